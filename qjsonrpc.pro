@@ -1,4 +1,5 @@
 TEMPLATE = subdirs
 SUBDIRS += src \
+           tools \
            tests
 CONFIG += ordered
@@ -7,6 +7,8 @@ PRIVATE_HEADERS += \
     $${PWD}/qjson_p.h \
     $${PWD}/qjsonwriter_p.h \
     $${PWD}/qjsonparser_p.h \
+    $${PWD}/qjsondouble_p.h \
+    $${PWD}/qjsonbuilder_p.h \
     $${PWD}/qjsondocument.h \
     $${PWD}/qjsonobject.h \
     $${PWD}/qjsonvalue.h \
@@ -19,7 +21,9 @@ SOURCES += \
     $${PWD}/qjsonarray.cpp \
     $${PWD}/qjsonvalue.cpp \
     $${PWD}/qjsonwriter.cpp \
-    $${PWD}/qjsonparser.cpp
+    $${PWD}/qjsonparser.cpp \
+    $${PWD}/qjsondouble.cpp \
+    $${PWD}/qjsonbuilder.cpp
 
 
 json.files = \
@@ -56,6 +56,8 @@ void Data::compact()
     if (!compactionCounter)
         return;
 
+    dropIndexes();
+
     Base *base = header->root();
     int reserve = 0;
     if (base->is_object) {
@@ -125,8 +127,12 @@ void Data::compact()
 
 bool Data::valid() const
 {
+    if (alloc < int(sizeof(Header) + sizeof(Base)))
+        return false;
     if (header->tag != QJsonDocument::BinaryFormatTag || header->version != 1u)
         return false;
+    if (sizeof(Header) + header->root()->size > uint(alloc))
+        return false;
 
     bool res = false;
     if (header->root()->is_object)
@@ -195,6 +201,59 @@ int Object::indexOf(const QString &key, bool *exists)
     return min;
 }
 
+ObjectIndex::ObjectIndex(const Object *o, uint objectOffset)
+    : objectOffset(objectOffset),
+      next(0)
+{
+    // backwards, so that duplicates in binary data resolve like the binary
+    // search does
+    positions.reserve(o->length);
+    for (int i = (int)o->length - 1; i >= 0; --i)
+        positions.insert(o->entryAt(i)->key(), i);
+}
+
+const ObjectIndex *Data::objectIndex(const Object *o)
+{
+    if (o->length < (uint)ObjectIndex::MinimumLength)
+        return 0;
+
+    const uint objectOffset = offsetOf(o);
+    for (ObjectIndex *index = indexes; index; index = index->next) {
+        if (index->objectOffset == objectOffset)
+            return index;
+    }
+
+    // another reader may add the same one meanwhile, which only costs memory
+    ObjectIndex *index = new ObjectIndex(o, objectOffset);
+    for (;;) {
+        ObjectIndex *head = indexes;
+        index->next = head;
+        if (indexes.testAndSetOrdered(head, index))
+            return index;
+    }
+}
+
+int Data::indexOf(const Object *o, const QString &key, bool *exists)
+{
+    const ObjectIndex *index = objectIndex(o);
+    if (!index)
+        return const_cast<Object *>(o)->indexOf(key, exists);
+
+    QHash<QString, int>::const_iterator it = index->positions.constFind(key);
+    *exists = (it != index->positions.constEnd());
+    return *exists ? it.value() : -1;
+}
+
+void Data::dropIndexes()
+{
+    ObjectIndex *index = indexes.fetchAndStoreOrdered(0);
+    while (index) {
+        ObjectIndex *next = index->next;
+        delete index;
+        index = next;
+    }
+}
+
 bool Object::isValid() const
 {
     if (tableOffset + length*sizeof(offset) > size)
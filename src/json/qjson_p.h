@@ -51,6 +51,8 @@
 #include "qjsonarray.h"
 
 #include <qatomic.h>
+#include <qfile.h>
+#include <qhash.h>
 #include <qstring.h>
 #include <qendian.h>
 #include <qnumeric.h>
@@ -331,8 +333,14 @@ public:
         return !operator ==(str);
     }
     inline bool operator >=(const QString &str) const {
-        // ###
-        return toString() >= str;
+        const int l = qMin((int)d->length, str.length());
+        const qle_ushort *a = d->utf16;
+        const ushort *b = (const ushort *)str.constData();
+        for (int i = 0; i < l; ++i) {
+            if (a[i] != b[i])
+                return (ushort)a[i] > b[i];
+        }
+        return (int)d->length >= str.length();
     }
 
     inline bool operator<(const Latin1String &str) const;
@@ -385,16 +393,32 @@ public:
         return *this;
     }
 
+    // these compare in place, the keys are looked up far too often to be
+    // converted to a QString every time
     inline bool operator ==(const QString &str) const {
-//      return QLatin1String(d->latin1, d->length) == str;
-        return QString::fromLatin1(d->latin1, d->length) == str;
+        const int l = d->length;
+        if (l != str.length())
+            return false;
+        const uchar *a = (const uchar *)d->latin1;
+        const ushort *b = (const ushort *)str.constData();
+        for (int i = 0; i < l; ++i) {
+            if (a[i] != b[i])
+                return false;
+        }
+        return true;
     }
     inline bool operator !=(const QString &str) const {
         return !operator ==(str);
     }
     inline bool operator >=(const QString &str) const {
-//        return QLatin1String(d->latin1, d->length) >= str;
-        return QString::fromLatin1(d->latin1, d->length) >= str;
+        const int l = qMin((int)d->length, str.length());
+        const uchar *a = (const uchar *)d->latin1;
+        const ushort *b = (const ushort *)str.constData();
+        for (int i = 0; i < l; ++i) {
+            if (a[i] != b[i])
+                return a[i] > b[i];
+        }
+        return (int)d->length >= str.length();
     }
 
     inline bool operator ==(const Latin1String &str) const {
@@ -707,6 +731,20 @@ inline Base *Value::base(const Base *b) const
     return reinterpret_cast<Base *>(data(b));
 }
 
+// The positions of the keys of a large object, so that looking one up is a
+// single hash probe instead of a binary search comparing keys. Built on the
+// first lookup, they stay valid until the data is changed.
+class ObjectIndex {
+public:
+    enum { MinimumLength = 32 };
+
+    ObjectIndex(const Object *o, uint objectOffset);
+
+    uint objectOffset;
+    QHash<QString, int> positions;
+    ObjectIndex *next;
+};
+
 class Data {
 public:
     enum Validation {
@@ -723,13 +761,17 @@ public:
     };
     uint compactionCounter : 31;
     uint ownsData : 1;
+    Validation validation;
+    QFile *mappedFile;      // the file rawData is mapped from, unmapped with it
 
     inline Data(char *raw, int a)
-        : alloc(a), rawData(raw), compactionCounter(0), ownsData(true)
+        : alloc(a), rawData(raw), compactionCounter(0), ownsData(true),
+          validation(Unchecked), mappedFile(0)
     {
     }
     inline Data(int reserved, QJsonValue::Type valueType)
-        : rawData(0), compactionCounter(0), ownsData(true)
+        : rawData(0), compactionCounter(0), ownsData(true),
+          validation(Unchecked), mappedFile(0)
     {
         Q_ASSERT(valueType == QJsonValue::Array || valueType == QJsonValue::Object);
 
@@ -745,7 +787,7 @@ public:
         b->length = 0;
     }
     inline ~Data()
-    { if (ownsData) free(rawData); }
+    { dropIndexes(); if (ownsData) free(rawData); delete mappedFile; }
 
     uint offsetOf(const void *ptr) const { return (uint)(((char *)ptr - rawData)); }
 
@@ -762,8 +804,11 @@ public:
     Data *clone(Base *b, int reserve = 0)
     {
         int size = sizeof(Header) + b->size;
-        if (b == header->root() && int(ref) == 1 && alloc >= size + reserve)
+        // data that isn't owned, such as a mapped file, is never written to
+        if (b == header->root() && int(ref) == 1 && ownsData && alloc >= size + reserve) {
+            dropIndexes();
             return this;
+        }
 
         if (reserve) {
             if (reserve < 128)
@@ -784,6 +829,17 @@ public:
     void compact();
     bool valid() const;
 
+    // 0 for objects too small to be worth an index
+    const ObjectIndex *objectIndex(const Object *o);
+    int indexOf(const Object *o, const QString &key, bool *exists);
+
+    // to be called before changing the data in place
+    void dropIndexes();
+
+    // readers sharing the data may add indexes concurrently, all changes
+    // happen when it isn't shared
+    QAtomicPointer<ObjectIndex> indexes;
+
 private:
     Q_DISABLE_COPY(Data)
 };
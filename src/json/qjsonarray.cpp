@@ -39,6 +39,7 @@
 #include <qdebug.h>
 
 #include "qjsonwriter_p.h"
+#include "qjsonbuilder_p.h"
 #include "qjson_p.h"
 
 QT_BEGIN_NAMESPACE
@@ -239,10 +240,11 @@ QJsonArray &QJsonArray::operator =(const QJsonArray &other)
  */
 QJsonArray QJsonArray::fromStringList(const QStringList &list)
 {
-    QJsonArray array;
+    QJsonArrayBuilder builder;
+    builder.reserve(list.size());
     for (QStringList::const_iterator it = list.constBegin(); it != list.constEnd(); ++it)
-        array.append(QJsonValue(*it));
-    return array;
+        builder.append(QJsonValue(*it));
+    return builder.takeArray();
 }
 
 /*!
@@ -254,10 +256,11 @@ QJsonArray QJsonArray::fromStringList(const QStringList &list)
  */
 QJsonArray QJsonArray::fromVariantList(const QVariantList &list)
 {
-    QJsonArray array;
+    QJsonArrayBuilder builder;
+    builder.reserve(list.size());
     for (QVariantList::const_iterator it = list.constBegin(); it != list.constEnd(); ++it)
-        array.append(QJsonValue::fromVariant(*it));
-    return array;
+        builder.append(QJsonValue::fromVariant(*it));
+    return builder.takeArray();
 }
 
 /*!
@@ -1130,8 +1133,10 @@ void QJsonArray::detach(uint reserve)
     if (reserve == 0 && d->ref.load() == 1)
         return;
     */
-    if (reserve == 0 && int(d->ref) == 1)
+    if (reserve == 0 && int(d->ref) == 1 && d->ownsData) {
+        d->dropIndexes();
         return;
+    }
 
     QJsonPrivate::Data *x = d->clone(a, reserve);
     x->ref.ref();
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <qalgorithms.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qjsonbuilder_p.h"
+
+QT_BEGIN_NAMESPACE
+
+using namespace QJsonPrivate;
+
+Arena::Arena()
+    : raw(0),
+      used(sizeof(Header) + sizeof(Base)),
+      capacity(0)
+{
+}
+
+Arena::~Arena()
+{
+    free(raw);
+}
+
+char *Arena::allocate(int size, int tableLength, uint *offset)
+{
+    const int payload = used - int(sizeof(Header));
+    if (payload + size + tableLength * int(sizeof(QJsonPrivate::offset)) >= Value::MaxSize) {
+        qWarning("QJson: Document too large to store in data structure %d %d %d",
+                 payload, size, Value::MaxSize);
+        return 0;
+    }
+
+    if (used + size > capacity) {
+        capacity = qMax(used + size, qMax(capacity * 2, 256));
+        raw = (char *)realloc(raw, capacity);
+        Q_CHECK_PTR(raw);
+    }
+
+    *offset = payload;
+    char *dest = raw + used;
+    used += size;
+    return dest;
+}
+
+Data *Arena::finish(bool isObject, int length, const void *table)
+{
+    const int tableSize = length * sizeof(QJsonPrivate::offset);
+    if (used + tableSize > capacity) {
+        capacity = used + tableSize;
+        raw = (char *)realloc(raw, capacity);
+        Q_CHECK_PTR(raw);
+    }
+    memcpy(raw + used, table, tableSize);
+
+    Header *h = (Header *)raw;
+    h->tag = QJsonDocument::BinaryFormatTag;
+    h->version = 1;
+    Base *b = h->root();
+    b->size = used + tableSize - sizeof(Header);
+    b->is_object = isObject;
+    b->length = length;
+    b->tableOffset = used - sizeof(Header);
+
+    // the spare capacity is left for later appends to grow into
+    Data *d = new Data(raw, capacity);
+    raw = 0;
+    clear();
+    return d;
+}
+
+void Arena::clear()
+{
+    free(raw);
+    raw = 0;
+    used = sizeof(Header) + sizeof(Base);
+    capacity = 0;
+}
+
+QJsonArrayBuilder::QJsonArrayBuilder()
+{
+}
+
+void QJsonArrayBuilder::reserve(int count)
+{
+    table.reserve(count);
+}
+
+void QJsonArrayBuilder::append(const QJsonValue &value)
+{
+    QJsonValue val = value;
+    bool compressed;
+    const int valueSize = Value::requiredStorage(val, &compressed);
+
+    uint valueOffset = 0;
+    char *dest = arena.allocate(valueSize, table.size() + 1, &valueOffset);
+    if (!dest)
+        return;
+
+    Value v;
+    v._dummy = 0;
+    v.type = (val.type() == QJsonValue::Undefined ? QJsonValue::Null : val.type());
+    v.latinOrIntValue = compressed;
+    v.latinKey = false;
+    v.value = Value::valueToStore(val, valueOffset);
+    if (valueSize)
+        Value::copyData(val, dest, compressed);
+    table.append(v);
+}
+
+QJsonArray QJsonArrayBuilder::takeArray()
+{
+    if (table.isEmpty())
+        return QJsonArray();
+
+    Data *d = arena.finish(false, table.size(), table.constData());
+    table.clear();
+    return d->toArray(static_cast<Array *>(d->header->root()));
+}
+
+QJsonObjectBuilder::QJsonObjectBuilder()
+    : sorted(true)
+{
+}
+
+void QJsonObjectBuilder::reserve(int count)
+{
+    items.reserve(count);
+}
+
+void QJsonObjectBuilder::insert(const QString &key, const QJsonValue &value)
+{
+    Item item;
+    item.key = key;
+    item.offset = -1;
+
+    if (value.type() != QJsonValue::Undefined) {
+        QJsonValue val = value;
+        bool latinOrIntValue;
+        const int valueSize = Value::requiredStorage(val, &latinOrIntValue);
+
+        const bool latinKey = useCompressed(key);
+        const int valueOffset = sizeof(Entry) + qStringSize(key, latinKey);
+
+        uint entryOffset = 0;
+        char *dest = arena.allocate(valueOffset + valueSize, items.size() + 1, &entryOffset);
+        if (!dest)
+            return;
+
+        Entry *e = (Entry *)dest;
+        e->value._dummy = 0;
+        e->value.type = val.type();
+        e->value.latinKey = latinKey;
+        e->value.latinOrIntValue = latinOrIntValue;
+        e->value.value = Value::valueToStore(val, entryOffset + valueOffset);
+        copyString(dest + sizeof(Entry), key, latinKey);
+        if (valueSize)
+            Value::copyData(val, dest + valueOffset, latinOrIntValue);
+        item.offset = entryOffset;
+    }
+
+    // maps and generated keys usually arrive in order already
+    if (sorted && !items.isEmpty() && !(items.last().key < key))
+        sorted = false;
+    items.append(item);
+}
+
+QJsonObject QJsonObjectBuilder::takeObject()
+{
+    if (!sorted)
+        qStableSort(items.begin(), items.end(), keyLessThan);
+
+    // equal keys are next to each other in the order they were inserted
+    QVector<offset> table;
+    table.reserve(items.size());
+    uint unused = 0;
+    for (int i = 0; i < items.size(); ++i) {
+        const Item &item = items.at(i);
+        if (i + 1 < items.size() && items.at(i + 1).key == item.key) {
+            if (item.offset >= 0)
+                ++unused;
+            continue;
+        }
+        if (item.offset < 0)
+            continue;
+
+        offset entry;
+        entry = item.offset;
+        table.append(entry);
+    }
+
+    items.clear();
+    sorted = true;
+    if (table.isEmpty()) {
+        arena.clear();
+        return QJsonObject();
+    }
+
+    Data *d = arena.finish(true, table.size(), table.constData());
+    d->compactionCounter = unused;
+    return d->toObject(static_cast<Object *>(d->header->root()));
+}
+
+QT_END_NAMESPACE
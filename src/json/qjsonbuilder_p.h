@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONBUILDER_P_H
+#define QJSONBUILDER_P_H
+
+#include <qvector.h>
+
+#include "qjsonarray.h"
+#include "qjsonobject.h"
+#include "qjson_p.h"
+
+QT_BEGIN_NAMESPACE
+
+namespace QJsonPrivate {
+
+// The memory of a document under construction. Values are written at their
+// final offsets, behind room for the header and the base, and the table is
+// appended when it's handed over to a Data.
+class Arena
+{
+public:
+    Arena();
+    ~Arena();
+
+    // \a size bytes at *\a offset from the base, 0 if the document would
+    // grow too large with a table of \a tableLength entries
+    char *allocate(int size, int tableLength, uint *offset);
+
+    Data *finish(bool isObject, int length, const void *table);
+    void clear();
+
+private:
+    char *raw;
+    int used;
+    int capacity;
+
+    Q_DISABLE_COPY(Arena)
+};
+
+}
+
+// Builds an array in one pass: the values are appended to a growing buffer
+// laid out like the binary format, and the table is added at the end, where
+// QJsonArray::append would move it for every value.
+class QJsonArrayBuilder
+{
+public:
+    QJsonArrayBuilder();
+
+    void reserve(int count);
+    int size() const { return table.size(); }
+
+    void append(const QJsonValue &value);
+
+    // the array built so far, the builder is empty afterwards
+    QJsonArray takeArray();
+
+private:
+    QJsonPrivate::Arena arena;
+    QVector<QJsonPrivate::Value> table;
+
+    Q_DISABLE_COPY(QJsonArrayBuilder)
+};
+
+// The same for objects, whose entries are sorted by key once they are all
+// known. As with QJsonObject::insert, the value inserted last for a key wins
+// and an undefined one removes the key.
+class QJsonObjectBuilder
+{
+public:
+    QJsonObjectBuilder();
+
+    void reserve(int count);
+
+    void insert(const QString &key, const QJsonValue &value);
+
+    // the object built so far, the builder is empty afterwards
+    QJsonObject takeObject();
+
+private:
+    struct Item {
+        QString key;
+        int offset;     // of the entry, -1 for a removed key
+    };
+    static bool keyLessThan(const Item &a, const Item &b) { return a.key < b.key; }
+
+    QJsonPrivate::Arena arena;
+    QVector<Item> items;
+    bool sorted;
+
+    Q_DISABLE_COPY(QJsonObjectBuilder)
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -38,6 +38,7 @@
 #include <qstringlist.h>
 #include <qvariant.h>
 #include <qdebug.h>
+#include <qfile.h>
 #include "qjsonwriter_p.h"
 #include "qjsonparser_p.h"
 #include "qjson_p.h"
@@ -184,9 +185,12 @@ QJsonDocument QJsonDocument::fromRawData(const char *data, int size, DataValidat
     QJsonPrivate::Data *d = new QJsonPrivate::Data((char *)data, size);
     d->ownsData = false;
 
-    if (validation != BypassValidation && !d->valid()) {
-        delete d;
-        return QJsonDocument();
+    if (validation != BypassValidation) {
+        if (!d->valid()) {
+            delete d;
+            return QJsonDocument();
+        }
+        d->validation = QJsonPrivate::Data::Validated;
     }
 
     return QJsonDocument(d);
@@ -241,14 +245,94 @@ QJsonDocument QJsonDocument::fromBinaryData(const QByteArray &data, DataValidati
     memcpy(raw, data.constData(), size);
     QJsonPrivate::Data *d = new QJsonPrivate::Data(raw, size);
 
-    if (validation != BypassValidation && !d->valid()) {
-        delete d;
+    if (validation != BypassValidation) {
+        if (!d->valid()) {
+            delete d;
+            return QJsonDocument();
+        }
+        d->validation = QJsonPrivate::Data::Validated;
+    }
+
+    return QJsonDocument(d);
+}
+
+/*!
+ Creates a QJsonDocument that uses the binary encoded JSON document stored in
+ the file \a fileName, as written by toBinaryData(), without reading it.
+
+ The file is mapped into memory and values are read from the mapping, so
+ that processes loading the same file share the pages of the system's file
+ cache. The file stays mapped as long as any QJsonDocument, QJsonObject or
+ QJsonArray still references its data; changing one of them copies the
+ data first. The file must not be modified meanwhile.
+
+ \a validation decides whether the data is checked for validity before being
+ used. Validating a large file reads all of it, with BypassValidation the
+ check can be made later with validate(). A file that cannot be mapped or
+ whose headers are invalid results in a null document either way.
+
+ \sa fromRawData(), fromBinaryData(), validate(), DataValidation
+ */
+QJsonDocument QJsonDocument::fromMappedFile(const QString &fileName, DataValidation validation)
+{
+    QFile *file = new QFile(fileName);
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        return QJsonDocument();
+    }
+
+    const qint64 fileSize = file->size();
+    uchar *data = 0;
+    if (fileSize >= qint64(sizeof(QJsonPrivate::Header) + sizeof(QJsonPrivate::Base)) &&
+        fileSize <= INT_MAX)
+        data = file->map(0, fileSize);
+    if (!data) {
+        delete file;
+        return QJsonDocument();
+    }
+
+    // the file may be larger than the document, any trailing data is ignored
+    const QJsonPrivate::Header *h = reinterpret_cast<const QJsonPrivate::Header *>(data);
+    const QJsonPrivate::Base *root = reinterpret_cast<const QJsonPrivate::Base *>(h + 1);
+    if (h->tag != QJsonDocument::BinaryFormatTag || h->version != 1u ||
+        sizeof(QJsonPrivate::Header) + root->size > quint64(fileSize)) {
+        delete file;
         return QJsonDocument();
     }
 
+    // mappings are page aligned, as fromRawData() requires
+    QJsonPrivate::Data *d = new QJsonPrivate::Data((char *)data, sizeof(QJsonPrivate::Header) + root->size);
+    d->ownsData = false;
+    d->mappedFile = file;
+
+    if (validation != BypassValidation) {
+        if (!d->valid()) {
+            delete d;
+            return QJsonDocument();
+        }
+        d->validation = QJsonPrivate::Data::Validated;
+    }
+
     return QJsonDocument(d);
 }
 
+/*!
+ Checks the binary data of the document, as done when it is created with
+ Validate, and returns \c true if it is valid. Meant for documents created
+ with BypassValidation, the check is only made once for all documents
+ sharing the data. Returns \c false for a null document.
+
+ \sa fromMappedFile(), fromRawData(), fromBinaryData()
+ */
+bool QJsonDocument::validate() const
+{
+    if (!d)
+        return false;
+    if (d->validation == QJsonPrivate::Data::Unchecked)
+        d->validation = d->valid() ? QJsonPrivate::Data::Validated : QJsonPrivate::Data::Invalid;
+    return d->validation == QJsonPrivate::Data::Validated;
+}
+
 /*!
  Creates a QJsonDocument from the QVariant \a variant.
 
@@ -98,6 +98,9 @@ public:
     static QJsonDocument fromBinaryData(const QByteArray &data, DataValidation validation  = Validate);
     QByteArray toBinaryData() const;
 
+    static QJsonDocument fromMappedFile(const QString &fileName, DataValidation validation = Validate);
+    bool validate() const;
+
     static QJsonDocument fromVariant(const QVariant &variant);
     QVariant toVariant() const;
 
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONDOUBLE_P_H
+#define QJSONDOUBLE_P_H
+
+#include <qglobal.h>
+
+QT_BEGIN_NAMESPACE
+
+namespace QJsonPrivate {
+
+// Converts mantissa * 10^exp10 to the nearest double with the Eisel-Lemire
+// algorithm. Returns false for the rare inputs it cannot round correctly
+// and for those outside the range of normal doubles, which are left to a
+// full conversion.
+bool eiselLemire(quint64 mantissa, int exp10, bool negative, double *result);
+
+}
+
+QT_END_NAMESPACE
+
+#endif
@@ -39,6 +39,7 @@
 #include <qvariant.h>
 #include "qjson_p.h"
 #include "qjsonwriter_p.h"
+#include "qjsonbuilder_p.h"
 
 QT_BEGIN_NAMESPACE
 
@@ -196,12 +197,12 @@ QJsonObject &QJsonObject::operator =(const QJsonObject &other)
  */
 QJsonObject QJsonObject::fromVariantMap(const QVariantMap &map)
 {
-    // ### this is implemented the trivial way, not the most efficient way
-
-    QJsonObject object;
+    // the keys of a map arrive sorted, the builder only has to append them
+    QJsonObjectBuilder builder;
+    builder.reserve(map.size());
     for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it)
-        object.insert(it.key(), QJsonValue::fromVariant(it.value()));
-    return object;
+        builder.insert(it.key(), QJsonValue::fromVariant(it.value()));
+    return builder.takeObject();
 }
 
 /*!
@@ -276,7 +277,7 @@ QJsonValue QJsonObject::value(const QString &key) const
         return QJsonValue(QJsonValue::Undefined);
 
     bool keyExists;
-    int i = o->indexOf(key, &keyExists);
+    int i = d->indexOf(o, key, &keyExists);
     if (!keyExists)
         return QJsonValue(QJsonValue::Undefined);
     return QJsonValue(d, o, o->entryAt(i)->value);
@@ -311,7 +312,7 @@ QJsonValueRef QJsonObject::operator [](const QString &key)
 {
     // ### somewhat inefficient, as we lookup the key twice if it doesn't yet exist
     bool keyExists = false;
-    int index = o ? o->indexOf(key, &keyExists) : -1;
+    int index = o ? d->indexOf(o, key, &keyExists) : -1;
     if (!keyExists) {
         iterator i = insert(key, QJsonValue());
         index = i.i;
@@ -387,7 +388,7 @@ void QJsonObject::remove(const QString &key)
         return;
 
     bool keyExists;
-    int index = o->indexOf(key, &keyExists);
+    int index = d->indexOf(o, key, &keyExists);
     if (!keyExists)
         return;
 
@@ -413,7 +414,7 @@ QJsonValue QJsonObject::take(const QString &key)
         return QJsonValue(QJsonValue::Undefined);
 
     bool keyExists;
-    int index = o->indexOf(key, &keyExists);
+    int index = d->indexOf(o, key, &keyExists);
     if (!keyExists)
         return QJsonValue(QJsonValue::Undefined);
 
@@ -438,7 +439,7 @@ bool QJsonObject::contains(const QString &key) const
         return false;
 
     bool keyExists;
-    o->indexOf(key, &keyExists);
+    d->indexOf(o, key, &keyExists);
     return keyExists;
 }
 
@@ -490,6 +491,7 @@ QJsonObject::iterator QJsonObject::erase(QJsonObject::iterator it)
 
     int index = it.i;
 
+    d->dropIndexes();
     o->removeItems(index, 1);
     ++d->compactionCounter;
     if (d->compactionCounter > 32u && d->compactionCounter >= unsigned(o->length) / 2u)
@@ -509,7 +511,7 @@ QJsonObject::iterator QJsonObject::erase(QJsonObject::iterator it)
 QJsonObject::iterator QJsonObject::find(const QString &key)
 {
     bool keyExists = false;
-    int index = o ? o->indexOf(key, &keyExists) : 0;
+    int index = o ? d->indexOf(o, key, &keyExists) : 0;
     if (!keyExists)
         return end();
     detach();
@@ -531,7 +533,7 @@ QJsonObject::iterator QJsonObject::find(const QString &key)
 QJsonObject::const_iterator QJsonObject::constFind(const QString &key) const
 {
     bool keyExists = false;
-    int index = o ? o->indexOf(key, &keyExists) : 0;
+    int index = o ? d->indexOf(o, key, &keyExists) : 0;
     if (!keyExists)
         return end();
     return const_iterator(this, index);
@@ -1013,8 +1015,10 @@ void QJsonObject::detach(uint reserve)
     if (reserve == 0 && d->ref.load() == 1)
         return;
     */
-    if (reserve == 0 && int(d->ref) == 1)
+    if (reserve == 0 && int(d->ref) == 1 && d->ownsData) {
+        d->dropIndexes();
         return;
+    }
 
     QJsonPrivate::Data *x = d->clone(o, reserve);
     x->ref.ref();
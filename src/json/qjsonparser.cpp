@@ -36,7 +36,20 @@
 #include <qcoreapplication.h>
 #endif
 #include <qdebug.h>
+#include <string.h>
+#include <float.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(Q_CC_MSVC)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "qjsonparser_p.h"
+#include "qjsondouble_p.h"
 #include "qjson_p.h"
 
 //#define PARSER_DEBUG
@@ -190,11 +203,106 @@ QString QJsonParseError::errorString() const
 using namespace QJsonPrivate;
 
 Parser::Parser(const char *json, int length)
-    : head(json), json(json), data(0), dataLength(0), current(0), nestingLevel(0), lastError(QJsonParseError::NoError)
+    : head(json), json(json), data(0), dataLength(0), scratch(false), current(0), nestingLevel(0), lastError(QJsonParseError::NoError)
 {
     end = json + length;
 }
 
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#   define QJSON_HAS_THREAD_LOCAL
+#endif
+
+#if defined(QJSON_HAS_THREAD_LOCAL)
+// The buffer documents are parsed into on a thread, reused so that parsing
+// many small documents doesn't allocate and grow a new one for each. Parsed
+// documents get a copy of their part, large ones take the buffer itself.
+enum {
+    MaximumCopyLength = 64 * 1024,
+    MaximumScratchLength = 1024 * 1024
+};
+
+struct ScratchBuffer
+{
+    ScratchBuffer() : data(0), length(0), inUse(false) {}
+    ~ScratchBuffer() { free(data); }
+
+    char *data;
+    int length;
+    bool inUse;
+};
+
+static ScratchBuffer &scratchBuffer()
+{
+    static thread_local ScratchBuffer buffer;
+    return buffer;
+}
+#endif
+
+void Parser::acquireData()
+{
+    dataLength = qMax(end - json, (ptrdiff_t) 256);
+#if defined(QJSON_HAS_THREAD_LOCAL)
+    ScratchBuffer &buffer = scratchBuffer();
+    if (!buffer.inUse) {
+        if (buffer.length < dataLength) {
+            free(buffer.data);
+            buffer.data = (char *)malloc(dataLength);
+            buffer.length = dataLength;
+        }
+        buffer.inUse = true;
+        scratch = true;
+        data = buffer.data;
+        dataLength = buffer.length;
+        return;
+    }
+#endif
+    data = (char *)malloc(dataLength);
+}
+
+// the data of a parsed document, handed over to it
+char *Parser::takeData()
+{
+#if defined(QJSON_HAS_THREAD_LOCAL)
+    if (scratch) {
+        if (current <= MaximumCopyLength) {
+            char *copy = (char *)malloc(current);
+            memcpy(copy, data, current);
+            releaseData();
+            return copy;
+        }
+
+        // too large to be worth copying, the document takes the buffer
+        ScratchBuffer &buffer = scratchBuffer();
+        buffer.data = 0;
+        buffer.length = 0;
+        buffer.inUse = false;
+        scratch = false;
+    }
+#endif
+    return data;
+}
+
+void Parser::releaseData()
+{
+#if defined(QJSON_HAS_THREAD_LOCAL)
+    if (scratch) {
+        ScratchBuffer &buffer = scratchBuffer();
+        buffer.inUse = false;
+        scratch = false;
+
+        // reserveSpace may have moved it
+        if (dataLength <= MaximumScratchLength) {
+            buffer.data = data;
+            buffer.length = dataLength;
+            return;
+        }
+        buffer.data = 0;
+        buffer.length = 0;
+    }
+#endif
+    free(data);
+}
+
 
 
 /*
@@ -237,6 +345,89 @@ enum {
     Quote = 0x22
 };
 
+#if defined(__SSE2__)
+static inline int firstSetBit(int mask)
+{
+#if defined(Q_CC_MSVC)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Skips whitespace 16 bytes at a time, returns the first other byte or the
+// start of the tail too short for a block
+static inline const char *skipWhitespaceBlocks(const char *json, const char *end)
+{
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(Space);
+    const __m128i tab = _mm_set1_epi8(Tab);
+    const __m128i lineFeed = _mm_set1_epi8(LineFeed);
+    const __m128i cr = _mm_set1_epi8(Return);
+    while (end - json >= 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(json));
+        const __m128i ws =
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab)),
+                         _mm_or_si128(_mm_cmpeq_epi8(block, lineFeed), _mm_cmpeq_epi8(block, cr)));
+        const int other = _mm_movemask_epi8(ws) ^ 0xffff;
+        if (other)
+            return json + firstSetBit(other);
+        json += 16;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    while (end - json >= 16) {
+        const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(json));
+        const uint8x16_t ws =
+            vorrq_u8(vorrq_u8(vceqq_u8(block, vdupq_n_u8(Space)), vceqq_u8(block, vdupq_n_u8(Tab))),
+                     vorrq_u8(vceqq_u8(block, vdupq_n_u8(LineFeed)), vceqq_u8(block, vdupq_n_u8(Return))));
+        const uint64x2_t lanes = vreinterpretq_u64_u8(ws);
+        if (~(vgetq_lane_u64(lanes, 0) & vgetq_lane_u64(lanes, 1)))
+            return json;    // the scalar loop finds the exact position
+        json += 16;
+    }
+#else
+    Q_UNUSED(end)
+#endif
+    return json;
+}
+
+// Returns the first quote, backslash or non-ASCII byte in [json, end), or
+// end. Everything before it is copied as is into a string.
+static inline const char *findStringSpecial(const char *json, const char *end)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8(Quote);
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - json >= 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(json));
+        const __m128i special =
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash));
+        // the sign bit is set for the bytes of multi-byte UTF-8 sequences
+        const int mask = _mm_movemask_epi8(_mm_or_si128(special, block));
+        if (mask)
+            return json + firstSetBit(mask);
+        json += 16;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    while (end - json >= 16) {
+        const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(json));
+        const uint8x16_t special =
+            vorrq_u8(vorrq_u8(vceqq_u8(block, vdupq_n_u8(Quote)), vceqq_u8(block, vdupq_n_u8('\\'))),
+                     vcgeq_u8(block, vdupq_n_u8(0x80)));
+        const uint64x2_t lanes = vreinterpretq_u64_u8(special);
+        if (vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1))
+            break;
+        json += 16;
+    }
+#endif
+    while (json < end && *json != Quote && *json != '\\' && uchar(*json) < 0x80)
+        ++json;
+    return json;
+}
+
 void Parser::eatBOM()
 {
     // eat UTF-8 byte order mark
@@ -250,6 +441,13 @@ void Parser::eatBOM()
 
 bool Parser::eatSpace()
 {
+    // most tokens are preceded by no whitespace or a single space, longer
+    // runs like indentation are skipped in blocks
+    if (json < end && *json > Space)
+        return true;
+    if (end - json > 16 && json[1] <= Space)
+        json = skipWhitespaceBlocks(json, end);
+
     while (json < end) {
         if (*json > Space)
             break;
@@ -295,8 +493,7 @@ QJsonDocument Parser::parse(QJsonParseError *error)
     qDebug() << ">>>>> parser begin";
 #endif
     // allocate some space
-    dataLength = qMax(end - json, (ptrdiff_t) 256);
-    data = (char *)malloc(dataLength);
+    acquireData();
 
     // fill in Header data
     QJsonPrivate::Header *h = (QJsonPrivate::Header *)data;
@@ -332,7 +529,7 @@ QJsonDocument Parser::parse(QJsonParseError *error)
             error->offset = 0;
             error->error = QJsonParseError::NoError;
         }
-        QJsonPrivate::Data *d = new QJsonPrivate::Data(data, current);
+        QJsonPrivate::Data *d = new QJsonPrivate::Data(takeData(), current);
         return QJsonDocument(d);
     }
 
@@ -344,7 +541,7 @@ error:
         error->offset = json - head;
         error->error  = lastError;
     }
-    free(data);
+    releaseData();
     return QJsonDocument();
 }
 
@@ -660,6 +857,12 @@ bool Parser::parseValue(QJsonPrivate::Value *val, int baseOffset)
 
 */
 
+// powers of ten that are exact doubles
+static const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
 bool Parser::parseNumber(QJsonPrivate::Value *val, int baseOffset)
 {
     BEGIN << "parseNumber" << json;
@@ -668,34 +871,75 @@ bool Parser::parseNumber(QJsonPrivate::Value *val, int baseOffset)
     const char *start = json;
     bool isInt = true;
 
+    // the literal is read as mantissa * 10^exponent while it is scanned,
+    // keeping up to 19 significant digits
+    bool negative = false;
+    bool exact = true;
+    bool wellFormed = true;
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+
     // minus
-    if (json < end && *json == '-')
+    if (json < end && *json == '-') {
+        negative = true;
         ++json;
+    }
 
     // int = zero / ( digit1-9 *DIGIT )
     if (json < end && *json == '0') {
         ++json;
     } else {
-        while (json < end && *json >= '0' && *json <= '9')
+        const char *intStart = json;
+        while (json < end && *json >= '0' && *json <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + uint(*json - '0');
+                if (mantissa)
+                    ++digits;
+            } else {
+                exact = false;
+                ++exponent;
+            }
             ++json;
+        }
+        wellFormed = json != intStart;
     }
 
     // frac = decimal-point 1*DIGIT
     if (json < end && *json == '.') {
         isInt = false;
         ++json;
-        while (json < end && *json >= '0' && *json <= '9')
+        const char *fracStart = json;
+        while (json < end && *json >= '0' && *json <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + uint(*json - '0');
+                if (mantissa)
+                    ++digits;
+                --exponent;
+            } else {
+                exact = false;
+            }
             ++json;
+        }
+        wellFormed = wellFormed && json != fracStart;
     }
 
     // exp = e [ minus / plus ] 1*DIGIT
     if (json < end && (*json == 'e' || *json == 'E')) {
         isInt = false;
         ++json;
+        bool negativeExponent = false;
         if (json < end && (*json == '-' || *json == '+'))
+            negativeExponent = (*json++ == '-');
+        const char *expStart = json;
+        int value = 0;
+        while (json < end && *json >= '0' && *json <= '9') {
+            if (value < 100000)
+                value = value * 10 + (*json - '0');
             ++json;
-        while (json < end && *json >= '0' && *json <= '9')
-            ++json;
+        }
+        wellFormed = wellFormed && json != expStart;
+        exponent += negativeExponent ? -value : value;
     }
 
     if (json >= end) {
@@ -703,30 +947,47 @@ bool Parser::parseNumber(QJsonPrivate::Value *val, int baseOffset)
         return false;
     }
 
-    QByteArray number(start, json - start);
-    DEBUG << "numberstring" << number;
-
-    if (isInt) {
-        bool ok;
-        int n = number.toInt(&ok);
-        if (ok && n < (1<<25) && n > -(1<<25)) {
-            val->int_value = n;
-            val->latinOrIntValue = true;
-            END;
-            return true;
-        }
+    if (isInt && exact && wellFormed && mantissa < (1<<25)) {
+        val->int_value = negative ? -int(mantissa) : int(mantissa);
+        val->latinOrIntValue = true;
+        END;
+        return true;
     }
 
-    bool ok;
     union {
         quint64 ui;
         double d;
     };
-    d = number.toDouble(&ok);
 
-    if (!ok) {
-        lastError = QJsonParseError::IllegalNumber;
-        return false;
+    bool converted = false;
+    if (exact && wellFormed) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+        // both operands are exact, so is the correctly rounded result
+        if (mantissa <= (Q_UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+            d = double(mantissa);
+            if (exponent < 0)
+                d /= exactPowersOfTen[-exponent];
+            else
+                d *= exactPowersOfTen[exponent];
+            if (negative)
+                d = -d;
+            converted = true;
+        }
+#endif
+        if (!converted)
+            converted = QJsonPrivate::eiselLemire(mantissa, exponent, negative, &d);
+    }
+
+    if (!converted) {
+        QByteArray number(start, json - start);
+        DEBUG << "numberstring" << number;
+
+        bool ok;
+        d = number.toDouble(&ok);
+        if (!ok) {
+            lastError = QJsonParseError::IllegalNumber;
+            return false;
+        }
     }
 
     int pos = reserveSpace(sizeof(double));
@@ -891,6 +1152,17 @@ bool Parser::parseString(bool *latin1)
     int stringPos = reserveSpace(2);
     BEGIN << "parse string stringPos=" << stringPos << json;
     while (json < end) {
+        // runs of plain ASCII are copied as they are, up to the length a
+        // latin1 string can hold
+        const char *special = findStringSpecial(json, end);
+        const int run = qMin(int(special - json), int(0x7fff - (json - start)));
+        if (run > 0) {
+            int pos = reserveSpace(run);
+            memcpy(data + pos, json, run);
+            json += run;
+            continue;
+        }
+
         uint ch = 0;
         if (*json == '"')
             break;
@@ -939,6 +1211,16 @@ bool Parser::parseString(bool *latin1)
     current = outStart + sizeof(int);
 
     while (json < end) {
+        const char *special = findStringSpecial(json, end);
+        if (special != json) {
+            const int run = int(special - json);
+            int pos = reserveSpace(2 * run);
+            for (int i = 0; i < run; ++i)
+                *(QJsonPrivate::qle_ushort *)(data + pos + 2 * i) = ushort(uchar(json[i]));
+            json = special;
+            continue;
+        }
+
         uint ch = 0;
         if (*json == '"')
             break;
@@ -93,12 +93,17 @@ private:
     bool parseString(bool *latin1);
     bool parseValue(QJsonPrivate::Value *val, int baseOffset);
     bool parseNumber(QJsonPrivate::Value *val, int baseOffset);
+    void acquireData();
+    char *takeData();
+    void releaseData();
+
     const char *head;
     const char *json;
     const char *end;
 
     char *data;
     int dataLength;
+    bool scratch;   // data is the buffer of the thread, kept between documents
     int current;
     int nestingLevel;
     QJsonParseError::ParseError lastError;
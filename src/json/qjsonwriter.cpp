@@ -35,6 +35,15 @@
 #include "qjsonwriter_p.h"
 #include "qjson_p.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(Q_CC_MSVC)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
 using namespace QJsonPrivate;
@@ -62,26 +71,160 @@ static inline uchar hexdig(uint u)
     return (u < 0xa ? '0' + u : 'a' + u - 0xa);
 }
 
-static QByteArray escapedString(const QString &s)
+#if defined(__SSE2__)
+static inline int firstSetBit(int mask)
+{
+#if defined(Q_CC_MSVC)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Narrows 8 UTF-16 units to \a cursor and returns how many of them in a row
+// were printable ASCII needing no escape, the rest of the 8 bytes is garbage
+static inline int copyPlainUtf16(const QChar *ch, uchar *cursor)
+{
+#if defined(__SSE2__)
+    // the signed saturation turns everything beyond Latin-1 into 0 or 0xff,
+    // and the signed compare below catches both along with the controls
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ch));
+    const __m128i bytes = _mm_packus_epi16(block, block);
+    const __m128i special =
+        _mm_or_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20)),
+                     _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')),
+                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(cursor), bytes);
+    const int mask = _mm_movemask_epi8(special) & 0xff;
+    return mask ? firstSetBit(mask) : 8;
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    const uint8x8_t bytes = vqmovn_u16(vld1q_u16(reinterpret_cast<const uint16_t *>(ch)));
+    const uint8x8_t special =
+        vorr_u8(vorr_u8(vclt_u8(bytes, vdup_n_u8(0x20)), vcge_u8(bytes, vdup_n_u8(0x80))),
+                vorr_u8(vceq_u8(bytes, vdup_n_u8('"')), vceq_u8(bytes, vdup_n_u8('\\'))));
+    vst1_u8(cursor, bytes);
+    const quint64 mask = vget_lane_u64(vreinterpret_u64_u8(special), 0);
+    return mask ? __builtin_ctzll(mask) / 8 : 8;
+#else
+    Q_UNUSED(ch)
+    Q_UNUSED(cursor)
+    return 0;
+#endif
+}
+
+// The same for 16 Latin-1 characters
+static inline int copyPlainLatin1(const uchar *ch, uchar *cursor)
+{
+#if defined(__SSE2__)
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ch));
+    const __m128i special =
+        _mm_or_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20)),
+                     _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')),
+                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(cursor), bytes);
+    const int mask = _mm_movemask_epi8(special);
+    return mask ? firstSetBit(mask) : 16;
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    const uint8x16_t bytes = vld1q_u8(ch);
+    const uint8x16_t special =
+        vorrq_u8(vorrq_u8(vcltq_u8(bytes, vdupq_n_u8(0x20)), vcgeq_u8(bytes, vdupq_n_u8(0x80))),
+                 vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('"')), vceqq_u8(bytes, vdupq_n_u8('\\'))));
+    vst1q_u8(cursor, bytes);
+    const uint64x2_t lanes = vreinterpretq_u64_u8(special);
+    const quint64 low = vgetq_lane_u64(lanes, 0);
+    if (low)
+        return __builtin_ctzll(low) / 8;
+    const quint64 high = vgetq_lane_u64(lanes, 1);
+    return high ? 8 + __builtin_ctzll(high) / 8 : 16;
+#else
+    Q_UNUSED(ch)
+    Q_UNUSED(cursor)
+    return 0;
+#endif
+}
+
+static inline uchar *escapeAscii(uchar *cursor, uint u)
+{
+    *cursor++ = '\\';
+    switch (u) {
+    case 0x22:
+        *cursor++ = '"';
+        break;
+    case 0x5c:
+        *cursor++ = '\\';
+        break;
+    case 0x8:
+        *cursor++ = 'b';
+        break;
+    case 0xc:
+        *cursor++ = 'f';
+        break;
+    case 0xa:
+        *cursor++ = 'n';
+        break;
+    case 0xd:
+        *cursor++ = 'r';
+        break;
+    case 0x9:
+        *cursor++ = 't';
+        break;
+    default:
+        *cursor++ = 'u';
+        *cursor++ = '0';
+        *cursor++ = '0';
+        *cursor++ = hexdig(u>>4);
+        *cursor++ = hexdig(u & 0xf);
+    }
+    return cursor;
+}
+
+// Makes room for \a needed more bytes after \a cursor, growing the output by
+// half at least, and returns the cursor in the reallocated data
+static inline uchar *growOutput(QByteArray &json, uchar *cursor, int needed)
+{
+    const int pos = cursor - (const uchar *)json.constData();
+    json.resize(qMax(pos + needed, json.size() + json.size() / 2));
+    return (uchar *)json.data() + pos;
+}
+
+// Escapes straight into the end of \a json, which the writer reserved for
+// the whole document, instead of building every string on its own
+static void appendEscaped(QByteArray &json, const QChar *ch, int length)
 {
     const uchar replacement = '?';
-    QByteArray ba(s.length(), Qt::Uninitialized);
+    const int start = json.size();
+    json.resize(start + length + 8);
 
-    uchar *cursor = (uchar *)ba.data();
-    const uchar *ba_end = cursor + ba.length();
+    uchar *cursor = (uchar *)json.data() + start;
+    const uchar *ba_end = (const uchar *)json.constData() + json.size();
 
-    const QChar *ch = (const QChar *)s.constData();
-    const QChar *end = ch + s.length();
+    const QChar *end = ch + length;
 
     int surrogate_high = -1;
 
     while (ch < end) {
-        if (cursor >= ba_end - 6) {
+        if (cursor > ba_end - 8) {
             // ensure we have enough space
-            int pos = cursor - (const uchar *)ba.constData();
-            ba.resize(ba.size()*2);
-            cursor = (uchar *)ba.data() + pos;
-            ba_end = (const uchar *)ba.constData() + ba.length();
+            cursor = growOutput(json, cursor, (end - ch) + 8);
+            ba_end = (const uchar *)json.constData() + json.size();
+        }
+
+        if (surrogate_high < 0) {
+            // copy the plain runs in blocks
+            while (end - ch >= 8 && ba_end - cursor >= 8) {
+                const int plain = copyPlainUtf16(ch, cursor);
+                ch += plain;
+                cursor += plain;
+                if (plain < 8)
+                    break;
+            }
+            if (ch == end)
+                break;
+            if (cursor > ba_end - 8)
+                continue;
         }
 
         uint u = ch->unicode();
@@ -108,40 +251,10 @@ static QByteArray escapedString(const QString &s)
         }
 
         if (u < 0x80) {
-            if (u < 0x20 || u == 0x22 || u == 0x5c) {
-                *cursor++ = '\\';
-                switch (u) {
-                case 0x22:
-                    *cursor++ = '"';
-                    break;
-                case 0x5c:
-                    *cursor++ = '\\';
-                    break;
-                case 0x8:
-                    *cursor++ = 'b';
-                    break;
-                case 0xc:
-                    *cursor++ = 'f';
-                    break;
-                case 0xa:
-                    *cursor++ = 'n';
-                    break;
-                case 0xd:
-                    *cursor++ = 'r';
-                    break;
-                case 0x9:
-                    *cursor++ = 't';
-                    break;
-                default:
-                    *cursor++ = 'u';
-                    *cursor++ = '0';
-                    *cursor++ = '0';
-                    *cursor++ = hexdig(u>>4);
-                    *cursor++ = hexdig(u & 0xf);
-               }
-            } else {
+            if (u < 0x20 || u == 0x22 || u == 0x5c)
+                cursor = escapeAscii(cursor, u);
+            else
                 *cursor++ = (uchar)u;
-            }
         } else {
             if (u < 0x0800) {
                 *cursor++ = 0xc0 | ((uchar) (u >> 6));
@@ -166,8 +279,66 @@ static QByteArray escapedString(const QString &s)
         ++ch;
     }
 
-    ba.resize(cursor - (const uchar *)ba.constData());
-    return ba;
+    json.resize(cursor - (const uchar *)json.constData());
+}
+
+// The binary format keeps short strings as Latin-1, these are written
+// without going through a QString
+static void appendEscaped(QByteArray &json, const uchar *ch, int length)
+{
+    const int start = json.size();
+    json.resize(start + length + 16);
+
+    uchar *cursor = (uchar *)json.data() + start;
+    const uchar *ba_end = (const uchar *)json.constData() + json.size();
+
+    const uchar *end = ch + length;
+
+    while (ch < end) {
+        if (cursor > ba_end - 16) {
+            cursor = growOutput(json, cursor, 2 * (end - ch) + 16);
+            ba_end = (const uchar *)json.constData() + json.size();
+        }
+
+        while (end - ch >= 16 && ba_end - cursor >= 16) {
+            const int plain = copyPlainLatin1(ch, cursor);
+            ch += plain;
+            cursor += plain;
+            if (plain < 16)
+                break;
+        }
+        if (ch == end)
+            break;
+        if (cursor > ba_end - 16)
+            continue;
+
+        const uint u = *ch++;
+        if (u >= 0x80) {
+            *cursor++ = 0xc0 | ((uchar) (u >> 6));
+            *cursor++ = 0x80 | ((uchar) (u&0x3f));
+        } else if (u < 0x20 || u == 0x22 || u == 0x5c) {
+            cursor = escapeAscii(cursor, u);
+        } else {
+            *cursor++ = (uchar)u;
+        }
+    }
+
+    json.resize(cursor - (const uchar *)json.constData());
+}
+
+static inline void appendEscaped(QByteArray &json, const QJsonPrivate::String &s)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    appendEscaped(json, (const QChar *)s.d->utf16, s.d->length);
+#else
+    const QString str = s.toString();
+    appendEscaped(json, str.constData(), str.length());
+#endif
+}
+
+static inline void appendEscaped(QByteArray &json, const QJsonPrivate::Latin1String &s)
+{
+    appendEscaped(json, (const uchar *)s.d->latin1, s.d->length);
 }
 
 static void valueToJson(const QJsonPrivate::Base *b, const QJsonPrivate::Value &v, QByteArray &json, int indent, bool compact)
@@ -187,7 +358,10 @@ static void valueToJson(const QJsonPrivate::Base *b, const QJsonPrivate::Value &
     }
     case QJsonValue::String:
         json += '"';
-        json += escapedString(v.toString(b));
+        if (v.latinOrIntValue)
+            appendEscaped(json, v.asLatin1String(b));
+        else
+            appendEscaped(json, v.asString(b));
         json += '"';
         break;
     case QJsonValue::Array:
@@ -243,7 +417,10 @@ static void objectContentToJson(const QJsonPrivate::Object *o, QByteArray &json,
         QJsonPrivate::Entry *e = o->entryAt(i);
         json += indentString;
         json += '"';
-        json += escapedString(e->key());
+        if (e->value.latinKey)
+            appendEscaped(json, e->shallowLatin1Key());
+        else
+            appendEscaped(json, e->shallowKey());
         json += compact ? "\":" : "\": ";
         valueToJson(o, e->value, json, indent, compact);
 
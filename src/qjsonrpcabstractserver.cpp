@@ -1,11 +1,239 @@
+#include <QPointer>
+#include <QThread>
+#include <QStringList>
+
 #include "qjsonrpcsocket.h"
+#include "qjsonrpcsocket_p.h"
 #include "qjsonrpcabstractserver_p.h"
 #include "qjsonrpcabstractserver.h"
+#include "qjsonrpcmessage.h"
 
 QJsonRpcAbstractServer::~QJsonRpcAbstractServer()
 {
 }
 
+bool QJsonRpcAbstractServer::subscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_UNUSED(client);
+    Q_UNUSED(topic);
+    return false;
+}
+
+bool QJsonRpcAbstractServer::unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_UNUSED(client);
+    Q_UNUSED(topic);
+    return false;
+}
+
+int QJsonRpcAbstractServer::subscriberCount(const QString &topic) const
+{
+    Q_UNUSED(topic);
+    return 0;
+}
+
+void QJsonRpcAbstractServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    Q_UNUSED(topic);
+    Q_UNUSED(message);
+}
+
+static inline QJsonRpcSocketPrivate *socketPrivate(QJsonRpcSocket *socket)
+{
+    return static_cast<QJsonRpcSocketPrivate*>(QJsonRpcAbstractSocketPrivate::get(socket));
+}
+
+QJsonRpcClientRegistry::Handle QJsonRpcClientRegistry::insert(QJsonRpcSocket *client)
+{
+    int slot = freeSlot;
+    if (slot == -1) {
+        Slot entry;
+        entry.generation = 1;
+        entry.index = -1;
+        slot = entries.size();
+        entries.append(entry);
+    } else {
+        freeSlot = entries.at(slot).index;
+    }
+
+    entries[slot].index = clients.size();
+    clients.append(client);
+    clientSlots.append(slot);
+
+    const Handle handle = (Handle(entries.at(slot).generation) << 32) | quint32(slot);
+    socketPrivate(client)->clientHandle = handle;
+    return handle;
+}
+
+bool QJsonRpcClientRegistry::remove(QJsonRpcSocket *client)
+{
+    QJsonRpcSocketPrivate *d = socketPrivate(client);
+    if (find(d->clientHandle) != client)
+        return false;
+
+    // the last client moves into the hole
+    const int slot = int(quint32(d->clientHandle));
+    const int index = entries.at(slot).index;
+    const int last = clients.size() - 1;
+    if (index != last) {
+        clients[index] = clients.at(last);
+        clientSlots[index] = clientSlots.at(last);
+        entries[clientSlots.at(index)].index = index;
+    }
+    clients.resize(last);
+    clientSlots.resize(last);
+
+    // a new generation, never 0, invalidates handles to the freed slot
+    Slot &entry = entries[slot];
+    if (!++entry.generation)
+        entry.generation = 1;
+    entry.index = freeSlot;
+    freeSlot = slot;
+    d->clientHandle = 0;
+    return true;
+}
+
+void QJsonRpcClientRegistry::clear()
+{
+    // slot by slot, so that handles still around stay stale
+    while (!clients.isEmpty())
+        remove(clients.last());
+}
+
+QJsonRpcSocket *QJsonRpcClientRegistry::find(Handle handle) const
+{
+    const int slot = int(quint32(handle));
+    if (!handle || slot >= entries.size() || entries.at(slot).generation != quint32(handle >> 32))
+        return 0;
+    return clients.at(entries.at(slot).index);
+}
+
+bool QJsonRpcClientRegistry::contains(QJsonRpcSocket *client) const
+{
+    return client && find(socketPrivate(client)->clientHandle) == client;
+}
+
+QJsonRpcIdleWheel::QJsonRpcIdleWheel(QJsonRpcAbstractServerPrivate *server, QObject *parent)
+    : QObject(parent),
+      server(server),
+      currentSlot(0),
+      ticks(0),
+      pending(0)
+{
+    wheel.resize(WheelSize);
+    timer.setInterval(Resolution);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+void QJsonRpcIdleWheel::add(QJsonRpcSocket *client)
+{
+    QJsonRpcSocketPrivate *d = socketPrivate(client);
+    d->idleTracked = true;
+    d->lastActivity = QJsonRpcMessagePrivate::monotonicMsecs();
+    schedule(d->clientHandle, d->idleTimeout > 0 ?
+             qMin(d->idleTimeout, int(IdleReleaseDelay)) : int(IdleReleaseDelay));
+}
+
+void QJsonRpcIdleWheel::schedule(QJsonRpcClientRegistry::Handle handle, qint64 msecs)
+{
+    if (!timer.isActive()) {
+        clock.start();
+        ticks = 0;
+        timer.start();
+    }
+
+    // never early, as with the deadlines of requests
+    const qint64 lateTicks = clock.elapsed() / Resolution - ticks;
+    const qint64 due = (qMax(msecs, Q_INT64_C(0)) + Resolution - 1) / Resolution + 1 + lateTicks;
+    Entry entry;
+    entry.handle = handle;
+    entry.rounds = int((due - 1) / WheelSize);
+    wheel[int((currentSlot + due) % WheelSize)].append(entry);
+    pending++;
+}
+
+void QJsonRpcIdleWheel::tick()
+{
+    const qint64 dueTicks = clock.elapsed() / Resolution;
+    while (ticks < dueTicks && pending > 0) {
+        ticks++;
+        currentSlot = (currentSlot + 1) % WheelSize;
+
+        // visits may schedule into this very slot, for a later round
+        QVector<Entry> due;
+        QVector<Entry> &entries = wheel[currentSlot];
+        for (int i = 0; i < entries.size(); ++i) {
+            if (entries.at(i).rounds > 0) {
+                entries[i].rounds--;
+                continue;
+            }
+            due.append(entries.at(i));
+            entries.remove(i--);
+        }
+
+        pending -= due.size();
+        for (int i = 0; i < due.size(); ++i)
+            visit(due.at(i).handle);
+    }
+
+    if (pending == 0)
+        timer.stop();
+}
+
+void QJsonRpcIdleWheel::visit(QJsonRpcClientRegistry::Handle handle)
+{
+    // clients are removed in this thread, one found stays until we return
+    QJsonRpcSocket *client;
+    {
+        QMutexLocker locker(&server->clientsMutex);
+        client = server->clients.find(handle);
+    }
+    if (!client)
+        return;
+
+    QJsonRpcSocketPrivate *d = socketPrivate(client);
+    const int interval = d->idleTimeout > 0 ?
+        qMin(d->idleTimeout, int(IdleReleaseDelay)) : int(IdleReleaseDelay);
+    const qint64 quiet = QJsonRpcMessagePrivate::monotonicMsecs() - d->lastActivity;
+    if (quiet < interval) {
+        schedule(handle, interval - quiet);
+        return;
+    }
+
+    d->releaseIdleBuffers();
+    const bool busy = d->incomingRequests > 0 || d->hasPendingRequests();
+    if (d->idleTimeout <= 0 || busy) {
+        schedule(handle, interval);
+    } else if (quiet < d->idleTimeout) {
+        schedule(handle, d->idleTimeout - quiet);
+    } else if (d->device) {
+        // disconnecting it removes the client
+        qJsonRpcDebug() << Q_FUNC_INFO << "closing connection idle for" << quiet << "msecs";
+        d->device.data()->close();
+    }
+}
+
+void QJsonRpcAbstractServerPrivate::configureSocket(QJsonRpcSocket *socket) const
+{
+    socket->setFramingMode(framingMode);
+    socket->setWriteCoalescingDelay(writeCoalescingDelay);
+    socket->setCodec(codec);
+    socket->setCompressionThreshold(compressionThreshold);
+    socket->setAttachmentsEnabled(attachmentsEnabled);
+    socket->setWriteBufferWaterMarks(highWaterMark, lowWaterMark);
+    socket->setMaximumIncomingRequests(maximumIncomingRequests);
+    socket->setMaximumFrameSize(maximumFrameSize);
+    socket->setMaximumMemoryUsage(maximumConnectionMemory);
+
+    // what connections hold is accounted as it drains too
+    QJsonRpcSocketPrivate *d = socket->d_func();
+    d->memoryAccount = memoryAccount;
+    d->idleTimeout = idleTimeout;
+    if (d->device)
+        QObject::connect(d->device.data(), SIGNAL(bytesWritten(qint64)), socket, SLOT(_q_bytesWritten()),
+                         Qt::UniqueConnection);
+}
+
 void QJsonRpcAbstractServerPrivate::_q_notifyConnectedClients(const QString &method,
                                                               const QJsonArray &params)
 {
@@ -14,8 +242,162 @@ void QJsonRpcAbstractServerPrivate::_q_notifyConnectedClients(const QString &met
     _q_notifyConnectedClients(notification);
 }
 
+static int qjsonRpcBroadcastType = qRegisterMetaType<QJsonRpcBroadcastPointer>("QJsonRpcBroadcastPointer");
+
+// written once the lock is released, a client dropped or disconnected by
+// a write must be able to remove itself
+static void writeBroadcast(const QList<QPointer<QJsonRpcSocket> > &clients,
+                           const QJsonRpcBroadcastPointer &broadcast)
+{
+    for (int i = 0; i < clients.size(); ++i) {
+        QJsonRpcSocket *client = clients.at(i).data();
+        if (!client)
+            continue;
+
+        if (client->thread() == QThread::currentThread())
+            client->d_func()->_q_writeBroadcast(broadcast);
+        else
+            QMetaObject::invokeMethod(client, "_q_writeBroadcast", Qt::QueuedConnection,
+                                      Q_ARG(QJsonRpcBroadcastPointer, broadcast));
+    }
+}
+
 void QJsonRpcAbstractServerPrivate::_q_notifyConnectedClients(const QJsonRpcMessage &message)
 {
-    for (int i = 0; i < clients.size(); ++i)
-        clients[i]->notify(message);
+    QList<QPointer<QJsonRpcSocket> > recipients;
+    {
+        QMutexLocker locker(&clientsMutex);
+        recipients.reserve(clients.size());
+        for (int i = 0; i < clients.size(); ++i)
+            recipients.append(clients.at(i));
+    }
+
+    // serialized once per wire format rather than once per client
+    QJsonRpcBroadcastPointer broadcast(new QJsonRpcBroadcast(message));
+    writeBroadcast(recipients, broadcast);
+}
+
+void QJsonRpcAbstractServerPrivate::_q_notifySubscribers(const QString &topic,
+                                                         const QJsonRpcMessage &message)
+{
+    QList<QPointer<QJsonRpcSocket> > recipients;
+    {
+        QMutexLocker locker(&clientsMutex);
+        QHash<QString, QSet<QJsonRpcSocket*> >::const_iterator it = subscribers.constFind(topic);
+        if (it == subscribers.constEnd())
+            return;
+
+        foreach (QJsonRpcSocket *client, it.value())
+            recipients.append(client);
+    }
+
+    QJsonRpcBroadcastPointer broadcast(new QJsonRpcBroadcast(message));
+    writeBroadcast(recipients, broadcast);
+}
+
+void QJsonRpcAbstractServerPrivate::removeClient(QJsonRpcSocket *socket)
+{
+    clients.remove(socket);
+    QHash<QJsonRpcSocket*, QSet<QString> >::iterator it = subscriptions.find(socket);
+    if (it == subscriptions.end())
+        return;
+
+    foreach (const QString &topic, it.value()) {
+        QHash<QString, QSet<QJsonRpcSocket*> >::iterator topicSubscribers = subscribers.find(topic);
+        topicSubscribers.value().remove(socket);
+        if (topicSubscribers.value().isEmpty())
+            subscribers.erase(topicSubscribers);
+    }
+    subscriptions.erase(it);
+}
+
+static QJsonRpcSocket *findClient(const QJsonRpcClientRegistry &clients,
+                                  QJsonRpcAbstractSocket *client)
+{
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcSocket*>(client);
+    return clients.contains(socket) ? socket : 0;
+}
+
+bool QJsonRpcAbstractServerPrivate::subscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    QMutexLocker locker(&clientsMutex);
+    QJsonRpcSocket *socket = findClient(clients, client);
+    if (!socket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "not a connected client";
+        return false;
+    }
+
+    subscribers[topic].insert(socket);
+    subscriptions[socket].insert(topic);
+    return true;
+}
+
+bool QJsonRpcAbstractServerPrivate::unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    QMutexLocker locker(&clientsMutex);
+    QJsonRpcSocket *socket = findClient(clients, client);
+    QHash<QJsonRpcSocket*, QSet<QString> >::iterator it = subscriptions.find(socket);
+    if (!socket || it == subscriptions.end() || !it.value().remove(topic))
+        return false;
+
+    if (it.value().isEmpty())
+        subscriptions.erase(it);
+
+    QHash<QString, QSet<QJsonRpcSocket*> >::iterator topicSubscribers = subscribers.find(topic);
+    topicSubscribers.value().remove(socket);
+    if (topicSubscribers.value().isEmpty())
+        subscribers.erase(topicSubscribers);
+    return true;
+}
+
+int QJsonRpcAbstractServerPrivate::subscriberCount(const QString &topic) const
+{
+    QMutexLocker locker(&clientsMutex);
+    return subscribers.value(topic).size();
+}
+
+bool QJsonRpcAbstractServerPrivate::processSubscription(QJsonRpcSocket *socket,
+                                                        const QJsonRpcMessage &message)
+{
+    if (message.type() != QJsonRpcMessage::Request &&
+        message.type() != QJsonRpcMessage::Notification)
+        return false;
+
+    const QString method = message.method();
+    const bool subscribing = (method == QLatin1String("rpc.subscribe"));
+    if (!subscribing && method != QLatin1String("rpc.unsubscribe"))
+        return false;
+
+    // either a list of topics or {"topics": [...]}
+    QJsonValue params = message.params();
+    if (params.isObject())
+        params = params.toObject().value(QLatin1String("topics"));
+
+    QStringList topics;
+    const QJsonArray array = params.toArray();
+    for (int i = 0; i < array.size(); ++i) {
+        if (!array.at(i).isString()) {
+            topics.clear();
+            break;
+        }
+        topics.append(array.at(i).toString());
+    }
+
+    if (topics.isEmpty()) {
+        if (message.type() == QJsonRpcMessage::Request)
+            socket->notify(message.createErrorResponse(QJsonRpc::InvalidParams,
+                                                       "expected a list of topics"));
+        return true;
+    }
+
+    foreach (const QString &topic, topics) {
+        if (subscribing)
+            subscribe(socket, topic);
+        else
+            unsubscribe(socket, topic);
+    }
+
+    if (message.type() == QJsonRpcMessage::Request)
+        socket->notify(message.createResponse(QJsonValue(true)));
+    return true;
 }
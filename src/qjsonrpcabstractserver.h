@@ -20,8 +20,24 @@
 #include "qjsonrpcserviceprovider.h"
 #include "qjsonrpcglobal.h"
 
+class QString;
 class QJsonArray;
 class QJsonRpcMessage;
+class QJsonRpcAbstractSocket;
+class QJsonRpcCodec;
+
+// Memory held by the connections of a server for their peers: data received
+// and not processed yet and data waiting to be written, see
+// QJsonRpcSocket::memoryUsage()
+struct QJsonRpcMemoryStats
+{
+    QJsonRpcMemoryStats() : bytes(0), peakBytes(0), droppedConnections(0) {}
+
+    qint64 bytes;               // by all connections right now
+    qint64 peakBytes;           // the most they held at once
+    int droppedConnections;     // aborted for exceeding their limits
+};
+
 class QJsonRpcAbstractServerPrivate;
 class QJSONRPC_EXPORT QJsonRpcAbstractServer : public QJsonRpcServiceProvider
 {
@@ -29,6 +45,16 @@ public:
     virtual ~QJsonRpcAbstractServer();
     virtual int connectedClientCount() const = 0;
 
+    // Clients receive the notifications of the topics they subscribed to,
+    // either through the built-in rpc.subscribe and rpc.unsubscribe methods,
+    // which take a list of topics, or through these, e.g. from a service
+    // with currentRequest().socket(). All of them are thread-safe. Servers
+    // without topics keep the defaults, which subscribe nobody and notify
+    // no one.
+    virtual bool subscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual bool unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual int subscriberCount(const QString &topic) const;
+
 // Q_SIGNALS:
     virtual void clientConnected() = 0;
     virtual void clientDisconnected() = 0;
@@ -36,6 +62,7 @@ public:
 // public Q_SLOTS:
     virtual void notifyConnectedClients(const QJsonRpcMessage &message) = 0;
     virtual void notifyConnectedClients(const QString &method, const QJsonArray &params) = 0;
+    virtual void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
 
 };
 
@@ -17,9 +17,95 @@
 #ifndef QJSONRPCABSTRACTSERVER_P_H
 #define QJSONRPCABSTRACTSERVER_P_H
 
+#include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+
 #include "qjsonrpcabstractserver.h"
+#include "qjsonrpcsocket_p.h"
 
 class QJsonRpcSocket;
+class QJsonRpcAbstractSocket;
+
+// The connected clients of a server as a slot map. A client's handle is the
+// index of its slot along with the slot's generation, which changes whenever
+// the slot is freed, so stale handles never match the slot's next client.
+// Clients are kept contiguous for broadcasts, the last one taking the place
+// of one removed, and each knows its own handle: adding, removing and
+// finding clients are O(1) whatever their number.
+class QJsonRpcClientRegistry
+{
+public:
+    typedef quint64 Handle;     // 0 is never one
+
+    QJsonRpcClientRegistry() : freeSlot(-1) {}
+
+    Handle insert(QJsonRpcSocket *client);
+    bool remove(QJsonRpcSocket *client);
+    void clear();
+
+    QJsonRpcSocket *find(Handle handle) const;
+    bool contains(QJsonRpcSocket *client) const;
+    int size() const { return clients.size(); }
+    bool isEmpty() const { return clients.isEmpty(); }
+    QJsonRpcSocket *at(int i) const { return clients.at(i); }
+
+private:
+    struct Slot
+    {
+        quint32 generation;
+        int index;      // of its client, or of the next free slot if free
+    };
+    QVector<Slot> entries;
+    QVector<QJsonRpcSocket*> clients;
+    QVector<int> clientSlots;       // of each client
+    int freeSlot;                   // first of the free list, -1 if none
+};
+
+// Looks after the idle connections of a server living in one thread. Each
+// connection sits in the slot of a hashed timing wheel it is next due in,
+// traffic only stamps it, and when its slot comes up one found quiet for
+// IdleReleaseDelay gives back its buffers, one quiet for its idle timeout
+// is closed, and every other moves on to the slot of its next deadline. So
+// the wheel does nothing per message, and little per idle connection.
+class QJsonRpcAbstractServerPrivate;
+class QJsonRpcIdleWheel : public QObject
+{
+    Q_OBJECT
+public:
+    QJsonRpcIdleWheel(QJsonRpcAbstractServerPrivate *server, QObject *parent = 0);
+
+    // a registered client living in the wheel's thread
+    void add(QJsonRpcSocket *client);
+
+    enum { WheelSize = 256, Resolution = 100, IdleReleaseDelay = 5000 };
+
+private Q_SLOTS:
+    void tick();
+
+private:
+    void schedule(QJsonRpcClientRegistry::Handle handle, qint64 msecs);
+    void visit(QJsonRpcClientRegistry::Handle handle);
+
+    struct Entry
+    {
+        QJsonRpcClientRegistry::Handle handle;
+        int rounds;     // full turns of the wheel left
+    };
+
+    QJsonRpcAbstractServerPrivate *server;
+    QVector<QVector<Entry> > wheel;
+    int currentSlot;
+    qint64 ticks;       // processed since clock was started
+    int pending;
+    QElapsedTimer clock;
+    QTimer timer;
+};
+
 #if defined(USE_QT_PRIVATE_HEADERS)
 #include <private/qobject_p.h>
 
@@ -29,14 +115,65 @@ class QJsonRpcAbstractServerPrivate
 #endif
 {
 public:
+    QJsonRpcAbstractServerPrivate()
+        : framingMode(QJsonRpc::JsonFraming),
+          writeCoalescingDelay(-1),
+          codec(0),
+          compressionThreshold(-1),
+          attachmentsEnabled(false),
+          highWaterMark(-1),
+          lowWaterMark(-1),
+          maximumIncomingRequests(-1),
+          maximumFrameSize(-1),
+          maximumConnectionMemory(-1),
+          memoryAccount(new QJsonRpcMemoryAccount),
+          idleTimeout(0),
+          idleWheel(0)
+    {
+    }
+
 #if !defined(USE_QT_PRIVATE_HEADERS)
     virtual ~QJsonRpcAbstractServerPrivate() {}
 #endif
 
     void _q_notifyConnectedClients(const QJsonRpcMessage &message);
     void _q_notifyConnectedClients(const QString &method, const QJsonArray &params);
+    void _q_notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
+    void configureSocket(QJsonRpcSocket *socket) const;
+
+    // clientsMutex must be held, also drops the client's subscriptions
+    void removeClient(QJsonRpcSocket *socket);
+
+    // answers rpc.subscribe and rpc.unsubscribe, false for other messages
+    bool processSubscription(QJsonRpcSocket *socket, const QJsonRpcMessage &message);
+    bool subscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    bool unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    int subscriberCount(const QString &topic) const;
+
+    QJsonRpcClientRegistry clients;
+    mutable QMutex clientsMutex;      // clients may be added from I/O threads
+
+    // topic to subscribed clients and back, guarded by clientsMutex
+    QHash<QString, QSet<QJsonRpcSocket*> > subscribers;
+    QHash<QJsonRpcSocket*, QSet<QString> > subscriptions;
+    QJsonRpc::FramingMode framingMode;
+    int writeCoalescingDelay;
+    QJsonRpcCodec *codec;
+    int compressionThreshold;
+    bool attachmentsEnabled;
+    qint64 highWaterMark;
+    qint64 lowWaterMark;
+    int maximumIncomingRequests;
+
+    // memory limits of each connection, and what they all hold
+    int maximumFrameSize;
+    qint64 maximumConnectionMemory;
+    QJsonRpcMemoryAccountPointer memoryAccount;
 
-    QList<QJsonRpcSocket*> clients;
+    // of each connection, 0 keeps idle connections open. The wheel looks
+    // after those of the server's thread, I/O threads have their own
+    int idleTimeout;
+    QJsonRpcIdleWheel *idleWheel;
 };
 
 #endif
@@ -0,0 +1,176 @@
+#include <qmath.h>
+
+#include "qjsonrpcadmission_p.h"
+
+// how far recent latency may rise above the long-term one before limits shrink
+static const double Tolerance = 1.5;
+
+void QJsonRpcAdmissionController::Limit::sample(double latency)
+{
+    if (longLatency <= 0) {
+        shortLatency = longLatency = latency;
+        return;
+    }
+
+    shortLatency += (latency - shortLatency) * 0.1;
+    longLatency += (latency - longLatency) * 0.01;
+
+    // after a long overload the long-term latency has drifted up with the
+    // short one, let it recover once requests are fast again
+    if (longLatency > 2 * shortLatency)
+        longLatency *= 0.95;
+
+    // a limit that isn't reached says nothing about the capacity behind it
+    if (inFlight < limit / 2)
+        return;
+
+    const double gradient = qBound(0.5, Tolerance * longLatency / qMax(shortLatency, 1.0), 1.0);
+    const double target = limit * gradient + qSqrt(limit);
+    limit = qBound(1.0, limit * 0.8 + target * 0.2, double(maximum));
+}
+
+QJsonRpcAdmissionController::QJsonRpcAdmissionController()
+    : maximumPerClient(-1),
+      adaptive(false)
+{
+}
+
+QJsonRpcAdmissionPointer
+QJsonRpcAdmissionController::admit(const QSharedPointer<QJsonRpcAdmissionController> &controller,
+                                   const QString &method, const void *client)
+{
+    QJsonRpcAdmissionController *d = controller.data();
+    const QString service = method.section(QLatin1Char('.'), 0, -2);
+
+    QMutexLocker locker(&d->mutex);
+    QHash<QString, Limit>::iterator serviceLimit = d->limits.find(service);
+    QHash<QString, Limit>::iterator methodLimit = d->limits.find(method);
+    const bool limitService = serviceLimit != d->limits.end();
+    const bool limitMethod = methodLimit != d->limits.end();
+    if (limitService && serviceLimit->inFlight >= serviceLimit->effective(d->adaptive))
+        return QJsonRpcAdmissionPointer();
+    if (limitMethod && methodLimit->inFlight >= methodLimit->effective(d->adaptive))
+        return QJsonRpcAdmissionPointer();
+
+    int *clientRequests = 0;
+    if (d->maximumPerClient > 0) {
+        clientRequests = &d->clients[client];
+        if (*clientRequests >= d->maximumPerClient) {
+            if (!*clientRequests)
+                d->clients.remove(client);
+            return QJsonRpcAdmissionPointer();
+        }
+        ++*clientRequests;
+    }
+
+    if (limitService)
+        serviceLimit->inFlight++;
+    if (limitMethod)
+        methodLimit->inFlight++;
+    return QJsonRpcAdmissionPointer(
+        new QJsonRpcAdmission(controller, limitService ? service : QString(),
+                              limitMethod ? method : QString(), clientRequests ? client : 0));
+}
+
+int QJsonRpcAdmissionController::limit(const QString &name) const
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Limit>::const_iterator it = limits.constFind(name);
+    return it == limits.constEnd() ? -1 : it->maximum;
+}
+
+void QJsonRpcAdmissionController::setLimit(const QString &name, int count)
+{
+    QMutexLocker locker(&mutex);
+    if (count <= 0) {
+        limits.remove(name);
+        return;
+    }
+
+    // requests admitted before keep counting against the new limit
+    Limit &limit = limits[name];
+    limit.maximum = count;
+    limit.limit = count;
+}
+
+int QJsonRpcAdmissionController::effectiveLimit(const QString &name) const
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Limit>::const_iterator it = limits.constFind(name);
+    return it == limits.constEnd() ? -1 : it->effective(adaptive);
+}
+
+int QJsonRpcAdmissionController::clientLimit() const
+{
+    QMutexLocker locker(&mutex);
+    return maximumPerClient;
+}
+
+void QJsonRpcAdmissionController::setClientLimit(int count)
+{
+    QMutexLocker locker(&mutex);
+    maximumPerClient = count <= 0 ? -1 : count;
+}
+
+bool QJsonRpcAdmissionController::isAdaptive() const
+{
+    QMutexLocker locker(&mutex);
+    return adaptive;
+}
+
+void QJsonRpcAdmissionController::setAdaptive(bool enabled)
+{
+    QMutexLocker locker(&mutex);
+    adaptive = enabled;
+}
+
+void QJsonRpcAdmissionController::release(const QJsonRpcAdmission *admission, bool measured)
+{
+    const double latency = measured ? admission->timer.nsecsElapsed() / 1000.0 : 0;
+    QMutexLocker locker(&mutex);
+    const QString *names[] = { &admission->service, &admission->method };
+    for (int i = 0; i < 2; ++i) {
+        if (names[i]->isEmpty())
+            continue;
+
+        // the limit may have been removed meanwhile
+        QHash<QString, Limit>::iterator it = limits.find(*names[i]);
+        if (it == limits.end())
+            continue;
+
+        if (measured && adaptive)
+            it->sample(latency);
+        if (it->inFlight > 0)
+            it->inFlight--;
+    }
+
+    if (admission->client) {
+        QHash<const void*, int>::iterator it = clients.find(admission->client);
+        if (it != clients.end() && --it.value() <= 0)
+            clients.erase(it);
+    }
+}
+
+QJsonRpcAdmission::QJsonRpcAdmission(const QSharedPointer<QJsonRpcAdmissionController> &controller,
+                                     const QString &service, const QString &method,
+                                     const void *client)
+    : controller(controller),
+      service(service),
+      method(method),
+      client(client),
+      released(0)
+{
+    timer.start();
+}
+
+QJsonRpcAdmission::~QJsonRpcAdmission()
+{
+    if (released.testAndSetOrdered(0, 1))
+        controller->release(this, false);
+}
+
+void QJsonRpcAdmission::release()
+{
+    if (released.testAndSetOrdered(0, 1))
+        controller->release(this, true);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCADMISSION_P_H
+#define QJSONRPCADMISSION_P_H
+
+#include <QHash>
+#include <QString>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+
+#include "qjsonrpcglobal.h"
+
+// Concurrency limits of a service provider. Each request admitted holds an
+// admission until its response is sent, past a limit requests are turned
+// away instead of queued. Admissions may be released from any thread.
+class QJsonRpcAdmission;
+typedef QSharedPointer<QJsonRpcAdmission> QJsonRpcAdmissionPointer;
+
+class QJSONRPC_EXPORT QJsonRpcAdmissionController
+{
+public:
+    QJsonRpcAdmissionController();
+
+    // null when the request is past one of the limits
+    static QJsonRpcAdmissionPointer admit(const QSharedPointer<QJsonRpcAdmissionController> &controller,
+                                          const QString &method, const void *client);
+
+    // name is a service's, or one of its methods' as "service.method"
+    int limit(const QString &name) const;
+    void setLimit(const QString &name, int count);
+    int effectiveLimit(const QString &name) const;
+    int clientLimit() const;
+    void setClientLimit(int count);
+    bool isAdaptive() const;
+    void setAdaptive(bool enabled);
+
+private:
+    friend class QJsonRpcAdmission;
+    void release(const QJsonRpcAdmission *admission, bool measured);
+
+    // With adaptive limits, each limit follows a gradient of its latency:
+    // while the recent latency stays within Tolerance of the long-term one
+    // the limit grows, by the square root of itself, up to its maximum;
+    // when it rises above, the limit shrinks in proportion, down to 1
+    struct Limit
+    {
+        Limit() : maximum(0), limit(0), inFlight(0), shortLatency(0), longLatency(0) {}
+        int effective(bool adaptive) const { return adaptive ? qMax(1, int(limit)) : maximum; }
+        void sample(double latency);
+
+        int maximum;
+        double limit;
+        int inFlight;
+        double shortLatency;    // in usecs, averaged over about 10 requests
+        double longLatency;     // and about 100
+    };
+
+    mutable QMutex mutex;
+    QHash<QString, Limit> limits;
+    QHash<const void*, int> clients;    // requests in flight by client
+    int maximumPerClient;
+    bool adaptive;
+};
+
+class QJSONRPC_EXPORT QJsonRpcAdmission
+{
+public:
+    ~QJsonRpcAdmission();
+
+    // the request was answered, its latency counts for adaptive limits.
+    // Releasing again, or dropping the last reference without releasing, only
+    // makes room for another request
+    void release();
+
+private:
+    friend class QJsonRpcAdmissionController;
+    QJsonRpcAdmission(const QSharedPointer<QJsonRpcAdmissionController> &controller,
+                      const QString &service, const QString &method, const void *client);
+
+    QSharedPointer<QJsonRpcAdmissionController> controller;
+    QString service;    // empty if the service has no limit
+    QString method;     // empty if the method has no limit
+    const void *client;
+    QElapsedTimer timer;
+    QAtomicInt released;
+    Q_DISABLE_COPY(QJsonRpcAdmission)
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include <QPointer>
+#include <QHash>
+#include <QVector>
+
+#include "qjsonrpcservicereply.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpcclustersocket.h"
+
+class QJsonRpcClusterSocketPrivate : public QJsonRpcAbstractSocketPrivate
+{
+public:
+    QJsonRpcClusterSocketPrivate(QJsonRpcClusterSocket *socket)
+        : virtualNodeCount(128),
+          shardKeyParameter(QLatin1String("/0")),
+          q_ptr(socket)
+    {
+    }
+
+    // slots
+    void _q_nodeDestroyed(QObject *node);
+
+    static quint64 hash(const QByteArray &key);
+    void rebuildRing();
+    QByteArray shardKey(const QJsonRpcMessage &message) const;
+    QJsonRpcAbstractSocket *nodeForKey(const QByteArray &key) const;
+
+    struct Node
+    {
+        QString name;
+        QPointer<QJsonRpcAbstractSocket> socket;
+    };
+    QList<Node> nodes;
+
+    // sorted by hash, each refers to its node by index
+    struct Point
+    {
+        quint64 hash;
+        int node;
+        bool operator<(const Point &other) const { return hash < other.hash; }
+    };
+    QVector<Point> ring;
+    int virtualNodeCount;
+
+    QString shardKeyParameter;
+    QHash<QString, QString> methodShardKeyParameters;
+
+    QJsonRpcClusterSocket * const q_ptr;
+    Q_DECLARE_PUBLIC(QJsonRpcClusterSocket)
+};
+
+// FNV-1a, mixed as in MurmurHash3 since keys often only differ at the end
+quint64 QJsonRpcClusterSocketPrivate::hash(const QByteArray &key)
+{
+    quint64 value = Q_UINT64_C(14695981039346656037);
+    for (int i = 0; i < key.size(); ++i) {
+        value ^= uchar(key.at(i));
+        value *= Q_UINT64_C(1099511628211);
+    }
+
+    value ^= value >> 33;
+    value *= Q_UINT64_C(0xff51afd7ed558ccd);
+    value ^= value >> 33;
+    value *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+    value ^= value >> 33;
+    return value;
+}
+
+void QJsonRpcClusterSocketPrivate::rebuildRing()
+{
+    ring.clear();
+    ring.reserve(nodes.size() * virtualNodeCount);
+    for (int i = 0; i < nodes.size(); ++i) {
+        const QByteArray name = nodes.at(i).name.toUtf8();
+        for (int j = 0; j < virtualNodeCount; ++j) {
+            Point point;
+            point.hash = hash(name + '#' + QByteArray::number(j));
+            point.node = i;
+            ring.append(point);
+        }
+    }
+
+    qSort(ring.begin(), ring.end());
+}
+
+QByteArray QJsonRpcClusterSocketPrivate::shardKey(const QJsonRpcMessage &message) const
+{
+    const QString pointer =
+        methodShardKeyParameters.value(message.method(), shardKeyParameter);
+    const QJsonValue key = message.paramsValue(pointer);
+    if (key.isString())
+        return key.toString().toUtf8();
+    if (key.isUndefined())
+        return message.method().toUtf8();
+
+    QByteArray text;
+    QJsonRpcMessagePrivate::writeValue(key, text);
+    return text;
+}
+
+QJsonRpcAbstractSocket *QJsonRpcClusterSocketPrivate::nodeForKey(const QByteArray &key) const
+{
+    if (ring.isEmpty())
+        return 0;
+
+    // the first point at or after the key, wrapping around
+    Point point;
+    point.hash = hash(key);
+    point.node = 0;
+    QVector<Point>::const_iterator it = qLowerBound(ring.constBegin(), ring.constEnd(), point);
+    if (it == ring.constEnd())
+        it = ring.constBegin();
+    return nodes.at(it->node).socket.data();
+}
+
+void QJsonRpcClusterSocketPrivate::_q_nodeDestroyed(QObject *node)
+{
+    for (int i = 0; i < nodes.size(); ++i) {
+        if (nodes.at(i).socket.isNull() || nodes.at(i).socket.data() == node)
+            nodes.removeAt(i--);
+    }
+    rebuildRing();
+}
+
+QJsonRpcClusterSocket::QJsonRpcClusterSocket(QObject *parent)
+    : QJsonRpcAbstractSocket(*new QJsonRpcClusterSocketPrivate(this), parent)
+{
+}
+
+QJsonRpcClusterSocket::~QJsonRpcClusterSocket()
+{
+}
+
+bool QJsonRpcClusterSocket::isValid() const
+{
+    Q_D(const QJsonRpcClusterSocket);
+    for (int i = 0; i < d->nodes.size(); ++i) {
+        if (d->nodes.at(i).socket && d->nodes.at(i).socket.data()->isValid())
+            return true;
+    }
+
+    return false;
+}
+
+void QJsonRpcClusterSocket::addNode(const QString &name, QJsonRpcAbstractSocket *node)
+{
+    Q_D(QJsonRpcClusterSocket);
+    if (name.isEmpty() || !node) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid node name or socket";
+        return;
+    }
+
+    removeNode(name);
+    QJsonRpcClusterSocketPrivate::Node entry;
+    entry.name = name;
+    entry.socket = node;
+    d->nodes.append(entry);
+    d->rebuildRing();
+
+    connect(node, SIGNAL(messageReceived(QJsonRpcMessage)),
+            this, SIGNAL(messageReceived(QJsonRpcMessage)), Qt::UniqueConnection);
+    connect(node, SIGNAL(destroyed(QObject*)), this, SLOT(_q_nodeDestroyed(QObject*)),
+            Qt::UniqueConnection);
+}
+
+void QJsonRpcClusterSocket::removeNode(const QString &name)
+{
+    Q_D(QJsonRpcClusterSocket);
+    for (int i = 0; i < d->nodes.size(); ++i) {
+        if (d->nodes.at(i).name != name)
+            continue;
+
+        QJsonRpcAbstractSocket *node = d->nodes.takeAt(i).socket.data();
+        d->rebuildRing();
+
+        // it may still be a node under another name
+        for (int j = 0; j < d->nodes.size(); ++j) {
+            if (d->nodes.at(j).socket.data() == node)
+                return;
+        }
+        if (node)
+            disconnect(node, 0, this, 0);
+        return;
+    }
+}
+
+QStringList QJsonRpcClusterSocket::nodeNames() const
+{
+    Q_D(const QJsonRpcClusterSocket);
+    QStringList names;
+    for (int i = 0; i < d->nodes.size(); ++i)
+        names.append(d->nodes.at(i).name);
+    return names;
+}
+
+QJsonRpcAbstractSocket *QJsonRpcClusterSocket::node(const QString &name) const
+{
+    Q_D(const QJsonRpcClusterSocket);
+    for (int i = 0; i < d->nodes.size(); ++i) {
+        if (d->nodes.at(i).name == name)
+            return d->nodes.at(i).socket.data();
+    }
+
+    return 0;
+}
+
+int QJsonRpcClusterSocket::virtualNodeCount() const
+{
+    Q_D(const QJsonRpcClusterSocket);
+    return d->virtualNodeCount;
+}
+
+void QJsonRpcClusterSocket::setVirtualNodeCount(int count)
+{
+    Q_D(QJsonRpcClusterSocket);
+    d->virtualNodeCount = qMax(1, count);
+    d->rebuildRing();
+}
+
+QString QJsonRpcClusterSocket::shardKeyParameter(const QString &method) const
+{
+    Q_D(const QJsonRpcClusterSocket);
+    return d->methodShardKeyParameters.value(method, d->shardKeyParameter);
+}
+
+void QJsonRpcClusterSocket::setShardKeyParameter(const QString &pointer)
+{
+    Q_D(QJsonRpcClusterSocket);
+    d->shardKeyParameter = pointer;
+}
+
+void QJsonRpcClusterSocket::setShardKeyParameter(const QString &method, const QString &pointer)
+{
+    Q_D(QJsonRpcClusterSocket);
+    if (pointer.isEmpty())
+        d->methodShardKeyParameters.remove(method);
+    else
+        d->methodShardKeyParameters.insert(method, pointer);
+}
+
+QString QJsonRpcClusterSocket::nodeForKey(const QString &shardKey) const
+{
+    Q_D(const QJsonRpcClusterSocket);
+    QJsonRpcAbstractSocket *node = d->nodeForKey(shardKey.toUtf8());
+    for (int i = 0; i < d->nodes.size(); ++i) {
+        if (node && d->nodes.at(i).socket.data() == node)
+            return d->nodes.at(i).name;
+    }
+
+    return QString();
+}
+
+void QJsonRpcClusterSocket::notify(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcClusterSocket);
+    QJsonRpcAbstractSocket *node = d->nodeForKey(d->shardKey(message));
+    if (!node) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without nodes";
+        return;
+    }
+
+    node->notify(message);
+}
+
+QJsonRpcMessage QJsonRpcClusterSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+{
+    Q_D(QJsonRpcClusterSocket);
+    QJsonRpcAbstractSocket *node = d->nodeForKey(d->shardKey(message));
+    if (!node)
+        return message.createErrorResponse(QJsonRpc::InternalError, "no nodes");
+    return node->sendMessageBlocking(message, msecs);
+}
+
+QJsonRpcMessage QJsonRpcClusterSocket::sendMessageBlocking(const QJsonRpcMessage &message,
+                                                           const QString &shardKey, int msecs)
+{
+    Q_D(QJsonRpcClusterSocket);
+    QJsonRpcAbstractSocket *node = d->nodeForKey(shardKey.toUtf8());
+    if (!node)
+        return message.createErrorResponse(QJsonRpc::InternalError, "no nodes");
+    return node->sendMessageBlocking(message, msecs);
+}
+
+QJsonRpcServiceReply *QJsonRpcClusterSocket::sendMessage(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcClusterSocket);
+    QJsonRpcAbstractSocket *node = d->nodeForKey(d->shardKey(message));
+    if (!node) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without nodes";
+        return 0;
+    }
+
+    return node->sendMessage(message);
+}
+
+QJsonRpcServiceReply *QJsonRpcClusterSocket::sendMessage(const QJsonRpcMessage &message,
+                                                         const QString &shardKey)
+{
+    Q_D(QJsonRpcClusterSocket);
+    QJsonRpcAbstractSocket *node = d->nodeForKey(shardKey.toUtf8());
+    if (!node) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without nodes";
+        return 0;
+    }
+
+    return node->sendMessage(message);
+}
+
+QList<QJsonRpcServiceReply *> QJsonRpcClusterSocket::sendBatch(const QList<QJsonRpcMessage> &messages)
+{
+    Q_D(QJsonRpcClusterSocket);
+    QList<QJsonRpcServiceReply *> batchReplies;
+    if (d->ring.isEmpty()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without nodes";
+        return batchReplies;
+    }
+
+    // one batch per node, the replies of its requests are put back in the
+    // order of the requests
+    QList<QJsonRpcAbstractSocket *> batchNodes;
+    QList<QList<QJsonRpcMessage> > batches;
+    QList<QList<int> > requestPositions;
+    int requests = 0;
+    for (int i = 0; i < messages.size(); ++i) {
+        const QJsonRpcMessage &message = messages.at(i);
+        QJsonRpcAbstractSocket *node = d->nodeForKey(d->shardKey(message));
+        int batch = batchNodes.indexOf(node);
+        if (batch == -1) {
+            batch = batchNodes.size();
+            batchNodes.append(node);
+            batches.append(QList<QJsonRpcMessage>());
+            requestPositions.append(QList<int>());
+        }
+
+        batches[batch].append(message);
+        if (message.type() == QJsonRpcMessage::Request)
+            requestPositions[batch].append(requests++);
+    }
+
+    QVector<QJsonRpcServiceReply *> ordered(requests, 0);
+    for (int i = 0; i < batchNodes.size(); ++i) {
+        const QList<QJsonRpcServiceReply *> replies = batchNodes.at(i)->sendBatch(batches.at(i));
+        const QList<int> &positions = requestPositions.at(i);
+        for (int j = 0; j < replies.size() && j < positions.size(); ++j)
+            ordered[positions.at(j)] = replies.at(j);
+    }
+
+    for (int i = 0; i < ordered.size(); ++i) {
+        if (ordered.at(i))
+            batchReplies.append(ordered.at(i));
+    }
+    return batchReplies;
+}
+
+#include "moc_qjsonrpcclustersocket.cpp"
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCCLUSTERSOCKET_H
+#define QJSONRPCCLUSTERSOCKET_H
+
+#include <QStringList>
+
+#include "qjsonrpcsocket.h"
+
+// Spreads the calls of a client over the nodes of a partitioned service.
+// Each call goes to the node its shard key hashes to on a consistent hash
+// ring, so adding or removing a node only moves the keys of that node. The
+// key is a param of the call, the first positional one unless another is
+// chosen, or one given explicitly; calls without one are placed by their
+// method. Nodes are any sockets, not owned by the cluster, connected to
+// their node: QJsonRpcHttpClient ones hedge and retry on their own, and
+// batches are split into one batch per node.
+//
+//     QJsonRpcClusterSocket cluster;
+//     cluster.addNode("node-1", socket1);
+//     cluster.addNode("node-2", socket2);
+//     cluster.setShardKeyParameter("/account");
+//     cluster.invokeRemoteMethod("accounts.balance", params);
+class QJsonRpcClusterSocketPrivate;
+class QJSONRPC_EXPORT QJsonRpcClusterSocket : public QJsonRpcAbstractSocket
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcClusterSocket(QObject *parent = 0);
+    ~QJsonRpcClusterSocket();
+
+    // valid while one of its nodes is
+    virtual bool isValid() const;
+
+    // Nodes are placed on the ring by name, a node added again under the
+    // same name replaces the previous one. Those destroyed are removed.
+    // Requests in flight stay with the node they were sent to.
+    void addNode(const QString &name, QJsonRpcAbstractSocket *node);
+    void removeNode(const QString &name);
+    QStringList nodeNames() const;
+    QJsonRpcAbstractSocket *node(const QString &name) const;
+
+    // the points each node takes on the ring, 128 by default; more spread
+    // the keys more evenly
+    int virtualNodeCount() const;
+    void setVirtualNodeCount(int count);
+
+    // Where the shard key is found in the params of a call, as a JSON
+    // Pointer, "/0" by default. One set for a method applies to its calls
+    // only, an empty pointer drops it. Params aren't decoded to find it.
+    QString shardKeyParameter(const QString &method = QString()) const;
+    void setShardKeyParameter(const QString &pointer);
+    void setShardKeyParameter(const QString &method, const QString &pointer);
+
+    // the name of the node a key belongs to, an empty one without nodes
+    QString nodeForKey(const QString &shardKey) const;
+
+    // with an explicit shard key rather than one of the params
+    QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message, const QString &shardKey);
+    QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, const QString &shardKey,
+                                        int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
+
+public Q_SLOTS:
+    virtual void notify(const QJsonRpcMessage &message);
+    virtual QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
+    virtual QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
+    virtual QList<QJsonRpcServiceReply *> sendBatch(const QList<QJsonRpcMessage> &messages);
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcClusterSocket)
+    Q_DISABLE_COPY(QJsonRpcClusterSocket)
+    Q_PRIVATE_SLOT(d_func(), void _q_nodeDestroyed(QObject *node))
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <QList>
+#include <QMutex>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#else
+#include "json/qjsondocument.h"
+#include "json/qjsonobject.h"
+#include "json/qjsonarray.h"
+#endif
+
+#if QT_VERSION >= 0x050C00
+#include <QCborValue>
+#endif
+
+#include "qjsonrpccodec.h"
+
+static QJsonDocument toDocument(const QJsonValue &value)
+{
+    if (value.isArray())
+        return QJsonDocument(value.toArray());
+    return QJsonDocument(value.toObject());
+}
+
+static QJsonValue fromDocument(const QJsonDocument &document)
+{
+    if (document.isArray())
+        return document.array();
+    if (document.isObject())
+        return document.object();
+    return QJsonValue(QJsonValue::Undefined);
+}
+
+class QJsonRpcTextCodec : public QJsonRpcCodec
+{
+public:
+    QByteArray contentType() const { return "application/json"; }
+
+    QByteArray encode(const QJsonValue &value) const {
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+        return toDocument(value).toJson(QJsonDocument::Compact);
+#else
+        return toDocument(value).toJson();
+#endif
+    }
+
+    QJsonValue decode(const QByteArray &data) const {
+        return fromDocument(QJsonDocument::fromJson(data));
+    }
+};
+
+class QJsonRpcBinaryJsonCodec : public QJsonRpcCodec
+{
+public:
+    QByteArray contentType() const { return "application/x-qt-binary-json"; }
+
+    QByteArray encode(const QJsonValue &value) const {
+        return toDocument(value).toBinaryData();
+    }
+
+    QJsonValue decode(const QByteArray &data) const {
+        return fromDocument(QJsonDocument::fromBinaryData(data));
+    }
+};
+
+#if QT_VERSION >= 0x050C00
+class QJsonRpcCborCodec : public QJsonRpcCodec
+{
+public:
+    QByteArray contentType() const { return "application/cbor"; }
+
+    QByteArray encode(const QJsonValue &value) const {
+        return QCborValue::fromJsonValue(value).toCbor();
+    }
+
+    QJsonValue decode(const QByteArray &data) const {
+        QCborParserError error;
+        QCborValue value = QCborValue::fromCbor(data, &error);
+        if (error.error != QCborError::NoError || !(value.isMap() || value.isArray()))
+            return QJsonValue(QJsonValue::Undefined);
+        return value.toJsonValue();
+    }
+};
+#endif
+
+class QJsonRpcCodecRegistry
+{
+public:
+    ~QJsonRpcCodecRegistry() { qDeleteAll(codecs); }
+
+    QJsonRpcTextCodec text;
+    QJsonRpcBinaryJsonCodec binaryJson;
+#if QT_VERSION >= 0x050C00
+    QJsonRpcCborCodec cbor;
+#endif
+    QList<QJsonRpcCodec *> codecs;      // registered by the application
+    QMutex mutex;
+};
+Q_GLOBAL_STATIC(QJsonRpcCodecRegistry, codecRegistry)
+
+QJsonRpcCodec::~QJsonRpcCodec()
+{
+}
+
+QJsonRpcCodec *QJsonRpcCodec::json()
+{
+    return &codecRegistry()->text;
+}
+
+QJsonRpcCodec *QJsonRpcCodec::binaryJson()
+{
+    return &codecRegistry()->binaryJson;
+}
+
+QJsonRpcCodec *QJsonRpcCodec::cbor()
+{
+#if QT_VERSION >= 0x050C00
+    return &codecRegistry()->cbor;
+#else
+    return 0;
+#endif
+}
+
+QJsonRpcCodec *QJsonRpcCodec::codecForContentType(const QByteArray &contentType)
+{
+    int parameters = contentType.indexOf(';');
+    const QByteArray type =
+        (parameters == -1 ? contentType : contentType.left(parameters)).trimmed().toLower();
+
+    QJsonRpcCodecRegistry *registry = codecRegistry();
+    {
+        QMutexLocker locker(&registry->mutex);
+        foreach (QJsonRpcCodec *codec, registry->codecs) {
+            if (codec->contentType() == type)
+                return codec;
+        }
+    }
+
+    if (type == registry->binaryJson.contentType())
+        return &registry->binaryJson;
+#if QT_VERSION >= 0x050C00
+    if (type == registry->cbor.contentType())
+        return &registry->cbor;
+#endif
+    if (type == registry->text.contentType())
+        return &registry->text;
+    return 0;
+}
+
+void QJsonRpcCodec::registerCodec(QJsonRpcCodec *codec)
+{
+    if (!codec)
+        return;
+
+    QJsonRpcCodecRegistry *registry = codecRegistry();
+    QMutexLocker locker(&registry->mutex);
+    registry->codecs.prepend(codec);
+}
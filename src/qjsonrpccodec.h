@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCCODEC_H
+#define QJSONRPCCODEC_H
+
+#include <QByteArray>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonValue>
+#else
+#include "json/qjsonvalue.h"
+#endif
+
+#include "qjsonrpcglobal.h"
+
+// Converts the body of a frame to and from JSON values: message objects or
+// batch arrays. Frames written with a codec other than text JSON carry its
+// content type in a header, so a peer can decode them whatever codec it has
+// been configured with.
+class QJSONRPC_EXPORT QJsonRpcCodec
+{
+public:
+    virtual ~QJsonRpcCodec();
+
+    virtual QByteArray contentType() const = 0;
+    virtual QByteArray encode(const QJsonValue &value) const = 0;
+    virtual QJsonValue decode(const QByteArray &data) const = 0;   // undefined if malformed
+
+    // text JSON, "application/json"
+    static QJsonRpcCodec *json();
+    // Qt's binary JSON format, "application/x-qt-binary-json"
+    static QJsonRpcCodec *binaryJson();
+    // CBOR, "application/cbor", 0 before Qt 5.12
+    static QJsonRpcCodec *cbor();
+
+    // the codec matching a Content-Type header, ignoring its parameters
+    static QJsonRpcCodec *codecForContentType(const QByteArray &contentType);
+    // makes a codec available to codecForContentType, taking ownership
+    static void registerCodec(QJsonRpcCodec *codec);
+};
+
+#endif
@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <QList>
+
+#include "qjsonrpccompression_p.h"
+
+// reflected CRC-32 of gzip (RFC 1952 8), built before main
+static struct CrcTable
+{
+    CrcTable()
+    {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            entries[i] = crc;
+        }
+    }
+
+    quint32 entries[256];
+} crcTable;
+
+static inline quint32 readLittleEndian(const uchar *data)
+{
+    return quint32(data[0]) | (quint32(data[1]) << 8) |
+           (quint32(data[2]) << 16) | (quint32(data[3]) << 24);
+}
+
+static inline void appendLittleEndian(QByteArray *out, quint32 value)
+{
+    out->append(char(value));
+    out->append(char(value >> 8));
+    out->append(char(value >> 16));
+    out->append(char(value >> 24));
+}
+
+// Decoder of raw DEFLATE data (RFC 1951), after zlib's puff. Codes are
+// canonical, so each is decoded bit by bit from the number of codes of every
+// length; slower than zlib's tables, which doesn't matter at the size of
+// request bodies
+namespace {
+class Inflater
+{
+public:
+    Inflater(const uchar *data, int size, QByteArray *output, int maximumSize, bool flushed = false)
+        : m_data(data),
+          m_size(size),
+          m_position(0),
+          m_bitBuffer(0),
+          m_bitCount(0),
+          m_output(output),
+          m_start(output->size()),
+          m_maximumSize(maximumSize),
+          m_error(false),
+          m_sizeExceeded(false),
+          m_flushed(flushed)
+    {
+    }
+
+    bool run();
+    int consumed() const { return m_position; }
+    bool sizeExceeded() const { return m_sizeExceeded; }
+
+private:
+    enum {
+        MaximumBits = 15,
+        LiteralCodes = 288,
+        DistanceCodes = 30,
+        CodeLengthCodes = 19
+    };
+
+    struct Huffman
+    {
+        short count[MaximumBits + 1];       // number of codes of each length
+        short symbol[LiteralCodes];         // symbols ordered by code
+    };
+
+    int bits(int need);
+    bool reserve(int length);
+    int decode(const Huffman &huffman);
+    static int construct(Huffman *huffman, const short *lengths, int n);
+    bool stored();
+    bool fixed();
+    bool dynamic();
+    bool codes(const Huffman &lengthCodes, const Huffman &distanceCodes);
+
+    const uchar *m_data;
+    int m_size;
+    int m_position;
+    quint32 m_bitBuffer;
+    int m_bitCount;
+    QByteArray *m_output;
+    int m_start;            // back references don't reach before it
+    int m_maximumSize;
+    bool m_error;           // out of input
+    bool m_sizeExceeded;
+    bool m_flushed;         // the data may end with a flush instead of a final block
+};
+}
+
+int Inflater::bits(int need)
+{
+    quint32 value = m_bitBuffer;
+    while (m_bitCount < need) {
+        if (m_position == m_size) {
+            m_error = true;
+            return 0;
+        }
+
+        value |= quint32(m_data[m_position++]) << m_bitCount;
+        m_bitCount += 8;
+    }
+
+    m_bitBuffer = value >> need;
+    m_bitCount -= need;
+    return int(value & ((1U << need) - 1));
+}
+
+bool Inflater::reserve(int length)
+{
+    if (m_maximumSize > 0 && m_output->size() + length > m_maximumSize) {
+        m_sizeExceeded = true;
+        return false;
+    }
+
+    return true;
+}
+
+int Inflater::decode(const Huffman &huffman)
+{
+    int code = 0;       // bits read so far
+    int first = 0;      // first code of the current length
+    int index = 0;      // of the first code of the current length in symbol
+    for (int length = 1; length <= MaximumBits; ++length) {
+        code |= bits(1);
+        if (m_error)
+            return -1;
+
+        const int count = huffman.count[length];
+        if (code - count < first)
+            return huffman.symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+// 0 for a complete code, negative for an over-subscribed one and positive
+// for an incomplete one
+int Inflater::construct(Huffman *huffman, const short *lengths, int n)
+{
+    for (int length = 0; length <= MaximumBits; ++length)
+        huffman->count[length] = 0;
+    for (int symbol = 0; symbol < n; ++symbol)
+        huffman->count[lengths[symbol]]++;
+    if (huffman->count[0] == n)
+        return 0;
+
+    int left = 1;
+    for (int length = 1; length <= MaximumBits; ++length) {
+        left <<= 1;
+        left -= huffman->count[length];
+        if (left < 0)
+            return left;
+    }
+
+    short offsets[MaximumBits + 1];
+    offsets[1] = 0;
+    for (int length = 1; length < MaximumBits; ++length)
+        offsets[length + 1] = short(offsets[length] + huffman->count[length]);
+    for (int symbol = 0; symbol < n; ++symbol) {
+        if (lengths[symbol] != 0)
+            huffman->symbol[offsets[lengths[symbol]]++] = short(symbol);
+    }
+
+    return left;
+}
+
+bool Inflater::stored()
+{
+    // the block starts at the next byte
+    m_bitBuffer = 0;
+    m_bitCount = 0;
+    if (m_position + 4 > m_size)
+        return false;
+
+    const int length = m_data[m_position] | (m_data[m_position + 1] << 8);
+    if (m_data[m_position + 2] != (~length & 0xff) ||
+        m_data[m_position + 3] != ((~length >> 8) & 0xff))
+        return false;
+    m_position += 4;
+
+    if (m_position + length > m_size || !reserve(length))
+        return false;
+    m_output->append(reinterpret_cast<const char*>(m_data + m_position), length);
+    m_position += length;
+    return true;
+}
+
+bool Inflater::fixed()
+{
+    short lengths[LiteralCodes];
+    int symbol = 0;
+    for (; symbol < 144; ++symbol)
+        lengths[symbol] = 8;
+    for (; symbol < 256; ++symbol)
+        lengths[symbol] = 9;
+    for (; symbol < 280; ++symbol)
+        lengths[symbol] = 7;
+    for (; symbol < LiteralCodes; ++symbol)
+        lengths[symbol] = 8;
+
+    Huffman lengthCodes;
+    construct(&lengthCodes, lengths, LiteralCodes);
+    for (symbol = 0; symbol < DistanceCodes; ++symbol)
+        lengths[symbol] = 5;
+    Huffman distanceCodes;
+    construct(&distanceCodes, lengths, DistanceCodes);
+    return codes(lengthCodes, distanceCodes);
+}
+
+bool Inflater::dynamic()
+{
+    static const short order[CodeLengthCodes] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+
+    const int lengthCount = bits(5) + 257;
+    const int distanceCount = bits(5) + 1;
+    const int codeLengthCount = bits(4) + 4;
+    if (m_error || lengthCount > 286 || distanceCount > DistanceCodes)
+        return false;
+
+    // the code lengths of both codes are themselves Huffman coded
+    short lengths[286 + DistanceCodes];
+    int index = 0;
+    for (; index < codeLengthCount; ++index)
+        lengths[order[index]] = short(bits(3));
+    for (; index < CodeLengthCodes; ++index)
+        lengths[order[index]] = 0;
+    if (m_error)
+        return false;
+
+    Huffman lengthCodes;
+    if (construct(&lengthCodes, lengths, CodeLengthCodes) != 0)
+        return false;
+
+    index = 0;
+    while (index < lengthCount + distanceCount) {
+        int symbol = decode(lengthCodes);
+        if (symbol < 0)
+            return false;
+
+        if (symbol < 16) {
+            lengths[index++] = short(symbol);
+            continue;
+        }
+
+        short length = 0;
+        if (symbol == 16) {
+            if (index == 0)
+                return false;
+            length = lengths[index - 1];
+            symbol = 3 + bits(2);
+        } else if (symbol == 17) {
+            symbol = 3 + bits(3);
+        } else {
+            symbol = 11 + bits(7);
+        }
+
+        if (m_error || index + symbol > lengthCount + distanceCount)
+            return false;
+        while (symbol--)
+            lengths[index++] = length;
+    }
+
+    // a block can't end without a code for its end
+    if (lengths[256] == 0)
+        return false;
+
+    // incomplete codes are only allowed for a single length 1 code
+    int left = construct(&lengthCodes, lengths, lengthCount);
+    if (left && (left < 0 || lengthCount != lengthCodes.count[0] + lengthCodes.count[1]))
+        return false;
+
+    Huffman distanceCodes;
+    left = construct(&distanceCodes, lengths + lengthCount, distanceCount);
+    if (left && (left < 0 || distanceCount != distanceCodes.count[0] + distanceCodes.count[1]))
+        return false;
+
+    return codes(lengthCodes, distanceCodes);
+}
+
+bool Inflater::codes(const Huffman &lengthCodes, const Huffman &distanceCodes)
+{
+    static const short lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const short lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const short distanceBase[DistanceCodes] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577
+    };
+    static const short distanceExtra[DistanceCodes] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    for (;;) {
+        int symbol = decode(lengthCodes);
+        if (symbol < 0)
+            return false;
+        if (symbol == 256)
+            return true;
+
+        if (symbol < 256) {
+            if (!reserve(1))
+                return false;
+            m_output->append(char(symbol));
+            continue;
+        }
+
+        // a length and distance pair, copying earlier output
+        symbol -= 257;
+        if (symbol >= 29)
+            return false;
+        const int length = lengthBase[symbol] + bits(lengthExtra[symbol]);
+
+        symbol = decode(distanceCodes);
+        if (symbol < 0 || symbol >= DistanceCodes)
+            return false;
+        const int distance = distanceBase[symbol] + bits(distanceExtra[symbol]);
+        if (m_error || distance > m_output->size() - m_start || !reserve(length))
+            return false;
+
+        // the copy may overlap with what it produces
+        const int from = m_output->size() - distance;
+        for (int i = 0; i < length; ++i)
+            m_output->append(m_output->at(from + i));
+    }
+}
+
+bool Inflater::run()
+{
+    int last;
+    do {
+        last = bits(1);
+        const int type = bits(2);
+        if (m_error)
+            return false;
+
+        bool decoded;
+        switch (type) {
+        case 0:
+            decoded = stored();
+            break;
+        case 1:
+            decoded = fixed();
+            break;
+        case 2:
+            decoded = dynamic();
+            break;
+        default:
+            decoded = false;
+            break;
+        }
+
+        if (!decoded || m_error)
+            return false;
+        if (m_flushed && m_position == m_size)
+            return true;
+    } while (!last);
+
+    return true;
+}
+
+QJsonRpcCompression::Encoding QJsonRpcCompression::encodingForName(const QByteArray &name)
+{
+    const QByteArray coding = name.trimmed().toLower();
+    if (coding.isEmpty() || coding == "identity")
+        return Identity;
+    if (coding == "gzip" || coding == "x-gzip")
+        return Gzip;
+    if (coding == "deflate")
+        return Deflate;
+    return UnknownEncoding;
+}
+
+QByteArray QJsonRpcCompression::nameForEncoding(Encoding encoding)
+{
+    switch (encoding) {
+    case Gzip:
+        return "gzip";
+    case Deflate:
+        return "deflate";
+    case Identity:
+        return "identity";
+    case UnknownEncoding:
+        break;
+    }
+
+    return QByteArray();
+}
+
+QJsonRpcCompression::Encoding QJsonRpcCompression::negotiate(const QByteArray &acceptEncoding)
+{
+    // quality values of the supported codings, -1 for not mentioned
+    double gzip = -1;
+    double deflate = -1;
+    double any = -1;
+    const QList<QByteArray> codings = acceptEncoding.split(',');
+    foreach (const QByteArray &entry, codings) {
+        const int parameters = entry.indexOf(';');
+        const Encoding encoding = encodingForName(entry.left(parameters));
+        const bool wildcard = entry.left(parameters).trimmed() == "*";
+
+        double quality = 1;
+        if (parameters >= 0) {
+            const QByteArray parameter = entry.mid(parameters + 1).trimmed().toLower();
+            if (parameter.startsWith("q="))
+                quality = parameter.mid(2).toDouble();
+        }
+
+        if (encoding == Gzip)
+            gzip = quality;
+        else if (encoding == Deflate)
+            deflate = quality;
+        else if (wildcard)
+            any = quality;
+    }
+
+    if (gzip < 0)
+        gzip = any;
+    if (deflate < 0)
+        deflate = any;
+
+    if (gzip > 0 && gzip >= deflate)
+        return Gzip;
+    if (deflate > 0)
+        return Deflate;
+    return Identity;
+}
+
+QByteArray QJsonRpcCompression::compress(const QByteArray &data, Encoding encoding, int level)
+{
+    if (encoding != Deflate && encoding != Gzip)
+        return QByteArray();
+
+    // qCompress' output is the size of data followed by a zlib stream, a
+    // 2 byte header, the raw DEFLATE data and an Adler-32. Empty input
+    // gives the size alone
+    QByteArray zlib = qCompress(data, level);
+    if (zlib.size() < 4 + 2 + 4)
+        return QByteArray();
+
+    if (encoding == Deflate) {
+        zlib.remove(0, 4);
+        return zlib;
+    }
+
+    static const char header[10] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+    const int rawSize = zlib.size() - 4 - 2 - 4;
+    QByteArray gzip;
+    gzip.reserve(sizeof(header) + rawSize + 8);
+    gzip.append(header, sizeof(header));
+    gzip.append(zlib.constData() + 4 + 2, rawSize);
+    appendLittleEndian(&gzip, crc32(data.constData(), data.size()));
+    appendLittleEndian(&gzip, quint32(data.size()));
+    return gzip;
+}
+
+bool QJsonRpcCompression::decompress(const QByteArray &data, Encoding encoding, QByteArray *result,
+                                     int maximumSize, bool *sizeExceeded)
+{
+    if (sizeExceeded)
+        *sizeExceeded = false;
+    result->clear();
+
+    const uchar *begin = reinterpret_cast<const uchar*>(data.constData());
+    const int size = data.size();
+    switch (encoding) {
+    case Identity:
+        if (maximumSize > 0 && size > maximumSize) {
+            if (sizeExceeded)
+                *sizeExceeded = true;
+            return false;
+        }
+
+        *result = data;
+        return true;
+
+    case Deflate: {
+        // a zlib stream, some clients send raw DEFLATE data instead
+        int offset = 0;
+        const bool wrapped = size >= 2 && (begin[0] & 0x0f) == 8 && !(begin[1] & 0x20) &&
+                             ((begin[0] << 8) | begin[1]) % 31 == 0;
+        if (wrapped)
+            offset = 2;
+
+        Inflater inflater(begin + offset, size - offset, result, maximumSize);
+        if (!inflater.run()) {
+            if (sizeExceeded)
+                *sizeExceeded = inflater.sizeExceeded();
+            return false;
+        }
+
+        if (!wrapped)
+            return true;
+
+        offset += inflater.consumed();
+        if (offset + 4 > size)
+            return false;
+        const quint32 checksum = (quint32(begin[offset]) << 24) | (quint32(begin[offset + 1]) << 16) |
+                                 (quint32(begin[offset + 2]) << 8) | quint32(begin[offset + 3]);
+        return checksum == adler32(result->constData(), result->size());
+    }
+
+    case Gzip: {
+        // one or more members, each checked on its own
+        int position = 0;
+        do {
+            if (size - position < 18)
+                return false;
+
+            const uchar *member = begin + position;
+            if (member[0] != 0x1f || member[1] != 0x8b || member[2] != 8)
+                return false;
+
+            const int flags = member[3];
+            int offset = position + 10;
+            if (flags & 0x04) {         // FEXTRA
+                if (offset + 2 > size)
+                    return false;
+                offset += 2 + (begin[offset] | (begin[offset + 1] << 8));
+            }
+            for (int field = 0x08; field <= 0x10; field <<= 1) {
+                if (!(flags & field))   // FNAME and FCOMMENT, zero terminated
+                    continue;
+                while (offset < size && begin[offset] != 0)
+                    ++offset;
+                ++offset;
+            }
+            if (flags & 0x02)           // FHCRC
+                offset += 2;
+            if (offset > size)
+                return false;
+
+            const int start = result->size();
+            Inflater inflater(begin + offset, size - offset, result, maximumSize);
+            if (!inflater.run()) {
+                if (sizeExceeded)
+                    *sizeExceeded = inflater.sizeExceeded();
+                return false;
+            }
+
+            offset += inflater.consumed();
+            if (offset + 8 > size)
+                return false;
+
+            const int length = result->size() - start;
+            if (readLittleEndian(begin + offset) != crc32(result->constData() + start, length) ||
+                readLittleEndian(begin + offset + 4) != quint32(length))
+                return false;
+            position = offset + 8;
+        } while (position < size);
+
+        return true;
+    }
+
+    case UnknownEncoding:
+        break;
+    }
+
+    return false;
+}
+
+QByteArray QJsonRpcCompression::deflateMessage(const QByteArray &data, int level)
+{
+    // the raw DEFLATE data of qCompress ends with a final block rather than
+    // a flush, which RFC 7692 allows; the empty stored block that has to
+    // follow is left with the 3 bits of its header once its length is
+    // stripped, a zero byte
+    const QByteArray zlib = qCompress(data, level);
+    if (zlib.size() < 4 + 2 + 4)
+        return QByteArray("\x03\x00\x00", 3);
+
+    QByteArray message = zlib.mid(4 + 2, zlib.size() - 4 - 2 - 4);
+    message.append('\0');
+    return message;
+}
+
+bool QJsonRpcCompression::inflateMessage(const QByteArray &data, QByteArray *result,
+                                         int maximumSize, bool *sizeExceeded)
+{
+    if (sizeExceeded)
+        *sizeExceeded = false;
+    result->clear();
+
+    // the length of the empty stored block ending the sender's flush
+    QByteArray flushed;
+    flushed.reserve(data.size() + 4);
+    flushed.append(data);
+    flushed.append("\x00\x00\xff\xff", 4);
+
+    Inflater inflater(reinterpret_cast<const uchar*>(flushed.constData()), flushed.size(),
+                      result, maximumSize, true);
+    if (!inflater.run()) {
+        if (sizeExceeded)
+            *sizeExceeded = inflater.sizeExceeded();
+        return false;
+    }
+
+    return true;
+}
+
+quint32 QJsonRpcCompression::crc32(const char *data, int size)
+{
+    quint32 crc = 0xffffffff;
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    for (int i = 0; i < size; ++i)
+        crc = crcTable.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+quint32 QJsonRpcCompression::adler32(const char *data, int size)
+{
+    // the sums can go 5552 bytes without reducing before overflowing
+    quint32 a = 1;
+    quint32 b = 0;
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    while (size > 0) {
+        const int block = qMin(size, 5552);
+        for (int i = 0; i < block; ++i) {
+            a += p[i];
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+        p += block;
+        size -= block;
+    }
+
+    return (b << 16) | a;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCCOMPRESSION_P_H
+#define QJSONRPCCOMPRESSION_P_H
+
+#include <QByteArray>
+
+#include "qjsonrpcglobal.h"
+
+// Content codings of HTTP bodies (RFC 7230 4.2). Bodies are compressed with
+// qCompress, whose zlib stream is the deflate coding and holds the raw DEFLATE
+// data a gzip member wraps. qUncompress can't read gzip members, which carry
+// a CRC-32 where zlib has an Adler-32, so they are inflated here instead.
+class QJSONRPC_EXPORT QJsonRpcCompression
+{
+public:
+    enum Encoding {
+        Identity,
+        Deflate,
+        Gzip,
+        UnknownEncoding
+    };
+
+    // the coding named by a Content-Encoding header
+    static Encoding encodingForName(const QByteArray &name);
+    static QByteArray nameForEncoding(Encoding encoding);
+
+    // the coding an Accept-Encoding header prefers among those supported,
+    // gzip when it doesn't matter
+    static Encoding negotiate(const QByteArray &acceptEncoding);
+
+    // level is zlib's, -1 for its default. Empty if data couldn't be compressed
+    static QByteArray compress(const QByteArray &data, Encoding encoding, int level = -1);
+
+    // false for malformed data and for output larger than maximumSize, if
+    // not 0, which *sizeExceeded tells apart
+    static bool decompress(const QByteArray &data, Encoding encoding, QByteArray *result,
+                           int maximumSize = 0, bool *sizeExceeded = 0);
+
+    // The payload of a WebSocket message compressed by permessage-deflate
+    // (RFC 7692): raw DEFLATE data without the last 4 bytes of the flush
+    // ending it. Messages are compressed without context takeover, each on
+    // its own, and only such messages can be inflated
+    static QByteArray deflateMessage(const QByteArray &data, int level = -1);
+    static bool inflateMessage(const QByteArray &data, QByteArray *result,
+                               int maximumSize = 0, bool *sizeExceeded = 0);
+
+    static quint32 crc32(const char *data, int size);
+    static quint32 adler32(const char *data, int size);
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCCOROUTINE_H
+#define QJSONRPCCOROUTINE_H
+
+#include "qjsonrpcglobal.h"
+
+#if defined(QJSONRPC_HAS_COROUTINES)
+#include <coroutine>
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#include "qjsonrpcmessage.h"
+#include "qjsonrpcservicereply.h"
+
+// The response to a request already sent, to co_await on from a
+// coroutine. The coroutine is suspended until the reply finished, timed
+// out or was destroyed, and resumed from the event loop of the thread
+// that awaited it, never from within the reply's signal. The reply is
+// deleted along with the call.
+//
+//     QJsonRpcMessage response = co_await socket->call("service.method", 42).timeout(500);
+//     if (response.type() == QJsonRpcMessage::Error)
+//         ...
+//
+// Aborting the reply resumes the coroutine with a CancelledError.
+class QJsonRpcPendingCall
+{
+public:
+    // a null reply, for a request that couldn't be sent, resumes right away
+    // with an InternalError
+    QJsonRpcPendingCall(QJsonRpcServiceReply *reply, const QJsonRpcMessage &request)
+        : m_reply(reply), m_request(request), m_timeout(0), m_state(nullptr) {}
+
+    QJsonRpcPendingCall(QJsonRpcPendingCall &&other) noexcept
+        : m_reply(other.m_reply), m_request(other.m_request),
+          m_timeout(other.m_timeout), m_state(other.m_state)
+    {
+        other.m_reply = nullptr;
+        other.m_state = nullptr;
+    }
+
+    ~QJsonRpcPendingCall()
+    {
+        // the coroutine may be destroyed while suspended, or from within the
+        // state's own slot when it runs to completion after being resumed
+        if (m_state) {
+            m_state->handle = nullptr;
+            m_state->deleteLater();
+        }
+        if (m_reply)
+            m_reply->deleteLater();
+    }
+
+    QJsonRpcServiceReply *reply() const { return m_reply; }
+
+    // bounds the wait to msecs, after which the coroutine resumes with a
+    // TimeoutError; the reply's own timeout still applies
+    QJsonRpcPendingCall &&timeout(int msecs) &&
+    {
+        m_timeout = msecs;
+        return std::move(*this);
+    }
+
+    bool await_ready() const
+    {
+        return !m_reply || m_reply->response().isValid();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_state = new State(handle);
+        State *state = m_state;
+        QPointer<QJsonRpcServiceReply> reply = m_reply;
+        const QJsonRpcMessage request = m_request;
+        QObject::connect(m_reply.data(), &QJsonRpcServiceReply::finished, state,
+                         [state, reply]() { if (reply) state->resume(reply->response()); },
+                         Qt::QueuedConnection);
+        QObject::connect(m_reply.data(), &QObject::destroyed, state,
+                         [state, request]() {
+                             state->resume(request.createErrorResponse(QJsonRpc::CancelledError,
+                                                                       "reply destroyed"));
+                         }, Qt::QueuedConnection);
+        if (m_timeout > 0)
+            QTimer::singleShot(m_timeout, state, [state, request]() {
+                state->resume(request.createErrorResponse(QJsonRpc::TimeoutError,
+                                                          "request timed out"));
+            });
+    }
+
+    QJsonRpcMessage await_resume() const
+    {
+        if (m_state)
+            return m_state->response;
+        if (!m_reply)
+            return m_request.createErrorResponse(QJsonRpc::InternalError, "unable to send request");
+        return m_reply->response();
+    }
+
+private:
+    // receives the wakeup in the awaiting thread, lives as long as the call
+    class State : public QObject
+    {
+    public:
+        explicit State(std::coroutine_handle<> handle) : handle(handle) {}
+
+        void resume(const QJsonRpcMessage &message)
+        {
+            if (!handle)
+                return;
+
+            response = message;
+            std::coroutine_handle<> resumed = handle;
+            handle = nullptr;
+            resumed.resume();
+        }
+
+        std::coroutine_handle<> handle;
+        QJsonRpcMessage response;
+    };
+
+    QPointer<QJsonRpcServiceReply> m_reply;
+    QJsonRpcMessage m_request;
+    int m_timeout;
+    State *m_state;
+
+    Q_DISABLE_COPY(QJsonRpcPendingCall)
+};
+
+#endif
+
+#endif
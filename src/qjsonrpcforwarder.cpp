@@ -0,0 +1,88 @@
+#include "qjsonrpcsocket.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcforwarder_p.h"
+
+QJsonRpcForwarder::QJsonRpcForwarder(QJsonRpcAbstractSocket *backend, QObject *parent)
+    : QObject(parent),
+      m_backend(backend)
+{
+    connect(backend, SIGNAL(messageReceived(QJsonRpcMessage)),
+               this, SLOT(_q_relayResponse(QJsonRpcMessage)));
+    connect(backend, SIGNAL(destroyed()), this, SLOT(_q_backendDestroyed()));
+}
+
+QJsonRpcForwarder::~QJsonRpcForwarder()
+{
+    // still answered, rather than left waiting for their timeout
+    _q_backendDestroyed();
+}
+
+void QJsonRpcForwarder::forward(QJsonRpcAbstractSocket *client, const QJsonRpcMessage &message,
+                                const QJsonRpcCallPointer &call)
+{
+    if (message.type() != QJsonRpcMessage::Request) {
+        if (call)
+            call->finish(QJsonRpcMessage());
+        if (m_backend)
+            m_backend.data()->notify(message);
+        return;
+    }
+
+    PendingRequest pending;
+    pending.client = client;
+    pending.request = message;
+    pending.call = call;
+    if (!m_backend || !m_backend.data()->isValid()) {
+        respond(pending, message.createErrorResponse(QJsonRpc::InternalError, "backend unavailable"));
+        return;
+    }
+
+    // the backend is only left what remains of the client's timeout
+    QJsonRpcMessage request = message;
+    const qint64 remaining = QJsonRpcMessagePrivate::remainingTime(message);
+    if (remaining >= 0)
+        request = QJsonRpcMessagePrivate::withTimeout(message, int(remaining));
+
+    const qint64 id = QJsonRpcMessagePrivate::nextRequestId();
+    m_pending.insert(id, pending);
+    m_backend.data()->notify(QJsonRpcMessagePrivate::withId(request, QJsonValue(double(id))));
+}
+
+void QJsonRpcForwarder::respond(const PendingRequest &pending, const QJsonRpcMessage &response)
+{
+    if (pending.call)
+        pending.call->finish(response);
+    if (pending.client)
+        pending.client.data()->notify(response);
+}
+
+void QJsonRpcForwarder::_q_relayResponse(const QJsonRpcMessage &response)
+{
+    if (response.type() != QJsonRpcMessage::Response && response.type() != QJsonRpcMessage::Error)
+        return;
+
+    QHash<qint64, PendingRequest>::iterator it = m_pending.find(response.id());
+    if (it == m_pending.end())
+        return;
+
+    // answers the client's request, in the batch or on the stream it was
+    // read in if any
+    const PendingRequest pending = it.value();
+    m_pending.erase(it);
+    QJsonRpcMessage relayed = QJsonRpcMessagePrivate::withId(response,
+                                  QJsonRpcMessagePrivate::idValue(pending.request));
+    relayed = QJsonRpcMessagePrivate::withStream(relayed,
+                  QJsonRpcMessagePrivate::stream(pending.request));
+    respond(pending, QJsonRpcMessagePrivate::withBatch(relayed,
+                         QJsonRpcMessagePrivate::batch(pending.request)));
+}
+
+void QJsonRpcForwarder::_q_backendDestroyed()
+{
+    const QList<PendingRequest> pending = m_pending.values();
+    m_pending.clear();
+    for (int i = 0; i < pending.size(); ++i) {
+        respond(pending.at(i), pending.at(i).request.createErrorResponse(
+                    QJsonRpc::InternalError, "backend unavailable"));
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCFORWARDER_P_H
+#define QJSONRPCFORWARDER_P_H
+
+#include <QObject>
+#include <QPointer>
+#include <QHash>
+
+#include "qjsonrpcmessage.h"
+#include "qjsonrpcmetrics_p.h"
+
+// Relays the calls of the services a provider routes to one backend, as
+// they were read, see QJsonRpcServiceProvider::addBackend(). Requests go
+// out with ids of the forwarder's own, those of clients may clash, which
+// are swapped back in the responses relayed in return. Neither params nor
+// results are decoded on the way.
+class QJsonRpcAbstractSocket;
+class QJsonRpcForwarder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcForwarder(QJsonRpcAbstractSocket *backend, QObject *parent = 0);
+    ~QJsonRpcForwarder();
+
+    QJsonRpcAbstractSocket *backend() const { return m_backend.data(); }
+    void forward(QJsonRpcAbstractSocket *client, const QJsonRpcMessage &message,
+                 const QJsonRpcCallPointer &call);
+
+private Q_SLOTS:
+    void _q_relayResponse(const QJsonRpcMessage &response);
+    void _q_backendDestroyed();
+
+private:
+    struct PendingRequest
+    {
+        QPointer<QJsonRpcAbstractSocket> client;
+        QJsonRpcMessage request;
+        QJsonRpcCallPointer call;
+    };
+    void respond(const PendingRequest &pending, const QJsonRpcMessage &response);
+
+    QPointer<QJsonRpcAbstractSocket> m_backend;
+    QHash<qint64, PendingRequest> m_pending;     // by the id sent to the backend
+};
+
+#endif
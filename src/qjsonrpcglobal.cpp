@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include "qjsonrpcglobal.h"
+
+#if QT_VERSION >= 0x050400
+namespace {
+// off by default, like the QJSONRPC_DEBUG switch it replaces; logging rules
+// such as "qjsonrpc.debug=true" apply as usual
+class QJsonRpcLoggingCategory : public QLoggingCategory
+{
+public:
+    QJsonRpcLoggingCategory()
+        : QLoggingCategory("qjsonrpc", QtWarningMsg)
+    {
+        if (!qgetenv("QJSONRPC_DEBUG").isEmpty())
+            setEnabled(QtDebugMsg, true);
+    }
+};
+}
+
+const QLoggingCategory &qjsonrpcLog()
+{
+    static QJsonRpcLoggingCategory category;
+    return category;
+}
+#else
+bool qJsonRpcDebugEnabled()
+{
+    static const bool enabled = !qgetenv("QJSONRPC_DEBUG").isEmpty();
+    return enabled;
+}
+#endif
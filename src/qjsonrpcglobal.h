@@ -32,12 +32,42 @@ namespace QJsonRpc {
         InternalError   = -32603,           // Internal JSON-RPC error.
         ServerErrorBase = -32000,           // Reserved for implementation-defined server-errors.
         UserError       = -32099,           // Anything after this is user defined
-        TimeoutError    = -32100
+        TimeoutError    = -32100,
+        CancelledError  = -32101,           // The request was aborted before its response arrived.
+        OverloadedError = -32001            // The server turned the request away, it may be retried later.
+    };
+
+    // order in which queued requests are dispatched
+    enum Priority {
+        HighPriority,
+        NormalPriority,
+        LowPriority
+    };
+
+    // how messages are delimited on stream transports
+    enum FramingMode {
+        JsonFraming,                // messages are delimited by the JSON documents themselves
+        ContentLengthFraming        // messages are prefixed with a "Content-Length: N\r\n\r\n" header
     };
 }
 Q_DECLARE_METATYPE(QJsonRpc::ErrorCode)
 
-#define qJsonRpcDebug if (qgetenv("QJSONRPC_DEBUG").isEmpty()); else qDebug
+// std::function based APIs are only available when building with C++11
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#   define QJSONRPC_HAS_STD_FUNCTION
+#endif
+
+// so are the variadic invokeRemoteMethod overloads
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#   define QJSONRPC_HAS_VARIADIC_TEMPLATES
+#endif
+
+// co_await on client calls needs C++20 coroutines, and functors queued
+// through QMetaObject::invokeMethod
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && \
+    QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#   define QJSONRPC_HAS_COROUTINES
+#endif
 
 #ifdef QJSONRPC_SHARED
 #   ifdef QJSONRPC_BUILD
@@ -49,4 +79,17 @@ Q_DECLARE_METATYPE(QJsonRpc::ErrorCode)
 #   define QJSONRPC_EXPORT
 #endif
 
+// Debug output goes to the "qjsonrpc" logging category where available, and
+// is also enabled by setting QJSONRPC_DEBUG. The check is resolved once, and
+// the streamed arguments are only evaluated when output is enabled.
+#if QT_VERSION >= 0x050400
+#include <QLoggingCategory>
+QJSONRPC_EXPORT const QLoggingCategory &qjsonrpcLog();
+#define qJsonRpcDebug() qCDebug(qjsonrpcLog)
+#else
+#include <QDebug>
+QJSONRPC_EXPORT bool qJsonRpcDebugEnabled();
+#define qJsonRpcDebug if (!qJsonRpcDebugEnabled()); else qDebug
+#endif
+
 #endif
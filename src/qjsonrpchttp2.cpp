@@ -0,0 +1,1221 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <cstring>
+
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpchttpserver_p.h"
+#include "qjsonrpchttp2_p.h"
+
+// RFC 7541, appendix A
+static const struct {
+    const char *name;
+    const char *value;
+} staticTable[QJsonRpcHpackTable::StaticTableSize] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+// RFC 7541, appendix B: code and length in bits of every octet, and EOS
+static const struct {
+    quint32 code;
+    int length;
+} huffmanCodes[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+// The code is canonical: codes of one length are consecutive and ordered
+// by symbol, so decoding only needs the first code and the symbols of each
+// length. Built before main from huffmanCodes
+static struct HuffmanDecodingTable
+{
+    enum { MaximumCodeLength = 30 };
+
+    HuffmanDecodingTable()
+    {
+        int index = 0;
+        quint32 code = 0;
+        for (int length = 1; length <= MaximumCodeLength; ++length) {
+            firstIndex[length] = index;
+            firstCode[length] = code;
+            for (int symbol = 0; symbol < 257; ++symbol) {
+                if (huffmanCodes[symbol].length == length)
+                    symbols[index++] = quint16(symbol);
+            }
+
+            count[length] = quint32(index - firstIndex[length]);
+            code = (code + count[length]) << 1;
+        }
+    }
+
+    quint32 firstCode[MaximumCodeLength + 1];
+    quint32 count[MaximumCodeLength + 1];
+    int firstIndex[MaximumCodeLength + 1];
+    quint16 symbols[257];
+} huffmanDecodingTable;
+
+static bool huffmanDecode(const uchar *data, const uchar *end, QByteArray *out)
+{
+    quint32 code = 0;
+    int length = 0;
+    for (; data != end; ++data) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((*data >> bit) & 1);
+            if (++length > HuffmanDecodingTable::MaximumCodeLength)
+                return false;
+
+            const quint32 offset = code - huffmanDecodingTable.firstCode[length];
+            if (code >= huffmanDecodingTable.firstCode[length] && offset < huffmanDecodingTable.count[length]) {
+                const int symbol = huffmanDecodingTable.symbols[huffmanDecodingTable.firstIndex[length] + offset];
+                if (symbol == 256)      // EOS
+                    return false;
+                out->append(char(symbol));
+                code = 0;
+                length = 0;
+            }
+        }
+    }
+
+    // padding is a prefix of EOS, all ones and shorter than an octet
+    return length < 8 && code == (1u << length) - 1;
+}
+
+static int huffmanEncodedSize(const QByteArray &data)
+{
+    qint64 bits = 0;
+    for (int i = 0; i < data.size(); ++i)
+        bits += huffmanCodes[uchar(data.at(i))].length;
+    return int((bits + 7) / 8);
+}
+
+static void huffmanEncode(const QByteArray &data, QByteArray *out)
+{
+    quint64 buffer = 0;
+    int bits = 0;
+    for (int i = 0; i < data.size(); ++i) {
+        const int symbol = uchar(data.at(i));
+        buffer = (buffer << huffmanCodes[symbol].length) | huffmanCodes[symbol].code;
+        bits += huffmanCodes[symbol].length;
+        while (bits >= 8) {
+            bits -= 8;
+            out->append(char(buffer >> bits));
+        }
+        buffer &= (quint64(1) << bits) - 1;
+    }
+
+    if (bits > 0)
+        out->append(char((buffer << (8 - bits)) | (0xff >> bits)));
+}
+
+static void encodeInteger(QByteArray *out, int prefixBits, uchar flags, quint32 value)
+{
+    const quint32 maximum = (1u << prefixBits) - 1;
+    if (value < maximum) {
+        out->append(char(flags | value));
+        return;
+    }
+
+    out->append(char(flags | maximum));
+    value -= maximum;
+    while (value >= 0x80) {
+        out->append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->append(char(value));
+}
+
+static bool decodeInteger(const uchar *&data, const uchar *end, int prefixBits, quint32 *value)
+{
+    if (data == end)
+        return false;
+
+    const quint32 maximum = (1u << prefixBits) - 1;
+    quint32 result = *data++ & maximum;
+    if (result < maximum) {
+        *value = result;
+        return true;
+    }
+
+    // four more octets are plenty for any sane index or length
+    for (int shift = 0; data != end && shift <= 21; shift += 7) {
+        const uchar octet = *data++;
+        result += quint32(octet & 0x7f) << shift;
+        if (!(octet & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void encodeString(QByteArray *out, const QByteArray &data)
+{
+    const int huffmanSize = huffmanEncodedSize(data);
+    if (huffmanSize < data.size()) {
+        encodeInteger(out, 7, 0x80, quint32(huffmanSize));
+        huffmanEncode(data, out);
+    } else {
+        encodeInteger(out, 7, 0x00, quint32(data.size()));
+        out->append(data);
+    }
+}
+
+static bool decodeString(const uchar *&data, const uchar *end, QByteArray *out)
+{
+    if (data == end)
+        return false;
+
+    const bool huffman = *data & 0x80;
+    quint32 length;
+    if (!decodeInteger(data, end, 7, &length) || quint32(end - data) < length)
+        return false;
+
+    if (huffman) {
+        out->clear();
+        if (!huffmanDecode(data, data + length, out))
+            return false;
+    } else {
+        *out = QByteArray(reinterpret_cast<const char *>(data), int(length));
+    }
+
+    data += length;
+    return true;
+}
+
+static inline int entrySize(const QByteArray &name, const QByteArray &value)
+{
+    return name.size() + value.size() + 32;
+}
+
+QJsonRpcHpackTable::QJsonRpcHpackTable()
+    : m_size(0),
+      m_maximumSize(DefaultMaximumSize)
+{
+}
+
+bool QJsonRpcHpackTable::entry(quint32 index, QByteArray *name, QByteArray *value) const
+{
+    if (index == 0)
+        return false;
+
+    if (index <= StaticTableSize) {
+        *name = staticTable[index - 1].name;
+        *value = staticTable[index - 1].value;
+        return true;
+    }
+
+    const quint32 dynamicIndex = index - StaticTableSize - 1;
+    if (dynamicIndex >= quint32(m_entries.size()))
+        return false;
+
+    *name = m_entries.at(int(dynamicIndex)).first;
+    *value = m_entries.at(int(dynamicIndex)).second;
+    return true;
+}
+
+quint32 QJsonRpcHpackTable::find(const QByteArray &name, const QByteArray &value,
+                                 bool *valueMatched) const
+{
+    quint32 nameIndex = 0;
+    for (int i = 0; i < StaticTableSize; ++i) {
+        if (name == staticTable[i].name) {
+            if (value == staticTable[i].value) {
+                *valueMatched = true;
+                return quint32(i + 1);
+            }
+
+            if (!nameIndex)
+                nameIndex = quint32(i + 1);
+        }
+    }
+
+    for (int i = 0; i < m_entries.size(); ++i) {
+        if (m_entries.at(i).first == name) {
+            if (m_entries.at(i).second == value) {
+                *valueMatched = true;
+                return quint32(StaticTableSize + i + 1);
+            }
+
+            if (!nameIndex)
+                nameIndex = quint32(StaticTableSize + i + 1);
+        }
+    }
+
+    *valueMatched = false;
+    return nameIndex;
+}
+
+void QJsonRpcHpackTable::insert(const QByteArray &name, const QByteArray &value)
+{
+    // an entry larger than the table empties it
+    const int size = entrySize(name, value);
+    if (size > m_maximumSize) {
+        m_entries.clear();
+        m_size = 0;
+        return;
+    }
+
+    evict(m_maximumSize - size);
+    m_entries.prepend(qMakePair(name, value));
+    m_size += size;
+}
+
+void QJsonRpcHpackTable::setMaximumSize(int size)
+{
+    m_maximumSize = size;
+    evict(size);
+}
+
+void QJsonRpcHpackTable::evict(int maximumSize)
+{
+    while (m_size > maximumSize && !m_entries.isEmpty()) {
+        const QJsonRpcHttp2Header entry = m_entries.takeLast();
+        m_size -= entrySize(entry.first, entry.second);
+    }
+}
+
+QJsonRpcHpackDecoder::QJsonRpcHpackDecoder()
+{
+}
+
+bool QJsonRpcHpackDecoder::decode(const QByteArray &block, QJsonRpcHttp2HeaderList *headers,
+                                  int maximumListSize)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(block.constData());
+    const uchar *end = data + block.size();
+    // indexed fields expand a few bytes into whole entries, so the limit
+    // is checked against what was decoded rather than the block's size
+    qint64 listSize = 0;
+    while (data != end) {
+
+        const uchar first = *data;
+        QByteArray name;
+        QByteArray value;
+        if (first & 0x80) {
+            // indexed header field
+            quint32 index;
+            if (!decodeInteger(data, end, 7, &index) || !m_table.entry(index, &name, &value))
+                return false;
+            listSize += name.size() + value.size() + 32;
+            if (maximumListSize >= 0 && listSize > maximumListSize)
+                return false;
+            headers->append(qMakePair(name, value));
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20) {
+            // dynamic table size update, within what our settings allow
+            quint32 size;
+            if (!decodeInteger(data, end, 5, &size) || size > QJsonRpcHpackTable::DefaultMaximumSize)
+                return false;
+            m_table.setMaximumSize(int(size));
+            continue;
+        }
+
+        // literals, with incremental indexing, without or never indexed
+        const bool indexing = (first & 0xc0) == 0x40;
+        quint32 index;
+        if (!decodeInteger(data, end, indexing ? 6 : 4, &index))
+            return false;
+
+        if (index) {
+            QByteArray unused;
+            if (!m_table.entry(index, &name, &unused))
+                return false;
+        } else if (!decodeString(data, end, &name)) {
+            return false;
+        }
+
+        if (!decodeString(data, end, &value))
+            return false;
+
+        if (indexing)
+            m_table.insert(name, value);
+        listSize += name.size() + value.size() + 32;
+        if (maximumListSize >= 0 && listSize > maximumListSize)
+            return false;
+        headers->append(qMakePair(name, value));
+    }
+
+    return true;
+}
+
+QJsonRpcHpackEncoder::QJsonRpcHpackEncoder()
+    : m_tableSizeUpdate(-1)
+{
+}
+
+void QJsonRpcHpackEncoder::setMaximumTableSize(int size)
+{
+    // no more than the default is used, even if the peer allows it
+    size = qMin(size, int(QJsonRpcHpackTable::DefaultMaximumSize));
+    if (size == m_table.maximumSize())
+        return;
+
+    // the smallest size since the last block has to be announced as well,
+    // for the peer to evict the same entries
+    m_table.setMaximumSize(size);
+    if (m_tableSizeUpdate < 0 || size < m_tableSizeUpdate)
+        m_tableSizeUpdate = size;
+}
+
+static bool isIndexedHeader(const QByteArray &name)
+{
+    return name == "content-type" ||
+           name == "access-control-allow-origin" ||
+           name == "access-control-allow-methods" ||
+           name == "access-control-allow-headers";
+}
+
+void QJsonRpcHpackEncoder::encode(const QJsonRpcHttp2HeaderList &headers, QByteArray *block)
+{
+    if (m_tableSizeUpdate >= 0) {
+        encodeInteger(block, 5, 0x20, quint32(m_tableSizeUpdate));
+        if (m_tableSizeUpdate != m_table.maximumSize())
+            encodeInteger(block, 5, 0x20, quint32(m_table.maximumSize()));
+        m_tableSizeUpdate = -1;
+    }
+
+    for (int i = 0; i < headers.size(); ++i) {
+        const QByteArray &name = headers.at(i).first;
+        const QByteArray &value = headers.at(i).second;
+        bool valueMatched;
+        const quint32 index = m_table.find(name, value, &valueMatched);
+        if (index && valueMatched) {
+            encodeInteger(block, 7, 0x80, index);
+            continue;
+        }
+
+        const bool indexing = isIndexedHeader(name);
+        if (indexing)
+            encodeInteger(block, 6, 0x40, index);
+        else
+            encodeInteger(block, 4, 0x00, index);
+        if (!index)
+            encodeString(block, name);
+        encodeString(block, value);
+
+        if (indexing)
+            m_table.insert(name, value);
+    }
+}
+
+const char QJsonRpcHttp2Connection::preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static inline quint32 readUInt32(const char *data)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    return (quint32(bytes[0]) << 24) | (quint32(bytes[1]) << 16) |
+           (quint32(bytes[2]) << 8) | quint32(bytes[3]);
+}
+
+static inline void writeUInt32(char *data, quint32 value)
+{
+    data[0] = char(value >> 24);
+    data[1] = char(value >> 16);
+    data[2] = char(value >> 8);
+    data[3] = char(value);
+}
+
+static inline void writeSetting(char *data, int identifier, quint32 value)
+{
+    data[0] = char(identifier >> 8);
+    data[1] = char(identifier);
+    writeUInt32(data + 2, value);
+}
+
+QJsonRpcHttp2Connection::Stream::Stream()
+    : remoteClosed(false),
+      awaitingResponse(false),
+      requestId(-1),
+      pendingOffset(0),
+      sendWindow(0)
+{
+}
+
+QJsonRpcHttp2Connection::QJsonRpcHttp2Connection(QJsonRpcHttpServerSocket *socket)
+    : m_socket(socket),
+      m_prefaceReceived(false),
+      m_processing(false),
+      m_goingAway(false),
+      m_lastStreamId(0),
+      m_headerStreamId(0),
+      m_headerEndStream(false),
+      m_sendWindow(DefaultWindowSize),
+      m_initialSendWindow(DefaultWindowSize),
+      m_maximumSendFrameSize(DefaultMaximumFrameSize)
+{
+    m_headerBuffer.reserve(256);
+
+    // the server's connection preface. The connection window is opened
+    // beyond the default so that uploads don't wait for WINDOW_UPDATE
+    char settings[12];
+    writeSetting(settings, MaximumConcurrentStreamsSetting, MaximumConcurrentStreams);
+    writeSetting(settings + 6, MaximumHeaderListSizeSetting, MaximumHeaderBlockSize);
+    writeFrame(SettingsFrame, 0, 0, settings, sizeof(settings));
+    writeWindowUpdate(0, ConnectionWindowSize - DefaultWindowSize);
+}
+
+bool QJsonRpcHttp2Connection::processInput(const QByteArray &data)
+{
+    m_input.append(data);
+    if (m_processing)
+        return true;
+
+    m_processing = true;
+    bool ok = true;
+    while (ok) {
+        // frames refer into input, which stays valid if more data is
+        // appended to m_input while a request is dispatched
+        const QByteArray input = m_input;
+        const char *begin = input.constData();
+        int offset = 0;
+        if (!m_prefaceReceived) {
+            if (input.size() < PrefaceLength)
+                break;
+            if (memcmp(begin, preface, PrefaceLength) != 0) {
+                ok = connectionError(ProtocolError, "invalid connection preface");
+                break;
+            }
+
+            m_prefaceReceived = true;
+            offset = PrefaceLength;
+        }
+
+        while (input.size() - offset >= FrameHeaderSize) {
+            const uchar *header = reinterpret_cast<const uchar *>(begin + offset);
+            const int length = (int(header[0]) << 16) | (int(header[1]) << 8) | int(header[2]);
+            if (length > DefaultMaximumFrameSize) {
+                ok = connectionError(FrameSizeError, "frame larger than SETTINGS_MAX_FRAME_SIZE");
+                break;
+            }
+
+            if (input.size() - offset - FrameHeaderSize < length)
+                break;
+
+            const quint32 streamId = readUInt32(begin + offset + 5) & 0x7fffffff;
+            ok = processFrame(header[3], header[4], streamId,
+                              begin + offset + FrameHeaderSize, length);
+            offset += FrameHeaderSize + length;
+            if (!ok)
+                break;
+        }
+
+        if (!ok)
+            break;
+
+        // done, unless more arrived meanwhile
+        m_input.remove(0, offset);
+        if (m_input.size() == input.size() - offset)
+            break;
+    }
+    m_processing = false;
+
+    return ok;
+}
+
+bool QJsonRpcHttp2Connection::processFrame(int type, int flags, quint32 streamId,
+                                           const char *payload, int length)
+{
+    // nothing may come between a HEADERS frame and its CONTINUATION frames
+    if (m_headerStreamId && (type != ContinuationFrame || streamId != m_headerStreamId))
+        return connectionError(ProtocolError, "expected CONTINUATION frame");
+
+    switch (type) {
+    case DataFrame:
+        return processData(flags, streamId, payload, length);
+
+    case HeadersFrame:
+        return processHeaders(flags, streamId, payload, length);
+
+    case ContinuationFrame:
+        return processContinuation(flags, streamId, payload, length);
+
+    case PriorityFrame:
+        // all streams are served alike, priorities don't change anything
+        if (!streamId)
+            return connectionError(ProtocolError, "PRIORITY on stream 0");
+        if (length != 5)
+            resetStream(streamId, FrameSizeError);
+        return true;
+
+    case RstStreamFrame:
+        if (!streamId || streamId > m_lastStreamId)
+            return connectionError(ProtocolError, "RST_STREAM on idle stream");
+        if (length != 4)
+            return connectionError(FrameSizeError, "invalid RST_STREAM length");
+        m_streams.remove(streamId);
+        return true;
+
+    case SettingsFrame:
+        return processSettings(flags, streamId, payload, length);
+
+    case PushPromiseFrame:
+        return connectionError(ProtocolError, "PUSH_PROMISE from client");
+
+    case PingFrame:
+        if (streamId)
+            return connectionError(ProtocolError, "PING on a stream");
+        if (length != 8)
+            return connectionError(FrameSizeError, "invalid PING length");
+        if (!(flags & AckFlag))
+            writeFrame(PingFrame, AckFlag, 0, payload, length);
+        return true;
+
+    case GoAwayFrame:
+        // the client opens no more streams and closes the connection when
+        // it's done with those it has
+        if (streamId)
+            return connectionError(ProtocolError, "GOAWAY on a stream");
+        if (length < 8)
+            return connectionError(FrameSizeError, "invalid GOAWAY length");
+        return true;
+
+    case WindowUpdateFrame:
+        return processWindowUpdate(streamId, payload, length);
+    }
+
+    // unknown frame types are ignored
+    return true;
+}
+
+bool QJsonRpcHttp2Connection::processHeaders(int flags, quint32 streamId,
+                                             const char *payload, int length)
+{
+    if (!streamId)
+        return connectionError(ProtocolError, "HEADERS on stream 0");
+
+    int offset = 0;
+    int padding = 0;
+    if (flags & PaddedFlag) {
+        if (length < 1)
+            return connectionError(FrameSizeError, "invalid HEADERS length");
+        padding = uchar(payload[0]);
+        offset = 1;
+    }
+
+    if (flags & PriorityFlag)
+        offset += 5;
+    if (offset + padding > length)
+        return connectionError(ProtocolError, "invalid HEADERS padding");
+
+    m_headerStreamId = streamId;
+    m_headerEndStream = flags & EndStreamFlag;
+    m_headerBlock.resize(0);
+    m_headerBlock.append(payload + offset, length - offset - padding);
+    if (flags & EndHeadersFlag)
+        return processHeaderBlock();
+    return true;
+}
+
+bool QJsonRpcHttp2Connection::processContinuation(int flags, quint32 streamId,
+                                                  const char *payload, int length)
+{
+    Q_UNUSED(streamId)
+    if (!m_headerStreamId)
+        return connectionError(ProtocolError, "unexpected CONTINUATION frame");
+    if (m_headerBlock.size() + length > MaximumHeaderBlockSize)
+        return connectionError(EnhanceYourCalmError, "header block too large");
+
+    m_headerBlock.append(payload, length);
+    if (flags & EndHeadersFlag)
+        return processHeaderBlock();
+    return true;
+}
+
+bool QJsonRpcHttp2Connection::processHeaderBlock()
+{
+    const quint32 streamId = m_headerStreamId;
+    m_headerStreamId = 0;
+
+    // decoded even for streams that are refused, to keep the decoder's
+    // table in step with the client's
+    QJsonRpcHttp2HeaderList headers;
+    if (!m_decoder.decode(m_headerBlock, &headers, MaximumHeaderBlockSize))
+        return connectionError(CompressionError, "invalid header block");
+
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it != m_streams.end()) {
+        // trailers, which have to end the request
+        if (it->remoteClosed || !m_headerEndStream) {
+            resetStream(streamId, ProtocolError);
+            m_streams.erase(it);
+            return true;
+        }
+
+        it->remoteClosed = true;
+        dispatchRequest(streamId);
+        return true;
+    }
+
+    if (streamId <= m_lastStreamId)
+        return connectionError(StreamClosedError, "HEADERS on closed stream");
+    if (!(streamId & 1))
+        return connectionError(ProtocolError, "HEADERS on server stream");
+
+    m_lastStreamId = streamId;
+    if (m_goingAway)
+        return true;
+    if (m_streams.size() >= MaximumConcurrentStreams) {
+        resetStream(streamId, RefusedStreamError);
+        return true;
+    }
+
+    Stream stream;
+    QByteArray contentType;
+    QByteArray accept;
+    QByteArray contentLength;
+    for (int i = 0; i < headers.size(); ++i) {
+        const QByteArray &name = headers.at(i).first;
+        const QByteArray &value = headers.at(i).second;
+        if (name == ":method")
+            stream.method = value;
+        else if (name == "content-type")
+            contentType = value;
+        else if (name == "accept")
+            accept = value;
+        else if (name == "content-length")
+            contentLength = value;
+        else if (name == "origin")
+            stream.origin = value;
+        else if (name == "access-control-request-method")
+            stream.accessControlRequestMethod = value;
+        else if (name == "access-control-request-headers")
+            stream.accessControlRequestHeaders = value;
+    }
+
+    stream.remoteClosed = m_headerEndStream;
+    stream.sendWindow = m_initialSendWindow;
+    Stream &inserted = *m_streams.insert(streamId, stream);
+
+    // the checks done for HTTP/1.1 requests, except that Content-Length is
+    // optional since the DATA frames delimit the body
+    if (inserted.method == "OPTIONS") {
+        QJsonRpcHttp2HeaderList responseHeaders;
+        if (!inserted.origin.isNull())
+            responseHeaders.append(qMakePair(QByteArray("access-control-allow-origin"), inserted.origin));
+        if (!inserted.accessControlRequestMethod.isNull()) {
+            responseHeaders.append(qMakePair(QByteArray("access-control-allow-methods"),
+                                             inserted.accessControlRequestMethod));
+        }
+        if (!inserted.accessControlRequestHeaders.isNull()) {
+            responseHeaders.append(qMakePair(QByteArray("access-control-allow-headers"),
+                                             inserted.accessControlRequestHeaders));
+        }
+        respond(streamId, 200, responseHeaders);
+        return true;
+    }
+
+    if (inserted.method != "POST" && inserted.method != "GET") {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid method:" << inserted.method;
+        respond(streamId, 405, QJsonRpcHttp2HeaderList());
+        return true;
+    }
+
+    if (!QJsonRpcHttpServerSocket::isSupportedMediaType(contentType, accept)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid content or accept type";
+        respond(streamId, 400, QJsonRpcHttp2HeaderList());
+        return true;
+    }
+
+    if (!contentLength.isNull()) {
+        const quint64 size = contentLength.toULongLong();
+        const int maximum = m_socket->m_maximumRequestSize;
+        if (maximum > 0 && size > quint64(maximum)) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "request body of" << size << "bytes exceeds" << maximum;
+            respond(streamId, 413, QJsonRpcHttp2HeaderList());
+            return true;
+        }
+
+        inserted.body.reserve(int(qMin<quint64>(size, QJsonRpcHttpServerSocket::MaximumBodyReservation)));
+    }
+
+    if (inserted.remoteClosed)
+        dispatchRequest(streamId);
+    return true;
+}
+
+bool QJsonRpcHttp2Connection::processData(int flags, quint32 streamId,
+                                          const char *payload, int length)
+{
+    if (!streamId)
+        return connectionError(ProtocolError, "DATA on stream 0");
+
+    int offset = 0;
+    int padding = 0;
+    if (flags & PaddedFlag) {
+        if (length < 1)
+            return connectionError(FrameSizeError, "invalid DATA length");
+        padding = uchar(payload[0]);
+        offset = 1;
+    }
+
+    if (offset + padding > length)
+        return connectionError(ProtocolError, "invalid DATA padding");
+
+    // flow control counts the whole frame, the connection's share is given
+    // back right away since the data is dealt with as it arrives
+    if (length > 0)
+        writeWindowUpdate(0, quint32(length));
+
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it == m_streams.end()) {
+        if (streamId > m_lastStreamId)
+            return connectionError(ProtocolError, "DATA on idle stream");
+
+        // the rest of a request that was answered early or reset
+        return true;
+    }
+
+    if (it->remoteClosed) {
+        resetStream(streamId, StreamClosedError);
+        m_streams.erase(it);
+        return true;
+    }
+
+    const int size = length - offset - padding;
+    const int maximum = m_socket->m_maximumRequestSize;
+    if (maximum > 0 && qint64(it->body.size()) + size > maximum) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "request body exceeds" << maximum << "bytes";
+        respond(streamId, 413, QJsonRpcHttp2HeaderList());
+        return true;
+    }
+
+    it->body.append(payload + offset, size);
+    if (flags & EndStreamFlag) {
+        it->remoteClosed = true;
+        dispatchRequest(streamId);
+    } else if (length > 0) {
+        writeWindowUpdate(streamId, quint32(length));
+    }
+
+    return true;
+}
+
+bool QJsonRpcHttp2Connection::processSettings(int flags, quint32 streamId,
+                                              const char *payload, int length)
+{
+    if (streamId)
+        return connectionError(ProtocolError, "SETTINGS on a stream");
+    if (flags & AckFlag) {
+        if (length)
+            return connectionError(FrameSizeError, "SETTINGS acknowledgement with payload");
+        return true;
+    }
+
+    if (length % 6)
+        return connectionError(FrameSizeError, "invalid SETTINGS length");
+
+    for (int i = 0; i < length; i += 6) {
+        const int identifier = (int(uchar(payload[i])) << 8) | int(uchar(payload[i + 1]));
+        const quint32 value = readUInt32(payload + i + 2);
+        switch (identifier) {
+        case HeaderTableSizeSetting:
+            m_encoder.setMaximumTableSize(int(qMin<quint32>(value, QJsonRpcHpackTable::DefaultMaximumSize)));
+            break;
+
+        case EnablePushSetting:
+            if (value > 1)
+                return connectionError(ProtocolError, "invalid SETTINGS_ENABLE_PUSH");
+            break;
+
+        case InitialWindowSizeSetting: {
+            if (value > 0x7fffffff)
+                return connectionError(FlowControlError, "invalid SETTINGS_INITIAL_WINDOW_SIZE");
+
+            // applies to the streams already open as well
+            const qint64 delta = qint64(value) - m_initialSendWindow;
+            m_initialSendWindow = value;
+            for (QMap<quint32, Stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+                it->sendWindow += delta;
+            break;
+        }
+
+        case MaximumFrameSizeSetting:
+            if (value < DefaultMaximumFrameSize || value > 0xffffff)
+                return connectionError(ProtocolError, "invalid SETTINGS_MAX_FRAME_SIZE");
+            m_maximumSendFrameSize = int(value);
+            break;
+
+        default:
+            // the others don't limit what a server sends
+            break;
+        }
+    }
+
+    writeFrame(SettingsFrame, AckFlag, 0, 0, 0);
+    flushStreams();
+    return true;
+}
+
+bool QJsonRpcHttp2Connection::processWindowUpdate(quint32 streamId, const char *payload, int length)
+{
+    if (length != 4)
+        return connectionError(FrameSizeError, "invalid WINDOW_UPDATE length");
+
+    const quint32 increment = readUInt32(payload) & 0x7fffffff;
+    if (!streamId) {
+        if (!increment)
+            return connectionError(ProtocolError, "WINDOW_UPDATE without increment");
+        m_sendWindow += increment;
+        if (m_sendWindow > 0x7fffffff)
+            return connectionError(FlowControlError, "connection window overflow");
+        flushStreams();
+        return true;
+    }
+
+    // updates for streams that were closed meanwhile are to be expected
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it == m_streams.end())
+        return true;
+
+    it->sendWindow += increment;
+    if (!increment || it->sendWindow > 0x7fffffff) {
+        resetStream(streamId, increment ? FlowControlError : ProtocolError);
+        m_streams.erase(it);
+        return true;
+    }
+
+    flushStream(streamId);
+    return true;
+}
+
+void QJsonRpcHttp2Connection::dispatchRequest(quint32 streamId)
+{
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    // ids are only unique per client, the response is matched by stream
+    const QJsonRpcMessage message =
+        QJsonRpcMessagePrivate::withStream(QJsonRpcMessage::fromJson(it->body), streamId);
+    it->body = QByteArray();
+    it->awaitingResponse = true;
+    it->requestId = message.id();
+    Q_EMIT m_socket->messageReceived(message);
+
+    // answered or reset meanwhile, the stream may be gone
+    it = m_streams.find(streamId);
+    if (it == m_streams.end() || !it->awaitingResponse)
+        return;
+
+    // notifications have no response to wait for
+    if (message.type() == QJsonRpcMessage::Notification) {
+        it->awaitingResponse = false;
+        respond(streamId, 204, QJsonRpcHttp2HeaderList());
+    }
+}
+
+void QJsonRpcHttp2Connection::sendResponse(const QJsonRpcMessage &message)
+{
+    // the stream of its request, or for responses created without it the
+    // oldest stream waiting for a response with this id
+    const qint64 id = message.id();
+    const quint32 streamId = QJsonRpcMessagePrivate::stream(message);
+    QMap<quint32, Stream>::iterator it;
+    if (streamId) {
+        it = m_streams.find(streamId);
+        if (it != m_streams.end() && !it->awaitingResponse)
+            it = m_streams.end();
+    } else {
+        it = m_streams.begin();
+        while (it != m_streams.end() && !(it->awaitingResponse && it->requestId == id))
+            ++it;
+    }
+
+    if (it == m_streams.end()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "no stream waiting for response" << id;
+        return;
+    }
+
+    it->awaitingResponse = false;
+    QByteArray body;
+    QJsonRpcMessagePrivate::writeJson(message, body);
+    qJsonRpcDebug() << "sending(" << m_socket << ", stream" << it.key() << "): " << body;
+
+    QJsonRpcHttp2HeaderList headers;
+    headers.append(qMakePair(QByteArray("content-type"), QByteArray("application/json-rpc")));
+    if (!it->origin.isNull())
+        headers.append(qMakePair(QByteArray("access-control-allow-origin"), it->origin));
+    respond(it.key(), QJsonRpcHttpServerSocket::statusCodeForMessage(message), headers, body);
+}
+
+bool QJsonRpcHttp2Connection::hasPendingResponses() const
+{
+    for (QMap<quint32, Stream>::const_iterator it = m_streams.constBegin(); it != m_streams.constEnd(); ++it) {
+        if (it->awaitingResponse)
+            return true;
+    }
+
+    return false;
+}
+
+bool QJsonRpcHttp2Connection::isIdle() const
+{
+    return m_streams.isEmpty() && !m_headerStreamId;
+}
+
+void QJsonRpcHttp2Connection::goAway()
+{
+    char payload[8];
+    writeUInt32(payload, m_lastStreamId);
+    writeUInt32(payload + 4, NoError);
+    writeFrame(GoAwayFrame, 0, 0, payload, sizeof(payload));
+    m_goingAway = true;
+}
+
+void QJsonRpcHttp2Connection::respond(quint32 streamId, int statusCode,
+                                      const QJsonRpcHttp2HeaderList &headers, const QByteArray &body)
+{
+    QJsonRpcHttp2HeaderList responseHeaders;
+    responseHeaders.append(qMakePair(QByteArray(":status"), QByteArray::number(statusCode)));
+    responseHeaders += headers;
+    if (!body.isEmpty())
+        responseHeaders.append(qMakePair(QByteArray("content-length"), QByteArray::number(body.size())));
+
+    m_headerBuffer.resize(0);
+    m_encoder.encode(responseHeaders, &m_headerBuffer);
+
+    // a block larger than a frame goes on in CONTINUATION frames, END_STREAM
+    // belongs on the HEADERS frame all the same
+    const bool endStream = body.isEmpty();
+    int offset = 0;
+    do {
+        const int size = qMin(m_headerBuffer.size() - offset, m_maximumSendFrameSize);
+        int flags = (offset + size == m_headerBuffer.size()) ? EndHeadersFlag : 0;
+        if (offset == 0 && endStream)
+            flags |= EndStreamFlag;
+        writeFrame(offset == 0 ? HeadersFrame : ContinuationFrame, flags, streamId,
+                   m_headerBuffer.constData() + offset, size);
+        offset += size;
+    } while (offset < m_headerBuffer.size());
+
+    if (endStream) {
+        finishStream(streamId);
+        return;
+    }
+
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    it->pendingData = body;
+    it->pendingOffset = 0;
+    flushStream(streamId);
+}
+
+void QJsonRpcHttp2Connection::flushStream(quint32 streamId)
+{
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it == m_streams.end() || it->pendingData.isEmpty())
+        return;
+
+    Stream &stream = *it;
+    while (stream.pendingOffset < stream.pendingData.size()) {
+        const qint64 window = qMin(m_sendWindow, stream.sendWindow);
+        if (window <= 0)
+            return;
+
+        const int size = int(qMin<qint64>(qMin<qint64>(stream.pendingData.size() - stream.pendingOffset, window),
+                                          m_maximumSendFrameSize));
+        const bool last = stream.pendingOffset + size == stream.pendingData.size();
+        writeFrame(DataFrame, last ? EndStreamFlag : 0, streamId,
+                   stream.pendingData.constData() + stream.pendingOffset, size);
+        stream.pendingOffset += size;
+        stream.sendWindow -= size;
+        m_sendWindow -= size;
+    }
+
+    finishStream(streamId);
+}
+
+void QJsonRpcHttp2Connection::flushStreams()
+{
+    const QList<quint32> streamIds = m_streams.keys();
+    for (int i = 0; i < streamIds.size() && m_sendWindow > 0; ++i)
+        flushStream(streamIds.at(i));
+}
+
+void QJsonRpcHttp2Connection::finishStream(quint32 streamId)
+{
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it == m_streams.end())
+        return;
+
+    // answered before the request was complete, the rest isn't needed
+    if (!it->remoteClosed)
+        resetStream(streamId, NoError);
+    m_streams.erase(it);
+}
+
+void QJsonRpcHttp2Connection::writeFrame(int type, int flags, quint32 streamId,
+                                         const char *payload, int length)
+{
+    char header[FrameHeaderSize];
+    header[0] = char(length >> 16);
+    header[1] = char(length >> 8);
+    header[2] = char(length);
+    header[3] = char(type);
+    header[4] = char(flags);
+    writeUInt32(header + 5, streamId);
+
+    m_socket->write(header, FrameHeaderSize);
+    if (length > 0)
+        m_socket->write(payload, length);
+}
+
+void QJsonRpcHttp2Connection::writeWindowUpdate(quint32 streamId, quint32 increment)
+{
+    char payload[4];
+    writeUInt32(payload, increment);
+    writeFrame(WindowUpdateFrame, 0, streamId, payload, sizeof(payload));
+}
+
+void QJsonRpcHttp2Connection::resetStream(quint32 streamId, quint32 errorCode)
+{
+    char payload[4];
+    writeUInt32(payload, errorCode);
+    writeFrame(RstStreamFrame, 0, streamId, payload, sizeof(payload));
+}
+
+bool QJsonRpcHttp2Connection::connectionError(quint32 errorCode, const char *reason)
+{
+    qJsonRpcDebug() << Q_FUNC_INFO << reason;
+    char payload[8];
+    writeUInt32(payload, m_lastStreamId);
+    writeUInt32(payload + 4, errorCode);
+    writeFrame(GoAwayFrame, 0, 0, payload, sizeof(payload));
+    m_goingAway = true;
+    return false;
+}
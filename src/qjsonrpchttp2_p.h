@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCHTTP2_P_H
+#define QJSONRPCHTTP2_P_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QPair>
+
+#include "qjsonrpcglobal.h"
+#include "qjsonrpcmessage.h"
+
+typedef QPair<QByteArray, QByteArray> QJsonRpcHttp2Header;
+typedef QList<QJsonRpcHttp2Header> QJsonRpcHttp2HeaderList;
+
+// one side's header table of an HPACK (RFC 7541) context: the static table
+// followed by the dynamic one, newest entries first
+class QJSONRPC_EXPORT QJsonRpcHpackTable
+{
+public:
+    QJsonRpcHpackTable();
+
+    enum { StaticTableSize = 61, DefaultMaximumSize = 4096 };
+
+    bool entry(quint32 index, QByteArray *name, QByteArray *value) const;
+
+    // index of an entry with name and value, or failing that of one with
+    // name only, *valueMatched tells which. 0 if there is neither
+    quint32 find(const QByteArray &name, const QByteArray &value, bool *valueMatched) const;
+
+    void insert(const QByteArray &name, const QByteArray &value);
+    int maximumSize() const { return m_maximumSize; }
+    void setMaximumSize(int size);
+
+private:
+    void evict(int maximumSize);
+
+    QList<QJsonRpcHttp2Header> m_entries;
+    int m_size;
+    int m_maximumSize;
+};
+
+class QJSONRPC_EXPORT QJsonRpcHpackDecoder
+{
+public:
+    QJsonRpcHpackDecoder();
+
+    // false on a malformed block, which is fatal to the connection since
+    // the two tables can no longer be kept in step, and on one whose
+    // headers add up to more than maximumListSize as counted for
+    // SETTINGS_MAX_HEADER_LIST_SIZE, -1 for no limit
+    bool decode(const QByteArray &block, QJsonRpcHttp2HeaderList *headers,
+                int maximumListSize = -1);
+
+private:
+    QJsonRpcHpackTable m_table;
+};
+
+class QJSONRPC_EXPORT QJsonRpcHpackEncoder
+{
+public:
+    QJsonRpcHpackEncoder();
+
+    // values that repeat between responses, like content-type, are added
+    // to the dynamic table, others are sent literally every time
+    void encode(const QJsonRpcHttp2HeaderList &headers, QByteArray *block);
+
+    // the peer's SETTINGS_HEADER_TABLE_SIZE, announced in the next block
+    void setMaximumTableSize(int size);
+
+private:
+    QJsonRpcHpackTable m_table;
+    int m_tableSizeUpdate;      // -1 if there is none to announce
+};
+
+// Server side of an HTTP/2 (RFC 7540) connection on a QJsonRpcHttpServerSocket.
+// Each stream carries one JSON-RPC request in its DATA frames; requests are
+// dispatched as soon as their stream ends, so that several of them can be
+// outstanding at once, and answered on their stream as their responses come
+// back, in whatever order that is
+class QJsonRpcHttpServerSocket;
+class QJsonRpcHttp2Connection
+{
+public:
+    explicit QJsonRpcHttp2Connection(QJsonRpcHttpServerSocket *socket);
+
+    // what a client starts its connection with
+    static const char preface[];
+    enum { PrefaceLength = 24 };
+
+    // input starts with the preface, false once a connection error was
+    // answered with GOAWAY and the socket should be closed
+    bool processInput(const QByteArray &data);
+
+    // sends a response on the stream its request arrived on, or without
+    // one on the oldest stream waiting for a response with the same id
+    void sendResponse(const QJsonRpcMessage &message);
+
+    bool hasPendingResponses() const;
+    bool isIdle() const;
+    void goAway();
+
+private:
+    Q_DISABLE_COPY(QJsonRpcHttp2Connection)
+
+    enum FrameType {
+        DataFrame = 0x0,
+        HeadersFrame = 0x1,
+        PriorityFrame = 0x2,
+        RstStreamFrame = 0x3,
+        SettingsFrame = 0x4,
+        PushPromiseFrame = 0x5,
+        PingFrame = 0x6,
+        GoAwayFrame = 0x7,
+        WindowUpdateFrame = 0x8,
+        ContinuationFrame = 0x9
+    };
+
+    enum FrameFlag {
+        EndStreamFlag = 0x1,
+        AckFlag = 0x1,
+        EndHeadersFlag = 0x4,
+        PaddedFlag = 0x8,
+        PriorityFlag = 0x20
+    };
+
+    enum ErrorCode {
+        NoError = 0x0,
+        ProtocolError = 0x1,
+        InternalError = 0x2,
+        FlowControlError = 0x3,
+        StreamClosedError = 0x5,
+        FrameSizeError = 0x6,
+        RefusedStreamError = 0x7,
+        CompressionError = 0x9,
+        EnhanceYourCalmError = 0xb
+    };
+
+    enum Setting {
+        HeaderTableSizeSetting = 0x1,
+        EnablePushSetting = 0x2,
+        MaximumConcurrentStreamsSetting = 0x3,
+        InitialWindowSizeSetting = 0x4,
+        MaximumFrameSizeSetting = 0x5,
+        MaximumHeaderListSizeSetting = 0x6
+    };
+
+    enum {
+        FrameHeaderSize = 9,
+        DefaultWindowSize = 65535,
+        DefaultMaximumFrameSize = 16384,
+        MaximumConcurrentStreams = 100,
+        MaximumHeaderBlockSize = 64 * 1024,
+        ConnectionWindowSize = 1024 * 1024
+    };
+
+    struct Stream
+    {
+        Stream();
+
+        // request
+        QByteArray method;
+        QByteArray origin;
+        QByteArray accessControlRequestMethod;
+        QByteArray accessControlRequestHeaders;
+        QByteArray body;
+        bool remoteClosed;
+        bool awaitingResponse;
+        qint64 requestId;
+
+        // response DATA waiting for the flow control windows to open
+        QByteArray pendingData;
+        int pendingOffset;
+        qint64 sendWindow;
+    };
+
+    bool processFrame(int type, int flags, quint32 streamId, const char *payload, int length);
+    bool processHeaders(int flags, quint32 streamId, const char *payload, int length);
+    bool processContinuation(int flags, quint32 streamId, const char *payload, int length);
+    bool processHeaderBlock();
+    bool processData(int flags, quint32 streamId, const char *payload, int length);
+    bool processSettings(int flags, quint32 streamId, const char *payload, int length);
+    bool processWindowUpdate(quint32 streamId, const char *payload, int length);
+
+    void dispatchRequest(quint32 streamId);
+    void respond(quint32 streamId, int statusCode, const QJsonRpcHttp2HeaderList &headers,
+                 const QByteArray &body = QByteArray());
+    void flushStream(quint32 streamId);
+    void flushStreams();
+    void finishStream(quint32 streamId);
+
+    void writeFrame(int type, int flags, quint32 streamId, const char *payload, int length);
+    void writeWindowUpdate(quint32 streamId, quint32 increment);
+    void resetStream(quint32 streamId, quint32 errorCode);
+    bool connectionError(quint32 errorCode, const char *reason);
+
+    QJsonRpcHttpServerSocket *m_socket;
+    QByteArray m_input;
+    bool m_prefaceReceived;
+    bool m_processing;
+    bool m_goingAway;
+
+    QMap<quint32, Stream> m_streams;
+    quint32 m_lastStreamId;
+
+    // header block being received in a HEADERS and its CONTINUATION frames
+    quint32 m_headerStreamId;   // 0 when there is none
+    bool m_headerEndStream;
+    QByteArray m_headerBlock;
+
+    QJsonRpcHpackDecoder m_decoder;
+    QJsonRpcHpackEncoder m_encoder;
+    QByteArray m_headerBuffer;      // reused for outgoing header blocks
+
+    // peer's settings and the connection's send window
+    qint64 m_sendWindow;
+    qint64 m_initialSendWindow;
+    int m_maximumSendFrameSize;
+};
+
+#endif
@@ -14,10 +14,17 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
  * Lesser General Public License for more details.
  */
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
 #include <QEventLoop>
 #include <QTimer>
+#include <QTimerEvent>
+#include <QThread>
 #include <QDebug>
 
+#include <algorithm>
+
 #if QT_VERSION >= 0x050000
 #include <QJsonDocument>
 #else
@@ -25,13 +32,20 @@
 #endif
 
 #include "qjsonrpcsocket_p.h"
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcservicereply_p.h"
 #include "qjsonrpchttpclient.h"
 
 class QJsonRpcHttpReplyPrivate : public QJsonRpcServiceReplyPrivate
 {
 public:
-    QNetworkReply *reply;
+    QJsonRpcHttpReplyPrivate() : retryable(false), timerId(0), hedgeTimerId(0) {}
+
+    // requests in flight for the message, two once it was hedged
+    QList<QPointer<QNetworkReply> > attempts;
+    bool retryable;         // until a second request was asked for
+    int timerId;
+    int hedgeTimerId;
 };
 
 class QJsonRpcHttpReply : public QJsonRpcServiceReply
@@ -44,16 +58,101 @@ public:
     {
         Q_D(QJsonRpcHttpReply);
         d->request = request;
-        d->reply = reply;
-        connect(d->reply, SIGNAL(finished()), this, SLOT(networkReplyFinished()));
-        connect(d->reply, SIGNAL(error(QNetworkReply::NetworkError)),
-                    this, SLOT(networkReplyError(QNetworkReply::NetworkError)));
+
+        // replies that are part of a batch are finished by the batch
+        if (reply)
+            addAttempt(reply);
+    }
+
+    virtual ~QJsonRpcHttpReply()
+    {
+        // nobody waits for the response anymore
+        Q_D(QJsonRpcHttpReply);
+        if (!d->response.isValid())
+            abortNetworkReplies();
+    }
+
+    // 0 for no timeout
+    void setTimeout(int msecs)
+    {
+        Q_D(QJsonRpcHttpReply);
+        if (msecs > 0)
+            d->timerId = startTimer(msecs);
+    }
+
+    // A request failing without a response emits attemptFailed() rather
+    // than finishing, for an attempt to be added in its place, and one
+    // still unanswered after hedgeDelay msecs emits hedgeDue(), -1 for
+    // never. Only one of them is emitted, there is a single second chance
+    void setRetryable(int hedgeDelay)
+    {
+        Q_D(QJsonRpcHttpReply);
+        d->retryable = true;
+        if (hedgeDelay > 0)
+            d->hedgeTimerId = startTimer(hedgeDelay);
+    }
+
+    // another request for the message, the first to answer wins
+    void addAttempt(QNetworkReply *reply)
+    {
+        Q_D(QJsonRpcHttpReply);
+        d->attempts.append(reply);
+        connect(reply, SIGNAL(finished()), this, SLOT(networkReplyFinished()));
+    }
+
+    virtual void abort()
+    {
+        cancel(QJsonRpc::CancelledError, "request aborted");
+    }
+
+    // empty for replies finished by a batch
+    QList<QNetworkReply*> networkReplies() const
+    {
+        Q_D(const QJsonRpcHttpReply);
+        QList<QNetworkReply*> replies;
+        foreach (QPointer<QNetworkReply> reply, d->attempts) {
+            if (reply)
+                replies.append(reply);
+        }
+        return replies;
     }
 
-    virtual ~QJsonRpcHttpReply() {}
+    void finish(const QJsonRpcMessage &response)
+    {
+        Q_D(QJsonRpcHttpReply);
+        stopTimeout();
+        d->response = response;
+        Q_EMIT finished();
+    }
 
 Q_SIGNALS:
     void messageReceived(const QJsonRpcMessage &message);
+    void timedOut();
+    void hedgeDue();
+    void attemptFailed(QNetworkReply *reply);
+
+protected:
+    virtual void timerEvent(QTimerEvent *event)
+    {
+        Q_D(QJsonRpcHttpReply);
+        if (event->timerId() == d->hedgeTimerId) {
+            killTimer(d->hedgeTimerId);
+            d->hedgeTimerId = 0;
+            if (d->retryable && d->attempts.size() == 1) {
+                d->retryable = false;
+                Q_EMIT hedgeDue();
+            }
+            return;
+        }
+
+        if (event->timerId() != d->timerId) {
+            QJsonRpcServiceReply::timerEvent(event);
+            return;
+        }
+
+        Q_EMIT timedOut();
+        cancel(QJsonRpc::TimeoutError, "request timed out");
+    }
 
 private Q_SLOTS:
     void networkReplyFinished()
@@ -65,69 +164,233 @@ private Q_SLOTS:
             return;
         }
 
+        d->attempts.removeAll(reply);
+        reply->deleteLater();
+
+        QByteArray data = reply->readAll();
+        QJsonRpcMessage response;
         if (reply->error() != QNetworkReply::NoError) {
-            // this should be handled by the networkReplyError slot
+            // the server may still have answered with an error response
+            response = QJsonRpcMessage::fromJson(data);
+            if (response.isValid()) {
+                Q_EMIT messageReceived(response);
+            } else {
+                // nothing came back, the other attempt may still answer,
+                // or a new one be made
+                if (!d->attempts.isEmpty())
+                    return;
+
+                if (d->retryable) {
+                    d->retryable = false;
+                    Q_EMIT attemptFailed(reply);
+                    if (!d->attempts.isEmpty())
+                        return;
+                }
+
+                response = d->request.createErrorResponse(QJsonRpc::InternalError,
+                                           QString("error with http request: %1").arg(reply->error()),
+                                           reply->errorString());
+            }
         } else {
-            QByteArray data = reply->readAll();
             QJsonDocument doc = QJsonDocument::fromJson(data);
             if (doc.isEmpty() || doc.isNull() || !doc.isObject()) {
-                d->response =
+                response =
                     d->request.createErrorResponse(QJsonRpc::ParseError,
                                                    "unable to process incoming JSON data",
                                                    QString::fromUtf8(data));
             } else {
                 qJsonRpcDebug() << "received: " << doc.toJson();
-                QJsonRpcMessage response = QJsonRpcMessage::fromObject(doc.object());
+                response = QJsonRpcMessage::fromObject(doc.object());
                 Q_EMIT messageReceived(response);
 
                 if (d->request.type() == QJsonRpcMessage::Request &&
                     d->request.id() != response.id()) {
-                    d->response =
+                    response =
                         d->request.createErrorResponse(QJsonRpc::InternalError,
                                                        "invalid response id",
                                                        QString::fromUtf8(data));
-                } else {
-                    d->response = response;
                 }
             }
         }
 
-        reply->deleteLater();
-        Q_EMIT finished();
+        // the first answer wins, an attempt still running is dropped
+        abortNetworkReplies();
+        finish(response);
+    }
+
+private:
+    void stopTimeout()
+    {
+        Q_D(QJsonRpcHttpReply);
+        if (d->timerId) {
+            killTimer(d->timerId);
+            d->timerId = 0;
+        }
+
+        if (d->hedgeTimerId) {
+            killTimer(d->hedgeTimerId);
+            d->hedgeTimerId = 0;
+        }
+    }
+
+    // frees the connections the requests hold
+    void abortNetworkReplies()
+    {
+        Q_D(QJsonRpcHttpReply);
+        QList<QPointer<QNetworkReply> > attempts = d->attempts;
+        d->attempts.clear();
+        foreach (QPointer<QNetworkReply> reply, attempts) {
+            if (!reply)
+                continue;
+
+            disconnect(reply, 0, this, 0);
+            reply->abort();
+            reply->deleteLater();
+        }
     }
 
-    void networkReplyError(QNetworkReply::NetworkError code)
+    void cancel(QJsonRpc::ErrorCode code, const QString &message)
     {
         Q_D(QJsonRpcHttpReply);
+        if (d->response.isValid())
+            return;
+
+        abortNetworkReplies();
+        finish(d->request.createErrorResponse(code, message));
+    }
+
+    Q_DISABLE_COPY(QJsonRpcHttpReply)
+    Q_DECLARE_PRIVATE(QJsonRpcHttpReply)
+
+};
+
+class QJsonRpcHttpBatchReply : public QObject
+{
+    Q_OBJECT
+public:
+    QJsonRpcHttpBatchReply(const QList<QJsonRpcHttpReply*> &replies,
+                           QNetworkReply *reply, QObject *parent = 0)
+        : QObject(parent)
+    {
+        foreach (QJsonRpcHttpReply *serviceReply, replies)
+            m_replies.append(serviceReply);
+        connect(reply, SIGNAL(finished()), this, SLOT(networkReplyFinished()));
+    }
+
+Q_SIGNALS:
+    void messageReceived(const QJsonRpcMessage &message);
+
+private Q_SLOTS:
+    void networkReplyFinished()
+    {
         QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
         if (!reply) {
             qJsonRpcDebug() << Q_FUNC_INFO << "invalid reply";
             return;
         }
 
-        if (code == QNetworkReply::NoError)
-            return;
+        // the server answers with an array, or with a single error when it
+        // could not process the batch at all
+        QByteArray data = reply->readAll();
+        QJsonDocument doc = QJsonDocument::fromJson(data);
+        QHash<qint64, QJsonRpcMessage> responses;
+        QJsonRpcMessage batchError;
+        if (doc.isArray()) {
+            QJsonArray array = doc.array();
+            for (int i = 0; i < array.size(); ++i) {
+                QJsonRpcMessage response = QJsonRpcMessage::fromObject(array.at(i).toObject());
+                responses.insert(response.id(), response);
+                Q_EMIT messageReceived(response);
+            }
+        } else if (doc.isObject()) {
+            batchError = QJsonRpcMessage::fromObject(doc.object());
+            Q_EMIT messageReceived(batchError);
+        }
 
-        QJsonRpcMessage response = QJsonRpcMessage::fromJson(reply->readAll());
-        if (response.isValid()) {
-            d->response = response;
-            Q_EMIT messageReceived(response);
-        } else {
-            d->response = d->request.createErrorResponse(QJsonRpc::InternalError,
-                                           QString("error with http request: %1").arg(reply->error()),
-                                           reply->errorString());
+        foreach (QPointer<QJsonRpcHttpReply> serviceReply, m_replies) {
+            // timed out or aborted already
+            if (!serviceReply || serviceReply->response().isValid())
+                continue;
+
+            // queued notifications have nothing coming back
+            QJsonRpcMessage request = serviceReply->request();
+            if (request.type() != QJsonRpcMessage::Request) {
+                serviceReply->finish(QJsonRpcMessage());
+            } else if (responses.contains(request.id())) {
+                serviceReply->finish(responses.value(request.id()));
+            } else if (batchError.type() == QJsonRpcMessage::Error) {
+                serviceReply->finish(request.createErrorResponse(
+                    static_cast<QJsonRpc::ErrorCode>(batchError.errorCode()),
+                    batchError.errorMessage(), batchError.errorData()));
+            } else if (reply->error() != QNetworkReply::NoError) {
+                serviceReply->finish(request.createErrorResponse(QJsonRpc::InternalError,
+                                     QString("error with http request: %1").arg(reply->error()),
+                                     reply->errorString()));
+            } else if (!doc.isArray()) {
+                serviceReply->finish(request.createErrorResponse(QJsonRpc::ParseError,
+                                     "unable to process incoming JSON data",
+                                     QString::fromUtf8(data)));
+            } else {
+                serviceReply->finish(request.createErrorResponse(QJsonRpc::InternalError,
+                                     "no response in batch for request"));
+            }
         }
+
+        reply->deleteLater();
+        deleteLater();
     }
 
 private:
-    Q_DISABLE_COPY(QJsonRpcHttpReply)
-    Q_DECLARE_PRIVATE(QJsonRpcHttpReply)
+    Q_DISABLE_COPY(QJsonRpcHttpBatchReply)
+    QList<QPointer<QJsonRpcHttpReply> > m_replies;
 
 };
 
 class QJsonRpcHttpClientPrivate : public QJsonRpcAbstractSocketPrivate
 {
 public:
+    static const QNetworkRequest::Attribute EndPointAttribute = QNetworkRequest::User;
+    static const QNetworkRequest::Attribute StartTimeAttribute = QNetworkRequest::Attribute(QNetworkRequest::User + 1);
+
+    struct EndPoint
+    {
+        EndPoint() : outstanding(0), latency(0), consecutiveFailures(0), ejectedUntil(0) {}
+
+        QUrl url;
+        QNetworkRequest request;
+        int outstanding;
+        double latency;             // moving average in msecs, 0 until known
+        int consecutiveFailures;
+        qint64 ejectedUntil;        // on clock
+    };
+
+    QJsonRpcHttpClientPrivate()
+        : networkAccessManager(0),
+          tlsHandshakes(0),
+          tlsResumptionAttempts(0),
+          batchingEnabled(false),
+          maximumBatchSize(50),
+          batchTimer(0),
+          loadBalancingPolicy(QJsonRpcHttpClient::RoundRobin),
+          nextEndPoint(0),
+          maximumConsecutiveFailures(3),
+          ejectionTime(30000),
+          hedgingPercentile(0.95),
+          retryBudget(0.1),
+          retryTokens(MinimumRetryTokens),
+          nextLatencySample(0),
+          hedgedRequests(0),
+          retriedRequests(0)
+    {
+        clock.start();
+    }
+
+    void initializeBatchTimer(QJsonRpcHttpClient *client) {
+        batchTimer = new QTimer(client);
+        batchTimer->setSingleShot(true);
+        QObject::connect(batchTimer, SIGNAL(timeout()), client, SLOT(flushBatch()));
+    }
+
     void initializeNetworkAccessManager(QJsonRpcHttpClient *client) {
         QObject::connect(networkAccessManager, SIGNAL(authenticationRequired(QNetworkReply*,QAuthenticator*)),
                 client, SLOT(handleAuthenticationRequired(QNetworkReply*,QAuthenticator*)));
@@ -135,29 +398,316 @@ public:
                 client, SLOT(handleSslErrors(QNetworkReply*,QList<QSslError>)));
     }
 
-    QNetworkReply *writeMessage(const QJsonRpcMessage &message) {
-        QNetworkRequest request(endPoint);
+    // compact, without going through QJsonDocument
+    QNetworkReply *writeMessage(const QJsonRpcMessage &message, QJsonRpcHttpClient *client,
+                                const QList<QUrl> &excluded = QList<QUrl>()) {
+        QByteArray data;
+        data.reserve(256);
+        QJsonRpcMessagePrivate::writeJson(message, data);
+        return writeData(data, client, excluded);
+    }
+
+    // requests start as a copy of their endpoint's template, which has
+    // everything but the attributes tracking the request
+    void updateRequestTemplate(EndPoint *endPoint) {
+        QNetworkRequest request(endPoint->url);
+        request.setAttribute(EndPointAttribute, endPoint->url);
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
         request.setRawHeader("Accept", "application/json-rpc");
-        if (!sslConfiguration.isNull())
+        if (!sslConfiguration.isNull()) {
+#if QT_VERSION >= 0x050200
+            // sessions are only saved when persistence is on, and only
+            // offered when the configuration carries one
+            QSslConfiguration configuration = sslConfiguration;
+            configuration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+            configuration.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+            request.setSslConfiguration(configuration);
+#else
             request.setSslConfiguration(sslConfiguration);
+#endif
+        }
+        endPoint->request = request;
+    }
+
+    void updateRequestTemplates() {
+        for (int i = 0; i < endPoints.size(); ++i)
+            updateRequestTemplate(&endPoints[i]);
+    }
+
+    // 0 if every endpoint left is excluded
+    QNetworkReply *writeData(const QByteArray &data, QJsonRpcHttpClient *client,
+                             const QList<QUrl> &excluded = QList<QUrl>()) {
+        const int index = selectEndPoint(excluded);
+        if (index < 0)
+            return 0;
+
+        // the start is carried along for replyFinished()
+        EndPoint &endPoint = endPoints[index];
+        endPoint.outstanding++;
+        QNetworkRequest request = endPoint.request;
+        request.setAttribute(StartTimeAttribute, clock.elapsed());
 
-        QByteArray data = message.toJson();
         qJsonRpcDebug() << "sending: " << data;
-        return networkAccessManager->post(request, data);
+        QNetworkReply *reply = networkAccessManager->post(request, data);
+        QObject::connect(reply, SIGNAL(finished()), client, SLOT(replyFinished()));
+#if QT_VERSION >= 0x050100
+        if (!sslConfiguration.isNull())
+            QObject::connect(reply, SIGNAL(encrypted()), client, SLOT(replyEncrypted()));
+#else
+        Q_UNUSED(client)
+#endif
+        return reply;
+    }
+
+    // one request for all messages, replies are finished from its response
+    void writeBatch(const QList<QJsonRpcMessage> &messages, const QList<QJsonRpcHttpReply*> &replies,
+                    QJsonRpcHttpClient *client) {
+        QByteArray data;
+        data.reserve(messages.size() * 128);
+        data.append('[');
+        for (int i = 0; i < messages.size(); ++i) {
+            if (i)
+                data.append(',');
+            QJsonRpcMessagePrivate::writeJson(messages.at(i), data);
+        }
+        data.append(']');
+
+        QNetworkReply *reply = writeData(data, client);
+        QJsonRpcHttpBatchReply *batchReply = new QJsonRpcHttpBatchReply(replies, reply, client);
+        QObject::connect(batchReply, SIGNAL(messageReceived(QJsonRpcMessage)),
+                         client, SIGNAL(messageReceived(QJsonRpcMessage)));
+    }
+
+    // queues a message for the next batch, with its reply if it has one
+    void queueMessage(const QJsonRpcMessage &message, QJsonRpcHttpReply *reply, QJsonRpcHttpClient *client) {
+        pendingMessages.append(message);
+        if (reply)
+            pendingReplies.append(reply);
+
+        if (pendingMessages.size() >= maximumBatchSize)
+            client->flushBatch();
+        else if (!batchTimer->isActive())
+            batchTimer->start();
     }
 
-    QUrl endPoint;
+    enum Outcome {
+        Succeeded,
+        Failed,
+        Cancelled       // tells nothing about the endpoint
+    };
+
+    // Hedges and retries draw on a budget that every request adds
+    // retryBudget to, so that they stay a fraction of the traffic when
+    // endpoints are in trouble rather than multiplying it
+    enum {
+        MinimumRetryTokens = 10,
+        MaximumRetryTokens = 100,
+        LatencySamples = 128,
+        MinimumLatencySamples = 16
+    };
+
+    bool isIdempotent(const QJsonRpcMessage &message) const {
+        return message.type() == QJsonRpcMessage::Request &&
+               idempotentMethods.contains(message.method());
+    }
+
+    void depositRetryToken() {
+        retryTokens = qMin<double>(MaximumRetryTokens, retryTokens + retryBudget);
+    }
+
+    bool withdrawRetryToken() {
+        if (retryBudget <= 0 || retryTokens < 1)
+            return false;
+        retryTokens -= 1;
+        return true;
+    }
+
+    int selectEndPoint(const QList<QUrl> &excluded = QList<QUrl>());
+    void endPointFinished(QNetworkReply *reply, Outcome outcome);
+    void setEndPoints(const QList<QUrl> &urls);
+    int hedgeDelay() const;
+    QNetworkReply *resend(QJsonRpcHttpReply *reply, QNetworkReply *failed, QJsonRpcHttpClient *client);
+
+    QList<EndPoint> endPoints;
+    QJsonRpcHttpClient::LoadBalancingPolicy loadBalancingPolicy;
+    int nextEndPoint;               // where the search starts, for ties to rotate
+    int maximumConsecutiveFailures;
+    int ejectionTime;
+    QElapsedTimer clock;
+
+    QStringList idempotentMethods;
+    double hedgingPercentile;
+    double retryBudget;
+    double retryTokens;
+    QVector<int> latencySamples;    // of successful requests, in msecs
+    int nextLatencySample;
+    int hedgedRequests;
+    int retriedRequests;
+
     QNetworkAccessManager *networkAccessManager;
     QSslConfiguration sslConfiguration;
+    int tlsHandshakes;
+    int tlsResumptionAttempts;
+
+    bool batchingEnabled;
+    int maximumBatchSize;
+    QTimer *batchTimer;     // started by the first message of a batch
+    QList<QJsonRpcMessage> pendingMessages;
+    QList<QPointer<QJsonRpcHttpReply> > pendingReplies;     // callers may delete them meanwhile
+
+    // blocking calls from other threads, see QJsonRpcBlockingCall
+    QMutex blockingCallsMutex;
+    QList<QJsonRpcBlockingCallPointer> queuedBlockingCalls;
+    QHash<QJsonRpcServiceReply*, QJsonRpcBlockingCallPointer> blockingCalls;
 };
 
+int QJsonRpcHttpClientPrivate::selectEndPoint(const QList<QUrl> &excluded)
+{
+    const qint64 now = clock.elapsed();
+    int selected = -1;
+    double selectedCost = 0;
+    for (int n = 0; n < endPoints.size(); ++n) {
+        const int i = (nextEndPoint + n) % endPoints.size();
+        const EndPoint &endPoint = endPoints.at(i);
+        if (endPoint.ejectedUntil > now || excluded.contains(endPoint.url))
+            continue;
+
+        double cost = 0;
+        if (loadBalancingPolicy == QJsonRpcHttpClient::LeastOutstandingRequests)
+            cost = endPoint.outstanding;
+        else if (loadBalancingPolicy == QJsonRpcHttpClient::LatencyEwma)
+            cost = endPoint.latency * (endPoint.outstanding + 1);
+
+        if (selected < 0 || cost < selectedCost) {
+            selected = i;
+            selectedCost = cost;
+        }
+
+        if (loadBalancingPolicy == QJsonRpcHttpClient::RoundRobin)
+            break;
+    }
+
+    // a second try goes elsewhere or not at all
+    if (selected < 0 && !excluded.isEmpty())
+        return -1;
+
+    // with every endpoint left out, trying one beats failing outright
+    if (selected < 0) {
+        selected = 0;
+        for (int i = 1; i < endPoints.size(); ++i) {
+            if (endPoints.at(i).ejectedUntil < endPoints.at(selected).ejectedUntil)
+                selected = i;
+        }
+    }
+
+    nextEndPoint = (selected + 1) % endPoints.size();
+    return selected;
+}
+
+void QJsonRpcHttpClientPrivate::endPointFinished(QNetworkReply *reply, Outcome outcome)
+{
+    const QUrl url = reply->request().attribute(EndPointAttribute).toUrl();
+    for (int i = 0; i < endPoints.size(); ++i) {
+        EndPoint &endPoint = endPoints[i];
+        if (endPoint.url != url)
+            continue;
+
+        endPoint.outstanding = qMax(0, endPoint.outstanding - 1);
+        if (outcome == Cancelled)
+            return;
+
+        if (outcome == Failed) {
+            endPoint.consecutiveFailures++;
+            if (maximumConsecutiveFailures > 0 && endPoint.consecutiveFailures >= maximumConsecutiveFailures) {
+                qJsonRpcDebug() << Q_FUNC_INFO << "leaving out" << url << "for" << ejectionTime << "msecs";
+                endPoint.ejectedUntil = clock.elapsed() + ejectionTime;
+            }
+            return;
+        }
+
+        // recent requests weigh most, old ones fade out
+        const qint64 start =
+            reply->request().attribute(StartTimeAttribute).toLongLong();
+        const int sample = int(qMax<qint64>(1, clock.elapsed() - start));
+        endPoint.latency = endPoint.latency > 0 ? 0.7 * endPoint.latency + 0.3 * sample : sample;
+
+        if (latencySamples.size() < LatencySamples)
+            latencySamples.append(sample);
+        else
+            latencySamples[nextLatencySample] = sample;
+        nextLatencySample = (nextLatencySample + 1) % LatencySamples;
+        endPoint.consecutiveFailures = 0;
+        endPoint.ejectedUntil = 0;
+        return;
+    }
+}
+
+void QJsonRpcHttpClientPrivate::setEndPoints(const QList<QUrl> &urls)
+{
+    QList<EndPoint> previous = endPoints;
+    endPoints.clear();
+    nextEndPoint = 0;
+    foreach (const QUrl &url, urls) {
+        if (url.isEmpty())
+            continue;
+
+        // endpoints that stay keep their statistics
+        EndPoint endPoint;
+        endPoint.url = url;
+        for (int i = 0; i < previous.size(); ++i) {
+            if (previous.at(i).url == url) {
+                endPoint = previous.at(i);
+                break;
+            }
+        }
+        updateRequestTemplate(&endPoint);
+        endPoints.append(endPoint);
+    }
+}
+
+int QJsonRpcHttpClientPrivate::hedgeDelay() const
+{
+    if (hedgingPercentile <= 0 || retryBudget <= 0 ||
+        latencySamples.size() < MinimumLatencySamples || endPoints.size() < 2)
+        return -1;
+
+    // a request slower than most is likely stuck behind something
+    QVector<int> samples = latencySamples;
+    const int index = qMin(samples.size() - 1, int(hedgingPercentile * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples.at(index);
+}
+
+QNetworkReply *QJsonRpcHttpClientPrivate::resend(QJsonRpcHttpReply *reply, QNetworkReply *failed,
+                                                 QJsonRpcHttpClient *client)
+{
+    // the endpoints tried already are left out
+    QList<QUrl> excluded;
+    if (failed)
+        excluded.append(failed->request().attribute(EndPointAttribute).toUrl());
+    foreach (QNetworkReply *attempt, reply->networkReplies())
+        excluded.append(attempt->request().attribute(EndPointAttribute).toUrl());
+
+    if (excluded.size() >= endPoints.size() || !withdrawRetryToken())
+        return 0;
+
+    QNetworkReply *attempt = writeMessage(reply->request(), client, excluded);
+    if (!attempt) {
+        retryTokens += 1;
+        return 0;
+    }
+
+    reply->addAttempt(attempt);
+    return attempt;
+}
+
 QJsonRpcHttpClient::QJsonRpcHttpClient(QObject *parent)
     : QJsonRpcAbstractSocket(*new QJsonRpcHttpClientPrivate, parent)
 {
     Q_D(QJsonRpcHttpClient);
     d->networkAccessManager = new QNetworkAccessManager(this);
     d->initializeNetworkAccessManager(this);
+    d->initializeBatchTimer(this);
 }
 
 QJsonRpcHttpClient::QJsonRpcHttpClient(QNetworkAccessManager *manager, QObject *parent)
@@ -166,43 +716,175 @@ QJsonRpcHttpClient::QJsonRpcHttpClient(QNetworkAccessManager *manager, QObject *
     Q_D(QJsonRpcHttpClient);
     d->networkAccessManager = manager;
     d->initializeNetworkAccessManager(this);
+    d->initializeBatchTimer(this);
 }
 
 QJsonRpcHttpClient::QJsonRpcHttpClient(const QString &endPoint, QObject *parent)
     : QJsonRpcAbstractSocket(*new QJsonRpcHttpClientPrivate, parent)
 {
     Q_D(QJsonRpcHttpClient);
-    d->endPoint = QUrl::fromUserInput(endPoint);
+    d->setEndPoints(QList<QUrl>() << QUrl::fromUserInput(endPoint));
     d->networkAccessManager = new QNetworkAccessManager(this);
     d->initializeNetworkAccessManager(this);
+    d->initializeBatchTimer(this);
 }
 
 QJsonRpcHttpClient::~QJsonRpcHttpClient()
 {
+    Q_D(QJsonRpcHttpClient);
+    QList<QJsonRpcBlockingCallPointer> calls = d->blockingCalls.values();
+    {
+        QMutexLocker locker(&d->blockingCallsMutex);
+        calls += d->queuedBlockingCalls;
+        d->queuedBlockingCalls.clear();
+    }
+
+    foreach (const QJsonRpcBlockingCallPointer &call, calls)
+        call->finish(call->request.createErrorResponse(QJsonRpc::InternalError, "client destroyed"));
 }
 
 bool QJsonRpcHttpClient::isValid() const
 {
     Q_D(const QJsonRpcHttpClient);
-    return d->networkAccessManager && !d->endPoint.isEmpty() && d->endPoint.isValid();
+    if (!d->networkAccessManager || d->endPoints.isEmpty())
+        return false;
+
+    foreach (const QJsonRpcHttpClientPrivate::EndPoint &endPoint, d->endPoints) {
+        if (!endPoint.url.isValid())
+            return false;
+    }
+    return true;
 }
 
 QUrl QJsonRpcHttpClient::endPoint() const
 {
     Q_D(const QJsonRpcHttpClient);
-    return d->endPoint;
+    return d->endPoints.isEmpty() ? QUrl() : d->endPoints.first().url;
 }
 
 void QJsonRpcHttpClient::setEndPoint(const QUrl &endPoint)
 {
-    Q_D(QJsonRpcHttpClient);
-    d->endPoint = endPoint;
+    setEndPoints(QList<QUrl>() << endPoint);
 }
 
 void QJsonRpcHttpClient::setEndPoint(const QString &endPoint)
+{
+    setEndPoint(QUrl::fromUserInput(endPoint));
+}
+
+QList<QUrl> QJsonRpcHttpClient::endPoints() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    QList<QUrl> urls;
+    foreach (const QJsonRpcHttpClientPrivate::EndPoint &endPoint, d->endPoints)
+        urls.append(endPoint.url);
+    return urls;
+}
+
+void QJsonRpcHttpClient::setEndPoints(const QList<QUrl> &endPoints)
+{
+    Q_D(QJsonRpcHttpClient);
+#if QT_VERSION >= 0x050200
+    // a session is only of use to the server that issued it
+    d->sslConfiguration.setSessionTicket(QByteArray());
+#endif
+    d->setEndPoints(endPoints);
+}
+
+QJsonRpcHttpClient::LoadBalancingPolicy QJsonRpcHttpClient::loadBalancingPolicy() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->loadBalancingPolicy;
+}
+
+void QJsonRpcHttpClient::setLoadBalancingPolicy(LoadBalancingPolicy policy)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->loadBalancingPolicy = policy;
+}
+
+int QJsonRpcHttpClient::maximumConsecutiveFailures() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->maximumConsecutiveFailures;
+}
+
+void QJsonRpcHttpClient::setMaximumConsecutiveFailures(int failures)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->maximumConsecutiveFailures = qMax(0, failures);
+}
+
+int QJsonRpcHttpClient::ejectionTime() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->ejectionTime;
+}
+
+void QJsonRpcHttpClient::setEjectionTime(int msecs)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->ejectionTime = qMax(0, msecs);
+}
+
+QList<QUrl> QJsonRpcHttpClient::healthyEndPoints() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    const qint64 now = d->clock.elapsed();
+    QList<QUrl> urls;
+    foreach (const QJsonRpcHttpClientPrivate::EndPoint &endPoint, d->endPoints) {
+        if (endPoint.ejectedUntil <= now)
+            urls.append(endPoint.url);
+    }
+    return urls;
+}
+
+QStringList QJsonRpcHttpClient::idempotentMethods() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->idempotentMethods;
+}
+
+void QJsonRpcHttpClient::setIdempotentMethods(const QStringList &methods)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->idempotentMethods = methods;
+}
+
+double QJsonRpcHttpClient::hedgingPercentile() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->hedgingPercentile;
+}
+
+void QJsonRpcHttpClient::setHedgingPercentile(double percentile)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->hedgingPercentile = qBound(0.0, percentile, 1.0);
+}
+
+double QJsonRpcHttpClient::retryBudget() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->retryBudget;
+}
+
+void QJsonRpcHttpClient::setRetryBudget(double ratio)
 {
     Q_D(QJsonRpcHttpClient);
-    d->endPoint = QUrl::fromUserInput(endPoint);
+    d->retryBudget = qMax(0.0, ratio);
+}
+
+int QJsonRpcHttpClient::hedgedRequestCount() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->hedgedRequests;
+}
+
+int QJsonRpcHttpClient::retriedRequestCount() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->retriedRequests;
 }
 
 QNetworkAccessManager *QJsonRpcHttpClient::networkAccessManager()
@@ -221,17 +903,172 @@ void QJsonRpcHttpClient::setSslConfiguration(const QSslConfiguration &sslConfigu
 {
     Q_D(QJsonRpcHttpClient);
     d->sslConfiguration = sslConfiguration;
+    d->updateRequestTemplates();
+}
+
+int QJsonRpcHttpClient::tlsHandshakeCount() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->tlsHandshakes;
+}
+
+int QJsonRpcHttpClient::tlsResumptionAttemptCount() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->tlsResumptionAttempts;
+}
+
+bool QJsonRpcHttpClient::isBatchingEnabled() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->batchingEnabled;
+}
+
+void QJsonRpcHttpClient::setBatchingEnabled(bool enabled)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->batchingEnabled = enabled;
+    if (!enabled)
+        flushBatch();
+}
+
+int QJsonRpcHttpClient::maximumBatchSize() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->maximumBatchSize;
+}
+
+void QJsonRpcHttpClient::setMaximumBatchSize(int messages)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->maximumBatchSize = qMax(1, messages);
+}
+
+int QJsonRpcHttpClient::maximumBatchDelay() const
+{
+    Q_D(const QJsonRpcHttpClient);
+    return d->batchTimer->interval();
+}
+
+void QJsonRpcHttpClient::setMaximumBatchDelay(int msecs)
+{
+    Q_D(QJsonRpcHttpClient);
+    d->batchTimer->setInterval(qMax(0, msecs));
+}
+
+void QJsonRpcHttpClient::flushBatch()
+{
+    Q_D(QJsonRpcHttpClient);
+    d->batchTimer->stop();
+    if (d->pendingMessages.isEmpty() || d->endPoints.isEmpty())
+        return;
+
+    // even a single message goes as a batch, for the batch reply to read
+    QList<QJsonRpcMessage> messages = d->pendingMessages;
+    QList<QJsonRpcHttpReply*> replies;
+    foreach (QPointer<QJsonRpcHttpReply> reply, d->pendingReplies) {
+        if (reply)
+            replies.append(reply);
+    }
+    d->pendingMessages.clear();
+    d->pendingReplies.clear();
+    d->writeBatch(messages, replies, this);
+}
+
+void QJsonRpcHttpClient::replyEncrypted()
+{
+#if QT_VERSION >= 0x050100
+    Q_D(QJsonRpcHttpClient);
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply)
+        return;
+
+    // requests reusing a connection don't get here, only new handshakes do
+    d->tlsHandshakes++;
+#if QT_VERSION >= 0x050200
+    if (!reply->request().sslConfiguration().sessionTicket().isEmpty())
+        d->tlsResumptionAttempts++;
+
+    QByteArray sessionTicket = reply->sslConfiguration().sessionTicket();
+    if (!sessionTicket.isEmpty() && sessionTicket != d->sslConfiguration.sessionTicket()) {
+        d->sslConfiguration.setSessionTicket(sessionTicket);
+        d->updateRequestTemplates();
+    }
+#endif
+#endif
+}
+
+void QJsonRpcHttpClient::replyFinished()
+{
+    Q_D(QJsonRpcHttpClient);
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply)
+        return;
+
+    // errors the server answered itself say nothing about its health, but
+    // its 5xx responses and failed connections do. Timeouts were counted
+    // before the request was aborted
+    if (reply->error() == QNetworkReply::OperationCanceledError) {
+        d->endPointFinished(reply, QJsonRpcHttpClientPrivate::Cancelled);
+        return;
+    }
+
+    const QVariant statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    const bool failed = statusCode.isValid() ? statusCode.toInt() >= 500
+                                             : reply->error() != QNetworkReply::NoError;
+    d->endPointFinished(reply, failed ? QJsonRpcHttpClientPrivate::Failed : QJsonRpcHttpClientPrivate::Succeeded);
+}
+
+void QJsonRpcHttpClient::replyTimedOut()
+{
+    Q_D(QJsonRpcHttpClient);
+    QJsonRpcHttpReply *reply = qobject_cast<QJsonRpcHttpReply*>(sender());
+    if (!reply)
+        return;
+
+    // a timeout counts against the endpoints, unlike the abort following it
+    foreach (QNetworkReply *networkReply, reply->networkReplies()) {
+        disconnect(networkReply, SIGNAL(finished()), this, SLOT(replyFinished()));
+        d->endPointFinished(networkReply, QJsonRpcHttpClientPrivate::Failed);
+    }
+}
+
+void QJsonRpcHttpClient::replyHedgeDue()
+{
+    Q_D(QJsonRpcHttpClient);
+    QJsonRpcHttpReply *reply = qobject_cast<QJsonRpcHttpReply*>(sender());
+    if (!reply)
+        return;
+
+    if (d->resend(reply, 0, this))
+        d->hedgedRequests++;
+}
+
+void QJsonRpcHttpClient::replyAttemptFailed(QNetworkReply *networkReply)
+{
+    Q_D(QJsonRpcHttpClient);
+    QJsonRpcHttpReply *reply = qobject_cast<QJsonRpcHttpReply*>(sender());
+    if (!reply)
+        return;
+
+    if (d->resend(reply, networkReply, this))
+        d->retriedRequests++;
 }
 
 void QJsonRpcHttpClient::notify(const QJsonRpcMessage &message)
 {
     Q_D(QJsonRpcHttpClient);
-    if (d->endPoint.isEmpty()) {
+    if (d->endPoints.isEmpty()) {
         qJsonRpcDebug() << Q_FUNC_INFO << "invalid endpoint specified";
         return;
     }
 
-    QNetworkReply *reply = d->writeMessage(message);
+    if (d->batchingEnabled) {
+        d->queueMessage(message, 0, this);
+        return;
+    }
+
+    QNetworkReply *reply = d->writeMessage(message, this);
     connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
 
     // NOTE: we might want to connect this to a local slot to track errors
@@ -242,92 +1079,133 @@ void QJsonRpcHttpClient::notify(const QJsonRpcMessage &message)
 QJsonRpcServiceReply *QJsonRpcHttpClient::sendMessage(const QJsonRpcMessage &message)
 {
     Q_D(QJsonRpcHttpClient);
-    if (d->endPoint.isEmpty()) {
+    return sendMessage(message, d->defaultRequestTimeout);
+}
+
+QJsonRpcServiceReply *QJsonRpcHttpClient::sendMessage(const QJsonRpcMessage &message, int msecs)
+{
+    Q_D(QJsonRpcHttpClient);
+    if (d->endPoints.isEmpty()) {
         qJsonRpcDebug() << Q_FUNC_INFO << "invalid endpoint specified";
         return 0;
     }
 
-    QNetworkReply *reply = d->writeMessage(message);
+    if (d->batchingEnabled) {
+        QJsonRpcHttpReply *serviceReply = new QJsonRpcHttpReply(message, 0);
+        serviceReply->setTimeout(msecs);
+        d->queueMessage(message, serviceReply, this);
+        return serviceReply;
+    }
+
+    QNetworkReply *reply = d->writeMessage(message, this);
     QJsonRpcHttpReply *serviceReply = new QJsonRpcHttpReply(message, reply);
     connect(serviceReply, SIGNAL(messageReceived(QJsonRpcMessage)),
                     this, SIGNAL(messageReceived(QJsonRpcMessage)));
+    connect(serviceReply, SIGNAL(timedOut()), this, SLOT(replyTimedOut()));
+    serviceReply->setTimeout(msecs);
+
+    d->depositRetryToken();
+    if (d->isIdempotent(message)) {
+        connect(serviceReply, SIGNAL(hedgeDue()), this, SLOT(replyHedgeDue()));
+        connect(serviceReply, SIGNAL(attemptFailed(QNetworkReply*)),
+                        this, SLOT(replyAttemptFailed(QNetworkReply*)));
+        serviceReply->setRetryable(d->hedgeDelay());
+    }
 
     return serviceReply;
 }
 
+QList<QJsonRpcServiceReply *> QJsonRpcHttpClient::sendBatch(const QList<QJsonRpcMessage> &messages)
+{
+    Q_D(QJsonRpcHttpClient);
+    QList<QJsonRpcServiceReply *> batchReplies;
+    if (d->endPoints.isEmpty()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid endpoint specified";
+        return batchReplies;
+    }
+
+    if (messages.isEmpty()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send an empty batch";
+        return batchReplies;
+    }
+
+    QList<QJsonRpcHttpReply*> httpReplies;
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() != QJsonRpcMessage::Request)
+            continue;
+
+        QJsonRpcHttpReply *serviceReply = new QJsonRpcHttpReply(message, 0);
+        serviceReply->setTimeout(d->defaultRequestTimeout);
+        httpReplies.append(serviceReply);
+        batchReplies.append(serviceReply);
+    }
+
+    d->writeBatch(messages, httpReplies, this);
+    return batchReplies;
+}
+
 QJsonRpcMessage QJsonRpcHttpClient::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
 {
-    QJsonRpcServiceReply *reply = sendMessage(message);
+    Q_D(QJsonRpcHttpClient);
+    if (thread() != QThread::currentThread()) {
+        QJsonRpcBlockingCallPointer call(new QJsonRpcBlockingCall(message, msecs));
+        bool first;
+        {
+            QMutexLocker locker(&d->blockingCallsMutex);
+            first = d->queuedBlockingCalls.isEmpty();
+            d->queuedBlockingCalls.append(call);
+        }
+
+        if (first)
+            QMetaObject::invokeMethod(this, "startBlockingCalls", Qt::QueuedConnection);
+        return call->wait();
+    }
+
+    // the reply times out by itself
+    QJsonRpcServiceReply *reply = sendMessage(message, qMax(1, msecs));
+    if (!reply)
+        return message.createErrorResponse(QJsonRpc::InternalError, "invalid endpoint specified");
     QScopedPointer<QJsonRpcServiceReply> replyPtr(reply);
 
-    QEventLoop responseLoop;
-    connect(reply, SIGNAL(finished()), &responseLoop, SLOT(quit()));
-    QTimer::singleShot(msecs, &responseLoop, SLOT(quit()));
-    responseLoop.exec();
+    if (!reply->response().isValid()) {
+        QEventLoop responseLoop;
+        connect(reply, SIGNAL(finished()), &responseLoop, SLOT(quit()));
+        responseLoop.exec();
+    }
 
-    if (!reply->response().isValid())
-        return message.createErrorResponse(QJsonRpc::TimeoutError, "request timed out");
     return reply->response();
 }
 
-QJsonRpcMessage QJsonRpcHttpClient::invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &param1,
-                                                               const QVariant &param2, const QVariant &param3,
-                                                               const QVariant &param4, const QVariant &param5,
-                                                               const QVariant &param6, const QVariant &param7,
-                                                               const QVariant &param8, const QVariant &param9,
-                                                               const QVariant &param10)
-{
-    QVariantList params;
-    if (param1.isValid()) params.append(param1);
-    if (param2.isValid()) params.append(param2);
-    if (param3.isValid()) params.append(param3);
-    if (param4.isValid()) params.append(param4);
-    if (param5.isValid()) params.append(param5);
-    if (param6.isValid()) params.append(param6);
-    if (param7.isValid()) params.append(param7);
-    if (param8.isValid()) params.append(param8);
-    if (param9.isValid()) params.append(param9);
-    if (param10.isValid()) params.append(param10);
-
-    QJsonRpcMessage request =
-        QJsonRpcMessage::createRequest(method, QJsonArray::fromVariantList(params));
-    return sendMessageBlocking(request, msecs);
-}
-
-QJsonRpcMessage QJsonRpcHttpClient::invokeRemoteMethodBlocking(const QString &method, const QVariant &param1,
-                                                               const QVariant &param2, const QVariant &param3,
-                                                               const QVariant &param4, const QVariant &param5,
-                                                               const QVariant &param6, const QVariant &param7,
-                                                               const QVariant &param8, const QVariant &param9,
-                                                               const QVariant &param10)
+void QJsonRpcHttpClient::startBlockingCalls()
 {
     Q_D(QJsonRpcHttpClient);
+    QList<QJsonRpcBlockingCallPointer> calls;
+    {
+        QMutexLocker locker(&d->blockingCallsMutex);
+        calls.swap(d->queuedBlockingCalls);
+    }
+
+    foreach (const QJsonRpcBlockingCallPointer &call, calls) {
+        QJsonRpcServiceReply *reply = sendMessage(call->request, qMax(1, call->msecs));
+        if (!reply) {
+            call->finish(call->request.createErrorResponse(QJsonRpc::InternalError,
+                                                           "invalid endpoint specified"));
+            continue;
+        }
 
-    return invokeRemoteMethodBlocking(method, d->defaultRequestTimeout, param1, param2, param3, param4, param5, param6, param7, param8, param9, param10);
-}
-
-QJsonRpcServiceReply *QJsonRpcHttpClient::invokeRemoteMethod(const QString &method, const QVariant &param1,
-                                                             const QVariant &param2, const QVariant &param3,
-                                                             const QVariant &param4, const QVariant &param5,
-                                                             const QVariant &param6, const QVariant &param7,
-                                                             const QVariant &param8, const QVariant &param9,
-                                                             const QVariant &param10)
-{
-    QVariantList params;
-    if (param1.isValid()) params.append(param1);
-    if (param2.isValid()) params.append(param2);
-    if (param3.isValid()) params.append(param3);
-    if (param4.isValid()) params.append(param4);
-    if (param5.isValid()) params.append(param5);
-    if (param6.isValid()) params.append(param6);
-    if (param7.isValid()) params.append(param7);
-    if (param8.isValid()) params.append(param8);
-    if (param9.isValid()) params.append(param9);
-    if (param10.isValid()) params.append(param10);
-
-    QJsonRpcMessage request =
-        QJsonRpcMessage::createRequest(method, QJsonArray::fromVariantList(params));
-    return sendMessage(request);
+        d->blockingCalls.insert(reply, call);
+        connect(reply, SIGNAL(finished()), this, SLOT(blockingCallFinished()));
+    }
+}
+
+void QJsonRpcHttpClient::blockingCallFinished()
+{
+    Q_D(QJsonRpcHttpClient);
+    QJsonRpcServiceReply *reply = static_cast<QJsonRpcServiceReply*>(sender());
+    QJsonRpcBlockingCallPointer call = d->blockingCalls.take(reply);
+    if (call)
+        call->finish(reply->response());
+    reply->deleteLater();
 }
 
 void QJsonRpcHttpClient::handleAuthenticationRequired(QNetworkReply *reply, QAuthenticator *authenticator)
@@ -18,6 +18,9 @@
 #define QJSONRPCHTTPCLIENT_H
 
 #include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QUrl>
 #include <QNetworkReply>
 #include <QSslConfiguration>
 
@@ -35,6 +38,12 @@ class QJSONRPC_EXPORT QJsonRpcHttpClient : public QJsonRpcAbstractSocket
 {
     Q_OBJECT
 public:
+    enum LoadBalancingPolicy {
+        RoundRobin,                 // each endpoint in turn
+        LeastOutstandingRequests,   // the one with the fewest requests in flight
+        LatencyEwma                 // the lowest average latency, weighted by requests in flight
+    };
+
     QJsonRpcHttpClient(QObject *parent = 0);
     QJsonRpcHttpClient(const QString &endPoint, QObject *parent = 0);
     QJsonRpcHttpClient(QNetworkAccessManager *manager, QObject *parent = 0);
@@ -42,43 +51,121 @@ public:
 
     virtual bool isValid() const;
 
+    // the first of endPoints()
     QUrl endPoint() const;
     void setEndPoint(const QUrl &endPoint);
     void setEndPoint(const QString &endPoint);
 
+    // Every request goes to one of several endpoints, picked by
+    // loadBalancingPolicy() among the healthy ones. All of them share
+    // networkAccessManager() and its pool of connections.
+    QList<QUrl> endPoints() const;
+    void setEndPoints(const QList<QUrl> &endPoints);
+
+    // RoundRobin by default
+    LoadBalancingPolicy loadBalancingPolicy() const;
+    void setLoadBalancingPolicy(LoadBalancingPolicy policy);
+
+    // An endpoint failing failures requests in a row, through network
+    // errors, 5xx responses or blocking calls timing out, is left out for
+    // msecs before being tried again. While every endpoint is left out,
+    // the one due back first is used. 3 failures and 30 seconds by
+    // default, 0 failures never leaves an endpoint out.
+    int maximumConsecutiveFailures() const;
+    void setMaximumConsecutiveFailures(int failures);
+    int ejectionTime() const;
+    void setEjectionTime(int msecs);
+
+    // the endpoints currently used
+    QList<QUrl> healthyEndPoints() const;
+
+    // Requests for idempotent methods are sent again to another healthy
+    // endpoint when they fail without a response, and hedged by a second
+    // copy going to another endpoint when they haven't been answered
+    // after the hedgingPercentile() latency of recent requests. The first
+    // response wins and the other request is aborted. None by default.
+    QStringList idempotentMethods() const;
+    void setIdempotentMethods(const QStringList &methods);
+
+    // 0.95 by default, 0 never hedges
+    double hedgingPercentile() const;
+    void setHedgingPercentile(double percentile);
+
+    // Second requests, from hedges and retries alike, are limited to ratio
+    // of the requests sent, plus a small reserve, so that they don't pile
+    // onto endpoints that are already struggling. 0.1 by default, 0 makes
+    // no second requests.
+    double retryBudget() const;
+    void setRetryBudget(double ratio);
+
+    int hedgedRequestCount() const;
+    int retriedRequestCount() const;
+
+    // the reply times out after msecs rather than defaultRequestTimeout,
+    // 0 for never. Requests timing out or aborted through the reply are
+    // aborted on the network too, so they don't hold on to a connection,
+    // and so are those whose reply is deleted before it finished
+    QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message, int msecs);
+
     QNetworkAccessManager *networkAccessManager();
 
+    // Over TLS, the session of the last handshake is offered again on new
+    // connections, so the server can resume it instead of running a full
+    // handshake (Qt 5.2 and later). The configuration returned carries the
+    // saved session ticket, for clients created later to start with.
     QSslConfiguration sslConfiguration() const;
     void setSslConfiguration(const QSslConfiguration &sslConfiguration);
 
+    // TLS handshakes run for the requests sent so far, and how many of them
+    // offered a saved session. Whether the server accepted it is not visible
+    // through QSslSocket, a server that did skipped the certificate exchange.
+    int tlsHandshakeCount() const;
+    int tlsResumptionAttemptCount() const;
+
+    // With batching enabled, messages sent through sendMessage() and notify()
+    // are queued and go out together as one batch request once control
+    // returns to the event loop, or after maximumBatchDelay() if that is
+    // set. A full batch of maximumBatchSize() messages goes out right away.
+    // Each reply still finishes with the response carrying its request's id.
+    // The server has to accept batches. Off by default.
+    bool isBatchingEnabled() const;
+    void setBatchingEnabled(bool enabled);
+
+    // 50 messages by default
+    int maximumBatchSize() const;
+    void setMaximumBatchSize(int messages);
+
+    // how long the first message of a batch may wait for others to join,
+    // 0, the default, waits no longer than the current event loop pass
+    int maximumBatchDelay() const;
+    void setMaximumBatchDelay(int msecs);
+
 public Q_SLOTS:
     virtual void notify(const QJsonRpcMessage &message);
+
+    // like QJsonRpcSocket's, waits without an event loop on other threads
+    // than the client's
     virtual QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
     virtual QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
+    virtual QList<QJsonRpcServiceReply *> sendBatch(const QList<QJsonRpcMessage> &messages);
+
+    // sends the messages queued for batching now
+    void flushBatch();
 
-    virtual QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &arg1 = QVariant(),
-                                               const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
-                                               const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
-                                               const QVariant &arg6 = QVariant(), const QVariant &arg7 = QVariant(),
-                                               const QVariant &arg8 = QVariant(), const QVariant &arg9 = QVariant(),
-                                               const QVariant &arg10 = QVariant());
-    virtual QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, const QVariant &arg1 = QVariant(),
-                                               const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
-                                               const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
-                                               const QVariant &arg6 = QVariant(), const QVariant &arg7 = QVariant(),
-                                               const QVariant &arg8 = QVariant(), const QVariant &arg9 = QVariant(),
-                                               const QVariant &arg10 = QVariant());
-    virtual QJsonRpcServiceReply *invokeRemoteMethod(const QString &method, const QVariant &arg1 = QVariant(),
-                                             const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
-                                             const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
-                                             const QVariant &arg6 = QVariant(), const QVariant &arg7 = QVariant(),
-                                             const QVariant &arg8 = QVariant(), const QVariant &arg9 = QVariant(),
-                                             const QVariant &arg10 = QVariant());
 
 protected Q_SLOTS:
     virtual void handleAuthenticationRequired(QNetworkReply *reply, QAuthenticator * authenticator);
     virtual void handleSslErrors( QNetworkReply * reply, const QList<QSslError> &errors);
 
+private Q_SLOTS:
+    void replyEncrypted();
+    void replyFinished();
+    void replyTimedOut();
+    void replyHedgeDue();
+    void replyAttemptFailed(QNetworkReply *networkReply);
+    void startBlockingCalls();
+    void blockingCallFinished();
+
 private:
     Q_DISABLE_COPY(QJsonRpcHttpClient)
     Q_DECLARE_PRIVATE(QJsonRpcHttpClient)
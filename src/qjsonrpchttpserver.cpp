@@ -1,5 +1,6 @@
-#include <QStringList>
+#include <cstring>
 #include <QDateTime>
+#include <QPointer>
 
 #if QT_VERSION >= 0x050000
 #include <QJsonDocument>
@@ -9,13 +10,40 @@
 
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcmessage.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcservice.h"
 #include "qjsonrpchttpserver_p.h"
 #include "qjsonrpchttpserver.h"
+#include "qjsonrpchttp2_p.h"
 
 QJsonRpcHttpServerSocket::QJsonRpcHttpServerSocket(QObject *parent)
     : QSslSocket(parent),
-      m_requestParser(0)
+      m_requestEncoding(QJsonRpcCompression::Identity),
+      m_maximumRequestSize(0),
+      m_requestParser(0),
+      m_parsing(false),
+      m_awaitingResponse(false),
+      m_keepAlive(false),
+      m_optionsRequest(false),
+      m_eventStreamRequest(false),
+      m_eventStream(false),
+      m_closing(false),
+      m_headerNameLength(0),
+      m_currentHeader(-1),
+      m_readingHeaderValue(false),
+      m_compressionThreshold(-1),
+      m_compressionLevel(-1),
+      m_keepAliveTimeout(0),
+      m_detectingHttp2(false),
+      m_maximumMemoryUsage(-1),
+      m_accountedMemory(0)
 {
+    for (int i = 0; i < KnownHeaderCount; ++i)
+        m_headers[i].length = -1;
+    m_headerData.reserve(512);
+    m_responseHeader.reserve(256);
+    m_responseBuffer.reserve(4096);
+
     // initialize request parser
     m_requestParser = (http_parser*)malloc(sizeof(http_parser));
     http_parser_init(m_requestParser, HTTP_REQUEST);
@@ -28,12 +56,77 @@ QJsonRpcHttpServerSocket::QJsonRpcHttpServerSocket(QObject *parent)
     m_requestParserSettings.on_message_complete = onMessageComplete;
     m_requestParser->data = this;
 
+    m_idleTimer.setSingleShot(true);
+    connect(&m_idleTimer, SIGNAL(timeout()), this, SLOT(closeIdleConnection()));
     connect(this, SIGNAL(readyRead()), this, SLOT(readIncomingData()));
 }
 
 QJsonRpcHttpServerSocket::~QJsonRpcHttpServerSocket()
 {
     free(m_requestParser);
+    if (m_memoryAccount)
+        m_memoryAccount->update(-m_accountedMemory);
+}
+
+void QJsonRpcHttpServerSocket::setKeepAliveTimeout(int msecs)
+{
+    m_keepAliveTimeout = qMax(0, msecs);
+}
+
+void QJsonRpcHttpServerSocket::setMaximumRequestSize(int bytes)
+{
+    m_maximumRequestSize = qMax(0, bytes);
+}
+
+int QJsonRpcHttpServerSocket::requestSizeLimit() const
+{
+    return m_maximumRequestSize > 0 ? m_maximumRequestSize : int(MaximumUnlimitedRequestSize);
+}
+
+void QJsonRpcHttpServerSocket::setHttp2Enabled(bool enabled)
+{
+    m_detectingHttp2 = enabled;
+}
+
+void QJsonRpcHttpServerSocket::setCompression(int threshold, int level)
+{
+    m_compressionThreshold = qMax(-1, threshold);
+    m_compressionLevel = qBound(-1, level, 9);
+}
+
+void QJsonRpcHttpServerSocket::setMemoryLimit(qint64 bytes, const QJsonRpcMemoryAccountPointer &account)
+{
+    m_maximumMemoryUsage = bytes <= 0 ? -1 : bytes;
+    m_memoryAccount = account;
+    connect(this, SIGNAL(bytesWritten(qint64)), this, SLOT(updateMemoryUsage()), Qt::UniqueConnection);
+}
+
+qint64 QJsonRpcHttpServerSocket::memoryUsage() const
+{
+    return m_pendingInput.size() + m_requestPayload.size() + bytesToWrite();
+}
+
+void QJsonRpcHttpServerSocket::updateMemoryUsage()
+{
+    const qint64 usage = memoryUsage();
+    if (m_memoryAccount && usage != m_accountedMemory)
+        m_memoryAccount->update(usage - m_accountedMemory);
+    m_accountedMemory = usage;
+    if (m_maximumMemoryUsage < 0 || usage <= m_maximumMemoryUsage || m_closing)
+        return;
+
+    // pipelined requests piling up behind a slow one, or a peer that
+    // doesn't read its responses
+    qJsonRpcDebug() << Q_FUNC_INFO << "connection holds" << usage << "bytes, dropping it";
+    m_closing = true;
+    m_pendingInput.clear();
+    m_requestPayload = QByteArray();
+    if (m_memoryAccount) {
+        m_memoryAccount->update(-m_accountedMemory);
+        m_memoryAccount->connectionDropped();
+    }
+    m_accountedMemory = 0;
+    abort();
 }
 
 static inline QByteArray statusMessageForCode(int code)
@@ -41,12 +134,18 @@ static inline QByteArray statusMessageForCode(int code)
     switch (code) {
     case 200:
         return "OK";
+    case 204:
+        return "No Content";
     case 400:
         return "Bad Request";
     case 404:
         return "Not Found";
     case 405:
         return "Method Not Allowed";
+    case 413:
+        return "Request Entity Too Large";
+    case 415:
+        return "Unsupported Media Type";
     case 500:
         return "Internal Server Error";
     }
@@ -54,66 +153,192 @@ static inline QByteArray statusMessageForCode(int code)
     return QByteArray();
 }
 
-qint64 QJsonRpcHttpServerSocket::writeData(const char *data, qint64 maxSize)
-{
-    m_responseBuffer.append(data, (int)maxSize);
-    QJsonDocument document = QJsonDocument::fromJson(m_responseBuffer);
-    if (document.isObject()) {
-        // determine the HTTP code to respond with
-        int statusCode = 200;
-        QJsonRpcMessage message = QJsonRpcMessage::fromObject(document.object());
-        switch (message.type()) {
-        case QJsonRpcMessage::Error:
-            switch (message.errorCode()) {
-            case QJsonRpc::InvalidRequest:
-                statusCode = 400;
-                break;
-
-            case QJsonRpc::MethodNotFound:
-                statusCode = 404;
-                break;
-
-            default:
-                statusCode = 500;
-                break;
-            }
-            break;
+// in the order of KnownHeader
+static const struct {
+    const char *name;
+    int length;
+} knownHeaders[] = {
+    { "content-type", 12 },
+    { "content-length", 14 },
+    { "accept", 6 },
+    { "origin", 6 },
+    { "connection", 10 },
+    { "access-control-request-method", 29 },
+    { "access-control-request-headers", 30 },
+    { "accept-encoding", 15 },
+    { "content-encoding", 16 }
+};
 
-        case QJsonRpcMessage::Invalid:
-            statusCode = 400;
-            break;
+int QJsonRpcHttpServerSocket::knownHeader(const char *name, int length)
+{
+    for (int i = 0; i < KnownHeaderCount; ++i) {
+        if (knownHeaders[i].length == length && qstrnicmp(knownHeaders[i].name, name, length) == 0)
+            return i;
+    }
 
-        case QJsonRpcMessage::Notification:
-        case QJsonRpcMessage::Response:
-        case QJsonRpcMessage::Request:
-            statusCode = 200;
-            break;
-        }
+    return -1;
+}
 
-        // header
-        QByteArray responseHeader;
-        responseHeader += "HTTP/1.1 " + QByteArray::number(statusCode) +" " + statusMessageForCode(statusCode) + "\r\n";
+bool QJsonRpcHttpServerSocket::hasHeader(KnownHeader header) const
+{
+    return m_headers[header].length >= 0;
+}
 
-        if(m_requestHeaders.contains("origin")) {
-          QString origin = m_requestHeaders["origin"];
-          responseHeader += "Access-Control-Allow-Origin: " + origin + "\r\n";
+QByteArray QJsonRpcHttpServerSocket::header(KnownHeader header) const
+{
+    const HeaderSpan &span = m_headers[header];
+    if (span.length < 0)
+        return QByteArray();
+    return QByteArray::fromRawData(m_headerData.constData() + span.offset, span.length);
+}
+
+QByteArray QJsonRpcHttpServerSocket::connectionHeader() const
+{
+    return m_keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+int QJsonRpcHttpServerSocket::statusCodeForMessage(const QJsonRpcMessage &message)
+{
+    switch (message.type()) {
+    case QJsonRpcMessage::Error:
+        switch (message.errorCode()) {
+        case QJsonRpc::InvalidRequest:
+            return 400;
+        case QJsonRpc::MethodNotFound:
+            return 404;
+        default:
+            return 500;
         }
 
-        responseHeader += "Content-Type: application/json-rpc\r\n";
-        responseHeader += "Content-Length: " + QByteArray::number(m_responseBuffer.size()) + "\r\n";
-        responseHeader += "\r\n";
+    case QJsonRpcMessage::Invalid:
+        return 400;
 
-        // body
-        m_responseBuffer.prepend(responseHeader);
-        qint64 bytesWritten = QSslSocket::writeData(m_responseBuffer.constData(), m_responseBuffer.size());
-        close();
+    case QJsonRpcMessage::Notification:
+    case QJsonRpcMessage::Response:
+    case QJsonRpcMessage::Request:
+        break;
+    }
+
+    return 200;
+}
+
+void QJsonRpcHttpServerSocket::sendResponse(const QJsonRpcMessage &message)
+{
+    if (m_closing || state() != QAbstractSocket::ConnectedState)
+        return;
+
+    if (m_http2) {
+        m_http2->sendResponse(message);
+        if (m_http2->isIdle() && m_keepAliveTimeout > 0)
+            m_idleTimer.start(m_keepAliveTimeout);
+        return;
+    }
+
+    // body first, its size goes into the header
+    m_responseBuffer.resize(0);
+    QJsonRpcMessagePrivate::writeJson(message, m_responseBuffer);
+    writeResponse(statusCodeForMessage(message));
+}
+
+void QJsonRpcHttpServerSocket::sendBatchResponse(const QJsonArray &responses)
+{
+    if (m_closing || state() != QAbstractSocket::ConnectedState)
+        return;
+
+    // a batch of notifications is answered like a single one. Otherwise
+    // the status is that of the batch, errors are in the responses
+    if (responses.isEmpty()) {
+        sendNoContentResponse();
+        return;
+    }
+
+    m_responseBuffer.resize(0);
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    m_responseBuffer += QJsonDocument(responses).toJson(QJsonDocument::Compact);
+#else
+    m_responseBuffer += QJsonDocument(responses).toJson();
+#endif
+    writeResponse(200);
+}
+
+void QJsonRpcHttpServerSocket::sendNoContentResponse()
+{
+    QByteArray responseHeader = "HTTP/1.1 204 No Content\r\n";
+    responseHeader += connectionHeader();
+    responseHeader += "\r\n";
+    write(responseHeader);
+    finishResponse();
+}
+
+void QJsonRpcHttpServerSocket::writeResponse(int statusCode)
+{
+    qJsonRpcDebug() << "sending(" << this << "): " << m_responseBuffer;
+    m_responseHeader.resize(0);
+    m_responseHeader += "HTTP/1.1 " + QByteArray::number(statusCode) + ' ' + statusMessageForCode(statusCode) + "\r\n";
+    if (hasHeader(OriginHeader)) {
+        m_responseHeader += "Access-Control-Allow-Origin: ";
+        m_responseHeader += header(OriginHeader);
+        m_responseHeader += "\r\n";
+    }
+    m_responseHeader += "Content-Type: application/json-rpc\r\n";
+
+    // the body stays as it is unless compressing makes it smaller
+    const QByteArray *body = &m_responseBuffer;
+    QByteArray compressed;
+    if (m_compressionThreshold >= 0) {
+        const QJsonRpcCompression::Encoding encoding = m_responseBuffer.size() < m_compressionThreshold ?
+            QJsonRpcCompression::Identity : QJsonRpcCompression::negotiate(header(AcceptEncodingHeader));
+        if (encoding != QJsonRpcCompression::Identity) {
+            compressed = QJsonRpcCompression::compress(m_responseBuffer, encoding, m_compressionLevel);
+            if (!compressed.isEmpty() && compressed.size() < m_responseBuffer.size()) {
+                m_responseHeader += "Content-Encoding: " + QJsonRpcCompression::nameForEncoding(encoding) + "\r\n";
+                body = &compressed;
+            }
+        }
 
-        // then clear the buffer
-        m_responseBuffer.clear();
-        return bytesWritten;
+        // caches must not hand one client's coding to another
+        m_responseHeader += "Vary: Accept-Encoding\r\n";
     }
 
-    return maxSize;
+    m_responseHeader += "Content-Length: " + QByteArray::number(body->size()) + "\r\n";
+    m_responseHeader += connectionHeader();
+    m_responseHeader += "\r\n";
+
+    // both end up in the socket's write buffer, without joining them first
+    write(m_responseHeader);
+    write(*body);
+
+    // reused for the next response unless it was unusually large
+    if (m_responseBuffer.capacity() > MaximumBodyReservation)
+        m_responseBuffer = QByteArray();
+    finishResponse();
+    updateMemoryUsage();
+}
+
+void QJsonRpcHttpServerSocket::startEventStream()
+{
+    // no Content-Length, the stream lasts as long as the connection
+    QByteArray responseHeader = "HTTP/1.1 200 OK\r\n";
+    if (hasHeader(OriginHeader))
+        responseHeader += "Access-Control-Allow-Origin: " + header(OriginHeader) + "\r\n";
+    responseHeader += "Content-Type: text/event-stream\r\n";
+    responseHeader += "Cache-Control: no-cache\r\n";
+    responseHeader += "\r\n";
+    write(responseHeader);
+
+    m_eventStream = true;
+    m_awaitingResponse = true;
+    m_pendingInput.clear();
+    m_idleTimer.stop();
+    Q_EMIT eventStreamOpened();
+}
+
+void QJsonRpcHttpServerSocket::sendEvent(const QByteArray &event)
+{
+    if (m_eventStream && !m_closing) {
+        write(event);
+        updateMemoryUsage();
+    }
 }
 
 void QJsonRpcHttpServerSocket::sendOptionsResponse(int statusCode)
@@ -122,78 +347,268 @@ void QJsonRpcHttpServerSocket::sendOptionsResponse(int statusCode)
 
     responseHeader += "HTTP/1.1 " + QByteArray::number(statusCode) +" " + statusMessageForCode(statusCode) + "\r\n";
     
-    if(m_requestHeaders.contains("origin")) {
-      QByteArray origin = m_requestHeaders["origin"].toLatin1();
-      responseHeader += "Access-Control-Allow-Origin: " + origin + "\r\n";
-    }
+    if (hasHeader(OriginHeader))
+        responseHeader += "Access-Control-Allow-Origin: " + header(OriginHeader) + "\r\n";
 
-    if(m_requestHeaders.contains("access-control-request-method")) {
-      QByteArray allowed_method = m_requestHeaders["access-control-request-method"].toLatin1();
-      responseHeader += "Access-Control-Allow-Methods: " + allowed_method + "\r\n";
+    if (hasHeader(AccessControlRequestMethodHeader)) {
+        responseHeader += "Access-Control-Allow-Methods: " +
+                          header(AccessControlRequestMethodHeader) + "\r\n";
     }
 
-    if(m_requestHeaders.contains("access-control-request-headers")) {
-      QByteArray allowed_headers = m_requestHeaders["access-control-request-headers"].toLatin1();
-      responseHeader += "Access-Control-Allow-Headers: " + allowed_headers + "\r\n";
+    if (hasHeader(AccessControlRequestHeadersHeader)) {
+        responseHeader += "Access-Control-Allow-Headers: " +
+                          header(AccessControlRequestHeadersHeader) + "\r\n";
     }
 
     responseHeader += "Content-Type: text/plain\r\n";
-    responseHeader += "Connection: keep-alive\r\n";
+    responseHeader += "Content-Length: 0\r\n";
+    responseHeader += connectionHeader();
     responseHeader += "\r\n";
 
-    QSslSocket::writeData(responseHeader.constData(), responseHeader.size());
-    close();
+    write(responseHeader);
+    finishResponse();
 }
 
 void QJsonRpcHttpServerSocket::sendErrorResponse(int statusCode)
 {
+    // the request may not have been read completely, so the connection
+    // can't be reused
     QByteArray responseHeader;
     responseHeader += "HTTP/1.1 " + QByteArray::number(statusCode) +" " + statusMessageForCode(statusCode) + "\r\n";
+    responseHeader += "Content-Length: 0\r\n";
+    responseHeader += "Connection: close\r\n";
     responseHeader += "\r\n";
 
-    QSslSocket::writeData(responseHeader.constData(), responseHeader.size());
+    write(responseHeader);
+    finishResponse(false);
+}
+
+void QJsonRpcHttpServerSocket::finishResponse(bool keepAlive)
+{
+    m_awaitingResponse = false;
+    if (!keepAlive || !m_keepAlive) {
+        m_closing = true;
+        m_pendingInput.clear();
+        close();
+        return;
+    }
+
+    // answered from a callback, the parsing loop picks up the next request
+    if (m_parsing)
+        return;
+
+    if (m_pendingInput.isEmpty())
+        m_idleTimer.start(m_keepAliveTimeout);
+    else
+        processPendingInput();
+}
+
+void QJsonRpcHttpServerSocket::closeIdleConnection()
+{
+    qJsonRpcDebug() << Q_FUNC_INFO << "closing idle connection";
+    if (m_http2)
+        m_http2->goAway();
+    m_closing = true;
     close();
 }
 
 void QJsonRpcHttpServerSocket::readIncomingData()
 {
-    QByteArray requestBuffer = readAll();
-    http_parser_execute(m_requestParser, &m_requestParserSettings,
-                        requestBuffer.constData(), requestBuffer.size());
+    if (m_closing || m_eventStream) {
+        readAll();
+        return;
+    }
+
+    m_idleTimer.stop();
+    if (m_http2) {
+        processHttp2Input(readAll());
+        updateMemoryUsage();
+        return;
+    }
+
+    m_pendingInput.append(readAll());
+    if (m_detectingHttp2) {
+        // anything else than the preface is HTTP/1.x
+        const int size = qMin(m_pendingInput.size(), int(QJsonRpcHttp2Connection::PrefaceLength));
+        if (memcmp(m_pendingInput.constData(), QJsonRpcHttp2Connection::preface, size) != 0) {
+            m_detectingHttp2 = false;
+        } else if (size < QJsonRpcHttp2Connection::PrefaceLength) {
+            return;
+        } else {
+            m_detectingHttp2 = false;
+            m_http2.reset(new QJsonRpcHttp2Connection(this));
+            const QByteArray input = m_pendingInput;
+            m_pendingInput.clear();
+            processHttp2Input(input);
+            updateMemoryUsage();
+            return;
+        }
+    }
+
+    processPendingInput();
+    updateMemoryUsage();
+}
+
+void QJsonRpcHttpServerSocket::processHttp2Input(const QByteArray &data)
+{
+    if (!m_http2->processInput(data)) {
+        m_closing = true;
+        close();
+        return;
+    }
+
+    if (m_http2->isIdle() && m_keepAliveTimeout > 0)
+        m_idleTimer.start(m_keepAliveTimeout);
+}
+
+void QJsonRpcHttpServerSocket::processPendingInput()
+{
+    if (m_parsing)
+        return;
+
+    m_parsing = true;
+    while (!m_pendingInput.isEmpty() && !m_awaitingResponse && !m_closing) {
+        // the callbacks refer into input, which stays valid if more data
+        // is appended to m_pendingInput meanwhile
+        const QByteArray input = m_pendingInput;
+        size_t parsed = http_parser_execute(m_requestParser, &m_requestParserSettings,
+                                            input.constData(), input.size());
+        if (m_closing)
+            break;
+
+        m_pendingInput.remove(0, int(parsed));
+        if (HTTP_PARSER_ERRNO(m_requestParser) == HPE_PAUSED) {
+            // a request was completed, go on once it was answered
+            http_parser_pause(m_requestParser, 0);
+        } else if (HTTP_PARSER_ERRNO(m_requestParser) != HPE_OK) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "invalid request:"
+                            << http_errno_name(HTTP_PARSER_ERRNO(m_requestParser));
+            sendErrorResponse(400);
+            break;
+        }
+    }
+    m_parsing = false;
+
+    if (!m_awaitingResponse && !m_closing && m_pendingInput.isEmpty() && m_keepAlive)
+        m_idleTimer.start(m_keepAliveTimeout);
 }
 
+// the body may arrive in several pieces, it was reserved from Content-Length
 int QJsonRpcHttpServerSocket::onBody(http_parser *parser, const char *at, size_t length)
 {
     QJsonRpcHttpServerSocket *request = (QJsonRpcHttpServerSocket *)parser->data;
-    request->m_requestPayload = QByteArray(at, length);
+    const int limit = request->requestSizeLimit();
+    if (quint64(request->m_requestPayload.size()) + length > quint64(limit)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "request body exceeds" << limit << "bytes";
+        request->sendErrorResponse(413);
+        return -1;
+    }
+
+    request->m_requestPayload.append(at, int(length));
+    if (request->m_requestEncoding == QJsonRpcCompression::Identity)
+        request->m_bodyParser.feed(request->m_requestPayload.constData(), request->m_requestPayload.size());
     return 0;
 }
 
+bool QJsonRpcHttpServerSocket::isBatch(const QByteArray &payload)
+{
+    for (int i = 0; i < payload.size(); ++i) {
+        const char c = payload.at(i);
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            return c == '[';
+    }
+
+    return false;
+}
+
+static inline bool isBlank(const char *data, int from, int to)
+{
+    for (int i = from; i < to; ++i) {
+        if (data[i] != ' ' && data[i] != '\t' && data[i] != '\r' && data[i] != '\n')
+            return false;
+    }
+
+    return true;
+}
+
+// whether the body holds one message, read while it arrived, and nothing
+// else. Other bodies are parsed once complete, which reports their errors
+bool QJsonRpcHttpServerSocket::isBodyParsed() const
+{
+    if (m_requestEncoding != QJsonRpcCompression::Identity ||
+        m_bodyParser.status() != QJsonRpcIncrementalParser::Finished || m_bodyParser.isBatch())
+        return false;
+
+    const char *data = m_requestPayload.constData();
+    return isBlank(data, 0, m_bodyParser.documentStart()) &&
+           isBlank(data, m_bodyParser.documentEnd(), m_requestPayload.size());
+}
+
 int QJsonRpcHttpServerSocket::onMessageComplete(http_parser *parser)
 {
     QJsonRpcHttpServerSocket *request = (QJsonRpcHttpServerSocket *)parser->data;
-    QJsonRpcMessage message = QJsonRpcMessage::fromJson(request->m_requestPayload);
+    http_parser_pause(parser, 1);
+    if (request->m_optionsRequest)
+        return 0;
+
+    if (request->m_eventStreamRequest) {
+        request->startEventStream();
+        return 0;
+    }
+
+    // decoded in one go, the body was limited to m_maximumRequestSize so far
+    // and its decoded form is held to the same limit
+    if (request->m_requestEncoding != QJsonRpcCompression::Identity) {
+        QByteArray decoded;
+        bool sizeExceeded = false;
+        const int maximumSize = request->m_maximumRequestSize > 0 ? request->m_maximumRequestSize
+                                                                  : int(MaximumDecodedRequestSize);
+        if (!QJsonRpcCompression::decompress(request->m_requestPayload, request->m_requestEncoding, &decoded,
+                                             maximumSize, &sizeExceeded)) {
+            qJsonRpcDebug() << Q_FUNC_INFO << (sizeExceeded ? "decoded request body exceeds" : "malformed")
+                            << QJsonRpcCompression::nameForEncoding(request->m_requestEncoding) << "body";
+            request->sendErrorResponse(sizeExceeded ? 413 : 400);
+            return -1;
+        }
+
+        request->m_requestPayload = decoded;
+    }
+
+    request->m_awaitingResponse = true;
+    QJsonRpcMessage message;
+    if (request->isBodyParsed()) {
+        message = request->m_bodyParser.takeMessage();
+    } else {
+        if (isBatch(request->m_requestPayload)) {
+            QJsonDocument document = QJsonDocument::fromJson(request->m_requestPayload);
+            if (document.isArray()) {
+                Q_EMIT request->batchReceived(document.array());
+                return 0;
+            }
+        }
+
+        message = QJsonRpcMessage::fromJson(request->m_requestPayload);
+    }
     Q_EMIT request->messageReceived(message);
+
+    // notifications have no response to wait for
+    if (message.type() == QJsonRpcMessage::Notification && request->m_awaitingResponse)
+        request->sendNoContentResponse();
+
     return 0;
 }
 
 int QJsonRpcHttpServerSocket::onHeadersComplete(http_parser *parser)
 {
     QJsonRpcHttpServerSocket *request = (QJsonRpcHttpServerSocket *)parser->data;
-
+    request->m_keepAlive = request->m_keepAliveTimeout > 0 && http_should_keep_alive(parser);
     if (parser->method == HTTP_OPTIONS) {
         qJsonRpcDebug() << Q_FUNC_INFO << "OPTIONS method" << parser->method;
+        request->m_optionsRequest = true;
         request->sendOptionsResponse(200);
         return 0;
     }
 
-    // need to add the final headers received
-    if (!request->m_currentHeaderField.isEmpty() && !request->m_currentHeaderValue.isEmpty()) {
-        request->m_requestHeaders.insert(request->m_currentHeaderField.toLower(), request->m_currentHeaderValue);
-        request->m_currentHeaderField.clear();
-        request->m_currentHeaderValue.clear();
-    }
-
     if (parser->method != HTTP_GET && parser->method != HTTP_POST) {
         // NOTE: close the socket, cleanup, delete, etc..
         qJsonRpcDebug() << Q_FUNC_INFO << "invalid method: " << parser->method;
@@ -201,64 +616,135 @@ int QJsonRpcHttpServerSocket::onHeadersComplete(http_parser *parser)
         return -1;
     }
 
+    // a long-lived stream of notifications rather than a request
+    if (parser->method == HTTP_GET && request->header(AcceptHeader).contains("text/event-stream")) {
+        request->m_eventStreamRequest = true;
+        return 0;
+    }
+
     // check headers
     // see: http://www.jsonrpc.org/historical/json-rpc-over-http.html#http-header
-    QStringList requiredHeaders =
-        QStringList() << "content-type" << "content-length" << "accept";
-    foreach (QString requiredHeader, requiredHeaders) {
-        if (!request->m_requestHeaders.contains(requiredHeader)) {
-            qJsonRpcDebug() << Q_FUNC_INFO << "error: " << request->m_requestHeaders;
+    static const KnownHeader requiredHeaders[] = {
+        ContentTypeHeader, ContentLengthHeader, AcceptHeader
+    };
+    for (int i = 0; i < 3; ++i) {
+        if (!request->hasHeader(requiredHeaders[i])) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "missing header:" << knownHeaders[requiredHeaders[i]].name;
             request->sendErrorResponse(400);
             return -1;
         }
     }
 
-    QStringList supportedContentTypes =
-        QStringList() << "application/json-rpc" << "application/json" << "application/jsonrequest";
-    QString contentType = request->m_requestHeaders.value("content-type");
-    bool foundSupportedContentType = false;
-    foreach (QString supportedContentType, supportedContentTypes) {
-        if (contentType.contains(supportedContentType)) {
-            foundSupportedContentType = true;
-            break;
-        }
-    }
-
-    QString acceptType = request->m_requestHeaders.value("accept");
-    if (!foundSupportedContentType || !supportedContentTypes.contains(acceptType)) {
+    if (!isSupportedMediaType(request->header(ContentTypeHeader), request->header(AcceptHeader))) {
         // NOTE: signal the error
         qJsonRpcDebug() << Q_FUNC_INFO << "invalid content or accept type";
         request->sendErrorResponse(400);
         return -1;
     }
 
+    request->m_requestEncoding = QJsonRpcCompression::Identity;
+    if (request->hasHeader(ContentEncodingHeader)) {
+        request->m_requestEncoding = QJsonRpcCompression::encodingForName(request->header(ContentEncodingHeader));
+        if (request->m_requestEncoding == QJsonRpcCompression::UnknownEncoding) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "unsupported content encoding:"
+                            << request->header(ContentEncodingHeader);
+            request->sendErrorResponse(415);
+            return -1;
+        }
+    }
+
+    // refuse oversized bodies before reading them, and read the others into
+    // a buffer allocated once; http-parser reports a missing length as -1.
+    // Content-Length is only trusted up to a point for the reservation,
+    // bodies larger than that grow as they arrive
+    const quint64 contentLength = parser->content_length;
+    const int limit = request->requestSizeLimit();
+    if (contentLength != quint64(-1) && contentLength > quint64(limit)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "request body of" << contentLength << "bytes exceeds" << limit;
+        request->sendErrorResponse(413);
+        return -1;
+    }
+
+    if (contentLength != quint64(-1))
+        request->m_requestPayload.reserve(int(qMin<quint64>(contentLength, MaximumBodyReservation)));
     return 0;
 }
 
+bool QJsonRpcHttpServerSocket::isSupportedMediaType(const QByteArray &contentType,
+                                                    const QByteArray &accept)
+{
+    static const char * const supportedContentTypes[] = {
+        "application/json-rpc", "application/json", "application/jsonrequest"
+    };
+
+    bool foundSupportedContentType = false;
+    bool foundSupportedAcceptType = false;
+    for (int i = 0; i < 3; ++i) {
+        if (contentType.contains(supportedContentTypes[i]))
+            foundSupportedContentType = true;
+        if (accept == supportedContentTypes[i])
+            foundSupportedAcceptType = true;
+    }
+
+    return foundSupportedContentType && foundSupportedAcceptType;
+}
+
+// names and values may arrive in several pieces when split across reads
 int QJsonRpcHttpServerSocket::onHeaderField(http_parser *parser, const char *at, size_t length)
 {
     QJsonRpcHttpServerSocket *request = (QJsonRpcHttpServerSocket *)parser->data;
-    if (!request->m_currentHeaderField.isEmpty() && !request->m_currentHeaderValue.isEmpty()) {
-        request->m_requestHeaders.insert(request->m_currentHeaderField.toLower(), request->m_currentHeaderValue);
-        request->m_currentHeaderField.clear();
-        request->m_currentHeaderValue.clear();
+    if (request->m_readingHeaderValue) {
+        request->m_readingHeaderValue = false;
+        request->m_headerNameLength = 0;
     }
 
-    request->m_currentHeaderField.append(QString::fromUtf8(at, length));
+    int end = request->m_headerNameLength + int(length);
+    if (end <= MaximumHeaderNameLength)
+        memcpy(request->m_headerName + request->m_headerNameLength, at, length);
+    request->m_headerNameLength = end;
     return 0;
 }
 
 int QJsonRpcHttpServerSocket::onHeaderValue(http_parser *parser, const char *at, size_t length)
 {
     QJsonRpcHttpServerSocket *request = (QJsonRpcHttpServerSocket *)parser->data;
-    request->m_currentHeaderValue.append(QString::fromUtf8(at, length));
+    if (!request->m_readingHeaderValue) {
+        request->m_readingHeaderValue = true;
+        request->m_currentHeader = (request->m_headerNameLength <= MaximumHeaderNameLength) ?
+            knownHeader(request->m_headerName, request->m_headerNameLength) : -1;
+        if (request->m_currentHeader >= 0) {
+            HeaderSpan &span = request->m_headers[request->m_currentHeader];
+            span.offset = request->m_headerData.size();
+            span.length = 0;
+        }
+    }
+
+    if (request->m_currentHeader >= 0) {
+        request->m_headerData.append(at, int(length));
+        request->m_headers[request->m_currentHeader].length += int(length);
+    }
+
     return 0;
 }
 
 int QJsonRpcHttpServerSocket::onMessageBegin(http_parser *parser)
 {
     QJsonRpcHttpServerSocket *request = (QJsonRpcHttpServerSocket *)parser->data;
-    request->m_requestHeaders.clear();
+    for (int i = 0; i < KnownHeaderCount; ++i)
+        request->m_headers[i].length = -1;
+    request->m_headerData.resize(0);
+    request->m_headerNameLength = 0;
+    request->m_currentHeader = -1;
+    request->m_readingHeaderValue = false;
+    // keep the body's capacity for the next request unless it was unusually large
+    if (request->m_requestPayload.capacity() > MaximumBodyReservation)
+        request->m_requestPayload = QByteArray();
+    else
+        request->m_requestPayload.resize(0);
+    request->m_bodyParser.reset();
+    request->m_optionsRequest = false;
+    request->m_eventStreamRequest = false;
+    request->m_keepAlive = false;
     return 0;
 }
 
@@ -273,10 +759,226 @@ int QJsonRpcHttpServerSocket::onUrl(http_parser *parser, const char *at, size_t
     return 0;
 }
 
-QJsonRpcHttpServerRpcSocket::QJsonRpcHttpServerRpcSocket(QIODevice *device, QObject *parent)
-    : QJsonRpcSocket(device, parent)
+QJsonRpcHttpServerRpcSocketPrivate::QJsonRpcHttpServerRpcSocketPrivate(QJsonRpcHttpServerSocket *httpSocket,
+                                                                       QJsonRpcSocket *q)
+    : QJsonRpcSocketPrivate(q),
+      httpSocket(httpSocket)
+{
+    device = httpSocket;
+}
+
+void QJsonRpcHttpServerRpcSocketPrivate::writeBatchResponse(const QJsonArray &responses)
+{
+    if (httpSocket)
+        httpSocket->sendBatchResponse(responses);
+}
+
+QJsonRpcHttpServerRpcSocket::QJsonRpcHttpServerRpcSocket(QJsonRpcHttpServerSocket *device,
+                                                         QObject *parent)
+    : QJsonRpcSocket(*new QJsonRpcHttpServerRpcSocketPrivate(device, this), parent),
+      m_httpSocket(device)
 {
     disconnect(device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
+    connect(device, SIGNAL(batchReceived(QJsonArray)), this, SLOT(processBatch(QJsonArray)));
+}
+
+void QJsonRpcHttpServerRpcSocket::processBatch(const QJsonArray &batch)
+{
+    Q_D(QJsonRpcSocket);
+    if (batch.isEmpty()) {
+        m_httpSocket->sendResponse(
+            QJsonRpcMessage().createErrorResponse(QJsonRpc::InvalidRequest, "invalid request"));
+        return;
+    }
+
+    d->processIncomingBatch(batch);
+}
+
+void QJsonRpcHttpServerRpcSocket::notify(const QJsonRpcMessage &message)
+{
+    if (!m_httpSocket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return;
+    }
+
+    Q_D(QJsonRpcSocket);
+    if (d->collectBatchResponse(message))
+        return;
+
+    m_httpSocket->sendResponse(message);
+}
+
+QJsonRpcHttpServerReactor::QJsonRpcHttpServerReactor(QJsonRpcHttpServer *server)
+    : connections(0),
+      server(server)
+{
+}
+
+QJsonRpcHttpServerReactor::~QJsonRpcHttpServerReactor()
+{
+    QJsonRpcHttpServerPrivate *d = server->d_func();
+    QMutexLocker locker(&d->clientsMutex);
+    QHash<QJsonRpcHttpServerSocket*, QJsonRpcHttpServerRpcSocket*>::const_iterator it;
+    for (it = requestSocketLookup.constBegin(); it != requestSocketLookup.constEnd(); ++it) {
+        d->eventStreams.removeAll(it.key());
+        it.key()->disconnect(this);
+        it.key()->flush();
+    }
+
+    // the sockets are children, deleted along with the reactor
+}
+
+int QJsonRpcHttpServerReactor::connectionCount() const
+{
+#if QT_VERSION >= 0x050000
+    return connections.load();
+#else
+    return connections;
+#endif
+}
+
+void QJsonRpcHttpServerReactor::addConnection(qlonglong socketDescriptor)
+{
+    QJsonRpcHttpServerSocket *socket = new QJsonRpcHttpServerSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "unable to set socket descriptor";
+        connections.deref();
+        socket->deleteLater();
+        return;
+    }
+
+    server->d_func()->configureSocket(socket);
+    connect(socket, SIGNAL(disconnected()), this, SLOT(_q_socketDisconnected()));
+    connect(socket, SIGNAL(eventStreamOpened()), this, SLOT(_q_eventStreamOpened()));
+    connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
+              this, SLOT(_q_processMessage(QJsonRpcMessage)));
+    QJsonRpcHttpServerRpcSocket *rpcSocket = new QJsonRpcHttpServerRpcSocket(socket, this);
+    connect(rpcSocket, SIGNAL(messageReceived(QJsonRpcMessage)),
+                 this, SLOT(_q_processMessage(QJsonRpcMessage)));
+    requestSocketLookup.insert(socket, rpcSocket);
+}
+
+void QJsonRpcHttpServerReactor::_q_socketDisconnected()
+{
+    QJsonRpcHttpServerSocket *socket = qobject_cast<QJsonRpcHttpServerSocket*>(sender());
+    if (!socket)
+        return;
+
+    QJsonRpcHttpServerPrivate *d = server->d_func();
+    bool eventStream;
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        eventStream = d->eventStreams.removeAll(socket) > 0;
+    }
+
+    if (eventStream)
+        Q_EMIT server->clientDisconnected();
+
+    if (requestSocketLookup.contains(socket)) {
+        connections.deref();
+        requestSocketLookup.take(socket)->deleteLater();
+    }
+
+    socket->deleteLater();
+}
+
+void QJsonRpcHttpServerReactor::_q_eventStreamOpened()
+{
+    QJsonRpcHttpServerSocket *socket = qobject_cast<QJsonRpcHttpServerSocket*>(sender());
+    if (!socket)
+        return;
+
+    QJsonRpcHttpServerPrivate *d = server->d_func();
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        d->eventStreams.append(socket);
+    }
+
+    Q_EMIT server->clientConnected();
+}
+
+void QJsonRpcHttpServerReactor::_q_processMessage(const QJsonRpcMessage &message)
+{
+    // the requests of a batch come from the rpc socket itself
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcHttpServerRpcSocket*>(sender());
+    if (!socket) {
+        QJsonRpcHttpServerSocket *request = qobject_cast<QJsonRpcHttpServerSocket*>(sender());
+        if (!request)
+            return;
+        socket = requestSocketLookup.value(request);
+    }
+
+    server->processMessage(socket, message);
+}
+
+void QJsonRpcHttpServerPrivate::configureSocket(QJsonRpcHttpServerSocket *socket)
+{
+    socket->setKeepAliveTimeout(keepAliveTimeout);
+    socket->setMaximumRequestSize(maximumRequestSize);
+    socket->setHttp2Enabled(http2Enabled);
+    socket->setCompression(compressionThreshold, compressionLevel);
+    socket->setMemoryLimit(maximumConnectionMemory, memoryAccount);
+    if (!sslConfiguration.isNull()) {
+        QSslConfiguration configuration = sslConfiguration;
+#if QT_VERSION >= 0x050300
+        // over TLS, HTTP/2 is negotiated through ALPN; the client still
+        // starts with the preface once it was
+        if (http2Enabled)
+            configuration.setAllowedNextProtocols(QList<QByteArray>() << "h2" << "http/1.1");
+#endif
+        socket->setSslConfiguration(configuration);
+        socket->startServerEncryption();
+        // connect ssl error signals etc
+
+        // NOTE: unsafe
+        QObject::connect(socket, SIGNAL(sslErrors(QList<QSslError>)), socket, SLOT(ignoreSslErrors()));
+        QObject::connect(socket, SIGNAL(encrypted()), q_ptr, SLOT(_q_socketEncrypted()));
+    }
+}
+
+QJsonRpcHttpServerReactor *QJsonRpcHttpServerPrivate::selectReactor()
+{
+    Q_Q(QJsonRpcHttpServer);
+    if (reactors.isEmpty()) {
+        for (int i = 0; i < ioThreadCount; ++i) {
+            QThread *thread = new QThread;
+            QJsonRpcHttpServerReactor *reactor = new QJsonRpcHttpServerReactor(q);
+            reactor->moveToThread(thread);
+            thread->start();
+            ioThreads.append(thread);
+            reactors.append(reactor);
+        }
+    }
+
+    // least loaded, round robin between equally loaded ones
+    int selected = nextReactor;
+    int selectedLoad = reactors.at(selected)->connectionCount();
+    for (int i = 1; i < reactors.size() && selectedLoad > 0; ++i) {
+        int index = (nextReactor + i) % reactors.size();
+        int load = reactors.at(index)->connectionCount();
+        if (load < selectedLoad) {
+            selected = index;
+            selectedLoad = load;
+        }
+    }
+
+    nextReactor = (selected + 1) % reactors.size();
+    return reactors.at(selected);
+}
+
+void QJsonRpcHttpServerPrivate::stopReactors()
+{
+    // reactors are deleted in their own thread when its event loop finishes
+    foreach (QJsonRpcHttpServerReactor *reactor, reactors)
+        reactor->deleteLater();
+    reactors.clear();
+
+    foreach (QThread *thread, ioThreads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    ioThreads.clear();
 }
 
 QJsonRpcHttpServer::QJsonRpcHttpServer(QObject *parent)
@@ -287,6 +989,8 @@ QJsonRpcHttpServer::QJsonRpcHttpServer(QObject *parent)
 
 QJsonRpcHttpServer::~QJsonRpcHttpServer()
 {
+    Q_D(QJsonRpcHttpServer);
+    d->stopReactors();
 }
 
 QSslConfiguration QJsonRpcHttpServer::sslConfiguration() const
@@ -301,6 +1005,107 @@ void QJsonRpcHttpServer::setSslConfiguration(const QSslConfiguration &config)
     d->sslConfiguration = config;
 }
 
+int QJsonRpcHttpServer::tlsHandshakeCount() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->tlsHandshakes;
+}
+
+int QJsonRpcHttpServer::maximumRequestSize() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->maximumRequestSize;
+}
+
+void QJsonRpcHttpServer::setMaximumRequestSize(int bytes)
+{
+    Q_D(QJsonRpcHttpServer);
+    d->maximumRequestSize = qMax(0, bytes);
+}
+
+qint64 QJsonRpcHttpServer::maximumConnectionMemory() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->maximumConnectionMemory;
+}
+
+void QJsonRpcHttpServer::setMaximumConnectionMemory(qint64 bytes)
+{
+    Q_D(QJsonRpcHttpServer);
+    d->maximumConnectionMemory = bytes <= 0 ? -1 : bytes;
+}
+
+QJsonRpcMemoryStats QJsonRpcHttpServer::memoryStats() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->memoryAccount->stats();
+}
+
+int QJsonRpcHttpServer::compressionThreshold() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->compressionThreshold;
+}
+
+void QJsonRpcHttpServer::setCompressionThreshold(int bytes)
+{
+    Q_D(QJsonRpcHttpServer);
+    d->compressionThreshold = qMax(-1, bytes);
+}
+
+int QJsonRpcHttpServer::compressionLevel() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->compressionLevel;
+}
+
+void QJsonRpcHttpServer::setCompressionLevel(int level)
+{
+    Q_D(QJsonRpcHttpServer);
+    d->compressionLevel = qBound(-1, level, 9);
+}
+
+bool QJsonRpcHttpServer::isHttp2Enabled() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->http2Enabled;
+}
+
+void QJsonRpcHttpServer::setHttp2Enabled(bool enabled)
+{
+    Q_D(QJsonRpcHttpServer);
+    d->http2Enabled = enabled;
+}
+
+int QJsonRpcHttpServer::ioThreadCount() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->ioThreadCount;
+}
+
+void QJsonRpcHttpServer::setIoThreadCount(int count)
+{
+    Q_D(QJsonRpcHttpServer);
+    if (!d->reactors.isEmpty()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "can't change the I/O threads once connections were accepted";
+        return;
+    }
+
+    d->ioThreadCount = qMax(0, count);
+}
+
+int QJsonRpcHttpServer::keepAliveTimeout() const
+{
+    Q_D(const QJsonRpcHttpServer);
+    return d->keepAliveTimeout;
+}
+
+void QJsonRpcHttpServer::setKeepAliveTimeout(int msecs)
+{
+    Q_D(QJsonRpcHttpServer);
+    d->keepAliveTimeout = qMax(0, msecs);
+}
+
 #if QT_VERSION >= 0x050000
 void QJsonRpcHttpServer::incomingConnection(qintptr socketDescriptor)
 #else
@@ -308,6 +1113,14 @@ void QJsonRpcHttpServer::incomingConnection(int socketDescriptor)
 #endif
 {
     Q_D(QJsonRpcHttpServer);
+    if (d->ioThreadCount > 0) {
+        QJsonRpcHttpServerReactor *reactor = d->selectReactor();
+        reactor->connections.ref();
+        QMetaObject::invokeMethod(reactor, "addConnection", Qt::QueuedConnection,
+                                  Q_ARG(qlonglong, socketDescriptor));
+        return;
+    }
+
     QJsonRpcHttpServerSocket *socket = new QJsonRpcHttpServerSocket(this);
     if (!socket->setSocketDescriptor(socketDescriptor)) {
         qJsonRpcDebug() << Q_FUNC_INFO << "unable to set socket descriptor";
@@ -315,47 +1128,93 @@ void QJsonRpcHttpServer::incomingConnection(int socketDescriptor)
         return;
     }
 
-    if (!d->sslConfiguration.isNull()) {
-        socket->setSslConfiguration(d->sslConfiguration);
-        socket->startServerEncryption();
-        // connect ssl error signals etc
-
-        // NOTE: unsafe
-        connect(socket, SIGNAL(sslErrors(QList<QSslError>)), socket, SLOT(ignoreSslErrors()));
-    }
-
+    d->configureSocket(socket);
     connect(socket, SIGNAL(disconnected()), this, SLOT(_q_socketDisconnected()));
+    connect(socket, SIGNAL(eventStreamOpened()), this, SLOT(_q_eventStreamOpened()));
     connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
               this, SLOT(processIncomingMessage(QJsonRpcMessage)));
     QJsonRpcHttpServerRpcSocket *rpcSocket = new QJsonRpcHttpServerRpcSocket(socket, this);
+    connect(rpcSocket, SIGNAL(messageReceived(QJsonRpcMessage)),
+                 this, SLOT(processIncomingMessage(QJsonRpcMessage)));
     d->requestSocketLookup.insert(socket, rpcSocket);
 }
 
 void QJsonRpcHttpServer::processIncomingMessage(const QJsonRpcMessage &message)
 {
     Q_D(QJsonRpcHttpServer);
-    QJsonRpcHttpServerSocket *request = qobject_cast<QJsonRpcHttpServerSocket*>(sender());
-    if (!request)
-        return;
+    // the requests of a batch come from the rpc socket itself
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcHttpServerRpcSocket*>(sender());
+    if (!socket) {
+        QJsonRpcHttpServerSocket *request = qobject_cast<QJsonRpcHttpServerSocket*>(sender());
+        if (!request)
+            return;
+        socket = d->requestSocketLookup.value(request);
+    }
 
-    QJsonRpcSocket *socket = d->requestSocketLookup.value(request);
     processMessage(socket, message);
 }
 
 int QJsonRpcHttpServer::connectedClientCount() const
 {
-    return 0;
+    Q_D(const QJsonRpcHttpServer);
+    QMutexLocker locker(&d->clientsMutex);
+    return d->eventStreams.size();
 }
 
 void QJsonRpcHttpServer::notifyConnectedClients(const QJsonRpcMessage &message)
 {
-    Q_UNUSED(message);
+    Q_D(QJsonRpcHttpServer);
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        if (d->eventStreams.isEmpty())
+            return;
+    }
+
+    // serialized once for all streams. Line breaks can only come from
+    // whitespace in JSON received as is, a data field ends at each of them
+    QByteArray json;
+    QJsonRpcMessagePrivate::writeJson(message, json);
+    json.replace('\r', "");
+    json.replace('\n', "\ndata: ");
+
+    QByteArray event;
+    event.reserve(json.size() + 8);
+    event += "data: ";
+    event += json;
+    event += "\n\n";
+
+    // written once the lock is released, a stream closed by its write must
+    // be able to leave the list
+    QList<QPointer<QJsonRpcHttpServerSocket> > streams;
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        for (int i = 0; i < d->eventStreams.size(); ++i)
+            streams.append(d->eventStreams.at(i));
+    }
+
+    // streams of I/O threads are written from their thread
+    for (int i = 0; i < streams.size(); ++i) {
+        QJsonRpcHttpServerSocket *socket = streams.at(i).data();
+        if (!socket)
+            continue;
+
+        if (socket->thread() == QThread::currentThread())
+            socket->sendEvent(event);
+        else
+            QMetaObject::invokeMethod(socket, "sendEvent", Qt::QueuedConnection,
+                                      Q_ARG(QByteArray, event));
+    }
 }
 
 void QJsonRpcHttpServer::notifyConnectedClients(const QString &method, const QJsonArray &params)
 {
-    Q_UNUSED(method);
-    Q_UNUSED(params);
+    notifyConnectedClients(QJsonRpcMessage::createNotification(method, params));
+}
+
+void QJsonRpcHttpServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    // kept as a slot for the services' signal, topics aren't supported
+    QJsonRpcAbstractServer::notifySubscribers(topic, message);
 }
 
 void QJsonRpcHttpServerPrivate::_q_socketDisconnected()
@@ -365,9 +1224,38 @@ void QJsonRpcHttpServerPrivate::_q_socketDisconnected()
     if (!socket)
         return;
 
-    QJsonRpcSocket *rpcSocket = requestSocketLookup.take(socket);
-    rpcSocket->deleteLater();
+    bool eventStream;
+    {
+        QMutexLocker locker(&clientsMutex);
+        eventStream = eventStreams.removeAll(socket) > 0;
+    }
+
+    if (eventStream)
+        Q_EMIT q->clientDisconnected();
+
+    if (requestSocketLookup.contains(socket))
+        requestSocketLookup.take(socket)->deleteLater();
     socket->deleteLater();
 }
 
+void QJsonRpcHttpServerPrivate::_q_eventStreamOpened()
+{
+    Q_Q(QJsonRpcHttpServer);
+    QJsonRpcHttpServerSocket *socket = qobject_cast<QJsonRpcHttpServerSocket*>(q->sender());
+    if (!socket)
+        return;
+
+    {
+        QMutexLocker locker(&clientsMutex);
+        eventStreams.append(socket);
+    }
+
+    Q_EMIT q->clientConnected();
+}
+
+void QJsonRpcHttpServerPrivate::_q_socketEncrypted()
+{
+    tlsHandshakes++;
+}
+
 #include "moc_qjsonrpchttpserver.cpp"
@@ -17,11 +17,79 @@ public:
     QJsonRpcHttpServer(QObject *parent = 0);
     ~QJsonRpcHttpServer();
 
+    // QSslSocket sets up a TLS context of its own for every connection, so
+    // sessions and tickets of one connection are unknown to the next one and
+    // every new connection runs a full handshake. Keep-alive connections,
+    // see keepAliveTimeout(), are what spares clients further handshakes.
     QSslConfiguration sslConfiguration() const;
     void setSslConfiguration(const QSslConfiguration &config);
 
+    // TLS handshakes completed so far, next to the number of requests
+    // answered over them this tells how well connections are reused
+    int tlsHandshakeCount() const;
+
+    // HTTP/1.1 connections, and HTTP/1.0 ones asking for it, stay open for up
+    // to msecs without a request, 30 seconds by default. 0 closes
+    // connections after every response. Applies to new connections.
+    int keepAliveTimeout() const;
+    void setKeepAliveTimeout(int msecs);
+
+    // requests whose body is larger than bytes are refused with 413 Request
+    // Entity Too Large before the body is read. 0, the default, accepts up
+    // to 1GB. Applies to new connections.
+    int maximumRequestSize() const;
+    void setMaximumRequestSize(int bytes);
+
+    // Connections holding more than bytes, pipelined requests waiting to be
+    // parsed and responses the client didn't read yet included, are
+    // aborted. -1, the default, doesn't limit them. Applies to new
+    // connections. memoryStats() sums up what all of them hold.
+    qint64 maximumConnectionMemory() const;
+    void setMaximumConnectionMemory(qint64 bytes);
+    QJsonRpcMemoryStats memoryStats() const;
+
+    // Also accept HTTP/2: in the clear from clients that start with the
+    // HTTP/2 connection preface, and over TLS when negotiated through ALPN
+    // (Qt 5.3 and later). Each stream carries one request, requests on a
+    // connection are dispatched as they arrive and answered as their
+    // responses come back. Idle HTTP/2 connections are closed after
+    // keepAliveTimeout(), if set. Off by default, applies to new connections.
+    bool isHttp2Enabled() const;
+    void setHttp2Enabled(bool enabled);
+
+    // HTTP/1.1 response bodies of at least bytes are compressed with gzip or
+    // deflate, whichever the request's Accept-Encoding prefers, and sent
+    // as they are if that doesn't make them smaller. -1, the default,
+    // doesn't compress responses. Request bodies in either coding are
+    // accepted regardless, others are refused with 415 Unsupported Media
+    // Type; maximumRequestSize() limits their decoded size too, 64MB without
+    // one. Applies to new connections.
+    int compressionThreshold() const;
+    void setCompressionThreshold(int bytes);
+
+    // zlib's level, from 1 (fastest) to 9 (smallest), -1 for zlib's default
+    int compressionLevel() const;
+    void setCompressionLevel(int level);
+
+    // Accepted connections are handed to the least loaded of count threads,
+    // each decrypting, parsing and answering the requests of its own
+    // connections. Services are still invoked on their own thread, or their
+    // thread pool if they have one. 0, the default, serves every connection
+    // from the server's thread. Can't be changed once connections were
+    // accepted.
+    int ioThreadCount() const;
+    void setIoThreadCount(int count);
+
+    // Clients are connections holding an event stream open: a GET request
+    // accepting text/event-stream is answered with server-sent events, one
+    // for every notification sent to connected clients
     virtual int connectedClientCount() const;
 
+    // Topics aren't supported: event streams have no way of sending
+    // rpc.subscribe and requests don't outlive their connection. subscribe()
+    // and unsubscribe() return false, subscriberCount() 0, and
+    // notifySubscribers() reaches nobody; use notifyConnectedClients()
+
 Q_SIGNALS:
     void clientConnected();
     void clientDisconnected();
@@ -29,6 +97,7 @@ Q_SIGNALS:
 public Q_SLOTS:
     virtual void notifyConnectedClients(const QJsonRpcMessage &message);
     virtual void notifyConnectedClients(const QString &method, const QJsonArray &params);
+    virtual void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
 
 protected:
 #if QT_VERSION >= 0x050000
@@ -41,11 +110,14 @@ private Q_SLOTS:
     void processIncomingMessage(const QJsonRpcMessage &message);
 
 private:
+    friend class QJsonRpcHttpServerReactor;
     Q_DECLARE_PRIVATE(QJsonRpcHttpServer)
     Q_DISABLE_COPY(QJsonRpcHttpServer)
     QScopedPointer<QJsonRpcHttpServerPrivate> d_ptr;
 
     Q_PRIVATE_SLOT(d_func(), void _q_socketDisconnected())
+    Q_PRIVATE_SLOT(d_func(), void _q_eventStreamOpened())
+    Q_PRIVATE_SLOT(d_func(), void _q_socketEncrypted())
 
 };
 
@@ -1,20 +1,53 @@
 #ifndef QJSONRPCHTTPSERVER_P_H
 #define QJSONRPCHTTPSERVER_P_H
 
+#include <QAtomicInt>
 #include <QHash>
+#include <QPointer>
+#include <QScopedPointer>
+#include <QTimer>
 #include <QSslSocket>
 #include <QSslConfiguration>
+#include <QThread>
 
 #include "qjsonrpcsocket.h"
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpccompression_p.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpcabstractserver_p.h"
 
 #include "http_parser.h"
 
+class QJsonRpcHttp2Connection;
+class QJsonRpcHttpServerSocket;
+class QJsonRpcHttpServerRpcSocketPrivate : public QJsonRpcSocketPrivate
+{
+public:
+    QJsonRpcHttpServerRpcSocketPrivate(QJsonRpcHttpServerSocket *httpSocket, QJsonRpcSocket *q);
+
+    // the responses of a batch make up one HTTP response
+    virtual void writeBatchResponse(const QJsonArray &responses);
+
+    QPointer<QJsonRpcHttpServerSocket> httpSocket;
+};
+
 class QJsonRpcHttpServerRpcSocket : public QJsonRpcSocket
 {
+    Q_OBJECT
 public:
-    explicit QJsonRpcHttpServerRpcSocket(QIODevice *device, QObject *parent = 0);
+    explicit QJsonRpcHttpServerRpcSocket(QJsonRpcHttpServerSocket *device, QObject *parent = 0);
+
+    // hands responses to the HTTP layer as messages, which picks the status
+    // code from them and serializes them once
+    virtual void notify(const QJsonRpcMessage &message);
+
+private Q_SLOTS:
+    // requests of a batch body are emitted one by one as messageReceived,
+    // their responses collected like on any other socket
+    void processBatch(const QJsonArray &batch);
+
+private:
+    QPointer<QJsonRpcHttpServerSocket> m_httpSocket;
 };
 
 class QAbstractSocket;
@@ -25,16 +58,48 @@ public:
     explicit QJsonRpcHttpServerSocket(QObject *parent = 0);
     ~QJsonRpcHttpServerSocket();
 
+    void sendResponse(const QJsonRpcMessage &message);
+    void sendBatchResponse(const QJsonArray &responses);
     void sendErrorResponse(int statusCode);
     void sendOptionsResponse(int statusCode);
+
+    // connections are kept open between requests for up to msecs of
+    // inactivity, 0 closes them after every response
+    void setKeepAliveTimeout(int msecs);
+
+    // requests with a larger body are answered with 413, 0 for no limit
+    void setMaximumRequestSize(int bytes);
+
+    // accept connections starting with the HTTP/2 preface
+    void setHttp2Enabled(bool enabled);
+
+    // response bodies of at least threshold bytes are compressed with the
+    // coding the request accepts, at zlib's level. -1 doesn't compress
+    void setCompression(int threshold, int level);
+
+    // connections holding more than bytes, requests waiting to be parsed and
+    // responses not written yet, are aborted; -1 for no limit. What they
+    // hold is reported to account
+    void setMemoryLimit(qint64 bytes, const QJsonRpcMemoryAccountPointer &account);
+    qint64 memoryUsage() const;
+
+    static int statusCodeForMessage(const QJsonRpcMessage &message);
+    static bool isSupportedMediaType(const QByteArray &contentType, const QByteArray &accept);
+
+public Q_SLOTS:
+    // writes a server-sent event on a connection that asked for them
+    void sendEvent(const QByteArray &event);
+
 Q_SIGNALS:
     void messageReceived(const QJsonRpcMessage &message);
-
-protected:
-    virtual qint64 writeData(const char *data, qint64 maxSize);
+    void batchReceived(const QJsonArray &batch);
+    void eventStreamOpened();
 
 private Q_SLOTS:
     void readIncomingData();
+    void processPendingInput();
+    void closeIdleConnection();
+    void updateMemoryUsage();
 
 private:
     static int onMessageBegin(http_parser *parser);
@@ -47,36 +112,169 @@ private:
 
 private:
     Q_DISABLE_COPY(QJsonRpcHttpServerSocket)
+    friend class QJsonRpcHttp2Connection;
+    void processHttp2Input(const QByteArray &data);
+    void startEventStream();
+
+    // the request headers the server looks at, others are skipped
+    enum KnownHeader {
+        ContentTypeHeader,
+        ContentLengthHeader,
+        AcceptHeader,
+        OriginHeader,
+        ConnectionHeader,
+        AccessControlRequestMethodHeader,
+        AccessControlRequestHeadersHeader,
+        AcceptEncodingHeader,
+        ContentEncodingHeader,
+        KnownHeaderCount
+    };
+    enum { MaximumHeaderNameLength = 32 };
+    enum { MaximumBodyReservation = 1024 * 1024 };
+    // compressed bodies decode to no more than m_maximumRequestSize, or this
+    // without one, like compressed socket frames
+    enum { MaximumDecodedRequestSize = 64 * 1024 * 1024 };
+    // bodies are refused past this without a maximum request size, well
+    // before a QByteArray holding them would have to grow beyond INT_MAX
+    enum { MaximumUnlimitedRequestSize = 1024 * 1024 * 1024 };
+    int requestSizeLimit() const;
+    static int knownHeader(const char *name, int length);
+    bool hasHeader(KnownHeader header) const;
+    QByteArray header(KnownHeader header) const;    // refers into m_headerData
+
+    QByteArray connectionHeader() const;
+    void writeResponse(int statusCode);     // with m_responseBuffer as body
+    void sendNoContentResponse();
+    void finishResponse(bool keepAlive = true);
+    static bool isBatch(const QByteArray &payload);
+    bool isBodyParsed() const;
 
-    // request
+    // request, the body is assembled in m_requestPayload as it arrives, and
+    // parsed on the way unless it is compressed
     QByteArray m_requestPayload;
+    QJsonRpcIncrementalParser m_bodyParser;
+    QJsonRpcCompression::Encoding m_requestEncoding;
+    int m_maximumRequestSize;     // of the decoded body as well
     http_parser *m_requestParser;
     http_parser_settings m_requestParserSettings;
 
-    // for header processing
-    QHash<QString, QString> m_requestHeaders;
-    QString m_currentHeaderField;
-    QString m_currentHeaderValue;
+    // for header processing: values of known headers are gathered in
+    // m_headerData, which keeps its capacity from one request to the next.
+    // Names are matched once complete, nothing else is stored
+    struct HeaderSpan
+    {
+        int offset;
+        int length;     // -1 if the header wasn't sent
+    };
+    HeaderSpan m_headers[KnownHeaderCount];
+    QByteArray m_headerData;
+    char m_headerName[MaximumHeaderNameLength];
+    int m_headerNameLength;     // longer than the buffer for unknown names
+    int m_currentHeader;        // known header whose value is being read, or -1
+    bool m_readingHeaderValue;
 
-    // response
+    // response, both reused between requests
+    QByteArray m_responseHeader;
     QByteArray m_responseBuffer;
+    int m_compressionThreshold;
+    int m_compressionLevel;
+
+    // Pipelined requests are answered one at a time and in order: the
+    // parser is paused after each request until it was answered, later
+    // input waits in m_pendingInput meanwhile
+    QByteArray m_pendingInput;
+    bool m_parsing;
+    bool m_awaitingResponse;
+    bool m_keepAlive;           // of the request being answered
+    bool m_optionsRequest;
+    bool m_eventStreamRequest;
+    bool m_eventStream;         // the connection only carries events from now on
+    bool m_closing;
+    int m_keepAliveTimeout;
+    QTimer m_idleTimer;
+
+    // set once a connection started with the HTTP/2 preface, until the
+    // first bytes tell m_detectingHttp2 stays set
+    QScopedPointer<QJsonRpcHttp2Connection> m_http2;
+    bool m_detectingHttp2;
+
+    qint64 m_maximumMemoryUsage;
+    qint64 m_accountedMemory;
+    QJsonRpcMemoryAccountPointer m_memoryAccount;
 
 };
 
 class QJsonRpcHttpServer;
+
+// owns the connections handed to one I/O thread and lives in it, requests
+// are parsed and answered there
+class QJsonRpcHttpServerReactor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcHttpServerReactor(QJsonRpcHttpServer *server);
+    ~QJsonRpcHttpServerReactor();
+
+    int connectionCount() const;
+    QAtomicInt connections;     // counted on accept, before addConnection runs
+
+public Q_SLOTS:
+    void addConnection(qlonglong socketDescriptor);
+
+private Q_SLOTS:
+    void _q_socketDisconnected();
+    void _q_eventStreamOpened();
+    void _q_processMessage(const QJsonRpcMessage &message);
+
+private:
+    QJsonRpcHttpServer *server;
+    QHash<QJsonRpcHttpServerSocket*, QJsonRpcHttpServerRpcSocket*> requestSocketLookup;
+
+};
 class QJsonRpcHttpServerPrivate : public QJsonRpcAbstractServerPrivate
 {
 public:
     QJsonRpcHttpServerPrivate(QJsonRpcHttpServer *qq)
-        : q_ptr(qq)
+        : keepAliveTimeout(30000),
+          maximumRequestSize(0),
+          http2Enabled(false),
+          compressionThreshold(-1),
+          compressionLevel(-1),
+          ioThreadCount(0),
+          nextReactor(0),
+          tlsHandshakes(0),
+          q_ptr(qq)
     {
     }
 
+    // applies the server's settings to a new connection and starts TLS
+    void configureSocket(QJsonRpcHttpServerSocket *socket);
+    QJsonRpcHttpServerReactor *selectReactor();
+    void stopReactors();
+
     // slots
     void _q_socketDisconnected();
+    void _q_eventStreamOpened();
+    void _q_socketEncrypted();
 
     QHash<QJsonRpcHttpServerSocket*, QJsonRpcHttpServerRpcSocket*> requestSocketLookup;
+
+    // of all threads, guarded by clientsMutex
+    QList<QJsonRpcHttpServerSocket*> eventStreams;
     QSslConfiguration sslConfiguration;
+    int keepAliveTimeout;
+    int maximumRequestSize;
+    bool http2Enabled;
+    int compressionThreshold;
+    int compressionLevel;
+
+    int ioThreadCount;
+    int nextReactor;
+    QList<QThread*> ioThreads;
+    QList<QJsonRpcHttpServerReactor*> reactors;
+
+    // counted in the server's thread, sockets of I/O threads report queued
+    int tlsHandshakes;
 
     QJsonRpcHttpServer * const q_ptr;
     Q_DECLARE_PUBLIC(QJsonRpcHttpServer)
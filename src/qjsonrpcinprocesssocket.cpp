@@ -0,0 +1,267 @@
+#include <QPointer>
+#include <QHash>
+#include <QMap>
+#include <QTimer>
+#include <QEventLoop>
+#include <QElapsedTimer>
+
+#include "qjsonrpcservicereply.h"
+#include "qjsonrpcservicereply_p.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpcinprocesssocket.h"
+
+class QJsonRpcInProcessSocketPrivate : public QJsonRpcAbstractSocketPrivate
+{
+public:
+    QJsonRpcInProcessSocketPrivate(QJsonRpcInProcessSocket *socket)
+        : deadlineTimer(0),
+          q_ptr(socket)
+    {
+    }
+
+    // slots
+    void _q_receiveMessage(const QJsonRpcMessage &message);
+    void _q_expireDeadlines();
+
+    // queued even when the peer lives on the same thread, so that replies
+    // exist before their response arrives and nothing runs re-entrantly
+    void deliver(const QJsonRpcMessage &message);
+
+    QJsonRpcServiceReply *createReply(const QJsonRpcMessage &request, int msecs);
+    void finishReply(qint64 id, const QJsonRpcMessage &response);
+    void scheduleDeadlines();
+
+    QPointer<QJsonRpcInProcessSocket> peer;
+    QHash<qint64, QPointer<QJsonRpcServiceReply> > replies;
+
+    // request ids by the time they're due, on clock
+    QMultiMap<qint64, qint64> deadlines;
+    QElapsedTimer clock;
+    QTimer *deadlineTimer;
+
+    QJsonRpcInProcessSocket * const q_ptr;
+    Q_DECLARE_PUBLIC(QJsonRpcInProcessSocket)
+};
+
+void QJsonRpcInProcessSocketPrivate::deliver(const QJsonRpcMessage &message)
+{
+    Q_Q(QJsonRpcInProcessSocket);
+    if (!peer) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without peer";
+        return;
+    }
+
+    qJsonRpcDebug() << "sending(" << q << "): " << message;
+    QMetaObject::invokeMethod(peer.data(), "_q_receiveMessage", Qt::QueuedConnection,
+                              Q_ARG(QJsonRpcMessage, message));
+}
+
+void QJsonRpcInProcessSocketPrivate::_q_receiveMessage(const QJsonRpcMessage &message)
+{
+    Q_Q(QJsonRpcInProcessSocket);
+    qJsonRpcDebug() << "received(" << q << "): " << message;
+    Q_EMIT q->messageReceived(message);
+
+    if (message.type() == QJsonRpcMessage::Response ||
+        message.type() == QJsonRpcMessage::Error) {
+        finishReply(message.id(), message);
+    } else if (QJsonRpcMessagePrivate::isPartialResult(message)) {
+        QJsonRpcServiceReplyPrivate::deliverPartialResult(replies, message);
+    } else {
+        q->processRequestMessage(message);
+    }
+}
+
+QJsonRpcServiceReply *QJsonRpcInProcessSocketPrivate::createReply(const QJsonRpcMessage &request,
+                                                                  int msecs)
+{
+    QPointer<QJsonRpcServiceReply> reply(new QJsonRpcServiceReply);
+    reply->d_func()->request = request;
+    replies.insert(request.id(), reply);
+
+    if (msecs > 0) {
+        if (!clock.isValid())
+            clock.start();
+        deadlines.insert(clock.elapsed() + msecs, request.id());
+        scheduleDeadlines();
+    }
+    return reply;
+}
+
+void QJsonRpcInProcessSocketPrivate::finishReply(qint64 id, const QJsonRpcMessage &response)
+{
+    QPointer<QJsonRpcServiceReply> reply = replies.take(id);
+    if (!reply.isNull() && !reply->response().isValid()) {
+        reply->d_func()->response = response;
+        reply->finished();
+    }
+}
+
+void QJsonRpcInProcessSocketPrivate::scheduleDeadlines()
+{
+    Q_Q(QJsonRpcInProcessSocket);
+    if (deadlines.isEmpty()) {
+        if (deadlineTimer)
+            deadlineTimer->stop();
+        return;
+    }
+
+    if (!deadlineTimer) {
+        deadlineTimer = new QTimer(q);
+        deadlineTimer->setSingleShot(true);
+        QObject::connect(deadlineTimer, SIGNAL(timeout()), q, SLOT(_q_expireDeadlines()));
+    }
+
+    const qint64 due = deadlines.constBegin().key() - clock.elapsed();
+    deadlineTimer->start(int(qMax(due, qint64(0))));
+}
+
+void QJsonRpcInProcessSocketPrivate::_q_expireDeadlines()
+{
+    const qint64 now = clock.elapsed();
+    QList<qint64> expired;
+    QMultiMap<qint64, qint64>::iterator it = deadlines.begin();
+    while (it != deadlines.end() && it.key() <= now) {
+        expired.append(it.value());
+        it = deadlines.erase(it);
+    }
+
+    // finishing a request runs user code, which may send new ones
+    foreach (qint64 id, expired) {
+        if (!replies.contains(id))
+            continue;
+
+        QPointer<QJsonRpcServiceReply> reply = replies.value(id);
+        if (!reply.isNull())
+            finishReply(id, reply->request().createErrorResponse(QJsonRpc::TimeoutError,
+                                                                 "request timed out"));
+        else
+            replies.remove(id);
+    }
+
+    scheduleDeadlines();
+}
+
+QJsonRpcInProcessSocket::QJsonRpcInProcessSocket(QObject *parent)
+    : QJsonRpcAbstractSocket(*new QJsonRpcInProcessSocketPrivate(this), parent)
+{
+}
+
+QJsonRpcInProcessSocket::~QJsonRpcInProcessSocket()
+{
+}
+
+bool QJsonRpcInProcessSocket::isValid() const
+{
+    Q_D(const QJsonRpcInProcessSocket);
+    return !d->peer.isNull();
+}
+
+QJsonRpcInProcessSocket *QJsonRpcInProcessSocket::peer() const
+{
+    Q_D(const QJsonRpcInProcessSocket);
+    return d->peer.data();
+}
+
+void QJsonRpcInProcessSocket::setPeer(QJsonRpcInProcessSocket *peer)
+{
+    Q_D(QJsonRpcInProcessSocket);
+    if (d->peer == peer)
+        return;
+
+    if (d->peer && d->peer->d_func()->peer == this)
+        d->peer->d_func()->peer = 0;
+    d->peer = peer;
+    if (peer) {
+        if (peer->d_func()->peer && peer->d_func()->peer != this)
+            peer->d_func()->peer->d_func()->peer = 0;
+        peer->d_func()->peer = this;
+    }
+}
+
+void QJsonRpcInProcessSocket::notify(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcInProcessSocket);
+
+    d->deliver(message);
+}
+
+QJsonRpcMessage QJsonRpcInProcessSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+{
+    Q_D(QJsonRpcInProcessSocket);
+    if (!d->peer) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without peer";
+        return message.createErrorResponse(QJsonRpc::InternalError, "no peer");
+    }
+
+    QScopedPointer<QJsonRpcServiceReply> reply(d->createReply(message, 0));
+    d->deliver(message);
+
+    QEventLoop responseLoop;
+    connect(reply.data(), SIGNAL(finished()), &responseLoop, SLOT(quit()));
+    QTimer::singleShot(msecs, &responseLoop, SLOT(quit()));
+    responseLoop.exec();
+
+    if (!reply->response().isValid()) {
+        d->replies.remove(message.id());
+        return message.createErrorResponse(QJsonRpc::TimeoutError, "request timed out");
+    }
+
+    return reply->response();
+}
+
+QJsonRpcServiceReply *QJsonRpcInProcessSocket::sendMessage(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcInProcessSocket);
+    if (!d->peer) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without peer";
+        return 0;
+    }
+
+    QJsonRpcServiceReply *reply = d->createReply(message, d->defaultRequestTimeout);
+    d->deliver(message);
+    return reply;
+}
+
+QList<QJsonRpcServiceReply *> QJsonRpcInProcessSocket::sendBatch(const QList<QJsonRpcMessage> &messages)
+{
+    Q_D(QJsonRpcInProcessSocket);
+    QList<QJsonRpcServiceReply *> batchReplies;
+    if (!d->peer) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without peer";
+        return batchReplies;
+    }
+
+    // there is no array to parse, the messages are delivered one by one and
+    // answered the same way
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() == QJsonRpcMessage::Request)
+            batchReplies.append(d->createReply(message, d->defaultRequestTimeout));
+        d->deliver(message);
+    }
+
+    return batchReplies;
+}
+
+void QJsonRpcInProcessSocket::processRequestMessage(const QJsonRpcMessage &message)
+{
+    Q_UNUSED(message)
+    // requests and notifications are only handled by the service socket
+}
+
+QJsonRpcInProcessServiceSocket::QJsonRpcInProcessServiceSocket(QObject *parent)
+    : QJsonRpcInProcessSocket(parent)
+{
+}
+
+QJsonRpcInProcessServiceSocket::~QJsonRpcInProcessServiceSocket()
+{
+}
+
+void QJsonRpcInProcessServiceSocket::processRequestMessage(const QJsonRpcMessage &message)
+{
+    processMessage(this, message);
+}
+
+#include "moc_qjsonrpcinprocesssocket.cpp"
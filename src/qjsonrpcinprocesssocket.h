@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCINPROCESSSOCKET_H
+#define QJSONRPCINPROCESSSOCKET_H
+
+#include "qjsonrpcsocket.h"
+#include "qjsonrpcserviceprovider.h"
+
+// Connects two ends within the same process. Messages are handed to the
+// peer as they are, without being encoded or parsed, through a queued call
+// on the peer's thread, so either end may live on any thread. Replies to
+// requests finish once the peer answered or time out after
+// defaultRequestTimeout like those of a QJsonRpcSocket.
+//
+//     QJsonRpcInProcessServiceSocket *services = new QJsonRpcInProcessServiceSocket;
+//     services->addService(new MyService);
+//     QJsonRpcInProcessSocket *client = new QJsonRpcInProcessSocket;
+//     client->setPeer(services);
+class QJsonRpcInProcessSocketPrivate;
+class QJSONRPC_EXPORT QJsonRpcInProcessSocket : public QJsonRpcAbstractSocket
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcInProcessSocket(QObject *parent = 0);
+    ~QJsonRpcInProcessSocket();
+
+    // valid while connected to a peer
+    virtual bool isValid() const;
+
+    // connects both ends to each other, dropping their previous peers
+    QJsonRpcInProcessSocket *peer() const;
+    void setPeer(QJsonRpcInProcessSocket *peer);
+
+public Q_SLOTS:
+    virtual void notify(const QJsonRpcMessage &message);
+    virtual QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
+    virtual QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
+    virtual QList<QJsonRpcServiceReply *> sendBatch(const QList<QJsonRpcMessage> &messages);
+
+protected:
+    virtual void processRequestMessage(const QJsonRpcMessage &message);
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcInProcessSocket)
+    Q_DISABLE_COPY(QJsonRpcInProcessSocket)
+    Q_PRIVATE_SLOT(d_func(), void _q_receiveMessage(const QJsonRpcMessage &message))
+    Q_PRIVATE_SLOT(d_func(), void _q_expireDeadlines())
+};
+
+// an end answering the requests it receives with its services
+class QJSONRPC_EXPORT QJsonRpcInProcessServiceSocket : public QJsonRpcInProcessSocket,
+                                                       public QJsonRpcServiceProvider
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcInProcessServiceSocket(QObject *parent = 0);
+    ~QJsonRpcInProcessServiceSocket();
+
+private:
+    virtual void processRequestMessage(const QJsonRpcMessage &message);
+
+};
+
+#endif
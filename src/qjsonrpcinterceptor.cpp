@@ -0,0 +1,33 @@
+#include <QDateTime>
+
+#include "qjsonrpcinterceptor.h"
+
+QJsonRpcCallContext::QJsonRpcCallContext(const QJsonRpcMessage &request,
+                                         QJsonRpcAbstractSocket *socket)
+    : m_request(request),
+      m_socket(socket),
+      m_startTime(QDateTime::currentMSecsSinceEpoch())
+{
+    m_timer.start();
+}
+
+QJsonRpcCallContext::~QJsonRpcCallContext()
+{
+}
+
+QJsonRpcInterceptor::~QJsonRpcInterceptor()
+{
+}
+
+QJsonRpcMessage QJsonRpcInterceptor::beforeDispatch(QJsonRpcCallContext &context)
+{
+    Q_UNUSED(context)
+    return QJsonRpcMessage();
+}
+
+void QJsonRpcInterceptor::afterDispatch(const QJsonRpcCallContext &context,
+                                        const QJsonRpcMessage &response)
+{
+    Q_UNUSED(context)
+    Q_UNUSED(response)
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCINTERCEPTOR_H
+#define QJSONRPCINTERCEPTOR_H
+
+#include <QElapsedTimer>
+#include <QVariant>
+
+#include "qjsonrpcmessage.h"
+
+// A request or notification on its way through a service provider's
+// interceptors, from before it is routed until it is answered. Interceptors
+// keep what they need between both through attributes, such as the span
+// of a trace.
+class QJsonRpcAbstractSocket;
+class QJSONRPC_EXPORT QJsonRpcCallContext
+{
+public:
+    QJsonRpcMessage request() const { return m_request; }
+    QJsonRpcAbstractSocket *socket() const { return m_socket; }
+
+    // when the call started, in msecs since the epoch, and how long ago in nsecs
+    qint64 startTime() const { return m_startTime; }
+    qint64 elapsed() const { return m_timer.nsecsElapsed(); }
+
+    QVariant attribute(const QString &name) const { return m_attributes.value(name); }
+    void setAttribute(const QString &name, const QVariant &value) { m_attributes.insert(name, value); }
+
+protected:
+    QJsonRpcCallContext(const QJsonRpcMessage &request, QJsonRpcAbstractSocket *socket);
+    ~QJsonRpcCallContext();
+
+private:
+    Q_DISABLE_COPY(QJsonRpcCallContext)
+    QJsonRpcMessage m_request;
+    QJsonRpcAbstractSocket *m_socket;
+    qint64 m_startTime;
+    QElapsedTimer m_timer;
+    QVariantHash m_attributes;
+};
+
+// Runs around the dispatch of every request and notification of a service
+// provider it was added to, see QJsonRpcServiceProvider::addInterceptor().
+// Calls are answered from the thread of their socket, their service or of
+// the service's thread pool, so an interceptor has to be thread safe.
+class QJSONRPC_EXPORT QJsonRpcInterceptor
+{
+public:
+    virtual ~QJsonRpcInterceptor();
+
+    // Before the call is routed. A valid message returned short-circuits
+    // it: a request is answered with that message, a notification dropped,
+    // and neither reaches its service nor the interceptors after this one.
+    // An invalid message, the default, lets the call through.
+    virtual QJsonRpcMessage beforeDispatch(QJsonRpcCallContext &context);
+
+    // Once the response is about to be sent, or the notification was
+    // dispatched, with an invalid response then. Every interceptor whose
+    // beforeDispatch() ran is called, in the reverse order. Requests that
+    // are never answered, such as cancelled delayed ones, don't get here.
+    virtual void afterDispatch(const QJsonRpcCallContext &context, const QJsonRpcMessage &response);
+};
+
+#endif
@@ -2,13 +2,16 @@
 #include <QLocalSocket>
 
 #include "qjsonrpcsocket.h"
+#include "qjsonrpcsharedmemorydevice.h"
 #include "qjsonrpcabstractserver_p.h"
 #include "qjsonrpclocalserver.h"
 
 class QJsonRpcLocalServerPrivate : public QJsonRpcAbstractServerPrivate
 {
 public:
-    QHash<QLocalSocket*, QJsonRpcSocket*> socketLookup;
+    QJsonRpcLocalServerPrivate() : sharedMemoryRingSize(0) {}
+
+    int sharedMemoryRingSize;
 
 };
 
@@ -25,14 +28,14 @@ QJsonRpcLocalServer::QJsonRpcLocalServer(QObject *parent)
 QJsonRpcLocalServer::~QJsonRpcLocalServer()
 {
     Q_D(QJsonRpcLocalServer);
-    foreach (QLocalSocket *socket, d->socketLookup.keys()) {
-        socket->flush();
-        socket->deleteLater();
-    }
-    d->socketLookup.clear();
 
-    foreach (QJsonRpcSocket *client, d->clients)
+    // the local sockets are their children
+    for (int i = 0; i < d->clients.size(); ++i) {
+        QJsonRpcSocket *client = d->clients.at(i);
+        if (QLocalSocket *localSocket = client->findChild<QLocalSocket*>())
+            localSocket->flush();
         client->deleteLater();
+    }
     d->clients.clear();
 }
 
@@ -42,6 +45,156 @@ int QJsonRpcLocalServer::connectedClientCount() const
     return d->clients.size();
 }
 
+QJsonRpc::FramingMode QJsonRpcLocalServer::framingMode() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->framingMode;
+}
+
+void QJsonRpcLocalServer::setFramingMode(QJsonRpc::FramingMode mode)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->framingMode = mode;
+}
+
+int QJsonRpcLocalServer::writeCoalescingDelay() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->writeCoalescingDelay;
+}
+
+void QJsonRpcLocalServer::setWriteCoalescingDelay(int msecs)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->writeCoalescingDelay = msecs < 0 ? -1 : msecs;
+}
+
+QJsonRpcCodec *QJsonRpcLocalServer::codec() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->codec;
+}
+
+void QJsonRpcLocalServer::setCodec(QJsonRpcCodec *codec)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->codec = codec;
+}
+
+int QJsonRpcLocalServer::compressionThreshold() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->compressionThreshold;
+}
+
+void QJsonRpcLocalServer::setCompressionThreshold(int bytes)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->compressionThreshold = bytes < 0 ? -1 : bytes;
+}
+
+bool QJsonRpcLocalServer::attachmentsEnabled() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->attachmentsEnabled;
+}
+
+void QJsonRpcLocalServer::setAttachmentsEnabled(bool enabled)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->attachmentsEnabled = enabled;
+}
+
+qint64 QJsonRpcLocalServer::writeBufferHighWaterMark() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->highWaterMark;
+}
+
+qint64 QJsonRpcLocalServer::writeBufferLowWaterMark() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->lowWaterMark;
+}
+
+void QJsonRpcLocalServer::setWriteBufferWaterMarks(qint64 high, qint64 low)
+{
+    Q_D(QJsonRpcLocalServer);
+    if (high >= 0 && (low < 0 || low > high)) {
+        qJsonRpcDebug() << "Cannot set a low water mark outside of 0 and the high water mark";
+        return;
+    }
+
+    d->highWaterMark = high < 0 ? -1 : high;
+    d->lowWaterMark = high < 0 ? -1 : low;
+}
+
+int QJsonRpcLocalServer::maximumIncomingRequests() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->maximumIncomingRequests;
+}
+
+void QJsonRpcLocalServer::setMaximumIncomingRequests(int count)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->maximumIncomingRequests = count <= 0 ? -1 : count;
+}
+
+int QJsonRpcLocalServer::maximumFrameSize() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->maximumFrameSize;
+}
+
+void QJsonRpcLocalServer::setMaximumFrameSize(int bytes)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->maximumFrameSize = bytes <= 0 ? -1 : bytes;
+}
+
+qint64 QJsonRpcLocalServer::maximumConnectionMemory() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->maximumConnectionMemory;
+}
+
+void QJsonRpcLocalServer::setMaximumConnectionMemory(qint64 bytes)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->maximumConnectionMemory = bytes <= 0 ? -1 : bytes;
+}
+
+QJsonRpcMemoryStats QJsonRpcLocalServer::memoryStats() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->memoryAccount->stats();
+}
+
+int QJsonRpcLocalServer::idleTimeout() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->idleTimeout;
+}
+
+void QJsonRpcLocalServer::setIdleTimeout(int msecs)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->idleTimeout = qMax(0, msecs);
+}
+
+int QJsonRpcLocalServer::sharedMemoryRingSize() const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->sharedMemoryRingSize;
+}
+
+void QJsonRpcLocalServer::setSharedMemoryRingSize(int bytes)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->sharedMemoryRingSize = qMax(0, bytes);
+}
+
 bool QJsonRpcLocalServer::addService(QJsonRpcService *service)
 {
     if (!QJsonRpcServiceProvider::addService(service))
@@ -51,6 +204,8 @@ bool QJsonRpcLocalServer::addService(QJsonRpcService *service)
                this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
     connect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
                this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    connect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+               this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
     return true;
 }
 
@@ -63,6 +218,8 @@ bool QJsonRpcLocalServer::removeService(QJsonRpcService *service)
                   this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
     disconnect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
                   this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    disconnect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+                  this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
     return true;
 }
 
@@ -77,12 +234,23 @@ void QJsonRpcLocalServer::incomingConnection(quintptr socketDescriptor)
     }
 
     QIODevice *device = qobject_cast<QIODevice*>(localSocket);
+    if (d->sharedMemoryRingSize > 0)
+        device = new QJsonRpcSharedMemoryDevice(localSocket, QJsonRpcSharedMemoryDevice::ServerRole,
+                                                d->sharedMemoryRingSize, localSocket);
     QJsonRpcSocket *socket = new QJsonRpcSocket(device, this);
+    localSocket->setParent(socket);
+    d->configureSocket(socket);
     connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
               this, SLOT(_q_processMessage(QJsonRpcMessage)));
-    d->clients.append(socket);
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        d->clients.insert(socket);
+    }
     connect(localSocket, SIGNAL(disconnected()), this, SLOT(_q_clientDisconnected()));
-    d->socketLookup.insert(localSocket, socket);
+
+    if (!d->idleWheel)
+        d->idleWheel = new QJsonRpcIdleWheel(d, this);
+    d->idleWheel->add(socket);
     Q_EMIT clientConnected();
 }
 
@@ -95,24 +263,36 @@ void QJsonRpcLocalServer::_q_clientDisconnected()
         return;
     }
 
-    if (d->socketLookup.contains(localSocket)) {
-        QJsonRpcSocket *socket = d->socketLookup.take(localSocket);
-        d->clients.removeAll(socket);
-        socket->deleteLater();
+    // the local socket goes along with its QJsonRpcSocket
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcSocket*>(localSocket->parent());
+    bool removed = false;
+    if (socket) {
+        QMutexLocker locker(&d->clientsMutex);
+        removed = d->clients.contains(socket);
+        if (removed)
+            d->removeClient(socket);
+    }
+
+    if (!removed) {
+        localSocket->deleteLater();
+        return;
     }
 
-    localSocket->deleteLater();
+    socket->deleteLater();
     Q_EMIT clientDisconnected();
 }
 
 void QJsonRpcLocalServer::_q_processMessage(const QJsonRpcMessage &message)
 {
+    Q_D(QJsonRpcLocalServer);
     QJsonRpcSocket *socket = static_cast<QJsonRpcSocket*>(sender());
     if (!socket) {
         qJsonRpcDebug() << Q_FUNC_INFO << "called without service socket";
         return;
     }
 
+    if (d->processSubscription(socket, message))
+        return;
     processMessage(socket, message);
 }
 
@@ -128,4 +308,28 @@ void QJsonRpcLocalServer::notifyConnectedClients(const QString &method, const QJ
     d->_q_notifyConnectedClients(method, params);
 }
 
+void QJsonRpcLocalServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcLocalServer);
+    d->_q_notifySubscribers(topic, message);
+}
+
+bool QJsonRpcLocalServer::subscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcLocalServer);
+    return d->subscribe(client, topic);
+}
+
+bool QJsonRpcLocalServer::unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcLocalServer);
+    return d->unsubscribe(client, topic);
+}
+
+int QJsonRpcLocalServer::subscriberCount(const QString &topic) const
+{
+    Q_D(const QJsonRpcLocalServer);
+    return d->subscriberCount(topic);
+}
+
 #include "moc_qjsonrpclocalserver.cpp"
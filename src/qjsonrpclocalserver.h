@@ -29,6 +29,50 @@ public:
     ~QJsonRpcLocalServer();
 
     virtual int connectedClientCount() const;
+    virtual bool subscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual bool unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual int subscriberCount(const QString &topic) const;
+
+    // applies to connections accepted after the call
+    QJsonRpc::FramingMode framingMode() const;
+    void setFramingMode(QJsonRpc::FramingMode mode);
+    int writeCoalescingDelay() const;
+    void setWriteCoalescingDelay(int msecs);
+    QJsonRpcCodec *codec() const;
+    void setCodec(QJsonRpcCodec *codec);
+    int compressionThreshold() const;
+    void setCompressionThreshold(int bytes);
+    bool attachmentsEnabled() const;
+    void setAttachmentsEnabled(bool enabled);
+
+    // flow control of each connection, see QJsonRpcSocket
+    qint64 writeBufferHighWaterMark() const;
+    qint64 writeBufferLowWaterMark() const;
+    void setWriteBufferWaterMarks(qint64 high, qint64 low);
+    int maximumIncomingRequests() const;
+    void setMaximumIncomingRequests(int count);
+
+    // memory limits of each connection, see QJsonRpcSocket, and what all
+    // of them hold
+    int maximumFrameSize() const;
+    void setMaximumFrameSize(int bytes);
+    qint64 maximumConnectionMemory() const;
+    void setMaximumConnectionMemory(qint64 bytes);
+    QJsonRpcMemoryStats memoryStats() const;
+
+    // connections that neither received nor sent anything for that long
+    // are closed, unless they still have requests in flight; idle ones
+    // release their buffers either way. 0, the default, keeps them open.
+    // Applies to connections accepted after the call.
+    int idleTimeout() const;
+    void setIdleTimeout(int msecs);
+
+    // Above 0, the bytes of each direction of a ring in shared memory that
+    // connections carry their messages through, see
+    // QJsonRpcSharedMemoryDevice, which the clients have to use as well.
+    // 0, the default, uses the local socket alone.
+    int sharedMemoryRingSize() const;
+    void setSharedMemoryRingSize(int bytes);
 
     // reimp
     bool addService(QJsonRpcService *service);
@@ -41,6 +85,7 @@ Q_SIGNALS:
 public Q_SLOTS:
     void notifyConnectedClients(const QJsonRpcMessage &message);
     void notifyConnectedClients(const QString &method, const QJsonArray &params);
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
 
 protected:
     virtual void incomingConnection(quintptr socketDescriptor);
@@ -16,76 +16,1690 @@
  */
 
 #include <QDebug>
+#include <QLocale>
+#include <QVarLengthArray>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <qnumeric.h>
+
+#include <cmath>
+#include <cstring>
+#include <climits>
 
 #if QT_VERSION >= 0x050000
 #   include <QJsonDocument>
 #else
-#   include "json/qjsondocument.h"
+#   include "json/qjsondocument.h"
+#endif
+
+#include "qjsonrpcpool_p.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcmessage.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(Q_CC_MSVC)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// request ids come from one counter shared by all threads, 64 bits wide so
+// that it doesn't wrap around in long running processes
+#if QT_VERSION >= 0x050300 && defined(Q_ATOMIC_INT64_IS_SUPPORTED)
+static QBasicAtomicInteger<qint64> requestIdCounter = Q_BASIC_ATOMIC_INITIALIZER(0);
+#else
+Q_GLOBAL_STATIC(QMutex, requestIdMutex)
+static qint64 requestIdCounter = 0;
+#endif
+
+QJsonRpcKeys::QJsonRpcKeys()
+    : jsonrpc(QLatin1String("jsonrpc")),
+      id(QLatin1String("id")),
+      method(QLatin1String("method")),
+      params(QLatin1String("params")),
+      priority(QLatin1String("priority")),
+      timeout(QLatin1String("timeout")),
+      result(QLatin1String("result")),
+      error(QLatin1String("error")),
+      code(QLatin1String("code")),
+      message(QLatin1String("message")),
+      data(QLatin1String("data")),
+      value(QLatin1String("value"))
+{
+}
+
+Q_GLOBAL_STATIC(QJsonRpcKeys, jsonRpcKeys)
+
+// guard the decoding of deferred values, shared by many messages
+struct QJsonRpcPendingLocks
+{
+    enum { Count = 16 };
+    QMutex mutexes[Count];
+};
+Q_GLOBAL_STATIC(QJsonRpcPendingLocks, pendingLocks)
+
+static inline QMutex *pendingLock(const QJsonRpcMessagePrivate *message)
+{
+    return &pendingLocks()->mutexes[(quintptr(message) >> 4) % QJsonRpcPendingLocks::Count];
+}
+
+const QJsonRpcKeys &QJsonRpcMessagePrivate::keys()
+{
+    return *jsonRpcKeys();
+}
+
+qint64 QJsonRpcMessagePrivate::nextRequestId()
+{
+#if QT_VERSION >= 0x050300 && defined(Q_ATOMIC_INT64_IS_SUPPORTED)
+    return requestIdCounter.fetchAndAddRelaxed(1) + 1;
+#else
+    QMutexLocker locker(requestIdMutex());
+    return ++requestIdCounter;
+#endif
+}
+
+QJsonRpcMessagePrivate::QJsonRpcMessagePrivate()
+    : type(QJsonRpcMessage::Invalid),
+      idValue(QJsonValue::Undefined),
+      id(0),
+      params(QJsonValue::Undefined),
+      result(QJsonValue::Undefined),
+      errorCode(0),
+      errorData(QJsonValue::Undefined),
+      priority(-1),
+      timeout(-1),
+      deadline(0),
+      batch(0),
+      stream(0),
+      pending(0),
+      paramsOffset(0),
+      paramsLength(0),
+      resultOffset(0),
+      resultLength(0),
+      idOffset(0),
+      idLength(0),
+      hasObject(false)
+{
+}
+
+QJsonRpcMessagePrivate::QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other)
+    : QSharedData(other),
+      type(other.type),
+      idValue(other.idValue),
+      id(other.id),
+      method(other.method),
+      errorCode(other.errorCode),
+      errorMessage(other.errorMessage),
+      errorData(other.errorData),
+      priority(other.priority),
+      timeout(other.timeout),
+      deadline(other.deadline),
+      batch(other.batch),
+      stream(other.stream),
+      pending(0),
+      paramsOffset(other.paramsOffset),
+      paramsLength(other.paramsLength),
+      resultOffset(other.resultOffset),
+      resultLength(other.resultLength),
+      idOffset(other.idOffset),
+      idLength(other.idLength),
+      object(other.object),
+      hasObject(other.hasObject),
+      json(other.json),
+      resultJson(other.resultJson),
+      attachments(other.attachments)
+{
+    // other may be decoding its values on another thread meanwhile
+    QMutexLocker locker(other.isPending(ParamsPending | ResultPending) ? pendingLock(&other) : 0);
+    params = other.params;
+    result = other.result;
+    pending.fetchAndStoreOrdered(const_cast<QAtomicInt &>(other.pending).fetchAndAddOrdered(0));
+}
+
+void QJsonRpcMessagePrivate::setPending(int value, int offset, int length)
+{
+    if (value == ParamsPending) {
+        paramsOffset = offset;
+        paramsLength = length;
+    } else {
+        resultOffset = offset;
+        resultLength = length;
+    }
+
+    const int flags = pending.fetchAndAddOrdered(0);
+    pending.fetchAndStoreOrdered(length > 0 ? (flags | value) : (flags & ~value));
+}
+
+// shared messages may be asked for their values on several threads, the
+// first one decodes them
+void QJsonRpcMessagePrivate::decodePending(int value) const
+{
+    QMutexLocker locker(pendingLock(this));
+    if (!isPending(value))
+        return;
+
+    QJsonRpcMessagePrivate *that = const_cast<QJsonRpcMessagePrivate *>(this);
+    const bool isParams = (value == ParamsPending);
+    const QByteArray text =
+        QByteArray::fromRawData(json.constData() + (isParams ? paramsOffset : resultOffset),
+                                isParams ? paramsLength : resultLength);
+    const QJsonDocument document = QJsonDocument::fromJson(text);
+    QJsonValue &decoded = isParams ? that->params : that->result;
+    if (document.isArray())
+        decoded = document.array();
+    else
+        decoded = document.object();
+
+    // only cleared here, under the lock
+    pending.fetchAndAddOrdered(-value);
+}
+
+void *QJsonRpcMessagePrivate::operator new(size_t size)
+{
+    return QJsonRpcPool<QJsonRpcMessagePrivate>::allocate(size);
+}
+
+void QJsonRpcMessagePrivate::operator delete(void *p, size_t size)
+{
+    QJsonRpcPool<QJsonRpcMessagePrivate>::release(p, size);
+}
+
+int QJsonRpcMessagePrivate::toInt(const QJsonValue &value)
+{
+    if (value.isString())
+        return value.toString().toInt();
+#if QT_VERSION >= 0x050200
+    return value.toInt();
+#else
+    return value.toDouble();
+#endif
+}
+
+qint64 QJsonRpcMessagePrivate::toId(const QJsonValue &value)
+{
+    if (value.isString())
+        return value.toString().toLongLong();
+
+    // like QJsonValue::toInt, ids that aren't integral are read as 0
+    const double number = value.toDouble();
+    if (number != std::floor(number) || qAbs(number) > 9007199254740992.0)
+        return 0;
+    return qint64(number);
+}
+
+int QJsonRpcMessagePrivate::priorityFromValue(const QJsonValue &value)
+{
+    const QString name = value.toString();
+    if (name == QLatin1String("high"))
+        return QJsonRpc::HighPriority;
+    if (name == QLatin1String("normal"))
+        return QJsonRpc::NormalPriority;
+    if (name == QLatin1String("low"))
+        return QJsonRpc::LowPriority;
+    return -1;
+}
+
+qint64 QJsonRpcMessagePrivate::monotonicMsecs()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock.msecsSinceReference();
+}
+
+void QJsonRpcMessagePrivate::setTimeout(int msecs)
+{
+    timeout = qMax(msecs, 0);
+    deadline = monotonicMsecs() + timeout;
+}
+
+void QJsonRpcMessagePrivate::setTimeout(const QJsonValue &value)
+{
+    if (value.isDouble())
+        setTimeout(int(qBound(0.0, value.toDouble(), double(INT_MAX))));
+}
+
+qint64 QJsonRpcMessagePrivate::remainingTime(const QJsonRpcMessage &message)
+{
+    if (message.d->timeout < 0)
+        return -1;
+    return qMax(message.d->deadline - monotonicMsecs(), Q_INT64_C(0));
+}
+
+void QJsonRpcMessagePrivate::initializeWithObject(const QJsonObject &message)
+{
+    const QJsonRpcKeys &key = keys();
+    object = message;
+    hasObject = true;
+
+    QJsonObject::const_iterator it = message.constFind(key.id);
+    const bool hasId = (it != message.constEnd());
+    if (hasId) {
+        idValue = it.value();
+        id = toId(idValue);
+    }
+
+    it = message.constFind(key.method);
+    const bool hasMethod = (it != message.constEnd());
+    if (hasMethod)
+        method = it.value().toString();
+
+    it = message.constFind(key.params);
+    if (it != message.constEnd())
+        params = it.value();
+
+    it = message.constFind(key.priority);
+    if (it != message.constEnd())
+        priority = priorityFromValue(it.value());
+
+    it = message.constFind(key.timeout);
+    if (it != message.constEnd())
+        setTimeout(it.value());
+
+    it = message.constFind(key.result);
+    const bool hasResult = (it != message.constEnd());
+    if (hasResult)
+        result = it.value();
+
+    it = message.constFind(key.error);
+    const bool hasError = (it != message.constEnd());
+    const bool isError = hasError && !it.value().isNull();
+    if (isError) {
+        const QJsonObject error = it.value().toObject();
+        errorCode = toInt(error.value(key.code));
+        errorMessage = error.value(key.message).toString();
+        errorData = error.value(key.data);
+    }
+
+    type = messageType(hasId, hasMethod, hasResult, hasError, isError);
+}
+
+QJsonRpcMessage::Type QJsonRpcMessagePrivate::messageType(bool hasId, bool hasMethod, bool hasResult,
+                                                          bool hasError, bool isError)
+{
+    if (hasId) {
+        if (hasResult || hasError)
+            return isError ? QJsonRpcMessage::Error : QJsonRpcMessage::Response;
+        if (hasMethod)
+            return QJsonRpcMessage::Request;
+    } else if (hasMethod) {
+        return QJsonRpcMessage::Notification;
+    }
+
+    return QJsonRpcMessage::Invalid;
+}
+
+QJsonObject QJsonRpcMessagePrivate::buildObject() const
+{
+    QJsonObject message;
+    if (type == QJsonRpcMessage::Invalid)
+        return message;
+
+    const QJsonRpcKeys &key = keys();
+
+    message.insert(key.jsonrpc, QLatin1String("2.0"));
+    if (!idValue.isUndefined())
+        message.insert(key.id, idValue);
+
+    switch (type) {
+    case QJsonRpcMessage::Request:
+    case QJsonRpcMessage::Notification:
+        message.insert(key.method, method);
+        if (!params.isUndefined())
+            message.insert(key.params, params);
+        if (type == QJsonRpcMessage::Request && timeout >= 0)
+            message.insert(key.timeout, timeout);
+        break;
+    case QJsonRpcMessage::Response:
+        message.insert(key.result, result);
+        break;
+    case QJsonRpcMessage::Error: {
+        QJsonObject error;
+        error.insert(key.code, errorCode);
+        if (!errorMessage.isEmpty())
+            error.insert(key.message, errorMessage);
+        if (!errorData.isUndefined())
+            error.insert(key.data, errorData);
+        message.insert(key.error, error);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return message;
+}
+
+QJsonRpcMessagePrivate::~QJsonRpcMessagePrivate()
+{
+}
+
+void QJsonRpcMessagePrivate::writeJson(const QJsonRpcMessage &message, QByteArray &data,
+                                       bool stringIds)
+{
+    const QJsonRpcMessagePrivate *d = message.d.constData();
+    if (d->hasObject) {
+        writeObject(d->object, data);
+        return;
+    }
+    if (!d->json.isEmpty()) {
+        data.append(d->json);
+        return;
+    }
+
+    switch (d->type) {
+    case QJsonRpcMessage::Request:
+        data.append("{\"jsonrpc\":\"2.0\",\"id\":");
+        if (stringIds && d->idValue.isDouble()) {
+            data.append('"');
+            writeNumber(d->idValue.toDouble(), data);
+            data.append('"');
+        } else {
+            writeValue(d->idValue, data);
+        }
+        data.append(",\"method\":");
+        writeString(d->method, data);
+        if (!d->params.isUndefined()) {
+            data.append(",\"params\":");
+            writeValue(d->params, data);
+        }
+        if (d->timeout >= 0) {
+            data.append(",\"timeout\":");
+            writeNumber(d->timeout, data);
+        }
+        data.append('}');
+        break;
+    case QJsonRpcMessage::Notification:
+        data.append("{\"jsonrpc\":\"2.0\",\"method\":");
+        writeString(d->method, data);
+        if (!d->params.isUndefined()) {
+            data.append(",\"params\":");
+            writeValue(d->params, data);
+        }
+        data.append('}');
+        break;
+    case QJsonRpcMessage::Response:
+        data.append("{\"jsonrpc\":\"2.0\",\"id\":");
+        writeValue(d->idValue, data);
+        if (!d->resultJson.isEmpty()) {
+            data.append(",\"result\":");
+            data.append(d->resultJson);
+        } else if (!d->result.isUndefined()) {
+            data.append(",\"result\":");
+            writeValue(d->result, data);
+        }
+        data.append('}');
+        break;
+    case QJsonRpcMessage::Error:
+        data.append("{\"jsonrpc\":\"2.0\",\"id\":");
+        writeValue(d->idValue, data);
+        data.append(",\"error\":{\"code\":");
+        writeNumber(d->errorCode, data);
+        if (!d->errorMessage.isEmpty()) {
+            data.append(",\"message\":");
+            writeString(d->errorMessage, data);
+        }
+        if (!d->errorData.isUndefined()) {
+            data.append(",\"data\":");
+            writeValue(d->errorData, data);
+        }
+        data.append("}}");
+        break;
+    default:
+        data.append("{}");
+        break;
+    }
+}
+
+void QJsonRpcMessagePrivate::writeValue(const QJsonValue &value, QByteArray &data)
+{
+    switch (value.type()) {
+    case QJsonValue::Bool:
+        data.append(value.toBool() ? "true" : "false");
+        break;
+    case QJsonValue::Double:
+        writeNumber(value.toDouble(), data);
+        break;
+    case QJsonValue::String:
+        writeString(value.toString(), data);
+        break;
+    case QJsonValue::Array:
+        writeArray(value.toArray(), data);
+        break;
+    case QJsonValue::Object:
+        writeObject(value.toObject(), data);
+        break;
+    default:
+        data.append("null");
+        break;
+    }
+}
+
+void QJsonRpcMessagePrivate::writeObject(const QJsonObject &object, QByteArray &data)
+{
+    data.append('{');
+    QJsonObject::const_iterator it;
+    for (it = object.constBegin(); it != object.constEnd(); ++it) {
+        if (it != object.constBegin())
+            data.append(',');
+        writeString(it.key(), data);
+        data.append(':');
+        writeValue(it.value(), data);
+    }
+    data.append('}');
+}
+
+void QJsonRpcMessagePrivate::writeArray(const QJsonArray &array, QByteArray &data)
+{
+    data.append('[');
+    for (int i = 0; i < array.size(); ++i) {
+        if (i)
+            data.append(',');
+        writeValue(array.at(i), data);
+    }
+    data.append(']');
+}
+
+void QJsonRpcMessagePrivate::writeString(const QString &string, QByteArray &data)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    data.append('"');
+    const ushort *c = string.utf16();
+    const ushort *end = c + string.size();
+    for (; c != end; ++c) {
+        uint u = *c;
+        if (u < 0x80) {
+            switch (u) {
+            case '"': data.append("\\\""); break;
+            case '\\': data.append("\\\\"); break;
+            case '\b': data.append("\\b"); break;
+            case '\f': data.append("\\f"); break;
+            case '\n': data.append("\\n"); break;
+            case '\r': data.append("\\r"); break;
+            case '\t': data.append("\\t"); break;
+            default:
+                if (u < 0x20) {
+                    data.append("\\u00");
+                    data.append(hexDigits[u >> 4]);
+                    data.append(hexDigits[u & 0xf]);
+                } else {
+                    data.append(char(u));
+                }
+            }
+            continue;
+        }
+
+        // UTF-8
+        if (u < 0x800) {
+            data.append(char(0xc0 | (u >> 6)));
+        } else {
+            if ((u & 0xfc00) == 0xd800 && c + 1 != end && (c[1] & 0xfc00) == 0xdc00) {
+                u = 0x10000 + ((u - 0xd800) << 10) + (*++c - 0xdc00);
+                data.append(char(0xf0 | (u >> 18)));
+                data.append(char(0x80 | ((u >> 12) & 0x3f)));
+            } else {
+                data.append(char(0xe0 | (u >> 12)));
+            }
+            data.append(char(0x80 | ((u >> 6) & 0x3f)));
+        }
+        data.append(char(0x80 | (u & 0x3f)));
+    }
+    data.append('"');
+}
+
+void QJsonRpcMessagePrivate::writeNumber(double number, QByteArray &data)
+{
+    if (qIsNaN(number) || qIsInf(number)) {
+        data.append("null");
+        return;
+    }
+
+    // integral values are written without exponent or fraction, and without
+    // a temporary QByteArray
+    if (number == std::floor(number) && qAbs(number) < 9007199254740992.0) {
+        char buffer[24];
+        char *end = buffer + sizeof(buffer);
+        char *p = end;
+        qulonglong value = qulonglong(qAbs(number));
+        do {
+            *--p = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        if (number < 0)
+            *--p = '-';
+        data.append(p, int(end - p));
+        return;
+    }
+
+#if QT_VERSION >= 0x050700
+    data.append(QByteArray::number(number, 'g', QLocale::FloatingPointShortest));
+#else
+    data.append(QByteArray::number(number, 'g', 17));
+#endif
+}
+
+// Reads a message object in a single pass. Envelope members are decoded
+// straight into the message fields; only structured params, results and
+// error data are built through QJsonDocument, from the span they occupy.
+class QJsonRpcMessageParser
+{
+public:
+    QJsonRpcMessageParser(const char *json, int length)
+        : error(QJsonParseError::NoError),
+          begin(json),
+          head(json),
+          end(json + length),
+          nestingLevel(0)
+    {
+        startMessage();
+    }
+
+    bool parseMessage(QJsonRpcMessagePrivate *message);
+    int offset() const { return int(head - begin); }
+
+    QJsonParseError::ParseError error;
+
+    // the steps of parseMessage, for QJsonRpcIncrementalParser which finds
+    // where each member ends. The text may have moved in between, ending at
+    // valueEnd spares looking for the end of a structured value again
+    void startMessage();
+    void setText(const char *json, int position, int length);
+    bool parseMember(QJsonRpcMessagePrivate *message, const char *valueEnd = 0);
+    void finishMessage(QJsonRpcMessagePrivate *message) const;
+    bool eatSpace();
+
+    // decodes the value the tokens of a JSON Pointer lead to from the one
+    // at head, skipping over everything else
+    bool findValue(const QList<QByteArray> &tokens, QJsonValue *value);
+
+private:
+    enum Member {
+        OtherMember,
+        IdMember,
+        MethodMember,
+        ParamsMember,
+        ResultMember,
+        ErrorMember,
+        CodeMember,
+        MessageMember,
+        DataMember,
+        PriorityMember,
+        TimeoutMember
+    };
+
+    bool parseMemberName(Member *member);
+    bool parseErrorObject(QJsonRpcMessagePrivate *message);
+    bool parseValue(QJsonValue *value, const char *valueEnd = 0);
+    bool parseDeferredValue(QJsonRpcMessagePrivate *message, int pending, QJsonValue *value);
+    bool parseString(QString *string);
+    bool parseNumber(double *number);
+    bool parseLiteral(const char *literal, int length);
+    bool skipValue();
+    bool skipContainer(char close);
+    bool fail(QJsonParseError::ParseError parseError) { error = parseError; return false; }
+    static Member member(const char *name, int length);
+
+    enum { MaximumNestingLevel = 1024 };
+
+    const char *begin;
+    const char *head;
+    const char *end;
+    int nestingLevel;
+
+    // members seen so far, which decide the type of the message
+    bool hasId;
+    bool hasMethod;
+    bool hasResult;
+    bool hasError;
+    bool isError;
+};
+
+void QJsonRpcMessageParser::startMessage()
+{
+    hasId = false;
+    hasMethod = false;
+    hasResult = false;
+    hasError = false;
+    isError = false;
+}
+
+void QJsonRpcMessageParser::setText(const char *json, int position, int length)
+{
+    begin = json;
+    head = json + position;
+    end = json + length;
+}
+
+void QJsonRpcMessageParser::finishMessage(QJsonRpcMessagePrivate *message) const
+{
+    message->type = QJsonRpcMessagePrivate::messageType(hasId, hasMethod, hasResult,
+                                                        hasError, isError);
+}
+
+inline bool QJsonRpcMessageParser::eatSpace()
+{
+    while (head < end && (*head == ' ' || *head == '\t' || *head == '\n' || *head == '\r'))
+        ++head;
+    return head < end;
+}
+
+QJsonRpcMessageParser::Member QJsonRpcMessageParser::member(const char *name, int length)
+{
+    switch (length) {
+    case 2:
+        if (!memcmp(name, "id", 2)) return IdMember;
+        break;
+    case 4:
+        if (!memcmp(name, "code", 4)) return CodeMember;
+        if (!memcmp(name, "data", 4)) return DataMember;
+        break;
+    case 5:
+        if (!memcmp(name, "error", 5)) return ErrorMember;
+        break;
+    case 6:
+        if (!memcmp(name, "method", 6)) return MethodMember;
+        if (!memcmp(name, "params", 6)) return ParamsMember;
+        if (!memcmp(name, "result", 6)) return ResultMember;
+        break;
+    case 7:
+        if (!memcmp(name, "message", 7)) return MessageMember;
+        if (!memcmp(name, "timeout", 7)) return TimeoutMember;
+        break;
+    case 8:
+        if (!memcmp(name, "priority", 8)) return PriorityMember;
+        break;
+    }
+
+    return OtherMember;
+}
+
+bool QJsonRpcMessageParser::parseMemberName(Member *result)
+{
+    if (*head != '"')
+        return fail(QJsonParseError::IllegalValue);
+
+    // names without escapes are matched in place
+    const char *name = ++head;
+    while (head < end && *head != '"' && *head != '\\')
+        ++head;
+    if (head < end && *head == '"') {
+        *result = member(name, int(head - name));
+        ++head;
+    } else {
+        head = name;
+        QString decoded;
+        if (!parseString(&decoded))
+            return false;
+        const QByteArray latin1 = decoded.toLatin1();
+        *result = member(latin1.constData(), latin1.size());
+    }
+
+    if (!eatSpace() || *head != ':')
+        return fail(QJsonParseError::MissingNameSeparator);
+    ++head;
+    if (!eatSpace())
+        return fail(QJsonParseError::IllegalValue);
+    return true;
+}
+
+bool QJsonRpcMessageParser::parseMessage(QJsonRpcMessagePrivate *message)
+{
+    if (end - head >= 3 && uchar(head[0]) == 0xef && uchar(head[1]) == 0xbb && uchar(head[2]) == 0xbf)
+        head += 3;
+    if (!eatSpace() || *head != '{')
+        return fail(QJsonParseError::MissingObject);
+    ++head;
+
+    if (!eatSpace())
+        return fail(QJsonParseError::UnterminatedObject);
+    if (*head == '}') {
+        ++head;
+    } else {
+        while (true) {
+            if (!parseMember(message))
+                return false;
+
+            if (!eatSpace())
+                return fail(QJsonParseError::UnterminatedObject);
+            if (*head == '}') {
+                ++head;
+                break;
+            }
+            if (*head != ',')
+                return fail(QJsonParseError::MissingValueSeparator);
+            ++head;
+            if (!eatSpace())
+                return fail(QJsonParseError::UnterminatedObject);
+        }
+    }
+
+    if (eatSpace())
+        return fail(QJsonParseError::GarbageAtEnd);
+
+    finishMessage(message);
+    return true;
+}
+
+// head is at the name of the member
+bool QJsonRpcMessageParser::parseMember(QJsonRpcMessagePrivate *message, const char *valueEnd)
+{
+    Member name;
+    if (!parseMemberName(&name))
+        return false;
+
+    switch (name) {
+    case IdMember: {
+        const char *start = head;
+        if (!parseValue(&message->idValue, valueEnd))
+            return false;
+        message->id = QJsonRpcMessagePrivate::toId(message->idValue);
+        message->idOffset = int(start - begin);
+        message->idLength = int(head - start);
+        hasId = true;
+        break;
+    }
+    case MethodMember:
+        if (*head == '"') {
+            ++head;
+            if (!parseString(&message->method))
+                return false;
+        } else {
+            QJsonValue method;
+            if (!parseValue(&method, valueEnd))
+                return false;
+            message->method = method.toString();
+        }
+        hasMethod = true;
+        break;
+    case ParamsMember:
+        if (!parseDeferredValue(message, QJsonRpcMessagePrivate::ParamsPending, &message->params))
+            return false;
+        break;
+    case ResultMember:
+        if (!parseDeferredValue(message, QJsonRpcMessagePrivate::ResultPending, &message->result))
+            return false;
+        hasResult = true;
+        break;
+    case PriorityMember: {
+        QJsonValue priority;
+        if (!parseValue(&priority, valueEnd))
+            return false;
+        message->priority = QJsonRpcMessagePrivate::priorityFromValue(priority);
+        break;
+    }
+    case TimeoutMember: {
+        QJsonValue timeout;
+        if (!parseValue(&timeout, valueEnd))
+            return false;
+        message->setTimeout(timeout);
+        break;
+    }
+    case ErrorMember:
+        hasError = true;
+        message->errorCode = 0;
+        message->errorMessage.clear();
+        message->errorData = QJsonValue(QJsonValue::Undefined);
+        if (*head == '{') {
+            if (!parseErrorObject(message))
+                return false;
+            isError = true;
+        } else {
+            QJsonValue error;
+            if (!parseValue(&error, valueEnd))
+                return false;
+            isError = !error.isNull();
+        }
+        break;
+    default:
+        // still validated, the text of the message is kept
+        if (!skipValue())
+            return false;
+        break;
+    }
+
+    return true;
+}
+
+bool QJsonRpcMessageParser::parseErrorObject(QJsonRpcMessagePrivate *message)
+{
+    ++head;
+    if (!eatSpace())
+        return fail(QJsonParseError::UnterminatedObject);
+    if (*head == '}') {
+        ++head;
+        return true;
+    }
+
+    while (true) {
+        Member name;
+        if (!parseMemberName(&name))
+            return false;
+
+        QJsonValue value;
+        switch (name) {
+        case CodeMember:
+            if (!parseValue(&value))
+                return false;
+            message->errorCode = QJsonRpcMessagePrivate::toInt(value);
+            break;
+        case MessageMember:
+            if (!parseValue(&value))
+                return false;
+            message->errorMessage = value.toString();
+            break;
+        case DataMember:
+            if (!parseValue(&message->errorData))
+                return false;
+            break;
+        default:
+            if (!skipValue())
+                return false;
+            break;
+        }
+
+        if (!eatSpace())
+            return fail(QJsonParseError::UnterminatedObject);
+        if (*head == '}') {
+            ++head;
+            return true;
+        }
+        if (*head != ',')
+            return fail(QJsonParseError::MissingValueSeparator);
+        ++head;
+        if (!eatSpace())
+            return fail(QJsonParseError::UnterminatedObject);
+    }
+}
+
+// structured values are only validated, their text is decoded on demand
+bool QJsonRpcMessageParser::parseDeferredValue(QJsonRpcMessagePrivate *message, int pending,
+                                               QJsonValue *value)
+{
+    if (*head != '{' && *head != '[') {
+        message->setPending(pending, 0, 0);
+        return parseValue(value);
+    }
+
+    const char *start = head;
+    if (!skipValue())
+        return false;
+    *value = QJsonValue(QJsonValue::Undefined);
+    message->setPending(pending, int(start - begin), int(head - start));
+    return true;
+}
+
+bool QJsonRpcMessageParser::parseValue(QJsonValue *value, const char *valueEnd)
+{
+    switch (*head) {
+    case '{':
+    case '[': {
+        const char *start = head;
+        if (valueEnd)
+            head = valueEnd;
+        else if (!skipValue())
+            return false;
+        QJsonParseError parseError;
+        QJsonDocument document =
+            QJsonDocument::fromJson(QByteArray::fromRawData(start, int(head - start)), &parseError);
+        if (parseError.error != QJsonParseError::NoError) {
+            head = start + parseError.offset;
+            return fail(parseError.error);
+        }
+        if (document.isArray())
+            *value = document.array();
+        else
+            *value = document.object();
+        return true;
+    }
+    case '"': {
+        ++head;
+        QString string;
+        if (!parseString(&string))
+            return false;
+        *value = string;
+        return true;
+    }
+    case 't':
+        *value = true;
+        return parseLiteral("true", 4);
+    case 'f':
+        *value = false;
+        return parseLiteral("false", 5);
+    case 'n':
+        *value = QJsonValue(QJsonValue::Null);
+        return parseLiteral("null", 4);
+    default: {
+        double number;
+        if (!parseNumber(&number))
+            return false;
+        *value = number;
+        return true;
+    }
+    }
+}
+
+bool QJsonRpcMessageParser::parseLiteral(const char *literal, int length)
+{
+    if (end - head < length || memcmp(head, literal, length))
+        return fail(QJsonParseError::IllegalValue);
+    head += length;
+    return true;
+}
+
+// head is past the opening quote, string may be 0 to only validate
+bool QJsonRpcMessageParser::parseString(QString *string)
+{
+    const char *start = head;
+    bool latin1 = true;
+    while (head < end && *head != '"' && *head != '\\') {
+        if (uchar(*head) < 0x20)
+            return fail(QJsonParseError::IllegalValue);
+        if (uchar(*head) >= 0x80)
+            latin1 = false;
+        ++head;
+    }
+    if (head == end)
+        return fail(QJsonParseError::UnterminatedString);
+
+    if (*head == '"') {
+        if (string) {
+            if (latin1)
+                *string = QString::fromLatin1(start, int(head - start));
+            else
+                *string = QString::fromUtf8(start, int(head - start));
+        }
+        ++head;
+        return true;
+    }
+
+    // escaped strings are decoded to UTF-8 first
+    QVarLengthArray<char, 256> utf8;
+    utf8.append(start, int(head - start));
+    while (head < end && *head != '"') {
+        char c = *head++;
+        if (uchar(c) < 0x20)
+            return fail(QJsonParseError::IllegalValue);
+        if (c != '\\') {
+            utf8.append(c);
+            continue;
+        }
+
+        if (head == end)
+            return fail(QJsonParseError::UnterminatedString);
+        switch (*head++) {
+        case '"': utf8.append('"'); break;
+        case '\\': utf8.append('\\'); break;
+        case '/': utf8.append('/'); break;
+        case 'b': utf8.append('\b'); break;
+        case 'f': utf8.append('\f'); break;
+        case 'n': utf8.append('\n'); break;
+        case 'r': utf8.append('\r'); break;
+        case 't': utf8.append('\t'); break;
+        case 'u': {
+            uint u = 0;
+            for (int i = 0; i < 4; ++i) {
+                if (head == end)
+                    return fail(QJsonParseError::UnterminatedString);
+                const char h = *head++;
+                u <<= 4;
+                if (h >= '0' && h <= '9')
+                    u |= h - '0';
+                else if (h >= 'a' && h <= 'f')
+                    u |= h - 'a' + 10;
+                else if (h >= 'A' && h <= 'F')
+                    u |= h - 'A' + 10;
+                else
+                    return fail(QJsonParseError::IllegalEscapeSequence);
+            }
+
+            if ((u & 0xfc00) == 0xd800 && end - head >= 6 && head[0] == '\\' && head[1] == 'u') {
+                bool ok;
+                const uint low = QByteArray::fromRawData(head + 2, 4).toUInt(&ok, 16);
+                if (ok && (low & 0xfc00) == 0xdc00) {
+                    u = 0x10000 + ((u - 0xd800) << 10) + (low - 0xdc00);
+                    head += 6;
+                }
+            }
+            if ((u & 0xf800) == 0xd800)
+                u = 0xfffd;     // unpaired surrogate
+
+            if (u < 0x80) {
+                utf8.append(char(u));
+            } else {
+                if (u < 0x800) {
+                    utf8.append(char(0xc0 | (u >> 6)));
+                } else {
+                    if (u >= 0x10000) {
+                        utf8.append(char(0xf0 | (u >> 18)));
+                        utf8.append(char(0x80 | ((u >> 12) & 0x3f)));
+                    } else {
+                        utf8.append(char(0xe0 | (u >> 12)));
+                    }
+                    utf8.append(char(0x80 | ((u >> 6) & 0x3f)));
+                }
+                utf8.append(char(0x80 | (u & 0x3f)));
+            }
+            break;
+        }
+        default:
+            return fail(QJsonParseError::IllegalEscapeSequence);
+        }
+    }
+    if (head == end)
+        return fail(QJsonParseError::UnterminatedString);
+
+    ++head;
+    if (string)
+        *string = QString::fromUtf8(utf8.constData(), utf8.size());
+    return true;
+}
+
+// number may be 0 to only validate
+bool QJsonRpcMessageParser::parseNumber(double *number)
+{
+    const char *start = head;
+    if (head < end && *head == '-')
+        ++head;
+
+    // small integers, by far the most common ids and codes, skip the conversion
+    qint64 integer = 0;
+    int digits = 0;
+    if (head < end && *head == '0') {
+        ++head;
+        digits = 1;
+    } else {
+        while (head < end && *head >= '0' && *head <= '9') {
+            integer = integer * 10 + (*head++ - '0');
+            if (++digits > 15)
+                break;
+        }
+        while (head < end && *head >= '0' && *head <= '9') {
+            ++head;
+            ++digits;
+        }
+    }
+    if (!digits)
+        return fail(QJsonParseError::IllegalNumber);
+
+    bool isInteger = (digits <= 15);
+    if (head < end && *head == '.') {
+        ++head;
+        isInteger = false;
+        if (head == end || *head < '0' || *head > '9')
+            return fail(QJsonParseError::IllegalNumber);
+        while (head < end && *head >= '0' && *head <= '9')
+            ++head;
+    }
+    if (head < end && (*head == 'e' || *head == 'E')) {
+        ++head;
+        isInteger = false;
+        if (head < end && (*head == '+' || *head == '-'))
+            ++head;
+        if (head == end || *head < '0' || *head > '9')
+            return fail(QJsonParseError::IllegalNumber);
+        while (head < end && *head >= '0' && *head <= '9')
+            ++head;
+    }
+
+    if (!number)
+        return true;
+
+    if (isInteger) {
+        *number = double(*start == '-' ? -integer : integer);
+        return true;
+    }
+
+    bool ok;
+    *number = QByteArray::fromRawData(start, int(head - start)).toDouble(&ok);
+    if (!ok || qIsInf(*number)) {
+        head = start;
+        return fail(QJsonParseError::IllegalNumber);
+    }
+    return true;
+}
+
+// the array index of a JSON Pointer token, "-" and leading zeros don't count
+static bool arrayIndex(const QByteArray &token, int *index)
+{
+    if (token.isEmpty() || token.size() > 9 || (token.size() > 1 && token.at(0) == '0'))
+        return false;
+
+    int value = 0;
+    for (int i = 0; i < token.size(); ++i) {
+        if (token.at(i) < '0' || token.at(i) > '9')
+            return false;
+        value = value * 10 + (token.at(i) - '0');
+    }
+    *index = value;
+    return true;
+}
+
+// the unescaped reference tokens of a pointer, as UTF-8
+static bool pointerTokens(const QString &pointer, QList<QByteArray> *tokens)
+{
+    if (pointer.isEmpty())
+        return true;
+    if (pointer.at(0) != QLatin1Char('/'))
+        return false;
+
+    foreach (QByteArray token, pointer.toUtf8().mid(1).split('/')) {
+        // in this order, so that "~01" stands for "~1"
+        token.replace("~1", "/");
+        token.replace("~0", "~");
+        tokens->append(token);
+    }
+    return true;
+}
+
+bool QJsonRpcMessageParser::findValue(const QList<QByteArray> &tokens, QJsonValue *value)
+{
+    foreach (const QByteArray &token, tokens) {
+        if (!eatSpace())
+            return false;
+
+        if (*head == '{') {
+            // the last of duplicate names wins, as in a decoded object
+            const char *found = 0;
+            ++head;
+            if (!eatSpace())
+                return false;
+            while (*head != '}') {
+                if (*head != '"')
+                    return false;
+                const char *name = ++head;
+                while (head < end && *head != '"' && *head != '\\')
+                    ++head;
+                bool matches;
+                if (head < end && *head == '"') {
+                    matches = (head - name == token.size() && !memcmp(name, token.constData(), token.size()));
+                    ++head;
+                } else {
+                    head = name;
+                    QString decoded;
+                    if (!parseString(&decoded))
+                        return false;
+                    matches = (decoded.toUtf8() == token);
+                }
+
+                if (!eatSpace() || *head != ':')
+                    return false;
+                ++head;
+                if (!eatSpace())
+                    return false;
+                if (matches)
+                    found = head;
+                if (!skipValue() || !eatSpace())
+                    return false;
+                if (*head == ',') {
+                    ++head;
+                    if (!eatSpace())
+                        return false;
+                }
+            }
+
+            if (!found)
+                return false;
+            head = found;
+        } else if (*head == '[') {
+            int index;
+            if (!arrayIndex(token, &index))
+                return false;
+            ++head;
+            for (int i = 0; i < index; ++i) {
+                if (!eatSpace() || *head == ']' || !skipValue() || !eatSpace() || *head != ',')
+                    return false;
+                ++head;
+            }
+            if (!eatSpace() || *head == ']')
+                return false;
+        } else {
+            return false;
+        }
+    }
+
+    return eatSpace() && parseValue(value);
+}
+
+bool QJsonRpcMessageParser::skipValue()
+{
+    switch (*head) {
+    case '{':
+        return skipContainer('}');
+    case '[':
+        return skipContainer(']');
+    case '"':
+        ++head;
+        return parseString(0);
+    case 't':
+        return parseLiteral("true", 4);
+    case 'f':
+        return parseLiteral("false", 5);
+    case 'n':
+        return parseLiteral("null", 4);
+    default:
+        return parseNumber(0);
+    }
+}
+
+bool QJsonRpcMessageParser::skipContainer(char close)
+{
+    const bool isObject = (close == '}');
+    const QJsonParseError::ParseError unterminated =
+        isObject ? QJsonParseError::UnterminatedObject : QJsonParseError::UnterminatedArray;
+    if (++nestingLevel > MaximumNestingLevel)
+        return fail(QJsonParseError::DeepNesting);
+
+    ++head;
+    if (!eatSpace())
+        return fail(unterminated);
+    if (*head != close) {
+        while (true) {
+            if (isObject) {
+                if (*head != '"')
+                    return fail(QJsonParseError::IllegalValue);
+                ++head;
+                if (!parseString(0))
+                    return false;
+                if (!eatSpace() || *head != ':')
+                    return fail(QJsonParseError::MissingNameSeparator);
+                ++head;
+                if (!eatSpace())
+                    return fail(unterminated);
+            }
+
+            if (!skipValue())
+                return false;
+            if (!eatSpace())
+                return fail(unterminated);
+            if (*head == close)
+                break;
+            if (*head != ',')
+                return fail(QJsonParseError::MissingValueSeparator);
+            ++head;
+            if (!eatSpace())
+                return fail(unterminated);
+        }
+    }
+
+    ++head;
+    --nestingLevel;
+    return true;
+}
+
+QJsonValue QJsonRpcMessagePrivate::valueAt(int value, const QString &pointer) const
+{
+    QList<QByteArray> tokens;
+    if (!pointerTokens(pointer, &tokens))
+        return QJsonValue(QJsonValue::Undefined);
+
+    // the text doesn't change once parsed, whether or not it is decoded meanwhile
+    if (isPending(value)) {
+        const bool isParams = (value == ParamsPending);
+        QJsonRpcMessageParser parser(json.constData() + (isParams ? paramsOffset : resultOffset),
+                                     isParams ? paramsLength : resultLength);
+        QJsonValue found;
+        if (!parser.findValue(tokens, &found))
+            return QJsonValue(QJsonValue::Undefined);
+        return found;
+    }
+
+    // decoded objects and arrays share their document's data, nothing is copied
+    QJsonValue found = (value == ParamsPending) ? params : result;
+    foreach (const QByteArray &token, tokens) {
+        int index;
+        if (found.isObject())
+            found = found.toObject().value(QString::fromUtf8(token.constData(), token.size()));
+        else if (found.isArray() && arrayIndex(token, &index) && index < found.toArray().size())
+            found = found.toArray().at(index);
+        else
+            return QJsonValue(QJsonValue::Undefined);
+    }
+    return found;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::fromJson(const QByteArray &json, QJsonParseError *error)
+{
+    QJsonRpcMessage message;
+    QJsonRpcMessageParser parser(json.constData(), json.size());
+    if (!parser.parseMessage(message.d.data())) {
+        error->error = parser.error;
+        error->offset = parser.offset();
+        return QJsonRpcMessage();
+    }
+
+    error->error = QJsonParseError::NoError;
+    error->offset = 0;
+    message.d->json = json;
+    return message;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::withBatch(const QJsonRpcMessage &message, quint32 batch)
+{
+    QJsonRpcMessage result = message;
+    result.d->batch = batch;
+    return result;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::withStream(const QJsonRpcMessage &message, quint32 stream)
+{
+    QJsonRpcMessage result = message;
+    result.d->stream = stream;
+    return result;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::withId(const QJsonRpcMessage &message, const QJsonValue &id)
+{
+    QJsonRpcMessage result = message;
+    QJsonRpcMessagePrivate *d = result.d.data();
+    d->idValue = id;
+    d->id = toId(id);
+    if (d->hasObject) {
+        d->object.insert(keys().id, id);
+        return result;
+    }
+    if (d->json.isEmpty())
+        return result;
+
+    if (d->idLength <= 0) {
+        // written from its fields instead, which have to be decoded then
+        if (d->isPending(ParamsPending))
+            d->decodePending(ParamsPending);
+        if (d->isPending(ResultPending))
+            d->decodePending(ResultPending);
+        d->json.clear();
+        return result;
+    }
+
+    // params and result are left where they are, only moved along
+    QByteArray text;
+    writeValue(id, text);
+    const int shift = text.size() - d->idLength;
+    d->json.replace(d->idOffset, d->idLength, text);
+    if (d->paramsOffset > d->idOffset)
+        d->paramsOffset += shift;
+    if (d->resultOffset > d->idOffset)
+        d->resultOffset += shift;
+    d->idLength = text.size();
+    return result;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::withTimeout(const QJsonRpcMessage &message, int msecs)
+{
+    QJsonRpcMessage result = message;
+    QJsonRpcMessagePrivate *d = result.d.data();
+    d->setTimeout(msecs);
+    if (d->hasObject) {
+        d->object.insert(keys().timeout, d->timeout);
+    } else if (!d->json.isEmpty()) {
+        // written from its fields instead, like a message given another id
+        // without one in its text
+        if (d->isPending(ParamsPending))
+            d->decodePending(ParamsPending);
+        if (d->isPending(ResultPending))
+            d->decodePending(ResultPending);
+        d->json.clear();
+    }
+
+    return result;
+}
+
+// whether c may change the state of an incremental parse: quotes and
+// backslashes in a string, quotes and brackets outside of one, and commas
+// too between the members of the envelope
+static inline bool isStateByte(char c, bool inString, bool commas)
+{
+    if (inString)
+        return c == '"' || c == '\\';
+    const char folded = c | 0x20;     // '[' and ']' as '{' and '}'
+    return c == '"' || (commas && c == ',') || folded == '{' || folded == '}';
+}
+
+// Returns the first byte in [pos, end) for which isStateByte holds, or the
+// start of the tail that is too short to be tested as a block. The caller
+// handles that tail byte by byte.
+static inline const char *skipPlainBytes(const char *pos, const char *end,
+                                         bool inString, bool commas)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i comma = _mm_set1_epi8(commas ? ',' : '"');
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    while (end - pos >= 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+        __m128i matches;
+        if (inString) {
+            matches = _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash));
+        } else {
+            const __m128i folded = _mm_or_si128(block, caseBit);
+            matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, comma)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)));
+        }
+        const int mask = _mm_movemask_epi8(matches);
+        if (mask) {
+#if defined(Q_CC_MSVC)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return pos + index;
+#else
+            return pos + __builtin_ctz(mask);
 #endif
+        }
 
-#include "qjsonrpcmessage.h"
+        pos += 16;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t comma = vdupq_n_u8(commas ? ',' : '"');
+    const uint8x16_t caseBit = vdupq_n_u8(0x20);
+    const uint8x16_t open = vdupq_n_u8('{');
+    const uint8x16_t close = vdupq_n_u8('}');
+    while (end - pos >= 16) {
+        const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(pos));
+        uint8x16_t matches;
+        if (inString) {
+            matches = vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash));
+        } else {
+            const uint8x16_t folded = vorrq_u8(block, caseBit);
+            matches = vorrq_u8(vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, comma)),
+                               vorrq_u8(vceqq_u8(folded, open), vceqq_u8(folded, close)));
+        }
+        const uint64x2_t lanes = vreinterpretq_u64_u8(matches);
+        if (vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) {
+            // a match is guaranteed within this block
+            while (!isStateByte(*pos, inString, commas))
+                pos++;
+            return pos;
+        }
 
-class QJsonRpcMessagePrivate : public QSharedData
-{
-public:
-    QJsonRpcMessagePrivate();
-    ~QJsonRpcMessagePrivate();
-    QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other);
+        pos += 16;
+    }
+#else
+    Q_UNUSED(end)
+    Q_UNUSED(inString)
+    Q_UNUSED(commas)
+#endif
+    return pos;
+}
 
-    void initializeWithObject(const QJsonObject &message);
-    static QJsonRpcMessage createBasicRequest(const QString &method, const QJsonArray &params);
-    static QJsonRpcMessage createBasicRequest(const QString &method,
-                                              const QJsonObject &namedParameters);
+QJsonRpcIncrementalParser::QJsonRpcIncrementalParser()
+    : parser(new QJsonRpcMessageParser(0, 0))
+{
+    reset();
+}
 
-    QJsonRpcMessage::Type type;
-    QScopedPointer<QJsonObject> object;
+QJsonRpcIncrementalParser::~QJsonRpcIncrementalParser()
+{
+    delete parser;
+}
 
-    static int uniqueRequestCounter;
-};
+void QJsonRpcIncrementalParser::reset()
+{
+    parser->startMessage();
+    message = QJsonRpcMessage();
+    state = NeedMoreData;
+    offset = 0;
+    start = 0;
+    memberStart = 0;
+    members = 0;
+    depth = 0;
+    batch = false;
+    inString = false;
+    escaped = false;
+    error = QJsonParseError::NoError;
+    errorOffset = 0;
+}
 
-int QJsonRpcMessagePrivate::uniqueRequestCounter = 0;
+QJsonParseError QJsonRpcIncrementalParser::parseError() const
+{
+    QJsonParseError parseError;
+    parseError.error = error;
+    parseError.offset = errorOffset;
+    return parseError;
+}
 
-QJsonRpcMessagePrivate::QJsonRpcMessagePrivate()
-    : type(QJsonRpcMessage::Invalid),
-      object(0)
+QJsonRpcMessage QJsonRpcIncrementalParser::takeMessage()
 {
+    QJsonRpcMessage result = message;
+    reset();
+    return result;
 }
 
-QJsonRpcMessagePrivate::QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other)
-    : QSharedData(other),
-      type(other.type),
-      object(other.object ? new QJsonObject(*other.object) : 0)
+bool QJsonRpcIncrementalParser::fail(QJsonParseError::ParseError parseError, int position)
 {
+    error = parseError;
+    errorOffset = position;
+    return false;
 }
 
-void QJsonRpcMessagePrivate::initializeWithObject(const QJsonObject &message)
+QJsonRpcIncrementalParser::Status QJsonRpcIncrementalParser::feed(const char *data, int size)
 {
-    object.reset(new QJsonObject(message));
-    if (message.contains(QLatin1String("id"))) {
-        if (message.contains(QLatin1String("result")) ||
-            message.contains(QLatin1String("error"))) {
-            if (message.contains(QLatin1String("error")) &&
-                !message.value(QLatin1String("error")).isNull())
-                type = QJsonRpcMessage::Error;
-            else
-                type = QJsonRpcMessage::Response;
-        } else if (message.contains(QLatin1String("method"))) {
-            type = QJsonRpcMessage::Request;
+    if (state != NeedMoreData)
+        return state;
+
+    const char *pos = data + offset;
+    const char *end = data + size;
+
+    // anything up to the start of the document is skipped, like the
+    // separators some peers write between them
+    if (depth == 0) {
+        while (pos != end && *pos != '{' && *pos != '[')
+            pos++;
+
+        if (pos == end) {
+            offset = size;
+            return NeedMoreData;
         }
-    } else {
-        if (message.contains(QLatin1String("method")))
-            type = QJsonRpcMessage::Notification;
+
+        start = int(pos - data);
+        batch = (*pos == '[');
+        memberStart = start + 1;
+        depth = 1;
+        pos++;
+    }
+
+    // the members of the envelope end at the separators found at depth 1,
+    // those of a malformed one are only delimited
+    while (pos != end) {
+        const bool commas = (depth == 1 && !batch);
+        if (!escaped) {
+            pos = skipPlainBytes(pos, end, inString, commas);
+            if (pos == end)
+                break;
+        }
+
+        const char c = *pos;
+        if (inString) {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                inString = false;
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                offset = int(pos - data) + 1;
+                return finish(data, c);
+            }
+        } else if (c == ',' && commas) {
+            if (error == QJsonParseError::NoError)
+                parseMember(data, int(pos - data), false);
+            memberStart = int(pos - data) + 1;
+        }
+
+        pos++;
     }
+
+    offset = size;
+    return NeedMoreData;
 }
 
-QJsonRpcMessagePrivate::~QJsonRpcMessagePrivate()
+QJsonRpcIncrementalParser::Status QJsonRpcIncrementalParser::finish(const char *data, char close)
+{
+    if (!batch && error == QJsonParseError::NoError) {
+        if (close != '}')
+            fail(QJsonParseError::UnterminatedObject, offset - 1);
+        else
+            parseMember(data, offset - 1, true);
+    }
+
+    if (error != QJsonParseError::NoError) {
+        state = Failed;
+        return state;
+    }
+
+    if (!batch) {
+        QJsonRpcMessagePrivate *d = QJsonRpcMessagePrivate::get(message);
+        parser->finishMessage(d);
+        d->json = QByteArray(data + start, offset - start);
+        d->paramsOffset -= start;
+        d->resultOffset -= start;
+        d->idOffset -= start;
+    }
+
+    state = Finished;
+    return state;
+}
+
+// the member between memberStart and memberEnd, which holds its separator or
+// the closing bracket
+bool QJsonRpcIncrementalParser::parseMember(const char *data, int memberEnd, bool last)
 {
+    parser->setText(data, memberStart, memberEnd);
+    if (!parser->eatSpace()) {
+        // only an empty object has nothing in its place
+        if (last && members == 0)
+            return true;
+        return fail(QJsonParseError::IllegalValue, memberEnd);
+    }
+
+    int valueEnd = memberEnd;
+    while (data[valueEnd - 1] == ' ' || data[valueEnd - 1] == '\t' ||
+           data[valueEnd - 1] == '\n' || data[valueEnd - 1] == '\r')
+        --valueEnd;
+
+    parser->setText(data, parser->offset(), valueEnd);
+    if (!parser->parseMember(QJsonRpcMessagePrivate::get(message), data + valueEnd))
+        return fail(parser->error, parser->offset());
+    if (parser->offset() != valueEnd)
+        return fail(QJsonParseError::MissingValueSeparator, parser->offset());
+
+    members++;
+    return true;
 }
 
 QJsonRpcMessage::QJsonRpcMessage()
     : d(new QJsonRpcMessagePrivate)
 {
-    d->object.reset(new QJsonObject);
 }
 
 QJsonRpcMessage::QJsonRpcMessage(const QJsonRpcMessage &other)
@@ -130,20 +1744,10 @@ bool QJsonRpcMessage::operator==(const QJsonRpcMessage &message) const
 
 QJsonRpcMessage QJsonRpcMessage::fromJson(const QByteArray &message)
 {
-    QJsonRpcMessage result;
     QJsonParseError error;
-    QJsonDocument document = QJsonDocument::fromJson(message, &error);
-    if (error.error != QJsonParseError::NoError) {
+    QJsonRpcMessage result = QJsonRpcMessagePrivate::fromJson(message, &error);
+    if (error.error != QJsonParseError::NoError)
         qJsonRpcDebug() << Q_FUNC_INFO << error.errorString();
-        return result;
-    }
-
-    if (!document.isObject()) {
-        qJsonRpcDebug() << Q_FUNC_INFO << "invalid message: " << message;
-        return result;
-    }
-
-    result.d->initializeWithObject(document.object());
     return result;
 }
 
@@ -156,19 +1760,17 @@ QJsonRpcMessage QJsonRpcMessage::fromObject(const QJsonObject &message)
 
 QJsonObject QJsonRpcMessage::toObject() const
 {
-    if (d->object)
-        return QJsonObject(*d->object);
-    return QJsonObject();
+    if (d->hasObject)
+        return d->object;
+    if (!d->json.isEmpty())
+        return QJsonDocument::fromJson(d->json).object();
+    return d->buildObject();
 }
 
 QByteArray QJsonRpcMessage::toJson() const
 {
-    if (d->object) {
-        QJsonDocument doc(*d->object);
-        return doc.toJson();
-    }
-
-    return QByteArray();
+    QJsonDocument doc(toObject());
+    return doc.toJson();
 }
 
 bool QJsonRpcMessage::isValid() const
@@ -181,33 +1783,22 @@ QJsonRpcMessage::Type QJsonRpcMessage::type() const
     return d->type;
 }
 
-QJsonRpcMessage QJsonRpcMessagePrivate::createBasicRequest(const QString &method, const QJsonArray &params)
-{
-    QJsonRpcMessage request;
-    request.d->object->insert(QLatin1String("jsonrpc"), QLatin1String("2.0"));
-    request.d->object->insert(QLatin1String("method"), method);
-    if (!params.isEmpty())
-        request.d->object->insert(QLatin1String("params"), params);
-    return request;
-}
-
 QJsonRpcMessage QJsonRpcMessagePrivate::createBasicRequest(const QString &method,
-                                                           const QJsonObject &namedParameters)
+                                                           const QJsonValue &params)
 {
     QJsonRpcMessage request;
-    request.d->object->insert(QLatin1String("jsonrpc"), QLatin1String("2.0"));
-    request.d->object->insert(QLatin1String("method"), method);
-    if (!namedParameters.isEmpty())
-        request.d->object->insert(QLatin1String("params"), namedParameters);
+    request.d->method = method;
+    request.d->params = params;
     return request;
 }
 
 QJsonRpcMessage QJsonRpcMessage::createRequest(const QString &method, const QJsonArray &params)
 {
-    QJsonRpcMessage request = QJsonRpcMessagePrivate::createBasicRequest(method, params);
+    QJsonRpcMessage request = QJsonRpcMessagePrivate::createBasicRequest(method,
+        params.isEmpty() ? QJsonValue(QJsonValue::Undefined) : QJsonValue(params));
     request.d->type = QJsonRpcMessage::Request;
-    QJsonRpcMessagePrivate::uniqueRequestCounter++;
-    request.d->object->insert(QLatin1String("id"), QJsonRpcMessagePrivate::uniqueRequestCounter);
+    request.d->id = QJsonRpcMessagePrivate::nextRequestId();
+    request.d->idValue = double(request.d->id);
     return request;
 }
 
@@ -221,17 +1812,18 @@ QJsonRpcMessage QJsonRpcMessage::createRequest(const QString &method, const QJso
 QJsonRpcMessage QJsonRpcMessage::createRequest(const QString &method,
                                                const QJsonObject &namedParameters)
 {
-    QJsonRpcMessage request =
-        QJsonRpcMessagePrivate::createBasicRequest(method, namedParameters);
+    QJsonRpcMessage request = QJsonRpcMessagePrivate::createBasicRequest(method,
+        namedParameters.isEmpty() ? QJsonValue(QJsonValue::Undefined) : QJsonValue(namedParameters));
     request.d->type = QJsonRpcMessage::Request;
-    QJsonRpcMessagePrivate::uniqueRequestCounter++;
-    request.d->object->insert(QLatin1String("id"), QJsonRpcMessagePrivate::uniqueRequestCounter);
+    request.d->id = QJsonRpcMessagePrivate::nextRequestId();
+    request.d->idValue = double(request.d->id);
     return request;
 }
 
 QJsonRpcMessage QJsonRpcMessage::createNotification(const QString &method, const QJsonArray &params)
 {
-    QJsonRpcMessage notification = QJsonRpcMessagePrivate::createBasicRequest(method, params);
+    QJsonRpcMessage notification = QJsonRpcMessagePrivate::createBasicRequest(method,
+        params.isEmpty() ? QJsonValue(QJsonValue::Undefined) : QJsonValue(params));
     notification.d->type = QJsonRpcMessage::Notification;
     return notification;
 }
@@ -246,125 +1838,231 @@ QJsonRpcMessage QJsonRpcMessage::createNotification(const QString &method, const
 QJsonRpcMessage QJsonRpcMessage::createNotification(const QString &method,
                                                     const QJsonObject &namedParameters)
 {
-    QJsonRpcMessage notification =
-        QJsonRpcMessagePrivate::createBasicRequest(method, namedParameters);
+    QJsonRpcMessage notification = QJsonRpcMessagePrivate::createBasicRequest(method,
+        namedParameters.isEmpty() ? QJsonValue(QJsonValue::Undefined) : QJsonValue(namedParameters));
     notification.d->type = QJsonRpcMessage::Notification;
     return notification;
 }
 
+QJsonRpcMessage QJsonRpcMessagePrivate::createPartialResult(const QJsonRpcMessage &request,
+                                                            const QJsonValue &value)
+{
+    QJsonObject params;
+    params.insert(keys().id, request.d->idValue);
+    params.insert(keys().value, value);
+    return QJsonRpcMessage::createNotification(QLatin1String("$/partialResult"), params);
+}
+
+bool QJsonRpcMessagePrivate::isPartialResult(const QJsonRpcMessage &message)
+{
+    return message.d->type == QJsonRpcMessage::Notification &&
+           message.d->method == QLatin1String("$/partialResult");
+}
+
 QJsonRpcMessage QJsonRpcMessage::createResponse(const QJsonValue &result) const
 {
     QJsonRpcMessage response;
-    if (d->object->contains(QLatin1String("id"))) {
-        QJsonObject *object = response.d->object.data();
-        object->insert(QLatin1String("jsonrpc"), QLatin1String("2.0"));
-        object->insert(QLatin1String("id"), d->object->value(QLatin1String("id")));
-        object->insert(QLatin1String("result"), result);
+    if (!d->idValue.isUndefined()) {
+        response.d->idValue = d->idValue;
+        response.d->id = d->id;
+        response.d->result = result;
         response.d->type = QJsonRpcMessage::Response;
+        response.d->batch = d->batch;
+        response.d->stream = d->stream;
     }
 
     return response;
 }
 
+QJsonRpcMessage QJsonRpcMessagePrivate::createResponse(const QJsonRpcMessage &request,
+                                                      const QJsonValue &result,
+                                                      const QByteArray &resultJson)
+{
+    QJsonRpcMessage response = request.createResponse(result);
+    if (response.type() == QJsonRpcMessage::Response)
+        response.d->resultJson = resultJson;
+    return response;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::withSerializedResult(const QJsonRpcMessage &response)
+{
+    const QJsonRpcMessagePrivate *d = response.d.constData();
+    if (d->type != QJsonRpcMessage::Response || d->hasObject || !d->json.isEmpty() ||
+        !d->resultJson.isEmpty() || !(d->result.isArray() || d->result.isObject()))
+        return response;
+
+    QJsonRpcMessage result = response;
+    writeValue(d->result, result.d->resultJson);
+    return result;
+}
+
 QJsonRpcMessage QJsonRpcMessage::createErrorResponse(QJsonRpc::ErrorCode code,
                                                      const QString &message,
                                                      const QJsonValue &data) const
 {
     QJsonRpcMessage response;
-    QJsonObject error;
-    error.insert(QLatin1String("code"), code);
-    if (!message.isEmpty())
-        error.insert(QLatin1String("message"), message);
-    if (!data.isUndefined())
-        error.insert(QLatin1String("data"), data);
-
     response.d->type = QJsonRpcMessage::Error;
-    QJsonObject *object = response.d->object.data();
-    object->insert(QLatin1String("jsonrpc"), QLatin1String("2.0"));
-    if (d->object->contains(QLatin1String("id")))
-        object->insert(QLatin1String("id"), d->object->value(QLatin1String("id")));
-    else
-        object->insert(QLatin1String("id"), 0);
-    object->insert(QLatin1String("error"), error);
+    if (!d->idValue.isUndefined()) {
+        response.d->idValue = d->idValue;
+        response.d->id = d->id;
+    } else {
+        response.d->idValue = 0;
+        response.d->id = 0;
+    }
+
+    response.d->errorCode = code;
+    response.d->errorMessage = message;
+    response.d->errorData = data;
+    response.d->batch = d->batch;
+    response.d->stream = d->stream;
     return response;
 }
 
-int QJsonRpcMessage::id() const
+qint64 QJsonRpcMessage::id() const
 {
-    if (d->type == QJsonRpcMessage::Notification || !d->object)
+    if (d->type == QJsonRpcMessage::Notification)
         return -1;
-
-    const QJsonValue &value = d->object->value(QLatin1String("id"));
-    if (value.isString())
-        return value.toString().toInt();
-#if QT_VERSION >= 0x050200
-    return value.toInt();
-#else
-    return value.toDouble();
-#endif
+    return d->id;
 }
 
 QString QJsonRpcMessage::method() const
 {
-    if (d->type == QJsonRpcMessage::Response || !d->object)
+    if (d->type == QJsonRpcMessage::Response)
         return QString();
-
-    return d->object->value(QLatin1String("method")).toString();
+    return d->method;
 }
 
 QJsonValue QJsonRpcMessage::params() const
 {
     if (d->type == QJsonRpcMessage::Response || d->type == QJsonRpcMessage::Error)
         return QJsonValue(QJsonValue::Undefined);
-    if (!d->object)
-        return QJsonValue(QJsonValue::Undefined);
-
-    return d->object->value(QLatin1String("params"));
+    if (d->isPending(QJsonRpcMessagePrivate::ParamsPending))
+        d->decodePending(QJsonRpcMessagePrivate::ParamsPending);
+    return d->params;
 }
 
 QJsonValue QJsonRpcMessage::result() const
 {
-    if (d->type != QJsonRpcMessage::Response || !d->object)
+    if (d->type != QJsonRpcMessage::Response)
         return QJsonValue(QJsonValue::Undefined);
+    if (d->isPending(QJsonRpcMessagePrivate::ResultPending))
+        d->decodePending(QJsonRpcMessagePrivate::ResultPending);
+    return d->result;
+}
+
+QJsonValue QJsonRpcMessage::paramsValue(const QString &pointer) const
+{
+    if (d->type == QJsonRpcMessage::Response || d->type == QJsonRpcMessage::Error)
+        return QJsonValue(QJsonValue::Undefined);
+    return d->valueAt(QJsonRpcMessagePrivate::ParamsPending, pointer);
+}
 
-    return d->object->value(QLatin1String("result"));
+QJsonValue QJsonRpcMessage::resultValue(const QString &pointer) const
+{
+    if (d->type != QJsonRpcMessage::Response)
+        return QJsonValue(QJsonValue::Undefined);
+    return d->valueAt(QJsonRpcMessagePrivate::ResultPending, pointer);
 }
 
 int QJsonRpcMessage::errorCode() const
 {
-    if (d->type != QJsonRpcMessage::Error || !d->object)
+    if (d->type != QJsonRpcMessage::Error)
         return 0;
-
-    QJsonObject error =
-        d->object->value(QLatin1String("error")).toObject();
-    const QJsonValue &value = error.value(QLatin1String("code"));
-    if (value.isString())
-        return value.toString().toInt();
-#if QT_VERSION >= 0x050200
-    return value.toInt();
-#else
-    return value.toDouble();
-#endif
+    return d->errorCode;
 }
 
 QString QJsonRpcMessage::errorMessage() const
 {
-    if (d->type != QJsonRpcMessage::Error || !d->object)
+    if (d->type != QJsonRpcMessage::Error)
         return QString();
-
-    QJsonObject error =
-        d->object->value(QLatin1String("error")).toObject();
-    return error.value(QLatin1String("message")).toString();
+    return d->errorMessage;
 }
 
 QJsonValue QJsonRpcMessage::errorData() const
 {
-    if (d->type != QJsonRpcMessage::Error || !d->object)
+    if (d->type != QJsonRpcMessage::Error)
         return QJsonValue(QJsonValue::Undefined);
+    return d->errorData;
+}
+
+QList<QByteArray> QJsonRpcMessage::attachments() const
+{
+    return d->attachments;
+}
+
+void QJsonRpcMessage::setAttachments(const QList<QByteArray> &attachments)
+{
+    d->attachments = attachments;
+}
+
+QJsonObject QJsonRpcMessage::attachmentReference(int index)
+{
+    QJsonObject reference;
+    reference.insert(QLatin1String("$attachment"), index);
+    return reference;
+}
+
+QByteArray QJsonRpcMessage::attachment(const QJsonValue &reference) const
+{
+    if (reference.isString())
+        return QByteArray::fromBase64(reference.toString().toLatin1());
+
+    int index = QJsonRpcMessagePrivate::attachmentIndex(reference);
+    if (index < 0 || index >= d->attachments.size())
+        return QByteArray();
+    return d->attachments.at(index);
+}
+
+int QJsonRpcMessagePrivate::attachmentIndex(const QJsonValue &value)
+{
+    if (!value.isObject())
+        return -1;
+
+    const QJsonObject object = value.toObject();
+    if (object.size() != 1)
+        return -1;
+
+    const QJsonValue index = object.value(QLatin1String("$attachment"));
+    if (!index.isDouble() || index.toDouble() < 0)
+        return -1;
+    return int(index.toDouble());
+}
+
+QJsonValue QJsonRpcMessagePrivate::inlineAttachments(const QJsonValue &value,
+                                                     const QList<QByteArray> &attachments)
+{
+    if (value.isArray()) {
+        QJsonArray array = value.toArray();
+        for (int i = 0; i < array.size(); ++i)
+            array.replace(i, inlineAttachments(array.at(i), attachments));
+        return array;
+    }
+
+    if (!value.isObject())
+        return value;
+
+    const int index = attachmentIndex(value);
+    if (index >= 0 && index < attachments.size())
+        return QString::fromLatin1(attachments.at(index).toBase64());
+
+    QJsonObject object = value.toObject();
+    for (QJsonObject::iterator it = object.begin(); it != object.end(); ++it)
+        it.value() = inlineAttachments(it.value(), attachments);
+    return object;
+}
+
+QJsonRpcMessage QJsonRpcMessagePrivate::inlineAttachments(const QJsonRpcMessage &message)
+{
+    const QList<QByteArray> &attachments = message.d->attachments;
+    if (attachments.isEmpty())
+        return message;
 
-    QJsonObject error =
-        d->object->value(QLatin1String("error")).toObject();
-    return error.value(QLatin1String("data"));
+    QJsonObject object = message.toObject();
+    if (object.contains(keys().params))
+        object.insert(keys().params, inlineAttachments(object.value(keys().params), attachments));
+    if (object.contains(keys().result))
+        object.insert(keys().result, inlineAttachments(object.value(keys().result), attachments));
+    return QJsonRpcMessage::fromObject(object);
 }
 
 #if QT_VERSION < 0x050000
@@ -19,6 +19,8 @@
 
 #include <QSharedDataPointer>
 #include <QMetaType>
+#include <QList>
+#include <QByteArray>
 
 #if QT_VERSION >= 0x050000
 #include <QJsonValue>
@@ -71,7 +73,8 @@ public:
 
     QJsonRpcMessage::Type type() const;
     bool isValid() const;
-    int id() const;
+    // unique per process for requests created here, -1 for notifications
+    qint64 id() const;
 
     // request
     QString method() const;
@@ -80,11 +83,30 @@ public:
     // response
     QJsonValue result() const;
 
+    // the value an RFC 6901 JSON Pointer such as "/items/0/name" refers to,
+    // undefined if there is none. Params and results that haven't been
+    // decoded yet are searched in the message's text, decoding only the
+    // value found
+    QJsonValue paramsValue(const QString &pointer) const;
+    QJsonValue resultValue(const QString &pointer) const;
+
     // error
     int errorCode() const;
     QString errorMessage() const;
     QJsonValue errorData() const;
 
+    // Binary data carried next to the message's JSON rather than in it,
+    // on sockets with attachments enabled, so it isn't base64 encoded.
+    // params and results refer to it by index through attachmentReference()
+    // values, which are replaced by base64 strings where attachments can't
+    // be carried
+    QList<QByteArray> attachments() const;
+    void setAttachments(const QList<QByteArray> &attachments);
+    static QJsonObject attachmentReference(int index);
+
+    // the data a reference, or a base64 string in its place, stands for
+    QByteArray attachment(const QJsonValue &reference) const;
+
     QJsonObject toObject() const;
     static QJsonRpcMessage fromObject(const QJsonObject &object);
 
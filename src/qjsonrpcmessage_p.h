@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCMESSAGE_P_H
+#define QJSONRPCMESSAGE_P_H
+
+#include <QSharedData>
+#include <QAtomicInt>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonDocument>
+#else
+#include "json/qjsondocument.h"
+#endif
+
+#include "qjsonrpcmessage.h"
+
+// the member names of the envelope, created once rather than converted from
+// a literal for every lookup
+class QJsonRpcKeys
+{
+public:
+    QJsonRpcKeys();
+
+    const QString jsonrpc;
+    const QString id;
+    const QString method;
+    const QString params;
+    const QString priority;
+    const QString timeout;
+    const QString result;
+    const QString error;
+    const QString code;
+    const QString message;
+    const QString data;
+    const QString value;
+};
+
+class QJsonRpcMessagePrivate : public QSharedData
+{
+public:
+    QJsonRpcMessagePrivate();
+    ~QJsonRpcMessagePrivate();
+    QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other);
+
+    // recycled through a per-thread pool, one is allocated for every message
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
+    static const QJsonRpcKeys &keys();
+    static QJsonRpcMessagePrivate *get(QJsonRpcMessage &message) { return message.d.data(); }
+
+    void initializeWithObject(const QJsonObject &message);
+    static QJsonRpcMessage::Type messageType(bool hasId, bool hasMethod, bool hasResult,
+                                             bool hasError, bool isError);
+
+    // parses an object directly into a message, without a QJsonDocument for
+    // the envelope. The text is kept to preserve unknown members, so it must
+    // not be raw data
+    static QJsonRpcMessage fromJson(const QByteArray &json, QJsonParseError *error);
+    QJsonObject buildObject() const;
+    static int toInt(const QJsonValue &value);
+    static qint64 toId(const QJsonValue &value);
+    static qint64 nextRequestId();
+    static QJsonRpcMessage createBasicRequest(const QString &method, const QJsonValue &params);
+
+    // of a request's optional "priority" member, "high", "normal" or "low",
+    // -1 without one
+    static int priority(const QJsonRpcMessage &message) { return message.d->priority; }
+    static int priorityFromValue(const QJsonValue &value);
+
+    // of a request's optional "timeout" member, the milliseconds its caller
+    // still waits for the response, -1 without one. Its deadline is counted
+    // from when the message was read or given a timeout, clocks of peers
+    // aren't compared
+    static int timeout(const QJsonRpcMessage &message) { return message.d->timeout; }
+    static QJsonRpcMessage withTimeout(const QJsonRpcMessage &message, int msecs);
+    // milliseconds left until the deadline, 0 once past it, -1 without one
+    static qint64 remainingTime(const QJsonRpcMessage &message);
+    static bool isExpired(const QJsonRpcMessage &message) { return remainingTime(message) == 0; }
+    static qint64 monotonicMsecs();
+    void setTimeout(int msecs);
+    void setTimeout(const QJsonValue &value);      // ignored unless a number
+
+    // as sent, a number, a string or null
+    static QJsonValue idValue(const QJsonRpcMessage &message) { return message.d->idValue; }
+
+    // the batch a request was read in, counted by the socket reading it, 0
+    // outside of one. Responses created for the request carry it along, so
+    // that they are collected for that batch only
+    static quint32 batch(const QJsonRpcMessage &message) { return message.d->batch; }
+    static QJsonRpcMessage withBatch(const QJsonRpcMessage &message, quint32 batch);
+
+    // the HTTP/2 stream a request arrived on, 0 for none, carried along to
+    // its responses like the batch
+    static quint32 stream(const QJsonRpcMessage &message) { return message.d->stream; }
+    static QJsonRpcMessage withStream(const QJsonRpcMessage &message, quint32 stream);
+
+    // the size of the text a message was parsed from, 0 otherwise
+    static int textSize(const QJsonRpcMessage &message) { return message.d->json.size(); }
+
+    // "$/partialResult" notifications carry parts of a result ahead of the
+    // response, tagged with the id of their request
+    static QJsonRpcMessage createPartialResult(const QJsonRpcMessage &request, const QJsonValue &value);
+    static bool isPartialResult(const QJsonRpcMessage &message);
+
+    // the message with another id, for relaying it. The text a message was
+    // read from is kept, only the id in it is replaced
+    static QJsonRpcMessage withId(const QJsonRpcMessage &message, const QJsonValue &id);
+
+    // a response whose result is written as the given text, which must be
+    // the compact serialization of result
+    static QJsonRpcMessage createResponse(const QJsonRpcMessage &request, const QJsonValue &result,
+                                          const QByteArray &resultJson);
+    // the response with its structured result serialized already, for the
+    // thread writing it
+    static QJsonRpcMessage withSerializedResult(const QJsonRpcMessage &response);
+
+    // appends compact JSON text, the envelope is written from fixed fragments
+    static void writeJson(const QJsonRpcMessage &message, QByteArray &data, bool stringIds = false);
+    static void writeValue(const QJsonValue &value, QByteArray &data);
+    static void writeObject(const QJsonObject &object, QByteArray &data);
+    static void writeArray(const QJsonArray &array, QByteArray &data);
+    static void writeString(const QString &string, QByteArray &data);
+    static void writeNumber(double number, QByteArray &data);
+
+    // index of the attachment value refers to, -1 if it isn't a reference
+    static int attachmentIndex(const QJsonValue &value);
+
+    // the message with its attachment references replaced by base64 strings
+    static QJsonRpcMessage inlineAttachments(const QJsonRpcMessage &message);
+    static QJsonValue inlineAttachments(const QJsonValue &value, const QList<QByteArray> &attachments);
+
+    // the envelope is parsed once into typed fields, so that routing and
+    // reply matching never look keys up in a QJsonObject
+    QJsonRpcMessage::Type type;
+    QJsonValue idValue;     // as sent, echoed back in responses
+    qint64 id;
+    QString method;
+    QJsonValue params;
+    QJsonValue result;
+    int errorCode;
+    QString errorMessage;
+    QJsonValue errorData;
+    int priority;
+    int timeout;
+    qint64 deadline;        // monotonicMsecs() it expires at, with a timeout
+    quint32 batch;
+    quint32 stream;
+
+    // structured params and results of a message read from text are left
+    // there, and only decoded when they are first asked for. Their spans in
+    // json hold as long as their flag is set
+    enum { ParamsPending = 1, ResultPending = 2 };
+    bool isPending(int value) const {
+        return const_cast<QAtomicInt &>(pending).fetchAndAddOrdered(0) & value;
+    }
+    void setPending(int value, int offset, int length);
+    void decodePending(int value) const;
+    QJsonValue valueAt(int value, const QString &pointer) const;
+    mutable QAtomicInt pending;
+    int paramsOffset;
+    int paramsLength;
+    int resultOffset;
+    int resultLength;
+    int idOffset;           // the span of the id in json, if any
+    int idLength;
+
+    // the object a message was read from, kept to preserve unknown members
+    QJsonObject object;
+    bool hasObject;
+    QByteArray json;        // the text a message was parsed from, when not read from an object
+    QByteArray resultJson;  // serialized result of a response, when known
+    QList<QByteArray> attachments;
+};
+
+// Reads a message while its text arrives, in place of scanning for the end
+// of the frame first. feed() is handed all of the text received so far,
+// which may have moved since the previous call, and carries on where that
+// one stopped: each member of the envelope is decoded as soon as its end is
+// there. Batches are only delimited, their array is read as a whole
+class QJsonRpcMessageParser;
+class QJSONRPC_EXPORT QJsonRpcIncrementalParser
+{
+public:
+    enum Status {
+        NeedMoreData,
+        Finished,
+        Failed      // once the malformed document has ended
+    };
+
+    QJsonRpcIncrementalParser();
+    ~QJsonRpcIncrementalParser();
+
+    void reset();
+    Status feed(const char *data, int size);
+
+    Status status() const { return state; }
+    bool isStarted() const { return depth != 0; }
+    bool isBatch() const { return batch; }
+    int documentStart() const { return start; }
+    int documentEnd() const { return offset; }     // once finished or failed
+    QJsonParseError parseError() const;
+
+    // of a finished object, the parser is reset for the next document
+    QJsonRpcMessage takeMessage();
+
+private:
+    Q_DISABLE_COPY(QJsonRpcIncrementalParser)
+    bool parseMember(const char *data, int memberEnd, bool last);
+    Status finish(const char *data, char close);
+    bool fail(QJsonParseError::ParseError parseError, int position);
+
+    QJsonRpcMessageParser *parser;
+    QJsonRpcMessage message;
+    Status state;
+    int offset;         // the next byte to look at
+    int start;          // of the opening bracket
+    int memberStart;    // just after the bracket or separator before the member
+    int members;
+    int depth;
+    bool batch;
+    bool inString;
+    bool escaped;
+    QJsonParseError::ParseError error;
+    int errorOffset;
+};
+
+#endif
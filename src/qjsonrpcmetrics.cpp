@@ -0,0 +1,389 @@
+#include <QMap>
+
+#include <math.h>
+
+#include "qjsonrpcmessage.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcpool_p.h"
+#include "qjsonrpcmetrics_p.h"
+
+// latencies above are counted in the last bucket
+static const qint64 MaximumLatency = (Q_INT64_C(1) << 37) - 1;
+
+static int highestBit(quint64 value)
+{
+    int bit = 0;
+    while (value >>= 1)
+        bit++;
+    return bit;
+}
+
+QJsonRpcMethodMetricsData::QJsonRpcMethodMetricsData()
+    : calls(0),
+      errors(0),
+      bytesIn(0),
+      bytesOut(0),
+      totalLatency(0),
+      minimumLatency(0),
+      maximumLatency(0)
+{
+}
+
+int QJsonRpcMethodMetricsData::bucketIndex(qint64 usecs)
+{
+    const qint64 value = qBound(Q_INT64_C(0), usecs, MaximumLatency);
+    if (value < 2 * SubBuckets)
+        return int(value);
+
+    // the four bits below the highest one pick the bucket within its power
+    const int shift = highestBit(quint64(value)) - 4;
+    return SubBuckets * (shift + 1) + int(value >> shift) - SubBuckets;
+}
+
+void QJsonRpcMethodMetricsData::record(qint64 usecs, int errorCode, qint64 in, qint64 out)
+{
+    usecs = qMax(usecs, Q_INT64_C(0));
+    if (!calls || usecs < minimumLatency)
+        minimumLatency = usecs;
+    if (usecs > maximumLatency)
+        maximumLatency = usecs;
+
+    calls++;
+    totalLatency += usecs;
+    bytesIn += in;
+    bytesOut += out;
+    if (errorCode != QJsonRpc::NoError) {
+        errors++;
+        errorsByCode[errorCode]++;
+    }
+
+    const int bucket = bucketIndex(usecs);
+    if (bucket >= buckets.size())
+        buckets.resize(bucket + 1);
+    buckets[bucket]++;
+}
+
+void QJsonRpcMethodMetricsData::merge(const QJsonRpcMethodMetricsData &other)
+{
+    if (!other.calls)
+        return;
+
+    if (!calls || other.minimumLatency < minimumLatency)
+        minimumLatency = other.minimumLatency;
+    if (other.maximumLatency > maximumLatency)
+        maximumLatency = other.maximumLatency;
+
+    calls += other.calls;
+    errors += other.errors;
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    totalLatency += other.totalLatency;
+    QHash<int, quint64>::const_iterator it;
+    for (it = other.errorsByCode.constBegin(); it != other.errorsByCode.constEnd(); ++it)
+        errorsByCode[it.key()] += it.value();
+
+    if (other.buckets.size() > buckets.size())
+        buckets.resize(other.buckets.size());
+    for (int i = 0; i < other.buckets.size(); ++i)
+        buckets[i] += other.buckets.at(i);
+}
+
+QJsonRpcMethodMetrics::QJsonRpcMethodMetrics()
+    : d(new QJsonRpcMethodMetricsData)
+{
+}
+
+QJsonRpcMethodMetrics::QJsonRpcMethodMetrics(const QJsonRpcMethodMetrics &other)
+    : d(other.d)
+{
+}
+
+QJsonRpcMethodMetrics &QJsonRpcMethodMetrics::operator=(const QJsonRpcMethodMetrics &other)
+{
+    d = other.d;
+    return *this;
+}
+
+QJsonRpcMethodMetrics::~QJsonRpcMethodMetrics()
+{
+}
+
+bool QJsonRpcMethodMetrics::isEmpty() const
+{
+    return !d->calls;
+}
+
+QString QJsonRpcMethodMetrics::name() const
+{
+    return d->name;
+}
+
+quint64 QJsonRpcMethodMetrics::calls() const
+{
+    return d->calls;
+}
+
+quint64 QJsonRpcMethodMetrics::errors() const
+{
+    return d->errors;
+}
+
+quint64 QJsonRpcMethodMetrics::errors(int code) const
+{
+    return d->errorsByCode.value(code);
+}
+
+QList<int> QJsonRpcMethodMetrics::errorCodes() const
+{
+    QList<int> codes = d->errorsByCode.keys();
+    qSort(codes);
+    return codes;
+}
+
+quint64 QJsonRpcMethodMetrics::bytesIn() const
+{
+    return d->bytesIn;
+}
+
+quint64 QJsonRpcMethodMetrics::bytesOut() const
+{
+    return d->bytesOut;
+}
+
+qint64 QJsonRpcMethodMetrics::minimumLatency() const
+{
+    return d->minimumLatency;
+}
+
+qint64 QJsonRpcMethodMetrics::maximumLatency() const
+{
+    return d->maximumLatency;
+}
+
+double QJsonRpcMethodMetrics::meanLatency() const
+{
+    return d->calls ? double(d->totalLatency) / d->calls : 0.0;
+}
+
+qint64 QJsonRpcMethodMetrics::latencyPercentile(double percentile) const
+{
+    if (!d->calls)
+        return 0;
+
+    // the highest latency of the bucket holding that rank, but never past
+    // what was measured
+    const double fraction = qBound(0.0, percentile, 100.0) / 100.0;
+    const quint64 rank = qMax(quint64(1), quint64(ceil(fraction * d->calls)));
+    quint64 count = 0;
+    for (int i = 0; i < d->buckets.size(); ++i) {
+        count += d->buckets.at(i);
+        if (count >= rank)
+            return qBound(d->minimumLatency, latencyBucketLowerBound(i + 1) - 1, d->maximumLatency);
+    }
+
+    return d->maximumLatency;
+}
+
+int QJsonRpcMethodMetrics::latencyBucketCount() const
+{
+    return d->buckets.size();
+}
+
+quint64 QJsonRpcMethodMetrics::latencyBucket(int bucket) const
+{
+    return d->buckets.value(bucket);
+}
+
+qint64 QJsonRpcMethodMetrics::latencyBucketLowerBound(int bucket)
+{
+    const int subBuckets = QJsonRpcMethodMetricsData::SubBuckets;
+    if (bucket < 2 * subBuckets)
+        return qMax(bucket, 0);
+
+    const int shift = bucket / subBuckets - 1;
+    return qint64(subBuckets + bucket % subBuckets) << shift;
+}
+
+void QJsonRpcMethodMetrics::merge(const QJsonRpcMethodMetrics &other)
+{
+    d->merge(*other.d);
+}
+
+QJsonObject QJsonRpcMethodMetrics::toJson() const
+{
+    QJsonObject object;
+    object.insert(QLatin1String("calls"), double(d->calls));
+    object.insert(QLatin1String("errors"), double(d->errors));
+    object.insert(QLatin1String("bytesIn"), double(d->bytesIn));
+    object.insert(QLatin1String("bytesOut"), double(d->bytesOut));
+
+    QJsonObject errorsByCode;
+    foreach (int code, errorCodes())
+        errorsByCode.insert(QString::number(code), double(d->errorsByCode.value(code)));
+    object.insert(QLatin1String("errorsByCode"), errorsByCode);
+
+    QJsonObject latency;
+    latency.insert(QLatin1String("min"), double(d->minimumLatency));
+    latency.insert(QLatin1String("mean"), meanLatency());
+    latency.insert(QLatin1String("p50"), double(latencyPercentile(50)));
+    latency.insert(QLatin1String("p90"), double(latencyPercentile(90)));
+    latency.insert(QLatin1String("p99"), double(latencyPercentile(99)));
+    latency.insert(QLatin1String("p999"), double(latencyPercentile(99.9)));
+    latency.insert(QLatin1String("max"), double(d->maximumLatency));
+    object.insert(QLatin1String("latency"), latency);
+    return object;
+}
+
+static QAtomicInt nextMetricsId(1);
+
+QJsonRpcMetrics::QJsonRpcMetrics()
+    : id(nextMetricsId.fetchAndAddOrdered(1))
+{
+}
+
+QJsonRpcMetrics::~QJsonRpcMetrics()
+{
+    qDeleteAll(threads);
+}
+
+QJsonRpcMetrics::ThreadCounters *QJsonRpcMetrics::threadCounters()
+{
+#if defined(QJSONRPC_HAS_THREAD_LOCAL)
+    // the counters of every metrics this thread recorded into, by id
+    static thread_local QHash<int, ThreadCounters *> counters;
+    ThreadCounters *&local = counters[id];
+    if (!local) {
+        local = new ThreadCounters;
+        QMutexLocker locker(&mutex);
+        threads.append(local);
+    }
+    return local;
+#else
+    // shared by every thread without thread_local
+    QMutexLocker locker(&mutex);
+    if (threads.isEmpty())
+        threads.append(new ThreadCounters);
+    return threads.first();
+#endif
+}
+
+void QJsonRpcMetrics::record(const QString &method, qint64 usecs, int errorCode,
+                             qint64 bytesIn, qint64 bytesOut)
+{
+    ThreadCounters *local = threadCounters();
+    QMutexLocker locker(&local->mutex);
+    local->methods[method].d->record(usecs, errorCode, bytesIn, bytesOut);
+}
+
+QList<QJsonRpcMethodMetrics> QJsonRpcMetrics::snapshot() const
+{
+    QMap<QString, QJsonRpcMethodMetrics> merged;
+    QMutexLocker locker(&mutex);
+    foreach (ThreadCounters *local, threads) {
+        QMutexLocker threadLocker(&local->mutex);
+        QHash<QString, QJsonRpcMethodMetrics>::const_iterator it;
+        for (it = local->methods.constBegin(); it != local->methods.constEnd(); ++it) {
+            QJsonRpcMethodMetrics &metrics = merged[it.key()];
+            metrics.d->name = it.key();
+            metrics.d->merge(*it.value().d);
+        }
+    }
+
+    return merged.values();
+}
+
+QJsonRpcMethodMetrics QJsonRpcMetrics::find(const QString &name) const
+{
+    QJsonRpcMethodMetrics total;
+    total.d->name = name;
+    const QString prefix = name + QLatin1Char('.');
+    foreach (const QJsonRpcMethodMetrics &method, snapshot()) {
+        if (method.name() == name)
+            return method;
+        if (method.name().startsWith(prefix))
+            total.merge(method);
+    }
+
+    return total;
+}
+
+void QJsonRpcMetrics::reset()
+{
+    QMutexLocker locker(&mutex);
+    foreach (ThreadCounters *local, threads) {
+        QMutexLocker threadLocker(&local->mutex);
+        local->methods.clear();
+    }
+}
+
+QJsonRpcCall::QJsonRpcCall(const QJsonRpcMessage &request, QJsonRpcAbstractSocket *socket)
+    : QJsonRpcCallContext(request, socket),
+      finished(0)
+{
+}
+
+QJsonRpcMessage QJsonRpcCall::beforeDispatch(const QList<QJsonRpcInterceptor *> &chain)
+{
+    for (int i = 0; i < chain.size(); ++i) {
+        QJsonRpcMessage message = chain.at(i)->beforeDispatch(*this);
+        if (message.isValid()) {
+            interceptors = chain.mid(0, i + 1);
+            return message;
+        }
+    }
+
+    interceptors = chain;
+    return QJsonRpcMessage();
+}
+
+void QJsonRpcCall::setMetrics(const QSharedPointer<QJsonRpcMetrics> &metrics)
+{
+    this->metrics = metrics;
+}
+
+void QJsonRpcCall::finish(const QJsonRpcMessage &response)
+{
+    if (!finished.testAndSetOrdered(0, 1))
+        return;
+
+    if (metrics) {
+        const qint64 usecs = elapsed() / 1000;
+        int errorCode = QJsonRpc::NoError;
+        qint64 bytesOut = 0;
+        if (response.isValid()) {
+            if (response.type() == QJsonRpcMessage::Error)
+                errorCode = response.errorCode();
+
+            QByteArray text;
+            QJsonRpcMessagePrivate::writeJson(response, text);
+            bytesOut = text.size();
+        }
+
+        const QJsonRpcMessage message = request();
+        metrics->record(message.method(), usecs, errorCode,
+                        QJsonRpcMessagePrivate::textSize(message), bytesOut);
+    }
+
+    for (int i = interceptors.size() - 1; i >= 0; --i)
+        interceptors.at(i)->afterDispatch(*this, response);
+}
+
+QJsonRpcStatsService::QJsonRpcStatsService(const QSharedPointer<QJsonRpcMetrics> &metrics,
+                                           QObject *parent)
+    : QJsonRpcService(parent),
+      metrics(metrics)
+{
+}
+
+QVariantMap QJsonRpcStatsService::stats() const
+{
+    QVariantMap result;
+    foreach (const QJsonRpcMethodMetrics &method, metrics->snapshot())
+        result.insert(method.name(), method.toJson().toVariantMap());
+    return result;
+}
+
+QVariantMap QJsonRpcStatsService::stats(const QString &name) const
+{
+    return metrics->find(name).toJson().toVariantMap();
+}
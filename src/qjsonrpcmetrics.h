@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCMETRICS_H
+#define QJSONRPCMETRICS_H
+
+#include <QSharedDataPointer>
+#include <QString>
+#include <QList>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonObject>
+#else
+#include "json/qjsonobject.h"
+#endif
+
+#include "qjsonrpcglobal.h"
+
+// What a service provider recorded for one method, "service.method", or
+// for all the methods of a service, see
+// QJsonRpcServiceProvider::setMetricsEnabled(). Latencies are in
+// microseconds, from a request being handed to its service until its
+// response is sent, and are kept in a histogram whose buckets are at most
+// 1/16th of their lower bound wide, so percentiles are within that of the
+// latencies measured.
+class QJsonRpcMethodMetricsData;
+class QJSONRPC_EXPORT QJsonRpcMethodMetrics
+{
+public:
+    QJsonRpcMethodMetrics();
+    QJsonRpcMethodMetrics(const QJsonRpcMethodMetrics &other);
+    QJsonRpcMethodMetrics &operator=(const QJsonRpcMethodMetrics &other);
+    ~QJsonRpcMethodMetrics();
+
+    bool isEmpty() const;
+    QString name() const;
+
+    quint64 calls() const;
+    // responses that were errors, in all or of one QJsonRpc::ErrorCode
+    quint64 errors() const;
+    quint64 errors(int code) const;
+    QList<int> errorCodes() const;
+
+    // of the requests as read and of the responses as compact JSON text
+    quint64 bytesIn() const;
+    quint64 bytesOut() const;
+
+    qint64 minimumLatency() const;
+    qint64 maximumLatency() const;
+    double meanLatency() const;
+    // the latency below which percentile percent of the calls were, 0 to 100
+    qint64 latencyPercentile(double percentile) const;
+
+    // calls by latency, those of bucket i took from latencyBucketLowerBound(i)
+    // up to latencyBucketLowerBound(i + 1)
+    int latencyBucketCount() const;
+    quint64 latencyBucket(int bucket) const;
+    static qint64 latencyBucketLowerBound(int bucket);
+
+    // the counts of both, under the name of this one
+    void merge(const QJsonRpcMethodMetrics &other);
+
+    // with percentiles rather than buckets, as the rpc.stats service
+    // returns them
+    QJsonObject toJson() const;
+
+private:
+    friend class QJsonRpcMetrics;
+    QSharedDataPointer<QJsonRpcMethodMetricsData> d;
+};
+
+#endif
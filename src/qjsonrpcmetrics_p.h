@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCMETRICS_P_H
+#define QJSONRPCMETRICS_P_H
+
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QVariantMap>
+
+#include "qjsonrpcservice.h"
+#include "qjsonrpcmetrics.h"
+#include "qjsonrpcinterceptor.h"
+
+class QJsonRpcMethodMetricsData : public QSharedData
+{
+public:
+    QJsonRpcMethodMetricsData();
+
+    void record(qint64 usecs, int errorCode, qint64 in, qint64 out);
+    void merge(const QJsonRpcMethodMetricsData &other);
+
+    // log-linear buckets: exact below 32, then 16 per power of two up to
+    // latencies of 2^37 usecs, about 38 hours
+    enum { SubBuckets = 16, MaximumBucket = SubBuckets * 34 - 1 };
+    static int bucketIndex(qint64 usecs);
+
+    QString name;
+    quint64 calls;
+    quint64 errors;
+    quint64 bytesIn;
+    quint64 bytesOut;
+    quint64 totalLatency;
+    qint64 minimumLatency;
+    qint64 maximumLatency;
+    QHash<int, quint64> errorsByCode;
+    QVector<quint64> buckets;       // grown to the highest one used
+};
+
+// Counters of a service provider, kept apart for every thread recording
+// into them so that calls only take the lock of their own thread, which
+// nothing else holds but a snapshot being taken. Counters of threads that
+// exit stay until the metrics are reset.
+class QJsonRpcMetrics
+{
+public:
+    QJsonRpcMetrics();
+    ~QJsonRpcMetrics();
+
+    // errorCode is QJsonRpc::NoError for responses that aren't errors
+    void record(const QString &method, qint64 usecs, int errorCode, qint64 bytesIn, qint64 bytesOut);
+
+    // sorted by name
+    QList<QJsonRpcMethodMetrics> snapshot() const;
+    // of a method by its full name, or of all those of a service
+    QJsonRpcMethodMetrics find(const QString &name) const;
+    void reset();
+
+private:
+    struct ThreadCounters
+    {
+        QMutex mutex;
+        QHash<QString, QJsonRpcMethodMetrics> methods;
+    };
+    ThreadCounters *threadCounters();
+
+    const int id;               // never reused, so threads can find theirs
+    mutable QMutex mutex;
+    QList<ThreadCounters *> threads;
+    Q_DISABLE_COPY(QJsonRpcMetrics)
+};
+
+// A request or notification on its way through a service provider, created
+// for its interceptors or its metrics and finished once it is answered.
+// Like admissions, calls may be finished from any thread.
+class QJSONRPC_EXPORT QJsonRpcCall : public QJsonRpcCallContext
+{
+public:
+    QJsonRpcCall(const QJsonRpcMessage &request, QJsonRpcAbstractSocket *socket);
+
+    // runs the interceptors in turn until one of them short-circuits the
+    // call, returning its message
+    QJsonRpcMessage beforeDispatch(const QList<QJsonRpcInterceptor *> &chain);
+    // recorded once finished, for routed methods
+    void setMetrics(const QSharedPointer<QJsonRpcMetrics> &metrics);
+
+    // with the response sent, or an invalid one for notifications; only the
+    // first call counts
+    void finish(const QJsonRpcMessage &response);
+
+private:
+    QList<QJsonRpcInterceptor *> interceptors;      // those that ran
+    QSharedPointer<QJsonRpcMetrics> metrics;
+    QAtomicInt finished;
+    Q_DISABLE_COPY(QJsonRpcCall)
+};
+typedef QSharedPointer<QJsonRpcCall> QJsonRpcCallPointer;
+
+// the built-in "rpc" service, its stats method returns the metrics of every
+// method by name, or of one method or service
+class QJsonRpcStatsService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "rpc")
+public:
+    QJsonRpcStatsService(const QSharedPointer<QJsonRpcMetrics> &metrics, QObject *parent = 0);
+
+public Q_SLOTS:
+    QVariantMap stats() const;
+    QVariantMap stats(const QString &name) const;
+
+private:
+    QSharedPointer<QJsonRpcMetrics> metrics;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCMPSCQUEUE_P_H
+#define QJSONRPCMPSCQUEUE_P_H
+
+#include <QAtomicPointer>
+
+#include "qjsonrpcglobal.h"
+
+// An unbounded queue any number of threads enqueue to without taking a
+// lock, drained by a single consumer thread. Producers swap themselves in
+// as the head and link the previous one after, so the consumer may briefly
+// see the queue end early while a producer is between both steps; whoever
+// wakes the consumer has to do so after enqueueing.
+template <typename T>
+class QJsonRpcMpscQueue
+{
+public:
+    QJsonRpcMpscQueue() : head(&stub), tail(&stub) {}
+    ~QJsonRpcMpscQueue()
+    {
+        T value;
+        while (dequeue(&value)) {}
+    }
+
+    // any thread
+    void enqueue(const T &value)
+    {
+        push(new Node(value));
+    }
+
+    // the consumer thread only
+    bool dequeue(T *value)
+    {
+        Node *first = tail;
+        Node *next = load(first->next);
+        if (first == &stub) {
+            if (!next)
+                return false;
+            tail = next;
+            first = next;
+            next = load(next->next);
+        }
+
+        if (!next) {
+            // a producer is linking its node
+            if (first != load(head))
+                return false;
+
+            // the last node can only be taken with the stub behind it
+            stub.next.fetchAndStoreOrdered(0);
+            push(&stub);
+            next = load(first->next);
+            if (!next)
+                return false;
+        }
+
+        tail = next;
+        *value = first->value;
+        delete first;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        Node() {}
+        explicit Node(const T &value) : value(value) {}
+
+        QAtomicPointer<Node> next;
+        T value;
+    };
+
+    static Node *load(QAtomicPointer<Node> &pointer)
+    {
+        return pointer.fetchAndAddOrdered(0);
+    }
+
+    void push(Node *node)
+    {
+        Node *previous = head.fetchAndStoreOrdered(node);
+        previous->next.fetchAndStoreOrdered(node);
+    }
+
+    QAtomicPointer<Node> head;  // the last enqueued, written by producers
+    Node *tail;                 // the next to dequeue, the consumer's
+    Node stub;
+
+    Q_DISABLE_COPY(QJsonRpcMpscQueue)
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCPARAMS_H
+#define QJSONRPCPARAMS_H
+
+#include <QVariant>
+#include <QStringList>
+
+#include <cstddef>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonValue>
+#include <QJsonArray>
+#include <QJsonObject>
+#else
+#include "json/qjsonvalue.h"
+#include "json/qjsonarray.h"
+#include "json/qjsonobject.h"
+#endif
+
+#include "qjsonrpcglobal.h"
+
+// Converts the arguments of a call to the JSON values of its params. Types
+// JSON has a value for are converted directly, any other goes through
+// QVariant. Specialize it for types of your own:
+//
+//     template <>
+//     struct QJsonRpcParamConverter<Point>
+//     {
+//         static QJsonValue toJson(const Point &point)
+//         {
+//             QJsonArray xy;
+//             xy.append(point.x);
+//             xy.append(point.y);
+//             return xy;
+//         }
+//     };
+template <typename T>
+struct QJsonRpcParamConverter
+{
+    static QJsonValue toJson(const T &value)
+    {
+        return QJsonValue::fromVariant(QVariant::fromValue(value));
+    }
+};
+
+#define QJSONRPC_DECLARE_PARAM_CONVERTER(Type, Expression) \
+    template <> \
+    struct QJsonRpcParamConverter<Type> \
+    { \
+        static QJsonValue toJson(const Type &value) { return Expression; } \
+    };
+
+QJSONRPC_DECLARE_PARAM_CONVERTER(bool, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(int, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(uint, QJsonValue(qint64(value)))
+QJSONRPC_DECLARE_PARAM_CONVERTER(qint64, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(float, QJsonValue(double(value)))
+QJSONRPC_DECLARE_PARAM_CONVERTER(double, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QString, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QLatin1String, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QStringList, QJsonArray::fromStringList(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QVariant, QJsonValue::fromVariant(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QVariantList, QJsonArray::fromVariantList(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QVariantMap, QJsonObject::fromVariantMap(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QJsonValue, value)
+QJSONRPC_DECLARE_PARAM_CONVERTER(QJsonArray, QJsonValue(value))
+QJSONRPC_DECLARE_PARAM_CONVERTER(QJsonObject, QJsonValue(value))
+
+#undef QJSONRPC_DECLARE_PARAM_CONVERTER
+
+// string literals and C strings, taken as UTF-8
+template <>
+struct QJsonRpcParamConverter<const char *>
+{
+    static QJsonValue toJson(const char *value) { return QJsonValue(QString::fromUtf8(value)); }
+};
+
+template <>
+struct QJsonRpcParamConverter<char *>
+{
+    static QJsonValue toJson(const char *value) { return QJsonValue(QString::fromUtf8(value)); }
+};
+
+template <size_t N>
+struct QJsonRpcParamConverter<char[N]>
+{
+    static QJsonValue toJson(const char *value) { return QJsonValue(QString::fromUtf8(value)); }
+};
+
+#if defined(QJSONRPC_HAS_VARIADIC_TEMPLATES)
+inline void qJsonRpcAppendParams(QJsonArray &params)
+{
+    Q_UNUSED(params)
+}
+
+template <typename T, typename... Args>
+inline void qJsonRpcAppendParams(QJsonArray &params, const T &value, const Args &... args)
+{
+    params.append(QJsonRpcParamConverter<T>::toJson(value));
+    qJsonRpcAppendParams(params, args...);
+}
+
+// the positional params of a call, in the order of the arguments
+template <typename... Args>
+inline QJsonArray qJsonRpcParams(const Args &... args)
+{
+    QJsonArray params;
+    qJsonRpcAppendParams(params, args...);
+    return params;
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCPOOL_P_H
+#define QJSONRPCPOOL_P_H
+
+#include <new>
+#include <cstddef>
+
+#include "qjsonrpcglobal.h"
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#   define QJSONRPC_HAS_THREAD_LOCAL
+#endif
+
+// Recycles the memory of objects of one class through a free list per
+// thread, so that objects created and destroyed at a steady rate stop
+// reaching the allocator. Memory freed on another thread than it was
+// allocated on goes to that thread's list. Only blocks of exactly
+// sizeof(T) are kept, subclasses fall through to the global operators.
+//
+// Used from class specific operators:
+//     static void *operator new(size_t size) { return QJsonRpcPool<T>::allocate(size); }
+//     static void operator delete(void *p, size_t size) { QJsonRpcPool<T>::release(p, size); }
+template <typename T, int MaximumCached = 256>
+class QJsonRpcPool
+{
+public:
+    static void *allocate(size_t size)
+    {
+#if defined(QJSONRPC_HAS_THREAD_LOCAL)
+        if (size == sizeof(T)) {
+            FreeList &list = freeList();
+            if (list.head) {
+                Block *block = list.head;
+                list.head = block->next;
+                list.count--;
+                return block;
+            }
+        }
+#endif
+        return ::operator new(size);
+    }
+
+    static void release(void *p, size_t size)
+    {
+        if (!p)
+            return;
+
+#if defined(QJSONRPC_HAS_THREAD_LOCAL)
+        if (size == sizeof(T)) {
+            FreeList &list = freeList();
+            if (list.count < MaximumCached) {
+                Block *block = static_cast<Block *>(p);
+                block->next = list.head;
+                list.head = block;
+                list.count++;
+                return;
+            }
+        }
+#else
+        Q_UNUSED(size)
+#endif
+        ::operator delete(p);
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+#if defined(QJSONRPC_HAS_THREAD_LOCAL)
+    struct FreeList
+    {
+        FreeList() : head(0), count(0) {}
+        ~FreeList()
+        {
+            while (head) {
+                Block *block = head;
+                head = block->next;
+                ::operator delete(block);
+            }
+
+            // objects destroyed later during thread exit are freed directly
+            count = MaximumCached;
+        }
+
+        Block *head;
+        int count;
+    };
+
+    static FreeList &freeList()
+    {
+        static thread_local FreeList list;
+        return list;
+    }
+#endif
+};
+
+#endif
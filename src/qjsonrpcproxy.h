@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCPROXY_H
+#define QJSONRPCPROXY_H
+
+#include "qjsonrpcsocket.h"
+#include "qjsonrpcservicereply.h"
+#include "qjsonrpcparams.h"
+
+// Converts the result of a call back to the type the service returned.
+// Types JSON has a value for are read directly, any other goes through
+// QVariant. Specialize it along with QJsonRpcParamConverter for types of
+// your own.
+template <typename T>
+struct QJsonRpcResultConverter
+{
+    static T fromJson(const QJsonValue &value)
+    {
+        return value.toVariant().value<T>();
+    }
+};
+
+#define QJSONRPC_DECLARE_RESULT_CONVERTER(Type, Expression) \
+    template <> \
+    struct QJsonRpcResultConverter<Type> \
+    { \
+        static Type fromJson(const QJsonValue &value) { return Expression; } \
+    };
+
+QJSONRPC_DECLARE_RESULT_CONVERTER(bool, value.toBool())
+QJSONRPC_DECLARE_RESULT_CONVERTER(int, int(value.toDouble()))
+QJSONRPC_DECLARE_RESULT_CONVERTER(uint, uint(value.toDouble()))
+QJSONRPC_DECLARE_RESULT_CONVERTER(qint64, qint64(value.toDouble()))
+QJSONRPC_DECLARE_RESULT_CONVERTER(float, float(value.toDouble()))
+QJSONRPC_DECLARE_RESULT_CONVERTER(double, value.toDouble())
+QJSONRPC_DECLARE_RESULT_CONVERTER(QString, value.toString())
+QJSONRPC_DECLARE_RESULT_CONVERTER(QVariant, value.toVariant())
+QJSONRPC_DECLARE_RESULT_CONVERTER(QVariantList, value.toArray().toVariantList())
+QJSONRPC_DECLARE_RESULT_CONVERTER(QVariantMap, value.toObject().toVariantMap())
+QJSONRPC_DECLARE_RESULT_CONVERTER(QJsonValue, value)
+QJSONRPC_DECLARE_RESULT_CONVERTER(QJsonArray, value.toArray())
+QJSONRPC_DECLARE_RESULT_CONVERTER(QJsonObject, value.toObject())
+
+#undef QJSONRPC_DECLARE_RESULT_CONVERTER
+
+template <>
+struct QJsonRpcResultConverter<QStringList>
+{
+    static QStringList fromJson(const QJsonValue &value)
+    {
+        QStringList strings;
+        const QJsonArray array = value.toArray();
+        for (int i = 0; i < array.size(); ++i)
+            strings.append(array.at(i).toString());
+        return strings;
+    }
+};
+
+// The response to a call of a typed proxy, with its result converted
+template <typename T>
+class QJsonRpcResult
+{
+public:
+    explicit QJsonRpcResult(const QJsonRpcMessage &response)
+        : m_response(response) {}
+
+    // false for errors, timeouts included
+    bool isValid() const { return m_response.type() == QJsonRpcMessage::Response; }
+    T value() const { return QJsonRpcResultConverter<T>::fromJson(m_response.result()); }
+    QJsonRpcMessage response() const { return m_response; }
+
+private:
+    QJsonRpcMessage m_response;
+};
+
+template <>
+class QJsonRpcResult<void>
+{
+public:
+    explicit QJsonRpcResult(const QJsonRpcMessage &response)
+        : m_response(response) {}
+
+    bool isValid() const { return m_response.type() == QJsonRpcMessage::Response; }
+    QJsonRpcMessage response() const { return m_response; }
+
+private:
+    QJsonRpcMessage m_response;
+};
+
+// Base of the client stubs qjsonrpc-proxygen writes for a QJsonRpcService
+// subclass, one typed method per slot of the service:
+//
+//     qjsonrpc-proxygen -o calculatorproxy.h calculatorservice.h
+//
+//     CalculatorServiceProxy calculator(socket);
+//     QJsonRpcResult<int> sum = calculator.add(1, 2);
+//     QJsonRpcServiceReply *reply = calculator.addAsync(1, 2);
+//
+// Stubs hold their method names, built once, and append each argument to
+// the params with its QJsonRpcParamConverter, the socket isn't looked up
+// or asked to build anything.
+class QJsonRpcProxy
+{
+public:
+    explicit QJsonRpcProxy(QJsonRpcAbstractSocket *socket)
+        : m_socket(socket) {}
+    virtual ~QJsonRpcProxy() {}
+
+    QJsonRpcAbstractSocket *socket() const { return m_socket; }
+    void setSocket(QJsonRpcAbstractSocket *socket) { m_socket = socket; }
+
+protected:
+    QJsonRpcServiceReply *sendRequest(const QString &method, const QJsonArray &params) const
+    {
+        return m_socket->sendMessage(QJsonRpcMessage::createRequest(method, params));
+    }
+
+    QJsonRpcMessage sendRequestBlocking(const QString &method, const QJsonArray &params, int msecs) const
+    {
+        return m_socket->sendMessageBlocking(QJsonRpcMessage::createRequest(method, params), msecs);
+    }
+
+private:
+    QJsonRpcAbstractSocket *m_socket;
+};
+
+#endif
@@ -18,11 +18,14 @@
 #include <QVarLengthArray>
 #include <QMetaMethod>
 #include <QEventLoop>
+#include <QThreadStorage>
 #include <QDebug>
 
 #include "qjsonrpcsocket.h"
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcservice_p.h"
 #include "qjsonrpcservice.h"
+#include "qjsonrpcserviceprovider.h"
 
 QJsonRpcServiceRequest::QJsonRpcServiceRequest()
     : d(new QJsonRpcServiceRequestPrivate)
@@ -52,6 +55,16 @@ QJsonRpcServiceRequest::~QJsonRpcServiceRequest()
 {
 }
 
+bool QJsonRpcServiceRequest::isCancelled() const
+{
+    return d->cancellation && d->cancellation->isCancelled();
+}
+
+qint64 QJsonRpcServiceRequest::remainingTime() const
+{
+    return QJsonRpcMessagePrivate::remainingTime(d->request);
+}
+
 bool QJsonRpcServiceRequest::isValid() const
 {
     return (d && d->request.isValid() && !d->socket.isNull());
@@ -70,7 +83,7 @@ QJsonRpcAbstractSocket *QJsonRpcServiceRequest::socket() const
 bool QJsonRpcServiceRequest::respond(QVariant returnValue)
 {
     if (!d->socket) {
-        qJsonRpcDebug() << Q_FUNC_INFO << "socket was closed";
+        qJsonRpcDebug() << Q_FUNC_INFO << "no socket, or it was closed";
         return false;
     }
 
@@ -79,20 +92,80 @@ bool QJsonRpcServiceRequest::respond(QVariant returnValue)
     return respond(response);
 }
 
+bool QJsonRpcServiceRequest::sendPartialResult(QVariant value)
+{
+    if (!d->socket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "no socket, or it was closed";
+        return false;
+    }
+
+    if (d->request.type() != QJsonRpcMessage::Request || isCancelled())
+        return false;
+
+    QJsonRpcMessage partial = QJsonRpcMessagePrivate::createPartialResult(
+        d->request, QJsonRpcServicePrivate::convertReturnValue(value));
+    QJsonRpcAbstractSocketPrivate::post(d->socket, partial);
+    return true;
+}
+
 bool QJsonRpcServiceRequest::respond(const QJsonRpcMessage &response)
 {
     if (!d->socket) {
-        qJsonRpcDebug() << Q_FUNC_INFO << "socket was closed";
+        qJsonRpcDebug() << Q_FUNC_INFO << "no socket, or it was closed";
         return false;
     }
 
-    QMetaObject::invokeMethod(d->socket, "notify", Q_ARG(QJsonRpcMessage, response));
+    if (d->cancellation) {
+        if (d->cancellation->isCancelled()) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "request was cancelled";
+            return false;
+        }
+
+        QJsonRpcAbstractSocketPrivate::get(d->socket)->untrackRequest(d->request.id());
+        if (QJsonRpcService *service = qobject_cast<QJsonRpcService*>(d->cancellation->service.data()))
+            QJsonRpcServicePrivate::forgetRequest(service, *this);
+    }
+
+    if (d->admission)
+        d->admission->release();
+    if (d->call)
+        d->call->finish(response);
+    QJsonRpcAbstractSocketPrivate::post(d->socket, response);
     return true;
 }
 
+QJsonRpcServiceFutureWatcher::QJsonRpcServiceFutureWatcher(QJsonRpcService *service,
+                                                           const QJsonRpcServiceRequest &request,
+                                                           const QFuture<QVariant> &future)
+    : m_request(request)
+{
+    QJsonRpcServicePrivate::trackRequest(service, &m_request, this);
+    if (QJsonRpcAbstractSocket *socket = request.socket())
+        moveToThread(socket->thread());
+    connect(this, SIGNAL(finished()), this, SLOT(respond()));
+    setFuture(future);
+}
+
+void QJsonRpcServiceFutureWatcher::respond()
+{
+    const QJsonRpcMessage request = m_request.request();
+    if (request.type() == QJsonRpcMessage::Request) {
+        if (isCanceled()) {
+            m_request.respond(
+                request.createErrorResponse(QJsonRpc::InternalError, "request canceled"));
+        } else {
+            m_request.respond(future().resultCount() ? result() : QVariant());
+        }
+    }
+
+    deleteLater();
+}
+
 QJsonRpcServicePrivate::ParameterInfo::ParameterInfo(const QString &n, int t, bool o)
     : type(t),
       jsType(convertVariantTypeToJSType(t)),
+      kind(argumentKind(t)),
+      slot(-1),
       name(n),
       out(o)
 {
@@ -149,6 +222,158 @@ QJsonRpcServicePrivate::MethodInfo::MethodInfo(const QMetaMethod &method)
     }
 }
 
+namespace {
+struct QJsonRpcRequestContextStack
+{
+    QJsonRpcRequestContextStack() : top(0) {}
+    QJsonRpcServicePrivate::RequestContext *top;
+};
+}
+
+Q_GLOBAL_STATIC(QThreadStorage<QJsonRpcRequestContextStack *>, requestContexts)
+
+static QJsonRpcRequestContextStack *requestContextStack()
+{
+    QThreadStorage<QJsonRpcRequestContextStack *> *storage = requestContexts();
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QJsonRpcRequestContextStack);
+    return storage->localData();
+}
+
+QJsonRpcServicePrivate::RequestContext::RequestContext(QJsonRpcService *service,
+                                                      const QJsonRpcMessage &request,
+                                                      QJsonRpcAbstractSocket *socket,
+                                                      const QJsonRpcAdmissionPointer &admission,
+                                                      const QJsonRpcCallPointer &call)
+    : service(service),
+      request(request, socket),
+      delayedResponse(false)
+{
+    if (admission)
+        QJsonRpcServicePrivate::setAdmission(&this->request, admission);
+    if (call)
+        QJsonRpcServicePrivate::setCall(&this->request, call);
+
+    QJsonRpcRequestContextStack *stack = requestContextStack();
+    previous = stack->top;
+    stack->top = this;
+}
+
+void QJsonRpcServicePrivate::setAdmission(QJsonRpcServiceRequest *request,
+                                          const QJsonRpcAdmissionPointer &admission)
+{
+    request->d->admission = admission;
+}
+
+void QJsonRpcServicePrivate::setCall(QJsonRpcServiceRequest *request,
+                                     const QJsonRpcCallPointer &call)
+{
+    request->d->call = call;
+}
+
+void QJsonRpcServicePrivate::trackRequest(QJsonRpcService *service, QJsonRpcServiceRequest *request,
+                                          QObject *watcher)
+{
+    QJsonRpcAbstractSocket *socket = request->d->socket;
+    if (!socket || request->d->cancellation ||
+        request->d->request.type() != QJsonRpcMessage::Request)
+        return;
+
+    QJsonRpcRequestCancellationPointer cancellation(
+        new QJsonRpcRequestCancellation(request->d->request));
+    cancellation->service = service;
+    cancellation->watcher = watcher;
+    request->d->cancellation = cancellation;
+    QJsonRpcAbstractSocketPrivate::get(socket)->trackRequest(cancellation);
+
+    // futures are answered by their watcher, not through result()
+    if (watcher)
+        return;
+
+    QJsonRpcServicePrivate *d = service->d_func();
+    QMutexLocker locker(&d->delayedMutex);
+    if (d->delayedRequests.size() >= d->delayedSweepSize) {
+        QMultiHash<qint64, QJsonRpcServiceRequest>::iterator it = d->delayedRequests.begin();
+        while (it != d->delayedRequests.end()) {
+            if (it.value().isCancelled() || !it.value().isValid())
+                it = d->delayedRequests.erase(it);
+            else
+                ++it;
+        }
+        d->delayedSweepSize = qMax(int(MinimumDelayedSweepSize), 2 * d->delayedRequests.size());
+    }
+    d->delayedRequests.insert(request->d->request.id(), *request);
+}
+
+void QJsonRpcServicePrivate::forgetRequest(QJsonRpcService *service,
+                                           const QJsonRpcServiceRequest &request)
+{
+    QJsonRpcServicePrivate *d = service->d_func();
+    QMutexLocker locker(&d->delayedMutex);
+    QMultiHash<qint64, QJsonRpcServiceRequest>::iterator it =
+        d->delayedRequests.find(request.d->request.id());
+    while (it != d->delayedRequests.end() && it.key() == request.d->request.id()) {
+        const QJsonRpcServiceRequest &delayed = it.value();
+        if (delayed.d->cancellation == request.d->cancellation) {
+            d->delayedRequests.erase(it);
+            return;
+        }
+        ++it;
+    }
+}
+
+void QJsonRpcServicePrivate::_q_routeResult(const QJsonRpcMessage &response)
+{
+    Q_Q(QJsonRpcService);
+    if (response.type() != QJsonRpcMessage::Response && response.type() != QJsonRpcMessage::Error)
+        return;
+
+    // emitted by the slot being invoked, which then returns no response of
+    // its own
+    RequestContext *context = RequestContext::current(q);
+    if (context && !context->delayedResponse &&
+        context->request.request().type() == QJsonRpcMessage::Request &&
+        context->request.request().id() == response.id()) {
+        // dispatch() called directly still returns its own
+        if (context->request.socket()) {
+            context->delayedResponse = true;
+            context->request.respond(response);
+        }
+        return;
+    }
+
+    // ids are only unique per client, a response matching the requests of
+    // several can't be told apart and answers none of them
+    QMutexLocker locker(&delayedMutex);
+    const int waiting = delayedRequests.count(response.id());
+    if (waiting != 1) {
+        if (!waiting)
+            qJsonRpcDebug() << Q_FUNC_INFO << "no request waits for" << response.id();
+        else
+            qJsonRpcDebug() << Q_FUNC_INFO << waiting << "requests wait for" << response.id()
+                            << "- answer them with QJsonRpcServiceRequest::respond()";
+        return;
+    }
+    QJsonRpcServiceRequest request = delayedRequests.take(response.id());
+    locker.unlock();
+
+    request.respond(response);
+}
+
+QJsonRpcServicePrivate::RequestContext::~RequestContext()
+{
+    requestContextStack()->top = previous;
+}
+
+QJsonRpcServicePrivate::RequestContext *
+QJsonRpcServicePrivate::RequestContext::current(const QJsonRpcService *service)
+{
+    RequestContext *context = requestContextStack()->top;
+    while (context && context->service != service)
+        context = context->previous;
+    return context;
+}
+
 QJsonRpcService::QJsonRpcService(QObject *parent)
 #if defined(USE_QT_PRIVATE_HEADERS)
     : QObject(*new QJsonRpcServicePrivate(this), parent)
@@ -157,24 +382,347 @@ QJsonRpcService::QJsonRpcService(QObject *parent)
       d_ptr(new QJsonRpcServicePrivate(this))
 #endif
 {
+    // once for the service's lifetime rather than for every request
+    connect(this, SIGNAL(result(QJsonRpcMessage)), this, SLOT(_q_routeResult(QJsonRpcMessage)),
+            Qt::DirectConnection);
 }
 
 QJsonRpcService::~QJsonRpcService()
 {
+    Q_D(QJsonRpcService);
+    // too late for invocations still running, see shutdown()
+    d->waitForInvocations();
+
+    // no longer routed to
+    foreach (QJsonRpcServiceProvider *provider, d->providers)
+        provider->serviceDestroyed(this);
 }
 
-QJsonRpcServiceRequest QJsonRpcService::currentRequest() const
+void QJsonRpcService::shutdown()
+{
+    Q_D(QJsonRpcService);
+    d->waitForInvocations();
+}
+
+QThreadPool *QJsonRpcService::threadPool() const
 {
     Q_D(const QJsonRpcService);
-    return d->currentRequest;
+    return d->threadPool;
+}
+
+void QJsonRpcService::setThreadPool(QThreadPool *pool)
+{
+    Q_D(QJsonRpcService);
+    d->threadPool = pool;
+}
+
+int QJsonRpcService::maximumConcurrentRequests() const
+{
+    Q_D(const QJsonRpcService);
+    return d->maximumConcurrentRequests;
+}
+
+void QJsonRpcService::setMaximumConcurrentRequests(int count)
+{
+    Q_D(QJsonRpcService);
+    if (count <= 0) {
+        qJsonRpcDebug() << "Cannot set a non-positive concurrent request limit";
+        return;
+    }
+
+    QMutexLocker locker(&d->invocationMutex);
+    d->maximumConcurrentRequests = count;
+}
+
+void QJsonRpcService::setMethodCacheable(const QByteArray &method, bool cacheable)
+{
+    Q_D(QJsonRpcService);
+    d->cacheableMethods.insert(method, cacheable);
+    if (d->methods) {
+        d->applyCacheableMethods();
+        d->updateRoutes();
+    }
+    if (!cacheable)
+        invalidateResultCache(method);
+}
+
+int QJsonRpcService::resultCacheSize() const
+{
+    Q_D(const QJsonRpcService);
+    QMutexLocker locker(&d->resultCacheMutex);
+    return d->resultCache.maxCost();
+}
+
+void QJsonRpcService::setResultCacheSize(int entries)
+{
+    Q_D(QJsonRpcService);
+    QMutexLocker locker(&d->resultCacheMutex);
+    d->resultCache.setMaxCost(qMax(0, entries));
+}
+
+int QJsonRpcService::resultCacheTimeout() const
+{
+    Q_D(const QJsonRpcService);
+    QMutexLocker locker(&d->resultCacheMutex);
+    return d->resultCacheTimeout;
+}
+
+void QJsonRpcService::setResultCacheTimeout(int msecs)
+{
+    Q_D(QJsonRpcService);
+    QMutexLocker locker(&d->resultCacheMutex);
+    d->resultCacheTimeout = msecs < 0 ? -1 : msecs;
+}
+
+void QJsonRpcService::invalidateResultCache()
+{
+    Q_D(QJsonRpcService);
+    QMutexLocker locker(&d->resultCacheMutex);
+    d->resultCache.clear();
+}
+
+void QJsonRpcService::invalidateResultCache(const QByteArray &method)
+{
+    Q_D(QJsonRpcService);
+    const QByteArray prefix = method + '\0';
+    QMutexLocker locker(&d->resultCacheMutex);
+    foreach (const QByteArray &key, d->resultCache.keys()) {
+        if (key.startsWith(prefix))
+            d->resultCache.remove(key);
+    }
+}
+
+QByteArray QJsonRpcServicePrivate::resultCacheKey(const QByteArray &method, const QJsonValue &params)
+{
+    // objects are written in key order, so equal parameters give equal keys
+    QByteArray key = method;
+    key.append('\0');
+    QJsonRpcMessagePrivate::writeValue(params, key);
+    return key;
+}
+
+namespace {
+class QJsonRpcInvocationRunnable : public QRunnable
+{
+public:
+    explicit QJsonRpcInvocationRunnable(QJsonRpcServicePrivate *service)
+        : m_service(service) {}
+
+    void run() { m_service->runInvocations(); }
+
+private:
+    QJsonRpcServicePrivate *m_service;
+};
+}
+
+QJsonRpcServicePrivate::InvocationQueue::InvocationQueue()
+    : count(0)
+{
+    for (int i = 0; i < PriorityLevels; ++i)
+        passedOver[i] = 0;
+}
+
+void QJsonRpcServicePrivate::InvocationQueue::enqueue(const Invocation &invocation)
+{
+    levels[qBound(0, invocation.priority, int(PriorityLevels) - 1)].enqueue(invocation);
+    count++;
+}
+
+QJsonRpcServicePrivate::Invocation QJsonRpcServicePrivate::InvocationQueue::dequeue()
+{
+    int level = 0;
+    while (levels[level].isEmpty())
+        ++level;
+
+    for (int lower = PriorityLevels - 1; lower > level; --lower) {
+        if (!levels[lower].isEmpty() && ++passedOver[lower] > StarvationLimit) {
+            level = lower;
+            break;
+        }
+    }
+
+    passedOver[level] = 0;
+    count--;
+    return levels[level].dequeue();
+}
+
+void QJsonRpcServicePrivate::InvocationQueue::clear()
+{
+    for (int i = 0; i < PriorityLevels; ++i) {
+        levels[i].clear();
+        passedOver[i] = 0;
+    }
+    count = 0;
+}
+
+void QJsonRpcServicePrivate::enqueueInvocation(const Invocation &invocation)
+{
+    Q_Q(QJsonRpcService);
+    QMutexLocker locker(&invocationMutex);
+    pendingInvocations.enqueue(invocation);
+    if (!threadPool) {
+        // no pool, the service's own thread picks the queue up
+        if (!invocationsPosted) {
+            invocationsPosted = true;
+            locker.unlock();
+            QMetaObject::invokeMethod(q, "_q_runQueuedInvocations", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    if (activeRequests >= maximumConcurrentRequests)
+        return;
+
+    activeRequests++;
+    locker.unlock();
+    threadPool->start(new QJsonRpcInvocationRunnable(this));
+}
+
+void QJsonRpcServicePrivate::runInvocations()
+{
+    QMutexLocker locker(&invocationMutex);
+    drainInvocations(locker);
+    activeRequests--;
+    if (!activeRequests)
+        invocationsFinished.wakeAll();
+}
+
+void QJsonRpcServicePrivate::_q_runQueuedInvocations()
+{
+    Q_Q(QJsonRpcService);
+    QMutexLocker locker(&invocationMutex);
+    invocationsPosted = false;
+    drainInvocations(locker, MaximumInvocationsPerPass);
+    if (!pendingInvocations.isEmpty() && !invocationsPosted) {
+        invocationsPosted = true;
+        locker.unlock();
+        QMetaObject::invokeMethod(q, "_q_runQueuedInvocations", Qt::QueuedConnection);
+    }
+}
+
+void QJsonRpcServicePrivate::drainInvocations(QMutexLocker &locker, int maximum)
+{
+    Q_Q(QJsonRpcService);
+    for (int i = 0; !pendingInvocations.isEmpty() && i != maximum; ++i) {
+        Invocation invocation = pendingInvocations.dequeue();
+        locker.unlock();
+
+        // its deadline may have passed while it was queued
+        QJsonRpcMessage response;
+        if (invocation.request.type() == QJsonRpcMessage::Request &&
+            QJsonRpcMessagePrivate::isExpired(invocation.request)) {
+            response = invocation.request.createErrorResponse(QJsonRpc::TimeoutError,
+                                                              "deadline exceeded");
+        } else if (invocation.routed) {
+            // the handle keeps the socket from going away while the
+            // context takes its QPointer
+            QMutexLocker socketLocker(&invocation.socket->mutex);
+            RequestContext context(q, invocation.request, invocation.socket->socket,
+                                   invocation.admission, invocation.call);
+            socketLocker.unlock();
+            response = invoke(invocation.request, invocation.overloads);
+        } else {
+            response = q->dispatch(invocation.request);
+        }
+
+        if (response.isValid() && invocation.admission)
+            invocation.admission->release();
+        // requests answered later are finished by their QJsonRpcServiceRequest
+        if (invocation.call &&
+            (response.isValid() || invocation.request.type() == QJsonRpcMessage::Notification))
+            invocation.call->finish(response);
+        // queued unless the socket shares the service's thread
+        if (response.isValid())
+            invocation.socket->post(response);
+
+        locker.relock();
+    }
+}
+
+void QJsonRpcServicePrivate::waitForInvocations()
+{
+    QMutexLocker locker(&invocationMutex);
+    pendingInvocations.clear();
+    while (activeRequests > 0)
+        invocationsFinished.wait(&invocationMutex);
+}
+
+QJsonRpcServiceRequest QJsonRpcService::currentRequest() const
+{
+    QJsonRpcServicePrivate::RequestContext *context =
+        QJsonRpcServicePrivate::RequestContext::current(this);
+    return context ? context->request : QJsonRpcServiceRequest();
+}
+
+bool QJsonRpcService::beginDelayedResponse()
+{
+    QJsonRpcServicePrivate::RequestContext *context =
+        QJsonRpcServicePrivate::RequestContext::current(this);
+    if (!context) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called outside of a request";
+        return false;
+    }
+
+    if (!context->request.socket()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "request has no socket to be answered on later";
+        return false;
+    }
+
+    context->delayedResponse = true;
+    QJsonRpcServicePrivate::trackRequest(this, &context->request);
+    return true;
 }
 
-void QJsonRpcService::beginDelayedResponse()
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+void QJsonRpcService::addTypedMethod(const QByteArray &name, const TypedMethod &method)
 {
     Q_D(QJsonRpcService);
-    d->delayedResponse = true;
+    int index = d->typedMethodNames.indexOf(name);
+    if (index < 0) {
+        d->typedMethods.append(method);
+        d->typedMethodNames.append(name);
+    } else {
+        d->typedMethods[index] = method;
+    }
+
+    if (d->methods) {
+        d->applyTypedMethods();
+        d->applyCacheableMethods();
+        d->updateRoutes();
+    }
+}
+
+void QJsonRpcServicePrivate::applyTypedMethods()
+{
+    Q_Q(QJsonRpcService);
+    if (typedMethodNames.isEmpty())
+        return;
+
+    // typed methods belong to this instance, so they go into a private copy
+    // of the shared table, where they hide slots of the same name
+    detachMethodTable();
+    for (int i = 0; i < typedMethodNames.size(); ++i) {
+        MethodOverloads &overloads = methods->invokableMethodHash[typedMethodNames.at(i)];
+        overloads.indexes = QList<int>() << -(i + 1);
+        overloads.parameterSlots.clear();
+        overloads.resolvedSignatures.clear();
+    }
 }
 
+QJsonRpcMessage QJsonRpcServicePrivate::invokeTyped(const QJsonRpcMessage &request, int index)
+{
+    QJsonValue result;
+    if (!typedMethods.at(index)(request.params(), result))
+        return request.createErrorResponse(QJsonRpc::InvalidParams, "invalid parameters");
+
+    RequestContext *context = RequestContext::current(q_func());
+    if ((context && context->delayedResponse) || request.type() == QJsonRpcMessage::Notification)
+        return QJsonRpcMessage();
+
+    return request.createResponse(result);
+}
+#endif
+
 int QJsonRpcServicePrivate::convertVariantTypeToJSType(int type)
 {
     switch (type) {
@@ -207,12 +755,108 @@ int QJsonRpcServicePrivate::convertVariantTypeToJSType(int type)
     return QJsonValue::Undefined;
 }
 
+int QJsonRpcServicePrivate::argumentKind(int type)
+{
+    switch (type) {
+    case QMetaType::Int:
+        return IntArgument;
+    case QMetaType::UInt:
+        return UIntArgument;
+    case QMetaType::LongLong:
+        return LongLongArgument;
+    case QMetaType::ULongLong:
+        return ULongLongArgument;
+    case QMetaType::Double:
+        return DoubleArgument;
+    case QMetaType::Float:
+        return FloatArgument;
+    case QMetaType::Bool:
+        return BoolArgument;
+    case QMetaType::QString:
+        return StringArgument;
+    default:
+        break;
+    }
+
+    return GenericArgument;
+}
+
 int QJsonRpcServicePrivate::qjsonRpcMessageType = qRegisterMetaType<QJsonRpcMessage>("QJsonRpcMessage");
+int QJsonRpcServicePrivate::qjsonRpcFutureType =
+    qRegisterMetaType<QFuture<QVariant> >("QFuture<QVariant>");
+namespace {
+struct QJsonRpcMethodTableRegistry
+{
+    QMutex mutex;
+    QHash<const QMetaObject *,
+          QExplicitlySharedDataPointer<QJsonRpcServicePrivate::MethodTable> > tables;
+};
+}
+
+Q_GLOBAL_STATIC(QJsonRpcMethodTableRegistry, methodTableRegistry)
+
+QExplicitlySharedDataPointer<QJsonRpcServicePrivate::MethodTable>
+QJsonRpcServicePrivate::methodTable(const QMetaObject *metaObject)
+{
+    QJsonRpcMethodTableRegistry *registry = methodTableRegistry();
+    QMutexLocker locker(&registry->mutex);
+    QExplicitlySharedDataPointer<MethodTable> &table = registry->tables[metaObject];
+    if (!table)
+        table = createMethodTable(metaObject);
+    return table;
+}
+
 void QJsonRpcServicePrivate::cacheInvokableInfo()
 {
     Q_Q(QJsonRpcService);
-    const QMetaObject *obj = q->metaObject();
-    int startIdx = q->staticMetaObject.methodCount(); // skip QObject slots
+    if (methods)
+        return;
+
+    methods = methodTable(q->metaObject());
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    applyTypedMethods();
+#endif
+    applyCacheableMethods();
+}
+
+void QJsonRpcServicePrivate::detachMethodTable()
+{
+    // an existing copy is updated in place, routes may already point into it
+    Q_Q(QJsonRpcService);
+    QExplicitlySharedDataPointer<MethodTable> shared = methodTable(q->metaObject());
+    if (methods == shared)
+        methods = new MethodTable(*shared);
+}
+
+void QJsonRpcServicePrivate::updateRoutes()
+{
+    Q_Q(QJsonRpcService);
+    foreach (QJsonRpcServiceProvider *provider, providers)
+        provider->updateRoutes(q);
+}
+
+void QJsonRpcServicePrivate::applyCacheableMethods()
+{
+    if (cacheableMethods.isEmpty())
+        return;
+
+    detachMethodTable();
+    QHash<QByteArray, bool>::const_iterator it;
+    for (it = cacheableMethods.constBegin(); it != cacheableMethods.constEnd(); ++it) {
+        QHash<QByteArray, MethodOverloads>::iterator overloads =
+            methods->invokableMethodHash.find(it.key());
+        if (overloads != methods->invokableMethodHash.end())
+            overloads.value().cacheable = it.value();
+    }
+}
+
+QJsonRpcServicePrivate::MethodTable *
+QJsonRpcServicePrivate::createMethodTable(const QMetaObject *obj)
+{
+    MethodTable *table = new MethodTable;
+    QHash<int, MethodInfo> &methodInfoHash = table->methodInfoHash;
+    QHash<QByteArray, MethodOverloads> &invokableMethodHash = table->invokableMethodHash;
+    int startIdx = QJsonRpcService::staticMetaObject.methodCount(); // skip QObject slots
     for (int idx = startIdx; idx < obj->methodCount(); ++idx) {
         const QMetaMethod method = obj->method(idx);
         if ((method.methodType() == QMetaMethod::Slot &&
@@ -232,12 +876,66 @@ void QJsonRpcServicePrivate::cacheInvokableInfo()
                 continue;
 
             if (signature.contains("QVariant"))
-                invokableMethodHash[methodName].append(idx);
+                invokableMethodHash[methodName].indexes.append(idx);
             else
-                invokableMethodHash[methodName].prepend(idx);
+                invokableMethodHash[methodName].indexes.prepend(idx);
             methodInfoHash[idx] = info;
         }
     }
+
+    // Q_CLASSINFO("cacheable", "first second") marks methods whose results
+    // depend on their parameters only, "highPriority" and "lowPriority" those
+    // dispatched before or after the others when requests are queued
+    for (int i = 0; i < obj->classInfoCount(); ++i) {
+        const QMetaClassInfo classInfo = obj->classInfo(i);
+        const bool cacheable = qstrcmp(classInfo.name(), "cacheable") == 0;
+        int priority = -1;
+        if (qstrcmp(classInfo.name(), "highPriority") == 0)
+            priority = QJsonRpc::HighPriority;
+        else if (qstrcmp(classInfo.name(), "lowPriority") == 0)
+            priority = QJsonRpc::LowPriority;
+        if (!cacheable && priority < 0)
+            continue;
+
+        QByteArray names = classInfo.value();
+        foreach (const QByteArray &name, names.replace(',', ' ').split(' ')) {
+            QHash<QByteArray, MethodOverloads>::iterator overloads = invokableMethodHash.find(name);
+            if (overloads == invokableMethodHash.end())
+                continue;
+            if (cacheable)
+                overloads.value().cacheable = true;
+            else
+                overloads.value().priority = priority;
+        }
+    }
+
+    // number the parameter names of each overload set, so named parameters
+    // of a request can be sorted into slots once and shared by all overloads
+    QHash<QByteArray, MethodOverloads>::iterator it;
+    for (it = invokableMethodHash.begin(); it != invokableMethodHash.end(); ++it) {
+        MethodOverloads &overloads = it.value();
+        overloads.parameterSlots.clear();
+        overloads.resolvedSignatures.clear();
+        foreach (int methodIndex, overloads.indexes) {
+            if (methodIndex < 0)
+                continue;
+
+            MethodInfo &info = methodInfoHash[methodIndex];
+            for (int i = 0; i < info.parameters.size(); ++i) {
+                ParameterInfo &parameter = info.parameters[i];
+                QHash<QString, int>::const_iterator slot =
+                    overloads.parameterSlots.constFind(parameter.name);
+                if (slot == overloads.parameterSlots.constEnd()) {
+                    parameter.slot = overloads.parameterSlots.size();
+                    overloads.parameterSlots.insert(parameter.name, parameter.slot);
+                } else {
+                    parameter.slot = slot.value();
+                }
+            }
+        }
+    }
+
+    return table;
 }
 
 static bool jsParameterCompare(const QJsonArray &parameters,
@@ -257,13 +955,14 @@ static bool jsParameterCompare(const QJsonArray &parameters,
     return (j == parameters.size());
 }
 
-static  bool jsParameterCompare(const QJsonObject &parameters,
-                                const QJsonRpcServicePrivate::MethodInfo &info)
+// namedArguments holds the request's named parameters by slot
+static bool jsParameterCompare(const QJsonValue *namedArguments,
+                               const QJsonRpcServicePrivate::MethodInfo &info)
 {
     for (int i = 0; i < info.parameters.size(); ++i) {
         int jsType = info.parameters.at(i).jsType;
-        QJsonValue value = parameters.value(info.parameters.at(i).name);
-        if (value == QJsonValue::Undefined) {
+        const QJsonValue &value = namedArguments[info.parameters.at(i).slot];
+        if (value.isUndefined()) {
             if (!info.parameters.at(i).out)
                 return false;
         } else if (jsType == QJsonValue::Undefined) {
@@ -276,8 +975,8 @@ static  bool jsParameterCompare(const QJsonObject &parameters,
     return true;
 }
 
-static inline QVariant convertArgument(const QJsonValue &argument,
-                                       const QJsonRpcServicePrivate::ParameterInfo &info)
+static inline QVariant convertVariantArgument(const QJsonValue &argument,
+                                              const QJsonRpcServicePrivate::ParameterInfo &info)
 {
     if (argument.isUndefined())
 #if QT_VERSION >= 0x050000
@@ -332,6 +1031,91 @@ static inline QVariant convertArgument(const QJsonValue &argument,
 #endif
 }
 
+// Converts an argument into storage, returning the pointer handed to
+// qt_metacall or 0 if the conversion failed. Numbers are rounded the way
+// QVariant converts doubles to integers, QByteArray parameters referring
+// to an attachment share its data.
+static inline void *convertArgument(const QJsonValue &argument,
+                                    const QJsonRpcServicePrivate::ParameterInfo &info,
+                                    const QList<QByteArray> &attachments,
+                                    QJsonRpcServicePrivate::Argument &storage)
+{
+    if (info.type == QMetaType::QByteArray && !attachments.isEmpty()) {
+        const int index = QJsonRpcMessagePrivate::attachmentIndex(argument);
+        if (index >= 0 && index < attachments.size()) {
+            storage.variant = attachments.at(index);
+            return const_cast<void *>(storage.variant.constData());
+        }
+    }
+
+    if (info.kind != QJsonRpcServicePrivate::GenericArgument &&
+        (argument.isUndefined() || argument.type() == info.jsType)) {
+        switch (info.kind) {
+        case QJsonRpcServicePrivate::IntArgument:
+            storage.value.i = int(qRound64(argument.toDouble()));
+            return &storage.value.i;
+        case QJsonRpcServicePrivate::UIntArgument:
+            storage.value.u = uint(qRound64(argument.toDouble()));
+            return &storage.value.u;
+        case QJsonRpcServicePrivate::LongLongArgument:
+            storage.value.ll = qRound64(argument.toDouble());
+            return &storage.value.ll;
+        case QJsonRpcServicePrivate::ULongLongArgument:
+            storage.value.ull = qulonglong(qRound64(argument.toDouble()));
+            return &storage.value.ull;
+        case QJsonRpcServicePrivate::DoubleArgument:
+            storage.value.d = argument.toDouble();
+            return &storage.value.d;
+        case QJsonRpcServicePrivate::FloatArgument:
+            storage.value.f = float(argument.toDouble());
+            return &storage.value.f;
+        case QJsonRpcServicePrivate::BoolArgument:
+            storage.value.b = argument.toBool();
+            return &storage.value.b;
+        case QJsonRpcServicePrivate::StringArgument:
+            storage.string = argument.toString();
+            return &storage.string;
+        default:
+            break;
+        }
+    }
+
+    storage.variant = convertVariantArgument(argument, info);
+    if (!storage.variant.isValid())
+        return 0;
+
+    if (info.type == QMetaType::QVariant)
+        return &storage.variant;
+    return const_cast<void *>(storage.variant.constData());
+}
+
+static inline QJsonValue convertOutArgument(QJsonRpcServicePrivate::Argument &argument,
+                                            const QJsonRpcServicePrivate::ParameterInfo &info)
+{
+    switch (info.kind) {
+    case QJsonRpcServicePrivate::IntArgument:
+        return QJsonValue(double(argument.value.i));
+    case QJsonRpcServicePrivate::UIntArgument:
+        return QJsonValue(double(argument.value.u));
+    case QJsonRpcServicePrivate::LongLongArgument:
+        return QJsonValue(double(argument.value.ll));
+    case QJsonRpcServicePrivate::ULongLongArgument:
+        return QJsonValue(double(argument.value.ull));
+    case QJsonRpcServicePrivate::DoubleArgument:
+        return QJsonValue(argument.value.d);
+    case QJsonRpcServicePrivate::FloatArgument:
+        return QJsonValue(double(argument.value.f));
+    case QJsonRpcServicePrivate::BoolArgument:
+        return QJsonValue(argument.value.b);
+    case QJsonRpcServicePrivate::StringArgument:
+        return QJsonValue(argument.string);
+    default:
+        break;
+    }
+
+    return QJsonRpcServicePrivate::convertReturnValue(argument.variant);
+}
+
 QJsonValue QJsonRpcServicePrivate::convertReturnValue(QVariant &returnValue)
 {
 #if QT_VERSION >= 0x050200
@@ -360,11 +1144,44 @@ QJsonValue QJsonRpcServicePrivate::convertReturnValue(QVariant &returnValue)
             return QJsonValue();
     }
 #else
-    // custom conversions could not be registered before 5.2, so this is only an optimization
+    // custom conversions could not be registered before 5.2, so this is only an optimization;
+    // the bundled library builds lists and maps in one pass
     return QJsonValue::fromVariant(returnValue);
 #endif
 }
 
+// Packs the JSON types of a call's parameters into a key for the overload
+// resolution cache, three bits per parameter. Returns false for calls with
+// too many parameters to be packed.
+static inline quint64 signatureType(const QJsonValue &value)
+{
+    return value.isUndefined() ? 6 : quint64(value.type()) & 7;
+}
+
+static bool positionalSignature(const QJsonArray &parameters, quint64 *signature)
+{
+    if (parameters.size() > 19)
+        return false;
+
+    quint64 key = quint64(parameters.size());
+    for (int i = 0; i < parameters.size(); ++i)
+        key |= signatureType(parameters.at(i)) << (6 + 3 * i);
+    *signature = key;
+    return true;
+}
+
+static bool namedSignature(const QJsonValue *namedArguments, int count, quint64 *signature)
+{
+    if (count > 20)
+        return false;
+
+    quint64 key = Q_UINT64_C(1) << 63;
+    for (int i = 0; i < count; ++i)
+        key |= signatureType(namedArguments[i]) << (3 * i);
+    *signature = key;
+    return true;
+}
+
 static inline QByteArray methodName(const QJsonRpcMessage &request)
 {
     const QString &methodPath(request.method());
@@ -380,96 +1197,203 @@ QJsonRpcMessage QJsonRpcService::dispatch(const QJsonRpcMessage &request)
     }
 
     const QByteArray &method(methodName(request));
-    if (!d->invokableMethodHash.contains(method)) {
+    if (!d->methods || !d->methods->invokableMethodHash.contains(method)) {
         return request.createErrorResponse(QJsonRpc::MethodNotFound, "invalid method called");
     }
 
+    QJsonRpcServicePrivate::RequestContext context(this, request, 0);
+    return d->invoke(request, *d->methods->invokableMethodHash.constFind(method));
+}
+
+QJsonRpcMessage QJsonRpcServicePrivate::invoke(const QJsonRpcMessage &request,
+                                               const MethodOverloads &overloads)
+{
+    if (!overloads.cacheable || request.type() != QJsonRpcMessage::Request)
+        return invokeUncached(request, overloads);
+
+    const QByteArray key = resultCacheKey(methodName(request), request.params());
+    {
+        QMutexLocker locker(&resultCacheMutex);
+        if (CachedResult *cached = resultCache.object(key)) {
+            if (resultCacheTimeout < 0 || !cached->age.hasExpired(resultCacheTimeout))
+                return QJsonRpcMessagePrivate::createResponse(request, cached->result, cached->json);
+            resultCache.remove(key);
+        }
+    }
+
+    // only complete results are kept, not errors, delayed responses or
+    // results sent as attachments
+    QJsonRpcMessage response = invokeUncached(request, overloads);
+    if (response.type() != QJsonRpcMessage::Response || !response.attachments().isEmpty())
+        return response;
+
+    const QJsonValue result = response.result();
+    QByteArray json;
+    if (!result.isUndefined())
+        QJsonRpcMessagePrivate::writeValue(result, json);
+
+    CachedResult *cached = new CachedResult;
+    cached->result = result;
+    cached->json = json;
+    cached->age.start();
+    {
+        QMutexLocker locker(&resultCacheMutex);
+        resultCache.insert(key, cached);
+    }
+
+    return QJsonRpcMessagePrivate::createResponse(request, result, json);
+}
+
+QJsonRpcMessage QJsonRpcServicePrivate::invokeUncached(const QJsonRpcMessage &request,
+                                                       const MethodOverloads &overloads)
+{
+    Q_Q(QJsonRpcService);
+    const QList<int> &indexes = overloads.indexes;
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    if (!indexes.isEmpty() && indexes.first() < 0)
+        return invokeTyped(request, -indexes.first() - 1);
+#endif
+
     int idx = -1;
-    QVariantList arguments;
-    const QList<int> &indexes = d->invokableMethodHash.value(method);
+    QVarLengthArray<Argument, 10> arguments;
     const QJsonValue &params = request.params();
     QVarLengthArray<void *, 10> parameters;
     QVariant returnValue;
     QMetaType::Type returnType = QMetaType::Void;
 
     bool usingNamedParameters = params.isObject();
-    foreach (int methodIndex, indexes) {
-        QJsonRpcServicePrivate::MethodInfo &info = d->methodInfoHash[methodIndex];
-        bool methodMatch = usingNamedParameters ?
-            jsParameterCompare(params.toObject(), info) :
-            jsParameterCompare(params.toArray(), info);
-
-        if (methodMatch) {
-            idx = methodIndex;
-            arguments.reserve(info.parameters.size());
-            returnType = static_cast<QMetaType::Type>(info.returnType);
-#if QT_VERSION >= 0x050000
-            returnValue = (returnType == QMetaType::Void) ?
-                QVariant() : QVariant(returnType, Q_NULLPTR);
-#else
-            returnValue = (returnType == QMetaType::Void) ?
-                QVariant() : QVariant(returnType, (const void *) NULL);
-#endif
-            if (returnType == QMetaType::QVariant)
-                parameters.append(&returnValue);
-            else
-                parameters.append(returnValue.data());
+    QJsonArray positionalArguments;
+    QVarLengthArray<QJsonValue, 10> namedArguments;
+    const QList<QByteArray> attachments = request.attachments();
+    if (usingNamedParameters) {
+        namedArguments.resize(overloads.parameterSlots.size());
+        for (int i = 0; i < namedArguments.size(); ++i)
+            namedArguments[i] = QJsonValue(QJsonValue::Undefined);
 
-            for (int i = 0; i < info.parameters.size(); ++i) {
-                const QJsonRpcServicePrivate::ParameterInfo &parameterInfo = info.parameters.at(i);
-                QJsonValue incomingArgument = usingNamedParameters ?
-                    params.toObject().value(parameterInfo.name) :
-                    params.toArray().at(i);
-
-                QVariant argument = convertArgument(incomingArgument, parameterInfo);
-                if (!argument.isValid()) {
-                    QString message = incomingArgument.isUndefined() ?
-                        QString("failed to construct default object for '%1'").arg(parameterInfo.name) :
-                        QString("failed to convert from JSON for '%1'").arg(parameterInfo.name);
-                    return request.createErrorResponse(QJsonRpc::InvalidParams, message);
-                }
+        const QJsonObject object = params.toObject();
+        for (QJsonObject::const_iterator it = object.constBegin(); it != object.constEnd(); ++it) {
+            QHash<QString, int>::const_iterator slot = overloads.parameterSlots.constFind(it.key());
+            if (slot != overloads.parameterSlots.constEnd())
+                namedArguments[slot.value()] = it.value();
+        }
+    } else {
+        positionalArguments = params.toArray();
+    }
 
-                arguments.push_back(argument);
-                if (parameterInfo.type == QMetaType::QVariant)
-                    parameters.append(static_cast<void *>(&arguments.last()));
-                else
-                    parameters.append(const_cast<void *>(arguments.last().constData()));
-            }
+    // calls of the same shape resolve to the same overload
+    quint64 signature = 0;
+    const bool cacheable = usingNamedParameters ?
+        namedSignature(namedArguments.constData(), namedArguments.size(), &signature) :
+        positionalSignature(positionalArguments, &signature);
+    bool resolved = false;
+    if (cacheable) {
+        QMutexLocker locker(&methods->resolutionMutex);
+        QHash<quint64, int>::const_iterator it = overloads.resolvedSignatures.constFind(signature);
+        if (it != overloads.resolvedSignatures.constEnd()) {
+            idx = it.value();
+            resolved = true;
+        }
+    }
 
-            // found a match
-            break;
+    if (!resolved) {
+        foreach (int methodIndex, indexes) {
+            const MethodInfo &info = *methods->methodInfoHash.constFind(methodIndex);
+            bool methodMatch = usingNamedParameters ?
+                jsParameterCompare(namedArguments.constData(), info) :
+                jsParameterCompare(positionalArguments, info);
+            if (methodMatch) {
+                idx = methodIndex;
+                break;
+            }
         }
+
+        QMutexLocker locker(&methods->resolutionMutex);
+        if (cacheable && overloads.resolvedSignatures.size() < MaxResolvedSignatures)
+            overloads.resolvedSignatures.insert(signature, idx);
     }
 
     if (idx == -1) {
         return request.createErrorResponse(QJsonRpc::InvalidParams, "invalid parameters");
     }
 
-    QJsonRpcServicePrivate::MethodInfo &info = d->methodInfoHash[idx];
+    const MethodInfo &info = *methods->methodInfoHash.constFind(idx);
+    arguments.resize(info.parameters.size());
+    returnType = static_cast<QMetaType::Type>(info.returnType);
+#if QT_VERSION >= 0x050000
+    returnValue = (returnType == QMetaType::Void) ?
+        QVariant() : QVariant(returnType, Q_NULLPTR);
+#else
+    returnValue = (returnType == QMetaType::Void) ?
+        QVariant() : QVariant(returnType, (const void *) NULL);
+#endif
+    if (returnType == QMetaType::QVariant)
+        parameters.append(&returnValue);
+    else
+        parameters.append(returnValue.data());
+
+    for (int i = 0; i < info.parameters.size(); ++i) {
+        const ParameterInfo &parameterInfo = info.parameters.at(i);
+        const QJsonValue incomingArgument = usingNamedParameters ?
+            namedArguments.at(parameterInfo.slot) :
+            positionalArguments.at(i);
+
+        void *argument = convertArgument(incomingArgument, parameterInfo, attachments, arguments[i]);
+        if (!argument) {
+            QString message = incomingArgument.isUndefined() ?
+                QString("failed to construct default object for '%1'").arg(parameterInfo.name) :
+                QString("failed to convert from JSON for '%1'").arg(parameterInfo.name);
+            return request.createErrorResponse(QJsonRpc::InvalidParams, message);
+        }
+
+        parameters.append(argument);
+    }
 
     bool success =
-        const_cast<QJsonRpcService*>(this)->qt_metacall(QMetaObject::InvokeMetaMethod, idx, parameters.data()) < 0;
+        q->qt_metacall(QMetaObject::InvokeMetaMethod, idx, parameters.data()) < 0;
     if (!success) {
-        QString message = QString("dispatch for method '%1' failed").arg(method.constData());
+        QString message = QString("dispatch for method '%1' failed").arg(request.method());
         return request.createErrorResponse(QJsonRpc::InvalidRequest, message);
     }
 
-    if (d->delayedResponse) {
-        d->delayedResponse = false;
+    RequestContext *context = RequestContext::current(q);
+    if (context && context->delayedResponse)
+        return QJsonRpcMessage();
+
+    if (info.returnType == qjsonRpcFutureType) {
+        new QJsonRpcServiceFutureWatcher(q,
+            context ? context->request : QJsonRpcServiceRequest(request, 0),
+            returnValue.value<QFuture<QVariant> >());
         return QJsonRpcMessage();
     }
 
+    // nobody reads the result of a notification
+    if (request.type() == QJsonRpcMessage::Notification)
+        return QJsonRpcMessage();
+
     if (info.hasOut) {
         QJsonArray ret;
         if (info.returnType != QMetaType::Void)
-            ret.append(QJsonRpcServicePrivate::convertReturnValue(returnValue));
+            ret.append(convertReturnValue(returnValue));
         for (int i = 0; i < info.parameters.size(); ++i)
             if (info.parameters.at(i).out)
-                ret.append(QJsonRpcServicePrivate::convertReturnValue(arguments[i]));
+                ret.append(convertOutArgument(arguments[i], info.parameters.at(i)));
         if (ret.size() > 1)
             return request.createResponse(ret);
         return request.createResponse(ret.first());
     }
 
-    return request.createResponse(QJsonRpcServicePrivate::convertReturnValue(returnValue));
+    // binary results skip the JSON text where the connection allows it
+    if (info.returnType == QMetaType::QByteArray && context) {
+        QJsonRpcSocket *socket = qobject_cast<QJsonRpcSocket*>(context->request.socket());
+        if (socket && socket->attachmentsEnabled()) {
+            QJsonRpcMessage response =
+                request.createResponse(QJsonRpcMessage::attachmentReference(0));
+            response.setAttachments(QList<QByteArray>() << returnValue.toByteArray());
+            return response;
+        }
+    }
+
+    return request.createResponse(convertReturnValue(returnValue));
 }
+
+#include "moc_qjsonrpcservice.cpp"
@@ -19,9 +19,16 @@
 
 #include <QVariant>
 #include <QPointer>
+#include <QFuture>
 
 #include "qjsonrpcmessage.h"
 
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#endif
+
 class QJsonRpcAbstractSocket;
 class QJsonRpcServiceRequestPrivate;
 class QJSONRPC_EXPORT QJsonRpcServiceRequest
@@ -37,13 +44,202 @@ public:
     QJsonRpcMessage request() const;
     QJsonRpcAbstractSocket *socket() const;
 
+    // set once the client cancels a delayed request or disconnects, long
+    // running work may poll it to stop early; respond() then does nothing
+    bool isCancelled() const;
+
+    // milliseconds left of the timeout the client sent along, see
+    // QJsonRpcSocket::setDeadlinePropagation(), 0 once past it and -1 without
+    // one. Calls made on its behalf may be given it as their own timeout
+    qint64 remainingTime() const;
+
     bool respond(const QJsonRpcMessage &response);
     bool respond(QVariant returnValue);
 
+    // Streams a part of the result ahead of the response, so that neither
+    // side holds all of it at once. Each part is a "$/partialResult"
+    // notification with the request's id, which the client's
+    // QJsonRpcServiceReply emits as partialResult(); respond() completes
+    // the call as usual.
+    bool sendPartialResult(QVariant value);
+
 private:
     QSharedDataPointer<QJsonRpcServiceRequestPrivate> d;
+    friend class QJsonRpcServicePrivate;
+};
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+// JSON <-> C++ conversion for typed methods, specialize for custom types
+template <typename T>
+struct QJsonRpcTypeConverter
+{
+    static bool fromJson(const QJsonValue &value, T &result) {
+        QVariant variant = value.toVariant();
+        if (!variant.canConvert<T>())
+            return false;
+        result = variant.value<T>();
+        return true;
+    }
+
+    static QJsonValue toJson(const T &value) {
+        return QJsonValue::fromVariant(QVariant::fromValue(value));
+    }
+};
+
+// integers are rounded the way QVariant converts doubles
+#define QJSONRPC_NUMERIC_CONVERTER(Type, Conversion) \
+template <> \
+struct QJsonRpcTypeConverter<Type> \
+{ \
+    static bool fromJson(const QJsonValue &value, Type &result) { \
+        if (!value.isDouble()) \
+            return false; \
+        result = static_cast<Type>(Conversion(value.toDouble())); \
+        return true; \
+    } \
+    static QJsonValue toJson(Type value) { return QJsonValue(static_cast<double>(value)); } \
+};
+
+QJSONRPC_NUMERIC_CONVERTER(int, qRound64)
+QJSONRPC_NUMERIC_CONVERTER(uint, qRound64)
+QJSONRPC_NUMERIC_CONVERTER(qlonglong, qRound64)
+QJSONRPC_NUMERIC_CONVERTER(qulonglong, qRound64)
+QJSONRPC_NUMERIC_CONVERTER(double, )
+QJSONRPC_NUMERIC_CONVERTER(float, )
+#undef QJSONRPC_NUMERIC_CONVERTER
+
+template <>
+struct QJsonRpcTypeConverter<bool>
+{
+    static bool fromJson(const QJsonValue &value, bool &result) {
+        if (!value.isBool())
+            return false;
+        result = value.toBool();
+        return true;
+    }
+    static QJsonValue toJson(bool value) { return QJsonValue(value); }
 };
 
+template <>
+struct QJsonRpcTypeConverter<QString>
+{
+    static bool fromJson(const QJsonValue &value, QString &result) {
+        if (!value.isString())
+            return false;
+        result = value.toString();
+        return true;
+    }
+    static QJsonValue toJson(const QString &value) { return QJsonValue(value); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QJsonValue>
+{
+    static bool fromJson(const QJsonValue &value, QJsonValue &result) {
+        result = value;
+        return true;
+    }
+    static QJsonValue toJson(const QJsonValue &value) { return value; }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QJsonArray>
+{
+    static bool fromJson(const QJsonValue &value, QJsonArray &result) {
+        if (!value.isArray())
+            return false;
+        result = value.toArray();
+        return true;
+    }
+    static QJsonValue toJson(const QJsonArray &value) { return QJsonValue(value); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QJsonObject>
+{
+    static bool fromJson(const QJsonValue &value, QJsonObject &result) {
+        if (!value.isObject())
+            return false;
+        result = value.toObject();
+        return true;
+    }
+    static QJsonValue toJson(const QJsonObject &value) { return QJsonValue(value); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QVariant>
+{
+    static bool fromJson(const QJsonValue &value, QVariant &result) {
+        result = value.toVariant();
+        return true;
+    }
+    static QJsonValue toJson(const QVariant &value) { return QJsonValue::fromVariant(value); }
+};
+
+namespace QJsonRpcPrivate {
+    template <int...> struct IndexList {};
+    template <int N, int... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+    template <int... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> Type; };
+
+    template <typename R>
+    struct TypedCall
+    {
+        template <typename Function, typename... Args>
+        static QJsonValue call(const Function &function, Args &... args) {
+            return QJsonRpcTypeConverter<R>::toJson(function(args...));
+        }
+    };
+
+    template <>
+    struct TypedCall<void>
+    {
+        template <typename Function, typename... Args>
+        static QJsonValue call(const Function &function, Args &... args) {
+            function(args...);
+            return QJsonValue();
+        }
+    };
+
+    // converts positional parameters, calls the function and converts its result
+    template <typename R, typename... Args>
+    class TypedInvoker
+    {
+    public:
+        explicit TypedInvoker(const std::function<R (Args...)> &function)
+            : m_function(function) {}
+
+        bool operator()(const QJsonValue &params, QJsonValue &result) const {
+            return invoke(params, result, typename MakeIndexList<sizeof...(Args)>::Type());
+        }
+
+    private:
+        template <int... I>
+        bool invoke(const QJsonValue &params, QJsonValue &result, IndexList<I...>) const {
+            if (params.isObject())
+                return false;
+
+            const QJsonArray array = params.toArray();
+            if (array.size() != int(sizeof...(Args)))
+                return false;
+
+            std::tuple<typename std::decay<Args>::type...> arguments;
+            bool ok = true;
+            bool converted[] = { true, (ok = ok && QJsonRpcTypeConverter<
+                typename std::decay<Args>::type>::fromJson(array.at(I), std::get<I>(arguments)))... };
+            Q_UNUSED(converted)
+            if (!ok)
+                return false;
+
+            result = TypedCall<R>::call(m_function, std::get<I>(arguments)...);
+            return true;
+        }
+
+        std::function<R (Args...)> m_function;
+    };
+}
+#endif
+
+class QThreadPool;
 class QJsonRpcServiceProvider;
 class QJsonRpcServicePrivate;
 class QJSONRPC_EXPORT QJsonRpcService : public QObject
@@ -53,21 +249,132 @@ public:
     explicit QJsonRpcService(QObject *parent = 0);
     ~QJsonRpcService();
 
+    // Requests are dispatched on the pool rather than the socket's thread, at
+    // most maximumConcurrentRequests() at a time; the rest wait by priority,
+    // set for methods with Q_CLASSINFO("highPriority", "first second") or
+    // Q_CLASSINFO("lowPriority", ...), and in order within one. Lower
+    // priorities are still served every few requests under load.
+    // Responses are still written from the socket's thread. Slots are called
+    // from the pool's threads, so they must be thread-safe.
+    QThreadPool *threadPool() const;
+    void setThreadPool(QThreadPool *pool);
+    int maximumConcurrentRequests() const;
+    void setMaximumConcurrentRequests(int count);
+
+    // Drops the requests still waiting for the pool and waits for those
+    // running. Removing the service from its server does this; a service
+    // deleted while added must call it from its own destructor, since
+    // ~QJsonRpcService() runs once the subclass is gone. Not to be called
+    // from the service's own slots.
+    void shutdown();
+
+    // Results of cacheable methods are answered from a bounded cache, keyed
+    // by method and parameters, without invoking the method again. Methods
+    // are marked with Q_CLASSINFO("cacheable", "first second") or with
+    // setMethodCacheable() before adding the service to a server. Results
+    // expire after resultCacheTimeout() msecs, -1 (the default) keeps them
+    // until they are evicted or invalidated.
+    void setMethodCacheable(const QByteArray &method, bool cacheable = true);
+    int resultCacheSize() const;
+    void setResultCacheSize(int entries);
+    int resultCacheTimeout() const;
+    void setResultCacheTimeout(int msecs);
+    void invalidateResultCache();
+    void invalidateResultCache(const QByteArray &method);
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    // Registers a method dispatched without going through the meta object
+    // system. Parameters are taken by position only, and a typed method hides
+    // slots of the same name. Register before adding the service to a server.
+    template <typename R, typename... Args>
+    void registerMethod(const QByteArray &name, R (*function)(Args...)) {
+        addTypedMethod(name, QJsonRpcPrivate::TypedInvoker<R, Args...>(function));
+    }
+
+    template <typename C, typename R, typename... Args>
+    void registerMethod(const QByteArray &name, C *object, R (C::*method)(Args...)) {
+        addTypedMethod(name, QJsonRpcPrivate::TypedInvoker<R, Args...>(
+            [object, method](Args... args) -> R { return (object->*method)(args...); }));
+    }
+
+    template <typename C, typename R, typename... Args>
+    void registerMethod(const QByteArray &name, const C *object, R (C::*method)(Args...) const) {
+        addTypedMethod(name, QJsonRpcPrivate::TypedInvoker<R, Args...>(
+            [object, method](Args... args) -> R { return (object->*method)(args...); }));
+    }
+
+    // member functions of the service itself
+    template <typename C, typename R, typename... Args>
+    void registerMethod(const QByteArray &name, R (C::*method)(Args...)) {
+        registerMethod(name, static_cast<C *>(this), method);
+    }
+
+    template <typename C, typename R, typename... Args>
+    void registerMethod(const QByteArray &name, R (C::*method)(Args...) const) {
+        registerMethod(name, static_cast<const C *>(this), method);
+    }
+
+    // lambdas and other function objects
+    template <typename Functor>
+    void registerMethod(const QByteArray &name, Functor functor) {
+        registerFunctor(name, functor, &Functor::operator());
+    }
+#endif
+
 Q_SIGNALS:
+    // answers the request being invoked, or one after beginDelayedResponse(),
+    // that has the id of the response; from any thread. Ids are only unique
+    // per client, while requests of several clients wait with the same id
+    // it answers none, QJsonRpcServiceRequest::respond() must be used
     void result(const QJsonRpcMessage &result);
     void notifyConnectedClients(const QJsonRpcMessage &message);
     void notifyConnectedClients(const QString &method, const QJsonArray &params = QJsonArray());
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
+
+    // a delayed request, or one answered with a QFuture<QVariant>, was
+    // cancelled; futures are cancelled along with it. Emitted from the
+    // socket's thread
+    void requestCancelled(const QJsonRpcMessage &request);
 
 protected:
+    // both refer to the request being invoked on the calling thread, slots
+    // returning QFuture<QVariant> are answered once the future finishes
+    // instead, without blocking the socket's thread. Keep the request from
+    // currentRequest() after beginDelayedResponse(), the client may cancel
+    // it from then on. Returns false outside of a request, or for one
+    // without a socket to answer it on, which dispatch() then answers with
+    // what the slot returns
     QJsonRpcServiceRequest currentRequest() const;
-    void beginDelayedResponse();
+    bool beginDelayedResponse();
 
 protected Q_SLOTS:
+    // invokes the request without a socket, so the response returned is the
+    // only one: currentRequest() is invalid while it runs, and neither
+    // respond() nor cancellation reach it
     QJsonRpcMessage dispatch(const QJsonRpcMessage &request);
 
 private:
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    typedef std::function<bool (const QJsonValue &, QJsonValue &)> TypedMethod;
+    void addTypedMethod(const QByteArray &name, const TypedMethod &method);
+
+    template <typename Functor, typename R, typename... Args>
+    void registerFunctor(const QByteArray &name, const Functor &functor,
+                         R (Functor::*)(Args...) const) {
+        addTypedMethod(name, QJsonRpcPrivate::TypedInvoker<R, Args...>(functor));
+    }
+
+    template <typename Functor, typename R, typename... Args>
+    void registerFunctor(const QByteArray &name, const Functor &functor,
+                         R (Functor::*)(Args...)) {
+        addTypedMethod(name, QJsonRpcPrivate::TypedInvoker<R, Args...>(functor));
+    }
+#endif
+
     Q_DISABLE_COPY(QJsonRpcService)
     Q_DECLARE_PRIVATE(QJsonRpcService)
+    Q_PRIVATE_SLOT(d_func(), void _q_runQueuedInvocations())
+    Q_PRIVATE_SLOT(d_func(), void _q_routeResult(QJsonRpcMessage))
     friend class QJsonRpcServiceProvider;
 
 #if !defined(USE_QT_PRIVATE_HEADERS)
@@ -76,5 +383,7 @@ private:
 
 };
 
+Q_DECLARE_METATYPE(QFuture<QVariant>)
+
 #endif
 
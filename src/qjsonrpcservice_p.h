@@ -22,15 +22,48 @@
 #include <QPointer>
 #include <QVarLengthArray>
 #include <QStringList>
+#include <QVector>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QFutureWatcher>
+#include <QSharedData>
+#include <QCache>
+#include <QElapsedTimer>
 
 #include "qjsonrpcservice.h"
+#include "qjsonrpcadmission_p.h"
+#include "qjsonrpcmetrics_p.h"
+#include "qjsonrpcsocket_p.h"
 
 class QJsonRpcAbstractSocket;
+class QJsonRpcServiceProvider;
 class QJsonRpcServiceRequestPrivate : public QSharedData
 {
 public:
     QJsonRpcMessage request;
     QPointer<QJsonRpcAbstractSocket> socket;
+    QJsonRpcAdmissionPointer admission;     // released by respond()
+    QJsonRpcCallPointer call;               // finished by respond()
+    QJsonRpcRequestCancellationPointer cancellation;    // once delayed
+};
+
+// answers a request once the future returned by its slot finishes, lives in
+// the socket's thread and deletes itself afterwards
+class QJsonRpcServiceFutureWatcher : public QFutureWatcher<QVariant>
+{
+    Q_OBJECT
+public:
+    QJsonRpcServiceFutureWatcher(QJsonRpcService *service, const QJsonRpcServiceRequest &request,
+                                 const QFuture<QVariant> &future);
+
+private Q_SLOTS:
+    void respond();
+
+private:
+    QJsonRpcServiceRequest m_request;
+
 };
 
 class QJsonRpcService;
@@ -44,15 +77,70 @@ class QJsonRpcServicePrivate
 {
 public:
     QJsonRpcServicePrivate(QJsonRpcService *parent)
-        : delayedResponse(false),
+        : maximumConcurrentRequests(1),
+          activeRequests(0),
+          invocationsPosted(false),
+          resultCache(256),
+          resultCacheTimeout(-1),
+          delayedSweepSize(MinimumDelayedSweepSize),
           q_ptr(parent)
     {
     }
 
     void cacheInvokableInfo();
+    struct MethodOverloads;
+
+    // state of one invocation, lives on the stack of the invoking thread for
+    // the duration of the call and is found again through current()
+    class RequestContext
+    {
+    public:
+        RequestContext(QJsonRpcService *service, const QJsonRpcMessage &request,
+                       QJsonRpcAbstractSocket *socket,
+                       const QJsonRpcAdmissionPointer &admission = QJsonRpcAdmissionPointer(),
+                       const QJsonRpcCallPointer &call = QJsonRpcCallPointer());
+        ~RequestContext();
+
+        // innermost context of the calling thread belonging to service, or 0
+        static RequestContext *current(const QJsonRpcService *service);
+
+        QJsonRpcService *service;
+        QJsonRpcServiceRequest request;
+        bool delayedResponse;
+
+    private:
+        RequestContext *previous;
+        Q_DISABLE_COPY(RequestContext)
+    };
+
+    QJsonRpcMessage invoke(const QJsonRpcMessage &request, const MethodOverloads &overloads);
+    QJsonRpcMessage invokeUncached(const QJsonRpcMessage &request, const MethodOverloads &overloads);
     static int qjsonRpcMessageType;
+    static int qjsonRpcFutureType;
     static int convertVariantTypeToJSType(int type);
     static QJsonValue convertReturnValue(QVariant &returnValue);
+    static void setAdmission(QJsonRpcServiceRequest *request, const QJsonRpcAdmissionPointer &admission);
+    static void setCall(QJsonRpcServiceRequest *request, const QJsonRpcCallPointer &call);
+
+    // registers a request answered later with its socket, which may cancel it
+    static void trackRequest(QJsonRpcService *service, QJsonRpcServiceRequest *request,
+                             QObject *watcher = 0);
+    static void forgetRequest(QJsonRpcService *service, const QJsonRpcServiceRequest &request);
+
+    // how an argument is converted from JSON, resolved once per parameter so
+    // that common types skip the QVariant conversion machinery
+    enum ArgumentKind {
+        GenericArgument,        // converted through QVariant
+        IntArgument,
+        UIntArgument,
+        LongLongArgument,
+        ULongLongArgument,
+        DoubleArgument,
+        FloatArgument,
+        BoolArgument,
+        StringArgument
+    };
+    static int argumentKind(int type);
 
     struct ParameterInfo
     {
@@ -60,10 +148,28 @@ public:
 
         int type;
         int jsType;
+        int kind;
+        int slot;       // position of name in MethodOverloads::parameterSlots
         QString name;
         bool out;
     };
 
+    // storage for one argument of an invocation, lives on the stack
+    struct Argument
+    {
+        union {
+            int i;
+            uint u;
+            qlonglong ll;
+            qulonglong ull;
+            double d;
+            float f;
+            bool b;
+        } value;
+        QString string;
+        QVariant variant;
+    };
+
     struct MethodInfo
     {
         MethodInfo();
@@ -75,10 +181,131 @@ public:
         bool hasOut;
     };
 
-    QHash<int, MethodInfo > methodInfoHash;
-    QHash<QByteArray, QList<int> > invokableMethodHash;
-    QJsonRpcServiceRequest currentRequest;
-    bool delayedResponse;
+    // the methods sharing a name, candidates for a call in order of preference
+    enum { MaxResolvedSignatures = 16 };
+    struct MethodOverloads
+    {
+        MethodOverloads() : cacheable(false), priority(QJsonRpc::NormalPriority) {}
+
+        QList<int> indexes;     // typed methods have negative indexes
+        QHash<QString, int> parameterSlots;     // union of the overloads' parameter names
+
+        // parameter type signature to the matching index, or -1 for no match
+        mutable QHash<quint64, int> resolvedSignatures;
+        bool cacheable;         // results depend on the parameters only
+        int priority;           // a QJsonRpc::Priority
+    };
+
+    // the invokable methods of a meta object, built once and shared by all
+    // services of that class; not modified once shared
+    class MethodTable : public QSharedData
+    {
+    public:
+        MethodTable() {}
+        MethodTable(const MethodTable &other)
+            : QSharedData(other),
+              methodInfoHash(other.methodInfoHash),
+              invokableMethodHash(other.invokableMethodHash) {}
+
+        QHash<int, MethodInfo> methodInfoHash;
+        QHash<QByteArray, MethodOverloads> invokableMethodHash;
+        QMutex resolutionMutex;     // guards MethodOverloads::resolvedSignatures
+    };
+
+    static QExplicitlySharedDataPointer<MethodTable> methodTable(const QMetaObject *metaObject);
+    static MethodTable *createMethodTable(const QMetaObject *metaObject);
+    QExplicitlySharedDataPointer<MethodTable> methods;
+    void detachMethodTable();
+
+    // the providers routing to the service, their routes point into methods
+    // and are rebuilt whenever it changes
+    QList<QJsonRpcServiceProvider *> providers;
+    void updateRoutes();
+    QHash<QByteArray, bool> cacheableMethods;      // set per instance, applied to methods
+    void applyCacheableMethods();
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    QVector<QJsonRpcService::TypedMethod> typedMethods;
+    QList<QByteArray> typedMethodNames;
+    void applyTypedMethods();
+    QJsonRpcMessage invokeTyped(const QJsonRpcMessage &request, int index);
+#endif
+
+    // worker pool dispatch, requests beyond the concurrency limit wait in
+    // pendingInvocations until a running worker picks them up. Without a
+    // pool, requests arriving on another thread, or on the same one with
+    // priority scheduling, are queued to the service's own thread instead
+    struct Invocation
+    {
+        Invocation() : routed(false), priority(QJsonRpc::NormalPriority) {}
+
+        QJsonRpcMessage request;
+        QJsonRpcSocketHandlePointer socket;
+        MethodOverloads overloads;          // a copy, routes may be rebuilt meanwhile
+        bool routed;                        // false to go through dispatch()
+        QJsonRpcAdmissionPointer admission;
+        QJsonRpcCallPointer call;           // 0 without metrics
+        int priority;                       // a QJsonRpc::Priority
+    };
+
+    // Pending invocations by priority, each level in order. A lower level
+    // passed over StarvationLimit times while it had requests waiting is
+    // served next, so that it keeps moving under a stream of urgent ones
+    enum { PriorityLevels = QJsonRpc::LowPriority + 1, StarvationLimit = 4 };
+    class InvocationQueue
+    {
+    public:
+        InvocationQueue();
+        bool isEmpty() const { return !count; }
+        void enqueue(const Invocation &invocation);
+        Invocation dequeue();
+        void clear();
+
+    private:
+        QQueue<Invocation> levels[PriorityLevels];
+        int passedOver[PriorityLevels];
+        int count;
+    };
+
+    // the service's own thread yields between this many queued invocations,
+    // letting requests read meanwhile join the queue
+    enum { MaximumInvocationsPerPass = 64 };
+
+    void enqueueInvocation(const Invocation &invocation);
+    void runInvocations();
+    void _q_runQueuedInvocations();
+    void drainInvocations(QMutexLocker &locker, int maximum = -1);
+    void waitForInvocations();
+
+    QPointer<QThreadPool> threadPool;
+    int maximumConcurrentRequests;
+    int activeRequests;
+    bool invocationsPosted;     // _q_runQueuedInvocations is pending
+    InvocationQueue pendingInvocations;
+    QMutex invocationMutex;
+    QWaitCondition invocationsFinished;
+
+    // results of cacheable methods by method name and parameters, in least
+    // recently used order
+    struct CachedResult
+    {
+        QJsonValue result;
+        QByteArray json;
+        QElapsedTimer age;
+    };
+    static QByteArray resultCacheKey(const QByteArray &method, const QJsonValue &params);
+    QCache<QByteArray, CachedResult> resultCache;
+    int resultCacheTimeout;
+    mutable QMutex resultCacheMutex;
+
+    // Responses emitted through result() answer the request they carry the
+    // id of: the one being invoked, or else one after beginDelayedResponse(),
+    // the provider connects no signal for them. Requests cancelled before
+    // they were answered are swept from time to time
+    enum { MinimumDelayedSweepSize = 64 };
+    void _q_routeResult(const QJsonRpcMessage &response);
+    QMultiHash<qint64, QJsonRpcServiceRequest> delayedRequests;
+    int delayedSweepSize;
+    QMutex delayedMutex;
 
     QJsonRpcService * const q_ptr;
     Q_DECLARE_PUBLIC(QJsonRpcService)
@@ -1,21 +1,56 @@
 #include <QObjectCleanupHandler>
 #include <QMetaObject>
 #include <QMetaClassInfo>
+#include <QThread>
 #include <QDebug>
 
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcservice.h"
 #include "qjsonrpcservice_p.h"
+#include "qjsonrpcadmission_p.h"
+#include "qjsonrpcmetrics_p.h"
+#include "qjsonrpcforwarder_p.h"
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcserviceprovider.h"
 
 class QJsonRpcServiceProviderPrivate
 {
 public:
+    QJsonRpcServiceProviderPrivate() : priorityScheduling(false) {}
+
     QByteArray serviceName(QJsonRpcService *service);
+    void addRoutes(const QByteArray &serviceName, QJsonRpcService *service);
+    void removeRoutes(QJsonRpcService *service);
+
+    // fully qualified "service.method" name to the service and its
+    // candidate overloads, so a request is routed with a single lookup
+    struct Route
+    {
+        QJsonRpcService *service;
+        const QJsonRpcServicePrivate::MethodOverloads *overloads;
+    };
 
     QHash<QByteArray, QJsonRpcService*> services;
+    QHash<QString, Route> routes;
     QObjectCleanupHandler cleanupHandler;
 
+    // created along with the first limit, admissions may outlive the provider
+    QSharedPointer<QJsonRpcAdmissionController> admission;
+    QJsonRpcAdmissionController *admissionController();
+
+    bool priorityScheduling;
+
+    // null while disabled, calls in flight keep theirs
+    QSharedPointer<QJsonRpcMetrics> metrics;
+    QPointer<QJsonRpcStatsService> statsService;
+
+    // in the order they run, calls copy the list
+    QList<QJsonRpcInterceptor *> interceptors;
+
+    // service name to the forwarder of its backend, one for each backend
+    QHash<QString, QJsonRpcForwarder *> backends;
+    QJsonRpcForwarder *forwarder(QJsonRpcAbstractSocket *backend) const;
+
 };
 
 QJsonRpcServiceProvider::QJsonRpcServiceProvider()
@@ -25,6 +60,20 @@ QJsonRpcServiceProvider::QJsonRpcServiceProvider()
 
 QJsonRpcServiceProvider::~QJsonRpcServiceProvider()
 {
+    foreach (QJsonRpcService *service, d->services)
+        service->d_func()->providers.removeAll(this);
+    qDeleteAll(d->backends.values().toSet());
+}
+
+QJsonRpcForwarder *QJsonRpcServiceProviderPrivate::forwarder(QJsonRpcAbstractSocket *backend) const
+{
+    QHash<QString, QJsonRpcForwarder *>::const_iterator it;
+    for (it = backends.constBegin(); it != backends.constEnd(); ++it) {
+        if (it.value()->backend() == backend)
+            return it.value();
+    }
+
+    return 0;
 }
 
 QByteArray QJsonRpcServiceProviderPrivate::serviceName(QJsonRpcService *service)
@@ -39,6 +88,33 @@ QByteArray QJsonRpcServiceProviderPrivate::serviceName(QJsonRpcService *service)
     return QByteArray(mo->className()).toLower();
 }
 
+void QJsonRpcServiceProviderPrivate::addRoutes(const QByteArray &serviceName,
+                                               QJsonRpcService *service)
+{
+    // the overloads stay in place for as long as the service holds its
+    // table, the service has the routes rebuilt when it changes
+    const QHash<QByteArray, QJsonRpcServicePrivate::MethodOverloads> &methods =
+        service->d_func()->methods->invokableMethodHash;
+    QHash<QByteArray, QJsonRpcServicePrivate::MethodOverloads>::const_iterator it;
+    for (it = methods.constBegin(); it != methods.constEnd(); ++it) {
+        Route route;
+        route.service = service;
+        route.overloads = &it.value();
+        routes.insert(QString::fromLatin1(serviceName + '.' + it.key()), route);
+    }
+}
+
+void QJsonRpcServiceProviderPrivate::removeRoutes(QJsonRpcService *service)
+{
+    QHash<QString, Route>::iterator it = routes.begin();
+    while (it != routes.end()) {
+        if (it.value().service == service)
+            it = routes.erase(it);
+        else
+            ++it;
+    }
+}
+
 bool QJsonRpcServiceProvider::addService(QJsonRpcService *service)
 {
     QByteArray serviceName = d->serviceName(service);
@@ -53,7 +129,9 @@ bool QJsonRpcServiceProvider::addService(QJsonRpcService *service)
     }
 
     service->d_func()->cacheInvokableInfo();
+    service->d_func()->providers.append(this);
     d->services.insert(serviceName, service);
+    d->addRoutes(serviceName, service);
     if (!service->parent())
         d->cleanupHandler.add(service);
     return true;
@@ -67,33 +145,320 @@ bool QJsonRpcServiceProvider::removeService(QJsonRpcService *service)
         return false;
     }
 
-    d->cleanupHandler.remove(d->services.value(serviceName));
+    QJsonRpcService *removed = d->services.value(serviceName);
+    d->cleanupHandler.remove(removed);
+    d->removeRoutes(removed);
+    // nothing of it runs on a pool anymore when the caller deletes it
+    removed->shutdown();
+    removed->d_func()->providers.removeAll(this);
     d->services.remove(serviceName);
     return true;
 }
 
+void QJsonRpcServiceProvider::updateRoutes(QJsonRpcService *service)
+{
+    const QByteArray serviceName = d->services.key(service);
+    d->removeRoutes(service);
+    d->addRoutes(serviceName, service);
+}
+
+void QJsonRpcServiceProvider::serviceDestroyed(QJsonRpcService *service)
+{
+    // found by value, the service's class is no longer known
+    d->removeRoutes(service);
+    const QByteArray serviceName = d->services.key(service);
+    if (!serviceName.isEmpty())
+        d->services.remove(serviceName);
+}
+
+QJsonRpcAdmissionController *QJsonRpcServiceProviderPrivate::admissionController()
+{
+    if (!admission)
+        admission = QSharedPointer<QJsonRpcAdmissionController>(new QJsonRpcAdmissionController);
+    return admission.data();
+}
+
+int QJsonRpcServiceProvider::concurrencyLimit(const QString &name) const
+{
+    return d->admission ? d->admission->limit(name) : -1;
+}
+
+void QJsonRpcServiceProvider::setConcurrencyLimit(const QString &name, int count)
+{
+    d->admissionController()->setLimit(name, count);
+}
+
+int QJsonRpcServiceProvider::clientConcurrencyLimit() const
+{
+    return d->admission ? d->admission->clientLimit() : -1;
+}
+
+void QJsonRpcServiceProvider::setClientConcurrencyLimit(int count)
+{
+    d->admissionController()->setClientLimit(count);
+}
+
+bool QJsonRpcServiceProvider::adaptiveConcurrencyLimits() const
+{
+    return d->admission ? d->admission->isAdaptive() : false;
+}
+
+void QJsonRpcServiceProvider::setAdaptiveConcurrencyLimits(bool enabled)
+{
+    d->admissionController()->setAdaptive(enabled);
+}
+
+int QJsonRpcServiceProvider::effectiveConcurrencyLimit(const QString &name) const
+{
+    return d->admission ? d->admission->effectiveLimit(name) : -1;
+}
+
+bool QJsonRpcServiceProvider::priorityScheduling() const
+{
+    return d->priorityScheduling;
+}
+
+void QJsonRpcServiceProvider::setPriorityScheduling(bool enabled)
+{
+    d->priorityScheduling = enabled;
+}
+
+void QJsonRpcServiceProvider::addInterceptor(QJsonRpcInterceptor *interceptor)
+{
+    if (interceptor && !d->interceptors.contains(interceptor))
+        d->interceptors.append(interceptor);
+}
+
+void QJsonRpcServiceProvider::removeInterceptor(QJsonRpcInterceptor *interceptor)
+{
+    d->interceptors.removeAll(interceptor);
+}
+
+QList<QJsonRpcInterceptor *> QJsonRpcServiceProvider::interceptors() const
+{
+    return d->interceptors;
+}
+
+bool QJsonRpcServiceProvider::metricsEnabled() const
+{
+    return !d->metrics.isNull();
+}
+
+void QJsonRpcServiceProvider::setMetricsEnabled(bool enabled)
+{
+    if (enabled == metricsEnabled())
+        return;
+
+    if (enabled) {
+        d->metrics = QSharedPointer<QJsonRpcMetrics>(new QJsonRpcMetrics);
+    } else {
+        setStatsServiceEnabled(false);
+        d->metrics.clear();
+    }
+}
+
+QList<QJsonRpcMethodMetrics> QJsonRpcServiceProvider::methodMetrics() const
+{
+    return d->metrics ? d->metrics->snapshot() : QList<QJsonRpcMethodMetrics>();
+}
+
+QJsonRpcMethodMetrics QJsonRpcServiceProvider::methodMetrics(const QString &name) const
+{
+    return d->metrics ? d->metrics->find(name) : QJsonRpcMethodMetrics();
+}
+
+void QJsonRpcServiceProvider::resetMetrics()
+{
+    if (d->metrics)
+        d->metrics->reset();
+}
+
+bool QJsonRpcServiceProvider::statsServiceEnabled() const
+{
+    return !d->statsService.isNull();
+}
+
+void QJsonRpcServiceProvider::setStatsServiceEnabled(bool enabled)
+{
+    if (enabled == statsServiceEnabled())
+        return;
+
+    if (!enabled) {
+        QJsonRpcStatsService *service = d->statsService;
+        d->statsService.clear();
+        removeService(service);
+        service->deleteLater();
+        return;
+    }
+
+    setMetricsEnabled(true);
+    QJsonRpcStatsService *service = new QJsonRpcStatsService(d->metrics);
+    if (!addService(service)) {
+        delete service;
+        return;
+    }
+    d->statsService = service;
+}
+
+void QJsonRpcServiceProvider::addBackend(const QString &serviceName, QJsonRpcAbstractSocket *backend)
+{
+    if (serviceName.isEmpty() || !backend) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid service name or backend";
+        return;
+    }
+
+    removeBackend(serviceName);
+    QJsonRpcForwarder *forwarder = d->forwarder(backend);
+    if (!forwarder)
+        forwarder = new QJsonRpcForwarder(backend);
+    d->backends.insert(serviceName, forwarder);
+}
+
+void QJsonRpcServiceProvider::removeBackend(const QString &serviceName)
+{
+    QJsonRpcForwarder *forwarder = d->backends.take(serviceName);
+    if (forwarder && !d->backends.values().contains(forwarder))
+        delete forwarder;
+}
+
+QJsonRpcAbstractSocket *QJsonRpcServiceProvider::backend(const QString &serviceName) const
+{
+    QJsonRpcForwarder *forwarder = d->backends.value(serviceName);
+    return forwarder ? forwarder->backend() : 0;
+}
+
 void QJsonRpcServiceProvider::processMessage(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message)
 {
     switch (message.type()) {
         case QJsonRpcMessage::Request:
         case QJsonRpcMessage::Notification: {
-            QByteArray serviceName = message.method().section(".", 0, -2).toLatin1();
-            if (serviceName.isEmpty() || !d->services.contains(serviceName)) {
-                if (message.type() == QJsonRpcMessage::Request) {
+            const QString method = message.method();
+
+            // the peer gives up on a request it is still waiting for
+            if (message.type() == QJsonRpcMessage::Notification &&
+                method == QLatin1String("$/cancelRequest")) {
+                const QJsonValue id = message.params().toObject().value(QJsonRpcMessagePrivate::keys().id);
+                QJsonRpcAbstractSocketPrivate::get(socket)->cancelRequest(
+                    QJsonRpcMessagePrivate::toId(id));
+                break;
+            }
+
+            // nobody waits for its response anymore, it is answered without
+            // being dispatched so that flow control still counts it
+            if (message.type() == QJsonRpcMessage::Request &&
+                QJsonRpcMessagePrivate::isExpired(message)) {
+                socket->notify(message.createErrorResponse(QJsonRpc::TimeoutError, "deadline exceeded"));
+                break;
+            }
+
+            // without interceptors this is the only cost of the chain
+            QJsonRpcCallPointer call;
+            if (!d->interceptors.isEmpty()) {
+                call = QJsonRpcCallPointer(new QJsonRpcCall(message, socket));
+                QJsonRpcMessage response = call->beforeDispatch(d->interceptors);
+                if (response.isValid()) {
+                    if (message.type() == QJsonRpcMessage::Request) {
+                        call->finish(response);
+                        socket->notify(response);
+                    } else {
+                        call->finish(QJsonRpcMessage());
+                    }
+                    break;
+                }
+            }
+
+            // relayed as it is, the services of a gateway aren't routed here
+            if (!d->backends.isEmpty()) {
+                QJsonRpcForwarder *forwarder = d->backends.value(method.section('.', 0, -2));
+                if (forwarder) {
+                    forwarder->forward(socket, message, call);
+                    break;
+                }
+            }
+
+            QHash<QString, QJsonRpcServiceProviderPrivate::Route>::const_iterator route =
+                d->routes.constFind(method);
+            const bool routed = (route != d->routes.constEnd());
+
+            QJsonRpcService *service = 0;
+            if (routed) {
+                service = route.value().service;
+            } else {
+                // not routable, let the service report an unknown method if it exists
+                QByteArray serviceName = method.section(".", 0, -2).toLatin1();
+                service = d->services.value(serviceName);
+                if (!service) {
+                    QJsonRpcMessage error;
+                    if (message.type() == QJsonRpcMessage::Request) {
+                        error = message.createErrorResponse(QJsonRpc::MethodNotFound,
+                                QString("service '%1' not found").arg(serviceName.constData()));
+                    }
+                    if (call)
+                        call->finish(error);
+                    if (error.isValid())
+                        socket->notify(error);
+                    break;
+                }
+            }
+
+            // only routed methods are counted, names sent by clients alone
+            // can't grow the metrics
+            if (d->metrics && routed) {
+                if (!call)
+                    call = QJsonRpcCallPointer(new QJsonRpcCall(message, socket));
+                call->setMetrics(d->metrics);
+            }
+
+            // turned away before anything is queued for it
+            QJsonRpcAdmissionPointer admission;
+            if (d->admission && message.type() == QJsonRpcMessage::Request) {
+                admission = QJsonRpcAdmissionController::admit(d->admission, method, socket);
+                if (!admission) {
                     QJsonRpcMessage error =
-                        message.createErrorResponse(QJsonRpc::MethodNotFound,
-                            QString("service '%1' not found").arg(serviceName.constData()));
+                        message.createErrorResponse(QJsonRpc::OverloadedError, "overloaded");
+                    if (call)
+                        call->finish(error);
                     socket->notify(error);
+                    break;
                 }
+            }
+
+            // a service living on another thread than the socket is invoked there
+            if (d->priorityScheduling || service->d_func()->threadPool ||
+                service->thread() != QThread::currentThread()) {
+                QJsonRpcServicePrivate::Invocation invocation;
+                invocation.request = message;
+                invocation.socket = QJsonRpcAbstractSocketPrivate::handle(socket);
+                if (routed) {
+                    invocation.overloads = *route.value().overloads;
+                    invocation.routed = true;
+                }
+                invocation.admission = admission;
+                invocation.call = call;
+                invocation.priority = QJsonRpcMessagePrivate::priority(message);
+                if (invocation.priority < 0)
+                    invocation.priority = invocation.routed ? invocation.overloads.priority
+                                                            : int(QJsonRpc::NormalPriority);
+                service->d_func()->enqueueInvocation(invocation);
+                break;
+            }
+
+            QJsonRpcMessage response;
+            if (routed) {
+                QJsonRpcServicePrivate::RequestContext context(service, message, socket,
+                                                               admission, call);
+                response = service->d_func()->invoke(message, *route.value().overloads);
             } else {
-                QJsonRpcService *service = d->services.value(serviceName);
-                service->d_func()->currentRequest = QJsonRpcServiceRequest(message, socket);
-                if (message.type() == QJsonRpcMessage::Request)
-                    QObject::connect(service, SIGNAL(result(QJsonRpcMessage)),
-                                      socket, SLOT(notify(QJsonRpcMessage)), Qt::UniqueConnection);
-                QJsonRpcMessage response = service->dispatch(message);
-                if (response.isValid())
-                    socket->notify(response);
+                response = service->dispatch(message);
+            }
+
+            if (call && (response.isValid() || message.type() == QJsonRpcMessage::Notification))
+                call->finish(response);
+
+            if (response.isValid()) {
+                if (admission)
+                    admission->release();
+                socket->notify(response);
             }
         }
         break;
@@ -18,6 +18,8 @@
 #define QJSONRPCSERVICEPROVIDER_H
 
 #include "qjsonrpcglobal.h"
+#include "qjsonrpcmetrics.h"
+#include "qjsonrpcinterceptor.h"
 
 class QJsonRpcMessage;
 class QJsonRpcService;
@@ -30,11 +32,84 @@ public:
     virtual bool addService(QJsonRpcService *service);
     virtual bool removeService(QJsonRpcService *service);
 
+    // Past the concurrency limit of a service, named by its serviceName, of
+    // one of its methods, "service.method", or of a client, requests are
+    // answered right away with QJsonRpc::OverloadedError rather than queued.
+    // A request counts until its response is sent, delayed ones until their
+    // QJsonRpcServiceRequest responds or is dropped. -1, the default, means
+    // no limit.
+    int concurrencyLimit(const QString &name) const;
+    void setConcurrencyLimit(const QString &name, int count);
+    int clientConcurrencyLimit() const;
+    void setClientConcurrencyLimit(int count);
+
+    // Adaptive limits of services and methods follow the latency of their
+    // requests: they shrink below the configured limit when it rises, which
+    // sheds load before queues build up, and grow back towards it once it
+    // recovers. effectiveConcurrencyLimit() is the current one.
+    bool adaptiveConcurrencyLimits() const;
+    void setAdaptiveConcurrencyLimits(bool enabled);
+    int effectiveConcurrencyLimit(const QString &name) const;
+
+    // Requests are dispatched by priority once they queue up for a service:
+    // that of their "priority" member, "high", "normal" or "low", or else
+    // of their method, see QJsonRpcService. Requests for services on other
+    // threads or on a thread pool always queue; with priority scheduling
+    // those for services on the socket's thread do too, so that requests
+    // read together are served by priority rather than as they arrive.
+    bool priorityScheduling() const;
+    void setPriorityScheduling(bool enabled);
+
+    // Interceptors run around every request and notification, in the order
+    // they were added, see QJsonRpcInterceptor. They aren't owned by the
+    // provider, and have to outlive it and the calls in flight, which keep
+    // the chain they started with.
+    void addInterceptor(QJsonRpcInterceptor *interceptor);
+    void removeInterceptor(QJsonRpcInterceptor *interceptor);
+    QList<QJsonRpcInterceptor *> interceptors() const;
+
+    // Metrics of each method routed to a service, see
+    // QJsonRpcMethodMetrics, are recorded once enabled. Threads count into
+    // their own counters, which are only merged when metrics are asked for.
+    // Disabling them drops what was recorded. methodMetrics(name) is that
+    // of a method by its full name, or the total of a service.
+    bool metricsEnabled() const;
+    void setMetricsEnabled(bool enabled);
+    QList<QJsonRpcMethodMetrics> methodMetrics() const;
+    QJsonRpcMethodMetrics methodMetrics(const QString &name) const;
+    void resetMetrics();
+
+    // The built-in "rpc" service, which enables metrics. Its stats() method
+    // returns those of every method by name, stats(name) those of a method
+    // or a service, as QJsonRpcMethodMetrics::toJson() writes them. It lives
+    // on the thread enabling it.
+    bool statsServiceEnabled() const;
+    void setStatsServiceEnabled(bool enabled);
+
+    // Makes the provider a gateway for a service served by another process:
+    // the requests and notifications for its methods are relayed to backend,
+    // a socket connected to that process, as they were read. Only their
+    // envelope is parsed, neither params nor results are decoded, and
+    // responses are relayed back the same way. Request ids are replaced on
+    // the way, those of clients may clash. Interceptors still run first.
+    // The backend isn't owned by the provider and has to live on the thread
+    // of the connections relayed through it; requests pending when it is
+    // destroyed or removed are answered with QJsonRpc::InternalError.
+    void addBackend(const QString &serviceName, QJsonRpcAbstractSocket *backend);
+    void removeBackend(const QString &serviceName);
+    QJsonRpcAbstractSocket *backend(const QString &serviceName) const;
+
 protected:
     QJsonRpcServiceProvider();
     void processMessage(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message);
 
 private:
+    // called by services added to the provider
+    void updateRoutes(QJsonRpcService *service);
+    void serviceDestroyed(QJsonRpcService *service);
+    friend class QJsonRpcService;
+    friend class QJsonRpcServicePrivate;
+
     QScopedPointer<QJsonRpcServiceProviderPrivate> d;
 
 };
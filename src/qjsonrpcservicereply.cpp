@@ -14,9 +14,31 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
  * Lesser General Public License for more details.
  */
+#include "qjsonrpcpool_p.h"
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcservicereply_p.h"
 #include "qjsonrpcservicereply.h"
 
+void *QJsonRpcServiceReplyPrivate::operator new(size_t size)
+{
+    return QJsonRpcPool<QJsonRpcServiceReplyPrivate>::allocate(size);
+}
+
+void QJsonRpcServiceReplyPrivate::operator delete(void *p, size_t size)
+{
+    QJsonRpcPool<QJsonRpcServiceReplyPrivate>::release(p, size);
+}
+
+void *QJsonRpcServiceReply::operator new(size_t size)
+{
+    return QJsonRpcPool<QJsonRpcServiceReply>::allocate(size);
+}
+
+void QJsonRpcServiceReply::operator delete(void *p, size_t size)
+{
+    QJsonRpcPool<QJsonRpcServiceReply>::release(p, size);
+}
+
 QJsonRpcServiceReply::QJsonRpcServiceReply(QObject *parent)
 #if defined(USE_QT_PRIVATE_HEADERS)
     : QObject(*new QJsonRpcServiceReplyPrivate, parent)
@@ -52,3 +74,23 @@ QJsonRpcMessage QJsonRpcServiceReply::response() const
     Q_D(const QJsonRpcServiceReply);
     return d->response;
 }
+
+void QJsonRpcServiceReplyPrivate::deliverPartialResult(
+    const QHash<qint64, QPointer<QJsonRpcServiceReply> > &replies, const QJsonRpcMessage &message)
+{
+    const QJsonObject params = message.params().toObject();
+    QPointer<QJsonRpcServiceReply> reply =
+        replies.value(QJsonRpcMessagePrivate::toId(params.value(QJsonRpcMessagePrivate::keys().id)));
+    if (!reply.isNull() && !reply->response().isValid())
+        Q_EMIT reply->partialResult(params.value(QLatin1String("value")));
+}
+
+void QJsonRpcServiceReply::abort()
+{
+    Q_D(QJsonRpcServiceReply);
+    if (d->response.isValid())
+        return;
+
+    d->response = d->request.createErrorResponse(QJsonRpc::CancelledError, "request aborted");
+    Q_EMIT finished();
+}
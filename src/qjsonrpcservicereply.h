@@ -34,15 +34,29 @@ public:
     QJsonRpcMessage request() const;
     QJsonRpcMessage response() const;
 
+    // replies are recycled through a per-thread pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
+public Q_SLOTS:
+    // finishes a reply still waiting for its response with a CancelledError,
+    // the response is ignored if it still comes
+    virtual void abort();
+
 Q_SIGNALS:
     void finished();
 
+    // a part of the result streamed by the service ahead of the response,
+    // see QJsonRpcServiceRequest::sendPartialResult()
+    void partialResult(const QJsonValue &value);
+
 protected:
     Q_DECLARE_PRIVATE(QJsonRpcServiceReply)
     Q_DISABLE_COPY(QJsonRpcServiceReply)
     QJsonRpcServiceReply(QJsonRpcServiceReplyPrivate &dd, QObject *parent = 0);
     friend class QJsonRpcSocketPrivate;
     friend class QJsonRpcSocket;
+    friend class QJsonRpcInProcessSocketPrivate;
 
 #if !defined(USE_QT_PRIVATE_HEADERS)
     QScopedPointer<QJsonRpcServiceReplyPrivate> d_ptr;
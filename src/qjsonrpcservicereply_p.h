@@ -17,6 +17,9 @@
 #ifndef QJSONRPCSERVICEREPLY_P_H
 #define QJSONRPCSERVICEREPLY_P_H
 
+#include <QHash>
+#include <QPointer>
+
 #include "qjsonrpcmessage.h"
 
 #if defined(USE_QT_PRIVATE_HEADERS)
@@ -28,6 +31,13 @@ class QJsonRpcServiceReplyPrivate
 #endif
 {
 public:
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
+    // hands a "$/partialResult" notification to the pending reply it names
+    static void deliverPartialResult(const QHash<qint64, QPointer<QJsonRpcServiceReply> > &replies,
+                                     const QJsonRpcMessage &message);
+
     QJsonRpcMessage request;
     QJsonRpcMessage response;
 };
@@ -0,0 +1,557 @@
+#include <QLocalSocket>
+#include <QSharedMemory>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QPointer>
+#include <QTimer>
+#include <QAtomicInt>
+
+#include <cstring>
+
+#include "qjsonrpcsharedmemorydevice.h"
+
+// positions only ever grow, the ring's size being a power of two they wrap
+// around along with it
+static inline quint32 loadOrdered(QBasicAtomicInt &value)
+{
+    return quint32(value.fetchAndAddOrdered(0));
+}
+
+static inline quint32 exchangeOrdered(QBasicAtomicInt &value, quint32 newValue)
+{
+    return quint32(value.fetchAndStoreOrdered(int(newValue)));
+}
+
+// the control block of one direction, the data follows the control blocks
+struct QJsonRpcSharedRing
+{
+    QBasicAtomicInt head;           // written by the producer
+    QBasicAtomicInt tail;           // written by the consumer
+    QBasicAtomicInt readerWaiting;  // the consumer wants a doorbell for new data
+    QBasicAtomicInt writerWaiting;  // the producer wants a doorbell for space
+};
+
+class QJsonRpcSharedMemoryDevicePrivate
+{
+public:
+    enum State {
+        Attaching,      // client waiting for the announcement
+        SharedMemory,
+        Plain           // falling back to the local socket
+    };
+
+    // each control block has a cache line of its own
+    enum { ControlSize = 64, MaximumRingSize = 256 * 1024 * 1024 };
+
+    QJsonRpcSharedMemoryDevicePrivate(QLocalSocket *socket, QJsonRpcSharedMemoryDevice *q)
+        : socket(socket),
+          server(false),
+          state(Attaching),
+          ringSize(0),
+          incoming(0),
+          outgoing(0),
+          incomingData(0),
+          outgoingData(0),
+          doorbells(0),
+          readyReadScheduled(false),
+          q_ptr(q)
+    {
+    }
+
+    // slots
+    void _q_socketReadyRead();
+    void _q_ringDoorbell();
+    void _q_emitReadyRead();
+
+    bool create(int size);
+    bool attach(const QByteArray &announcement);
+    void setRings(bool server);
+    void fallBack();
+
+    // head - tail of a ring, or -1 once the peer moved either index so far
+    // that the ring would hold more than its size, after which the
+    // connection is closed with ringCorrupted()
+    qint64 used(QJsonRpcSharedRing *ring, quint32 *head, quint32 *tail) const;
+    void ringCorrupted();
+
+    quint32 available() const;
+    int writeRing(const char *data, int size);
+    void flushPendingOutput();
+    void scheduleDoorbell();
+    void scheduleReadyRead();
+
+    QPointer<QLocalSocket> socket;
+    bool server;
+    QSharedMemory memory;
+    State state;
+    int ringSize;
+    QJsonRpcSharedRing *incoming;
+    QJsonRpcSharedRing *outgoing;
+    char *incomingData;
+    char *outgoingData;
+
+    // what didn't fit into the ring, or was written before attaching
+    QByteArray pendingOutput;
+    // the line read so far, the announcement or the client's fallback,
+    // and what followed it in plain mode until it is read
+    QByteArray announcement;
+    QByteArray plainInput;
+    QTimer doorbellTimer;
+    int doorbells;
+    bool readyReadScheduled;
+
+    QJsonRpcSharedMemoryDevice * const q_ptr;
+    Q_DECLARE_PUBLIC(QJsonRpcSharedMemoryDevice)
+};
+
+static QByteArray segmentKey()
+{
+    static QBasicAtomicInt counter = Q_BASIC_ATOMIC_INITIALIZER(0);
+    return "qjsonrpc-" + QByteArray::number(QCoreApplication::applicationPid()) + '-' +
+           QByteArray::number(counter.fetchAndAddRelaxed(1)) + '-' +
+           QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+}
+
+bool QJsonRpcSharedMemoryDevicePrivate::create(int size)
+{
+    ringSize = 4096;
+    while (ringSize < size && ringSize < MaximumRingSize)
+        ringSize *= 2;
+
+    memory.setKey(QString::fromLatin1(segmentKey()));
+    if (!memory.create(2 * ControlSize + 2 * ringSize)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "unable to create shared memory:" << memory.errorString();
+        return false;
+    }
+
+    // the client waits for data once it attached, until then nothing is
+    // rung for it and all the socket carries is the announcement
+    memset(memory.data(), 0, 2 * ControlSize);
+    setRings(true);
+    exchangeOrdered(incoming->readerWaiting, 1);
+
+    socket->write("QJSONRPC-SHM " + memory.key().toLatin1() + ' ' +
+                  QByteArray::number(ringSize) + '\n');
+    return true;
+}
+
+bool QJsonRpcSharedMemoryDevicePrivate::attach(const QByteArray &announcement)
+{
+    const QList<QByteArray> fields = announcement.trimmed().split(' ');
+    if (fields.size() != 3 || fields.at(0) != "QJSONRPC-SHM")
+        return false;
+
+    bool ok = false;
+    ringSize = fields.at(2).toInt(&ok);
+    if (!ok || ringSize <= 0 || ringSize > MaximumRingSize || (ringSize & (ringSize - 1)))
+        return false;
+
+    memory.setKey(QString::fromLatin1(fields.at(1)));
+    if (!memory.attach()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "unable to attach shared memory:" << memory.errorString();
+        return false;
+    }
+
+    if (memory.size() < 2 * ControlSize + 2 * ringSize) {
+        memory.detach();
+        return false;
+    }
+
+    // looking at the head again once waiting, what the server wrote
+    // before is read right away
+    setRings(false);
+    exchangeOrdered(incoming->readerWaiting, 1);
+    return true;
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::setRings(bool server)
+{
+    // the first ring goes from the server to the client
+    char *base = static_cast<char*>(memory.data());
+    QJsonRpcSharedRing *toClient = reinterpret_cast<QJsonRpcSharedRing*>(base);
+    QJsonRpcSharedRing *toServer = reinterpret_cast<QJsonRpcSharedRing*>(base + ControlSize);
+    char *toClientData = base + 2 * ControlSize;
+    char *toServerData = toClientData + ringSize;
+
+    incoming = server ? toServer : toClient;
+    outgoing = server ? toClient : toServer;
+    incomingData = server ? toServerData : toClientData;
+    outgoingData = server ? toClientData : toServerData;
+    state = SharedMemory;
+}
+
+qint64 QJsonRpcSharedMemoryDevicePrivate::used(QJsonRpcSharedRing *ring, quint32 *head,
+                                              quint32 *tail) const
+{
+    *tail = loadOrdered(ring->tail);
+    *head = loadOrdered(ring->head);
+    const quint32 count = *head - *tail;
+    return count > quint32(ringSize) ? -1 : qint64(count);
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::ringCorrupted()
+{
+    qJsonRpcDebug() << Q_FUNC_INFO << "ring indices out of range, closing the connection";
+    pendingOutput.clear();
+    if (memory.isAttached())
+        memory.detach();
+    incoming = outgoing = 0;
+    incomingData = outgoingData = 0;
+    state = Plain;
+    if (socket)
+        socket->abort();
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::fallBack()
+{
+    // what the client never read from the ring goes ahead of the rest
+    if (state == SharedMemory) {
+        quint32 head;
+        quint32 tail;
+        const qint64 usage = used(outgoing, &head, &tail);
+        if (usage < 0) {
+            ringCorrupted();
+            return;
+        }
+
+        const int unread = int(usage);
+        const int offset = int(tail & quint32(ringSize - 1));
+        const int first = qMin(unread, ringSize - offset);
+        QByteArray data;
+        data.resize(unread);
+        memcpy(data.data(), outgoingData + offset, first);
+        memcpy(data.data() + first, outgoingData, unread - first);
+        pendingOutput.prepend(data);
+    }
+
+    if (memory.isAttached())
+        memory.detach();
+    state = Plain;
+    if (!pendingOutput.isEmpty()) {
+        socket->write(pendingOutput);
+        pendingOutput.clear();
+    }
+}
+
+quint32 QJsonRpcSharedMemoryDevicePrivate::available() const
+{
+    if (state != SharedMemory)
+        return 0;
+
+    // a corrupted ring is found out by the next read
+    quint32 head;
+    quint32 tail;
+    const qint64 usage = used(incoming, &head, &tail);
+    return usage < 0 ? 0 : quint32(usage);
+}
+
+int QJsonRpcSharedMemoryDevicePrivate::writeRing(const char *data, int size)
+{
+    quint32 head;
+    quint32 tail;
+    const qint64 usage = used(outgoing, &head, &tail);
+    if (usage < 0) {
+        ringCorrupted();
+        return 0;
+    }
+
+    const quint32 space = quint32(ringSize) - quint32(usage);
+    const int length = int(qMin(quint32(size), space));
+    if (length == 0)
+        return 0;
+
+    const int offset = int(head & quint32(ringSize - 1));
+    const int first = qMin(length, ringSize - offset);
+    memcpy(outgoingData + offset, data, first);
+    memcpy(outgoingData, data + first, length - first);
+
+    // published before looking at the flag, which the reader sets before
+    // looking at the head again, so one of both sees the other
+    exchangeOrdered(outgoing->head, head + quint32(length));
+    if (exchangeOrdered(outgoing->readerWaiting, 0))
+        scheduleDoorbell();
+    return length;
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::flushPendingOutput()
+{
+    while (state == SharedMemory && !pendingOutput.isEmpty()) {
+        const int written = writeRing(pendingOutput.constData(), pendingOutput.size());
+        pendingOutput.remove(0, written);
+        if (written > 0 || state != SharedMemory)
+            continue;
+
+        // full, the reader rings once it made room
+        exchangeOrdered(outgoing->writerWaiting, 1);
+        quint32 head;
+        quint32 tail;
+        const qint64 usage = used(outgoing, &head, &tail);
+        if (usage < 0)
+            ringCorrupted();
+        else if (usage == ringSize)
+            return;
+    }
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::scheduleDoorbell()
+{
+    if (!doorbellTimer.isActive())
+        doorbellTimer.start(0);
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::_q_ringDoorbell()
+{
+    doorbellTimer.stop();
+    if (!socket || socket->state() != QLocalSocket::ConnectedState)
+        return;
+
+    ++doorbells;
+    socket->write("\x01", 1);
+    socket->flush();
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::scheduleReadyRead()
+{
+    Q_Q(QJsonRpcSharedMemoryDevice);
+    if (readyReadScheduled)
+        return;
+
+    readyReadScheduled = true;
+    QMetaObject::invokeMethod(q, "_q_emitReadyRead", Qt::QueuedConnection);
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::_q_emitReadyRead()
+{
+    Q_Q(QJsonRpcSharedMemoryDevice);
+    readyReadScheduled = false;
+    if (q->bytesAvailable() > 0)
+        Q_EMIT q->readyRead();
+}
+
+void QJsonRpcSharedMemoryDevicePrivate::_q_socketReadyRead()
+{
+    Q_Q(QJsonRpcSharedMemoryDevice);
+    if (!socket)
+        return;
+
+    if (state == Attaching) {
+        announcement += socket->readAll();
+        const int end = announcement.indexOf('\n');
+        if (end == -1)
+            return;
+
+        // the server rings nothing before the client attached, after the
+        // line there can only be data it sent in plain mode
+        const QByteArray line = announcement.left(end).trimmed();
+        const QByteArray remainder = announcement.mid(end + 1);
+        announcement.clear();
+        if (line != "QJSONRPC-PLAIN" && attach(line)) {
+            flushPendingOutput();
+            if (available() > 0)
+                Q_EMIT q->readyRead();
+            return;
+        }
+
+        // the server waits for the client in shared memory mode until told
+        qJsonRpcDebug() << Q_FUNC_INFO << "falling back to the local socket";
+        if (line != "QJSONRPC-PLAIN")
+            socket->write("QJSONRPC-PLAIN\n");
+        plainInput = remainder;
+        fallBack();
+        if (q->bytesAvailable() > 0)
+            Q_EMIT q->readyRead();
+        return;
+    }
+
+    if (state == Plain) {
+        Q_EMIT q->readyRead();
+        return;
+    }
+
+    // doorbells carry nothing, the rings tell what changed. A client that
+    // couldn't attach sends a line instead, it never rang before
+    const QByteArray data = socket->readAll();
+    if (server && (!announcement.isEmpty() || (!data.isEmpty() && data.at(0) != '\x01'))) {
+        announcement += data;
+        const int end = announcement.indexOf('\n');
+        if (end == -1)
+            return;
+
+        const QByteArray line = announcement.left(end).trimmed();
+        plainInput = announcement.mid(end + 1);
+        announcement.clear();
+        if (line != "QJSONRPC-PLAIN") {
+            qJsonRpcDebug() << Q_FUNC_INFO << "unexpected data from the client, closing the connection";
+            plainInput.clear();
+            socket->abort();
+            return;
+        }
+
+        qJsonRpcDebug() << Q_FUNC_INFO << "client fell back to the local socket";
+        fallBack();
+        if (q->bytesAvailable() > 0)
+            Q_EMIT q->readyRead();
+        return;
+    }
+
+    flushPendingOutput();
+    if (available() > 0)
+        Q_EMIT q->readyRead();
+}
+
+QJsonRpcSharedMemoryDevice::QJsonRpcSharedMemoryDevice(QLocalSocket *socket, Role role,
+                                                       int ringSize, QObject *parent)
+    : QIODevice(parent),
+      d_ptr(new QJsonRpcSharedMemoryDevicePrivate(socket, this))
+{
+    Q_D(QJsonRpcSharedMemoryDevice);
+    d->doorbellTimer.setSingleShot(true);
+    connect(&d->doorbellTimer, SIGNAL(timeout()), this, SLOT(_q_ringDoorbell()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(_q_socketReadyRead()));
+    connect(socket, SIGNAL(disconnected()), this, SIGNAL(readChannelFinished()));
+    QIODevice::open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+
+    d->server = (role == ServerRole);
+    if (d->server && !d->create(ringSize)) {
+        socket->write("QJSONRPC-PLAIN\n");
+        d->fallBack();
+    }
+}
+
+QJsonRpcSharedMemoryDevice::~QJsonRpcSharedMemoryDevice()
+{
+    Q_D(QJsonRpcSharedMemoryDevice);
+    if (d->memory.isAttached())
+        d->memory.detach();
+}
+
+bool QJsonRpcSharedMemoryDevice::isSharedMemoryActive() const
+{
+    Q_D(const QJsonRpcSharedMemoryDevice);
+    return d->state == QJsonRpcSharedMemoryDevicePrivate::SharedMemory;
+}
+
+int QJsonRpcSharedMemoryDevice::ringSize() const
+{
+    Q_D(const QJsonRpcSharedMemoryDevice);
+    return d->ringSize;
+}
+
+int QJsonRpcSharedMemoryDevice::doorbellCount() const
+{
+    Q_D(const QJsonRpcSharedMemoryDevice);
+    return d->doorbells;
+}
+
+bool QJsonRpcSharedMemoryDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 QJsonRpcSharedMemoryDevice::bytesAvailable() const
+{
+    Q_D(const QJsonRpcSharedMemoryDevice);
+    qint64 available = QIODevice::bytesAvailable() + d->available() + d->plainInput.size();
+    if (d->state == QJsonRpcSharedMemoryDevicePrivate::Plain && d->socket)
+        available += d->socket->bytesAvailable();
+    return available;
+}
+
+qint64 QJsonRpcSharedMemoryDevice::bytesToWrite() const
+{
+    Q_D(const QJsonRpcSharedMemoryDevice);
+    qint64 pending = d->pendingOutput.size();
+    if (d->socket)
+        pending += d->socket->bytesToWrite();
+    return pending;
+}
+
+void QJsonRpcSharedMemoryDevice::close()
+{
+    Q_D(QJsonRpcSharedMemoryDevice);
+    QIODevice::close();
+    if (d->socket)
+        d->socket->disconnectFromServer();
+    if (d->memory.isAttached())
+        d->memory.detach();
+    d->state = QJsonRpcSharedMemoryDevicePrivate::Plain;
+}
+
+qint64 QJsonRpcSharedMemoryDevice::readData(char *data, qint64 maxSize)
+{
+    Q_D(QJsonRpcSharedMemoryDevice);
+    if (d->state == QJsonRpcSharedMemoryDevicePrivate::Plain) {
+        // what came along with the line that switched to it goes first
+        if (!d->plainInput.isEmpty()) {
+            const int length = int(qMin(qint64(d->plainInput.size()), maxSize));
+            memcpy(data, d->plainInput.constData(), length);
+            d->plainInput.remove(0, length);
+            return length;
+        }
+        return d->socket ? d->socket->read(data, maxSize) : -1;
+    }
+    if (d->state != QJsonRpcSharedMemoryDevicePrivate::SharedMemory)
+        return 0;
+
+    QJsonRpcSharedRing *ring = d->incoming;
+    quint32 head;
+    quint32 tail;
+    const qint64 usage = d->used(ring, &head, &tail);
+    if (usage < 0) {
+        d->ringCorrupted();
+        return -1;
+    }
+
+    const quint32 available = quint32(usage);
+    const int length = int(qMin(qint64(available), maxSize));
+    if (length > 0) {
+        const int offset = int(tail & quint32(d->ringSize - 1));
+        const int first = qMin(length, d->ringSize - offset);
+        memcpy(data, d->incomingData + offset, first);
+        memcpy(data + first, d->incomingData, length - first);
+
+        exchangeOrdered(ring->tail, tail + quint32(length));
+        if (exchangeOrdered(ring->writerWaiting, 0))
+            d->scheduleDoorbell();
+    }
+
+    // drained, from now on the writer rings; data that arrived meanwhile
+    // is announced right away
+    if (quint32(length) == available) {
+        exchangeOrdered(ring->readerWaiting, 1);
+        if (loadOrdered(ring->head) != tail + quint32(length))
+            d->scheduleReadyRead();
+    }
+
+    return length;
+}
+
+qint64 QJsonRpcSharedMemoryDevice::writeData(const char *data, qint64 size)
+{
+    Q_D(QJsonRpcSharedMemoryDevice);
+    if (d->state == QJsonRpcSharedMemoryDevicePrivate::Plain)
+        return d->socket ? d->socket->write(data, size) : -1;
+
+    // kept in order behind what is already waiting
+    if (d->state == QJsonRpcSharedMemoryDevicePrivate::Attaching || !d->pendingOutput.isEmpty()) {
+        d->pendingOutput.append(data, int(size));
+        if (d->state == QJsonRpcSharedMemoryDevicePrivate::SharedMemory) {
+            d->flushPendingOutput();
+            // closed if the ring turned out corrupted
+            if (d->state != QJsonRpcSharedMemoryDevicePrivate::SharedMemory)
+                return -1;
+        }
+        return size;
+    }
+
+    const int written = d->writeRing(data, int(size));
+    if (d->state != QJsonRpcSharedMemoryDevicePrivate::SharedMemory)
+        return -1;
+    if (written < size) {
+        d->pendingOutput.append(data + written, int(size - written));
+        d->flushPendingOutput();
+    }
+    return size;
+}
+
+#include "moc_qjsonrpcsharedmemorydevice.cpp"
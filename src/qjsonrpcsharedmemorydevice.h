@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCSHAREDMEMORYDEVICE_H
+#define QJSONRPCSHAREDMEMORYDEVICE_H
+
+#include <QIODevice>
+#include <QScopedPointer>
+
+#include "qjsonrpcglobal.h"
+
+// Carries a connection between two processes of the same host through a
+// segment of shared memory, a ring per direction, rather than through the
+// kernel buffers of a local socket. The QLocalSocket the device is created
+// on only announces the segment and rings a doorbell, of one byte, for a
+// reader that ran out of data or a writer that ran out of space; a reader
+// kept busy is never woken up. Doorbells rung by many writes in one event
+// loop pass go out as one.
+//
+// Both ends have to use the device, the server's creates the segment. When
+// it can't, or the client can't attach to it, that end tells the other and
+// both fall back to writing through the local socket.
+//
+//     QJsonRpcSocket *socket =
+//         new QJsonRpcSocket(new QJsonRpcSharedMemoryDevice(localSocket, QJsonRpcSharedMemoryDevice::ClientRole));
+class QLocalSocket;
+class QJsonRpcSharedMemoryDevicePrivate;
+class QJSONRPC_EXPORT QJsonRpcSharedMemoryDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    enum Role {
+        ClientRole,     // attaches to the segment announced by the server
+        ServerRole      // creates and announces the segment
+    };
+
+    // ringSize is that of each direction, rounded up to a power of two, and
+    // only used by the server. The device is open right away, data written
+    // before the client attached is sent once it has
+    QJsonRpcSharedMemoryDevice(QLocalSocket *socket, Role role, int ringSize = 1024 * 1024,
+                               QObject *parent = 0);
+    ~QJsonRpcSharedMemoryDevice();
+
+    // false until the client attached, and after falling back
+    bool isSharedMemoryActive() const;
+    int ringSize() const;
+
+    // doorbells rung by this end
+    int doorbellCount() const;
+
+    virtual bool isSequential() const;
+    virtual qint64 bytesAvailable() const;
+    virtual qint64 bytesToWrite() const;
+    virtual void close();
+
+protected:
+    virtual qint64 readData(char *data, qint64 maxSize);
+    virtual qint64 writeData(const char *data, qint64 size);
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcSharedMemoryDevice)
+    Q_DISABLE_COPY(QJsonRpcSharedMemoryDevice)
+    Q_PRIVATE_SLOT(d_func(), void _q_socketReadyRead())
+    Q_PRIVATE_SLOT(d_func(), void _q_ringDoorbell())
+    Q_PRIVATE_SLOT(d_func(), void _q_emitReadyRead())
+    QScopedPointer<QJsonRpcSharedMemoryDevicePrivate> d_ptr;
+};
+
+#endif
@@ -1,7 +1,21 @@
 #include <QTimer>
 #include <QEventLoop>
+#include <QThread>
+#include <QAbstractSocket>
+#include <QLocalSocket>
 #include <QDebug>
 
+#include <climits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(Q_CC_MSVC)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #if QT_VERSION >= 0x050000
 #include <QJsonDocument>
 #else
@@ -11,412 +25,1955 @@
 #include "qjsonrpcservice.h"
 #include "qjsonrpcservicereply_p.h"
 #include "qjsonrpcservicereply.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpccodec.h"
+#include "qjsonrpccompression_p.h"
 #include "qjsonrpcsocket_p.h"
 #include "qjsonrpcsocket.h"
 
-int QJsonRpcSocketPrivate::findJsonDocumentEnd(const QByteArray &jsonData)
+// Returns the first position in [pos, end) holding one of the given
+// characters, or the start of the remaining tail that is too short to be
+// tested as a block. The caller handles that tail byte by byte.
+static inline const char *skipPlainBytes(const char *pos, const char *end,
+                                         char c1, char c2, char c3)
+{
+#if defined(__SSE2__)
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    const __m128i v3 = _mm_set1_epi8(c3);
+    while (end - pos >= 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+        const __m128i matches =
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, v1), _mm_cmpeq_epi8(block, v2)),
+                         _mm_cmpeq_epi8(block, v3));
+        const int mask = _mm_movemask_epi8(matches);
+        if (mask) {
+#if defined(Q_CC_MSVC)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return pos + index;
+#else
+            return pos + __builtin_ctz(mask);
+#endif
+        }
+
+        pos += 16;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const uint8x16_t v1 = vdupq_n_u8(static_cast<uint8_t>(c1));
+    const uint8x16_t v2 = vdupq_n_u8(static_cast<uint8_t>(c2));
+    const uint8x16_t v3 = vdupq_n_u8(static_cast<uint8_t>(c3));
+    while (end - pos >= 16) {
+        const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(pos));
+        const uint8x16_t matches =
+            vorrq_u8(vorrq_u8(vceqq_u8(block, v1), vceqq_u8(block, v2)), vceqq_u8(block, v3));
+        const uint64x2_t lanes = vreinterpretq_u64_u8(matches);
+        if (vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) {
+            // a match is guaranteed within this block
+            while (*pos != c1 && *pos != c2 && *pos != c3)
+                pos++;
+            return pos;
+        }
+
+        pos += 16;
+    }
+#else
+    Q_UNUSED(end)
+    Q_UNUSED(c1)
+    Q_UNUSED(c2)
+    Q_UNUSED(c3)
+#endif
+    return pos;
+}
+
+QJsonRpcSocketPrivate::FrameScanner::FrameScanner()
+{
+    reset();
+}
+
+void QJsonRpcSocketPrivate::FrameScanner::reset()
 {
-    const char* pos = jsonData.constData();
-    const char* end = pos + jsonData.length();
+    offset = 0;
+    depth = 0;
+    blockStart = 0;
+    blockEnd = 0;
+    inString = false;
+    escaped = false;
+}
 
-    char blockStart = 0;
-    char blockEnd = 0;
-    int index = 0;
+int QJsonRpcSocketPrivate::FrameScanner::scan(const char *data, int size)
+{
+    const char *pos = data + offset;
+    const char *end = data + size;
 
     // Find the beginning of the JSON document and determine if it is an object or an array
-    while (true) {
+    if (depth == 0) {
+        while (pos != end && *pos != '{' && *pos != '[')
+            pos++;
+
         if (pos == end) {
+            offset = size;
             return -1;
-        } else if (*pos == '{') {
-            blockStart = '{';
-            blockEnd = '}';
-            break;
-        } else if(*pos == '[') {
-            blockStart = '[';
-            blockEnd = ']';
-            break;
         }
 
+        blockStart = *pos;
+        blockEnd = (blockStart == '{') ? '}' : ']';
+        depth = 1;
         pos++;
-        index++;
-    }
-
-    // Find the end of the JSON document
-    pos++;
-    index++;
-    int depth = 1;
-    bool inString = false;
-    while (depth > 0 && pos <= end) {
-        if (*pos == '\\') {
-            pos += 2;
-            index += 2;
-            continue;
-        } else if (*pos == '"') {
-            inString = !inString;
-        } else if (!inString) {
-            if (*pos == blockStart)
-                depth++;
-            else if (*pos == blockEnd)
-                depth--;
+    }
+
+    // Find the end of the JSON document, an escape sequence may be split
+    // across two chunks so it is tracked as part of the state
+    while (pos != end) {
+        // skip over blocks that can't change the state, inside a string only
+        // quotes and backslashes matter
+        if (!escaped) {
+            pos = inString ? skipPlainBytes(pos, end, '"', '\\', '"')
+                           : skipPlainBytes(pos, end, '"', blockStart, blockEnd);
+            if (pos == end)
+                break;
+        }
+
+        const char c = *pos;
+        if (inString) {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                inString = false;
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == blockStart) {
+            depth++;
+        } else if (c == blockEnd && --depth == 0) {
+            int index = pos - data;
+            reset();
+            return index;
         }
 
         pos++;
-        index++;
     }
 
-    // index-1 because we are one position ahead
-    return depth == 0 ? index-1 : -1;
+    offset = size;
+    return -1;
 }
 
-void QJsonRpcSocketPrivate::writeData(const QJsonRpcMessage &message)
+int QJsonRpcSocketPrivate::findJsonDocumentEnd(const QByteArray &jsonData)
 {
-    Q_Q(QJsonRpcSocket);
-    QJsonDocument doc = QJsonDocument(message.toObject());
-#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
-    QByteArray data = doc.toJson(QJsonDocument::Compact);
-#else
-    QByteArray data = doc.toJson();
-#endif
+    FrameScanner frameScanner;
+    return frameScanner.scan(jsonData.constData(), jsonData.size());
+}
 
-    device.data()->write(data);
-    qJsonRpcDebug() << "sending(" << q << "): " << data;
+void QJsonRpcSocketPrivate::compactBuffer()
+{
+    if (bufferOffset == 0)
+        return;
+
+    // only move the remaining data once at least half of the buffer has
+    // been consumed, so compaction is amortized over many messages
+    if (bufferOffset >= buffer.size()) {
+        buffer.clear();
+        bufferOffset = 0;
+    } else if (bufferOffset >= buffer.size() / 2) {
+        buffer.remove(0, bufferOffset);
+        bufferOffset = 0;
+    }
 }
 
-QJsonRpcAbstractSocket::QJsonRpcAbstractSocket(QObject *parent)
-#if defined(USE_QT_PRIVATE_HEADERS)
-    : QObject(*new QJsonRpcAbstractSocketPrivate, parent)
-#else
-    : QObject(parent),
-      d_ptr(new QJsonRpcAbstractSocketPrivate)
-#endif
+bool QJsonRpcSocketPrivate::atFrameHeader() const
 {
+    if (framingMode == QJsonRpc::ContentLengthFraming || contentLength != -1)
+        return true;
+    if (incoming.isStarted())
+        return false;
+
+    // peers writing another encoding prefix every frame with a header, even
+    // when plain JSON documents are expected
+    for (int i = bufferOffset; i < buffer.size(); ++i) {
+        const char c = buffer.at(i);
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            return c == 'C' || c == 'c';
+    }
+    return false;
 }
 
-QJsonRpcAbstractSocket::~QJsonRpcAbstractSocket()
+int QJsonRpcSocketPrivate::nextFrame(int *frameStart)
 {
+    if (atFrameHeader()) {
+        if (contentLength == -1) {
+            int headerEnd = buffer.indexOf("\r\n\r\n", bufferOffset);
+            if (headerEnd == -1)
+                return -1;
+
+            // a header without a usable length yields an empty frame, which
+            // is then dropped as malformed
+            contentLength = 0;
+            frameCodec = 0;
+            frameCompressed = false;
+            frameAttachmentSizes.clear();
+            frameAttachmentsSize = 0;
+            QList<QByteArray> headers = buffer.mid(bufferOffset, headerEnd - bufferOffset).split('\n');
+            foreach (const QByteArray &header, headers) {
+                int colon = header.indexOf(':');
+                if (colon == -1)
+                    continue;
+
+                const QByteArray name = header.left(colon).trimmed().toLower();
+                if (name == "content-length") {
+                    bool ok = false;
+                    int length = header.mid(colon + 1).trimmed().toInt(&ok);
+                    if (ok && length > 0)
+                        contentLength = length;
+                } else if (name == "content-type") {
+                    // unknown types are read as text JSON
+                    frameCodec = QJsonRpcCodec::codecForContentType(header.mid(colon + 1));
+                    if (frameCodec == QJsonRpcCodec::json())
+                        frameCodec = 0;
+                } else if (name == "content-encoding") {
+                    frameCompressed = (header.mid(colon + 1).trimmed().toLower() == "deflate");
+                } else if (name == "attachments") {
+                    // a malformed list leaves the frame without attachments
+                    foreach (const QByteArray &size, header.mid(colon + 1).split(',')) {
+                        bool ok = false;
+                        int length = size.trimmed().toInt(&ok);
+                        if (!ok || length < 0 || length > INT_MAX / 2 - frameAttachmentsSize) {
+                            frameAttachmentSizes.clear();
+                            frameAttachmentsSize = 0;
+                            break;
+                        }
+                        frameAttachmentSizes.append(length);
+                        frameAttachmentsSize += length;
+                    }
+                }
+            }
+
+            peerCodec = frameCodec;
+            incoming.reset();
+            bufferOffset = headerEnd + 4;
+
+            const qint64 announced = qint64(contentLength) + frameAttachmentsSize;
+            const qint64 maximum = maximumFrameSize >= 0 ? qint64(maximumFrameSize)
+                                                         : qint64(MaximumAnnouncedFrameSize);
+            if (announced > maximum) {
+                qJsonRpcDebug() << Q_FUNC_INFO << "frame of" << announced << "bytes is too large";
+                dropConnection();
+                return -1;
+            }
+        }
+
+        if (qint64(buffer.size()) - bufferOffset < qint64(contentLength) + frameAttachmentsSize)
+            return -1;
+
+        int frameSize = contentLength;
+        contentLength = -1;
+        *frameStart = bufferOffset;
+        return frameSize;
+    }
+
+    // parsed while it arrives, processFrame picks up the result
+    if (incoming.feed(buffer.constData() + bufferOffset, buffer.size() - bufferOffset) ==
+            QJsonRpcIncrementalParser::NeedMoreData)
+        return -1;
+
+    frameCodec = 0;
+    frameCompressed = false;
+    frameAttachmentSizes.clear();
+    frameAttachmentsSize = 0;
+    *frameStart = bufferOffset;
+    return incoming.documentEnd();
 }
 
-QJsonRpcAbstractSocket::QJsonRpcAbstractSocket(QJsonRpcAbstractSocketPrivate &dd, QObject *parent)
-#if defined(USE_QT_PRIVATE_HEADERS)
-    : QObject(dd, parent)
+static inline QByteArray compactJson(const QJsonDocument &doc)
+{
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    return doc.toJson(QJsonDocument::Compact);
 #else
-    : QObject(parent),
-      d_ptr(&dd)
+    return doc.toJson();
 #endif
-{
 }
 
-bool QJsonRpcAbstractSocket::isValid() const
+QJsonRpcCodec *QJsonRpcSocketPrivate::writeCodec() const
 {
-    return false;
+    QJsonRpcCodec *outgoing = codec ? codec : peerCodec;
+    return outgoing == QJsonRpcCodec::json() ? 0 : outgoing;
 }
 
-void QJsonRpcAbstractSocket::setDefaultRequestTimeout(int msecs)
+void QJsonRpcSocketPrivate::writeData(const QJsonRpcMessage &message)
 {
-    Q_D(QJsonRpcAbstractSocket);
+    if (!message.attachments().isEmpty()) {
+        if (attachmentsEnabled && !messageFraming)
+            writeAttachmentFrame(message);
+        else
+            writeData(QJsonRpcMessagePrivate::inlineAttachments(message));
+        return;
+    }
 
-    if (msecs < 0) {
-        qJsonRpcDebug() << "Cannot set a negative request timeout msecs value";
+    if (QJsonRpcCodec *outgoing = writeCodec()) {
+        writeFrame(outgoing->encode(message.toObject()), outgoing->contentType());
         return;
     }
 
-    d->defaultRequestTimeout = msecs;
+    // serialized straight into the coalescing buffer when there is no
+    // header, messages drained from other threads are always gathered
+    if ((writeCoalescingDelay >= 0 || drainingOutbound) &&
+        framingMode != QJsonRpc::ContentLengthFraming &&
+        compressionThreshold < 0 && !messageFraming) {
+        Q_Q(QJsonRpcSocket);
+        if (!writeBuffer.capacity())
+            writeBuffer.reserve(4096);
+        int start = writeBuffer.size();
+        QJsonRpcMessagePrivate::writeJson(message, writeBuffer, requestIdsAsStrings);
+        qJsonRpcDebug() << "sending(" << q << "): " << writeBuffer.mid(start);
+        if (!drainingOutbound || writeBuffer.size() >= writeCoalescingThreshold)
+            scheduleFlush();
+        return;
+    }
+
+    if (!frameBuffer.capacity())
+        frameBuffer.reserve(4096);
+    frameBuffer.resize(0);
+    QJsonRpcMessagePrivate::writeJson(message, frameBuffer, requestIdsAsStrings);
+    writeFrame(frameBuffer);
 }
 
-int QJsonRpcAbstractSocket::getDefaultRequestTimeout() const
+void QJsonRpcSocketPrivate::writeData(const QList<QJsonRpcMessage> &batch)
 {
-    Q_D(const QJsonRpcAbstractSocket);
+    if (QJsonRpcCodec *outgoing = writeCodec()) {
+        QJsonArray array;
+        for (int i = 0; i < batch.size(); ++i)
+            array.append(QJsonRpcMessagePrivate::inlineAttachments(batch.at(i)).toObject());
+        writeFrame(outgoing->encode(array), outgoing->contentType());
+        return;
+    }
 
-    return d->defaultRequestTimeout;
+    if (!frameBuffer.capacity())
+        frameBuffer.reserve(4096);
+    frameBuffer.resize(0);
+    frameBuffer.append('[');
+    for (int i = 0; i < batch.size(); ++i) {
+        if (i)
+            frameBuffer.append(',');
+        // batches have a single body, where attachments can't be told apart
+        QJsonRpcMessagePrivate::writeJson(QJsonRpcMessagePrivate::inlineAttachments(batch.at(i)),
+                                          frameBuffer, requestIdsAsStrings);
+    }
+    frameBuffer.append(']');
+    writeFrame(frameBuffer);
 }
 
-QJsonRpcMessage QJsonRpcAbstractSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+void QJsonRpcSocketPrivate::writeData(const QJsonArray &batch)
 {
-    Q_UNUSED(message)
-    Q_UNUSED(msecs)
-
-    return QJsonRpcMessage();
+    if (QJsonRpcCodec *outgoing = writeCodec())
+        writeFrame(outgoing->encode(batch), outgoing->contentType());
+    else
+        writeFrame(compactJson(QJsonDocument(batch)));
 }
 
-QJsonRpcServiceReply *QJsonRpcAbstractSocket::sendMessage(const QJsonRpcMessage &message)
+void QJsonRpcSocketPrivate::prepareFrame(const QByteArray &data, const QByteArray &contentType,
+                                         QByteArray *header, QByteArray *body,
+                                         const QList<QByteArray> &attachments) const
 {
-    Q_UNUSED(message)
+    // large frames are sent as a zlib stream, which is qCompress's output
+    // without its length prefix
+    bool compressed = false;
+    if (compressionThreshold >= 0 && data.size() >= compressionThreshold) {
+        *body = qCompress(data);
+        body->remove(0, 4);
+        compressed = true;
+    } else {
+        *body = data;
+    }
 
-    return 0;
+    // frames in another encoding than text JSON always carry a header, and
+    // so do those with attachments, which aren't compressed
+    if (framingMode == QJsonRpc::ContentLengthFraming || !contentType.isEmpty() || compressed ||
+        !attachments.isEmpty()) {
+        *header = "Content-Length: " + QByteArray::number(body->size()) + "\r\n";
+        if (!contentType.isEmpty())
+            *header += "Content-Type: " + contentType + "\r\n";
+        if (compressed)
+            *header += "Content-Encoding: deflate\r\n";
+        if (!attachments.isEmpty()) {
+            *header += "Attachments: ";
+            for (int i = 0; i < attachments.size(); ++i) {
+                if (i)
+                    *header += ',';
+                *header += QByteArray::number(attachments.at(i).size());
+            }
+            *header += "\r\n";
+        }
+        *header += "\r\n";
+    }
 }
 
-QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &arg1,
-                                                                   const QVariant &arg2, const QVariant &arg3,
-                                                                   const QVariant &arg4, const QVariant &arg5,
-                                                                   const QVariant &arg6, const QVariant &arg7,
-                                                                   const QVariant &arg8, const QVariant &arg9,
-                                                                   const QVariant &arg10)
+void QJsonRpcSocketPrivate::writeFrame(const QByteArray &data, const QByteArray &contentType)
 {
-    Q_UNUSED(method)
-    Q_UNUSED(msecs)
-    Q_UNUSED(arg1)
-    Q_UNUSED(arg2)
-    Q_UNUSED(arg3)
-    Q_UNUSED(arg4)
-    Q_UNUSED(arg5)
-    Q_UNUSED(arg6)
-    Q_UNUSED(arg7)
-    Q_UNUSED(arg8)
-    Q_UNUSED(arg9)
-    Q_UNUSED(arg10)
+    Q_Q(QJsonRpcSocket);
+    qJsonRpcDebug() << "sending(" << q << "): " << data;
 
-    return QJsonRpcMessage();
+    QByteArray header;
+    QByteArray body;
+    prepareFrame(data, contentType, &header, &body);
+    if (!header.isEmpty())
+        writeRaw(header);
+    writeRaw(body);
 }
 
-QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method, const QVariant &arg1,
-                                                                   const QVariant &arg2, const QVariant &arg3,
-                                                                   const QVariant &arg4, const QVariant &arg5,
-                                                                   const QVariant &arg6, const QVariant &arg7,
-                                                                   const QVariant &arg8, const QVariant &arg9,
-                                                                   const QVariant &arg10)
+void QJsonRpcSocketPrivate::writeRaw(const QByteArray &data)
 {
-    Q_D(QJsonRpcAbstractSocket);
-    return invokeRemoteMethodBlocking(method, d->defaultRequestTimeout, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10);
-}
+    if (dropped)
+        return;
 
-QJsonRpcServiceReply *QJsonRpcAbstractSocket::invokeRemoteMethod(const QString &method, const QVariant &arg1,
-                                                                 const QVariant &arg2, const QVariant &arg3,
-                                                                 const QVariant &arg4, const QVariant &arg5,
-                                                                 const QVariant &arg6, const QVariant &arg7,
-                                                                 const QVariant &arg8, const QVariant &arg9,
-                                                                 const QVariant &arg10)
-{
-    Q_UNUSED(method)
-    Q_UNUSED(arg1)
-    Q_UNUSED(arg2)
-    Q_UNUSED(arg3)
-    Q_UNUSED(arg4)
-    Q_UNUSED(arg5)
-    Q_UNUSED(arg6)
-    Q_UNUSED(arg7)
-    Q_UNUSED(arg8)
-    Q_UNUSED(arg9)
-    Q_UNUSED(arg10)
+    if (writeCoalescingDelay < 0) {
+        device.data()->write(data);
+        updateWriteBuffer();
+        return;
+    }
 
-    return 0;
+    writeBuffer.append(data);
+    scheduleFlush();
 }
 
-QJsonRpcSocket::QJsonRpcSocket(QIODevice *device, QObject *parent)
-#if defined(USE_QT_PRIVATE_HEADERS)
-    : QJsonRpcAbstractSocket(*new QJsonRpcSocketPrivate(this), parent)
-#else
-    : QJsonRpcAbstractSocket(parent),
-      d_ptr(new QJsonRpcSocketPrivate(this))
-#endif
+void QJsonRpcSocketPrivate::writeAttachmentFrame(const QJsonRpcMessage &message)
 {
-    Q_D(QJsonRpcSocket);
-    connect(device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
-    d->device = device;
+    Q_Q(QJsonRpcSocket);
+    QByteArray data;
+    QByteArray contentType;
+    encodeMessage(message, &data, &contentType);
+    qJsonRpcDebug() << "sending(" << q << "): " << data;
+
+    const QList<QByteArray> attachments = message.attachments();
+    QByteArray header;
+    QByteArray body;
+    prepareFrame(data, contentType, &header, &body, attachments);
+
+    // attachments go to the device as they are, rather than being copied
+    // into the coalescing buffer, which is written first to keep the order
+    _q_flushWriteBuffer();
+    device.data()->write(header);
+    device.data()->write(body);
+    foreach (const QByteArray &attachment, attachments)
+        device.data()->write(attachment);
+    updateWriteBuffer();
 }
 
-QJsonRpcSocket::QJsonRpcSocket(QJsonRpcSocketPrivate &dd, QObject *parent)
-#if defined(USE_QT_PRIVATE_HEADERS)
-    : QJsonRpcAbstractSocket(dd, parent)
-#else
-    : QJsonRpcAbstractSocket(parent),
-      d_ptr(&dd)
-#endif
+void QJsonRpcSocketPrivate::encodeMessage(const QJsonRpcMessage &message, QByteArray *data,
+                                          QByteArray *contentType) const
 {
-    Q_D(QJsonRpcSocket);
-    connect(d->device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
+    if (QJsonRpcCodec *outgoing = writeCodec()) {
+        *data = outgoing->encode(message.toObject());
+        *contentType = outgoing->contentType();
+    } else {
+        QJsonRpcMessagePrivate::writeJson(message, *data, requestIdsAsStrings);
+    }
 }
 
-QJsonRpcSocket::~QJsonRpcSocket()
+QByteArray QJsonRpcSocketPrivate::encodeFrame(const QJsonRpcMessage &message) const
 {
+    const QList<QByteArray> attachments = message.attachments();
+    if (!attachments.isEmpty() && !attachmentsEnabled)
+        return encodeFrame(QJsonRpcMessagePrivate::inlineAttachments(message));
+
+    QByteArray data;
+    QByteArray contentType;
+    encodeMessage(message, &data, &contentType);
+
+    QByteArray header;
+    QByteArray body;
+    prepareFrame(data, contentType, &header, &body, attachments);
+    QByteArray frame = header + body;
+    foreach (const QByteArray &attachment, attachments)
+        frame += attachment;
+    return frame;
 }
 
-bool QJsonRpcSocket::isValid() const
+QByteArray QJsonRpcSocketPrivate::wireFormat() const
 {
-    Q_D(const QJsonRpcSocket);
-    return d->device && d->device.data()->isOpen();
+    QByteArray format;
+    if (QJsonRpcCodec *outgoing = writeCodec())
+        format = outgoing->contentType();
+    format += (framingMode == QJsonRpc::ContentLengthFraming) ? "|length|" : "|json|";
+    format += QByteArray::number(compressionThreshold);
+    if (requestIdsAsStrings)
+        format += "|strings";
+    if (attachmentsEnabled)
+        format += "|attachments";
+    return format;
 }
 
-/*
-void QJsonRpcSocket::sendMessage(const QList<QJsonRpcMessage> &messages)
+void QJsonRpcSocketPrivate::_q_writeBroadcast(const QJsonRpcBroadcastPointer &broadcast)
 {
-    QJsonArray array;
-    foreach (QJsonRpcMessage message, messages) {
-        array.append(message.toObject());
+    if (!device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return;
     }
 
-    QJsonDocument doc = QJsonDocument(array);
-    m_device.data()->write(doc.toBinaryData());
+    if (!dropped) {
+        markActivity();
+        writeRaw(broadcast->frame(this));
+    }
 }
-*/
 
-QJsonRpcMessage QJsonRpcSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+QByteArray QJsonRpcBroadcast::frame(const QJsonRpcSocketPrivate *socket)
 {
-    Q_D(QJsonRpcSocket);
-    QJsonRpcServiceReply *reply = sendMessage(message);
-    QScopedPointer<QJsonRpcServiceReply> replyPtr(reply);
+    const QByteArray format = socket->wireFormat();
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, QByteArray>::const_iterator it = frames.constFind(format);
+    if (it != frames.constEnd())
+        return it.value();
 
-    QEventLoop responseLoop;
-    connect(reply, SIGNAL(finished()), &responseLoop, SLOT(quit()));
-    QTimer::singleShot(msecs, &responseLoop, SLOT(quit()));
-    responseLoop.exec();
+    QByteArray frame = socket->encodeFrame(message);
+    frames.insert(format, frame);
+    return frame;
+}
 
-    if (!reply->response().isValid()) {
-        d->replies.remove(message.id());
-        return message.createErrorResponse(QJsonRpc::TimeoutError, "request timed out");
-    }
+void QJsonRpcBlockingCall::finish(const QJsonRpcMessage &message)
+{
+    QMutexLocker locker(&mutex);
+    if (finished)
+        return;
 
-    return reply->response();
+    response = message;
+    finished = true;
+    done.wakeAll();
 }
 
-QJsonRpcServiceReply *QJsonRpcSocket::sendMessage(const QJsonRpcMessage &message)
+QJsonRpcMessage QJsonRpcBlockingCall::wait()
 {
-    Q_D(QJsonRpcSocket);
-    if (!d->device) {
-        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
-        return 0;
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker(&mutex);
+    while (!finished) {
+        const qint64 remaining = msecs - timer.elapsed();
+        if (remaining <= 0)
+            break;
+        done.wait(&mutex, (unsigned long)remaining);
     }
 
-    notify(message);
-    QPointer<QJsonRpcServiceReply> reply(new QJsonRpcServiceReply);
-    reply->d_func()->request = message;
-    d->replies.insert(message.id(), reply);
-    return reply;
+    if (!finished) {
+        finished = true;
+        response = request.createErrorResponse(QJsonRpc::TimeoutError, "request timed out");
+    }
+    return response;
 }
 
-void QJsonRpcSocket::notify(const QJsonRpcMessage &message)
+bool QJsonRpcRequestCancellation::isCancelled() const
 {
-    Q_D(QJsonRpcSocket);
-    if (!d->device) {
-        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+    return const_cast<QAtomicInt &>(cancelled).fetchAndAddOrdered(0) != 0;
+}
+
+void QJsonRpcRequestCancellation::cancel()
+{
+    if (!cancelled.testAndSetOrdered(0, 1))
         return;
-    }
 
-    // disconnect the result message if we need to
-    QJsonRpcService *service = qobject_cast<QJsonRpcService*>(sender());
+    // receivers on the service's thread are called from there
     if (service)
-        disconnect(service, SIGNAL(result(QJsonRpcMessage)), this, SLOT(notify(QJsonRpcMessage)));
+        QMetaObject::invokeMethod(service, "requestCancelled", Qt::DirectConnection,
+                                  Q_ARG(QJsonRpcMessage, request));
+    if (watcher)
+        QMetaObject::invokeMethod(watcher, "cancel", Qt::QueuedConnection);
+}
 
-    d->writeData(message);
+void QJsonRpcMemoryAccount::update(qint64 delta)
+{
+    QMutexLocker locker(&mutex);
+    current.bytes += delta;
+    if (current.bytes > current.peakBytes)
+        current.peakBytes = current.bytes;
 }
 
-QJsonRpcMessage QJsonRpcSocket::invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &param1,
-                                                           const QVariant &param2, const QVariant &param3,
-                                                           const QVariant &param4, const QVariant &param5,
-                                                           const QVariant &param6, const QVariant &param7,
-                                                           const QVariant &param8, const QVariant &param9,
-                                                           const QVariant &param10)
-{
-    QVariantList params;
-    if (param1.isValid()) params.append(param1);
-    if (param2.isValid()) params.append(param2);
-    if (param3.isValid()) params.append(param3);
-    if (param4.isValid()) params.append(param4);
-    if (param5.isValid()) params.append(param5);
-    if (param6.isValid()) params.append(param6);
-    if (param7.isValid()) params.append(param7);
-    if (param8.isValid()) params.append(param8);
-    if (param9.isValid()) params.append(param9);
-    if (param10.isValid()) params.append(param10);
+void QJsonRpcMemoryAccount::connectionDropped()
+{
+    QMutexLocker locker(&mutex);
+    current.droppedConnections++;
+}
 
-    QJsonRpcMessage request =
-        QJsonRpcMessage::createRequest(method, QJsonArray::fromVariantList(params));
-    return sendMessageBlocking(request, msecs);
+QJsonRpcMemoryStats QJsonRpcMemoryAccount::stats() const
+{
+    QMutexLocker locker(&mutex);
+    return current;
 }
 
-QJsonRpcMessage QJsonRpcSocket::invokeRemoteMethodBlocking(const QString &method, const QVariant &param1,
-                                                           const QVariant &param2, const QVariant &param3,
-                                                           const QVariant &param4, const QVariant &param5,
-                                                           const QVariant &param6, const QVariant &param7,
-                                                           const QVariant &param8, const QVariant &param9,
-                                                           const QVariant &param10)
+void QJsonRpcAbstractSocketPrivate::post(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message)
 {
-    Q_D(QJsonRpcSocket);
-    return invokeRemoteMethodBlocking(method, d->defaultRequestTimeout, param1, param2, param3, param4, param5, param6, param7, param8, param9, param10);
-}
-
-QJsonRpcServiceReply *QJsonRpcSocket::invokeRemoteMethod(const QString &method, const QVariant &param1,
-                                                         const QVariant &param2, const QVariant &param3,
-                                                         const QVariant &param4, const QVariant &param5,
-                                                         const QVariant &param6, const QVariant &param7,
-                                                         const QVariant &param8, const QVariant &param9,
-                                                         const QVariant &param10)
-{
-    QVariantList params;
-    if (param1.isValid()) params.append(param1);
-    if (param2.isValid()) params.append(param2);
-    if (param3.isValid()) params.append(param3);
-    if (param4.isValid()) params.append(param4);
-    if (param5.isValid()) params.append(param5);
-    if (param6.isValid()) params.append(param6);
-    if (param7.isValid()) params.append(param7);
-    if (param8.isValid()) params.append(param8);
-    if (param9.isValid()) params.append(param9);
-    if (param10.isValid()) params.append(param10);
+    if (socket->thread() == QThread::currentThread())
+        socket->notify(message);
+    else
+        get(socket)->postQueued(socket, message);
+}
 
-    QJsonRpcMessage request =
-        QJsonRpcMessage::createRequest(method, QJsonArray::fromVariantList(params));
-    return sendMessage(request);
+void QJsonRpcAbstractSocketPrivate::postQueued(QJsonRpcAbstractSocket *socket,
+                                               const QJsonRpcMessage &message)
+{
+    QMetaObject::invokeMethod(socket, "notify", Qt::QueuedConnection,
+                              Q_ARG(QJsonRpcMessage, message));
 }
 
-void QJsonRpcSocketPrivate::_q_processIncomingData()
+QJsonRpcSocketHandlePointer QJsonRpcAbstractSocketPrivate::handle(QJsonRpcAbstractSocket *socket)
 {
-    Q_Q(QJsonRpcSocket);
-    if (!device) {
-        qJsonRpcDebug() << Q_FUNC_INFO << "called without device";
-        return;
-    }
+    QJsonRpcAbstractSocketPrivate *d = get(socket);
+    if (!d->socketHandle)
+        d->socketHandle = QJsonRpcSocketHandlePointer(new QJsonRpcSocketHandle(socket));
+    return d->socketHandle;
+}
 
-    buffer.append(device.data()->readAll());
-    while (!buffer.isEmpty()) {
-        int dataSize = findJsonDocumentEnd(buffer);
-        if (dataSize == -1) {
-            // incomplete data, wait for more
-            return;
-        }
+bool QJsonRpcSocketHandle::post(const QJsonRpcMessage &message)
+{
+    QMutexLocker locker(&mutex);
+    if (!socket)
+        return false;
 
-        QJsonParseError error;
-        QJsonDocument document = QJsonDocument::fromJson(buffer.mid(0, dataSize + 1), &error);
-        if (document.isEmpty()) {
-            if (error.error != QJsonParseError::NoError) {
-                qJsonRpcDebug() << Q_FUNC_INFO << error.errorString();
-            }
+    QJsonRpcAbstractSocketPrivate::post(socket, message);
+    return true;
+}
 
-            break;
-        }
+void QJsonRpcSocketHandle::reset()
+{
+    QMutexLocker locker(&mutex);
+    socket = 0;
+}
 
-        buffer = buffer.mid(dataSize + 1);
-        if (document.isArray()) {
-            qJsonRpcDebug() << Q_FUNC_INFO << "bulk support is current disabled";
-            /*
-            for (int i = 0; i < document.array().size(); ++i) {
-                QJsonObject messageObject = document.array().at(i).toObject();
-                if (!messageObject.isEmpty()) {
-                    QJsonRpcMessage message(messageObject);
-                    Q_EMIT messageReceived(message);
-                }
-            }
-            */
-        } else if (document.isObject()){
-            qJsonRpcDebug() << "received(" << q << "): " << document.toJson(QJsonDocument::Compact);
-            QJsonRpcMessage message = QJsonRpcMessage::fromObject(document.object());
-            Q_EMIT q->messageReceived(message);
-
-            if (message.type() == QJsonRpcMessage::Response ||
-                message.type() == QJsonRpcMessage::Error) {
-                if (replies.contains(message.id())) {
-                    QPointer<QJsonRpcServiceReply> reply = replies.take(message.id());
-                    if (!reply.isNull()) {
-                        reply->d_func()->response = message;
-                        reply->finished();
-                    }
-                }
-            } else {
-                q->processRequestMessage(message);
-            }
-        }
+void QJsonRpcAbstractSocketPrivate::trackRequest(const QJsonRpcRequestCancellationPointer &cancellation)
+{
+    QMutexLocker locker(&trackedRequestsMutex);
+    trackedRequests.insert(cancellation->request.id(), cancellation);
+}
+
+void QJsonRpcAbstractSocketPrivate::untrackRequest(qint64 id)
+{
+    QMutexLocker locker(&trackedRequestsMutex);
+    trackedRequests.remove(id);
+}
+
+void QJsonRpcAbstractSocketPrivate::cancelRequest(qint64 id)
+{
+    QMutexLocker locker(&trackedRequestsMutex);
+    QJsonRpcRequestCancellationPointer cancellation = trackedRequests.take(id).toStrongRef();
+    locker.unlock();
+
+    if (cancellation) {
+        cancellation->cancel();
+        requestCancelled(cancellation->request);
+    }
+}
+
+void QJsonRpcAbstractSocketPrivate::cancelRequests()
+{
+    QMutexLocker locker(&trackedRequestsMutex);
+    QHash<qint64, QWeakPointer<QJsonRpcRequestCancellation> > requests;
+    requests.swap(trackedRequests);
+    locker.unlock();
+
+    foreach (const QWeakPointer<QJsonRpcRequestCancellation> &request, requests) {
+        QJsonRpcRequestCancellationPointer cancellation = request.toStrongRef();
+        if (cancellation)
+            cancellation->cancel();
     }
 }
 
+QJsonRpcMessage QJsonRpcSocketPrivate::sendBlockingCall(const QJsonRpcMessage &request, int msecs)
+{
+    Q_Q(QJsonRpcSocket);
+    QJsonRpcBlockingCallPointer call(new QJsonRpcBlockingCall(request, msecs));
+    bool first;
+    {
+        QMutexLocker locker(&blockingCallsMutex);
+        first = queuedBlockingCalls.isEmpty();
+        queuedBlockingCalls.append(call);
+    }
+
+    // calls queued meanwhile are picked up along with this one
+    if (first)
+        QMetaObject::invokeMethod(q, "_q_startBlockingCalls", Qt::QueuedConnection);
+    return call->wait();
+}
+
+void QJsonRpcSocketPrivate::_q_startBlockingCalls()
+{
+    QList<QJsonRpcBlockingCallPointer> calls;
+    {
+        QMutexLocker locker(&blockingCallsMutex);
+        calls.swap(queuedBlockingCalls);
+    }
+
+    foreach (const QJsonRpcBlockingCallPointer &call, calls) {
+        if (!device) {
+            call->finish(call->request.createErrorResponse(QJsonRpc::InternalError, "no device"));
+            continue;
+        }
+
+        blockingCalls.insert(call->request.id(), call);
+        addDeadline(call->request.id(), call->msecs);
+        writeRequest(call->request, call->msecs);
+    }
+}
+
+void QJsonRpcSocketPrivate::abortBlockingCalls()
+{
+    QList<QJsonRpcBlockingCallPointer> calls = blockingCalls.values();
+    blockingCalls.clear();
+    {
+        QMutexLocker locker(&blockingCallsMutex);
+        calls += queuedBlockingCalls;
+        queuedBlockingCalls.clear();
+    }
+
+    foreach (const QJsonRpcBlockingCallPointer &call, calls)
+        call->finish(call->request.createErrorResponse(QJsonRpc::InternalError, "socket destroyed"));
+}
+
+void QJsonRpcSocketPrivate::scheduleFlush()
+{
+    Q_Q(QJsonRpcSocket);
+    if (writeBuffer.size() >= writeCoalescingThreshold) {
+        _q_flushWriteBuffer();
+        updateWriteBuffer();
+        return;
+    }
+
+    if (!flushTimer) {
+        flushTimer = new QTimer(q);
+        flushTimer->setSingleShot(true);
+        QObject::connect(flushTimer, SIGNAL(timeout()), q, SLOT(_q_flushWriteBuffer()));
+    }
+
+    if (!flushTimer->isActive())
+        flushTimer->start(writeCoalescingDelay);
+    updateWriteBuffer();
+}
+
+void QJsonRpcSocketPrivate::postQueued(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message)
+{
+    outbound.enqueue(QJsonRpcMessagePrivate::withSerializedResult(message));
+
+    // one wakeup for all the messages queued until the socket drains them
+    if (outboundScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(socket, "_q_drainOutbound", Qt::QueuedConnection);
+}
+
+void QJsonRpcSocketPrivate::_q_drainOutbound()
+{
+    Q_Q(QJsonRpcSocket);
+    // cleared first, a message enqueued from now on schedules another pass
+    outboundScheduled.fetchAndStoreOrdered(0);
+
+    drainingOutbound = true;
+    QJsonRpcMessage message;
+    while (outbound.dequeue(&message))
+        q->notify(message);
+    drainingOutbound = false;
+
+    // still coalesced with what follows when that is enabled
+    if (writeCoalescingDelay >= 0 && !writeBuffer.isEmpty()) {
+        scheduleFlush();
+    } else {
+        _q_flushWriteBuffer();
+        updateWriteBuffer();
+    }
+}
+
+void QJsonRpcSocketPrivate::writeRequest(const QJsonRpcMessage &message, int msecs)
+{
+    Q_Q(QJsonRpcSocket);
+    if (message.type() != QJsonRpcMessage::Request) {
+        q->notify(message);
+        return;
+    }
+
+    const QJsonRpcMessage request = (deadlinePropagation && msecs > 0) ?
+        QJsonRpcMessagePrivate::withTimeout(message, msecs) : message;
+
+    // held in order, behind those already waiting
+    if (writeBlocked || !heldRequests.isEmpty() ||
+        (maximumRequestsInFlight >= 0 && requestsInFlight.size() >= maximumRequestsInFlight)) {
+        heldRequests.append(request);
+        return;
+    }
+
+    if (maximumRequestsInFlight >= 0)
+        requestsInFlight.insert(request.id());
+    q->notify(request);
+}
+
+void QJsonRpcSocketPrivate::requestFinished(qint64 id)
+{
+    if (requestsInFlight.remove(id)) {
+        releaseHeldRequests();
+        return;
+    }
+
+    // timed out before there was room to send it
+    for (int i = 0; i < heldRequests.size(); ++i) {
+        if (heldRequests.at(i).id() == id) {
+            heldRequests.removeAt(i);
+            return;
+        }
+    }
+}
+
+void QJsonRpcSocketPrivate::releaseHeldRequests()
+{
+    Q_Q(QJsonRpcSocket);
+    while (!heldRequests.isEmpty() && !writeBlocked && device &&
+           (maximumRequestsInFlight < 0 || requestsInFlight.size() < maximumRequestsInFlight)) {
+        QJsonRpcMessage request = heldRequests.takeFirst();
+        // the peer is only left what remains of the call's timeout
+        const qint64 remaining = QJsonRpcMessagePrivate::remainingTime(request);
+        if (remaining >= 0)
+            request = QJsonRpcMessagePrivate::withTimeout(request, int(remaining));
+        if (maximumRequestsInFlight >= 0)
+            requestsInFlight.insert(request.id());
+        q->notify(request);
+    }
+}
+
+void QJsonRpcSocketPrivate::updateWriteBuffer()
+{
+    updateMemoryUsage();
+    if (highWaterMark < 0 || dropped)
+        return;
+
+    Q_Q(QJsonRpcSocket);
+    const qint64 pending = q->bytesToWrite();
+    if (!writeBlocked && pending >= highWaterMark) {
+        writeBlocked = true;
+        Q_EMIT q->writeBufferFull();
+        updateReadPause();
+    } else if (writeBlocked && pending <= lowWaterMark) {
+        writeBlocked = false;
+        Q_EMIT q->writeBufferDrained();
+        updateReadPause();
+        releaseHeldRequests();
+    }
+}
+
+void QJsonRpcSocketPrivate::_q_bytesWritten()
+{
+    updateWriteBuffer();
+}
+
+qint64 QJsonRpcSocketPrivate::memoryUsage() const
+{
+    Q_Q(const QJsonRpcSocket);
+    if (dropped)
+        return 0;
+    return buffer.size() - bufferOffset + q->bytesToWrite();
+}
+
+qint64 QJsonRpcSocketPrivate::pendingFrameSize() const
+{
+    // once the header was read the frame's size is known before its body
+    if (contentLength != -1)
+        return qint64(contentLength) + frameAttachmentsSize;
+    return buffer.size() - bufferOffset;
+}
+
+void QJsonRpcSocketPrivate::updateMemoryUsage()
+{
+    if (dropped || (!memoryAccount && maximumMemoryUsage < 0))
+        return;
+
+    const qint64 usage = memoryUsage();
+    if (memoryAccount && usage != accountedMemory)
+        memoryAccount->update(usage - accountedMemory);
+    accountedMemory = usage;
+    if (maximumMemoryUsage >= 0 && usage > maximumMemoryUsage) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "connection holds" << usage << "bytes, dropping it";
+        dropConnection();
+    }
+}
+
+void QJsonRpcSocketPrivate::dropConnection()
+{
+    if (dropped)
+        return;
+
+    // counted in the peak before it is released
+    Q_Q(QJsonRpcSocket);
+    const qint64 usage = memoryUsage();
+    dropped = true;
+    buffer.clear();
+    bufferOffset = 0;
+    incoming.reset();
+    contentLength = -1;
+    frameAttachmentSizes.clear();
+    frameAttachmentsSize = 0;
+    writeBuffer.clear();
+    heldRequests.clear();
+    batchRequests.clear();
+    if (flushTimer)
+        flushTimer->stop();
+
+    if (memoryAccount) {
+        memoryAccount->update(usage - accountedMemory);
+        memoryAccount->update(-usage);
+        memoryAccount->connectionDropped();
+    }
+    accountedMemory = 0;
+    Q_EMIT q->memoryLimitExceeded();
+
+    // closed from the event loop, a write may be limited while its caller
+    // holds a lock the disconnected() handlers need
+    QMetaObject::invokeMethod(q, "_q_abortDevice", Qt::QueuedConnection);
+}
+
+void QJsonRpcSocketPrivate::_q_abortDevice()
+{
+    // whatever is left to write is discarded, the peer isn't waited for
+    if (QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device.data()))
+        socket->abort();
+    else if (QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(device.data()))
+        localSocket->abort();
+    else if (device)
+        device.data()->close();
+}
+
+void QJsonRpcSocketPrivate::releaseIdleBuffers()
+{
+    // allocated again by the next message
+    if (bufferOffset >= buffer.size()) {
+        buffer = QByteArray();
+        bufferOffset = 0;
+    } else {
+        buffer.remove(0, bufferOffset);
+        bufferOffset = 0;
+        buffer.squeeze();
+    }
+
+    if (writeBuffer.isEmpty())
+        writeBuffer = QByteArray();
+    frameBuffer = QByteArray();
+}
+
+void QJsonRpcSocketPrivate::updateReadPause()
+{
+    const bool pause = writeBlocked ||
+        (maximumIncomingRequests >= 0 && incomingRequests >= maximumIncomingRequests);
+    if (pause == readPaused)
+        return;
+
+    Q_Q(QJsonRpcSocket);
+    readPaused = pause;
+
+    // a device with a bounded buffer stops reading from the network once
+    // it is full, which throttles the peer through the transport
+    QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device.data());
+    QLocalSocket *localSocket = socket ? 0 : qobject_cast<QLocalSocket*>(device.data());
+    if (pause) {
+        if (socket || localSocket) {
+            savedReadBufferSize = socket ? socket->readBufferSize() : localSocket->readBufferSize();
+            const qint64 size = savedReadBufferSize > 0 ?
+                qMin(savedReadBufferSize, qint64(PausedReadBufferSize)) : qint64(PausedReadBufferSize);
+            if (socket)
+                socket->setReadBufferSize(size);
+            else
+                localSocket->setReadBufferSize(size);
+        }
+        Q_EMIT q->readingPaused();
+        return;
+    }
+
+    if (socket)
+        socket->setReadBufferSize(savedReadBufferSize);
+    else if (localSocket)
+        localSocket->setReadBufferSize(savedReadBufferSize);
+    Q_EMIT q->readingResumed();
+
+    // frames left in the buffer, and whatever arrived meanwhile
+    QMetaObject::invokeMethod(q, "_q_processIncomingData", Qt::QueuedConnection);
+}
+
+void QJsonRpcSocketPrivate::_q_flushWriteBuffer()
+{
+    if (flushTimer)
+        flushTimer->stop();
+
+    if (writeBuffer.isEmpty() || !device)
+        return;
+
+    device.data()->write(writeBuffer);
+    writeBuffer.resize(0);
+}
+
+QJsonRpcAbstractSocket::QJsonRpcAbstractSocket(QObject *parent)
+#if defined(USE_QT_PRIVATE_HEADERS)
+    : QObject(*new QJsonRpcAbstractSocketPrivate, parent)
+#else
+    : QObject(parent),
+      d_ptr(new QJsonRpcAbstractSocketPrivate)
+#endif
+{
+}
+
+QJsonRpcAbstractSocket::~QJsonRpcAbstractSocket()
+{
+    // requests still being answered have no one to answer to
+    Q_D(QJsonRpcAbstractSocket);
+    if (d->socketHandle)
+        d->socketHandle->reset();
+    d->cancelRequests();
+}
+
+QJsonRpcAbstractSocket::QJsonRpcAbstractSocket(QJsonRpcAbstractSocketPrivate &dd, QObject *parent)
+#if defined(USE_QT_PRIVATE_HEADERS)
+    : QObject(dd, parent)
+#else
+    : QObject(parent),
+      d_ptr(&dd)
+#endif
+{
+}
+
+bool QJsonRpcAbstractSocket::isValid() const
+{
+    return false;
+}
+
+void QJsonRpcAbstractSocket::setDefaultRequestTimeout(int msecs)
+{
+    Q_D(QJsonRpcAbstractSocket);
+
+    if (msecs < 0) {
+        qJsonRpcDebug() << "Cannot set a negative request timeout msecs value";
+        return;
+    }
+
+    d->defaultRequestTimeout = msecs;
+}
+
+int QJsonRpcAbstractSocket::getDefaultRequestTimeout() const
+{
+    Q_D(const QJsonRpcAbstractSocket);
+
+    return d->defaultRequestTimeout;
+}
+
+void QJsonRpcAbstractSocket::cancelRequest(const QJsonRpcMessage &request)
+{
+    const QString &id = QJsonRpcMessagePrivate::keys().id;
+    QJsonObject params;
+    params.insert(id, request.toObject().value(id));
+    notify(QJsonRpcMessage::createNotification(QLatin1String("$/cancelRequest"), params));
+}
+
+QJsonRpcMessage QJsonRpcAbstractSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+{
+    Q_UNUSED(message)
+    Q_UNUSED(msecs)
+
+    return QJsonRpcMessage();
+}
+
+QJsonRpcServiceReply *QJsonRpcAbstractSocket::sendMessage(const QJsonRpcMessage &message)
+{
+    Q_UNUSED(message)
+
+    return 0;
+}
+
+QList<QJsonRpcServiceReply *> QJsonRpcAbstractSocket::sendBatch(const QList<QJsonRpcMessage> &messages)
+{
+    Q_UNUSED(messages)
+
+    return QList<QJsonRpcServiceReply *>();
+}
+
+// invalid arguments are left out, the others converted once each
+static QJsonArray positionalParameters(const QVariant &arg1, const QVariant &arg2, const QVariant &arg3,
+                                       const QVariant &arg4, const QVariant &arg5, const QVariant &arg6,
+                                       const QVariant &arg7, const QVariant &arg8, const QVariant &arg9,
+                                       const QVariant &arg10)
+{
+    const QVariant *args[] = { &arg1, &arg2, &arg3, &arg4, &arg5, &arg6, &arg7, &arg8, &arg9, &arg10 };
+    QJsonArray params;
+    for (int i = 0; i < 10; ++i) {
+        if (args[i]->isValid())
+            params.append(QJsonValue::fromVariant(*args[i]));
+    }
+
+    return params;
+}
+
+QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &arg1,
+                                                                   const QVariant &arg2, const QVariant &arg3,
+                                                                   const QVariant &arg4, const QVariant &arg5,
+                                                                   const QVariant &arg6, const QVariant &arg7,
+                                                                   const QVariant &arg8, const QVariant &arg9,
+                                                                   const QVariant &arg10)
+{
+    QJsonRpcMessage request =
+        QJsonRpcMessage::createRequest(method, positionalParameters(arg1, arg2, arg3, arg4, arg5,
+                                                                    arg6, arg7, arg8, arg9, arg10));
+    return sendMessageBlocking(request, msecs);
+}
+
+QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method, const QVariant &arg1,
+                                                                   const QVariant &arg2, const QVariant &arg3,
+                                                                   const QVariant &arg4, const QVariant &arg5,
+                                                                   const QVariant &arg6, const QVariant &arg7,
+                                                                   const QVariant &arg8, const QVariant &arg9,
+                                                                   const QVariant &arg10)
+{
+    Q_D(QJsonRpcAbstractSocket);
+    return invokeRemoteMethodBlocking(method, d->defaultRequestTimeout, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10);
+}
+
+QJsonRpcServiceReply *QJsonRpcAbstractSocket::invokeRemoteMethod(const QString &method, const QVariant &arg1,
+                                                                 const QVariant &arg2, const QVariant &arg3,
+                                                                 const QVariant &arg4, const QVariant &arg5,
+                                                                 const QVariant &arg6, const QVariant &arg7,
+                                                                 const QVariant &arg8, const QVariant &arg9,
+                                                                 const QVariant &arg10)
+{
+    QJsonRpcMessage request =
+        QJsonRpcMessage::createRequest(method, positionalParameters(arg1, arg2, arg3, arg4, arg5,
+                                                                    arg6, arg7, arg8, arg9, arg10));
+    return sendMessage(request);
+}
+
+QJsonRpcServiceReply *QJsonRpcAbstractSocket::invokeRemoteMethod(const QString &method,
+                                                                 const QJsonObject &namedParameters)
+{
+    return sendMessage(QJsonRpcMessage::createRequest(method, namedParameters));
+}
+
+QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method, int msecs,
+                                                                   const QJsonObject &namedParameters)
+{
+    return sendMessageBlocking(QJsonRpcMessage::createRequest(method, namedParameters), msecs);
+}
+
+QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method,
+                                                                   const QJsonObject &namedParameters)
+{
+    Q_D(QJsonRpcAbstractSocket);
+    return invokeRemoteMethodBlocking(method, d->defaultRequestTimeout, namedParameters);
+}
+
+QJsonRpcSocket::QJsonRpcSocket(QIODevice *device, QObject *parent)
+#if defined(USE_QT_PRIVATE_HEADERS)
+    : QJsonRpcAbstractSocket(*new QJsonRpcSocketPrivate(this), parent)
+#else
+    : QJsonRpcAbstractSocket(parent),
+      d_ptr(new QJsonRpcSocketPrivate(this))
+#endif
+{
+    Q_D(QJsonRpcSocket);
+    connect(device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
+    d->device = device;
+}
+
+QJsonRpcSocket::QJsonRpcSocket(QJsonRpcSocketPrivate &dd, QObject *parent)
+#if defined(USE_QT_PRIVATE_HEADERS)
+    : QJsonRpcAbstractSocket(dd, parent)
+#else
+    : QJsonRpcAbstractSocket(parent),
+      d_ptr(&dd)
+#endif
+{
+    Q_D(QJsonRpcSocket);
+    connect(d->device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
+}
+
+QJsonRpcSocket::~QJsonRpcSocket()
+{
+    Q_D(QJsonRpcSocket);
+    d->_q_flushWriteBuffer();
+    d->abortBlockingCalls();
+    if (d->memoryAccount)
+        d->memoryAccount->update(-d->accountedMemory);
+}
+
+bool QJsonRpcSocket::isValid() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->device && d->device.data()->isOpen();
+}
+
+QJsonRpc::FramingMode QJsonRpcSocket::framingMode() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->framingMode;
+}
+
+void QJsonRpcSocket::setFramingMode(QJsonRpc::FramingMode mode)
+{
+    Q_D(QJsonRpcSocket);
+    d->framingMode = mode;
+    d->incoming.reset();
+    d->contentLength = -1;
+}
+
+int QJsonRpcSocket::writeCoalescingDelay() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->writeCoalescingDelay;
+}
+
+void QJsonRpcSocket::setWriteCoalescingDelay(int msecs)
+{
+    Q_D(QJsonRpcSocket);
+    if (msecs < 0)
+        d->_q_flushWriteBuffer();
+    d->writeCoalescingDelay = msecs < 0 ? -1 : msecs;
+}
+
+QJsonRpcCodec *QJsonRpcSocket::codec() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->codec;
+}
+
+void QJsonRpcSocket::setCodec(QJsonRpcCodec *codec)
+{
+    Q_D(QJsonRpcSocket);
+    d->codec = codec;
+}
+
+bool QJsonRpcSocket::requestIdsAsStrings() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->requestIdsAsStrings;
+}
+
+void QJsonRpcSocket::setRequestIdsAsStrings(bool enabled)
+{
+    Q_D(QJsonRpcSocket);
+    d->requestIdsAsStrings = enabled;
+}
+
+bool QJsonRpcSocket::deadlinePropagation() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->deadlinePropagation;
+}
+
+void QJsonRpcSocket::setDeadlinePropagation(bool enabled)
+{
+    Q_D(QJsonRpcSocket);
+    d->deadlinePropagation = enabled;
+}
+
+int QJsonRpcSocket::compressionThreshold() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->compressionThreshold;
+}
+
+void QJsonRpcSocket::setCompressionThreshold(int bytes)
+{
+    Q_D(QJsonRpcSocket);
+    d->compressionThreshold = bytes < 0 ? -1 : bytes;
+}
+
+bool QJsonRpcSocket::attachmentsEnabled() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->attachmentsEnabled;
+}
+
+void QJsonRpcSocket::setAttachmentsEnabled(bool enabled)
+{
+    Q_D(QJsonRpcSocket);
+    d->attachmentsEnabled = enabled;
+}
+
+int QJsonRpcSocket::writeCoalescingThreshold() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->writeCoalescingThreshold;
+}
+
+void QJsonRpcSocket::setWriteCoalescingThreshold(int bytes)
+{
+    Q_D(QJsonRpcSocket);
+    if (bytes <= 0) {
+        qJsonRpcDebug() << "Cannot set a non-positive write coalescing threshold";
+        return;
+    }
+
+    d->writeCoalescingThreshold = bytes;
+}
+
+qint64 QJsonRpcSocket::bytesToWrite() const
+{
+    Q_D(const QJsonRpcSocket);
+    qint64 bytes = d->writeBuffer.size();
+    if (d->device)
+        bytes += d->device.data()->bytesToWrite();
+    return bytes;
+}
+
+qint64 QJsonRpcSocket::writeBufferHighWaterMark() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->highWaterMark;
+}
+
+qint64 QJsonRpcSocket::writeBufferLowWaterMark() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->lowWaterMark;
+}
+
+void QJsonRpcSocket::setWriteBufferWaterMarks(qint64 high, qint64 low)
+{
+    Q_D(QJsonRpcSocket);
+    if (high >= 0 && (low < 0 || low > high)) {
+        qJsonRpcDebug() << "Cannot set a low water mark outside of 0 and the high water mark";
+        return;
+    }
+
+    d->highWaterMark = high < 0 ? -1 : high;
+    d->lowWaterMark = high < 0 ? -1 : low;
+    if (d->highWaterMark < 0) {
+        if (d->writeBlocked) {
+            d->writeBlocked = false;
+            Q_EMIT writeBufferDrained();
+            d->updateReadPause();
+            d->releaseHeldRequests();
+        }
+        return;
+    }
+
+    if (d->device)
+        connect(d->device.data(), SIGNAL(bytesWritten(qint64)), this, SLOT(_q_bytesWritten()),
+                Qt::UniqueConnection);
+    d->updateWriteBuffer();
+}
+
+int QJsonRpcSocket::maximumRequestsInFlight() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->maximumRequestsInFlight;
+}
+
+void QJsonRpcSocket::setMaximumRequestsInFlight(int count)
+{
+    Q_D(QJsonRpcSocket);
+    if (count == 0) {
+        qJsonRpcDebug() << "Cannot set a maximum of 0 requests in flight";
+        return;
+    }
+
+    // requests sent before the limit was set are not counted
+    d->maximumRequestsInFlight = count < 0 ? -1 : count;
+    if (d->maximumRequestsInFlight < 0)
+        d->requestsInFlight.clear();
+    d->releaseHeldRequests();
+}
+
+int QJsonRpcSocket::maximumIncomingRequests() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->maximumIncomingRequests;
+}
+
+void QJsonRpcSocket::setMaximumIncomingRequests(int count)
+{
+    Q_D(QJsonRpcSocket);
+    if (count == 0) {
+        qJsonRpcDebug() << "Cannot set a maximum of 0 incoming requests";
+        return;
+    }
+
+    d->maximumIncomingRequests = count < 0 ? -1 : count;
+    d->updateReadPause();
+}
+
+bool QJsonRpcSocket::isReadingPaused() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->readPaused;
+}
+
+qint64 QJsonRpcSocket::memoryUsage() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->memoryUsage();
+}
+
+int QJsonRpcSocket::maximumFrameSize() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->maximumFrameSize;
+}
+
+void QJsonRpcSocket::setMaximumFrameSize(int bytes)
+{
+    Q_D(QJsonRpcSocket);
+    if (bytes == 0) {
+        qJsonRpcDebug() << "Cannot set a maximum frame size of 0";
+        return;
+    }
+
+    d->maximumFrameSize = bytes < 0 ? -1 : bytes;
+}
+
+qint64 QJsonRpcSocket::maximumMemoryUsage() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->maximumMemoryUsage;
+}
+
+void QJsonRpcSocket::setMaximumMemoryUsage(qint64 bytes)
+{
+    Q_D(QJsonRpcSocket);
+    if (bytes == 0) {
+        qJsonRpcDebug() << "Cannot set a maximum memory usage of 0";
+        return;
+    }
+
+    d->maximumMemoryUsage = bytes < 0 ? -1 : bytes;
+    d->updateMemoryUsage();
+}
+
+void QJsonRpcSocket::flush()
+{
+    Q_D(QJsonRpcSocket);
+    d->_q_flushWriteBuffer();
+}
+
+QJsonRpcMessage QJsonRpcSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+{
+    Q_D(QJsonRpcSocket);
+    if (!d->device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return message.createErrorResponse(QJsonRpc::InternalError, "no device");
+    }
+
+    // other threads wait for the socket's thread to send the request and
+    // read the response, without an event loop of their own
+    if (thread() != QThread::currentThread())
+        return d->sendBlockingCall(message, msecs);
+
+    // the timeout is enforced here rather than by the deadline wheel
+    d->writeRequest(message, msecs);
+    QJsonRpcServiceReply *reply = d->createReply(message);
+    QScopedPointer<QJsonRpcServiceReply> replyPtr(reply);
+
+    QEventLoop responseLoop;
+    connect(reply, SIGNAL(finished()), &responseLoop, SLOT(quit()));
+    QTimer::singleShot(msecs, &responseLoop, SLOT(quit()));
+    responseLoop.exec();
+
+    if (!reply->response().isValid()) {
+        d->replies.remove(message.id());
+        d->requestFinished(message.id());
+        return message.createErrorResponse(QJsonRpc::TimeoutError, "request timed out");
+    }
+
+    return reply->response();
+}
+
+QJsonRpcServiceReply *QJsonRpcSocket::sendMessage(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcSocket);
+    if (!d->device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return 0;
+    }
+
+    d->writeRequest(message, d->defaultRequestTimeout);
+    QJsonRpcServiceReply *reply = d->createReply(message);
+    d->addDeadline(message.id(), d->defaultRequestTimeout);
+    return reply;
+}
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+void QJsonRpcSocket::sendMessage(const QJsonRpcMessage &message, const QJsonRpcResponseCallback &callback)
+{
+    Q_D(QJsonRpcSocket);
+    if (!d->device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return;
+    }
+
+    if (message.type() == QJsonRpcMessage::Request && callback) {
+        QJsonRpcSocketPrivate::PendingCallback pending;
+        pending.request = message;
+        pending.callback = callback;
+        d->callbacks.insert(message.id(), pending);
+        d->addDeadline(message.id(), d->defaultRequestTimeout);
+        d->writeRequest(message, d->defaultRequestTimeout);
+        return;
+    }
+    notify(message);
+}
+#endif
+
+QList<QJsonRpcServiceReply *> QJsonRpcSocket::sendBatch(const QList<QJsonRpcMessage> &messages)
+{
+    Q_D(QJsonRpcSocket);
+    QList<QJsonRpcServiceReply *> batchReplies;
+    if (!d->device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return batchReplies;
+    }
+
+    if (messages.isEmpty()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send an empty batch";
+        return batchReplies;
+    }
+
+    // one reply per request, the responses are matched by id when the
+    // response array arrives
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() != QJsonRpcMessage::Request)
+            continue;
+
+        batchReplies.append(d->createReply(message));
+        d->addDeadline(message.id(), d->defaultRequestTimeout);
+        if (d->maximumRequestsInFlight >= 0)
+            d->requestsInFlight.insert(message.id());
+    }
+
+    d->writeData(messages);
+    return batchReplies;
+}
+
+void QJsonRpcSocket::notify(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcSocket);
+    if (!d->device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message without device";
+        return;
+    }
+
+    if (d->incomingRequests > 0 &&
+        (message.type() == QJsonRpcMessage::Response || message.type() == QJsonRpcMessage::Error)) {
+        d->incomingRequests--;
+        d->updateReadPause();
+    }
+
+    // responses to batch requests are written together once complete
+    if (d->collectBatchResponse(message))
+        return;
+
+    // nothing more goes to a peer that was dropped
+    if (d->dropped)
+        return;
+
+    d->markActivity();
+    d->writeData(message);
+}
+
+void QJsonRpcSocketPrivate::_q_processIncomingData()
+{
+    if (!device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called without device";
+        return;
+    }
+
+    // the rest is read once there is room again, none of it once dropped
+    if (readPaused || dropped)
+        return;
+
+    markActivity();
+    compactBuffer();
+    buffer.append(device.data()->readAll());
+    while (bufferOffset < buffer.size() && !readPaused) {
+        int frameStart = 0;
+        int frameSize = nextFrame(&frameStart);
+        if (frameSize == -1) {
+            // incomplete data, wait for more
+            break;
+        }
+
+        const qint64 totalSize = qint64(frameSize) + frameAttachmentsSize;
+        if (maximumFrameSize >= 0 && totalSize > maximumFrameSize) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "frame of" << totalSize << "bytes is too large";
+            dropConnection();
+            return;
+        }
+
+        const char *data = buffer.constData() + frameStart;
+        bufferOffset = frameStart + frameSize;
+
+        // copied out of the buffer once, then shared with the slots taking them
+        QList<QByteArray> attachments;
+        foreach (int size, frameAttachmentSizes) {
+            attachments.append(buffer.mid(bufferOffset, size));
+            bufferOffset += size;
+        }
+        frameAttachmentSizes.clear();
+        frameAttachmentsSize = 0;
+
+        QByteArray inflated;
+        if (frameCompressed) {
+            // inflated no further than the frame may grow
+            bool sizeExceeded = false;
+            const int maximumSize = maximumFrameSize < 0 ? int(MaximumInflatedFrameSize)
+                                                         : qMax(maximumFrameSize, 1);
+            QJsonRpcCompression::decompress(QByteArray::fromRawData(data, frameSize),
+                                            QJsonRpcCompression::Deflate, &inflated,
+                                            maximumSize, &sizeExceeded);
+            if (sizeExceeded) {
+                qJsonRpcDebug() << Q_FUNC_INFO << "inflated frame is too large";
+                dropConnection();
+                return;
+            }
+            if (inflated.isEmpty()) {
+                qJsonRpcDebug() << Q_FUNC_INFO << "unable to decompress frame";
+                continue;
+            }
+            data = inflated.constData();
+            frameSize = inflated.size();
+        }
+
+        processFrame(data, frameSize, attachments);
+    }
+
+    // a partial frame that can't fit is refused without waiting for the rest
+    if (maximumFrameSize >= 0 && !dropped && pendingFrameSize() > maximumFrameSize) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "frame of at least" << pendingFrameSize() << "bytes is too large";
+        dropConnection();
+        return;
+    }
+
+    updateMemoryUsage();
+}
+
+void QJsonRpcSocketPrivate::processFrame(const char *data, int size,
+                                         const QList<QByteArray> &attachments)
+{
+    Q_Q(QJsonRpcSocket);
+    if (frameCodec) {
+        QJsonValue value = frameCodec->decode(QByteArray(data, size));
+        if (value.isObject()) {
+            QJsonRpcMessage message = QJsonRpcMessage::fromObject(value.toObject());
+            if (!attachments.isEmpty())
+                message.setAttachments(attachments);
+            processIncomingMessage(message);
+        } else if (value.isArray()) {
+            processIncomingBatch(value.toArray());
+        } else {
+            qJsonRpcDebug() << Q_FUNC_INFO << "unable to decode"
+                            << frameCodec->contentType() << "frame";
+        }
+        return;
+    }
+
+    QJsonParseError error;
+    if (incoming.status() != QJsonRpcIncrementalParser::NeedMoreData) {
+        if (incoming.status() == QJsonRpcIncrementalParser::Failed) {
+            // the parser is already past the malformed frame
+            qJsonRpcDebug() << Q_FUNC_INFO << incoming.parseError().errorString();
+            incoming.reset();
+            return;
+        }
+
+        if (!incoming.isBatch()) {
+            QJsonRpcMessage message = incoming.takeMessage();
+            if (!attachments.isEmpty())
+                message.setAttachments(attachments);
+
+            qJsonRpcDebug() << "received(" << q << "): " << message;
+            processIncomingMessage(message);
+            return;
+        }
+
+        // only delimited, the array is read below
+        incoming.reset();
+    }
+
+    int start = 0;
+    while (start < size && (data[start] == ' ' || data[start] == '\t' ||
+                            data[start] == '\n' || data[start] == '\r'))
+        ++start;
+
+    if (start < size && data[start] == '[') {
+        // hand the parser a view of the frame rather than a copy, it is
+        // only referenced for the duration of fromJson
+        QByteArray frame = QByteArray::fromRawData(data, size);
+        QJsonDocument document = QJsonDocument::fromJson(frame, &error);
+        if (error.error != QJsonParseError::NoError) {
+            // drop the malformed frame, the next one is read from its end
+            qJsonRpcDebug() << Q_FUNC_INFO << error.errorString();
+            return;
+        }
+
+        qJsonRpcDebug() << "received(" << q << "): " << frame;
+        processIncomingBatch(document.array());
+        return;
+    }
+
+    // single messages are parsed straight into their fields, the frame is
+    // copied once since the message keeps its text
+    QJsonRpcMessage message =
+        QJsonRpcMessagePrivate::fromJson(QByteArray(data, size), &error);
+    if (error.error != QJsonParseError::NoError) {
+        qJsonRpcDebug() << Q_FUNC_INFO << error.errorString();
+        return;
+    }
+
+    if (!attachments.isEmpty())
+        message.setAttachments(attachments);
+
+    qJsonRpcDebug() << "received(" << q << "): " << message;
+    processIncomingMessage(message);
+}
+
+void QJsonRpcSocketPrivate::processIncomingMessage(const QJsonRpcMessage &message)
+{
+    Q_Q(QJsonRpcSocket);
+    Q_EMIT q->messageReceived(message);
+
+    if (message.type() == QJsonRpcMessage::Response ||
+        message.type() == QJsonRpcMessage::Error) {
+        if (!requestsInFlight.isEmpty() || !heldRequests.isEmpty())
+            requestFinished(message.id());
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+        if (!callbacks.isEmpty()) {
+            QHash<qint64, PendingCallback>::iterator it = callbacks.find(message.id());
+            if (it != callbacks.end()) {
+                QJsonRpcResponseCallback callback = it.value().callback;
+                callbacks.erase(it);
+                if (!hasPendingRequests())
+                    clearDeadlines();
+                callback(message);
+                return;
+            }
+        }
+#endif
+
+        if (!blockingCalls.isEmpty()) {
+            QJsonRpcBlockingCallPointer call = blockingCalls.take(message.id());
+            if (call) {
+                if (!hasPendingRequests())
+                    clearDeadlines();
+                call->finish(message);
+                return;
+            }
+        }
+
+        if (replies.contains(message.id())) {
+            QPointer<QJsonRpcServiceReply> reply = replies.take(message.id());
+            if (!hasPendingRequests())
+                clearDeadlines();
+            if (!reply.isNull() && !reply->response().isValid()) {
+                reply->d_func()->response = message;
+                reply->finished();
+            }
+        }
+    } else if (QJsonRpcMessagePrivate::isPartialResult(message)) {
+        // blocking calls and callbacks only see the response
+        QJsonRpcServiceReplyPrivate::deliverPartialResult(replies, message);
+    } else if (message.type() == QJsonRpcMessage::Request) {
+        // counted until its response is written, however late that is
+        incomingRequests++;
+        q->processRequestMessage(message);
+        updateReadPause();
+    } else {
+        q->processRequestMessage(message);
+    }
+}
+
+QJsonRpcServiceReply *QJsonRpcSocketPrivate::createReply(const QJsonRpcMessage &request)
+{
+    QPointer<QJsonRpcServiceReply> reply(new QJsonRpcServiceReply);
+    reply->d_func()->request = request;
+    replies.insert(request.id(), reply);
+    return reply;
+}
+
+void QJsonRpcSocketPrivate::addDeadline(qint64 id, int msecs)
+{
+    if (msecs <= 0)
+        return;
+
+    Q_Q(QJsonRpcSocket);
+    if (!deadlineTimer) {
+        deadlineTimer = new QTimer(q);
+        deadlineTimer->setInterval(DeadlineResolution);
+        QObject::connect(deadlineTimer, SIGNAL(timeout()), q, SLOT(_q_expireDeadlines()));
+        deadlineWheel.resize(DeadlineWheelSize);
+    }
+
+    if (!deadlineTimer->isActive()) {
+        deadlineClock.start();
+        deadlineTicks = 0;
+        deadlineTimer->start();
+    }
+
+    // never expire early: round up, skip the partial tick in progress and
+    // account for ticks that are due but not processed yet
+    const qint64 lateTicks = deadlineClock.elapsed() / DeadlineResolution - deadlineTicks;
+    const int ticks = (msecs + DeadlineResolution - 1) / DeadlineResolution + 1 + int(lateTicks);
+    Deadline deadline;
+    deadline.id = id;
+    deadline.rounds = (ticks - 1) / DeadlineWheelSize;
+    deadlineWheel[(deadlineSlot + ticks) % DeadlineWheelSize].append(deadline);
+    pendingDeadlines++;
+}
+
+void QJsonRpcSocketPrivate::_q_expireDeadlines()
+{
+    // catch up on ticks that were delayed by a busy event loop
+    const qint64 dueTicks = deadlineClock.elapsed() / DeadlineResolution;
+    while (deadlineTicks < dueTicks && pendingDeadlines > 0) {
+        deadlineTicks++;
+        deadlineSlot = (deadlineSlot + 1) % DeadlineWheelSize;
+
+        QList<Deadline> &slot = deadlineWheel[deadlineSlot];
+        QList<qint64> expired;
+        for (QList<Deadline>::iterator it = slot.begin(); it != slot.end();) {
+            if (it->rounds > 0) {
+                it->rounds--;
+                ++it;
+                continue;
+            }
+
+            expired.append(it->id);
+            it = slot.erase(it);
+            pendingDeadlines--;
+        }
+
+        // finishing a request runs user code, which may add new deadlines
+        foreach (qint64 id, expired)
+            expireRequest(id);
+    }
+
+    if (pendingDeadlines == 0 && deadlineTimer)
+        deadlineTimer->stop();
+}
+
+void QJsonRpcSocketPrivate::expireRequest(qint64 id)
+{
+    if (!requestsInFlight.isEmpty() || !heldRequests.isEmpty())
+        requestFinished(id);
+
+    if (!blockingCalls.isEmpty()) {
+        QJsonRpcBlockingCallPointer call = blockingCalls.take(id);
+        if (call) {
+            call->finish(call->request.createErrorResponse(QJsonRpc::TimeoutError,
+                                                           "request timed out"));
+            return;
+        }
+    }
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    if (callbacks.contains(id)) {
+        PendingCallback pending = callbacks.take(id);
+        pending.callback(pending.request.createErrorResponse(QJsonRpc::TimeoutError,
+                                                             "request timed out"));
+        return;
+    }
+#endif
+
+    if (replies.contains(id)) {
+        QPointer<QJsonRpcServiceReply> reply = replies.take(id);
+        if (!reply.isNull() && !reply->response().isValid()) {
+            reply->d_func()->response =
+                reply->request().createErrorResponse(QJsonRpc::TimeoutError, "request timed out");
+            reply->finished();
+        }
+    }
+}
+
+bool QJsonRpcSocketPrivate::hasPendingRequests() const
+{
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    if (!callbacks.isEmpty())
+        return true;
+#endif
+    return !replies.isEmpty() || !blockingCalls.isEmpty();
+}
+
+void QJsonRpcSocketPrivate::clearDeadlines()
+{
+    if (!pendingDeadlines)
+        return;
+
+    for (int i = 0; i < deadlineWheel.size(); ++i)
+        deadlineWheel[i].clear();
+    pendingDeadlines = 0;
+    deadlineTimer->stop();
+}
+
+void QJsonRpcSocketPrivate::processIncomingBatch(const QJsonArray &batch)
+{
+    if (batch.isEmpty()) {
+        writeData(QJsonRpcMessage().createErrorResponse(QJsonRpc::InvalidRequest, "invalid request"));
+        return;
+    }
+
+    // register every request of the batch before dispatching, so that
+    // responses produced synchronously are collected as well. Ids are only
+    // unique within a batch, if at all, responses are matched by the batch
+    // their request was read in
+    QSharedPointer<BatchResponse> batchResponse(new BatchResponse);
+    if (!++batchCount)
+        ++batchCount;
+    batchResponse->batch = batchCount;
+    QList<QJsonRpcMessage> messages;
+    for (int i = 0; i < batch.size(); ++i) {
+        QJsonRpcMessage message = QJsonRpcMessage::fromObject(batch.at(i).toObject());
+        if (!message.isValid()) {
+            QJsonRpcMessage error =
+                message.createErrorResponse(QJsonRpc::InvalidRequest, "invalid request");
+            batchResponse->responses.append(error.toObject());
+            continue;
+        }
+
+        if (message.type() == QJsonRpcMessage::Request) {
+            batchResponse->pending++;
+            batchRequests.insert(message.id(), batchResponse);
+        }
+
+        messages.append(QJsonRpcMessagePrivate::withBatch(message, batchCount));
+    }
+
+    foreach (const QJsonRpcMessage &message, messages)
+        processIncomingMessage(message);
+    finishBatchResponse(batchResponse);
+}
+
+bool QJsonRpcSocketPrivate::collectBatchResponse(const QJsonRpcMessage &message)
+{
+    const quint32 batch = QJsonRpcMessagePrivate::batch(message);
+    if (!batch || batchRequests.isEmpty() ||
+        (message.type() != QJsonRpcMessage::Response && message.type() != QJsonRpcMessage::Error))
+        return false;
+
+    QMultiHash<qint64, QSharedPointer<BatchResponse> >::iterator it = batchRequests.find(message.id());
+    while (it != batchRequests.end() && it.key() == message.id() && it.value()->batch != batch)
+        ++it;
+    if (it == batchRequests.end() || it.key() != message.id())
+        return false;
+
+    QSharedPointer<BatchResponse> batchResponse = it.value();
+    batchRequests.erase(it);
+    batchResponse->responses.append(QJsonRpcMessagePrivate::inlineAttachments(message).toObject());
+    finishBatchResponse(batchResponse);
+    return true;
+}
+
+void QJsonRpcSocketPrivate::requestCancelled(const QJsonRpcMessage &request)
+{
+    // the batch isn't left waiting for it, counted as answered
+    Q_Q(QJsonRpcSocket);
+    if (QJsonRpcMessagePrivate::batch(request))
+        q->notify(request.createErrorResponse(QJsonRpc::CancelledError, "request cancelled"));
+}
+
+void QJsonRpcSocketPrivate::finishBatchResponse(const QSharedPointer<BatchResponse> &batchResponse)
+{
+    if (--batchResponse->pending > 0)
+        return;
+    writeBatchResponse(batchResponse->responses);
+}
+
+void QJsonRpcSocketPrivate::writeBatchResponse(const QJsonArray &responses)
+{
+    // a batch of notifications has no response at all
+    if (!responses.isEmpty())
+        writeData(responses);
+}
+
 void QJsonRpcSocket::processRequestMessage(const QJsonRpcMessage &message)
 {
     Q_UNUSED(message)
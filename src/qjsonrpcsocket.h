@@ -24,6 +24,13 @@
 #include "qjsonrpcservice.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpcglobal.h"
+#include "qjsonrpcparams.h"
+#include "qjsonrpccoroutine.h"
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+#include <functional>
+typedef std::function<void(const QJsonRpcMessage &)> QJsonRpcResponseCallback;
+#endif
 
 #define DEFAULT_MSECS_REQUEST_TIMEOUT (30000)
 
@@ -37,9 +44,43 @@ public:
     ~QJsonRpcAbstractSocket();
 
     virtual bool isValid() const;
+
+    // also bounds asynchronous requests on a QJsonRpcSocket or a
+    // QJsonRpcHttpClient, 0 disables that
     void setDefaultRequestTimeout(int msecs);
     int getDefaultRequestTimeout() const;
 
+    // Asks the peer to give up on a request sent earlier, with a
+    // "$/cancelRequest" notification. A delayed response that is cancelled
+    // is not written, so the reply only finishes if it was already on its
+    // way or once it times out.
+    void cancelRequest(const QJsonRpcMessage &request);
+
+    // parameters by name
+    QJsonRpcServiceReply *invokeRemoteMethod(const QString &method, const QJsonObject &namedParameters);
+    QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, int msecs,
+                                               const QJsonObject &namedParameters);
+    QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, const QJsonObject &namedParameters);
+
+#if defined(QJSONRPC_HAS_VARIADIC_TEMPLATES)
+    // any number of arguments, each converted straight to JSON by its
+    // QJsonRpcParamConverter; calls with only QVariant arguments take the
+    // overloads below, which skip invalid ones. As with those, a leading
+    // int is the timeout of invokeRemoteMethodBlocking
+    template <typename... Args>
+    QJsonRpcServiceReply *invokeRemoteMethod(const QString &method, const Args &... args);
+    template <typename... Args>
+    QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, int msecs, const Args &... args);
+    template <typename... Args>
+    QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, const Args &... args);
+#endif
+
+#if defined(QJSONRPC_HAS_COROUTINES)
+    // sends the request right away, co_await on the result for the response
+    template <typename... Args>
+    QJsonRpcPendingCall call(const QString &method, const Args &... args);
+#endif
+
 Q_SIGNALS:
     void messageReceived(const QJsonRpcMessage &message);
 
@@ -47,6 +88,7 @@ public Q_SLOTS:
     virtual void notify(const QJsonRpcMessage &message) = 0;
     virtual QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
     virtual QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
+    virtual QList<QJsonRpcServiceReply *> sendBatch(const QList<QJsonRpcMessage> &messages);
     virtual QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &arg1 = QVariant(),
                                                const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
                                                const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
@@ -78,6 +120,39 @@ private:
 
 };
 
+#if defined(QJSONRPC_HAS_VARIADIC_TEMPLATES)
+template <typename... Args>
+inline QJsonRpcServiceReply *QJsonRpcAbstractSocket::invokeRemoteMethod(const QString &method,
+                                                                        const Args &... args)
+{
+    return sendMessage(QJsonRpcMessage::createRequest(method, qJsonRpcParams(args...)));
+}
+
+template <typename... Args>
+inline QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method, int msecs,
+                                                                          const Args &... args)
+{
+    return sendMessageBlocking(QJsonRpcMessage::createRequest(method, qJsonRpcParams(args...)), msecs);
+}
+
+template <typename... Args>
+inline QJsonRpcMessage QJsonRpcAbstractSocket::invokeRemoteMethodBlocking(const QString &method,
+                                                                          const Args &... args)
+{
+    return sendMessageBlocking(QJsonRpcMessage::createRequest(method, qJsonRpcParams(args...)),
+                               getDefaultRequestTimeout());
+}
+#endif
+
+#if defined(QJSONRPC_HAS_COROUTINES)
+template <typename... Args>
+inline QJsonRpcPendingCall QJsonRpcAbstractSocket::call(const QString &method, const Args &... args)
+{
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest(method, qJsonRpcParams(args...));
+    return QJsonRpcPendingCall(sendMessage(request), request);
+}
+#endif
+
 class QJsonRpcSocketPrivate;
 class QJSONRPC_EXPORT QJsonRpcSocket : public QJsonRpcAbstractSocket
 {
@@ -88,28 +163,110 @@ public:
 
     virtual bool isValid() const;
 
+    QJsonRpc::FramingMode framingMode() const;
+    void setFramingMode(QJsonRpc::FramingMode mode);
+
+    // outgoing messages are gathered and written at most msecs later,
+    // -1 (the default) writes every message immediately
+    int writeCoalescingDelay() const;
+    void setWriteCoalescingDelay(int msecs);
+    int writeCoalescingThreshold() const;
+    void setWriteCoalescingThreshold(int bytes);
+
+    // sends the ids of requests as strings, for peers that read JSON numbers
+    // as doubles and would lose precision on large ids
+    bool requestIdsAsStrings() const;
+    void setRequestIdsAsStrings(bool enabled);
+
+    // Requests are sent with a "timeout" member, the milliseconds their call
+    // waits for the response, so that the peer answers them with a
+    // QJsonRpc::TimeoutError rather than dispatching them once that much time
+    // has passed. Off by default, peers predating it ignore the member.
+    // Services read what is left of it through
+    // QJsonRpcServiceRequest::remainingTime()
+    bool deadlinePropagation() const;
+    void setDeadlinePropagation(bool enabled);
+
+    // encoding of outgoing frames. Frames from the peer are decoded according
+    // to their Content-Type header whatever the codec; with none set (the
+    // default) text JSON is written until the peer uses another encoding,
+    // which is then used to answer it
+    QJsonRpcCodec *codec() const;
+    void setCodec(QJsonRpcCodec *codec);
+
+    // frames of at least bytes are deflated and sent with a header, peers
+    // inflate them whatever their own setting; -1 (the default) disables it
+    int compressionThreshold() const;
+    void setCompressionThreshold(int bytes);
+
+    // Attachments of outgoing messages are written after the frame's body,
+    // their sizes listed in an Attachments header, and QByteArray results of
+    // services are sent back as attachments. Off by default, attachments are
+    // then inlined as base64 strings, as they always are in batches. Incoming
+    // attachments are read whatever the setting, and handed to the QByteArray
+    // parameters referring to them.
+    bool attachmentsEnabled() const;
+    void setAttachmentsEnabled(bool enabled);
+
+    // Flow control, each limit disabled by -1 (the default). Once the bytes
+    // not yet written, coalesced ones included, reach the high water mark
+    // writeBufferFull() is emitted, reading stops and requests are held back
+    // until they fall to the low water mark, which emits writeBufferDrained().
+    // Requests beyond the maximum in flight, written and not answered, are
+    // held as well and sent as responses come in, their timeouts running
+    // from the call; batches are written whole whatever the limit. With the
+    // maximum of incoming requests dispatched and not answered yet, reading
+    // stops until one is. A paused socket leaves data in the device, which
+    // for sockets stops reading from the network once its buffer is full.
+    qint64 bytesToWrite() const;
+    qint64 writeBufferHighWaterMark() const;
+    qint64 writeBufferLowWaterMark() const;
+    void setWriteBufferWaterMarks(qint64 high, qint64 low);
+    int maximumRequestsInFlight() const;
+    void setMaximumRequestsInFlight(int count);
+    int maximumIncomingRequests() const;
+    void setMaximumIncomingRequests(int count);
+    bool isReadingPaused() const;
+
+    // Memory limits, each disabled by -1 (the default). A frame larger than
+    // the maximum frame size, attachments and inflating included, is refused
+    // as soon as its header or the data buffered for it tell. Once the
+    // memory usage, the bytes received and not processed yet along with
+    // bytesToWrite(), exceeds its maximum, or a frame was refused,
+    // memoryLimitExceeded() is emitted and the connection aborted. Requests
+    // being answered are bounded by maximumIncomingRequests() instead.
+    // Without a maximum frame size compressed frames still inflate to no
+    // more than 64MB.
+    qint64 memoryUsage() const;
+    int maximumFrameSize() const;
+    void setMaximumFrameSize(int bytes);
+    qint64 maximumMemoryUsage() const;
+    void setMaximumMemoryUsage(qint64 bytes);
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    // the callback is invoked with the response, without allocating a reply object
+    void sendMessage(const QJsonRpcMessage &message, const QJsonRpcResponseCallback &callback);
+#endif
+
+Q_SIGNALS:
+    void writeBufferFull();
+    void writeBufferDrained();
+    void readingPaused();
+    void readingResumed();
+    void memoryLimitExceeded();
+
 public Q_SLOTS:
+    void flush();
     virtual void notify(const QJsonRpcMessage &message);
+
+    // On the socket's own thread this runs an event loop until the response
+    // arrives. Any other thread, which needs no event loop, only waits while
+    // the socket's thread sends the request and reads the response, so a
+    // socket moved to a thread of its own serves blocking calls from many
+    // worker threads at once without re-entering theirs.
     virtual QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
     virtual QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
-    QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, int msecs, const QVariant &arg1 = QVariant(),
-                                               const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
-                                               const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
-                                               const QVariant &arg6 = QVariant(), const QVariant &arg7 = QVariant(),
-                                               const QVariant &arg8 = QVariant(), const QVariant &arg9 = QVariant(),
-                                               const QVariant &arg10 = QVariant());
-    QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, const QVariant &arg1 = QVariant(),
-                                               const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
-                                               const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
-                                               const QVariant &arg6 = QVariant(), const QVariant &arg7 = QVariant(),
-                                               const QVariant &arg8 = QVariant(), const QVariant &arg9 = QVariant(),
-                                               const QVariant &arg10 = QVariant());
-    QJsonRpcServiceReply *invokeRemoteMethod(const QString &method, const QVariant &arg1 = QVariant(),
-                                             const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
-                                             const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
-                                             const QVariant &arg6 = QVariant(), const QVariant &arg7 = QVariant(),
-                                             const QVariant &arg8 = QVariant(), const QVariant &arg9 = QVariant(),
-                                             const QVariant &arg10 = QVariant());
+    virtual QList<QJsonRpcServiceReply *> sendBatch(const QList<QJsonRpcMessage> &messages);
 
 protected:
     QJsonRpcSocket(QJsonRpcSocketPrivate &dd, QObject *parent);
@@ -119,6 +276,17 @@ private:
     Q_DECLARE_PRIVATE(QJsonRpcSocket)
     Q_DISABLE_COPY(QJsonRpcSocket)
     Q_PRIVATE_SLOT(d_func(), void _q_processIncomingData())
+    Q_PRIVATE_SLOT(d_func(), void _q_flushWriteBuffer())
+    Q_PRIVATE_SLOT(d_func(), void _q_expireDeadlines())
+    Q_PRIVATE_SLOT(d_func(), void _q_writeBroadcast(QJsonRpcBroadcastPointer))
+    Q_PRIVATE_SLOT(d_func(), void _q_startBlockingCalls())
+    Q_PRIVATE_SLOT(d_func(), void _q_bytesWritten())
+    Q_PRIVATE_SLOT(d_func(), void _q_drainOutbound())
+    Q_PRIVATE_SLOT(d_func(), void _q_abortDevice())
+    friend class QJsonRpcAbstractServerPrivate;
+    friend class QJsonRpcHttpServerRpcSocket;
+    friend class QJsonRpcWebSocket;
+    friend class QJsonRpcUdpSocket;
 
 #if !defined(USE_QT_PRIVATE_HEADERS)
     QScopedPointer<QJsonRpcSocketPrivate> d_ptr;
@@ -19,12 +19,131 @@
 
 #include <QPointer>
 #include <QHash>
+#include <QSet>
+#include <QSharedPointer>
 #include <QIODevice>
+#include <QTimer>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QWaitCondition>
+#include <climits>
 
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcmessage.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcmpscqueue_p.h"
 #include "qjsonrpcglobal.h"
 
+// a notification written to many sockets, possibly on different threads.
+// Each wire format is encoded by the first socket needing it, the others
+// write the same bytes
+class QJsonRpcSocketPrivate;
+class QJSONRPC_EXPORT QJsonRpcBroadcast
+{
+public:
+    explicit QJsonRpcBroadcast(const QJsonRpcMessage &message) : message(message) {}
+    QByteArray frame(const QJsonRpcSocketPrivate *socket);
+
+    const QJsonRpcMessage message;
+
+private:
+    QMutex mutex;
+    QHash<QByteArray, QByteArray> frames;   // wire format to encoded frame
+    Q_DISABLE_COPY(QJsonRpcBroadcast)
+};
+typedef QSharedPointer<QJsonRpcBroadcast> QJsonRpcBroadcastPointer;
+Q_DECLARE_METATYPE(QJsonRpcBroadcastPointer)
+
+// a blocking call made on another thread than the socket's. The caller
+// waits on a condition while the socket's thread sends the request and
+// hands over the response, rather than running an event loop of its own
+class QJSONRPC_EXPORT QJsonRpcBlockingCall
+{
+public:
+    QJsonRpcBlockingCall(const QJsonRpcMessage &request, int msecs)
+        : request(request), msecs(msecs), finished(false) {}
+
+    // the first response wins, later ones are ignored
+    void finish(const QJsonRpcMessage &response);
+
+    // the response, or a timeout error after msecs
+    QJsonRpcMessage wait();
+
+    const QJsonRpcMessage request;
+    const int msecs;
+
+private:
+    QMutex mutex;
+    QWaitCondition done;
+    QJsonRpcMessage response;
+    bool finished;
+    Q_DISABLE_COPY(QJsonRpcBlockingCall)
+};
+typedef QSharedPointer<QJsonRpcBlockingCall> QJsonRpcBlockingCallPointer;
+
+// a request answered later, shared by its QJsonRpcServiceRequest handles and
+// the socket it arrived on, which cancels it for the peer or when it goes
+class QJSONRPC_EXPORT QJsonRpcRequestCancellation
+{
+public:
+    explicit QJsonRpcRequestCancellation(const QJsonRpcMessage &request)
+        : request(request), cancelled(0) {}
+
+    bool isCancelled() const;
+
+    // tells the service and stops the future watcher, once
+    void cancel();
+
+    const QJsonRpcMessage request;
+    QPointer<QObject> service;      // emits requestCancelled()
+    QPointer<QObject> watcher;      // waits for the future of the request
+
+private:
+    QAtomicInt cancelled;
+    Q_DISABLE_COPY(QJsonRpcRequestCancellation)
+};
+typedef QSharedPointer<QJsonRpcRequestCancellation> QJsonRpcRequestCancellationPointer;
+
+// lets other threads reach a socket for as long as it lives, where a
+// QPointer to it can only be relied on from the socket's own thread. The
+// socket clears it when destroyed, waiting for a post under way
+class QJSONRPC_EXPORT QJsonRpcSocketHandle
+{
+public:
+    explicit QJsonRpcSocketHandle(QJsonRpcAbstractSocket *socket) : socket(socket) {}
+
+    // false once the socket is gone
+    bool post(const QJsonRpcMessage &message);
+    void reset();
+
+    QMutex mutex;
+    QJsonRpcAbstractSocket *socket;     // guarded by mutex
+
+private:
+    Q_DISABLE_COPY(QJsonRpcSocketHandle)
+};
+typedef QSharedPointer<QJsonRpcSocketHandle> QJsonRpcSocketHandlePointer;
+
+// the memory held by the connections of a server, each reporting how its
+// own usage changed from its thread
+class QJSONRPC_EXPORT QJsonRpcMemoryAccount
+{
+public:
+    QJsonRpcMemoryAccount() {}
+
+    void update(qint64 delta);
+    void connectionDropped();
+    QJsonRpcMemoryStats stats() const;
+
+private:
+    mutable QMutex mutex;
+    QJsonRpcMemoryStats current;
+    Q_DISABLE_COPY(QJsonRpcMemoryAccount)
+};
+typedef QSharedPointer<QJsonRpcMemoryAccount> QJsonRpcMemoryAccountPointer;
+
 #if defined(USE_QT_PRIVATE_HEADERS)
 #include <private/qobject_p.h>
 
@@ -38,8 +157,34 @@ public:
         : defaultRequestTimeout(DEFAULT_MSECS_REQUEST_TIMEOUT)
     {}
 
+    static QJsonRpcAbstractSocketPrivate *get(QJsonRpcAbstractSocket *socket) {
+        return socket->d_func();
+    }
+
     int defaultRequestTimeout;
 
+    // Hands a message for the peer to the socket from any thread. It is
+    // written right away on the socket's own thread, other threads queue it
+    static void post(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message);
+    virtual void postQueued(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message);
+
+    // for threads holding on to the socket, created on its own thread
+    static QJsonRpcSocketHandlePointer handle(QJsonRpcAbstractSocket *socket);
+    QJsonRpcSocketHandlePointer socketHandle;
+
+    // delayed requests received by id, possibly from the services' threads.
+    // Their handles own them, the socket only cancels those still around
+    void trackRequest(const QJsonRpcRequestCancellationPointer &cancellation);
+    void untrackRequest(qint64 id);
+    void cancelRequest(qint64 id);
+    void cancelRequests();
+
+    // a request the peer cancelled won't be answered by its service
+    virtual void requestCancelled(const QJsonRpcMessage &request) { Q_UNUSED(request) }
+
+    QMutex trackedRequestsMutex;
+    QHash<qint64, QWeakPointer<QJsonRpcRequestCancellation> > trackedRequests;
+
 #if !defined(USE_QT_PRIVATE_HEADERS)
     virtual ~QJsonRpcAbstractSocketPrivate() {}
 #endif
@@ -50,7 +195,46 @@ class QJSONRPC_EXPORT QJsonRpcSocketPrivate : public QJsonRpcAbstractSocketPriva
 {
 public:
     QJsonRpcSocketPrivate(QJsonRpcSocket *socket)
-        : q_ptr(socket)
+        : bufferOffset(0),
+          framingMode(QJsonRpc::JsonFraming),
+          contentLength(-1),
+          writeCoalescingDelay(-1),
+          writeCoalescingThreshold(64 * 1024),
+          requestIdsAsStrings(false),
+          deadlinePropagation(false),
+          codec(0),
+          peerCodec(0),
+          frameCodec(0),
+          frameCompressed(false),
+          compressionThreshold(-1),
+          attachmentsEnabled(false),
+          frameAttachmentsSize(0),
+          flushTimer(0),
+          outboundScheduled(0),
+          drainingOutbound(false),
+          batchCount(0),
+          deadlineSlot(0),
+          deadlineTicks(0),
+          pendingDeadlines(0),
+          deadlineTimer(0),
+          highWaterMark(-1),
+          lowWaterMark(-1),
+          maximumRequestsInFlight(-1),
+          maximumIncomingRequests(-1),
+          writeBlocked(false),
+          readPaused(false),
+          incomingRequests(0),
+          savedReadBufferSize(0),
+          maximumFrameSize(-1),
+          maximumMemoryUsage(-1),
+          accountedMemory(0),
+          dropped(false),
+          clientHandle(0),
+          idleTimeout(0),
+          lastActivity(0),
+          idleTracked(false),
+          messageFraming(false),
+          q_ptr(socket)
     {}
 
 #if !defined(USE_QT_PRIVATE_HEADERS)
@@ -59,13 +243,221 @@ public:
 
     // slots
     virtual void _q_processIncomingData();
+    void _q_flushWriteBuffer();
+    void _q_expireDeadlines();
+    void _q_writeBroadcast(const QJsonRpcBroadcastPointer &broadcast);
+    void _q_startBlockingCalls();
+    void _q_bytesWritten();
+    void _q_drainOutbound();
+    void _q_abortDevice();
+
+    // scans for the end of a JSON document, keeping its state between calls
+    // so that data arriving in chunks is only looked at once. Frames read by
+    // the socket are delimited by QJsonRpcIncrementalParser instead, which
+    // parses them on the way
+    struct QJSONRPC_EXPORT FrameScanner
+    {
+        FrameScanner();
+
+        void reset();
+        int scan(const char *data, int size);
+
+        int offset;
+        int depth;
+        char blockStart;
+        char blockEnd;
+        bool inString;
+        bool escaped;
+    };
+
+    // responses to a batch request are collected here until each request
+    // in the batch has been answered, then they are written as one array
+    struct BatchResponse
+    {
+        BatchResponse() : pending(1), batch(0) {}     // released once dispatch is complete
+
+        QJsonArray responses;
+        int pending;
+        quint32 batch;      // see QJsonRpcMessagePrivate::batch()
+    };
+
+    // asynchronous requests that have not been answered by their deadline are
+    // finished with a timeout error. Deadlines live in a hashed timing wheel of
+    // DeadlineWheelSize slots, DeadlineResolution msecs apart; entries whose
+    // request was answered in the meantime are dropped when their slot comes up
+    enum { DeadlineWheelSize = 256, DeadlineResolution = 50 };
+    struct Deadline
+    {
+        qint64 id;
+        int rounds;     // full turns of the wheel left before expiry
+    };
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    struct PendingCallback
+    {
+        QJsonRpcMessage request;
+        QJsonRpcResponseCallback callback;
+    };
+#endif
+
+    QJsonRpcServiceReply *createReply(const QJsonRpcMessage &request);
+    QJsonRpcMessage sendBlockingCall(const QJsonRpcMessage &request, int msecs);
+    void abortBlockingCalls();
+    void addDeadline(qint64 id, int msecs);
+    void expireRequest(qint64 id);
+    bool hasPendingRequests() const;
+    void clearDeadlines();
+
+    // messages posted from other threads, their results serialized there.
+    // Those queued before the socket's thread gets to them are written
+    // together, one wakeup and one write for all of them
+    virtual void postQueued(QJsonRpcAbstractSocket *socket, const QJsonRpcMessage &message);
+
+    // flow control
+    enum { PausedReadBufferSize = 64 * 1024 };
+    // msecs is the timeout of the call, sent along with deadline propagation
+    void writeRequest(const QJsonRpcMessage &request, int msecs);
+    void requestFinished(qint64 id);    // answered or expired
+    void releaseHeldRequests();
+    void updateWriteBuffer();
+    void updateReadPause();
+
+    // memory limits
+    qint64 memoryUsage() const;
+    qint64 pendingFrameSize() const;    // as far as the frame being read is known
+    void updateMemoryUsage();
+    void dropConnection();              // once a limit is exceeded
+
+    // idle connections of a server, see QJsonRpcIdleWheel
+    void markActivity() { if (idleTracked) lastActivity = QJsonRpcMessagePrivate::monotonicMsecs(); }
+    void releaseIdleBuffers();
 
     int findJsonDocumentEnd(const QByteArray &jsonData);
     void writeData(const QJsonRpcMessage &message);
+    void writeData(const QJsonArray &batch);
+    void writeData(const QList<QJsonRpcMessage> &batch);
+    void prepareFrame(const QByteArray &data, const QByteArray &contentType,
+                      QByteArray *header, QByteArray *body,
+                      const QList<QByteArray> &attachments = QList<QByteArray>()) const;
+    void writeAttachmentFrame(const QJsonRpcMessage &message);
+    void encodeMessage(const QJsonRpcMessage &message, QByteArray *data, QByteArray *contentType) const;
+    QJsonRpcCodec *writeCodec() const;
+    void scheduleFlush();
+
+    void compactBuffer();
+    int nextFrame(int *frameStart);
+    bool atFrameHeader() const;
+    void processFrame(const char *data, int size, const QList<QByteArray> &attachments);
+    void processIncomingMessage(const QJsonRpcMessage &message);
+    void processIncomingBatch(const QJsonArray &batch);
+    bool collectBatchResponse(const QJsonRpcMessage &message);
+    virtual void requestCancelled(const QJsonRpcMessage &request);
+    void finishBatchResponse(const QSharedPointer<BatchResponse> &batchResponse);
+
+    // called once every request of a batch was answered, writes the
+    // responses as one array
+    virtual void writeBatchResponse(const QJsonArray &responses);
+
+    // transports delimiting frames themselves reimplement these along with
+    // _q_processIncomingData, and set messageFraming so that every frame,
+    // without a header or attachments, goes through writeFrame. writeRaw
+    // also writes the frames of broadcasts, which those sending every frame
+    // on its own reimplement as well
+    virtual void writeFrame(const QByteArray &data, const QByteArray &contentType = QByteArray());
+    virtual void writeRaw(const QByteArray &data);
+    virtual QByteArray encodeFrame(const QJsonRpcMessage &message) const;
+    virtual QByteArray wireFormat() const;      // identifies how encodeFrame encodes
 
     QPointer<QIODevice> device;
     QByteArray buffer;
-    QHash<int, QPointer<QJsonRpcServiceReply> > replies;
+    int bufferOffset;       // start of the unconsumed data in buffer
+    QJsonRpcIncrementalParser incoming;     // of frames without a header
+    QJsonRpc::FramingMode framingMode;
+    int contentLength;      // length of the current frame, -1 while reading its header
+
+    // encodings, 0 is text JSON
+    QJsonRpcCodec *codec;
+    QJsonRpcCodec *peerCodec;   // of the last frame with a header
+    QJsonRpcCodec *frameCodec;  // of the frame being read
+    bool frameCompressed;
+
+    // frames of at least this many bytes are deflated, -1 disables that
+    int compressionThreshold;
+    // compressed frames inflate to no more than their maximum size, or this
+    // without one
+    enum { MaximumInflatedFrameSize = 64 * 1024 * 1024 };
+    // a header announcing more than this, body and attachments together,
+    // is refused without a maximum frame size, the buffer couldn't hold it
+    enum { MaximumAnnouncedFrameSize = INT_MAX / 2 };
+
+    // binary attachments follow a frame's body, their sizes are listed in
+    // its Attachments header
+    bool attachmentsEnabled;
+    QList<int> frameAttachmentSizes;    // of the frame being read
+    int frameAttachmentsSize;
+
+    // write coalescing
+    int writeCoalescingDelay;
+    int writeCoalescingThreshold;
+    bool requestIdsAsStrings;
+    bool deadlinePropagation;
+    QByteArray writeBuffer;
+    QTimer *flushTimer;
+    QByteArray frameBuffer;     // reused to serialize messages written unbuffered
+
+    // messages posted from other threads, see postQueued()
+    QJsonRpcMpscQueue<QJsonRpcMessage> outbound;
+    QAtomicInt outboundScheduled;       // set by the producer that found it clear
+    bool drainingOutbound;
+
+    QHash<qint64, QPointer<QJsonRpcServiceReply> > replies;
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+    QHash<qint64, PendingCallback> callbacks;
+#endif
+    // requests of batches by id, each matched by the batch it was read in
+    QMultiHash<qint64, QSharedPointer<BatchResponse> > batchRequests;
+    quint32 batchCount;
+
+    // blocking calls from other threads, queued until the socket's thread
+    // picks them up, then waiting for their response
+    QMutex blockingCallsMutex;
+    QList<QJsonRpcBlockingCallPointer> queuedBlockingCalls;
+    QHash<qint64, QJsonRpcBlockingCallPointer> blockingCalls;
+
+    // request deadlines
+    QVector<QList<Deadline> > deadlineWheel;
+    int deadlineSlot;
+    qint64 deadlineTicks;   // ticks processed since deadlineClock was started
+    int pendingDeadlines;
+    QElapsedTimer deadlineClock;
+    QTimer *deadlineTimer;
+
+    // flow control
+    qint64 highWaterMark;
+    qint64 lowWaterMark;
+    int maximumRequestsInFlight;
+    int maximumIncomingRequests;
+    bool writeBlocked;          // above the high water mark
+    bool readPaused;
+    int incomingRequests;       // dispatched and not answered yet
+    QSet<qint64> requestsInFlight;          // only tracked with a maximum
+    QList<QJsonRpcMessage> heldRequests;    // waiting for room to be sent
+    qint64 savedReadBufferSize; // of the device, while paused
+
+    // memory limits
+    int maximumFrameSize;
+    qint64 maximumMemoryUsage;
+    qint64 accountedMemory;     // last reported to memoryAccount
+    QJsonRpcMemoryAccountPointer memoryAccount;     // of the server, if any
+    bool dropped;
+
+    // with a server
+    quint64 clientHandle;       // in its registry, 0 if none
+    int idleTimeout;            // 0 keeps it open while idle
+    qint64 lastActivity;        // monotonicMsecs() of the last traffic
+    bool idleTracked;
+
+    bool messageFraming;
 
     QJsonRpcSocket * const q_ptr;
     Q_DECLARE_PUBLIC(QJsonRpcSocket)
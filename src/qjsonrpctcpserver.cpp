@@ -1,16 +1,202 @@
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QThread>
+#include <QAtomicInt>
 
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcabstractserver_p.h"
 #include "qjsonrpctcpserver.h"
 
+// owns the connections handed to one I/O thread, lives in that thread
+class QJsonRpcTcpServerReactor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcTcpServerReactor(QJsonRpcTcpServer *server);
+    ~QJsonRpcTcpServerReactor();
+
+    int connectionCount() const;
+    QAtomicInt connections;     // counted on accept, before addConnection runs
+
+public Q_SLOTS:
+    void addConnection(qlonglong socketDescriptor);
+
+private Q_SLOTS:
+    void _q_clientDisconnected();
+    void _q_processMessage(const QJsonRpcMessage &message);
+
+private:
+    QJsonRpcTcpServer *server;
+    QJsonRpcIdleWheel *idleWheel;
+
+};
+
 class QJsonRpcTcpServerPrivate : public QJsonRpcAbstractServerPrivate
 {
 public:
-    QHash<QTcpSocket*, QJsonRpcSocket*> socketLookup;
+    QJsonRpcTcpServerPrivate()
+        : ioThreadCount(0),
+          nextReactor(0)
+    {
+    }
+
+    QJsonRpcTcpServerReactor *selectReactor(QJsonRpcTcpServer *server);
+    void stopReactors();
+
+    int ioThreadCount;
+    int nextReactor;
+    QList<QThread*> ioThreads;
+    QList<QJsonRpcTcpServerReactor*> reactors;
 };
 
+QJsonRpcTcpServerReactor::QJsonRpcTcpServerReactor(QJsonRpcTcpServer *server)
+    : connections(0),
+      server(server),
+      idleWheel(0)
+{
+}
+
+QJsonRpcTcpServerReactor::~QJsonRpcTcpServerReactor()
+{
+    QJsonRpcTcpServerPrivate *d = server->d_func();
+    QMutexLocker locker(&d->clientsMutex);
+    for (int i = d->clients.size() - 1; i >= 0; --i) {
+        QJsonRpcSocket *socket = d->clients.at(i);
+        if (socket->parent() != this)
+            continue;
+
+        // the tcp socket is its child
+        d->removeClient(socket);
+        if (QTcpSocket *tcpSocket = socket->findChild<QTcpSocket*>())
+            tcpSocket->flush();
+        delete socket;
+    }
+}
+
+int QJsonRpcTcpServerReactor::connectionCount() const
+{
+#if QT_VERSION >= 0x050000
+    return connections.load();
+#else
+    return connections;
+#endif
+}
+
+void QJsonRpcTcpServerReactor::addConnection(qlonglong socketDescriptor)
+{
+    QTcpSocket *tcpSocket = new QTcpSocket(this);
+    if (!tcpSocket->setSocketDescriptor(socketDescriptor)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "can't set socket descriptor";
+        connections.deref();
+        tcpSocket->deleteLater();
+        return;
+    }
+
+    QIODevice *device = qobject_cast<QIODevice*>(tcpSocket);
+    QJsonRpcSocket *socket = new QJsonRpcSocket(device, this);
+    tcpSocket->setParent(socket);
+    QJsonRpcTcpServerPrivate *d = server->d_func();
+    d->configureSocket(socket);
+    connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
+              this, SLOT(_q_processMessage(QJsonRpcMessage)));
+    connect(tcpSocket, SIGNAL(disconnected()), this, SLOT(_q_clientDisconnected()));
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        d->clients.insert(socket);
+    }
+
+    if (!idleWheel)
+        idleWheel = new QJsonRpcIdleWheel(d, this);
+    idleWheel->add(socket);
+    Q_EMIT server->clientConnected();
+}
+
+void QJsonRpcTcpServerReactor::_q_clientDisconnected()
+{
+    QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(sender());
+    if (!tcpSocket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called with invalid socket";
+        return;
+    }
+
+    // the tcp socket goes along with its QJsonRpcSocket
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcSocket*>(tcpSocket->parent());
+    QJsonRpcTcpServerPrivate *d = server->d_func();
+    bool removed = false;
+    if (socket) {
+        QMutexLocker locker(&d->clientsMutex);
+        removed = d->clients.contains(socket);
+        if (removed)
+            d->removeClient(socket);
+    }
+
+    if (!removed) {
+        tcpSocket->deleteLater();
+        return;
+    }
+
+    connections.deref();
+    socket->deleteLater();
+    Q_EMIT server->clientDisconnected();
+}
+
+void QJsonRpcTcpServerReactor::_q_processMessage(const QJsonRpcMessage &message)
+{
+    QJsonRpcSocket *socket = static_cast<QJsonRpcSocket*>(sender());
+    if (!socket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called without service socket";
+        return;
+    }
+
+    if (server->d_func()->processSubscription(socket, message))
+        return;
+    server->processMessage(socket, message);
+}
+
+QJsonRpcTcpServerReactor *QJsonRpcTcpServerPrivate::selectReactor(QJsonRpcTcpServer *server)
+{
+    if (reactors.isEmpty()) {
+        for (int i = 0; i < ioThreadCount; ++i) {
+            QThread *thread = new QThread;
+            QJsonRpcTcpServerReactor *reactor = new QJsonRpcTcpServerReactor(server);
+            reactor->moveToThread(thread);
+            thread->start();
+            ioThreads.append(thread);
+            reactors.append(reactor);
+        }
+    }
+
+    // least loaded, round robin between equally loaded ones
+    int selected = nextReactor;
+    int selectedLoad = reactors.at(selected)->connectionCount();
+    for (int i = 1; i < reactors.size() && selectedLoad > 0; ++i) {
+        int index = (nextReactor + i) % reactors.size();
+        int load = reactors.at(index)->connectionCount();
+        if (load < selectedLoad) {
+            selected = index;
+            selectedLoad = load;
+        }
+    }
+
+    nextReactor = (selected + 1) % reactors.size();
+    return reactors.at(selected);
+}
+
+void QJsonRpcTcpServerPrivate::stopReactors()
+{
+    // reactors are deleted in their own thread when its event loop finishes
+    foreach (QJsonRpcTcpServerReactor *reactor, reactors)
+        reactor->deleteLater();
+    reactors.clear();
+
+    foreach (QThread *thread, ioThreads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    ioThreads.clear();
+}
+
 QJsonRpcTcpServer::QJsonRpcTcpServer(QObject *parent)
 #if defined(USE_QT_PRIVATE_HEADERS)
     : QTcpServer(*new QJsonRpcTcpServerPrivate, parent)
@@ -24,14 +210,15 @@ QJsonRpcTcpServer::QJsonRpcTcpServer(QObject *parent)
 QJsonRpcTcpServer::~QJsonRpcTcpServer()
 {
     Q_D(QJsonRpcTcpServer);
-    foreach (QTcpSocket *socket, d->socketLookup.keys()) {
-        socket->flush();
-        socket->deleteLater();
-    }
-    d->socketLookup.clear();
+    d->stopReactors();
 
-    foreach (QJsonRpcSocket *client, d->clients)
+    // those accepted in this thread, the tcp sockets are their children
+    for (int i = 0; i < d->clients.size(); ++i) {
+        QJsonRpcSocket *client = d->clients.at(i);
+        if (QTcpSocket *tcpSocket = client->findChild<QTcpSocket*>())
+            tcpSocket->flush();
         client->deleteLater();
+    }
     d->clients.clear();
 }
 
@@ -44,6 +231,8 @@ bool QJsonRpcTcpServer::addService(QJsonRpcService *service)
                this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
     connect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
                this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    connect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+               this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
     return true;
 }
 
@@ -56,15 +245,173 @@ bool QJsonRpcTcpServer::removeService(QJsonRpcService *service)
                   this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
     disconnect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
                   this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    disconnect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+                  this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
     return true;
 }
 
 int QJsonRpcTcpServer::connectedClientCount() const
 {
     Q_D(const QJsonRpcTcpServer);
+    QMutexLocker locker(&d->clientsMutex);
     return d->clients.size();
 }
 
+QJsonRpc::FramingMode QJsonRpcTcpServer::framingMode() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->framingMode;
+}
+
+void QJsonRpcTcpServer::setFramingMode(QJsonRpc::FramingMode mode)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->framingMode = mode;
+}
+
+int QJsonRpcTcpServer::writeCoalescingDelay() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->writeCoalescingDelay;
+}
+
+void QJsonRpcTcpServer::setWriteCoalescingDelay(int msecs)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->writeCoalescingDelay = msecs < 0 ? -1 : msecs;
+}
+
+QJsonRpcCodec *QJsonRpcTcpServer::codec() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->codec;
+}
+
+void QJsonRpcTcpServer::setCodec(QJsonRpcCodec *codec)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->codec = codec;
+}
+
+int QJsonRpcTcpServer::compressionThreshold() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->compressionThreshold;
+}
+
+void QJsonRpcTcpServer::setCompressionThreshold(int bytes)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->compressionThreshold = bytes < 0 ? -1 : bytes;
+}
+
+bool QJsonRpcTcpServer::attachmentsEnabled() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->attachmentsEnabled;
+}
+
+void QJsonRpcTcpServer::setAttachmentsEnabled(bool enabled)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->attachmentsEnabled = enabled;
+}
+
+qint64 QJsonRpcTcpServer::writeBufferHighWaterMark() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->highWaterMark;
+}
+
+qint64 QJsonRpcTcpServer::writeBufferLowWaterMark() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->lowWaterMark;
+}
+
+void QJsonRpcTcpServer::setWriteBufferWaterMarks(qint64 high, qint64 low)
+{
+    Q_D(QJsonRpcTcpServer);
+    if (high >= 0 && (low < 0 || low > high)) {
+        qJsonRpcDebug() << "Cannot set a low water mark outside of 0 and the high water mark";
+        return;
+    }
+
+    d->highWaterMark = high < 0 ? -1 : high;
+    d->lowWaterMark = high < 0 ? -1 : low;
+}
+
+int QJsonRpcTcpServer::maximumIncomingRequests() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->maximumIncomingRequests;
+}
+
+void QJsonRpcTcpServer::setMaximumIncomingRequests(int count)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->maximumIncomingRequests = count <= 0 ? -1 : count;
+}
+
+int QJsonRpcTcpServer::maximumFrameSize() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->maximumFrameSize;
+}
+
+void QJsonRpcTcpServer::setMaximumFrameSize(int bytes)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->maximumFrameSize = bytes <= 0 ? -1 : bytes;
+}
+
+qint64 QJsonRpcTcpServer::maximumConnectionMemory() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->maximumConnectionMemory;
+}
+
+void QJsonRpcTcpServer::setMaximumConnectionMemory(qint64 bytes)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->maximumConnectionMemory = bytes <= 0 ? -1 : bytes;
+}
+
+QJsonRpcMemoryStats QJsonRpcTcpServer::memoryStats() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->memoryAccount->stats();
+}
+
+int QJsonRpcTcpServer::idleTimeout() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->idleTimeout;
+}
+
+void QJsonRpcTcpServer::setIdleTimeout(int msecs)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->idleTimeout = qMax(0, msecs);
+}
+
+int QJsonRpcTcpServer::ioThreadCount() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->ioThreadCount;
+}
+
+void QJsonRpcTcpServer::setIoThreadCount(int count)
+{
+    Q_D(QJsonRpcTcpServer);
+    if (!d->reactors.isEmpty()) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "can't change the I/O threads once connections were accepted";
+        return;
+    }
+
+    d->ioThreadCount = qMax(0, count);
+}
+
 #if QT_VERSION >= QT_VERSION_CHECK(5,0,0)
 void QJsonRpcTcpServer::incomingConnection(qintptr socketDescriptor)
 #else
@@ -72,6 +419,14 @@ void QJsonRpcTcpServer::incomingConnection(int socketDescriptor)
 #endif
 {
     Q_D(QJsonRpcTcpServer);
+    if (d->ioThreadCount > 0) {
+        QJsonRpcTcpServerReactor *reactor = d->selectReactor(this);
+        reactor->connections.ref();
+        QMetaObject::invokeMethod(reactor, "addConnection", Qt::QueuedConnection,
+                                  Q_ARG(qlonglong, socketDescriptor));
+        return;
+    }
+
     QTcpSocket *tcpSocket = new QTcpSocket(this);
     if (!tcpSocket->setSocketDescriptor(socketDescriptor)) {
         qJsonRpcDebug() << Q_FUNC_INFO << "can't set socket descriptor";
@@ -81,11 +436,19 @@ void QJsonRpcTcpServer::incomingConnection(int socketDescriptor)
 
     QIODevice *device = qobject_cast<QIODevice*>(tcpSocket);
     QJsonRpcSocket *socket = new QJsonRpcSocket(device, this);
+    tcpSocket->setParent(socket);
+    d->configureSocket(socket);
     connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
               this, SLOT(_q_processMessage(QJsonRpcMessage)));
-    d->clients.append(socket);
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        d->clients.insert(socket);
+    }
     connect(tcpSocket, SIGNAL(disconnected()), this, SLOT(_q_clientDisconnected()));
-    d->socketLookup.insert(tcpSocket, socket);
+
+    if (!d->idleWheel)
+        d->idleWheel = new QJsonRpcIdleWheel(d, this);
+    d->idleWheel->add(socket);
     Q_EMIT clientConnected();
 }
 
@@ -98,24 +461,36 @@ void QJsonRpcTcpServer::_q_clientDisconnected()
         return;
     }
 
-    if (d->socketLookup.contains(tcpSocket)) {
-        QJsonRpcSocket *socket = d->socketLookup.take(tcpSocket);
-        d->clients.removeAll(socket);
-        socket->deleteLater();
+    // the tcp socket goes along with its QJsonRpcSocket
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcSocket*>(tcpSocket->parent());
+    bool removed = false;
+    if (socket) {
+        QMutexLocker locker(&d->clientsMutex);
+        removed = d->clients.contains(socket);
+        if (removed)
+            d->removeClient(socket);
     }
 
-    tcpSocket->deleteLater();
+    if (!removed) {
+        tcpSocket->deleteLater();
+        return;
+    }
+
+    socket->deleteLater();
     Q_EMIT clientDisconnected();
 }
 
 void QJsonRpcTcpServer::_q_processMessage(const QJsonRpcMessage &message)
 {
+    Q_D(QJsonRpcTcpServer);
     QJsonRpcSocket *socket = static_cast<QJsonRpcSocket*>(sender());
     if (!socket) {
         qJsonRpcDebug() << Q_FUNC_INFO << "called without service socket";
         return;
     }
 
+    if (d->processSubscription(socket, message))
+        return;
     processMessage(socket, message);
 }
 
@@ -131,4 +506,29 @@ void QJsonRpcTcpServer::notifyConnectedClients(const QString &method, const QJso
     d->_q_notifyConnectedClients(method, params);
 }
 
+void QJsonRpcTcpServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->_q_notifySubscribers(topic, message);
+}
+
+bool QJsonRpcTcpServer::subscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcTcpServer);
+    return d->subscribe(client, topic);
+}
+
+bool QJsonRpcTcpServer::unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcTcpServer);
+    return d->unsubscribe(client, topic);
+}
+
+int QJsonRpcTcpServer::subscriberCount(const QString &topic) const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->subscriberCount(topic);
+}
+
 #include "moc_qjsonrpctcpserver.cpp"
+#include "qjsonrpctcpserver.moc"
@@ -29,6 +29,51 @@ public:
     ~QJsonRpcTcpServer();
 
     virtual int connectedClientCount() const;
+    virtual bool subscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual bool unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual int subscriberCount(const QString &topic) const;
+
+    // applies to connections accepted after the call
+    QJsonRpc::FramingMode framingMode() const;
+    void setFramingMode(QJsonRpc::FramingMode mode);
+    int writeCoalescingDelay() const;
+    void setWriteCoalescingDelay(int msecs);
+    QJsonRpcCodec *codec() const;
+    void setCodec(QJsonRpcCodec *codec);
+    int compressionThreshold() const;
+    void setCompressionThreshold(int bytes);
+    bool attachmentsEnabled() const;
+    void setAttachmentsEnabled(bool enabled);
+
+    // flow control of each connection, see QJsonRpcSocket
+    qint64 writeBufferHighWaterMark() const;
+    qint64 writeBufferLowWaterMark() const;
+    void setWriteBufferWaterMarks(qint64 high, qint64 low);
+    int maximumIncomingRequests() const;
+    void setMaximumIncomingRequests(int count);
+
+    // memory limits of each connection, see QJsonRpcSocket, and what all
+    // of them hold
+    int maximumFrameSize() const;
+    void setMaximumFrameSize(int bytes);
+    qint64 maximumConnectionMemory() const;
+    void setMaximumConnectionMemory(qint64 bytes);
+    QJsonRpcMemoryStats memoryStats() const;
+
+    // connections that neither received nor sent anything for that long
+    // are closed, unless they still have requests in flight; idle ones
+    // release their buffers either way. 0, the default, keeps them open.
+    // Applies to connections accepted after the call.
+    int idleTimeout() const;
+    void setIdleTimeout(int msecs);
+
+    // Accepted connections are handed to the least loaded of count threads,
+    // each reading, parsing and writing its own connections. Services are
+    // still invoked on their own thread, or their thread pool if they have one.
+    // 0, the default, serves every connection from the server's thread. Can't
+    // be changed once connections were accepted.
+    int ioThreadCount() const;
+    void setIoThreadCount(int count);
 
     // reimp
     bool addService(QJsonRpcService *service);
@@ -41,6 +86,7 @@ Q_SIGNALS:
 public Q_SLOTS:
     void notifyConnectedClients(const QJsonRpcMessage &message);
     void notifyConnectedClients(const QString &method, const QJsonArray &params);
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
 
 protected:
 #if QT_VERSION >= QT_VERSION_CHECK(5,0,0)
@@ -56,6 +102,7 @@ private Q_SLOTS:
 private:
     Q_DECLARE_PRIVATE(QJsonRpcTcpServer)
     Q_DISABLE_COPY(QJsonRpcTcpServer)
+    friend class QJsonRpcTcpServerReactor;
 #if !defined(USE_QT_PRIVATE_HEADERS)
     QScopedPointer<QJsonRpcTcpServerPrivate> d_ptr;
 #endif
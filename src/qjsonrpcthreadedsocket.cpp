@@ -0,0 +1,292 @@
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QSharedPointer>
+
+#include "qjsonrpcservice.h"
+#include "qjsonrpcservicereply.h"
+#include "qjsonrpcservicereply_p.h"
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpcmpscqueue_p.h"
+#include "qjsonrpcthreadedsocket.h"
+
+// a reply of the sending thread, the I/O thread only reaches it through
+// the handle, which forgets the reply when it is deleted
+class QJsonRpcThreadedReply;
+class QJsonRpcThreadedReplyHandle
+{
+public:
+    QJsonRpcThreadedReplyHandle(QJsonRpcThreadedReply *reply) : reply(reply) {}
+
+    QMutex mutex;
+    QJsonRpcThreadedReply *reply;
+};
+typedef QSharedPointer<QJsonRpcThreadedReplyHandle> QJsonRpcThreadedReplyHandlePointer;
+
+class QJsonRpcThreadedReply : public QJsonRpcServiceReply
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcThreadedReply(const QJsonRpcMessage &request)
+        : handle(new QJsonRpcThreadedReplyHandle(this))
+    {
+        Q_D(QJsonRpcServiceReply);
+        d->request = request;
+    }
+
+    ~QJsonRpcThreadedReply()
+    {
+        QMutexLocker locker(&handle->mutex);
+        handle->reply = 0;
+    }
+
+    QJsonRpcThreadedReplyHandlePointer handle;
+
+public Q_SLOTS:
+    void deliver(const QJsonRpcMessage &response)
+    {
+        // aborted meanwhile
+        Q_D(QJsonRpcServiceReply);
+        if (d->response.isValid())
+            return;
+
+        d->response = response;
+        Q_EMIT finished();
+    }
+};
+
+// a message on its way to the I/O thread
+struct QJsonRpcThreadedCall
+{
+    QJsonRpcThreadedCall() : msecs(0) {}
+
+    QJsonRpcMessage message;
+    int msecs;
+    QJsonRpcBlockingCallPointer blockingCall;   // for sendMessageBlocking
+    QJsonRpcThreadedReplyHandlePointer reply;   // for sendMessage
+};
+
+static void finishThreadedCall(const QJsonRpcThreadedCall &call, const QJsonRpcMessage &response)
+{
+    if (call.blockingCall) {
+        call.blockingCall->finish(response);
+    } else if (call.reply) {
+        // a reply deleted after the event is posted drops it along with it
+        QMutexLocker locker(&call.reply->mutex);
+        if (call.reply->reply)
+            QMetaObject::invokeMethod(call.reply->reply, "deliver", Qt::QueuedConnection,
+                                      Q_ARG(QJsonRpcMessage, response));
+    }
+}
+
+// owns the device and its socket, lives in the I/O thread
+class QJsonRpcThreadedSocketPrivate;
+class QJsonRpcThreadedSocketReactor : public QObject
+{
+    Q_OBJECT
+public:
+    QJsonRpcThreadedSocketReactor(QJsonRpcThreadedSocketPrivate *socket, QIODevice *device);
+    ~QJsonRpcThreadedSocketReactor();
+
+    QJsonRpcSocket *socket;
+
+public Q_SLOTS:
+    void drain();
+
+private Q_SLOTS:
+    void _q_replyFinished();
+    void _q_deviceClosed();
+
+private:
+    void send(const QJsonRpcThreadedCall &call);
+
+    QJsonRpcThreadedSocketPrivate *d;
+    QHash<QJsonRpcServiceReply*, QJsonRpcThreadedCall> calls;
+
+};
+
+class QJsonRpcThreadedSocketPrivate : public QJsonRpcAbstractSocketPrivate
+{
+public:
+    QJsonRpcThreadedSocketPrivate(QJsonRpcThreadedSocket *socket)
+        : drainScheduled(0),
+          valid(0),
+          reactor(0),
+          q_ptr(socket)
+    {
+    }
+
+    void submit(const QJsonRpcThreadedCall &call);
+
+    QJsonRpcMpscQueue<QJsonRpcThreadedCall> queue;
+    QAtomicInt drainScheduled;  // set by the producer that found it clear
+    QAtomicInt valid;
+    QThread ioThread;
+    QJsonRpcThreadedSocketReactor *reactor;
+
+    QJsonRpcThreadedSocket * const q_ptr;
+    Q_DECLARE_PUBLIC(QJsonRpcThreadedSocket)
+};
+
+void QJsonRpcThreadedSocketPrivate::submit(const QJsonRpcThreadedCall &call)
+{
+    queue.enqueue(call);
+
+    // one wakeup for all the messages queued until the reactor drains them
+    if (drainScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(reactor, "drain", Qt::QueuedConnection);
+}
+
+QJsonRpcThreadedSocketReactor::QJsonRpcThreadedSocketReactor(QJsonRpcThreadedSocketPrivate *socket,
+                                                             QIODevice *device)
+    : socket(0),
+      d(socket)
+{
+    device->setParent(this);
+    this->socket = new QJsonRpcSocket(device, this);
+    connect(device, SIGNAL(aboutToClose()), this, SLOT(_q_deviceClosed()));
+    if (device->metaObject()->indexOfSignal("disconnected()") != -1)
+        connect(device, SIGNAL(disconnected()), this, SLOT(_q_deviceClosed()));
+}
+
+QJsonRpcThreadedSocketReactor::~QJsonRpcThreadedSocketReactor()
+{
+    QHash<QJsonRpcServiceReply*, QJsonRpcThreadedCall>::const_iterator it;
+    for (it = calls.constBegin(); it != calls.constEnd(); ++it)
+        finishThreadedCall(it.value(), it.value().message.createErrorResponse(QJsonRpc::InternalError,
+                                                                              "socket destroyed"));
+}
+
+void QJsonRpcThreadedSocketReactor::drain()
+{
+    // cleared first, a message enqueued from now on schedules another pass
+    d->drainScheduled.fetchAndStoreOrdered(0);
+
+    QJsonRpcThreadedCall call;
+    while (d->queue.dequeue(&call))
+        send(call);
+}
+
+void QJsonRpcThreadedSocketReactor::send(const QJsonRpcThreadedCall &call)
+{
+    if (call.message.type() != QJsonRpcMessage::Request) {
+        socket->notify(call.message);
+        return;
+    }
+
+    // the socket reads its timeout when the request is sent
+    socket->setDefaultRequestTimeout(call.msecs);
+    QJsonRpcServiceReply *reply = socket->sendMessage(call.message);
+    if (!reply) {
+        finishThreadedCall(call, call.message.createErrorResponse(QJsonRpc::InternalError, "no device"));
+        return;
+    }
+
+    calls.insert(reply, call);
+    connect(reply, SIGNAL(finished()), this, SLOT(_q_replyFinished()));
+}
+
+void QJsonRpcThreadedSocketReactor::_q_replyFinished()
+{
+    QJsonRpcServiceReply *reply = static_cast<QJsonRpcServiceReply*>(sender());
+    if (calls.contains(reply))
+        finishThreadedCall(calls.take(reply), reply->response());
+    reply->deleteLater();
+}
+
+void QJsonRpcThreadedSocketReactor::_q_deviceClosed()
+{
+    d->valid.fetchAndStoreOrdered(0);
+}
+
+QJsonRpcThreadedSocket::QJsonRpcThreadedSocket(QIODevice *device, QObject *parent)
+    : QJsonRpcAbstractSocket(*new QJsonRpcThreadedSocketPrivate(this), parent)
+{
+    Q_D(QJsonRpcThreadedSocket);
+    if (device->parent())
+        qJsonRpcDebug() << Q_FUNC_INFO << "taking over a device that has a parent";
+
+    d->valid.fetchAndStoreOrdered(device->isOpen() ? 1 : 0);
+    d->reactor = new QJsonRpcThreadedSocketReactor(d, device);
+    connect(d->reactor->socket, SIGNAL(messageReceived(QJsonRpcMessage)),
+            this, SIGNAL(messageReceived(QJsonRpcMessage)));
+    d->reactor->moveToThread(&d->ioThread);
+    d->ioThread.start();
+}
+
+QJsonRpcThreadedSocket::~QJsonRpcThreadedSocket()
+{
+    Q_D(QJsonRpcThreadedSocket);
+
+    // the reactor is deleted in its own thread when its event loop finishes
+    d->reactor->deleteLater();
+    d->ioThread.quit();
+    d->ioThread.wait();
+
+    // the I/O thread is gone, this one is the consumer now
+    QJsonRpcThreadedCall call;
+    while (d->queue.dequeue(&call))
+        finishThreadedCall(call, call.message.createErrorResponse(QJsonRpc::InternalError,
+                                                                  "socket destroyed"));
+}
+
+bool QJsonRpcThreadedSocket::isValid() const
+{
+    Q_D(const QJsonRpcThreadedSocket);
+    return const_cast<QAtomicInt &>(d->valid).fetchAndAddOrdered(0) != 0;
+}
+
+QThread *QJsonRpcThreadedSocket::ioThread() const
+{
+    Q_D(const QJsonRpcThreadedSocket);
+    return const_cast<QThread *>(&d->ioThread);
+}
+
+void QJsonRpcThreadedSocket::notify(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcThreadedSocket);
+
+    QJsonRpcThreadedCall call;
+    call.message = message;
+    d->submit(call);
+}
+
+QJsonRpcMessage QJsonRpcThreadedSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
+{
+    Q_D(QJsonRpcThreadedSocket);
+    QJsonRpcThreadedCall call;
+    call.message = message;
+    call.msecs = msecs;
+    call.blockingCall = QJsonRpcBlockingCallPointer(new QJsonRpcBlockingCall(message, msecs));
+    d->submit(call);
+    return call.blockingCall->wait();
+}
+
+QJsonRpcServiceReply *QJsonRpcThreadedSocket::sendMessage(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcThreadedSocket);
+    QJsonRpcThreadedReply *reply = new QJsonRpcThreadedReply(message);
+    QJsonRpcThreadedCall call;
+    call.message = message;
+    call.msecs = d->defaultRequestTimeout;
+    call.reply = reply->handle;
+    d->submit(call);
+    return reply;
+}
+
+QList<QJsonRpcServiceReply *> QJsonRpcThreadedSocket::sendBatch(const QList<QJsonRpcMessage> &messages)
+{
+    // sent one by one, the I/O thread coalesces the writes of one pass
+    QList<QJsonRpcServiceReply *> batchReplies;
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() == QJsonRpcMessage::Request)
+            batchReplies.append(sendMessage(message));
+        else
+            notify(message);
+    }
+
+    return batchReplies;
+}
+
+#include "moc_qjsonrpcthreadedsocket.cpp"
+#include "qjsonrpcthreadedsocket.moc"
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCTHREADEDSOCKET_H
+#define QJSONRPCTHREADEDSOCKET_H
+
+#include "qjsonrpcsocket.h"
+
+// One client connection shared by any number of threads. The device is
+// moved, along with a QJsonRpcSocket on it, to an I/O thread of the
+// socket's own; messages sent from any thread go there through a queue
+// that takes no lock. Replies belong to the thread that sent the request,
+// their response is set and finished() emitted in that thread's event loop.
+// Blocking calls wait without an event loop, from any thread.
+//
+//     QTcpSocket *tcpSocket = new QTcpSocket;
+//     tcpSocket->connectToHost(host, port);
+//     tcpSocket->waitForConnected();
+//     QJsonRpcThreadedSocket *socket = new QJsonRpcThreadedSocket(tcpSocket);
+class QThread;
+class QJsonRpcThreadedSocketPrivate;
+class QJSONRPC_EXPORT QJsonRpcThreadedSocket : public QJsonRpcAbstractSocket
+{
+    Q_OBJECT
+public:
+    // takes the device, which must not have a parent, over
+    explicit QJsonRpcThreadedSocket(QIODevice *device, QObject *parent = 0);
+    ~QJsonRpcThreadedSocket();
+
+    // valid until the device closed
+    virtual bool isValid() const;
+    QThread *ioThread() const;
+
+public Q_SLOTS:
+    virtual void notify(const QJsonRpcMessage &message);
+    virtual QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = DEFAULT_MSECS_REQUEST_TIMEOUT);
+    virtual QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
+    virtual QList<QJsonRpcServiceReply *> sendBatch(const QList<QJsonRpcMessage> &messages);
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcThreadedSocket)
+    Q_DISABLE_COPY(QJsonRpcThreadedSocket)
+    friend class QJsonRpcThreadedSocketReactor;
+};
+
+#endif
@@ -0,0 +1,429 @@
+#include <QUdpSocket>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include "qjsonrpcudpsocket.h"
+#include "qjsonrpcudpsocket_p.h"
+#include "qjsonrpcabstractserver_p.h"
+#include "qjsonrpcudpserver.h"
+
+class QJsonRpcUdpServerPrivate : public QJsonRpcAbstractServerPrivate
+{
+public:
+    QJsonRpcUdpServerPrivate()
+        : udpSocket(0),
+          expiryTimer(0),
+          maximumDatagramSize(QJsonRpcUdpSocketPrivate::DefaultMaximumDatagramSize),
+          rejectedDatagrams(0),
+          peerTimeout(60000),
+          maximumPeerCount(DefaultMaximumPeerCount),
+          responsesEnabled(false)
+    {
+    }
+
+    enum { DefaultMaximumPeerCount = 1024 };
+
+    struct Peer
+    {
+        QJsonRpcUdpSocket *socket;
+        QElapsedTimer lastSeen;
+        bool client;
+    };
+
+    // IPv4 peers have the same key whether or not they're seen as mapped
+    // IPv6 addresses
+    static QByteArray peerKey(const QHostAddress &address, quint16 port);
+    QJsonRpcUdpSocket *takePeer(const QByteArray &key, bool *client);
+    void startExpiryTimer();
+
+    QUdpSocket *udpSocket;
+    QTimer *expiryTimer;
+    QHash<QByteArray, Peer> peers;
+    int maximumDatagramSize;
+    int rejectedDatagrams;
+    int peerTimeout;
+    int maximumPeerCount;
+    bool responsesEnabled;
+
+};
+
+QByteArray QJsonRpcUdpServerPrivate::peerKey(const QHostAddress &address, quint16 port)
+{
+    QString text = address.toString();
+    if (text.startsWith(QLatin1String("::ffff:")))
+        text.remove(0, 7);
+    return text.toLatin1() + ' ' + QByteArray::number(port);
+}
+
+QJsonRpcUdpSocket *QJsonRpcUdpServerPrivate::takePeer(const QByteArray &key, bool *client)
+{
+    const Peer peer = peers.take(key);
+    *client = peer.client;
+    if (peer.client) {
+        QMutexLocker locker(&clientsMutex);
+        removeClient(peer.socket);
+    }
+    return peer.socket;
+}
+
+void QJsonRpcUdpServerPrivate::startExpiryTimer()
+{
+    if (peerTimeout > 0 && udpSocket->state() == QAbstractSocket::BoundState)
+        expiryTimer->start(qMax(peerTimeout / 4, 50));
+    else
+        expiryTimer->stop();
+}
+
+QJsonRpcUdpServer::QJsonRpcUdpServer(QObject *parent)
+#if defined(USE_QT_PRIVATE_HEADERS)
+    : QObject(*new QJsonRpcUdpServerPrivate, parent)
+#else
+    : QObject(parent),
+      d_ptr(new QJsonRpcUdpServerPrivate)
+#endif
+{
+    Q_D(QJsonRpcUdpServer);
+    d->udpSocket = new QUdpSocket(this);
+    connect(d->udpSocket, SIGNAL(readyRead()), this, SLOT(_q_readDatagrams()));
+    connect(d->udpSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(_q_bytesWritten()));
+    d->expiryTimer = new QTimer(this);
+    connect(d->expiryTimer, SIGNAL(timeout()), this, SLOT(_q_expirePeers()));
+}
+
+QJsonRpcUdpServer::~QJsonRpcUdpServer()
+{
+    Q_D(QJsonRpcUdpServer);
+    QHash<QByteArray, QJsonRpcUdpServerPrivate::Peer>::const_iterator it;
+    for (it = d->peers.constBegin(); it != d->peers.constEnd(); ++it)
+        it.value().socket->deleteLater();
+    d->peers.clear();
+    d->clients.clear();
+}
+
+bool QJsonRpcUdpServer::listen(const QHostAddress &address, quint16 port)
+{
+    Q_D(QJsonRpcUdpServer);
+    if (d->udpSocket->state() != QAbstractSocket::UnconnectedState) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "already listening";
+        return false;
+    }
+
+    if (!d->udpSocket->bind(address, port))
+        return false;
+
+    d->startExpiryTimer();
+    return true;
+}
+
+bool QJsonRpcUdpServer::isListening() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->udpSocket->state() == QAbstractSocket::BoundState;
+}
+
+void QJsonRpcUdpServer::close()
+{
+    Q_D(QJsonRpcUdpServer);
+    d->udpSocket->close();
+    d->expiryTimer->stop();
+    foreach (const QByteArray &key, d->peers.keys()) {
+        bool client = false;
+        d->takePeer(key, &client)->deleteLater();
+        if (client)
+            Q_EMIT clientDisconnected();
+    }
+}
+
+QHostAddress QJsonRpcUdpServer::serverAddress() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->udpSocket->localAddress();
+}
+
+quint16 QJsonRpcUdpServer::serverPort() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->udpSocket->localPort();
+}
+
+QString QJsonRpcUdpServer::errorString() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->udpSocket->errorString();
+}
+
+int QJsonRpcUdpServer::connectedClientCount() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    QMutexLocker locker(&d->clientsMutex);
+    return d->clients.size();
+}
+
+QJsonRpcCodec *QJsonRpcUdpServer::codec() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->codec;
+}
+
+void QJsonRpcUdpServer::setCodec(QJsonRpcCodec *codec)
+{
+    Q_D(QJsonRpcUdpServer);
+    d->codec = codec;
+}
+
+int QJsonRpcUdpServer::maximumDatagramSize() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->maximumDatagramSize;
+}
+
+void QJsonRpcUdpServer::setMaximumDatagramSize(int bytes)
+{
+    Q_D(QJsonRpcUdpServer);
+    if (bytes <= 0 || bytes > QJsonRpcUdpSocketPrivate::DefaultMaximumDatagramSize) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid datagram size" << bytes;
+        return;
+    }
+
+    d->maximumDatagramSize = bytes;
+    QHash<QByteArray, QJsonRpcUdpServerPrivate::Peer>::const_iterator it;
+    for (it = d->peers.constBegin(); it != d->peers.constEnd(); ++it)
+        it.value().socket->setMaximumDatagramSize(bytes);
+}
+
+int QJsonRpcUdpServer::rejectedDatagramCount() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    int rejected = d->rejectedDatagrams;
+    QHash<QByteArray, QJsonRpcUdpServerPrivate::Peer>::const_iterator it;
+    for (it = d->peers.constBegin(); it != d->peers.constEnd(); ++it)
+        rejected += it.value().socket->rejectedDatagramCount();
+    return rejected;
+}
+
+int QJsonRpcUdpServer::peerTimeout() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->peerTimeout;
+}
+
+void QJsonRpcUdpServer::setPeerTimeout(int msecs)
+{
+    Q_D(QJsonRpcUdpServer);
+    d->peerTimeout = qMax(0, msecs);
+    d->startExpiryTimer();
+}
+
+int QJsonRpcUdpServer::maximumPeerCount() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->maximumPeerCount;
+}
+
+void QJsonRpcUdpServer::setMaximumPeerCount(int count)
+{
+    Q_D(QJsonRpcUdpServer);
+    if (count <= 0) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid peer count" << count;
+        return;
+    }
+
+    d->maximumPeerCount = count;
+}
+
+bool QJsonRpcUdpServer::responsesEnabled() const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->responsesEnabled;
+}
+
+void QJsonRpcUdpServer::setResponsesEnabled(bool enabled)
+{
+    Q_D(QJsonRpcUdpServer);
+    d->responsesEnabled = enabled;
+}
+
+bool QJsonRpcUdpServer::addService(QJsonRpcService *service)
+{
+    if (!QJsonRpcServiceProvider::addService(service))
+        return false;
+
+    connect(service, SIGNAL(notifyConnectedClients(QJsonRpcMessage)),
+               this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
+    connect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
+               this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    connect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+               this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
+    return true;
+}
+
+bool QJsonRpcUdpServer::removeService(QJsonRpcService *service)
+{
+    if (!QJsonRpcServiceProvider::removeService(service))
+        return false;
+
+    disconnect(service, SIGNAL(notifyConnectedClients(QJsonRpcMessage)),
+                  this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
+    disconnect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
+                  this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    disconnect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+                  this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
+    return true;
+}
+
+void QJsonRpcUdpServer::_q_readDatagrams()
+{
+    Q_D(QJsonRpcUdpServer);
+    while (d->udpSocket->hasPendingDatagrams()) {
+        const qint64 size = d->udpSocket->pendingDatagramSize();
+        if (size > d->maximumDatagramSize) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "dropping datagram of" << size << "bytes";
+            d->udpSocket->readDatagram(0, 0);
+            d->rejectedDatagrams++;
+            continue;
+        }
+
+        QByteArray datagram;
+        datagram.resize(int(qMax(size, qint64(0))));
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        const qint64 read = d->udpSocket->readDatagram(datagram.data(), datagram.size(),
+                                                       &sender, &senderPort);
+        if (read < 0)
+            continue;
+        datagram.resize(int(read));
+
+        const QByteArray key = QJsonRpcUdpServerPrivate::peerKey(sender, senderPort);
+        QHash<QByteArray, QJsonRpcUdpServerPrivate::Peer>::iterator it = d->peers.find(key);
+        if (it == d->peers.end()) {
+            // anyone can claim to be a new client with a spoofed source,
+            // so they're only answered while there's room for them
+            if (d->peers.size() >= d->maximumPeerCount) {
+                qJsonRpcDebug() << Q_FUNC_INFO << "dropping datagram from new peer" << key;
+                d->rejectedDatagrams++;
+                continue;
+            }
+
+            // the datagrams of all peers are read, and the shared socket's
+            // writes reported, here rather than by each of their sockets
+            QJsonRpcUdpSocket *socket = new QJsonRpcUdpSocket(d->udpSocket, sender, senderPort, this);
+            disconnect(d->udpSocket, SIGNAL(readyRead()), socket, SLOT(_q_processIncomingData()));
+            d->configureSocket(socket);
+            disconnect(d->udpSocket, SIGNAL(bytesWritten(qint64)), socket, SLOT(_q_bytesWritten()));
+            socket->setMaximumDatagramSize(d->maximumDatagramSize);
+            connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
+                      this, SLOT(_q_processMessage(QJsonRpcMessage)));
+
+            QJsonRpcUdpServerPrivate::Peer peer;
+            peer.socket = socket;
+            peer.client = d->responsesEnabled;
+            socket->d_func()->muted = !peer.client;
+            it = d->peers.insert(key, peer);
+            if (peer.client) {
+                {
+                    QMutexLocker locker(&d->clientsMutex);
+                    d->clients.insert(socket);
+                }
+                Q_EMIT clientConnected();
+            }
+        }
+
+        it.value().lastSeen.start();
+        it.value().socket->d_func()->processDatagram(datagram);
+    }
+}
+
+void QJsonRpcUdpServer::_q_expirePeers()
+{
+    Q_D(QJsonRpcUdpServer);
+    QList<QByteArray> expired;
+    QHash<QByteArray, QJsonRpcUdpServerPrivate::Peer>::const_iterator it;
+    for (it = d->peers.constBegin(); it != d->peers.constEnd(); ++it) {
+        if (it.value().lastSeen.elapsed() >= d->peerTimeout)
+            expired.append(it.key());
+    }
+
+    foreach (const QByteArray &key, expired) {
+        bool client = false;
+        d->takePeer(key, &client)->deleteLater();
+        if (client)
+            Q_EMIT clientDisconnected();
+    }
+}
+
+void QJsonRpcUdpServer::_q_processMessage(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcUdpServer);
+    QJsonRpcSocket *socket = static_cast<QJsonRpcSocket*>(sender());
+    if (!socket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called without service socket";
+        return;
+    }
+
+    // a peer that isn't a client may have been spoofed, nothing is done
+    // for it that would be answered or sent to it later
+    const QJsonRpcUdpSocket *peer = static_cast<QJsonRpcUdpSocket*>(socket);
+    if (peer->d_func()->muted) {
+        const QString method = message.method();
+        if (message.type() != QJsonRpcMessage::Notification ||
+            method == QLatin1String("rpc.subscribe") || method == QLatin1String("rpc.unsubscribe")) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "dropping" << method << "while responses are disabled";
+            return;
+        }
+    }
+
+    if (d->processSubscription(socket, message))
+        return;
+    processMessage(socket, message);
+}
+
+void QJsonRpcUdpServer::_q_bytesWritten()
+{
+    Q_D(QJsonRpcUdpServer);
+    if (d->highWaterMark < 0)
+        return;
+
+    QHash<QByteArray, QJsonRpcUdpServerPrivate::Peer>::const_iterator it;
+    for (it = d->peers.constBegin(); it != d->peers.constEnd(); ++it) {
+        if (it.value().client)
+            it.value().socket->d_func()->_q_bytesWritten();
+    }
+}
+
+void QJsonRpcUdpServer::notifyConnectedClients(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcUdpServer);
+    d->_q_notifyConnectedClients(message);
+}
+
+void QJsonRpcUdpServer::notifyConnectedClients(const QString &method, const QJsonArray &params)
+{
+    Q_D(QJsonRpcUdpServer);
+    d->_q_notifyConnectedClients(method, params);
+}
+
+void QJsonRpcUdpServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcUdpServer);
+    d->_q_notifySubscribers(topic, message);
+}
+
+bool QJsonRpcUdpServer::subscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcUdpServer);
+    return d->subscribe(client, topic);
+}
+
+bool QJsonRpcUdpServer::unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcUdpServer);
+    return d->unsubscribe(client, topic);
+}
+
+int QJsonRpcUdpServer::subscriberCount(const QString &topic) const
+{
+    Q_D(const QJsonRpcUdpServer);
+    return d->subscriberCount(topic);
+}
+
+#include "moc_qjsonrpcudpserver.cpp"
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCUDPSERVER_H
+#define QJSONRPCUDPSERVER_H
+
+#include <QObject>
+#include <QHostAddress>
+#include "qjsonrpcabstractserver.h"
+
+// Serves JSON-RPC over UDP, each datagram carrying a single message or a
+// batch, see QJsonRpcUdpSocket. Every address and port datagrams arrive
+// from is a peer, dropped after peerTimeout() without any. Sender addresses
+// are easily spoofed, so by default the server only takes notifications;
+// with setResponsesEnabled() peers become clients, announced with their
+// first datagram, that requests are answered to and notifyConnectedClients()
+// goes to.
+class QJsonRpcUdpServerPrivate;
+class QJSONRPC_EXPORT QJsonRpcUdpServer : public QObject, public QJsonRpcAbstractServer
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcUdpServer(QObject *parent = 0);
+    ~QJsonRpcUdpServer();
+
+    bool listen(const QHostAddress &address = QHostAddress::Any, quint16 port = 0);
+    bool isListening() const;
+    void close();
+    QHostAddress serverAddress() const;
+    quint16 serverPort() const;
+    QString errorString() const;
+
+    virtual int connectedClientCount() const;
+    virtual bool subscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual bool unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual int subscriberCount(const QString &topic) const;
+
+    // applies to clients seen after the call
+    QJsonRpcCodec *codec() const;
+    void setCodec(QJsonRpcCodec *codec);
+
+    // datagrams received larger than this are dropped, and so are
+    // responses that would be. 65507 bytes by default
+    int maximumDatagramSize() const;
+    void setMaximumDatagramSize(int bytes);
+    int rejectedDatagramCount() const;
+
+    // 60 seconds by default, 0 keeps clients until the server is closed
+    int peerTimeout() const;
+    void setPeerTimeout(int msecs);
+
+    // datagrams from new addresses are dropped, and counted as rejected,
+    // while this many clients are known. 1024 by default
+    int maximumPeerCount() const;
+    void setMaximumPeerCount(int count);
+
+    // requests and subscriptions are dropped, and peers are sent nothing,
+    // unless enabled. Off by default, applies to peers seen after the call
+    bool responsesEnabled() const;
+    void setResponsesEnabled(bool enabled);
+
+    // reimp
+    bool addService(QJsonRpcService *service);
+    bool removeService(QJsonRpcService *service);
+
+Q_SIGNALS:
+    void clientConnected();
+    void clientDisconnected();
+
+public Q_SLOTS:
+    void notifyConnectedClients(const QJsonRpcMessage &message);
+    void notifyConnectedClients(const QString &method, const QJsonArray &params);
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
+
+private Q_SLOTS:
+    void _q_readDatagrams();
+    void _q_expirePeers();
+    void _q_bytesWritten();
+    void _q_processMessage(const QJsonRpcMessage &message);
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcUdpServer)
+    Q_DISABLE_COPY(QJsonRpcUdpServer)
+#if !defined(USE_QT_PRIVATE_HEADERS)
+    QScopedPointer<QJsonRpcUdpServerPrivate> d_ptr;
+#endif
+};
+
+#endif
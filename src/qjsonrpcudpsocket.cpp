@@ -0,0 +1,181 @@
+#include <QUdpSocket>
+
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpccodec.h"
+#include "qjsonrpcudpsocket_p.h"
+#include "qjsonrpcudpsocket.h"
+
+QJsonRpcUdpSocketPrivate::QJsonRpcUdpSocketPrivate(QUdpSocket *socket, const QHostAddress &address,
+                                                   quint16 port, QJsonRpcUdpSocket *q)
+    : QJsonRpcSocketPrivate(q),
+      udpSocket(socket),
+      address(address),
+      port(port),
+      maximumDatagramSize(DefaultMaximumDatagramSize),
+      rejectedDatagrams(0),
+      muted(false)
+{
+    this->device = socket;
+    messageFraming = true;
+}
+
+bool QJsonRpcUdpSocketPrivate::isPeer(const QHostAddress &sender, quint16 senderPort) const
+{
+    if (senderPort != port)
+        return false;
+
+    // sockets bound to both protocols see IPv4 peers as mapped addresses
+#if QT_VERSION >= QT_VERSION_CHECK(5,8,0)
+    return sender.isEqual(address, QHostAddress::TolerantConversion);
+#else
+    const QString text = sender.toString();
+    if (text.startsWith(QLatin1String("::ffff:")))
+        return QHostAddress(text.mid(7)) == address;
+    return sender == address;
+#endif
+}
+
+void QJsonRpcUdpSocketPrivate::_q_processIncomingData()
+{
+    if (!udpSocket)
+        return;
+
+    while (!readPaused && udpSocket->hasPendingDatagrams()) {
+        const qint64 size = udpSocket->pendingDatagramSize();
+        if (size > maximumDatagramSize) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "dropping datagram of" << size << "bytes";
+            udpSocket->readDatagram(0, 0);
+            rejectedDatagrams++;
+            continue;
+        }
+
+        QByteArray datagram;
+        datagram.resize(int(qMax(size, qint64(0))));
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        const qint64 read = udpSocket->readDatagram(datagram.data(), datagram.size(),
+                                                    &sender, &senderPort);
+        if (read < 0 || !isPeer(sender, senderPort))
+            continue;
+
+        datagram.resize(int(read));
+        processDatagram(datagram);
+    }
+}
+
+void QJsonRpcUdpSocketPrivate::processDatagram(const QByteArray &datagram)
+{
+    int start = 0;
+    while (start < datagram.size() && (datagram[start] == ' ' || datagram[start] == '\t' ||
+                                       datagram[start] == '\n' || datagram[start] == '\r'))
+        ++start;
+    if (start == datagram.size())
+        return;
+
+    // there is no header to tell the encoding, text JSON always starts
+    // with one of these
+    const char first = datagram.at(start);
+    if (first == '{' || first == '[') {
+        frameCodec = 0;
+    } else if (codec && codec != QJsonRpcCodec::json()) {
+        frameCodec = codec;
+    } else {
+        qJsonRpcDebug() << Q_FUNC_INFO << "dropping datagram in an unknown encoding";
+        return;
+    }
+
+    processFrame(datagram.constData(), datagram.size(), QList<QByteArray>());
+}
+
+void QJsonRpcUdpSocketPrivate::writeFrame(const QByteArray &data, const QByteArray &contentType)
+{
+    Q_UNUSED(contentType)
+    Q_Q(QJsonRpcUdpSocket);
+    qJsonRpcDebug() << "sending(" << q << "): " << data;
+    writeRaw(data);
+}
+
+void QJsonRpcUdpSocketPrivate::writeRaw(const QByteArray &data)
+{
+    if (!udpSocket || muted)
+        return;
+
+    if (data.size() > maximumDatagramSize) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "dropping message of" << data.size() << "bytes";
+        rejectedDatagrams++;
+        return;
+    }
+
+    if (udpSocket->writeDatagram(data, address, port) < 0)
+        qJsonRpcDebug() << Q_FUNC_INFO << udpSocket->errorString();
+}
+
+QByteArray QJsonRpcUdpSocketPrivate::encodeFrame(const QJsonRpcMessage &message) const
+{
+    QByteArray data;
+    QByteArray contentType;
+    if (message.attachments().isEmpty())
+        encodeMessage(message, &data, &contentType);
+    else
+        encodeMessage(QJsonRpcMessagePrivate::inlineAttachments(message), &data, &contentType);
+    return data;
+}
+
+QByteArray QJsonRpcUdpSocketPrivate::wireFormat() const
+{
+    QByteArray format = "datagram|";
+    if (QJsonRpcCodec *outgoing = writeCodec())
+        format += outgoing->contentType();
+    if (requestIdsAsStrings)
+        format += "|strings";
+    return format;
+}
+
+QJsonRpcUdpSocket::QJsonRpcUdpSocket(QUdpSocket *socket, const QHostAddress &address, quint16 port,
+                                     QObject *parent)
+    : QJsonRpcSocket(*new QJsonRpcUdpSocketPrivate(socket, address, port, this), parent)
+{
+    if (socket->state() == QAbstractSocket::UnconnectedState && !socket->bind())
+        qJsonRpcDebug() << Q_FUNC_INFO << "unable to bind:" << socket->errorString();
+}
+
+QJsonRpcUdpSocket::~QJsonRpcUdpSocket()
+{
+}
+
+QHostAddress QJsonRpcUdpSocket::peerAddress() const
+{
+    Q_D(const QJsonRpcUdpSocket);
+    return d->address;
+}
+
+quint16 QJsonRpcUdpSocket::peerPort() const
+{
+    Q_D(const QJsonRpcUdpSocket);
+    return d->port;
+}
+
+int QJsonRpcUdpSocket::maximumDatagramSize() const
+{
+    Q_D(const QJsonRpcUdpSocket);
+    return d->maximumDatagramSize;
+}
+
+void QJsonRpcUdpSocket::setMaximumDatagramSize(int bytes)
+{
+    Q_D(QJsonRpcUdpSocket);
+    if (bytes <= 0 || bytes > QJsonRpcUdpSocketPrivate::DefaultMaximumDatagramSize) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid datagram size" << bytes;
+        return;
+    }
+
+    d->maximumDatagramSize = bytes;
+}
+
+int QJsonRpcUdpSocket::rejectedDatagramCount() const
+{
+    Q_D(const QJsonRpcUdpSocket);
+    return d->rejectedDatagrams;
+}
+
+#include "moc_qjsonrpcudpsocket.cpp"
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCUDPSOCKET_H
+#define QJSONRPCUDPSOCKET_H
+
+#include <QHostAddress>
+
+#include "qjsonrpcsocket.h"
+
+// Exchanges messages with a peer over UDP, each datagram carrying a single
+// message or a batch, and suits notifications sent at a high rate that don't
+// need to arrive in order, or at all. Requests may be sent as well, their
+// replies time out after defaultRequestTimeout like those of the other
+// sockets when either datagram is lost.
+//
+// Datagrams are never split: messages encoding to more than
+// maximumDatagramSize() are dropped rather than sent, and so are larger
+// datagrams received. Attachments are always inlined.
+//
+//     QJsonRpcUdpSocket *client =
+//         new QJsonRpcUdpSocket(new QUdpSocket, QHostAddress::LocalHost, 5555);
+//     client->notify(QJsonRpcMessage::createNotification("telemetry.sample", params));
+class QUdpSocket;
+class QJsonRpcUdpSocketPrivate;
+class QJSONRPC_EXPORT QJsonRpcUdpSocket : public QJsonRpcSocket
+{
+    Q_OBJECT
+public:
+    // sends to the peer at address and port, reading what it sends back
+    // on socket, which is bound to any port if it isn't already
+    QJsonRpcUdpSocket(QUdpSocket *socket, const QHostAddress &address, quint16 port,
+                      QObject *parent = 0);
+    ~QJsonRpcUdpSocket();
+
+    QHostAddress peerAddress() const;
+    quint16 peerPort() const;
+
+    // 65507 bytes by default, the most an IPv4 datagram carries; a smaller
+    // size keeps datagrams from being fragmented on the way
+    int maximumDatagramSize() const;
+    void setMaximumDatagramSize(int bytes);
+
+    // datagrams dropped for their size, sent and received
+    int rejectedDatagramCount() const;
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcUdpSocket)
+    Q_DISABLE_COPY(QJsonRpcUdpSocket)
+    friend class QJsonRpcUdpServer;
+};
+
+#endif
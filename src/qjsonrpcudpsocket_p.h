@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCUDPSOCKET_P_H
+#define QJSONRPCUDPSOCKET_P_H
+
+#include <QHostAddress>
+#include <QUdpSocket>
+
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpcudpsocket.h"
+
+class QJSONRPC_EXPORT QJsonRpcUdpSocketPrivate : public QJsonRpcSocketPrivate
+{
+public:
+    QJsonRpcUdpSocketPrivate(QUdpSocket *socket, const QHostAddress &address, quint16 port,
+                             QJsonRpcUdpSocket *q);
+
+    enum { DefaultMaximumDatagramSize = 65507 };
+
+    // slots
+    virtual void _q_processIncomingData();
+
+    // reimp
+    virtual void writeFrame(const QByteArray &data, const QByteArray &contentType = QByteArray());
+    virtual void writeRaw(const QByteArray &data);
+    virtual QByteArray encodeFrame(const QJsonRpcMessage &message) const;
+    virtual QByteArray wireFormat() const;
+
+    // a datagram from the peer, text JSON or in the encoding of codec
+    void processDatagram(const QByteArray &datagram);
+    bool isPeer(const QHostAddress &address, quint16 port) const;
+
+    QPointer<QUdpSocket> udpSocket;
+    QHostAddress address;
+    quint16 port;
+    int maximumDatagramSize;
+    int rejectedDatagrams;
+    // a server's peer that responses are disabled for, nothing is sent
+    bool muted;
+
+    Q_DECLARE_PUBLIC(QJsonRpcUdpSocket)
+};
+
+#endif
@@ -0,0 +1,625 @@
+#include <QAbstractSocket>
+#include <QSslSocket>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QList>
+#if QT_VERSION >= 0x050a00
+#include <QRandomGenerator>
+#endif
+
+#include "qjsonrpccodec.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpccompression_p.h"
+#include "qjsonrpcwebsocket_p.h"
+#include "qjsonrpcwebsocket.h"
+
+// the extension offered and accepted, messages are always compressed on
+// their own, so never rely on an earlier one
+static const char deflateExtension[] =
+    "permessage-deflate; server_no_context_takeover; client_no_context_takeover";
+
+static QByteArray randomBytes(int size)
+{
+    QByteArray bytes(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+#if QT_VERSION >= 0x050a00
+        bytes[i] = char(QRandomGenerator::global()->generate() & 0xff);
+#else
+        bytes[i] = char(qrand() & 0xff);
+#endif
+    }
+    return bytes;
+}
+
+static inline void applyMask(char *data, int size, const uchar *mask)
+{
+    for (int i = 0; i < size; ++i)
+        data[i] ^= mask[i & 3];
+}
+
+// the start line and headers of a handshake, with lower case names; values
+// of repeated headers are joined as a list
+static bool parseHandshake(const QByteArray &data, QList<QByteArray> *startLine,
+                           QHash<QByteArray, QByteArray> *headers)
+{
+    const QList<QByteArray> lines = data.split('\n');
+    *startLine = lines.first().trimmed().split(' ');
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines.at(i).indexOf(':');
+        if (colon == -1)
+            return false;
+
+        const QByteArray name = lines.at(i).left(colon).trimmed().toLower();
+        const QByteArray value = lines.at(i).mid(colon + 1).trimmed();
+        QHash<QByteArray, QByteArray>::iterator it = headers->find(name);
+        if (it == headers->end())
+            headers->insert(name, value);
+        else
+            it.value() += ", " + value;
+    }
+
+    return true;
+}
+
+static bool hasToken(const QByteArray &value, const char *token)
+{
+    foreach (const QByteArray &entry, value.split(',')) {
+        if (entry.trimmed().toLower() == token)
+            return true;
+    }
+    return false;
+}
+
+// the parameters of one entry of Sec-WebSocket-Extensions, false if it is
+// another extension
+static bool parseDeflateExtension(const QByteArray &extension,
+                                  QHash<QByteArray, QByteArray> *parameters)
+{
+    QList<QByteArray> entries = extension.split(';');
+    if (entries.takeFirst().trimmed().toLower() != "permessage-deflate")
+        return false;
+
+    foreach (const QByteArray &entry, entries) {
+        const int equals = entry.indexOf('=');
+        QByteArray value = equals == -1 ? QByteArray() : entry.mid(equals + 1).trimmed();
+        if (value.size() >= 2 && value.startsWith('"') && value.endsWith('"'))
+            value = value.mid(1, value.size() - 2);
+        parameters->insert(entry.left(equals).trimmed().toLower(), value);
+    }
+    return true;
+}
+
+QJsonRpcWebSocketPrivate::QJsonRpcWebSocketPrivate(QIODevice *device, const QUrl &url,
+                                                   bool client, QJsonRpcWebSocket *q)
+    : QJsonRpcSocketPrivate(q),
+      client(client),
+      url(url),
+      state(Connecting),
+      compressionNegotiated(false),
+      messageOpcode(ContinuationFrame),
+      messageCompressed(false),
+      closedEmitted(false)
+{
+    this->device = device;
+    messageFraming = true;
+}
+
+QByteArray QJsonRpcWebSocketPrivate::acceptKey(const QByteArray &key)
+{
+    return QCryptographicHash::hash(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11",
+                                    QCryptographicHash::Sha1).toBase64();
+}
+
+void QJsonRpcWebSocketPrivate::_q_sendHandshake()
+{
+    if (!device || state != Connecting || !key.isEmpty())
+        return;
+
+    key = randomBytes(16).toBase64();
+#if QT_VERSION >= 0x050000
+    resourceName = url.path(QUrl::FullyEncoded).toLatin1();
+    if (url.hasQuery())
+        resourceName += '?' + url.query(QUrl::FullyEncoded).toLatin1();
+#else
+    resourceName = url.encodedPath();
+    if (url.hasQuery())
+        resourceName += '?' + url.encodedQuery();
+#endif
+    if (resourceName.isEmpty() || resourceName.startsWith('?'))
+        resourceName.prepend('/');
+
+    QByteArray host = url.host().toLatin1();
+    if (url.port() != -1)
+        host += ':' + QByteArray::number(url.port());
+
+    QByteArray request;
+    request.reserve(256);
+    request += "GET " + resourceName + " HTTP/1.1\r\n";
+    request += "Host: " + host + "\r\n";
+    request += "Upgrade: websocket\r\n";
+    request += "Connection: Upgrade\r\n";
+    request += "Sec-WebSocket-Key: " + key + "\r\n";
+    request += "Sec-WebSocket-Version: 13\r\n";
+    request += "Sec-WebSocket-Extensions: " + QByteArray(deflateExtension) + "\r\n";
+    request += "\r\n";
+    device.data()->write(request);
+}
+
+bool QJsonRpcWebSocketPrivate::processServerHandshake()
+{
+    const int headerEnd = buffer.indexOf("\r\n\r\n", bufferOffset);
+    if (headerEnd == -1) {
+        if (buffer.size() - bufferOffset > MaximumHandshakeSize)
+            fail(ProtocolError);
+        return false;
+    }
+
+    QList<QByteArray> requestLine;
+    QHash<QByteArray, QByteArray> headers;
+    const bool parsed =
+        parseHandshake(buffer.mid(bufferOffset, headerEnd - bufferOffset), &requestLine, &headers);
+    bufferOffset = headerEnd + 4;
+
+    key = headers.value("sec-websocket-key");
+    if (!parsed || requestLine.size() != 3 || requestLine.at(0) != "GET" ||
+        requestLine.at(2) != "HTTP/1.1" ||
+        headers.value("upgrade").toLower() != "websocket" ||
+        !hasToken(headers.value("connection"), "upgrade") ||
+        headers.value("sec-websocket-version") != "13" ||
+        QByteArray::fromBase64(key).size() != 16) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "invalid opening handshake";
+        device.data()->write("HTTP/1.1 400 Bad Request\r\n"
+                             "Sec-WebSocket-Version: 13\r\n"
+                             "Content-Length: 0\r\n"
+                             "Connection: close\r\n\r\n");
+        state = Closed;
+        closeDevice();
+        return false;
+    }
+
+    resourceName = requestLine.at(1);
+
+    // the first offer that can be taken as it is: inflating copes with
+    // any window, compressing only uses the largest
+    foreach (const QByteArray &offer, headers.value("sec-websocket-extensions").split(',')) {
+        QHash<QByteArray, QByteArray> parameters;
+        if (!parseDeflateExtension(offer, &parameters))
+            continue;
+
+        bool acceptable = true;
+        QHash<QByteArray, QByteArray>::const_iterator it;
+        for (it = parameters.constBegin(); it != parameters.constEnd() && acceptable; ++it) {
+            if (it.key() == "server_max_window_bits")
+                acceptable = (it.value() == "15");
+            else
+                acceptable = (it.key() == "server_no_context_takeover" ||
+                              it.key() == "client_no_context_takeover" ||
+                              it.key() == "client_max_window_bits");
+        }
+
+        if (acceptable) {
+            compressionNegotiated = true;
+            break;
+        }
+    }
+
+    QByteArray response;
+    response.reserve(256);
+    response += "HTTP/1.1 101 Switching Protocols\r\n";
+    response += "Upgrade: websocket\r\n";
+    response += "Connection: Upgrade\r\n";
+    response += "Sec-WebSocket-Accept: " + acceptKey(key) + "\r\n";
+    if (compressionNegotiated)
+        response += "Sec-WebSocket-Extensions: " + QByteArray(deflateExtension) + "\r\n";
+    response += "\r\n";
+    device.data()->write(response);
+
+    finishHandshake();
+    return true;
+}
+
+bool QJsonRpcWebSocketPrivate::processClientHandshake()
+{
+    const int headerEnd = buffer.indexOf("\r\n\r\n", bufferOffset);
+    if (headerEnd == -1) {
+        if (buffer.size() - bufferOffset > MaximumHandshakeSize)
+            fail(ProtocolError);
+        return false;
+    }
+
+    QList<QByteArray> statusLine;
+    QHash<QByteArray, QByteArray> headers;
+    bool valid =
+        parseHandshake(buffer.mid(bufferOffset, headerEnd - bufferOffset), &statusLine, &headers);
+    bufferOffset = headerEnd + 4;
+
+    valid = valid && statusLine.size() >= 2 && statusLine.at(0).startsWith("HTTP/1.") &&
+            statusLine.at(1) == "101" &&
+            headers.value("upgrade").toLower() == "websocket" &&
+            hasToken(headers.value("connection"), "upgrade") &&
+            headers.value("sec-websocket-accept") == acceptKey(key);
+
+    // the server may only accept what was offered, messages it compresses
+    // have to stand on their own
+    const QByteArray extensions = headers.value("sec-websocket-extensions");
+    if (valid && !extensions.isEmpty()) {
+        QHash<QByteArray, QByteArray> parameters;
+        valid = !extensions.contains(',') && parseDeflateExtension(extensions, &parameters) &&
+                parameters.contains("server_no_context_takeover");
+
+        QHash<QByteArray, QByteArray>::const_iterator it;
+        for (it = parameters.constBegin(); it != parameters.constEnd() && valid; ++it) {
+            if (it.key() == "client_max_window_bits")
+                valid = (it.value().isEmpty() || it.value() == "15");
+            else
+                valid = (it.key() == "server_no_context_takeover" ||
+                         it.key() == "client_no_context_takeover" ||
+                         it.key() == "server_max_window_bits");
+        }
+        compressionNegotiated = valid;
+    }
+
+    if (!valid) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "opening handshake failed";
+        state = Closed;
+        closeDevice();
+        return false;
+    }
+
+    finishHandshake();
+    return true;
+}
+
+void QJsonRpcWebSocketPrivate::finishHandshake()
+{
+    Q_Q(QJsonRpcWebSocket);
+    state = Open;
+    if (!pendingFrames.isEmpty()) {
+        writeRaw(pendingFrames);
+        pendingFrames.clear();
+    }
+
+    Q_EMIT q->opened();
+}
+
+void QJsonRpcWebSocketPrivate::_q_processIncomingData()
+{
+    if (!device) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called without device";
+        return;
+    }
+
+    if (readPaused)
+        return;
+
+    compactBuffer();
+    buffer.append(device.data()->readAll());
+    if (state == Connecting) {
+        const bool opened = client ? processClientHandshake() : processServerHandshake();
+        if (!opened)
+            return;
+    }
+
+    while ((state == Open || state == Closing) && !readPaused && processNextFrame()) {
+    }
+}
+
+bool QJsonRpcWebSocketPrivate::processNextFrame()
+{
+    const int available = buffer.size() - bufferOffset;
+    if (available < 2)
+        return false;
+
+    const uchar *header = reinterpret_cast<const uchar*>(buffer.constData()) + bufferOffset;
+    const bool final = (header[0] & 0x80);
+    const bool compressed = (header[0] & 0x40);
+    const Opcode opcode = Opcode(header[0] & 0x0f);
+    const bool masked = (header[1] & 0x80);
+    const bool control = (opcode & 0x08);
+
+    quint64 length = header[1] & 0x7f;
+    int headerSize = 2;
+    if (length == 126) {
+        if (available < 4)
+            return false;
+        length = (quint64(header[2]) << 8) | header[3];
+        headerSize = 4;
+    } else if (length == 127) {
+        if (available < 10)
+            return false;
+        length = 0;
+        for (int i = 2; i < 10; ++i)
+            length = (length << 8) | header[i];
+        headerSize = 10;
+    }
+
+    // clients mask every frame and servers none; RSV1 marks the first
+    // frame of a compressed message, the other bits are unused
+    bool valid = !(header[0] & 0x30) && masked != client;
+    if (control) {
+        valid = valid && final && !compressed && length <= 125 &&
+                (opcode == CloseFrame || opcode == PingFrame || opcode == PongFrame);
+    } else if (opcode == ContinuationFrame) {
+        valid = valid && !compressed && messageOpcode != ContinuationFrame;
+    } else {
+        valid = valid && (opcode == TextFrame || opcode == BinaryFrame) &&
+                messageOpcode == ContinuationFrame && (!compressed || compressionNegotiated);
+    }
+
+    if (!valid) {
+        fail(ProtocolError);
+        return false;
+    }
+
+    if (!control && length > quint64(MaximumMessageSize - messageData.size())) {
+        fail(MessageTooBig);
+        return false;
+    }
+
+    const int maskOffset = headerSize;
+    if (masked)
+        headerSize += 4;
+    if (available < headerSize || quint64(available - headerSize) < length)
+        return false;
+
+    const int size = int(length);
+    const char *payload = buffer.constData() + bufferOffset + headerSize;
+    const uchar mask[4] = { header[maskOffset], header[maskOffset + 1],
+                            header[maskOffset + 2], header[maskOffset + 3] };
+    bufferOffset += headerSize + size;
+
+    if (control) {
+        QByteArray data(payload, size);
+        if (masked)
+            applyMask(data.data(), size, mask);
+
+        if (opcode == PingFrame) {
+            if (state == Open)
+                writeControlFrame(PongFrame, data);
+        } else if (opcode == CloseFrame) {
+            // answered with the same status code, unless it was the answer
+            if (state == Open)
+                writeControlFrame(CloseFrame, data.left(2));
+            state = Closed;
+            closeDevice();
+            return false;
+        }
+        return true;
+    }
+
+    if (opcode != ContinuationFrame) {
+        messageOpcode = opcode;
+        messageCompressed = compressed;
+    }
+
+    // unmasked in place, fragments are gathered the same way
+    const int start = messageData.size();
+    messageData.append(payload, size);
+    if (masked)
+        applyMask(messageData.data() + start, size, mask);
+    if (!final)
+        return true;
+
+    QByteArray data;
+    data.swap(messageData);
+    const Opcode dataOpcode = messageOpcode;
+    messageOpcode = ContinuationFrame;
+    processMessage(dataOpcode, data, messageCompressed);
+    return state == Open || state == Closing;
+}
+
+void QJsonRpcWebSocketPrivate::processMessage(Opcode opcode, const QByteArray &payload,
+                                              bool compressed)
+{
+    QByteArray inflated;
+    const QByteArray *data = &payload;
+    if (compressed) {
+        bool sizeExceeded = false;
+        if (!QJsonRpcCompression::inflateMessage(payload, &inflated, MaximumMessageSize,
+                                                 &sizeExceeded)) {
+            qJsonRpcDebug() << Q_FUNC_INFO << "unable to decompress message";
+            fail(sizeExceeded ? MessageTooBig : InvalidData);
+            return;
+        }
+        data = &inflated;
+    }
+
+    // binary messages are in the encoding of codec(), text JSON without one
+    frameCodec = 0;
+    if (opcode == BinaryFrame && codec != QJsonRpcCodec::json())
+        frameCodec = codec;
+    processFrame(data->constData(), data->size(), QList<QByteArray>());
+}
+
+QByteArray QJsonRpcWebSocketPrivate::buildFrame(const QByteArray &payload, Opcode opcode) const
+{
+    QByteArray compressed;
+    const QByteArray *body = &payload;
+    if (compressionNegotiated && !(opcode & 0x08) && compressionThreshold >= 0 &&
+        payload.size() >= compressionThreshold) {
+        compressed = QJsonRpcCompression::deflateMessage(payload);
+        body = &compressed;
+    }
+
+    const int size = body->size();
+    const char maskBit = client ? char(0x80) : char(0);
+    QByteArray frame;
+    frame.reserve(size + 14);
+    frame.append(char(0x80 | (body == &compressed ? 0x40 : 0) | opcode));
+    if (size < 126) {
+        frame.append(char(maskBit | size));
+    } else if (size <= 0xffff) {
+        frame.append(char(maskBit | 126));
+        frame.append(char(size >> 8));
+        frame.append(char(size));
+    } else {
+        frame.append(char(maskBit | 127));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            frame.append(char(quint64(size) >> shift));
+    }
+
+    if (!client) {
+        frame.append(*body);
+        return frame;
+    }
+
+    const QByteArray mask = randomBytes(4);
+    frame.append(mask);
+    const int start = frame.size();
+    frame.append(*body);
+    applyMask(frame.data() + start, size, reinterpret_cast<const uchar*>(mask.constData()));
+    return frame;
+}
+
+void QJsonRpcWebSocketPrivate::writeFrame(const QByteArray &data, const QByteArray &contentType)
+{
+    Q_Q(QJsonRpcWebSocket);
+    qJsonRpcDebug() << "sending(" << q << "): " << data;
+
+    const QByteArray frame = buildFrame(data, contentType.isEmpty() ? TextFrame : BinaryFrame);
+    if (state == Connecting)
+        pendingFrames.append(frame);
+    else if (state == Open)
+        writeRaw(frame);
+    else
+        qJsonRpcDebug() << Q_FUNC_INFO << "trying to send message on a closed connection";
+}
+
+QByteArray QJsonRpcWebSocketPrivate::encodeFrame(const QJsonRpcMessage &message) const
+{
+    QByteArray data;
+    QByteArray contentType;
+    if (message.attachments().isEmpty())
+        encodeMessage(message, &data, &contentType);
+    else
+        encodeMessage(QJsonRpcMessagePrivate::inlineAttachments(message), &data, &contentType);
+    return buildFrame(data, contentType.isEmpty() ? TextFrame : BinaryFrame);
+}
+
+QByteArray QJsonRpcWebSocketPrivate::wireFormat() const
+{
+    QByteArray format = "websocket|" + QJsonRpcSocketPrivate::wireFormat();
+    if (compressionNegotiated)
+        format += "|deflate";
+    if (client)
+        format += "|masked";
+    return format;
+}
+
+void QJsonRpcWebSocketPrivate::writeControlFrame(Opcode opcode, const QByteArray &payload)
+{
+    writeRaw(buildFrame(payload, opcode));
+    _q_flushWriteBuffer();
+}
+
+void QJsonRpcWebSocketPrivate::sendClose(int code)
+{
+    QByteArray payload;
+    payload.append(char(code >> 8));
+    payload.append(char(code));
+    writeControlFrame(CloseFrame, payload);
+    state = Closing;
+}
+
+void QJsonRpcWebSocketPrivate::fail(int code)
+{
+    qJsonRpcDebug() << Q_FUNC_INFO << "closing connection with status" << code;
+    if (state == Open)
+        sendClose(code);
+    state = Closed;
+    messageData.clear();
+    closeDevice();
+}
+
+void QJsonRpcWebSocketPrivate::closeDevice()
+{
+    if (!device)
+        return;
+
+    _q_flushWriteBuffer();
+    if (QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device.data()))
+        socket->disconnectFromHost();
+    else
+        device.data()->close();
+}
+
+void QJsonRpcWebSocketPrivate::_q_deviceClosed()
+{
+    Q_Q(QJsonRpcWebSocket);
+    state = Closed;
+    if (closedEmitted)
+        return;
+
+    closedEmitted = true;
+    Q_EMIT q->closed();
+}
+
+QJsonRpcWebSocket::QJsonRpcWebSocket(QIODevice *device, const QUrl &url, QObject *parent)
+    : QJsonRpcSocket(*new QJsonRpcWebSocketPrivate(device, url, true, this), parent)
+{
+    Q_D(QJsonRpcWebSocket);
+    QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device);
+    if (socket)
+        connect(socket, SIGNAL(disconnected()), this, SLOT(_q_deviceClosed()));
+    else
+        connect(device, SIGNAL(aboutToClose()), this, SLOT(_q_deviceClosed()));
+
+    // over TLS the handshake waits for the connection to be encrypted
+    QSslSocket *sslSocket = qobject_cast<QSslSocket*>(device);
+    if (sslSocket && url.scheme() == QLatin1String("wss") && !sslSocket->isEncrypted())
+        connect(sslSocket, SIGNAL(encrypted()), this, SLOT(_q_sendHandshake()));
+    else if (socket && socket->state() != QAbstractSocket::ConnectedState)
+        connect(socket, SIGNAL(connected()), this, SLOT(_q_sendHandshake()));
+    else
+        d->_q_sendHandshake();
+}
+
+QJsonRpcWebSocket::QJsonRpcWebSocket(QIODevice *device, QObject *parent)
+    : QJsonRpcSocket(*new QJsonRpcWebSocketPrivate(device, QUrl(), false, this), parent)
+{
+    if (QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device))
+        connect(socket, SIGNAL(disconnected()), this, SLOT(_q_deviceClosed()));
+    else
+        connect(device, SIGNAL(aboutToClose()), this, SLOT(_q_deviceClosed()));
+}
+
+QJsonRpcWebSocket::~QJsonRpcWebSocket()
+{
+}
+
+bool QJsonRpcWebSocket::isValid() const
+{
+    Q_D(const QJsonRpcWebSocket);
+    return QJsonRpcSocket::isValid() && d->state != QJsonRpcWebSocketPrivate::Closed;
+}
+
+bool QJsonRpcWebSocket::isOpen() const
+{
+    Q_D(const QJsonRpcWebSocket);
+    return d->state == QJsonRpcWebSocketPrivate::Open;
+}
+
+bool QJsonRpcWebSocket::isCompressionNegotiated() const
+{
+    Q_D(const QJsonRpcWebSocket);
+    return d->compressionNegotiated;
+}
+
+QByteArray QJsonRpcWebSocket::resourceName() const
+{
+    Q_D(const QJsonRpcWebSocket);
+    return d->resourceName;
+}
+
+void QJsonRpcWebSocket::close(int code)
+{
+    Q_D(QJsonRpcWebSocket);
+    if (d->state == QJsonRpcWebSocketPrivate::Open) {
+        d->sendClose(code);
+    } else if (d->state == QJsonRpcWebSocketPrivate::Connecting) {
+        d->state = QJsonRpcWebSocketPrivate::Closed;
+        d->closeDevice();
+    }
+}
+
+#include "moc_qjsonrpcwebsocket.cpp"
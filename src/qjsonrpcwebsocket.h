@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCWEBSOCKET_H
+#define QJSONRPCWEBSOCKET_H
+
+#include <QUrl>
+
+#include "qjsonrpcsocket.h"
+
+// A JSON-RPC connection over WebSocket (RFC 6455), e.g. to and from
+// browsers. Each message carries one frame: a message or a batch, as text
+// when written in text JSON and as binary data when written with codec(),
+// which binary messages are decoded with too. The framing mode doesn't
+// apply and attachments are inlined.
+//
+// permessage-deflate (RFC 7692) is negotiated without context takeover,
+// messages of at least compressionThreshold() bytes are then compressed.
+//
+// Messages written before the opening handshake completed are sent once it
+// has; a failed handshake closes the device.
+class QJsonRpcWebSocketPrivate;
+class QJSONRPC_EXPORT QJsonRpcWebSocket : public QJsonRpcSocket
+{
+    Q_OBJECT
+public:
+    // the client end of a connection to url, the opening handshake is sent
+    // once device is connected
+    QJsonRpcWebSocket(QIODevice *device, const QUrl &url, QObject *parent = 0);
+
+    // the server end, answering the opening handshake of the client
+    explicit QJsonRpcWebSocket(QIODevice *device, QObject *parent = 0);
+    ~QJsonRpcWebSocket();
+
+    virtual bool isValid() const;
+
+    // the opening handshake completed and no close frame was sent since
+    bool isOpen() const;
+
+    // whether permessage-deflate was negotiated
+    bool isCompressionNegotiated() const;
+
+    // the request target sent by the client, e.g. "/rpc"
+    QByteArray resourceName() const;
+
+public Q_SLOTS:
+    // sends a close frame, the device is closed once the peer answered it
+    void close(int code = 1000);
+
+Q_SIGNALS:
+    void opened();
+    void closed();
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcWebSocket)
+    Q_DISABLE_COPY(QJsonRpcWebSocket)
+    Q_PRIVATE_SLOT(d_func(), void _q_sendHandshake())
+    Q_PRIVATE_SLOT(d_func(), void _q_deviceClosed())
+
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCWEBSOCKET_P_H
+#define QJSONRPCWEBSOCKET_P_H
+
+#include <QUrl>
+
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpcwebsocket.h"
+
+class QJSONRPC_EXPORT QJsonRpcWebSocketPrivate : public QJsonRpcSocketPrivate
+{
+public:
+    QJsonRpcWebSocketPrivate(QIODevice *device, const QUrl &url, bool client, QJsonRpcWebSocket *q);
+
+    enum Opcode {
+        ContinuationFrame = 0x0,
+        TextFrame = 0x1,
+        BinaryFrame = 0x2,
+        CloseFrame = 0x8,
+        PingFrame = 0x9,
+        PongFrame = 0xa
+    };
+
+    enum State {
+        Connecting,     // waiting for the opening handshake
+        Open,
+        Closing,        // our close frame was sent
+        Closed
+    };
+
+    // status codes of close frames
+    enum {
+        NormalClosure = 1000,
+        ProtocolError = 1002,
+        InvalidData = 1007,
+        MessageTooBig = 1009
+    };
+
+    // messages are read into memory whole, bounded like this; handshakes
+    // are much smaller
+    enum { MaximumMessageSize = 64 * 1024 * 1024, MaximumHandshakeSize = 16 * 1024 };
+
+    // slots
+    virtual void _q_processIncomingData();
+    void _q_sendHandshake();
+    void _q_deviceClosed();
+
+    // reimp
+    virtual void writeFrame(const QByteArray &data, const QByteArray &contentType = QByteArray());
+    virtual QByteArray encodeFrame(const QJsonRpcMessage &message) const;
+    virtual QByteArray wireFormat() const;
+
+    // Sec-WebSocket-Accept for a Sec-WebSocket-Key
+    static QByteArray acceptKey(const QByteArray &key);
+
+    // a single frame carrying payload, compressed if it is large enough
+    QByteArray buildFrame(const QByteArray &payload, Opcode opcode) const;
+    void writeControlFrame(Opcode opcode, const QByteArray &payload = QByteArray());
+    void sendClose(int code);
+    void fail(int code);
+    void closeDevice();
+
+    // false while the handshake is incomplete or if it failed
+    bool processServerHandshake();
+    bool processClientHandshake();
+    void finishHandshake();
+
+    // reads the frame at bufferOffset, false if it is incomplete or the
+    // connection is closed
+    bool processNextFrame();
+    void processMessage(Opcode opcode, const QByteArray &payload, bool compressed);
+
+    bool client;
+    QUrl url;
+    State state;
+    QByteArray key;             // sent by the client
+    QByteArray resourceName;
+    bool compressionNegotiated;
+
+    // frames written before the handshake completed
+    QByteArray pendingFrames;
+
+    // fragments of the message being read
+    QByteArray messageData;
+    Opcode messageOpcode;       // ContinuationFrame if none is being read
+    bool messageCompressed;
+    bool closedEmitted;
+
+    Q_DECLARE_PUBLIC(QJsonRpcWebSocket)
+};
+
+#endif
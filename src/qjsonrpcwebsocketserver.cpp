@@ -0,0 +1,224 @@
+#include <QTcpSocket>
+
+#include "qjsonrpcwebsocket.h"
+#include "qjsonrpcabstractserver_p.h"
+#include "qjsonrpcwebsocketserver.h"
+
+class QJsonRpcWebSocketServerPrivate : public QJsonRpcAbstractServerPrivate
+{
+public:
+    // every connection, from before its handshake completed
+    QHash<QTcpSocket*, QJsonRpcWebSocket*> socketLookup;
+
+};
+
+QJsonRpcWebSocketServer::QJsonRpcWebSocketServer(QObject *parent)
+#if defined(USE_QT_PRIVATE_HEADERS)
+    : QTcpServer(*new QJsonRpcWebSocketServerPrivate, parent)
+#else
+    : QTcpServer(parent),
+      d_ptr(new QJsonRpcWebSocketServerPrivate)
+#endif
+{
+}
+
+QJsonRpcWebSocketServer::~QJsonRpcWebSocketServer()
+{
+    Q_D(QJsonRpcWebSocketServer);
+    QHash<QTcpSocket*, QJsonRpcWebSocket*>::const_iterator it;
+    for (it = d->socketLookup.constBegin(); it != d->socketLookup.constEnd(); ++it) {
+        it.key()->flush();
+        it.key()->deleteLater();
+        it.value()->deleteLater();
+    }
+    d->socketLookup.clear();
+    d->clients.clear();
+}
+
+int QJsonRpcWebSocketServer::connectedClientCount() const
+{
+    Q_D(const QJsonRpcWebSocketServer);
+    QMutexLocker locker(&d->clientsMutex);
+    return d->clients.size();
+}
+
+int QJsonRpcWebSocketServer::writeCoalescingDelay() const
+{
+    Q_D(const QJsonRpcWebSocketServer);
+    return d->writeCoalescingDelay;
+}
+
+void QJsonRpcWebSocketServer::setWriteCoalescingDelay(int msecs)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    d->writeCoalescingDelay = msecs < 0 ? -1 : msecs;
+}
+
+QJsonRpcCodec *QJsonRpcWebSocketServer::codec() const
+{
+    Q_D(const QJsonRpcWebSocketServer);
+    return d->codec;
+}
+
+void QJsonRpcWebSocketServer::setCodec(QJsonRpcCodec *codec)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    d->codec = codec;
+}
+
+int QJsonRpcWebSocketServer::compressionThreshold() const
+{
+    Q_D(const QJsonRpcWebSocketServer);
+    return d->compressionThreshold;
+}
+
+void QJsonRpcWebSocketServer::setCompressionThreshold(int bytes)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    d->compressionThreshold = bytes < 0 ? -1 : bytes;
+}
+
+bool QJsonRpcWebSocketServer::addService(QJsonRpcService *service)
+{
+    if (!QJsonRpcServiceProvider::addService(service))
+        return false;
+
+    connect(service, SIGNAL(notifyConnectedClients(QJsonRpcMessage)),
+               this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
+    connect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
+               this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    connect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+               this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
+    return true;
+}
+
+bool QJsonRpcWebSocketServer::removeService(QJsonRpcService *service)
+{
+    if (!QJsonRpcServiceProvider::removeService(service))
+        return false;
+
+    disconnect(service, SIGNAL(notifyConnectedClients(QJsonRpcMessage)),
+                  this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
+    disconnect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
+                  this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    disconnect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+                  this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
+    return true;
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(5,0,0)
+void QJsonRpcWebSocketServer::incomingConnection(qintptr socketDescriptor)
+#else
+void QJsonRpcWebSocketServer::incomingConnection(int socketDescriptor)
+#endif
+{
+    Q_D(QJsonRpcWebSocketServer);
+    QTcpSocket *tcpSocket = new QTcpSocket(this);
+    if (!tcpSocket->setSocketDescriptor(socketDescriptor)) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "can't set socket descriptor";
+        tcpSocket->deleteLater();
+        return;
+    }
+
+    QJsonRpcWebSocket *socket = new QJsonRpcWebSocket(tcpSocket, this);
+    d->configureSocket(socket);
+    connect(socket, SIGNAL(opened()), this, SLOT(_q_clientOpened()));
+    connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
+              this, SLOT(_q_processMessage(QJsonRpcMessage)));
+    connect(tcpSocket, SIGNAL(disconnected()), this, SLOT(_q_clientDisconnected()));
+    d->socketLookup.insert(tcpSocket, socket);
+}
+
+void QJsonRpcWebSocketServer::_q_clientOpened()
+{
+    Q_D(QJsonRpcWebSocketServer);
+    QJsonRpcWebSocket *socket = static_cast<QJsonRpcWebSocket*>(sender());
+    if (!socket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called without service socket";
+        return;
+    }
+
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        d->clients.insert(socket);
+    }
+    Q_EMIT clientConnected();
+}
+
+void QJsonRpcWebSocketServer::_q_clientDisconnected()
+{
+    Q_D(QJsonRpcWebSocketServer);
+    QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(sender());
+    if (!tcpSocket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called with invalid socket";
+        return;
+    }
+
+    // only connections that completed their handshake were announced
+    bool connected = false;
+    if (d->socketLookup.contains(tcpSocket)) {
+        QJsonRpcWebSocket *socket = d->socketLookup.take(tcpSocket);
+        {
+            QMutexLocker locker(&d->clientsMutex);
+            connected = d->clients.contains(socket);
+            d->removeClient(socket);
+        }
+        socket->deleteLater();
+    }
+
+    tcpSocket->deleteLater();
+    if (connected)
+        Q_EMIT clientDisconnected();
+}
+
+void QJsonRpcWebSocketServer::_q_processMessage(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    QJsonRpcSocket *socket = static_cast<QJsonRpcSocket*>(sender());
+    if (!socket) {
+        qJsonRpcDebug() << Q_FUNC_INFO << "called without service socket";
+        return;
+    }
+
+    if (d->processSubscription(socket, message))
+        return;
+    processMessage(socket, message);
+}
+
+void QJsonRpcWebSocketServer::notifyConnectedClients(const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    d->_q_notifyConnectedClients(message);
+}
+
+void QJsonRpcWebSocketServer::notifyConnectedClients(const QString &method, const QJsonArray &params)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    d->_q_notifyConnectedClients(method, params);
+}
+
+void QJsonRpcWebSocketServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    d->_q_notifySubscribers(topic, message);
+}
+
+bool QJsonRpcWebSocketServer::subscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    return d->subscribe(client, topic);
+}
+
+bool QJsonRpcWebSocketServer::unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic)
+{
+    Q_D(QJsonRpcWebSocketServer);
+    return d->unsubscribe(client, topic);
+}
+
+int QJsonRpcWebSocketServer::subscriberCount(const QString &topic) const
+{
+    Q_D(const QJsonRpcWebSocketServer);
+    return d->subscriberCount(topic);
+}
+
+#include "moc_qjsonrpcwebsocketserver.cpp"
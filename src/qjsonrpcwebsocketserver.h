@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCWEBSOCKETSERVER_H
+#define QJSONRPCWEBSOCKETSERVER_H
+
+#include <QTcpServer>
+#include "qjsonrpcabstractserver.h"
+
+// Serves JSON-RPC over WebSocket connections, one QJsonRpcWebSocket each.
+// Clients count as connected once their opening handshake completed, from
+// then on they receive notifyConnectedClients() and may subscribe to topics
+// like on the other servers.
+class QJsonRpcWebSocketServerPrivate;
+class QJSONRPC_EXPORT QJsonRpcWebSocketServer : public QTcpServer, public QJsonRpcAbstractServer
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcWebSocketServer(QObject *parent = 0);
+    ~QJsonRpcWebSocketServer();
+
+    virtual int connectedClientCount() const;
+    virtual bool subscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual bool unsubscribe(QJsonRpcAbstractSocket *client, const QString &topic);
+    virtual int subscriberCount(const QString &topic) const;
+
+    // applies to connections accepted after the call. permessage-deflate is
+    // accepted whenever clients offer it, messages of at least the
+    // compression threshold are then sent compressed
+    int writeCoalescingDelay() const;
+    void setWriteCoalescingDelay(int msecs);
+    QJsonRpcCodec *codec() const;
+    void setCodec(QJsonRpcCodec *codec);
+    int compressionThreshold() const;
+    void setCompressionThreshold(int bytes);
+
+    // reimp
+    bool addService(QJsonRpcService *service);
+    bool removeService(QJsonRpcService *service);
+
+Q_SIGNALS:
+    void clientConnected();
+    void clientDisconnected();
+
+public Q_SLOTS:
+    void notifyConnectedClients(const QJsonRpcMessage &message);
+    void notifyConnectedClients(const QString &method, const QJsonArray &params);
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
+
+protected:
+#if QT_VERSION >= QT_VERSION_CHECK(5,0,0)
+    virtual void incomingConnection(qintptr socketDescriptor);
+#else
+    virtual void incomingConnection(int socketDescriptor);
+#endif
+
+private Q_SLOTS:
+    void _q_clientOpened();
+    void _q_clientDisconnected();
+    void _q_processMessage(const QJsonRpcMessage &message);
+
+private:
+    Q_DECLARE_PRIVATE(QJsonRpcWebSocketServer)
+    Q_DISABLE_COPY(QJsonRpcWebSocketServer)
+#if !defined(USE_QT_PRIVATE_HEADERS)
+    QScopedPointer<QJsonRpcWebSocketServerPrivate> d_ptr;
+#endif
+};
+
+#endif
@@ -18,14 +18,27 @@ lessThan(QT_MAJOR_VERSION, 5) {
 }
 
 PRIVATE_HEADERS += \
+    qjsonrpcmessage_p.h \
+    qjsonrpcpool_p.h \
     qjsonrpcservice_p.h \
     qjsonrpcsocket_p.h \
     qjsonrpcabstractserver_p.h \
     qjsonrpcservicereply_p.h \
-    qjsonrpchttpserver_p.h
+    qjsonrpchttpserver_p.h \
+    qjsonrpchttp2_p.h \
+    qjsonrpccompression_p.h \
+    qjsonrpcwebsocket_p.h \
+    qjsonrpcudpsocket_p.h \
+    qjsonrpcmpscqueue_p.h \
+    qjsonrpcadmission_p.h \
+    qjsonrpcmetrics_p.h \
+    qjsonrpcforwarder_p.h
 
 INSTALL_HEADERS += \
     qjsonrpcmessage.h \
+    qjsonrpccodec.h \
+    qjsonrpcmetrics.h \
+    qjsonrpcinterceptor.h \
     qjsonrpcservice.h \
     qjsonrpcsocket.h \
     qjsonrpcserviceprovider.h \
@@ -35,7 +48,18 @@ INSTALL_HEADERS += \
     qjsonrpcglobal.h \
     qjsonrpcservicereply.h \
     qjsonrpchttpclient.h \
-    qjsonrpchttpserver.h
+    qjsonrpchttpserver.h \
+    qjsonrpcwebsocket.h \
+    qjsonrpcwebsocketserver.h \
+    qjsonrpcsharedmemorydevice.h \
+    qjsonrpcudpsocket.h \
+    qjsonrpcudpserver.h \
+    qjsonrpcinprocesssocket.h \
+    qjsonrpcthreadedsocket.h \
+    qjsonrpcclustersocket.h \
+    qjsonrpccoroutine.h \
+    qjsonrpcparams.h \
+    qjsonrpcproxy.h
 
 greaterThan(QT_MAJOR_VERSION, 4) {
     greaterThan(QT_MINOR_VERSION, 1) {
@@ -48,7 +72,9 @@ HEADERS += \
     $${PRIVATE_HEADERS}
 
 SOURCES += \
+    qjsonrpcglobal.cpp \
     qjsonrpcmessage.cpp \
+    qjsonrpccodec.cpp \
     qjsonrpcservice.cpp \
     qjsonrpcsocket.cpp \
     qjsonrpcserviceprovider.cpp \
@@ -57,7 +83,21 @@ SOURCES += \
     qjsonrpctcpserver.cpp \
     qjsonrpcservicereply.cpp \
     qjsonrpchttpclient.cpp \
-    qjsonrpchttpserver.cpp
+    qjsonrpchttpserver.cpp \
+    qjsonrpchttp2.cpp \
+    qjsonrpccompression.cpp \
+    qjsonrpcwebsocket.cpp \
+    qjsonrpcwebsocketserver.cpp \
+    qjsonrpcsharedmemorydevice.cpp \
+    qjsonrpcudpsocket.cpp \
+    qjsonrpcudpserver.cpp \
+    qjsonrpcinprocesssocket.cpp \
+    qjsonrpcthreadedsocket.cpp \
+    qjsonrpcclustersocket.cpp \
+    qjsonrpcadmission.cpp \
+    qjsonrpcmetrics.cpp \
+    qjsonrpcinterceptor.cpp \
+    qjsonrpcforwarder.cpp
 
 # install
 headers.files = $${INSTALL_HEADERS}
@@ -6,6 +6,8 @@ SUBDIRS += \
     qjsonrpcservice \
     qjsonrpchttpclient \
     qjsonrpchttpserver \
+    qjsonrpcudpserver \
+    qjsonrpcproxy \
     issue22
 
 lessThan(QT_MAJOR_VERSION, 5) {
@@ -76,6 +76,7 @@ private Q_SLOTS:
     void testArrayIteration();
 
     void testObjectFind();
+    void testObjectLargeFind();
 
     void testDocument();
 
@@ -90,19 +91,25 @@ private Q_SLOTS:
 
     void fromVariant();
     void fromVariantMap();
+    void fromVariantLarge();
     void toVariantMap();
     void toVariantList();
 
     void toJson();
     void toJsonSillyNumericValues();
     void toJsonLargeNumericValues();
+    void toJsonEscapedStrings();
     void fromJson();
     void fromJsonErrors();
+    void fromJsonReuse();
     void fromBinary();
+    void fromMappedFile();
     void toAndFromBinary_data();
     void toAndFromBinary();
     void parseNumbers();
+    void parseNumbersRounding();
     void parseStrings();
+    void parseLongStrings();
     void parseDuplicateKeys();
     void testParser();
 
@@ -873,6 +880,52 @@ void tst_QtJson::testObjectFind()
     QVERIFY(it == object.end());
 }
 
+void tst_QtJson::testObjectLargeFind()
+{
+    // large enough for the keys to be indexed, with latin1 and utf16 keys
+    QJsonObject object;
+    for (int i = 0; i < 100; ++i)
+        object.insert(QString::number(i) + (i % 2 ? QString(QChar(0x402)) : QString()), i);
+    QJsonObject nested;
+    nested.insert("object", object);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        const QJsonObject copy = object;
+        const QJsonObject inner = nested.value("object").toObject();
+        for (int i = 0; i < 100; ++i) {
+            const QString key = QString::number(i) + (i % 2 ? QString(QChar(0x402)) : QString());
+            QCOMPARE(copy.value(key).toDouble(), double(i));
+            QCOMPARE(inner.value(key).toDouble(), double(i));
+            QVERIFY(copy.contains(key));
+            QCOMPARE(copy.constFind(key).key(), key);
+        }
+        QVERIFY(!copy.contains("100"));
+        QVERIFY(!inner.contains(QLatin1String("1")));
+        QVERIFY(copy.constFind("100") == copy.constEnd());
+    }
+
+    // changes drop the index, a copy sharing the old data keeps its own
+    const QJsonObject before = object;
+    QVERIFY(object.contains("10"));
+    object.remove("10");
+    object.insert("new", true);
+    object.take("20");
+    QVERIFY(!object.contains("10"));
+    QVERIFY(!object.contains("20"));
+    QCOMPARE(object.value("new"), QJsonValue(true));
+    QCOMPARE(object.value("30").toDouble(), 30.);
+    QCOMPARE(before.value("10").toDouble(), 10.);
+    QCOMPARE(before.value("20").toDouble(), 20.);
+    QVERIFY(!before.contains("new"));
+
+    QJsonObject::iterator it = object.find("40");
+    QVERIFY(it != object.end());
+    it = object.erase(it);
+    QVERIFY(!object.contains("40"));
+    QCOMPARE(object.value("42").toDouble(), 42.);
+    QCOMPARE(object.size(), 98);
+}
+
 void tst_QtJson::testDocument()
 {
     QJsonDocument doc;
@@ -1162,6 +1215,55 @@ void tst_QtJson::fromVariantMap()
     QCOMPARE(array.at(3).toString(), QLatin1String("foo"));
 }
 
+void tst_QtJson::fromVariantLarge()
+{
+    // built in one pass, the result has to match the one of appending
+    QVariantList list;
+    QVariantMap map;
+    QJsonArray appended;
+    QJsonObject inserted;
+    for (int i = 0; i < 1000; ++i) {
+        QVariant value;
+        switch (i % 6) {
+        case 0: value = i; break;
+        case 1: value = i + 0.5; break;
+        case 2: value = QString::number(i); break;
+        case 3: value = QString::number(i) + QChar(0x402); break;
+        case 4: value = QVariantList() << true << QVariant() << i; break;
+        default: value = i % 4 == 1; break;
+        }
+        list.append(value);
+        map.insert(QString(QChar(0x402)) + QString::number(i), value);
+        appended.append(QJsonValue::fromVariant(value));
+        inserted.insert(QString(QChar(0x402)) + QString::number(i), QJsonValue::fromVariant(value));
+    }
+
+    QJsonArray array = QJsonArray::fromVariantList(list);
+    QCOMPARE(array.size(), 1000);
+    QCOMPARE(array, appended);
+    QCOMPARE(QJsonDocument(array).toJson(), QJsonDocument(appended).toJson());
+    QCOMPARE(array.at(4).toArray().at(2).toDouble(), 4.);
+
+    QJsonObject object = QJsonObject::fromVariantMap(map);
+    QCOMPARE(object.size(), 1000);
+    QCOMPARE(object, inserted);
+    QCOMPARE(QJsonDocument(object).toJson(), QJsonDocument(inserted).toJson());
+    QCOMPARE(object.value(QString(QChar(0x402)) + "3").toString(), QString("3") + QChar(0x402));
+
+    // and stay usable as any other
+    array.append(QLatin1String("last"));
+    array.removeAt(0);
+    QCOMPARE(array.size(), 1000);
+    QCOMPARE(array.last().toString(), QLatin1String("last"));
+    object.insert("last", true);
+    object.remove(QString(QChar(0x402)) + "0");
+    QCOMPARE(object.size(), 1000);
+    QCOMPARE(object.value("last"), QJsonValue(true));
+
+    QCOMPARE(QJsonArray::fromVariantList(QVariantList()), QJsonArray());
+    QCOMPARE(QJsonObject::fromVariantMap(QVariantMap()), QJsonObject());
+}
+
 void tst_QtJson::toVariantMap()
 {
     QCOMPARE(QMetaType::Type(QJsonValue(QJsonObject()).toVariant().type()), QMetaType::QVariantMap); // QTBUG-32524
@@ -1393,6 +1495,35 @@ void tst_QtJson::toJsonLargeNumericValues()
     QCOMPARE(json, expected);
 }
 
+void tst_QtJson::toJsonEscapedStrings()
+{
+    // plain runs of every length around the blocks the writer copies, ending
+    // in an escape or a multi-byte character, as Latin-1 and UTF-16 strings
+    const QString tails[] = { QString(), QString("\""), QString("\x01"), QString::fromUtf8("\xc3\xa9"),
+                              QString(QChar(0x402)) };
+    const char *escapedTails[] = { "", "\\\"", "\\u0001", "\xc3\xa9", "\xd0\x82" };
+    for (int length = 0; length < 40; ++length) {
+        for (int t = 0; t < 5; ++t) {
+            const QByteArray plain(length, 'a');
+            const QString string = QString::fromLatin1(plain) + tails[t] + QString::fromLatin1(plain);
+            const QByteArray escaped = plain + escapedTails[t] + plain;
+
+            QJsonObject object;
+            object.insert(string, string);
+            object.insert(string + QChar(0x402), QJsonValue());
+            QCOMPARE(QJsonDocument(object).toJson(QJsonDocument::Compact),
+                     "{\"" + escaped + "\":\"" + escaped + "\",\"" + escaped + "\xd0\x82\":null}");
+        }
+    }
+
+    // too long for a latin1 string
+    const QString plain(0x9000, 'b');
+    QJsonArray array;
+    array.append(plain + "\n");
+    QCOMPARE(QJsonDocument(array).toJson(QJsonDocument::Compact),
+             "[\"" + plain.toLatin1() + "\\n\"]");
+}
+
 void tst_QtJson::fromJson()
 {
     {
@@ -1683,6 +1814,32 @@ void tst_QtJson::fromJsonErrors()
     }
 }
 
+void tst_QtJson::fromJsonReuse()
+{
+    // documents parsed one after the other share the parser's buffer, each
+    // has to keep its own data
+    QList<QJsonDocument> documents;
+    QList<QJsonArray> expected;
+    for (int i = 0; i < 50; ++i) {
+        QJsonArray array;
+        const int count = (i % 10 == 9) ? 20000 : i;
+        for (int j = 0; j < count; ++j)
+            array.append(QString("value %1 of %2").arg(j).arg(i));
+        expected.append(array);
+
+        QJsonParseError error;
+        documents.append(QJsonDocument::fromJson(QJsonDocument(array).toJson(), &error));
+        QCOMPARE(error.error, QJsonParseError::NoError);
+
+        // a failing parse in between leaves the others alone
+        QVERIFY(QJsonDocument::fromJson("[\"unterminated", &error).isNull());
+        QCOMPARE(error.error, QJsonParseError::UnterminatedString);
+    }
+
+    for (int i = 0; i < documents.size(); ++i)
+        QCOMPARE(documents.at(i).array(), expected.at(i));
+}
+
 void tst_QtJson::fromBinary()
 {
     QFile file(":/test.json");
@@ -1704,6 +1861,60 @@ void tst_QtJson::fromBinary()
     QVERIFY(doc == bdoc);
 }
 
+void tst_QtJson::fromMappedFile()
+{
+    QJsonObject object;
+    object.insert("string", QLatin1String("value"));
+    object.insert("array", QJsonArray() << 1 << QString(QChar(0x402)) << QJsonObject());
+    const QByteArray binary = QJsonDocument(object).toBinaryData();
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(binary);
+    file.flush();
+
+    QJsonObject mapped;
+    {
+        QJsonDocument doc = QJsonDocument::fromMappedFile(file.fileName());
+        QVERIFY(doc.isObject());
+        QVERIFY(doc.validate());
+        QCOMPARE(doc.object(), object);
+        mapped = doc.object();
+    }
+
+    // the values outlive the document, and changing them leaves the file alone
+    QCOMPARE(mapped.value("array").toArray().at(1).toString(), QString(QChar(0x402)));
+    mapped.remove("string");
+    mapped.insert("new", true);
+    QCOMPARE(mapped.size(), 2);
+    QVERIFY(file.seek(0));
+    QCOMPARE(file.readAll(), binary);
+    QCOMPARE(QJsonDocument::fromMappedFile(file.fileName()).object(), object);
+
+    // validated on demand
+    QTemporaryFile corrupt;
+    QVERIFY(corrupt.open());
+    QByteArray damaged = binary;
+    damaged[damaged.size() - 2] = '\x7f';
+    corrupt.write(damaged);
+    corrupt.flush();
+    QVERIFY(QJsonDocument::fromMappedFile(corrupt.fileName()).isNull());
+    QJsonDocument unchecked = QJsonDocument::fromMappedFile(corrupt.fileName(),
+                                                            QJsonDocument::BypassValidation);
+    QVERIFY(!unchecked.isNull());
+    QVERIFY(!unchecked.validate());
+
+    // truncated or missing
+    QTemporaryFile truncated;
+    QVERIFY(truncated.open());
+    truncated.write(binary.left(binary.size() / 2));
+    truncated.flush();
+    QVERIFY(QJsonDocument::fromMappedFile(truncated.fileName(),
+                                          QJsonDocument::BypassValidation).isNull());
+    QVERIFY(QJsonDocument::fromMappedFile("does-not-exist.bjson").isNull());
+    QVERIFY(!QJsonDocument().validate());
+}
+
 void tst_QtJson::toAndFromBinary_data()
 {
     QTest::addColumn<QString>("filename");
@@ -1807,6 +2018,32 @@ void tst_QtJson::parseNumbers()
     }
 }
 
+void tst_QtJson::parseNumbersRounding()
+{
+    // values converted without a full string to double conversion must
+    // round the same way it does
+    const char *numbers[] = {
+        "33554431", "33554432", "-33554432", "9007199254740993", "18446744073709551615",
+        "123456789012345678901234567890", "0.1", "0.30000000000000004", "3.141592653589793",
+        "2.2250738585072014e-308", "2.2250738585072011e-308", "4.9e-324", "1.7976931348623157e308",
+        "1e23", "8.98846567431158e307", "9.424770000000001", "-0.0", "0e999",
+        "7.2057594037927933e16", "1.00000000000000011102230246251565404236316680908203125",
+        "0.000000000000000000000000000000000000000000123456789"
+    };
+    const int size = sizeof(numbers) / sizeof(const char *);
+    for (int i = 0; i < size; ++i) {
+        QByteArray json = "[";
+        json += numbers[i];
+        json += "]";
+        QJsonDocument doc = QJsonDocument::fromJson(json);
+        QVERIFY2(doc.isArray(), numbers[i]);
+        const double expected = QByteArray(numbers[i]).toDouble();
+        const double actual = doc.array().at(0).toDouble();
+        QVERIFY2(memcmp(&expected, &actual, sizeof(double)) == 0 || (expected == 0 && actual == 0),
+                 numbers[i]);
+    }
+}
+
 void tst_QtJson::parseStrings()
 {
     const char *strings [] =
@@ -1874,6 +2111,32 @@ void tst_QtJson::parseStrings()
 
 }
 
+void tst_QtJson::parseLongStrings()
+{
+    // plain runs and whitespace of every length around the 16 byte blocks
+    // the parser scans, ending in an escape, a multi-byte character or not
+    const char *tails[] = { "", "\\n", "\xc3\xa9", "\\u0402" };
+    const QString expectedTails[] = { QString(), QString("\n"), QString::fromUtf8("\xc3\xa9"),
+                                      QString(QChar(0x402)) };
+    for (int length = 0; length < 40; ++length) {
+        for (int t = 0; t < 4; ++t) {
+            QByteArray plain(length, 'a');
+            QByteArray json = "[" + QByteArray(length, ' ') + "\"" + plain + tails[t] + plain +
+                              "\"" + QByteArray(length, '\n') + "]";
+            QJsonParseError error;
+            QJsonDocument doc = QJsonDocument::fromJson(json, &error);
+            QCOMPARE(error.error, QJsonParseError::NoError);
+            QCOMPARE(doc.array().at(0).toString(),
+                     QString::fromLatin1(plain) + expectedTails[t] + QString::fromLatin1(plain));
+        }
+    }
+
+    // too long for a latin1 string
+    QByteArray plain(0x9000, 'b');
+    QJsonDocument doc = QJsonDocument::fromJson("[\"" + plain + "\"]");
+    QCOMPARE(doc.array().at(0).toString(), QString::fromLatin1(plain));
+}
+
 void tst_QtJson::parseDuplicateKeys()
 {
     const char *json = "{ \"B\": true, \"A\": null, \"B\": false }";
@@ -16,6 +16,12 @@
  */
 #include <QtTest/QtTest>
 
+#if QT_VERSION >= 0x050000
+#include <QJsonDocument>
+#else
+#include "json/qjsondocument.h"
+#endif
+
 #include "testhttpserver.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpchttpclient.h"
@@ -39,10 +45,13 @@ private Q_SLOTS:
 
     void properties();
     void basicRequest();
+    void batchRequest();
+    void compactRequest();
     void invalidResponse_data();
     void invalidResponse();
     void connectionRefused();
     void requestTimedOut();
+    void asyncTimeoutAndAbort();
     void issue23_doubleFinishedEmitted();
 };
 
@@ -73,6 +82,46 @@ public:
     }
 };
 
+class JsonRpcBatchRequestHandler : public TestHttpServerRequestHandler
+{
+public:
+    virtual QByteArray handleRequest(QNetworkAccessManager::Operation operation,
+                                     const QNetworkRequest &request, const QByteArray &body)
+    {
+        Q_UNUSED(operation)
+        Q_UNUSED(request)
+        QJsonArray requests = QJsonDocument::fromJson(body).array();
+        QJsonArray responses;
+        for (int i = requests.size() - 1; i >= 0; --i) {
+            QJsonRpcMessage requestMessage = QJsonRpcMessage::fromObject(requests.at(i).toObject());
+            if (requestMessage.type() == QJsonRpcMessage::Request)
+                responses.append(requestMessage.createResponse(requestMessage.method()).toObject());
+        }
+
+        QByteArray responseData = QJsonDocument(responses).toJson();
+        QByteArray reply;
+        reply += "HTTP/1.0 200\r\n";
+        reply += "Content-Type: application/json\r\n";
+        reply += "Content-length: " + QByteArray::number(responseData.size()) + "\r\n";
+        reply += "\r\n";
+        reply += responseData;
+        return reply;
+    }
+};
+
+class RecordingRequestHandler : public JsonRpcRequestHandler
+{
+public:
+    virtual QByteArray handleRequest(QNetworkAccessManager::Operation operation,
+                                     const QNetworkRequest &request, const QByteArray &body)
+    {
+        lastBody = body;
+        return JsonRpcRequestHandler::handleRequest(operation, request, body);
+    }
+
+    QByteArray lastBody;
+};
+
 void TestQJsonRpcHttpClient::properties()
 {
     QJsonRpcHttpClient client;
@@ -101,6 +150,55 @@ void TestQJsonRpcHttpClient::basicRequest()
     QCOMPARE(response.result().toString(), QLatin1String("some response data"));
 }
 
+void TestQJsonRpcHttpClient::batchRequest()
+{
+    TestHttpServer server;
+    server.setRequestHandler(new JsonRpcBatchRequestHandler);
+    QVERIFY(server.listen());
+
+    QString url =
+        QString("%1://localhost:%2").arg("http").arg(server.serverPort());
+    QJsonRpcHttpClient client(url);
+    QList<QJsonRpcMessage> messages;
+    messages << QJsonRpcMessage::createRequest("first")
+             << QJsonRpcMessage::createNotification("notify")
+             << QJsonRpcMessage::createRequest("second");
+    QList<QJsonRpcServiceReply *> replies = client.sendBatch(messages);
+    QCOMPARE(replies.size(), 2);
+
+    QSignalSpy spy(replies.last(), SIGNAL(finished()));
+    connect(replies.last(), SIGNAL(finished()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+    QCOMPARE(spy.size(), 1);
+
+    QCOMPARE(replies.at(0)->response().result().toString(), QLatin1String("first"));
+    QCOMPARE(replies.at(1)->response().result().toString(), QLatin1String("second"));
+    qDeleteAll(replies);
+}
+
+void TestQJsonRpcHttpClient::compactRequest()
+{
+    TestHttpServer server;
+    RecordingRequestHandler *handler = new RecordingRequestHandler;
+    server.setRequestHandler(handler);
+    QVERIFY(server.listen());
+
+    QString url =
+        QString("%1://localhost:%2").arg("http").arg(server.serverPort());
+    QJsonRpcHttpClient client(url);
+    QJsonRpcMessage message = QJsonRpcMessage::createRequest("testMethod", QLatin1String("param"));
+    for (int i = 0; i < 2; ++i) {
+        QJsonRpcMessage response = client.sendMessageBlocking(message);
+        QCOMPARE(response.result().toString(), QLatin1String("some response data"));
+
+        // requests after the first come from the same template
+        QVERIFY(!handler->lastBody.contains('\n'));
+        QVERIFY(!handler->lastBody.contains(": "));
+        QCOMPARE(QJsonRpcMessage::fromJson(handler->lastBody).method(), QLatin1String("testMethod"));
+    }
+}
+
 void TestQJsonRpcHttpClient::invalidResponse_data()
 {
     QTest::addColumn<QByteArray>("responseData");
@@ -155,6 +253,44 @@ void TestQJsonRpcHttpClient::requestTimedOut()
     QCOMPARE(response.errorCode(), int(QJsonRpc::TimeoutError));
 }
 
+void TestQJsonRpcHttpClient::asyncTimeoutAndAbort()
+{
+    // headers but never a body
+    TestHttpServer server;
+    server.setResponseData("HTTP/1.0 200\r\n\r\n");
+    QVERIFY(server.listen());
+
+    QString url =
+        QString("%1://localhost:%2").arg("http").arg(server.serverPort());
+    QJsonRpcHttpClient client(url);
+    QSignalSpy networkSpy(client.networkAccessManager(), SIGNAL(finished(QNetworkReply*)));
+    QJsonRpcMessage message = QJsonRpcMessage::createRequest("someMethod");
+    QScopedPointer<QJsonRpcServiceReply> reply(client.sendMessage(message, 50));
+    QSignalSpy spy(reply.data(), SIGNAL(finished()));
+    connect(reply.data(), SIGNAL(finished()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+    QCOMPARE(reply->response().errorCode(), int(QJsonRpc::TimeoutError));
+    QCOMPARE(spy.size(), 1);
+
+    // the request doesn't outlive its reply's timeout
+    QCOMPARE(networkSpy.size(), 1);
+
+    // aborting finishes the reply at once, and only once
+    networkSpy.clear();
+    client.setDefaultRequestTimeout(0);
+    reply.reset(client.sendMessage(message));
+    QSignalSpy abortSpy(reply.data(), SIGNAL(finished()));
+    QTest::qWait(50);
+    reply->abort();
+    QCOMPARE(abortSpy.size(), 1);
+    QCOMPARE(reply->response().errorCode(), int(QJsonRpc::CancelledError));
+    QCOMPARE(networkSpy.size(), 1);
+    reply->abort();
+    QTest::qWait(50);
+    QCOMPARE(abortSpy.size(), 1);
+}
+
 void TestQJsonRpcHttpClient::issue23_doubleFinishedEmitted()
 {
     QString url = QString("%1://localhost:%2").arg("http").arg(9191);
@@ -5,6 +5,11 @@
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QtEndian>
 
 #if QT_VERSION >= 0x050000
 #include <QJsonDocument>
@@ -16,6 +21,8 @@
 #include "qjsonrpcservice.h"
 #include "qjsonrpchttpserver.h"
 #include "qjsonrpcmessage.h"
+#include "qjsonrpchttp2_p.h"
+#include "qjsonrpccompression_p.h"
 
 class TestQJsonRpcHttpServer: public QObject
 {
@@ -31,6 +38,21 @@ private Q_SLOTS:
     void missingHeaders();
     void testAccessControlHeader();
     void testMissingAccessControlHeader();
+    void keepAlivePipelining();
+    void batch();
+    void clientBatching();
+    void loadBalancing();
+    void hedgingAndRetries();
+    void headersSplitAcrossReads();
+    void bodySplitAcrossReads();
+    void maximumRequestSize();
+    void compression();
+    void contentEncoding();
+    void hpack();
+    void http2();
+    void eventStream();
+    void ioThreads();
+    void tlsSessionResumption();
 
 private:
     // temporarily disabled
@@ -126,6 +148,8 @@ void TestQJsonRpcHttpServer::quickTest()
     QJsonRpcMessage response = client.sendMessageBlocking(request);
     QVERIFY(response.type() != QJsonRpcMessage::Error);
     QCOMPARE(request.id(), response.id());
+    QCOMPARE(server.tlsHandshakeCount(), 0);
+    QCOMPARE(client.tlsHandshakeCount(), 0);
 }
 
 void TestQJsonRpcHttpServer::sslTest()
@@ -144,6 +168,75 @@ void TestQJsonRpcHttpServer::sslTest()
     qDebug() << response;
     QVERIFY(response.type() != QJsonRpcMessage::Error);
     QCOMPARE(request.id(), response.id());
+    QCOMPARE(server.tlsHandshakeCount(), 1);
+    QCOMPARE(client.tlsHandshakeCount(), 1);
+
+    // the connection is kept alive, no second handshake
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("service.noParam"));
+    QVERIFY(response.type() != QJsonRpcMessage::Error);
+    QCOMPARE(server.tlsHandshakeCount(), 1);
+    QCOMPARE(client.tlsHandshakeCount(), 1);
+}
+
+void TestQJsonRpcHttpServer::tlsSessionResumption()
+{
+#if QT_VERSION < 0x050000
+    QSKIP("Session tickets need Qt 5.2", SkipAll);
+#elif QT_VERSION < 0x050200
+    QSKIP("Session tickets need Qt 5.2");
+#else
+    if (!QSslSocket::supportsSsl())
+        QSKIP("No TLS support");
+
+    QFile certificateFile(QLatin1String(":/certs/fluke.cert"));
+    QVERIFY(certificateFile.open(QIODevice::ReadOnly));
+    QFile keyFile(QLatin1String(":/certs/fluke.key"));
+    QVERIFY(keyFile.open(QIODevice::ReadOnly));
+    QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+    configuration.setLocalCertificate(QSslCertificate(certificateFile.readAll()));
+    configuration.setPrivateKey(QSslKey(keyFile.readAll(), QSsl::Rsa));
+    // TLS 1.2 hands out the ticket during the handshake
+    configuration.setProtocol(QSsl::TlsV1_2);
+
+    // every response closes its connection, so each request reconnects
+    QJsonRpcHttpServer server;
+    server.setSslConfiguration(configuration);
+    server.setKeepAliveTimeout(0);
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QJsonRpcHttpClient client;
+    client.setEndPoint("https://127.0.0.1:8118");
+    client.setSslConfiguration(QSslConfiguration::defaultConfiguration());
+    QJsonRpcMessage response =
+        client.sendMessageBlocking(QJsonRpcMessage::createRequest("service.noParam"));
+    QVERIFY(response.type() != QJsonRpcMessage::Error);
+    QCOMPARE(client.tlsHandshakeCount(), 1);
+    QCOMPARE(client.tlsResumptionAttemptCount(), 0);
+    const QByteArray ticket = client.sslConfiguration().sessionTicket();
+    if (ticket.isEmpty())
+        QSKIP("The TLS backend issued no session ticket");
+
+    // the reconnect offers the stored ticket
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("service.noParam"));
+    QVERIFY(response.type() != QJsonRpcMessage::Error);
+    QCOMPARE(client.tlsHandshakeCount(), 2);
+    QCOMPARE(client.tlsResumptionAttemptCount(), 1);
+
+    // and so does a client starting with the saved configuration, which
+    // shares the session, not the connection, of the first client. The
+    // server runs a full handshake for each, see sslConfiguration()
+    QJsonRpcHttpClient resumed;
+    resumed.setEndPoint("https://127.0.0.1:8118");
+    resumed.setSslConfiguration(client.sslConfiguration());
+    QVERIFY(!resumed.sslConfiguration().sessionTicket().isEmpty());
+    QCOMPARE(resumed.sslConfiguration().sessionTicket(), client.sslConfiguration().sessionTicket());
+    response = resumed.sendMessageBlocking(QJsonRpcMessage::createRequest("service.noParam"));
+    QVERIFY(response.type() != QJsonRpcMessage::Error);
+    QCOMPARE(resumed.tlsHandshakeCount(), 1);
+    QCOMPARE(resumed.tlsResumptionAttemptCount(), 1);
+    QCOMPARE(server.tlsHandshakeCount(), 3);
+#endif
 }
 
 void TestQJsonRpcHttpServer::statusCodes_data()
@@ -184,14 +277,30 @@ void TestQJsonRpcHttpServer::statusCodes_data()
                                 << QByteArray("OK") << QByteArray("application/json;charset=UTF-8");
     }
 
-    /*
-     * TODO: support notifications
     {
         QJsonRpcMessage notification = QJsonRpcMessage::createNotification("service.noParam");
         QTest::newRow("204-no-content") << notification.toJson() << 204
-                               << QByteArray("No Content") << QByteArray("OK") << QByteArray("application/json");
+                                        << QByteArray("No Content") << QByteArray("application/json");
+    }
+
+    {
+        // errors of single requests are reported in the batch's responses
+        QByteArray batch = "[" + QJsonRpcMessage::createRequest("service.noParam").toJson() + "," +
+                           QJsonRpcMessage::createRequest("invalidMethod").toJson() + "]";
+        QTest::newRow("200-batch") << batch << 200
+                                   << QByteArray("OK") << QByteArray("application/json");
+    }
+
+    {
+        QByteArray batch = "[" + QJsonRpcMessage::createNotification("service.noParam").toJson() + "]";
+        QTest::newRow("204-batch-of-notifications") << batch << 204
+                                   << QByteArray("No Content") << QByteArray("application/json");
+    }
+
+    {
+        QTest::newRow("400-empty-batch") << QByteArray(" []") << 400
+                                   << QByteArray("Bad Request") << QByteArray("application/json");
     }
-    */
 }
 
 void TestQJsonRpcHttpServer::statusCodes()
@@ -369,5 +478,789 @@ void TestQJsonRpcHttpServer::testAccessControlHeader()
     QCOMPARE(reply->rawHeader("Access-Control-Allow-Headers"), QByteArray("accept, content-type"));
 }
 
+static QByteArray httpRequest(const QJsonRpcMessage &message, const QByteArray &connection = QByteArray())
+{
+    QByteArray body = message.toJson();
+    QByteArray request = "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                         "Content-Type: application/json\r\nAccept: application/json\r\n";
+    if (!connection.isEmpty())
+        request += "Connection: " + connection + "\r\n";
+    request += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+    return request + body;
+}
+
+void TestQJsonRpcHttpServer::keepAlivePipelining()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+
+    // both requests in one write, answered in order on the same connection
+    QJsonRpcMessage first = QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("first"));
+    QJsonRpcMessage second = QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("second"));
+    socket.write(httpRequest(first) + httpRequest(second));
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (received.count("\"result\"") < 2 && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    QCOMPARE(received.count("HTTP/1.1 200 OK"), 2);
+    QVERIFY(received.contains("Connection: keep-alive"));
+    QVERIFY(received.indexOf("first") < received.indexOf("second"));
+    QVERIFY(received.indexOf("first") >= 0);
+    QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+
+    // the server closes the connection when asked to
+    received.clear();
+    socket.write(httpRequest(QJsonRpcMessage::createRequest("service.noParam"), "close"));
+    timer.restart();
+    while (socket.state() == QAbstractSocket::ConnectedState && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    received += socket.readAll();
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+    QVERIFY(received.contains("Connection: close"));
+    QVERIFY(socket.state() != QAbstractSocket::ConnectedState);
+}
+
+void TestQJsonRpcHttpServer::batch()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QJsonRpcHttpClient client;
+    client.setEndPoint("http://127.0.0.1:8118");
+
+    QList<QJsonRpcMessage> messages;
+    messages << QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("first"))
+             << QJsonRpcMessage::createNotification("service.noParam")
+             << QJsonRpcMessage::createRequest("invalidMethod")
+             << QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("second"));
+    QList<QJsonRpcServiceReply *> replies = client.sendBatch(messages);
+    QCOMPARE(replies.size(), 3);
+
+    connect(replies.last(), SIGNAL(finished()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+
+    QCOMPARE(replies.at(0)->response().result().toString(), QLatin1String("first"));
+    QCOMPARE(replies.at(1)->response().type(), QJsonRpcMessage::Error);
+    QCOMPARE(replies.at(1)->response().errorCode(), int(QJsonRpc::MethodNotFound));
+    QCOMPARE(replies.at(2)->response().result().toString(), QLatin1String("second"));
+    qDeleteAll(replies);
+}
+
+void TestQJsonRpcHttpServer::clientBatching()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QJsonRpcHttpClient client;
+    client.setEndPoint("http://127.0.0.1:8118");
+    client.setBatchingEnabled(true);
+    client.setMaximumBatchSize(3);
+    QVERIFY(client.isBatchingEnabled());
+    QCOMPARE(client.maximumBatchSize(), 3);
+    QSignalSpy requestSpy(client.networkAccessManager(), SIGNAL(finished(QNetworkReply*)));
+
+    // calls of the same pass go out together, a full batch right away
+    QList<QJsonRpcServiceReply *> replies;
+    for (int i = 0; i < 5; ++i)
+        replies.append(client.invokeRemoteMethod("service.singleParam", QString::number(i)));
+    client.notify(QJsonRpcMessage::createNotification("service.noParam"));
+    replies.append(client.invokeRemoteMethod("invalidMethod"));
+
+    QElapsedTimer timer;
+    timer.start();
+    bool finished = false;
+    while (!finished && timer.elapsed() < 5000) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+        finished = true;
+        foreach (QJsonRpcServiceReply *reply, replies)
+            finished = finished && reply->response().isValid();
+    }
+
+    QVERIFY(finished);
+    QCOMPARE(requestSpy.count(), 3);
+    for (int i = 0; i < 5; ++i)
+        QCOMPARE(replies.at(i)->response().result().toString(), QString::number(i));
+    QCOMPARE(replies.last()->response().errorCode(), int(QJsonRpc::MethodNotFound));
+    qDeleteAll(replies);
+    replies.clear();
+
+    // with a delay, calls from later passes join the batch
+    requestSpy.clear();
+    client.setMaximumBatchSize(50);
+    client.setMaximumBatchDelay(200);
+    QCOMPARE(client.maximumBatchDelay(), 200);
+    replies.append(client.invokeRemoteMethod("service.singleParam", QLatin1String("early")));
+    QCoreApplication::processEvents();
+    replies.append(client.invokeRemoteMethod("service.singleParam", QLatin1String("late")));
+    connect(replies.last(), SIGNAL(finished()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+    QCOMPARE(requestSpy.count(), 1);
+    QCOMPARE(replies.first()->response().result().toString(), QLatin1String("early"));
+    QCOMPARE(replies.last()->response().result().toString(), QLatin1String("late"));
+    qDeleteAll(replies);
+}
+
+void TestQJsonRpcHttpServer::loadBalancing()
+{
+    TestService *firstService = new TestService;
+    TestService *secondService = new TestService;
+    QJsonRpcHttpServer firstServer;
+    QJsonRpcHttpServer secondServer;
+    firstServer.addService(firstService);
+    secondServer.addService(secondService);
+    QVERIFY(firstServer.listen(QHostAddress::LocalHost, 8118));
+    QVERIFY(secondServer.listen(QHostAddress::LocalHost, 8119));
+
+    QJsonRpcHttpClient client;
+    QList<QUrl> endPoints;
+    endPoints << QUrl("http://127.0.0.1:8118") << QUrl("http://127.0.0.1:8119");
+    client.setEndPoints(endPoints);
+    QCOMPARE(client.endPoints(), endPoints);
+    QCOMPARE(client.endPoint(), endPoints.first());
+    QCOMPARE(client.loadBalancingPolicy(), QJsonRpcHttpClient::RoundRobin);
+
+    // one after the other, in turn
+    for (int i = 0; i < 4; ++i)
+        QCOMPARE(client.invokeRemoteMethodBlocking("service.increaseCalled").type(), QJsonRpcMessage::Response);
+    QCOMPARE(firstService->callCount(), 2);
+    QCOMPARE(secondService->callCount(), 2);
+
+    // requests in flight at the same time spread out
+    firstService->resetCount();
+    secondService->resetCount();
+    client.setLoadBalancingPolicy(QJsonRpcHttpClient::LeastOutstandingRequests);
+    QList<QJsonRpcServiceReply *> replies;
+    for (int i = 0; i < 4; ++i)
+        replies.append(client.invokeRemoteMethod("service.increaseCalled"));
+
+    QElapsedTimer timer;
+    timer.start();
+    while (firstService->callCount() + secondService->callCount() < 4 && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+    QCOMPARE(firstService->callCount(), 2);
+    QCOMPARE(secondService->callCount(), 2);
+    qDeleteAll(replies);
+
+    client.setLoadBalancingPolicy(QJsonRpcHttpClient::LatencyEwma);
+    for (int i = 0; i < 4; ++i)
+        QCOMPARE(client.invokeRemoteMethodBlocking("service.increaseCalled").type(), QJsonRpcMessage::Response);
+
+    // an endpoint refusing connections is left out
+    firstService->resetCount();
+    client.setLoadBalancingPolicy(QJsonRpcHttpClient::RoundRobin);
+    client.setMaximumConsecutiveFailures(1);
+    client.setEjectionTime(60000);
+    endPoints.replace(1, QUrl("http://127.0.0.1:9191"));
+    client.setEndPoints(endPoints);
+    QCOMPARE(client.invokeRemoteMethodBlocking("service.increaseCalled").type(), QJsonRpcMessage::Response);
+    QCOMPARE(client.invokeRemoteMethodBlocking("service.increaseCalled").type(), QJsonRpcMessage::Error);
+    QCOMPARE(client.healthyEndPoints(), QList<QUrl>() << endPoints.first());
+    for (int i = 0; i < 2; ++i)
+        QCOMPARE(client.invokeRemoteMethodBlocking("service.increaseCalled").type(), QJsonRpcMessage::Response);
+    QCOMPARE(firstService->callCount(), 3);
+}
+
+void TestQJsonRpcHttpServer::hedgingAndRetries()
+{
+    TestService *service = new TestService;
+    QJsonRpcHttpServer server;
+    server.addService(service);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    // takes connections and never answers
+    QTcpServer silentServer;
+    QVERIFY(silentServer.listen(QHostAddress::LocalHost, 8119));
+
+    QJsonRpcHttpClient client;
+    client.setIdempotentMethods(QStringList() << "service.singleParam");
+    client.setEndPoint(QUrl("http://127.0.0.1:8118"));
+    QCOMPARE(client.hedgingPercentile(), 0.95);
+    QCOMPARE(client.retryBudget(), 0.1);
+
+    // latencies to hedge by
+    for (int i = 0; i < 20; ++i) {
+        QJsonRpcMessage response = client.invokeRemoteMethodBlocking("service.singleParam", QString("warm"));
+        QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    }
+    QCOMPARE(client.hedgedRequestCount(), 0);
+
+    // the request stuck on the silent endpoint is overtaken by its hedge
+    client.setEndPoints(QList<QUrl>() << QUrl("http://127.0.0.1:8119") << QUrl("http://127.0.0.1:8118"));
+    QJsonRpcMessage response = client.invokeRemoteMethodBlocking("service.singleParam", 5000, QString("hedged"));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QString("hedged"));
+    QCOMPARE(client.hedgedRequestCount(), 1);
+
+    // a refused connection fails over to the other endpoint
+    QList<QUrl> endPoints;
+    endPoints << QUrl("http://127.0.0.1:9191") << QUrl("http://127.0.0.1:8118");
+    client.setEndPoints(endPoints);
+    response = client.invokeRemoteMethodBlocking("service.singleParam", 5000, QString("retried"));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QString("retried"));
+    QCOMPARE(client.retriedRequestCount(), 1);
+
+    // methods not known to be idempotent are never sent twice
+    service->resetCount();
+    client.setEndPoints(endPoints);
+    QCOMPARE(client.invokeRemoteMethodBlocking("service.increaseCalled", 5000).type(), QJsonRpcMessage::Error);
+    QCOMPARE(service->callCount(), 0);
+    QCOMPARE(client.retriedRequestCount(), 1);
+
+    // nor is anything without a budget
+    client.setRetryBudget(0);
+    client.setEndPoints(endPoints);
+    QCOMPARE(client.invokeRemoteMethodBlocking("service.singleParam", 5000, QString("failed")).type(),
+             QJsonRpcMessage::Error);
+    QCOMPARE(client.retriedRequestCount(), 1);
+}
+
+void TestQJsonRpcHttpServer::headersSplitAcrossReads()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+
+    // mixed case names, an unknown header with a long name, and every
+    // name and value cut in pieces
+    QByteArray body = QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("split")).toJson();
+    QByteArray request = "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                         "X-Some-Rather-Long-Unknown-Header-Name-That-Is-Skipped: value\r\n"
+                         "CONTENT-type: application/json\r\nAccept: application/json\r\n"
+                         "oRiGiN: http://example.com\r\n"
+                         "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+    for (int i = 0; i < request.size(); i += 5) {
+        socket.write(request.mid(i, 5));
+        socket.flush();
+        socket.waitForBytesWritten(100);
+        qApp->processEvents();
+    }
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (!received.contains("\"result\"") && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+    QVERIFY(received.contains("Access-Control-Allow-Origin: http://example.com\r\n"));
+    QVERIFY(received.contains("split"));
+}
+
+void TestQJsonRpcHttpServer::bodySplitAcrossReads()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+
+    QString text(4096, QLatin1Char('x'));
+    QByteArray request =
+        httpRequest(QJsonRpcMessage::createRequest("service.singleParam", text));
+    int headerEnd = request.indexOf("\r\n\r\n") + 4;
+    socket.write(request.left(headerEnd + 10));
+    socket.waitForBytesWritten(1000);
+    for (int i = headerEnd + 10; i < request.size(); i += 1000) {
+        qApp->processEvents();
+        socket.write(request.mid(i, 1000));
+        socket.waitForBytesWritten(1000);
+    }
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (!received.contains(text.toLatin1()) && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+    QVERIFY(received.contains(text.toLatin1()));
+}
+
+void TestQJsonRpcHttpServer::maximumRequestSize()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    server.setMaximumRequestSize(1024);
+    QCOMPARE(server.maximumRequestSize(), 1024);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    // small requests go through
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+    socket.write(httpRequest(QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("small"))));
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (!received.contains("\"result\"") && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+
+    // larger ones are refused from their headers and the connection closed
+    QString text(2048, QLatin1Char('x'));
+    QByteArray request = httpRequest(QJsonRpcMessage::createRequest("service.singleParam", text));
+    socket.write(request.left(request.indexOf("\r\n\r\n") + 4));
+
+    received.clear();
+    timer.restart();
+    while (socket.state() == QAbstractSocket::ConnectedState && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    received += socket.readAll();
+    QVERIFY(received.startsWith("HTTP/1.1 413 Request Entity Too Large"));
+    QVERIFY(socket.state() != QAbstractSocket::ConnectedState);
+
+    // without a maximum, bodies that couldn't even be held are refused too
+    QJsonRpcHttpServer unlimited;
+    unlimited.addService(new TestService);
+    QCOMPARE(unlimited.maximumRequestSize(), 0);
+    QVERIFY(unlimited.listen(QHostAddress::LocalHost, 8119));
+    QTcpSocket unlimitedSocket;
+    unlimitedSocket.connectToHost(QHostAddress::LocalHost, 8119);
+    QVERIFY(unlimitedSocket.waitForConnected(5000));
+    unlimitedSocket.write("POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n"
+                          "Content-Length: 2147483000\r\n\r\n");
+
+    received.clear();
+    timer.restart();
+    while (unlimitedSocket.state() == QAbstractSocket::ConnectedState && timer.elapsed() < 5000) {
+        if (unlimitedSocket.waitForReadyRead(100))
+            received += unlimitedSocket.readAll();
+    }
+
+    received += unlimitedSocket.readAll();
+    QVERIFY(received.startsWith("HTTP/1.1 413 Request Entity Too Large"));
+}
+
+void TestQJsonRpcHttpServer::compression()
+{
+    QCOMPARE(QJsonRpcCompression::crc32("123456789", 9), quint32(0xcbf43926));
+    QCOMPARE(QJsonRpcCompression::adler32("Wikipedia", 9), quint32(0x11e60398));
+
+    // gzip of "hello", as written by Python's gzip module
+    QByteArray decoded;
+    QVERIFY(QJsonRpcCompression::decompress(QByteArray::fromHex("1f8b0800000000000203cb48cdc9c9070086a6103605000000"),
+                                            QJsonRpcCompression::Gzip, &decoded));
+    QCOMPARE(decoded, QByteArray("hello"));
+
+    QByteArray data;
+    for (int i = 0; i < 100; ++i)
+        data += "{\"jsonrpc\":\"2.0\",\"id\":" + QByteArray::number(i) + ",\"result\":\"value\"}";
+    const QJsonRpcCompression::Encoding encodings[] = { QJsonRpcCompression::Gzip, QJsonRpcCompression::Deflate };
+    for (int i = 0; i < 2; ++i) {
+        const QByteArray compressed = QJsonRpcCompression::compress(data, encodings[i], 9);
+        QVERIFY(!compressed.isEmpty() && compressed.size() < data.size());
+        QVERIFY(QJsonRpcCompression::decompress(compressed, encodings[i], &decoded));
+        QCOMPARE(decoded, data);
+
+        // held to the decoded size, corrupted data is refused
+        bool sizeExceeded = false;
+        QVERIFY(!QJsonRpcCompression::decompress(compressed, encodings[i], &decoded, data.size() - 1, &sizeExceeded));
+        QVERIFY(sizeExceeded);
+        QVERIFY(!QJsonRpcCompression::decompress(compressed.left(compressed.size() - 1), encodings[i], &decoded));
+    }
+
+    QCOMPARE(QJsonRpcCompression::negotiate("gzip, deflate, br"), QJsonRpcCompression::Gzip);
+    QCOMPARE(QJsonRpcCompression::negotiate("gzip;q=0.5, deflate"), QJsonRpcCompression::Deflate);
+    QCOMPARE(QJsonRpcCompression::negotiate("gzip;q=0, *"), QJsonRpcCompression::Deflate);
+    QCOMPARE(QJsonRpcCompression::negotiate("br"), QJsonRpcCompression::Identity);
+    QCOMPARE(QJsonRpcCompression::negotiate(QByteArray()), QJsonRpcCompression::Identity);
+    QCOMPARE(QJsonRpcCompression::encodingForName("x-gzip"), QJsonRpcCompression::Gzip);
+    QCOMPARE(QJsonRpcCompression::encodingForName("br"), QJsonRpcCompression::UnknownEncoding);
+}
+
+static QByteArray encodedHttpRequest(const QByteArray &body, const QByteArray &extraHeaders)
+{
+    return "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+           "Content-Type: application/json\r\nAccept: application/json\r\n" + extraHeaders +
+           "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+}
+
+void TestQJsonRpcHttpServer::contentEncoding()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    server.setCompressionThreshold(64);
+    server.setCompressionLevel(9);
+    QCOMPARE(server.compressionThreshold(), 64);
+    QCOMPARE(server.compressionLevel(), 9);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+
+    // a gzip request body, answered with a gzip response
+    QJsonRpcMessage request =
+        QJsonRpcMessage::createRequest("service.singleParam", QString(256, QLatin1Char('x')));
+    socket.write(encodedHttpRequest(QJsonRpcCompression::compress(request.toJson(), QJsonRpcCompression::Gzip),
+                                    "Content-Encoding: gzip\r\nAccept-Encoding: deflate;q=0.5, gzip\r\n"));
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    int headerEnd = -1;
+    int contentLength = -1;
+    while ((contentLength < 0 || received.size() < headerEnd + 4 + contentLength) && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+        headerEnd = received.indexOf("\r\n\r\n");
+        const int length = received.indexOf("Content-Length: ");
+        if (headerEnd >= 0 && length >= 0)
+            contentLength = received.mid(length + 16, received.indexOf("\r\n", length) - length - 16).toInt();
+    }
+
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+    QVERIFY(received.left(headerEnd).contains("Content-Encoding: gzip"));
+    QVERIFY(received.left(headerEnd).contains("Vary: Accept-Encoding"));
+    QByteArray decoded;
+    QVERIFY(QJsonRpcCompression::decompress(received.mid(headerEnd + 4, contentLength),
+                                            QJsonRpcCompression::Gzip, &decoded));
+    QJsonRpcMessage response = QJsonRpcMessage::fromJson(decoded);
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QString(256, QLatin1Char('x')));
+
+    // responses below the threshold, or to clients not asking, go as they are
+    received.clear();
+    socket.write(encodedHttpRequest(QJsonRpcMessage::createRequest("service.noParam").toJson(),
+                                    "Accept-Encoding: gzip\r\n"));
+    timer.restart();
+    while (!received.contains("}") && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+    QVERIFY(!received.contains("Content-Encoding"));
+
+    // unknown codings are refused before the body is read
+    received.clear();
+    socket.write(encodedHttpRequest(request.toJson(), "Content-Encoding: br\r\n"));
+    timer.restart();
+    while (socket.state() == QAbstractSocket::ConnectedState && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    received += socket.readAll();
+    QVERIFY(received.startsWith("HTTP/1.1 415 Unsupported Media Type"));
+
+    // without a maximum request size, bodies still decode to 64MB at most
+    QCOMPARE(server.maximumRequestSize(), 0);
+    QTcpSocket bombSocket;
+    bombSocket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(bombSocket.waitForConnected(5000));
+    const QByteArray bomb =
+        QJsonRpcCompression::compress(QByteArray(64 * 1024 * 1024 + 1, ' '), QJsonRpcCompression::Gzip);
+    QVERIFY(!bomb.isEmpty());
+    bombSocket.write(encodedHttpRequest(bomb, "Content-Encoding: gzip\r\n"));
+    received.clear();
+    timer.restart();
+    while (bombSocket.state() == QAbstractSocket::ConnectedState && timer.elapsed() < 10000) {
+        if (bombSocket.waitForReadyRead(100))
+            received += bombSocket.readAll();
+    }
+
+    received += bombSocket.readAll();
+    QVERIFY(received.startsWith("HTTP/1.1 413 Request Entity Too Large"));
+}
+
+void TestQJsonRpcHttpServer::hpack()
+{
+    // RFC 7541, C.4: requests with Huffman coding, sharing a dynamic table
+    QJsonRpcHpackDecoder decoder;
+    QJsonRpcHttp2HeaderList headers;
+    QVERIFY(decoder.decode(QByteArray::fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), &headers));
+    QCOMPARE(headers.size(), 4);
+    QCOMPARE(headers.at(3).first, QByteArray(":authority"));
+    QCOMPARE(headers.at(3).second, QByteArray("www.example.com"));
+
+    headers.clear();
+    QVERIFY(decoder.decode(QByteArray::fromHex("828684be5886a8eb10649cbf"), &headers));
+    QCOMPARE(headers.size(), 5);
+    QCOMPARE(headers.at(3).second, QByteArray("www.example.com"));
+    QCOMPARE(headers.at(4).first, QByteArray("cache-control"));
+    QCOMPARE(headers.at(4).second, QByteArray("no-cache"));
+
+    headers.clear();
+    QVERIFY(decoder.decode(QByteArray::fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"), &headers));
+    QCOMPARE(headers.size(), 5);
+    QCOMPARE(headers.at(2).second, QByteArray("/index.html"));
+    QCOMPARE(headers.at(4).first, QByteArray("custom-key"));
+    QCOMPARE(headers.at(4).second, QByteArray("custom-value"));
+
+    // padding longer than 7 bits is an error
+    headers.clear();
+    QVERIFY(!decoder.decode(QByteArray::fromHex("0085f2b24a84ff8449509fff"), &headers));
+
+    // what the encoder writes decodes to the same, and repeated values
+    // come from the dynamic table the second time
+    QJsonRpcHpackEncoder encoder;
+    QJsonRpcHpackDecoder peer;
+    QJsonRpcHttp2HeaderList response;
+    response << qMakePair(QByteArray(":status"), QByteArray("200"))
+             << qMakePair(QByteArray("content-type"), QByteArray("application/json-rpc"))
+             << qMakePair(QByteArray("content-length"), QByteArray("42"));
+    QByteArray first;
+    encoder.encode(response, &first);
+    QByteArray second;
+    encoder.encode(response, &second);
+    QVERIFY(second.size() < first.size());
+
+    headers.clear();
+    QVERIFY(peer.decode(first, &headers));
+    QCOMPARE(headers, response);
+    headers.clear();
+    QVERIFY(peer.decode(second, &headers));
+    QCOMPARE(headers, response);
+
+    // a kilobyte entry referenced a hundred times in a few more bytes goes
+    // past a list size limit
+    QByteArray bomb = QByteArray::fromHex("400178") + QByteArray::fromHex("7fe906") +
+                      QByteArray(1000, 'v') + QByteArray(100, char(0xbe));
+    QJsonRpcHpackDecoder unlimited;
+    headers.clear();
+    QVERIFY(unlimited.decode(bomb, &headers));
+    QCOMPARE(headers.size(), 101);
+    QJsonRpcHpackDecoder limited;
+    headers.clear();
+    QVERIFY(!limited.decode(bomb, &headers, 64 * 1024));
+}
+
+static QByteArray http2Frame(int type, int flags, quint32 streamId, const QByteArray &payload)
+{
+    uchar header[9];
+    header[0] = uchar(payload.size() >> 16);
+    header[1] = uchar(payload.size() >> 8);
+    header[2] = uchar(payload.size());
+    header[3] = uchar(type);
+    header[4] = uchar(flags);
+    qToBigEndian<quint32>(streamId, header + 5);
+    return QByteArray(reinterpret_cast<const char *>(header), 9) + payload;
+}
+
+void TestQJsonRpcHttpServer::http2()
+{
+    QJsonRpcHttpServer server;
+    server.setHttp2Enabled(true);
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+
+    // prior knowledge: the preface, empty SETTINGS, then two requests on
+    // streams 1 and 3 in one go
+    QByteArray input = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    input += http2Frame(0x4, 0, 0, QByteArray());
+    QJsonRpcHpackEncoder encoder;
+    for (quint32 streamId = 1; streamId <= 3; streamId += 2) {
+        QJsonRpcHttp2HeaderList headers;
+        headers << qMakePair(QByteArray(":method"), QByteArray("POST"))
+                << qMakePair(QByteArray(":scheme"), QByteArray("http"))
+                << qMakePair(QByteArray(":path"), QByteArray("/"))
+                << qMakePair(QByteArray(":authority"), QByteArray("127.0.0.1:8118"))
+                << qMakePair(QByteArray("content-type"), QByteArray("application/json"))
+                << qMakePair(QByteArray("accept"), QByteArray("application/json"));
+        QByteArray block;
+        encoder.encode(headers, &block);
+        input += http2Frame(0x1, 0x4, streamId, block);
+
+        // with the same id, as two clients starting their ids at 1 would
+        QJsonObject request = QJsonRpcMessage::createRequest("service.singleParam",
+            QLatin1String(streamId == 1 ? "stream one" : "stream three")).toObject();
+        request.insert("id", 1);
+        input += http2Frame(0x0, 0x1, streamId, QJsonDocument(request).toJson());
+    }
+    socket.write(input);
+
+    QJsonRpcHpackDecoder decoder;
+    QHash<quint32, QByteArray> status;
+    QHash<quint32, QByteArray> bodies;
+    QSet<quint32> ended;
+    bool settingsAcknowledged = false;
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (ended.size() < 2 && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+
+        while (received.size() >= 9) {
+            const uchar *header = reinterpret_cast<const uchar *>(received.constData());
+            const int length = (header[0] << 16) | (header[1] << 8) | header[2];
+            if (received.size() < 9 + length)
+                break;
+
+            const int type = header[3];
+            const int flags = header[4];
+            const quint32 streamId = qFromBigEndian<quint32>(header + 5) & 0x7fffffff;
+            const QByteArray payload = received.mid(9, length);
+            received.remove(0, 9 + length);
+
+            if (type == 0x1) {
+                QJsonRpcHttp2HeaderList headers;
+                QVERIFY(decoder.decode(payload, &headers));
+                for (int i = 0; i < headers.size(); ++i) {
+                    if (headers.at(i).first == ":status")
+                        status.insert(streamId, headers.at(i).second);
+                }
+            } else if (type == 0x0) {
+                bodies[streamId] += payload;
+            } else if (type == 0x4 && (flags & 0x1)) {
+                settingsAcknowledged = true;
+            }
+
+            if ((type == 0x0 || type == 0x1) && (flags & 0x1))
+                ended.insert(streamId);
+        }
+    }
+
+    QVERIFY(settingsAcknowledged);
+    QCOMPARE(status.value(1), QByteArray("200"));
+    QCOMPARE(status.value(3), QByteArray("200"));
+    QVERIFY(bodies.value(1).contains("stream one"));
+    QVERIFY(bodies.value(3).contains("stream three"));
+    QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+}
+
+void TestQJsonRpcHttpServer::eventStream()
+{
+    QJsonRpcHttpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+    QSignalSpy connectedSpy(&server, SIGNAL(clientConnected()));
+    QSignalSpy disconnectedSpy(&server, SIGNAL(clientDisconnected()));
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+    socket.write("GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: text/event-stream\r\n\r\n");
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (!received.contains("\r\n\r\n") && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    QVERIFY(received.startsWith("HTTP/1.1 200 OK"));
+    QVERIFY(received.contains("Content-Type: text/event-stream"));
+    QCOMPARE(server.connectedClientCount(), 1);
+    QCOMPARE(connectedSpy.count(), 1);
+
+    // every notification becomes one event
+    received.clear();
+    server.notifyConnectedClients("test.event", QJsonArray() << QLatin1String("first"));
+    server.notifyConnectedClients("test.event", QJsonArray() << QLatin1String("second"));
+    timer.restart();
+    while (received.count("\n\n") < 2 && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+
+    QList<QByteArray> events = received.split('\n');
+    QCOMPARE(received.count("\n\n"), 2);
+    QVERIFY(events.at(0).startsWith("data: "));
+    QJsonRpcMessage first = QJsonRpcMessage::fromJson(events.at(0).mid(6));
+    QCOMPARE(first.type(), QJsonRpcMessage::Notification);
+    QCOMPARE(first.method(), QString("test.event"));
+    QVERIFY(received.indexOf("first") < received.indexOf("second"));
+
+    socket.disconnectFromHost();
+    timer.restart();
+    while (server.connectedClientCount() > 0 && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(server.connectedClientCount(), 0);
+    QCOMPARE(disconnectedSpy.count(), 1);
+}
+
+void TestQJsonRpcHttpServer::ioThreads()
+{
+    QJsonRpcHttpServer server;
+    server.setIoThreadCount(2);
+    QCOMPARE(server.ioThreadCount(), 2);
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    // the service lives in this thread, requests parsed on the I/O threads
+    // are invoked here and answered from there
+    for (int i = 0; i < 3; ++i) {
+        QJsonRpcHttpClient client;
+        client.setEndPoint("http://127.0.0.1:8118");
+        QJsonRpcMessage request =
+            QJsonRpcMessage::createRequest("service.singleParam", QString::number(i));
+        QJsonRpcMessage response = client.sendMessageBlocking(request);
+        QCOMPARE(response.type(), QJsonRpcMessage::Response);
+        QCOMPARE(response.result().toString(), QString::number(i));
+    }
+
+    server.setIoThreadCount(4);
+    QCOMPARE(server.ioThreadCount(), 2);
+
+    // notifications reach event streams of other threads
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 8118);
+    QVERIFY(socket.waitForConnected(5000));
+    socket.write("GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: text/event-stream\r\n\r\n");
+
+    QElapsedTimer timer;
+    timer.start();
+    while (server.connectedClientCount() == 0 && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        socket.waitForReadyRead(10);
+    }
+    QCOMPARE(server.connectedClientCount(), 1);
+
+    server.notifyConnectedClients("test.event", QJsonArray() << QLatin1String("threaded"));
+    QByteArray received;
+    timer.restart();
+    while (!received.contains("threaded") && timer.elapsed() < 5000) {
+        if (socket.waitForReadyRead(100))
+            received += socket.readAll();
+    }
+    QVERIFY(received.contains("data: "));
+    QVERIFY(received.contains("threaded"));
+
+    socket.disconnectFromHost();
+    timer.restart();
+    while (server.connectedClientCount() > 0 && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(server.connectedClientCount(), 0);
+}
+
 QTEST_MAIN(TestQJsonRpcHttpServer)
 #include "tst_qjsonrpchttpserver.moc"
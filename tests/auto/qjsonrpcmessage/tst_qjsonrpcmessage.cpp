@@ -15,6 +15,8 @@
  * Lesser General Public License for more details.
  */
 #include <QtCore/QVariant>
+#include <QtCore/QThread>
+#include <QtCore/QSet>
 #include <QtTest/QtTest>
 
 #if QT_VERSION >= 0x050000
@@ -24,6 +26,8 @@
 #endif
 
 #include "qjsonrpcmessage.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcpool_p.h"
 
 class TestQJsonRpcMessage: public QObject
 {
@@ -44,6 +48,22 @@ private slots:
     void equivalence();
     void withVariantListArgs();
     void idSentAsString();
+    void responseEchoesId();
+    void parseMatchesDocument_data();
+    void parseMatchesDocument();
+    void incrementalParse_data();
+    void incrementalParse();
+    void incrementalParseErrors();
+    void deferredValues();
+    void deferredValuesAcrossThreads();
+    void relayedWithOtherId();
+    void timeouts();
+    void jsonPointer_data();
+    void jsonPointer();
+    void wideIds();
+    void uniqueIdsAcrossThreads();
+    void pooledAllocation();
+    void messagesReleasedOnOtherThreads();
 };
 
 void TestQJsonRpcMessage::debugStreams_data()
@@ -95,6 +115,10 @@ void TestQJsonRpcMessage::invalidStringData_data()
     QTest::addColumn<QByteArray>("stringData");
     QTest::newRow("not-json") << QByteArray("invalid json string");
     QTest::newRow("not-an-object") << QByteArray("[\"string\"]");
+    QTest::newRow("truncated") << QByteArray("{\"jsonrpc\": \"2.0\", \"method\": \"test\"");
+    QTest::newRow("trailing-garbage") << QByteArray("{\"method\": \"test\"} x");
+    QTest::newRow("bad-escape") << QByteArray("{\"method\": \"te\\xst\"}");
+    QTest::newRow("bad-params") << QByteArray("{\"method\": \"test\", \"params\": [1,]}");
 }
 
 void TestQJsonRpcMessage::invalidStringData()
@@ -132,7 +156,7 @@ void TestQJsonRpcMessage::invalidDataResponseWithoutId()
     QJsonRpcMessage response = request.createResponse(QString());
     QCOMPARE(request.type(), QJsonRpcMessage::Invalid);
     QCOMPARE(response.type(), QJsonRpcMessage::Invalid);
-    QCOMPARE(error.id(), 0);
+    QCOMPARE(error.id(), qint64(0));
 }
 
 void TestQJsonRpcMessage::responseSameId()
@@ -148,7 +172,7 @@ void TestQJsonRpcMessage::notificationNoId()
 {
     QJsonRpcMessage notification =
         QJsonRpcMessage::createNotification("testNotification");
-    QCOMPARE(notification.id(), -1);
+    QCOMPARE(notification.id(), qint64(-1));
 }
 
 void TestQJsonRpcMessage::messageTypes()
@@ -292,7 +316,7 @@ void TestQJsonRpcMessage::withVariantListArgs()
 
     // QJsonRpcMessage::createRequest is creating objects with an unique id,
     // and to allow a random test execution order - json data must have the same id
-    int id = requestFromQJsonRpc.id();
+    qint64 id = requestFromQJsonRpc.id();
     QByteArray varListArgs = QString(varListArgsFormat).arg(id).toLatin1();
 
     QJsonRpcMessage requestFromData = QJsonRpcMessage::fromJson(varListArgs);
@@ -321,7 +345,7 @@ void TestQJsonRpcMessage::idSentAsString()
     params.append(QJsonArray::fromVariantList(firstParameter));
     QJsonRpcMessage requestFromQJsonRpc =
         QJsonRpcMessage::createRequest("service.someMethod", params);
-    int id = requestFromQJsonRpc.id();
+    qint64 id = requestFromQJsonRpc.id();
     QByteArray messageData = QString(messageWithStringId).arg(id).toLatin1();
     QJsonRpcMessage requestFromData = QJsonRpcMessage::fromJson(messageData);
 
@@ -334,5 +358,412 @@ void TestQJsonRpcMessage::idSentAsString()
     QCOMPARE(errorFromQJsonRpc, errorFromData);
 }
 
+void TestQJsonRpcMessage::responseEchoesId()
+{
+    const char *request = "{\"jsonrpc\": \"2.0\", \"method\": \"service.method\", " \
+                          "\"params\": [1], \"id\": \"42\", \"extension\": true}";
+    QJsonRpcMessage message = QJsonRpcMessage::fromJson(request);
+    QCOMPARE(message.type(), QJsonRpcMessage::Request);
+    QCOMPARE(message.id(), qint64(42));
+    QCOMPARE(message.method(), QLatin1String("service.method"));
+
+    // members the message doesn't know about are kept
+    QVERIFY(message.toObject().value(QLatin1String("extension")).toBool());
+
+    // the id is echoed as it was sent
+    QJsonObject response = message.createResponse(QLatin1String("result")).toObject();
+    QCOMPARE(response.value(QLatin1String("id")).toString(), QLatin1String("42"));
+    QCOMPARE(response.value(QLatin1String("result")).toString(), QLatin1String("result"));
+
+    QJsonRpcMessage error = message.createErrorResponse(QJsonRpc::InvalidParams, "error");
+    QJsonRpcMessage parsedError = QJsonRpcMessage::fromObject(error.toObject());
+    QCOMPARE(parsedError.type(), QJsonRpcMessage::Error);
+    QCOMPARE(parsedError.id(), qint64(42));
+    QCOMPARE(parsedError.errorCode(), int(QJsonRpc::InvalidParams));
+    QCOMPARE(parsedError.errorMessage(), QLatin1String("error"));
+}
+
+void TestQJsonRpcMessage::parseMatchesDocument_data()
+{
+    QTest::addColumn<QByteArray>("json");
+    QTest::newRow("request") << QByteArray(
+        "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"service.method\",\"params\":[1,\"two\",{\"three\":[3]}]}");
+    QTest::newRow("named-params") << QByteArray(
+        " {\n\t\"method\" : \"service.method\" , \"params\" : {\"a\": -1.5e3, \"b\": null}}\r\n");
+    QTest::newRow("escapes") << QByteArray(
+        "{\"method\":\"tab\\t quote\\\" unicode \\u00e9\\ud83d\\ude00 \\/\",\"params\":[\"\\n\"]}");
+    QTest::newRow("utf8") << QByteArray("{\"method\":\"\xc3\xa9\xe2\x82\xac\"}");
+    QTest::newRow("escaped-name") << QByteArray("{\"\\u0069d\":1,\"result\":true}");
+    QTest::newRow("string-id") << QByteArray("{\"id\":\"12\",\"result\":[]}");
+    QTest::newRow("null-error") << QByteArray("{\"id\":1,\"error\":null}");
+    QTest::newRow("error") << QByteArray(
+        "{\"id\":1,\"error\":{\"code\":-32601,\"message\":\"not found\",\"data\":{\"x\":[true,false]},\"other\":0}}");
+    QTest::newRow("unknown-members") << QByteArray(
+        "{\"extension\":{\"nested\":[[{}]]},\"id\":1.0,\"method\":\"m\",\"more\":\"\"}");
+    QTest::newRow("no-method") << QByteArray("{\"id\":1}");
+}
+
+void TestQJsonRpcMessage::parseMatchesDocument()
+{
+    QFETCH(QByteArray, json);
+    QJsonRpcMessage parsed = QJsonRpcMessage::fromJson(json);
+    QJsonRpcMessage expected =
+        QJsonRpcMessage::fromObject(QJsonDocument::fromJson(json).object());
+    QCOMPARE(parsed.type(), expected.type());
+    QCOMPARE(parsed.id(), expected.id());
+    QCOMPARE(parsed.method(), expected.method());
+    QCOMPARE(parsed.params(), expected.params());
+    QCOMPARE(parsed.result(), expected.result());
+    QCOMPARE(parsed.errorCode(), expected.errorCode());
+    QCOMPARE(parsed.errorMessage(), expected.errorMessage());
+    QCOMPARE(parsed.errorData(), expected.errorData());
+    QCOMPARE(parsed.toObject(), expected.toObject());
+}
+
+void TestQJsonRpcMessage::incrementalParse_data()
+{
+    parseMatchesDocument_data();
+}
+
+void TestQJsonRpcMessage::incrementalParse()
+{
+    QFETCH(QByteArray, json);
+    QJsonRpcMessage expected = QJsonRpcMessage::fromJson(json);
+
+    // fed one more byte at a time, from a copy that moves every time
+    QJsonRpcIncrementalParser parser;
+    QJsonRpcIncrementalParser::Status status = QJsonRpcIncrementalParser::NeedMoreData;
+    int fed = 0;
+    while (status == QJsonRpcIncrementalParser::NeedMoreData && fed < json.size()) {
+        const QByteArray received = json.left(++fed);
+        status = parser.feed(received.constData(), received.size());
+    }
+
+    QCOMPARE(status, QJsonRpcIncrementalParser::Finished);
+    QVERIFY(!parser.isBatch());
+    QCOMPARE(json.mid(parser.documentEnd()).trimmed(), QByteArray());
+    QJsonRpcMessage parsed = parser.takeMessage();
+    QCOMPARE(parsed.type(), expected.type());
+    QCOMPARE(parsed.id(), expected.id());
+    QCOMPARE(parsed.method(), expected.method());
+    QCOMPARE(parsed.params(), expected.params());
+    QCOMPARE(parsed.result(), expected.result());
+    QCOMPARE(parsed.errorCode(), expected.errorCode());
+    QCOMPARE(parsed.errorData(), expected.errorData());
+    QCOMPARE(parsed.toObject(), expected.toObject());
+
+    // and ready for the next document
+    QVERIFY(!parser.isStarted());
+    QCOMPARE(parser.feed(json.constData(), json.size()), QJsonRpcIncrementalParser::Finished);
+    QCOMPARE(parser.takeMessage().toObject(), expected.toObject());
+}
+
+void TestQJsonRpcMessage::incrementalParseErrors()
+{
+    // malformed documents fail once they have ended, so that the next one
+    // is read from there
+    const QByteArray malformed[] = {
+        "{\"id\":1,}", "{,\"id\":1}", "{\"id\" 1}", "{\"id\":1 \"method\":\"m\"}",
+        "{\"id\":tru}", "{\"params\":[1,]}", "{\"id\":1]"
+    };
+    for (uint i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        QJsonRpcIncrementalParser parser;
+        QCOMPARE(parser.feed(malformed[i].constData(), malformed[i].size() - 1),
+                 QJsonRpcIncrementalParser::NeedMoreData);
+        QCOMPARE(parser.feed(malformed[i].constData(), malformed[i].size()),
+                 QJsonRpcIncrementalParser::Failed);
+        QVERIFY(parser.parseError().error != QJsonParseError::NoError);
+        QCOMPARE(parser.documentEnd(), malformed[i].size());
+    }
+
+    QJsonRpcIncrementalParser parser;
+    const QByteArray batch("[{\"id\":1,\"method\":\"m\"},{\"method\":\"n\"}] {");
+    QCOMPARE(parser.feed(batch.constData(), batch.size()), QJsonRpcIncrementalParser::Finished);
+    QVERIFY(parser.isBatch());
+    QCOMPARE(parser.documentEnd(), batch.indexOf(']') + 1);
+
+    parser.reset();
+    const QByteArray empty("\r\n{ }");
+    QCOMPARE(parser.feed(empty.constData(), empty.size()), QJsonRpcIncrementalParser::Finished);
+    QCOMPARE(parser.documentStart(), 2);
+    QCOMPARE(parser.takeMessage().type(), QJsonRpcMessage::Invalid);
+}
+
+void TestQJsonRpcMessage::deferredValues()
+{
+    const QByteArray json(
+        "{\"jsonrpc\":\"2.0\",\"id\":7,\"method\":\"service.method\",\"params\":[1,{\"a\":\"b\"}]}");
+    QJsonRpcMessage request = QJsonRpcMessage::fromJson(json);
+    QJsonRpcMessagePrivate *d = QJsonRpcMessagePrivate::get(request);
+    QVERIFY(d->isPending(QJsonRpcMessagePrivate::ParamsPending));
+
+    // routed and forwarded as is, without decoding params
+    QCOMPARE(request.type(), QJsonRpcMessage::Request);
+    QCOMPARE(request.method(), QLatin1String("service.method"));
+    QByteArray written;
+    QJsonRpcMessagePrivate::writeJson(request, written);
+    QCOMPARE(written, json);
+    QVERIFY(d->isPending(QJsonRpcMessagePrivate::ParamsPending));
+
+    const QJsonRpcMessage copy = request;
+    QCOMPARE(copy.params(), QJsonDocument::fromJson("[1,{\"a\":\"b\"}]").array());
+    QVERIFY(!d->isPending(QJsonRpcMessagePrivate::ParamsPending));
+    QCOMPARE(request.params().toArray().at(0).toInt(), 1);
+
+    QJsonRpcMessage response = QJsonRpcMessage::fromJson("{\"id\":7,\"result\":{\"x\":[]}}");
+    QVERIFY(QJsonRpcMessagePrivate::get(response)->isPending(QJsonRpcMessagePrivate::ResultPending));
+    QCOMPARE(response.result().toObject().value("x").toArray(), QJsonArray());
+
+    // scalars are decoded right away, malformed values still reject the message
+    QJsonRpcMessage scalar = QJsonRpcMessage::fromJson("{\"id\":7,\"result\":\"done\"}");
+    QVERIFY(!QJsonRpcMessagePrivate::get(scalar)->isPending(QJsonRpcMessagePrivate::ResultPending));
+    QCOMPARE(scalar.result().toString(), QLatin1String("done"));
+    QVERIFY(!QJsonRpcMessage::fromJson("{\"id\":7,\"method\":\"m\",\"params\":[1,}").isValid());
+}
+
+void TestQJsonRpcMessage::relayedWithOtherId()
+{
+    const QByteArray json(
+        "{\"jsonrpc\":\"2.0\",\"id\": \"abc\",\"method\":\"service.method\",\"params\":[1,{\"a\":\"b\"}]}");
+    QJsonRpcMessage request = QJsonRpcMessage::fromJson(json);
+
+    // only the id is replaced in the text, params are left undecoded
+    QJsonRpcMessage relayed = QJsonRpcMessagePrivate::withId(request, QJsonValue(12345.0));
+    QCOMPARE(relayed.id(), qint64(12345));
+    QVERIFY(QJsonRpcMessagePrivate::get(relayed)->isPending(QJsonRpcMessagePrivate::ParamsPending));
+    QByteArray written;
+    QJsonRpcMessagePrivate::writeJson(relayed, written);
+    QCOMPARE(written, QByteArray(
+        "{\"jsonrpc\":\"2.0\",\"id\": 12345,\"method\":\"service.method\",\"params\":[1,{\"a\":\"b\"}]}"));
+    QCOMPARE(relayed.params(), QJsonDocument::fromJson("[1,{\"a\":\"b\"}]").array());
+
+    // and put back in the response, the original is untouched
+    QJsonRpcMessage response = QJsonRpcMessage::fromJson("{\"id\":12345,\"result\":{\"x\":[]}}");
+    response = QJsonRpcMessagePrivate::withId(response, QJsonRpcMessagePrivate::idValue(request));
+    QCOMPARE(response.result().toObject().value("x").toArray(), QJsonArray());
+    QCOMPARE(response.toObject().value("id").toString(), QLatin1String("abc"));
+    written.clear();
+    QJsonRpcMessagePrivate::writeJson(request, written);
+    QCOMPARE(written, json);
+
+    // messages built from their fields are written with the new one
+    QJsonRpcMessage built = QJsonRpcMessage::createRequest("service.method", QJsonValue(1));
+    built = QJsonRpcMessagePrivate::withId(built, QJsonValue(7.0));
+    QCOMPARE(built.toObject().value("id").toDouble(), 7.0);
+    QCOMPARE(built.params().toArray().at(0).toInt(), 1);
+}
+
+void TestQJsonRpcMessage::timeouts()
+{
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.method", QJsonValue(1));
+    QCOMPARE(QJsonRpcMessagePrivate::timeout(request), -1);
+    QCOMPARE(QJsonRpcMessagePrivate::remainingTime(request), qint64(-1));
+    QVERIFY(!QJsonRpcMessagePrivate::isExpired(request));
+
+    // counted from when the message is read
+    QJsonRpcMessage received = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"service.method\",\"timeout\":60000}");
+    QCOMPARE(QJsonRpcMessagePrivate::timeout(received), 60000);
+    QVERIFY(QJsonRpcMessagePrivate::remainingTime(received) > 0);
+    QVERIFY(QJsonRpcMessagePrivate::remainingTime(received) <= 60000);
+    received = QJsonRpcMessage::fromObject(QJsonDocument::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"service.method\",\"timeout\":0}").object());
+    QCOMPARE(QJsonRpcMessagePrivate::timeout(received), 0);
+    QVERIFY(QJsonRpcMessagePrivate::isExpired(received));
+
+    // written after the params
+    QJsonRpcMessage sent = QJsonRpcMessagePrivate::withTimeout(request, 250);
+    QCOMPARE(QJsonRpcMessagePrivate::timeout(sent), 250);
+    QCOMPARE(QJsonRpcMessagePrivate::timeout(request), -1);
+    QByteArray written;
+    QJsonRpcMessagePrivate::writeJson(sent, written);
+    QJsonRpcMessage parsed = QJsonRpcMessage::fromJson(written);
+    QCOMPARE(QJsonRpcMessagePrivate::timeout(parsed), 250);
+    QCOMPARE(parsed.params().toDouble(), 1.0);
+    QCOMPARE(sent.toObject().value("timeout").toDouble(), 250.0);
+
+    // text is written from the fields once the timeout changes
+    parsed = QJsonRpcMessagePrivate::withTimeout(parsed, 100);
+    written.clear();
+    QJsonRpcMessagePrivate::writeJson(parsed, written);
+    QVERIFY(written.contains("\"timeout\":100"));
+    QVERIFY(!written.contains("250"));
+}
+
+class ParamsReader : public QThread
+{
+public:
+    ParamsReader(const QJsonRpcMessage &message) : message(message), size(0) {}
+    const QJsonRpcMessage message;
+    int size;
+
+protected:
+    void run() {
+        size = message.params().toArray().size();
+    }
+};
+
+void TestQJsonRpcMessage::deferredValuesAcrossThreads()
+{
+    QJsonArray params;
+    for (int i = 0; i < 1000; ++i)
+        params.append(i);
+
+    for (int round = 0; round < 20; ++round) {
+        const QJsonRpcMessage request = QJsonRpcMessage::fromJson(
+            QJsonRpcMessage::createRequest("service.method", params).toJson());
+        QList<ParamsReader *> readers;
+        for (int i = 0; i < 4; ++i) {
+            readers.append(new ParamsReader(request));
+            readers.last()->start();
+        }
+
+        foreach (ParamsReader *reader, readers) {
+            QVERIFY(reader->wait(5000));
+            QCOMPARE(reader->size, 1000);
+            delete reader;
+        }
+    }
+}
+
+void TestQJsonRpcMessage::jsonPointer_data()
+{
+    QTest::addColumn<QString>("pointer");
+    QTest::addColumn<QJsonValue>("expected");
+
+    const QJsonObject params = QJsonDocument::fromJson(
+        "{\"items\":[{\"name\":\"first\"},{\"name\":\"second\",\"tags\":[1,2]}],"
+        "\"a/b\":1,\"m~n\":2,\"\\u00e9t\\u00e9\":3,\"\":4,\"dup\":5,\"dup\":6}").object();
+    QTest::newRow("whole") << QString() << QJsonValue(params);
+    QTest::newRow("member") << "/items/1/name" << QJsonValue(QLatin1String("second"));
+    QTest::newRow("nested") << "/items/1/tags/1" << QJsonValue(2);
+    QTest::newRow("structured") << "/items/0" << QJsonValue(params.value("items").toArray().at(0));
+    QTest::newRow("slash") << "/a~1b" << QJsonValue(1);
+    QTest::newRow("tilde") << "/m~0n" << QJsonValue(2);
+    QTest::newRow("unicode") << QString::fromUtf8("/\xc3\xa9t\xc3\xa9") << QJsonValue(3);
+    QTest::newRow("empty-name") << "/" << QJsonValue(4);
+    QTest::newRow("duplicate") << "/dup" << QJsonValue(6);
+    QTest::newRow("missing") << "/items/0/other" << QJsonValue(QJsonValue::Undefined);
+    QTest::newRow("past-end") << "/items/2" << QJsonValue(QJsonValue::Undefined);
+    QTest::newRow("append") << "/items/-" << QJsonValue(QJsonValue::Undefined);
+    QTest::newRow("leading-zero") << "/items/01" << QJsonValue(QJsonValue::Undefined);
+    QTest::newRow("into-scalar") << "/a~1b/c" << QJsonValue(QJsonValue::Undefined);
+    QTest::newRow("relative") << "items" << QJsonValue(QJsonValue::Undefined);
+}
+
+void TestQJsonRpcMessage::jsonPointer()
+{
+    QFETCH(QString, pointer);
+    QFETCH(QJsonValue, expected);
+
+    QJsonRpcMessage request = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"service.method\",\"params\":"
+        "{\"items\":[{\"name\":\"first\"},{\"name\":\"second\",\"tags\":[1,2]}],"
+        "\"a/b\":1,\"m~n\":2,\"\\u00e9t\\u00e9\":3,\"\":4,\"dup\":5,\"dup\":6}}");
+
+    // searched in the text, which stays undecoded
+    QCOMPARE(request.paramsValue(pointer), expected);
+    QVERIFY(QJsonRpcMessagePrivate::get(request)->isPending(QJsonRpcMessagePrivate::ParamsPending));
+
+    // and the same once decoded
+    QVERIFY(request.params().isObject());
+    QCOMPARE(request.paramsValue(pointer), expected);
+    QCOMPARE(request.resultValue(pointer), QJsonValue(QJsonValue::Undefined));
+}
+
+void TestQJsonRpcMessage::wideIds()
+{
+    QJsonRpcMessage request = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":4294967297,\"method\":\"service.method\"}");
+    QCOMPARE(request.id(), Q_INT64_C(4294967297));
+    QCOMPARE(request.createResponse(true).id(), Q_INT64_C(4294967297));
+
+    QJsonRpcMessage stringId = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":\"8589934593\",\"result\":true}");
+    QCOMPARE(stringId.id(), Q_INT64_C(8589934593));
+}
+
+class RequestCreator : public QThread
+{
+public:
+    QList<qint64> ids;
+
+protected:
+    void run() {
+        for (int i = 0; i < 1000; ++i)
+            ids.append(QJsonRpcMessage::createRequest("service.method").id());
+    }
+};
+
+void TestQJsonRpcMessage::uniqueIdsAcrossThreads()
+{
+    RequestCreator creators[4];
+    for (int i = 0; i < 4; ++i)
+        creators[i].start();
+
+    QSet<qint64> ids;
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(creators[i].wait(5000));
+        foreach (qint64 id, creators[i].ids)
+            ids.insert(id);
+    }
+    QCOMPARE(ids.size(), 4000);
+}
+
+struct PooledObject
+{
+    char data[48];
+};
+
+void TestQJsonRpcMessage::pooledAllocation()
+{
+    void *first = QJsonRpcPool<PooledObject>::allocate(sizeof(PooledObject));
+    QJsonRpcPool<PooledObject>::release(first, sizeof(PooledObject));
+    void *second = QJsonRpcPool<PooledObject>::allocate(sizeof(PooledObject));
+#if defined(QJSONRPC_HAS_THREAD_LOCAL)
+    QCOMPARE(second, first);
+#endif
+
+    // other sizes are never kept
+    void *larger = QJsonRpcPool<PooledObject>::allocate(sizeof(PooledObject) * 2);
+    QJsonRpcPool<PooledObject>::release(larger, sizeof(PooledObject) * 2);
+    QJsonRpcPool<PooledObject>::release(second, sizeof(PooledObject));
+}
+
+class MessageReleaser : public QThread
+{
+public:
+    QList<QJsonRpcMessage> messages;
+
+protected:
+    void run() {
+        messages.clear();
+        for (int i = 0; i < 1000; ++i)
+            messages.append(QJsonRpcMessage::createNotification("service.method"));
+    }
+};
+
+void TestQJsonRpcMessage::messagesReleasedOnOtherThreads()
+{
+    QList<QJsonRpcMessage> created;
+    for (int i = 0; i < 1000; ++i)
+        created.append(QJsonRpcMessage::createRequest("service.method", QJsonValue(i)));
+
+    MessageReleaser releaser;
+    releaser.messages = created;
+    created.clear();
+    releaser.start();
+    QVERIFY(releaser.wait(5000));
+
+    // messages allocated by the finished thread are released here
+    QCOMPARE(releaser.messages.size(), 1000);
+    QCOMPARE(releaser.messages.last().method(), QLatin1String("service.method"));
+    releaser.messages.clear();
+
+    for (int i = 0; i < 1000; ++i)
+        created.append(QJsonRpcMessage::createRequest("service.method", QJsonValue(i)));
+    QCOMPARE(created.last().params().toInt(), 999);
+}
+
 QTEST_MAIN(TestQJsonRpcMessage)
 #include "tst_qjsonrpcmessage.moc"
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef CALCULATORSERVICE_H
+#define CALCULATORSERVICE_H
+
+#include <QStringList>
+
+#include "qjsonrpcservice.h"
+
+class CalculatorService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "calculator")
+public:
+    explicit CalculatorService(QObject *parent = 0)
+        : QJsonRpcService(parent), pings(0) {}
+
+    int pings;
+
+public Q_SLOTS:
+    int add(int first, int second) const { return first + second; }
+    double scale(double value, double factor = 2.0) const { return value * factor; }
+    QString greet(const QString &name = QString("world")) const
+    {
+        return QLatin1String("hello ") + name;
+    }
+    QStringList split(const QString &text) const { return text.split(QLatin1Char(' ')); }
+    QVariantMap describe(const QVariantMap &values, bool flag) const
+    {
+        QVariantMap result = values;
+        result.insert("flag", flag);
+        return result;
+    }
+    void ping() { pings++; }
+
+    // left out of the proxy
+    void divide(int dividend, int divisor, int &quotient) { quotient = dividend / divisor; }
+
+Q_SIGNALS:
+    void pinged();
+
+private Q_SLOTS:
+    void internal() {}
+};
+
+#endif
@@ -0,0 +1,14 @@
+DEPTH = ../../..
+include($${DEPTH}/qjsonrpc.pri)
+include($${DEPTH}/tests/tests.pri)
+
+TARGET = tst_qjsonrpcproxy
+HEADERS = \
+    calculatorservice.h
+SOURCES = \
+    tst_qjsonrpcproxy.cpp
+
+# the stub is generated by the tool built along with the library
+QJSONRPC_PROXYGEN = $${OUT_PWD}/$${DEPTH}/tools/qjsonrpc-proxygen/qjsonrpc-proxygen
+JSONRPC_PROXIES += calculatorservice.h
+include($${DEPTH}/tools/qjsonrpc-proxygen/qjsonrpc-proxygen.pri)
@@ -0,0 +1,106 @@
+#include <QtCore/QEventLoop>
+#include <QtCore/QVariant>
+#include <QtTest/QtTest>
+
+#include "qjsonrpcinprocesssocket.h"
+#include "qjsonrpcproxy.h"
+#include "calculatorservice.h"
+#include "calculatorservice_proxy.h"
+
+class TestQJsonRpcProxy: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void typedCalls();
+    void defaultArguments();
+    void asyncCalls();
+    void errors();
+
+private:
+    QJsonRpcInProcessServiceSocket *serviceSocket;
+    QJsonRpcInProcessSocket *client;
+    CalculatorService *service;
+
+};
+
+void TestQJsonRpcProxy::init()
+{
+    serviceSocket = new QJsonRpcInProcessServiceSocket;
+    service = new CalculatorService;
+    QVERIFY(serviceSocket->addService(service));
+    client = new QJsonRpcInProcessSocket;
+    client->setPeer(serviceSocket);
+}
+
+void TestQJsonRpcProxy::cleanup()
+{
+    delete client;
+    delete serviceSocket;
+}
+
+void TestQJsonRpcProxy::typedCalls()
+{
+    CalculatorServiceProxy calculator(client);
+    QCOMPARE(calculator.socket(), static_cast<QJsonRpcAbstractSocket *>(client));
+
+    QJsonRpcResult<int> sum = calculator.add(40, 2);
+    QVERIFY(sum.isValid());
+    QCOMPARE(sum.value(), 42);
+    QCOMPARE(sum.response().type(), QJsonRpcMessage::Response);
+
+    QCOMPARE(calculator.split("one two three").value(),
+             QStringList() << "one" << "two" << "three");
+
+    QVariantMap values;
+    values.insert("key", QLatin1String("value"));
+    QVariantMap described = calculator.describe(values, true).value();
+    QCOMPARE(described.value("key").toString(), QLatin1String("value"));
+    QVERIFY(described.value("flag").toBool());
+
+    QJsonRpcResult<void> pinged = calculator.ping();
+    QVERIFY(pinged.isValid());
+    QCOMPARE(service->pings, 1);
+}
+
+void TestQJsonRpcProxy::defaultArguments()
+{
+    CalculatorServiceProxy calculator(client);
+    QCOMPARE(calculator.scale(1.5).value(), 3.0);
+    QCOMPARE(calculator.scale(1.5, 3.0).value(), 4.5);
+    QCOMPARE(calculator.greet().value(), QLatin1String("hello world"));
+    QCOMPARE(calculator.greet("proxy").value(), QLatin1String("hello proxy"));
+}
+
+void TestQJsonRpcProxy::asyncCalls()
+{
+    CalculatorServiceProxy calculator(client);
+    QScopedPointer<QJsonRpcServiceReply> reply(calculator.addAsync(1, 2));
+    QVERIFY(reply);
+    QCOMPARE(reply->request().method(), QLatin1String("calculator.add"));
+
+    QSignalSpy spyFinished(reply.data(), SIGNAL(finished()));
+    QElapsedTimer timer;
+    timer.start();
+    while (spyFinished.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(QJsonRpcResult<int>(reply->response()).value(), 3);
+}
+
+void TestQJsonRpcProxy::errors()
+{
+    // an end that doesn't answer lets calls time out
+    QJsonRpcInProcessSocket silent;
+    QJsonRpcInProcessSocket unanswered;
+    unanswered.setPeer(&silent);
+    CalculatorServiceProxy calculator(&unanswered);
+    calculator.setTimeout(50);
+    QJsonRpcResult<int> sum = calculator.add(1, 2);
+    QVERIFY(!sum.isValid());
+    QCOMPARE(sum.response().errorCode(), int(QJsonRpc::TimeoutError));
+}
+
+QTEST_MAIN(TestQJsonRpcProxy)
+#include "tst_qjsonrpcproxy.moc"
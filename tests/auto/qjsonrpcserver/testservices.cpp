@@ -17,6 +17,7 @@
 #include <QEventLoop>
 #include <QTimer>
 #include <QDebug>
+#include <QThread>
 #include <QtTest>
 
 #include "qjsonrpcsocket.h"
@@ -160,6 +161,12 @@ QJsonObject TestService::returnQJsonObject()
     return object;
 }
 
+double TestService::remainingTime()
+{
+    m_called++;
+    return double(currentRequest().remainingTime());
+}
+
 QVariantMap TestService::hugeResponse()
 {
     QVariantMap result;
@@ -223,11 +230,65 @@ void TestDelayedResponseService::delayedResponseWithClosedSocket()
     QTimer::singleShot(250, this, SLOT(delayedResponseWithClosedSocketComplete()));
 }
 
+void TestDelayedResponseService::signalledResponse()
+{
+    beginDelayedResponse();
+    m_request = currentRequest();
+    QTimer::singleShot(0, this, SLOT(signalledResponseComplete()));
+}
+
+void TestDelayedResponseService::signalledResponseComplete()
+{
+    Q_EMIT result(m_request.request().createResponse(QLatin1String("signalled")));
+}
+
+void TestDelayedResponseService::sharedIdResponse()
+{
+    beginDelayedResponse();
+    m_sharedIdRequests.append(currentRequest());
+    if (m_sharedIdRequests.size() == 2)
+        QTimer::singleShot(0, this, SLOT(sharedIdResponseComplete()));
+}
+
+void TestDelayedResponseService::sharedIdResponseComplete()
+{
+    // both requests have the id, neither may get this
+    Q_EMIT result(m_sharedIdRequests.first().request().createResponse(QLatin1String("signalled")));
+    for (int i = 0; i < m_sharedIdRequests.size(); ++i) {
+        QJsonRpcServiceRequest request = m_sharedIdRequests.at(i);
+        request.respond(request.request().createResponse(QString::number(i)));
+    }
+    m_sharedIdRequests.clear();
+}
+
+void TestDelayedResponseService::streamedResponse(int parts)
+{
+    beginDelayedResponse();
+    m_request = currentRequest();
+    for (int i = 0; i < parts; ++i)
+        m_request.sendPartialResult(i);
+    QTimer::singleShot(0, this, SLOT(delayedResponseComplete()));
+}
+
 QString TestDelayedResponseService::immediateResponse()
 {
     return QLatin1String("immediate");
 }
 
+QFuture<QVariant> TestDelayedResponseService::futureResponse()
+{
+    m_futureResponse = QFutureInterface<QVariant>();
+    m_futureResponse.reportStarted();
+    QTimer::singleShot(250, this, SLOT(futureResponseComplete()));
+    return m_futureResponse.future();
+}
+
+void TestDelayedResponseService::futureResponseComplete()
+{
+    QVariant result(QLatin1String("future"));
+    m_futureResponse.reportFinished(&result);
+}
+
 void TestDelayedResponseService::delayedResponseComplete()
 {
     m_request.respond(QLatin1String("delayed"));
@@ -240,3 +301,71 @@ void TestDelayedResponseService::delayedResponseWithClosedSocketComplete()
     bool result = m_request.respond(responseMessage);
     Q_EMIT responseResult(result);
 }
+
+TestThreadPoolService::TestThreadPoolService(QThread *dispatchThread, QObject *parent)
+    : QJsonRpcService(parent),
+      m_dispatchThread(dispatchThread),
+      m_active(0),
+      m_maximumActive(0)
+{
+}
+
+int TestThreadPoolService::active() const
+{
+#if QT_VERSION >= 0x050000
+    return m_active.load();
+#else
+    return m_active;
+#endif
+}
+
+int TestThreadPoolService::maximumActive() const
+{
+#if QT_VERSION >= 0x050000
+    return m_maximumActive.load();
+#else
+    return m_maximumActive;
+#endif
+}
+
+bool TestThreadPoolService::dispatchedOnPool() const
+{
+    return QThread::currentThread() != m_dispatchThread;
+}
+
+int TestThreadPoolService::slowMethod(int value)
+{
+    int active = m_active.fetchAndAddOrdered(1) + 1;
+    int maximum = maximumActive();
+    while (active > maximum && !m_maximumActive.testAndSetOrdered(maximum, active))
+        maximum = maximumActive();
+
+    QTest::qSleep(50);
+    m_active.fetchAndAddOrdered(-1);
+
+    // the request must not have been replaced by a concurrent one
+    if (currentRequest().request().params().toArray().at(0).toInt() != value)
+        return -1;
+    return value;
+}
+
+QList<int> TestThreadPoolService::completed() const
+{
+    QMutexLocker locker(&m_completedMutex);
+    return m_completed;
+}
+
+int TestThreadPoolService::urgentMethod(int value)
+{
+    QMutexLocker locker(&m_completedMutex);
+    m_completed.append(value);
+    return value;
+}
+
+int TestThreadPoolService::bulkMethod(int value)
+{
+    QTest::qSleep(10);
+    QMutexLocker locker(&m_completedMutex);
+    m_completed.append(value);
+    return value;
+}
@@ -17,6 +17,10 @@
 #ifndef TESTSERVICES_H
 #define TESTSERVICES_H
 
+#include <QAtomicInt>
+#include <QMutex>
+#include <QFutureInterface>
+
 #include "qjsonrpcservice.h"
 
 class TestService : public QJsonRpcService
@@ -60,6 +64,9 @@ public Q_SLOTS:
     QJsonArray returnQJsonArray();
     QJsonObject returnQJsonObject();
 
+    // of the request's deadline, -1 without one
+    double remainingTime();
+
 private:
     int m_called;
 
@@ -100,14 +107,51 @@ Q_SIGNALS:
 public Q_SLOTS:
     void delayedResponse();
     void delayedResponseWithClosedSocket();
+    void signalledResponse();
+    void sharedIdResponse();
+    void streamedResponse(int parts);
     QString immediateResponse();
+    QFuture<QVariant> futureResponse();
 
 private Q_SLOTS:
     void delayedResponseComplete();
     void delayedResponseWithClosedSocketComplete();
+    void signalledResponseComplete();
+    void sharedIdResponseComplete();
+    void futureResponseComplete();
 
 private:
     QJsonRpcServiceRequest m_request;
+    QList<QJsonRpcServiceRequest> m_sharedIdRequests;
+    QFutureInterface<QVariant> m_futureResponse;
+
+};
+
+class TestThreadPoolService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "service")
+    Q_CLASSINFO("highPriority", "urgentMethod")
+    Q_CLASSINFO("lowPriority", "bulkMethod")
+public:
+    TestThreadPoolService(QThread *dispatchThread, QObject *parent = 0);
+
+    int active() const;
+    int maximumActive() const;
+    QList<int> completed() const;
+
+public Q_SLOTS:
+    bool dispatchedOnPool() const;
+    int slowMethod(int value);
+    int urgentMethod(int value);
+    int bulkMethod(int value);
+
+private:
+    QThread *m_dispatchThread;
+    QAtomicInt m_active;
+    QAtomicInt m_maximumActive;
+    mutable QMutex m_completedMutex;
+    QList<int> m_completed;
 
 };
 
@@ -14,12 +14,17 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
  * Lesser General Public License for more details.
  */
+#include <QLocalServer>
 #include <QLocalSocket>
 #include <QTcpSocket>
 #include <QScopedPointer>
 
 #include <QtCore/QEventLoop>
 #include <QtCore/QVariant>
+#include <QtCore/QThreadPool>
+#include <QtCore/QThread>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSharedMemory>
 #include <QtTest/QtTest>
 
 #if QT_VERSION >= 0x050000
@@ -33,11 +38,101 @@
 #include "qjsonrpctcpserver.h"
 #include "qjsonrpchttpserver.h"
 #include "qjsonrpchttpclient.h"
+#include "qjsonrpcwebsocketserver.h"
+#include "qjsonrpcwebsocket.h"
+#include "qjsonrpcsharedmemorydevice.h"
 #include "qjsonrpcsocket.h"
+#include "qjsonrpcthreadedsocket.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpcservicereply.h"
+#include "qjsonrpccompression_p.h"
 #include "testservices.h"
 
+// makes blocking calls without an event loop of its own
+class BlockingCallThread : public QThread
+{
+public:
+    BlockingCallThread(QJsonRpcAbstractSocket *socket, int index)
+        : socket(socket), index(index) {}
+
+    QList<QJsonRpcMessage> requests;
+    QList<QJsonRpcMessage> responses;
+
+protected:
+    void run() {
+        for (int i = 0; i < 5; ++i) {
+            QString param = QString("%1-%2").arg(index).arg(i);
+            QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.singleParam", param);
+            requests.append(request);
+            responses.append(socket->sendMessageBlocking(request, 5000));
+        }
+    }
+
+private:
+    QJsonRpcAbstractSocket *socket;
+    int index;
+};
+
+// logs both hooks, and answers requests for one method itself
+class TestInterceptor : public QJsonRpcInterceptor
+{
+public:
+    TestInterceptor(const QString &name, QStringList *log, QMutex *mutex,
+                    const QString &answered = QString())
+        : name(name), log(log), mutex(mutex), answered(answered) {}
+
+    QJsonRpcMessage beforeDispatch(QJsonRpcCallContext &context) {
+        QMutexLocker locker(mutex);
+        log->append(name + " before " + context.request().method());
+        context.setAttribute(name, context.startTime());
+        if (context.request().method() == answered)
+            return context.request().createErrorResponse(QJsonRpc::InvalidRequest, "answered");
+        return QJsonRpcMessage();
+    }
+
+    void afterDispatch(const QJsonRpcCallContext &context, const QJsonRpcMessage &response) {
+        QMutexLocker locker(mutex);
+        QString entry = name + " after " + context.request().method();
+        if (response.type() == QJsonRpcMessage::Error)
+            entry += " error";
+        if (context.attribute(name).toLongLong() != context.startTime() || context.elapsed() < 0)
+            entry += " without context";
+        log->append(entry);
+    }
+
+private:
+    QString name;
+    QStringList *log;
+    QMutex *mutex;
+    QString answered;
+};
+
+#if defined(QJSONRPC_HAS_COROUTINES)
+// runs until its first co_await right away, and is never awaited itself
+struct TestCoroutine
+{
+    struct promise_type
+    {
+        TestCoroutine get_return_object() { return TestCoroutine(); }
+        std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static TestCoroutine chainedCalls(QJsonRpcAbstractSocket *socket, QList<QJsonRpcMessage> *responses)
+{
+    QJsonRpcMessage first = co_await socket->call("service.immediateResponse");
+    responses->append(first);
+    if (first.type() != QJsonRpcMessage::Response)
+        co_return;
+
+    responses->append(co_await socket->call("service.delayedResponse"));
+    responses->append(co_await socket->call("service.delayedResponse").timeout(50));
+}
+#endif
+
 class TestQJsonRpcServer: public QObject
 {
     Q_OBJECT
@@ -47,7 +142,9 @@ public:
     enum ServerType {
         TcpServer,
         LocalServer,
-        HttpServer
+        HttpServer,
+        WebSocketServer,
+        SharedMemoryServer
     };
 
 private Q_SLOTS:
@@ -68,6 +165,8 @@ private Q_SLOTS:
     void invalidRequest();
     void notifyConnectedClients_data();
     void notifyConnectedClients();
+    void notifyManyClients();
+    void topicSubscriptions();
     void numberParameters();
     void hugeResponse();
     void complexMethod();
@@ -75,6 +174,7 @@ private Q_SLOTS:
     void overloadedMethod();
     void qVariantMapInvalidParam();
     void stringListParameter();
+    void typedAndNamedParameters();
     void outputParameter();
 #if QT_VERSION >= 0x050200
     void jsonReturnTypes();
@@ -82,7 +182,34 @@ private Q_SLOTS:
     void notifyServiceSocket();
     void userDeletesReplyOnDelayedResponse();
     void delayedResponseBasic();
+    void signalledResponse();
+    void signalledResponseSharedId();
     void delayedResponseSocketClosed();
+    void futureResponse();
+    void admissionControl();
+    void methodMetrics();
+    void interceptors();
+    void cancelDelayedResponse();
+    void deadlinePropagation();
+    void streamedResponse();
+    void batchRequest();
+    void batchRequestMatching();
+    void threadPoolDispatch();
+    void priorityDispatch();
+    void threadPoolShutdown();
+    void blockingCallsFromWorkerThreads();
+    void threadedSocket();
+    void coroutineCalls();
+    void tcpServerIoThreads();
+    void connectionMemoryLimits();
+    void broadcastPastMemoryLimit();
+    void idleConnections();
+    void gatewayBackends();
+    void webSocketHandshake();
+    void webSocketCompression();
+    void sharedMemoryDoorbells();
+    void sharedMemoryFallback();
+    void sharedMemoryCorruptedRing();
 
     void addRemoveService();
     void serviceWithNoGivenName();
@@ -91,6 +218,8 @@ private Q_SLOTS:
 
 private:
     QJsonRpcAbstractSocket *createClient();
+    QObject *serverObject() const;
+    void writeRaw(const QByteArray &json);     // through the client's connection
 
     // client related
     QScopedPointer<QJsonRpcAbstractSocket> clientSocket;
@@ -103,9 +232,11 @@ private:
     QScopedPointer<QJsonRpcTcpServer> tcpServer;
     QScopedPointer<QJsonRpcLocalServer> localServer;
     QScopedPointer<QJsonRpcHttpServer> httpServer;
+    QScopedPointer<QJsonRpcWebSocketServer> webSocketServer;
 
     quint16 tcpServerPort;
     quint16 httpServerPort;
+    quint16 webSocketServerPort;
 
 private:
     // temporarily disabled
@@ -125,6 +256,8 @@ void TestQJsonRpcServer::initTestCase_data()
     QTest::newRow("tcp") << TcpServer;
     QTest::newRow("local") << LocalServer;
     QTest::newRow("http") << HttpServer;
+    QTest::newRow("websocket") << WebSocketServer;
+    QTest::newRow("sharedmemory") << SharedMemoryServer;
 }
 
 void TestQJsonRpcServer::initTestCase()
@@ -138,12 +271,35 @@ void TestQJsonRpcServer::cleanupTestCase()
     QVERIFY(serverThread.wait());
 }
 
+void TestQJsonRpcServer::writeRaw(const QByteArray &json)
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    QByteArray data = json;
+    if (serverType == WebSocketServer) {
+        // one text frame, masked with a key of zeros to leave it readable
+        QByteArray frame;
+        frame.append(char(0x81));
+        frame.append(char(0x80 | 126));
+        frame.append(char(data.size() >> 8));
+        frame.append(char(data.size()));
+        frame.append(QByteArray(4, 0));
+        data.prepend(frame);
+    }
+
+    if (serverType == TcpServer || serverType == WebSocketServer)
+        tcpSockets.first()->write(data);
+    else if (serverType == LocalServer)
+        localSockets.first()->write(data);
+    else if (serverType == SharedMemoryServer)
+        localSockets.first()->findChild<QJsonRpcSharedMemoryDevice*>()->write(data);
+}
+
 QJsonRpcAbstractSocket *TestQJsonRpcServer::createClient()
 {
     QFETCH_GLOBAL(ServerType, serverType);
 
     QJsonRpcAbstractSocket *socket = 0;
-    if (serverType == LocalServer) {
+    if (serverType == LocalServer || serverType == SharedMemoryServer) {
         QLocalSocket *localSocket = new QLocalSocket;
         connect(localServer.data(), SIGNAL(clientConnected()),
                 &QTestEventLoop::instance(), SLOT(exitLoop()));
@@ -154,7 +310,11 @@ QJsonRpcAbstractSocket *TestQJsonRpcServer::createClient()
             return 0;
         }
 
-        socket = new QJsonRpcSocket(localSocket);
+        QIODevice *device = localSocket;
+        if (serverType == SharedMemoryServer)
+            device = new QJsonRpcSharedMemoryDevice(localSocket, QJsonRpcSharedMemoryDevice::ClientRole,
+                                                    0, localSocket);
+        socket = new QJsonRpcSocket(device);
         localSockets.append(localSocket);
     } else if (serverType == TcpServer) {
         QTcpSocket *tcpSocket = new QTcpSocket;
@@ -173,16 +333,52 @@ QJsonRpcAbstractSocket *TestQJsonRpcServer::createClient()
         QJsonRpcHttpClient *client = new QJsonRpcHttpClient;
         client->setEndPoint("http://127.0.0.1:" + QString::number(httpServerPort));
         socket = client;
+    } else if (serverType == WebSocketServer) {
+        QTcpSocket *tcpSocket = new QTcpSocket;
+        connect(webSocketServer.data(), SIGNAL(clientConnected()),
+                &QTestEventLoop::instance(), SLOT(exitLoop()));
+        tcpSocket->connectToHost(QHostAddress::LocalHost, webSocketServerPort);
+        QUrl url("ws://127.0.0.1:" + QString::number(webSocketServerPort) + "/rpc");
+        QJsonRpcWebSocket *webSocket = new QJsonRpcWebSocket(tcpSocket, url);
+        QTestEventLoop::instance().enterLoop(5);
+        if (QTestEventLoop::instance().timeout()) {
+            delete webSocket;
+            delete tcpSocket;
+            return 0;
+        }
+
+        socket = webSocket;
+        tcpSockets.append(tcpSocket);
     }
 
     return socket;
 }
 
+QObject *TestQJsonRpcServer::serverObject() const
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    switch (serverType) {
+    case TcpServer:
+        return tcpServer.data();
+    case LocalServer:
+    case SharedMemoryServer:
+        return localServer.data();
+    case HttpServer:
+        return httpServer.data();
+    case WebSocketServer:
+        return webSocketServer.data();
+    }
+
+    return 0;
+}
+
 void TestQJsonRpcServer::init()
 {
     QFETCH_GLOBAL(ServerType, serverType);
-    if (serverType == LocalServer) {
+    if (serverType == LocalServer || serverType == SharedMemoryServer) {
         localServer.reset(new QJsonRpcLocalServer);
+        if (serverType == SharedMemoryServer)
+            localServer->setSharedMemoryRingSize(64 * 1024);
         QVERIFY(localServer->listen("qjsonrpc-test-local-server"));
         localServer->moveToThread(&serverThread);
         server = localServer.data();
@@ -198,23 +394,29 @@ void TestQJsonRpcServer::init()
         QVERIFY(httpServer->listen(QHostAddress::LocalHost, httpServerPort));
         httpServer->moveToThread(&serverThread);
         server = httpServer.data();
+    } else if (serverType == WebSocketServer) {
+        webSocketServer.reset(new QJsonRpcWebSocketServer);
+        webSocketServerPort = quint16(9219 + qrand() % 1000);
+        QVERIFY(webSocketServer->listen(QHostAddress::LocalHost, webSocketServerPort));
+        webSocketServer->moveToThread(&serverThread);
+        server = webSocketServer.data();
     }
 
     clientSocket.reset(createClient());
     QVERIFY(!clientSocket.isNull());
 
-    if (serverType == LocalServer || serverType == TcpServer)
+    if (serverType != HttpServer)
         QCOMPARE(server->connectedClientCount(), 1);
 }
 
 void TestQJsonRpcServer::cleanup()
 {
     QFETCH_GLOBAL(ServerType, serverType);
-    if (serverType == TcpServer) {
+    if (serverType == TcpServer || serverType == WebSocketServer) {
         // disconnect clients
         while (!tcpSockets.isEmpty()) {
             QTcpSocket *tcpSocket = tcpSockets.takeFirst();
-            connect(tcpServer.data(), SIGNAL(clientDisconnected()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+            connect(serverObject(), SIGNAL(clientDisconnected()), &QTestEventLoop::instance(), SLOT(exitLoop()));
             if (tcpSocket->state() == QAbstractSocket::ConnectedState) {
                 tcpSocket->disconnectFromHost();
                 QTestEventLoop::instance().enterLoop(5);
@@ -225,8 +427,8 @@ void TestQJsonRpcServer::cleanup()
         }
 
         // close server
-        tcpServer->close();
-    } else if (serverType == LocalServer) {
+        static_cast<QTcpServer*>(serverObject())->close();
+    } else if (serverType == LocalServer || serverType == SharedMemoryServer) {
         // disconnect clients
         while (!localSockets.isEmpty()) {
             QLocalSocket *localSocket = localSockets.takeFirst();
@@ -505,17 +707,11 @@ void TestQJsonRpcServer::notifyConnectedClients()
             break;
         }
 
-        if (serverType == TcpServer)
-            QMetaObject::invokeMethod(tcpServer.data(), "notifyConnectedClients", Q_ARG(QJsonRpcMessage, message));
-        else if (serverType == LocalServer)
-            QMetaObject::invokeMethod(localServer.data(), "notifyConnectedClients", Q_ARG(QJsonRpcMessage, message));
+        QMetaObject::invokeMethod(serverObject(), "notifyConnectedClients", Q_ARG(QJsonRpcMessage, message));
 
         // server->notifyConnectedClients(message);
     } else {
-        if (serverType == TcpServer)
-            QMetaObject::invokeMethod(tcpServer.data(), "notifyConnectedClients", Q_ARG(QString, method), Q_ARG(QJsonArray, parameters));
-        else if (serverType == LocalServer)
-            QMetaObject::invokeMethod(localServer.data(), "notifyConnectedClients", Q_ARG(QString, method), Q_ARG(QJsonArray, parameters));
+        QMetaObject::invokeMethod(serverObject(), "notifyConnectedClients", Q_ARG(QString, method), Q_ARG(QJsonArray, parameters));
         // server->notifyConnectedClients(method, parameters);
     }
 
@@ -532,6 +728,101 @@ void TestQJsonRpcServer::notifyConnectedClients()
     }
 }
 
+void TestQJsonRpcServer::notifyManyClients()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QList<QJsonRpcAbstractSocket*> clients;
+    clients.append(clientSocket.data());
+    QScopedPointer<QJsonRpcAbstractSocket> second(createClient());
+    QScopedPointer<QJsonRpcAbstractSocket> third(createClient());
+    QVERIFY(second && third);
+    clients << second.data() << third.data();
+    QCOMPARE(server->connectedClientCount(), 3);
+
+    QList<QSignalSpy*> spies;
+    for (int i = 0; i < clients.size(); ++i)
+        spies.append(new QSignalSpy(clients.at(i), SIGNAL(messageReceived(QJsonRpcMessage))));
+
+    QJsonArray parameters;
+    parameters.append(QLatin1String("shared"));
+    QJsonRpcMessage message = QJsonRpcMessage::createNotification("testNotification", parameters);
+    QMetaObject::invokeMethod(serverObject(), "notifyConnectedClients", Q_ARG(QJsonRpcMessage, message));
+
+    QElapsedTimer timer;
+    timer.start();
+    bool received = false;
+    while (!received && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        received = true;
+        for (int i = 0; i < spies.size(); ++i)
+            received = received && spies.at(i)->count() == 1;
+    }
+
+    for (int i = 0; i < spies.size(); ++i) {
+        QCOMPARE(spies.at(i)->count(), 1);
+        QCOMPARE(spies.at(i)->takeFirst().first().value<QJsonRpcMessage>(), message);
+    }
+    qDeleteAll(spies);
+}
+
+void TestQJsonRpcServer::topicSubscriptions()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QScopedPointer<QJsonRpcAbstractSocket> other(createClient());
+    QVERIFY(other);
+
+    QJsonArray topics;
+    topics.append(QLatin1String("news"));
+    QJsonRpcMessage response = clientSocket->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.subscribe", topics));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result(), QJsonValue(true));
+    QCOMPARE(server->subscriberCount("news"), 1);
+
+    response = clientSocket->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.subscribe", QJsonValue(QLatin1String("news"))));
+    QCOMPARE(response.type(), QJsonRpcMessage::Error);
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+
+    QSignalSpy subscriberSpy(clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+    QSignalSpy otherSpy(other.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+    QJsonRpcMessage news = QJsonRpcMessage::createNotification("news.update");
+    QJsonRpcMessage weather = QJsonRpcMessage::createNotification("weather.update");
+    QMetaObject::invokeMethod(serverObject(), "notifySubscribers",
+                              Q_ARG(QString, "weather"), Q_ARG(QJsonRpcMessage, weather));
+    QMetaObject::invokeMethod(serverObject(), "notifySubscribers",
+                              Q_ARG(QString, "news"), Q_ARG(QJsonRpcMessage, news));
+
+    QElapsedTimer timer;
+    timer.start();
+    while (subscriberSpy.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(subscriberSpy.count(), 1);
+    QCOMPARE(subscriberSpy.takeFirst().first().value<QJsonRpcMessage>(), news);
+    QCOMPARE(otherSpy.count(), 0);
+
+    response = clientSocket->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.unsubscribe", topics));
+    QCOMPARE(response.result(), QJsonValue(true));
+    QCOMPARE(server->subscriberCount("news"), 0);
+}
+
 void TestQJsonRpcServer::numberParameters()
 {
     TestService *service = new TestService;
@@ -605,12 +896,23 @@ void TestQJsonRpcServer::notifyServiceSocket()
 #endif
     }
 
+    if (serverType == WebSocketServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not applicable for WebSocket connections");
+#else
+        QSKIP("Not applicable for WebSocket connections", SkipAll);
+#endif
+    }
+
     QScopedPointer<QJsonRpcServiceSocket> serviceSocket;
     clientSocket.reset();   // we only want a service socket, this would override that
     if (serverType == TcpServer) {
         serviceSocket.reset(new QJsonRpcServiceSocket(tcpSockets.first()));
     } else if (serverType == LocalServer) {
         serviceSocket.reset(new QJsonRpcServiceSocket(localSockets.first()));
+    } else if (serverType == SharedMemoryServer) {
+        serviceSocket.reset(new QJsonRpcServiceSocket(
+            localSockets.first()->findChild<QJsonRpcSharedMemoryDevice*>()));
     }
 
     TestService *service = new TestService;
@@ -624,7 +926,7 @@ void TestQJsonRpcServer::notifyServiceSocket()
     QJsonRpcMessage notification = QJsonRpcMessage::createNotification("service.numberParameters", params);
     if (serverType == TcpServer)
         QMetaObject::invokeMethod(tcpServer.data(), "notifyConnectedClients", Q_ARG(QJsonRpcMessage, notification));
-    else if (serverType == LocalServer)
+    else
         QMetaObject::invokeMethod(localServer.data(), "notifyConnectedClients", Q_ARG(QJsonRpcMessage, notification));
     QTestEventLoop::instance().enterLoop(5);
     QVERIFY(!QTestEventLoop::instance().timeout());
@@ -664,6 +966,32 @@ void TestQJsonRpcServer::stringListParameter()
     QVERIFY(response.result().toBool());
 }
 
+void TestQJsonRpcServer::typedAndNamedParameters()
+{
+    QVERIFY(server->addService(new TestService));
+
+    QJsonObject named;
+    named.insert("string", QLatin1String("named"));
+    QJsonRpcMessage response = clientSocket->invokeRemoteMethodBlocking("service.singleParam", named);
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QLatin1String("named"));
+
+#if defined(QJSONRPC_HAS_VARIADIC_TEMPLATES)
+    QStringList strings = QStringList() << "one" << "two" << "three";
+    response = clientSocket->invokeRemoteMethodBlocking("service.stringListParameter",
+                                                        DEFAULT_MSECS_REQUEST_TIMEOUT, 1, "A",
+                                                        QLatin1String("B"), strings);
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QVERIFY(response.result().toBool());
+
+    QJsonArray params = qJsonRpcParams(1, 2.5, true, "four", QString("five"), QVariant(6), 7, 8, 9, 10, 11, 12);
+    QCOMPARE(params.size(), 12);
+    QCOMPARE(params.at(1).toDouble(), 2.5);
+    QCOMPARE(params.at(3).toString(), QLatin1String("four"));
+    QCOMPARE(params.at(11).toInt(), 12);
+#endif
+}
+
 void TestQJsonRpcServer::outputParameter()
 {
     QVERIFY(server->addService(new TestService));
@@ -812,6 +1140,60 @@ private:
 
 };
 
+void TestQJsonRpcServer::signalledResponse()
+{
+    TestDelayedResponseService *service = new TestDelayedResponseService;
+    QVERIFY(server->addService(service));
+
+    // result() answers the delayed request carrying its id, and only that
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.signalledResponse");
+    QJsonRpcMessage response = clientSocket->sendMessageBlocking(request);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toString(), QLatin1String("signalled"));
+
+    response = clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.immediateResponse"));
+    QCOMPARE(response.result().toString(), QLatin1String("immediate"));
+}
+
+void TestQJsonRpcServer::signalledResponseSharedId()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QVERIFY(server->addService(new TestDelayedResponseService));
+    QScopedPointer<QJsonRpcAbstractSocket> other(createClient());
+    QVERIFY(other);
+
+    // two clients wait with the same id, result() can't tell which is meant
+    QJsonRpcMessage request = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\": \"2.0\", \"id\": 4242, \"method\": \"service.sharedIdResponse\"}");
+    QJsonRpcServiceReply *firstReply = clientSocket->sendMessage(request);
+    QJsonRpcServiceReply *otherReply = other->sendMessage(request);
+
+    QElapsedTimer timer;
+    timer.start();
+    while ((!firstReply->response().isValid() || !otherReply->response().isValid()) &&
+           timer.elapsed() < 5000)
+        qApp->processEvents();
+
+    QJsonRpcMessage firstResponse = firstReply->response();
+    QJsonRpcMessage otherResponse = otherReply->response();
+    QCOMPARE(firstResponse.type(), QJsonRpcMessage::Response);
+    QCOMPARE(otherResponse.type(), QJsonRpcMessage::Response);
+    QCOMPARE(firstResponse.id(), qint64(4242));
+    QCOMPARE(otherResponse.id(), qint64(4242));
+    QStringList results;
+    results << firstResponse.result().toString() << otherResponse.result().toString();
+    results.sort();
+    QCOMPARE(results, QStringList() << QLatin1String("0") << QLatin1String("1"));
+}
+
 void TestQJsonRpcServer::delayedResponseBasic()
 {
     QFETCH_GLOBAL(ServerType, serverType);
@@ -827,7 +1209,7 @@ void TestQJsonRpcServer::delayedResponseBasic()
     QJsonRpcServiceReplySpy spy(6);
     connect(&spy, SIGNAL(finished()), &QTestEventLoop::instance(), SLOT(exitLoop()));
 
-    int delayedMessageId = 0;
+    qint64 delayedMessageId = 0;
     {
         QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.delayedResponse");
         QJsonRpcServiceReply *reply = clientSocket->sendMessage(request);
@@ -835,7 +1217,7 @@ void TestQJsonRpcServer::delayedResponseBasic()
         delayedMessageId = request.id();
     }
 
-    QList<int> expectedMessageOrder;
+    QList<qint64> expectedMessageOrder;
     for (int i = 0; i < 5; ++i) {
         QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.immediateResponse");
         QJsonRpcServiceReply *reply = clientSocket->sendMessage(request);
@@ -846,12 +1228,165 @@ void TestQJsonRpcServer::delayedResponseBasic()
 
     QTestEventLoop::instance().enterLoop(10);
     QVERIFY(!QTestEventLoop::instance().timeout());
-    QList<int> actualMessageOrder;
+    QList<qint64> actualMessageOrder;
     foreach (QJsonRpcMessage response, spy.responses())
         actualMessageOrder.append(response.id());
     QCOMPARE(expectedMessageOrder, actualMessageOrder);
 }
 
+void TestQJsonRpcServer::futureResponse()
+{
+    QVERIFY(server->addService(new TestDelayedResponseService));
+    QJsonRpcServiceReply *futureReply =
+        clientSocket->sendMessage(QJsonRpcMessage::createRequest("service.futureResponse"));
+
+    // the socket's thread is free while the future is pending
+    QJsonRpcMessage response =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.immediateResponse"));
+    QCOMPARE(response.result().toString(), QLatin1String("immediate"));
+    QVERIFY(!futureReply->response().isValid());
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!futureReply->response().isValid() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(futureReply->response().type(), QJsonRpcMessage::Response);
+    QCOMPARE(futureReply->response().result().toString(), QLatin1String("future"));
+    delete futureReply;
+}
+
+void TestQJsonRpcServer::admissionControl()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    QVERIFY(server->addService(new TestDelayedResponseService));
+    server->setConcurrencyLimit("service.delayedResponse", 1);
+    QCOMPARE(server->concurrencyLimit("service.delayedResponse"), 1);
+    QCOMPARE(server->concurrencyLimit("service"), -1);
+
+    // the second request is turned away while the first one is pending,
+    // other methods of the service are not limited
+    QScopedPointer<QJsonRpcServiceReply> first(
+        clientSocket->sendMessage(QJsonRpcMessage::createRequest("service.delayedResponse")));
+    QJsonRpcMessage overloaded =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.delayedResponse"));
+    QCOMPARE(overloaded.type(), QJsonRpcMessage::Error);
+    QCOMPARE(overloaded.errorCode(), int(QJsonRpc::OverloadedError));
+    QJsonRpcMessage immediate =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.immediateResponse"));
+    QCOMPARE(immediate.result().toString(), QLatin1String("immediate"));
+
+    // there is room again once the first one is answered
+    QElapsedTimer timer;
+    timer.start();
+    while (!first->response().isValid() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(first->response().result().toString(), QLatin1String("delayed"));
+    QJsonRpcMessage second =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.delayedResponse"));
+    QCOMPARE(second.result().toString(), QLatin1String("delayed"));
+
+    // HTTP clients spread their requests over several connections
+    if (serverType == HttpServer)
+        return;
+
+    server->setConcurrencyLimit("service.delayedResponse", -1);
+    server->setClientConcurrencyLimit(1);
+    first.reset(clientSocket->sendMessage(QJsonRpcMessage::createRequest("service.delayedResponse")));
+    immediate =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.immediateResponse"));
+    QCOMPARE(immediate.errorCode(), int(QJsonRpc::OverloadedError));
+    server->setClientConcurrencyLimit(-1);
+}
+
+void TestQJsonRpcServer::methodMetrics()
+{
+    QVERIFY(server->addService(new TestService));
+    QVERIFY(!server->metricsEnabled());
+    server->setStatsServiceEnabled(true);
+    QVERIFY(server->statsServiceEnabled());
+    QVERIFY(server->metricsEnabled());
+
+    for (int i = 0; i < 3; ++i) {
+        QJsonRpcMessage response = clientSocket->sendMessageBlocking(
+            QJsonRpcMessage::createRequest("service.singleParam", QString("single")));
+        QCOMPARE(response.result().toString(), QLatin1String("single"));
+    }
+    QJsonRpcMessage error =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.noParam", false));
+    QCOMPARE(error.errorCode(), int(QJsonRpc::InvalidParams));
+
+    // methods that don't exist aren't counted
+    clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.doesNotExist"));
+    QCOMPARE(server->methodMetrics("service.doesNotExist").calls(), quint64(0));
+
+    QJsonRpcMethodMetrics singleParam = server->methodMetrics("service.singleParam");
+    QCOMPARE(singleParam.name(), QLatin1String("service.singleParam"));
+    QCOMPARE(singleParam.calls(), quint64(3));
+    QCOMPARE(singleParam.errors(), quint64(0));
+    QVERIFY(singleParam.bytesOut() > 0);
+    QVERIFY(singleParam.minimumLatency() <= singleParam.latencyPercentile(50));
+    QVERIFY(singleParam.latencyPercentile(50) <= singleParam.maximumLatency());
+
+    QJsonRpcMethodMetrics noParam = server->methodMetrics("service.noParam");
+    QCOMPARE(noParam.errors(), quint64(1));
+    QCOMPARE(noParam.errors(QJsonRpc::InvalidParams), quint64(1));
+    QCOMPARE(noParam.errorCodes(), QList<int>() << int(QJsonRpc::InvalidParams));
+
+    QJsonRpcMethodMetrics service = server->methodMetrics("service");
+    QCOMPARE(service.calls(), quint64(4));
+    QCOMPARE(service.errors(), quint64(1));
+
+    // the same through the stats service, which counts itself too
+    QJsonRpcMessage stats = clientSocket->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.stats", QLatin1String("service.singleParam")));
+    QCOMPARE(stats.result().toObject().value("calls").toDouble(), 3.0);
+    stats = clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("rpc.stats"));
+    QVERIFY(stats.result().toObject().contains("service.noParam"));
+    QVERIFY(stats.result().toObject().contains("rpc.stats"));
+
+    server->resetMetrics();
+    QVERIFY(server->methodMetrics("service.singleParam").isEmpty());
+    server->setMetricsEnabled(false);
+    QVERIFY(!server->statsServiceEnabled());
+    QVERIFY(server->methodMetrics().isEmpty());
+}
+
+void TestQJsonRpcServer::interceptors()
+{
+    QVERIFY(server->addService(new TestService));
+    QMutex mutex;
+    QStringList log;
+    TestInterceptor outer("outer", &log, &mutex);
+    TestInterceptor inner("inner", &log, &mutex, "service.noParam");
+    server->addInterceptor(&outer);
+    server->addInterceptor(&inner);
+    QCOMPARE(server->interceptors(), QList<QJsonRpcInterceptor *>() << &outer << &inner);
+
+    QJsonRpcMessage response = clientSocket->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.singleParam", QString("single")));
+    QCOMPARE(response.result().toString(), QLatin1String("single"));
+
+    // the inner one answers, only the interceptors that ran are called after
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.noParam");
+    response = clientSocket->sendMessageBlocking(request);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidRequest));
+
+    server->removeInterceptor(&outer);
+    server->removeInterceptor(&inner);
+    QVERIFY(server->interceptors().isEmpty());
+
+    QMutexLocker locker(&mutex);
+    QCOMPARE(log, QStringList() << "outer before service.singleParam"
+                                << "inner before service.singleParam"
+                                << "inner after service.singleParam"
+                                << "outer after service.singleParam"
+                                << "outer before service.noParam"
+                                << "inner before service.noParam"
+                                << "inner after service.noParam error"
+                                << "outer after service.noParam error");
+}
+
 void TestQJsonRpcServer::delayedResponseSocketClosed()
 {
     QFETCH_GLOBAL(ServerType, serverType);
@@ -867,18 +1402,1040 @@ void TestQJsonRpcServer::delayedResponseSocketClosed()
     QVERIFY(server->addService(service));
 
     QSignalSpy spy(service, SIGNAL(responseResult(bool)));
+    QSignalSpy cancelled(service, SIGNAL(requestCancelled(QJsonRpcMessage)));
     connect(service, SIGNAL(responseResult(bool)), &QTestEventLoop::instance(), SLOT(exitLoop()));
     QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.delayedResponseWithClosedSocket");
     QScopedPointer<QJsonRpcServiceReply> reply(clientSocket->sendMessage(request));
-    if (serverType == TcpServer)
+    if (serverType == TcpServer || serverType == WebSocketServer)
         tcpSockets.first()->disconnectFromHost();
-    else if (serverType == LocalServer)
+    else if (serverType == LocalServer || serverType == SharedMemoryServer)
         localSockets.first()->disconnectFromServer();
 
     QTestEventLoop::instance().enterLoop(5);
     QVERIFY(!QTestEventLoop::instance().timeout());
     QList<QVariant> arguments = spy.takeFirst();
     QCOMPARE(arguments.at(0).toBool(), false);
+    QCOMPARE(cancelled.count(), 1);
+}
+
+void TestQJsonRpcServer::cancelDelayedResponse()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not applicable for HTTP connections");
+#else
+        QSKIP("Not applicable for HTTP connections", SkipAll);
+#endif
+    }
+
+    TestDelayedResponseService *service = new TestDelayedResponseService;
+    QVERIFY(server->addService(service));
+
+    QSignalSpy spy(service, SIGNAL(responseResult(bool)));
+    QSignalSpy cancelled(service, SIGNAL(requestCancelled(QJsonRpcMessage)));
+    connect(service, SIGNAL(responseResult(bool)), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.delayedResponseWithClosedSocket");
+    QScopedPointer<QJsonRpcServiceReply> reply(clientSocket->sendMessage(request));
+    clientSocket->cancelRequest(request);
+
+    // the handler is told, and its response is not written
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+    QCOMPARE(spy.takeFirst().at(0).toBool(), false);
+    QCOMPARE(cancelled.count(), 1);
+    QCOMPARE(cancelled.first().at(0).value<QJsonRpcMessage>().id(), request.id());
+    QVERIFY(!reply->response().isValid());
+
+    // requests that aren't cancelled are still answered
+    QJsonRpcMessage response =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.delayedResponse"));
+    QCOMPARE(response.result().toString(), QLatin1String("delayed"));
+}
+
+void TestQJsonRpcServer::deadlinePropagation()
+{
+    QJsonRpcSocket *socket = qobject_cast<QJsonRpcSocket*>(clientSocket.data());
+    if (!socket) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    TestService *service = new TestService;
+    QVERIFY(server->addService(service));
+
+    // handlers only see a deadline the client sent
+    QJsonRpcMessage response =
+        socket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.remainingTime"), 5000);
+    QCOMPARE(response.result().toDouble(), -1.0);
+
+    socket->setDeadlinePropagation(true);
+    response = socket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.remainingTime"), 5000);
+    QVERIFY(response.result().toDouble() > 0.0);
+    QVERIFY(response.result().toDouble() <= 5000.0);
+    QCOMPARE(service->callCount(), 2);
+
+    // those past their deadline are answered without being dispatched
+    socket->setDeadlinePropagation(false);
+    QJsonRpcMessage expired = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":424242,\"method\":\"service.remainingTime\",\"timeout\":0}");
+    response = socket->sendMessageBlocking(expired, 5000);
+    QCOMPARE(response.id(), expired.id());
+    QCOMPARE(response.errorCode(), int(QJsonRpc::TimeoutError));
+    QCOMPARE(service->callCount(), 2);
+}
+
+void TestQJsonRpcServer::streamedResponse()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QVERIFY(server->addService(new TestDelayedResponseService));
+    QScopedPointer<QJsonRpcServiceReply> reply(
+        clientSocket->sendMessage(QJsonRpcMessage::createRequest("service.streamedResponse", QJsonValue(3))));
+    QSignalSpy parts(reply.data(), SIGNAL(partialResult(QJsonValue)));
+    connect(reply.data(), SIGNAL(finished()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+
+    // every part arrives in order before the response
+    QCOMPARE(reply->response().result().toString(), QLatin1String("delayed"));
+    QCOMPARE(parts.count(), 3);
+    for (int i = 0; i < parts.count(); ++i)
+        QCOMPARE(parts.at(i).at(0).value<QJsonValue>().toInt(), i);
+}
+
+void TestQJsonRpcServer::batchRequest()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QVERIFY(server->addService(new TestDelayedResponseService));
+    QJsonRpcMessage delayedRequest = QJsonRpcMessage::createRequest("service.delayedResponse");
+    QJsonRpcMessage immediateRequest = QJsonRpcMessage::createRequest("service.immediateResponse");
+    QJsonArray batch;
+    batch.append(delayedRequest.toObject());
+    batch.append(QJsonRpcMessage::createNotification("service.immediateResponse").toObject());
+    batch.append(immediateRequest.toObject());
+
+    QSignalSpy spyMessageReceived(clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+    connect(clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)),
+            &QTestEventLoop::instance(), SLOT(exitLoop()));
+    writeRaw(QJsonDocument(batch).toJson());
+
+    // the responses arrive in a single array once the delayed one completed
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+    QCOMPARE(spyMessageReceived.count(), 2);
+
+    QHash<qint64, QString> results;
+    for (int i = 0; i < spyMessageReceived.count(); ++i) {
+        QJsonRpcMessage response = spyMessageReceived.at(i).at(0).value<QJsonRpcMessage>();
+        QCOMPARE(response.type(), QJsonRpcMessage::Response);
+        results.insert(response.id(), response.result().toString());
+    }
+
+    QCOMPARE(results.value(delayedRequest.id()), QLatin1String("delayed"));
+    QCOMPARE(results.value(immediateRequest.id()), QLatin1String("immediate"));
+}
+
+void TestQJsonRpcServer::batchRequestMatching()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QVERIFY(server->addService(new TestDelayedResponseService));
+    QSignalSpy spyMessageReceived(clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    // a member cancelled by the peer is answered as such, the rest of the
+    // batch isn't held back by it
+    writeRaw("[{\"jsonrpc\": \"2.0\", \"id\": 9001, \"method\": \"service.delayedResponse\"},"
+             " {\"jsonrpc\": \"2.0\", \"id\": 9002, \"method\": \"service.immediateResponse\"}]");
+    QJsonObject cancelled;
+    cancelled.insert("id", 9001);
+    clientSocket->notify(QJsonRpcMessage::createNotification("$/cancelRequest", cancelled));
+
+    QElapsedTimer timer;
+    timer.start();
+    while (spyMessageReceived.count() < 2 && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(spyMessageReceived.count(), 2);
+    QHash<qint64, QJsonRpcMessage> responses;
+    for (int i = 0; i < spyMessageReceived.count(); ++i) {
+        QJsonRpcMessage response = spyMessageReceived.at(i).at(0).value<QJsonRpcMessage>();
+        responses.insert(response.id(), response);
+    }
+    QCOMPARE(responses.value(9001).type(), QJsonRpcMessage::Error);
+    QCOMPARE(responses.value(9001).errorCode(), int(QJsonRpc::CancelledError));
+    QCOMPARE(responses.value(9002).result().toString(), QLatin1String("immediate"));
+
+    // the cancelled request completes without a response
+    QTest::qWait(300);
+    QCOMPARE(spyMessageReceived.count(), 2);
+    spyMessageReceived.clear();
+
+    // a request outside the batch reusing the id of one in it is answered
+    // on its own, the batch still waits for its member
+    writeRaw("[{\"jsonrpc\": \"2.0\", \"id\": 9003, \"method\": \"service.delayedResponse\"}]");
+    writeRaw("{\"jsonrpc\": \"2.0\", \"id\": 9003, \"method\": \"service.immediateResponse\"}");
+    timer.restart();
+    while (spyMessageReceived.count() < 2 && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(spyMessageReceived.count(), 2);
+    QJsonRpcMessage response = spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>();
+    QCOMPARE(response.id(), qint64(9003));
+    QCOMPARE(response.result().toString(), QLatin1String("immediate"));
+    response = spyMessageReceived.at(1).at(0).value<QJsonRpcMessage>();
+    QCOMPARE(response.id(), qint64(9003));
+    QCOMPARE(response.result().toString(), QLatin1String("delayed"));
+}
+
+void TestQJsonRpcServer::threadPoolDispatch()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    TestThreadPoolService *service = new TestThreadPoolService(&serverThread);
+    service->setThreadPool(&pool);
+    service->setMaximumConcurrentRequests(2);
+    QVERIFY(server->addService(service));
+
+    QJsonRpcMessage response =
+        clientSocket->sendMessageBlocking(QJsonRpcMessage::createRequest("service.dispatchedOnPool"));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QVERIFY(response.result().toBool());
+
+    QList<QJsonRpcServiceReply *> replies;
+    for (int i = 0; i < 6; ++i)
+        replies.append(clientSocket->sendMessage(
+            QJsonRpcMessage::createRequest("service.slowMethod", QJsonValue(i))));
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < replies.size(); ++i) {
+        while (!replies.at(i)->response().isValid() && timer.elapsed() < 5000)
+            qApp->processEvents();
+        QCOMPARE(replies.at(i)->response().result().toInt(), i);
+    }
+
+    QVERIFY(service->maximumActive() <= 2);
+    qDeleteAll(replies);
+    QVERIFY(server->removeService(service));
+    delete service;
+}
+
+void TestQJsonRpcServer::priorityDispatch()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(1);
+    TestThreadPoolService *service = new TestThreadPoolService(&serverThread);
+    service->setThreadPool(&pool);
+    service->setMaximumConcurrentRequests(1);
+    QVERIFY(server->addService(service));
+
+    // everything queues behind the first request, the urgent ones overtake
+    // the bulk ones whether marked by the method or by the request
+    QList<QJsonRpcServiceReply *> replies;
+    replies.append(clientSocket->sendMessage(
+        QJsonRpcMessage::createRequest("service.slowMethod", QJsonValue(0))));
+    for (int i = 1; i <= 3; ++i)
+        replies.append(clientSocket->sendMessage(
+            QJsonRpcMessage::createRequest("service.bulkMethod", QJsonValue(i))));
+    replies.append(clientSocket->sendMessage(
+        QJsonRpcMessage::createRequest("service.urgentMethod", QJsonValue(4))));
+    QJsonObject promoted = QJsonRpcMessage::createRequest("service.bulkMethod", QJsonValue(5)).toObject();
+    promoted.insert("priority", QLatin1String("high"));
+    replies.append(clientSocket->sendMessage(QJsonRpcMessage::fromObject(promoted)));
+
+    QElapsedTimer timer;
+    timer.start();
+    foreach (QJsonRpcServiceReply *reply, replies) {
+        while (!reply->response().isValid() && timer.elapsed() < 5000)
+            qApp->processEvents();
+        QCOMPARE(reply->response().type(), QJsonRpcMessage::Response);
+    }
+
+    QCOMPARE(service->completed(), QList<int>() << 4 << 5 << 1 << 2 << 3);
+    qDeleteAll(replies);
+    QVERIFY(server->removeService(service));
+    delete service;
+}
+
+void TestQJsonRpcServer::threadPoolShutdown()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType == HttpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Not supported for HTTP connections");
+#else
+        QSKIP("Not supported for HTTP connections", SkipAll);
+#endif
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(1);
+    TestThreadPoolService *service = new TestThreadPoolService(&serverThread);
+    service->setThreadPool(&pool);
+    service->setMaximumConcurrentRequests(1);
+    QVERIFY(server->addService(service));
+
+    QList<QJsonRpcServiceReply *> replies;
+    for (int i = 0; i < 4; ++i)
+        replies.append(clientSocket->sendMessage(
+            QJsonRpcMessage::createRequest("service.slowMethod", QJsonValue(i))));
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!service->active() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(service->active(), 1);
+
+    // the running request finishes before the service can be deleted, the
+    // queued ones are dropped
+    QVERIFY(server->removeService(service));
+    QCOMPARE(service->active(), 0);
+    delete service;
+    QVERIFY(pool.waitForDone(1000));
+    qDeleteAll(replies);
+}
+
+void TestQJsonRpcServer::blockingCallsFromWorkerThreads()
+{
+    QVERIFY(server->addService(new TestService));
+
+    QList<BlockingCallThread *> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.append(new BlockingCallThread(clientSocket.data(), i));
+        threads.last()->start();
+    }
+
+    // the socket lives on this thread, which has to keep it running
+    QElapsedTimer timer;
+    timer.start();
+    foreach (BlockingCallThread *thread, threads) {
+        while (!thread->isFinished() && timer.elapsed() < 10000)
+            qApp->processEvents(QEventLoop::AllEvents, 10);
+        QVERIFY(thread->wait(1000));
+    }
+
+    foreach (BlockingCallThread *thread, threads) {
+        QCOMPARE(thread->responses.size(), 5);
+        for (int i = 0; i < thread->responses.size(); ++i) {
+            const QJsonRpcMessage &response = thread->responses.at(i);
+            QCOMPARE(response.type(), QJsonRpcMessage::Response);
+            QCOMPARE(response.id(), thread->requests.at(i).id());
+            QCOMPARE(response.result().toString(), thread->requests.at(i).params().toArray().at(0).toString());
+        }
+    }
+
+    qDeleteAll(threads);
+}
+
+void TestQJsonRpcServer::threadedSocket()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != TcpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for TCP connections");
+#else
+        QSKIP("Only supported for TCP connections", SkipAll);
+#endif
+    }
+
+    QVERIFY(server->addService(new TestService));
+
+    QTcpSocket *tcpSocket = new QTcpSocket;
+    tcpSocket->connectToHost(QHostAddress::LocalHost, tcpServerPort);
+    QVERIFY(tcpSocket->waitForConnected());
+    QScopedPointer<QJsonRpcThreadedSocket> socket(new QJsonRpcThreadedSocket(tcpSocket));
+    QVERIFY(socket->isValid());
+    QVERIFY(socket->ioThread() != QThread::currentThread());
+
+    // blocking calls from threads without an event loop share the connection
+    QList<BlockingCallThread *> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.append(new BlockingCallThread(socket.data(), i));
+        threads.last()->start();
+    }
+
+    // replies to this thread's requests finish in this thread
+    QJsonRpcServiceReply *reply =
+        socket->sendMessage(QJsonRpcMessage::createRequest("service.singleParam", QString("own")));
+    QCOMPARE(reply->thread(), QThread::currentThread());
+    QSignalSpy spyFinished(reply, SIGNAL(finished()));
+    QElapsedTimer timer;
+    timer.start();
+    while (spyFinished.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents(QEventLoop::AllEvents, 10);
+    QCOMPARE(spyFinished.count(), 1);
+    QCOMPARE(reply->response().result().toString(), QLatin1String("own"));
+    delete reply;
+
+    foreach (BlockingCallThread *thread, threads) {
+        QVERIFY(thread->wait(10000));
+        QCOMPARE(thread->responses.size(), 5);
+        for (int i = 0; i < thread->responses.size(); ++i) {
+            QCOMPARE(thread->responses.at(i).type(), QJsonRpcMessage::Response);
+            QCOMPARE(thread->responses.at(i).id(), thread->requests.at(i).id());
+        }
+    }
+    qDeleteAll(threads);
+
+    // all of it went through one connection
+    QCOMPARE(server->connectedClientCount(), 2);
+    socket.reset();
+    timer.restart();
+    while (server->connectedClientCount() > 1 && timer.elapsed() < 5000)
+        qApp->processEvents(QEventLoop::AllEvents, 10);
+    QCOMPARE(server->connectedClientCount(), 1);
+}
+
+void TestQJsonRpcServer::coroutineCalls()
+{
+#if !defined(QJSONRPC_HAS_COROUTINES)
+#if QT_VERSION >= 0x050000
+    QSKIP("Built without coroutine support");
+#else
+    QSKIP("Built without coroutine support", SkipAll);
+#endif
+#else
+    QVERIFY(server->addService(new TestDelayedResponseService));
+
+    QList<QJsonRpcMessage> responses;
+    chainedCalls(clientSocket.data(), &responses);
+    QVERIFY(responses.isEmpty());
+
+    QElapsedTimer timer;
+    timer.start();
+    while (responses.size() < 3 && timer.elapsed() < 5000)
+        qApp->processEvents(QEventLoop::AllEvents, 10);
+
+    QCOMPARE(responses.size(), 3);
+    QCOMPARE(responses.at(0).result().toString(), QLatin1String("immediate"));
+    QCOMPARE(responses.at(1).type(), QJsonRpcMessage::Response);
+    QCOMPARE(responses.at(2).errorCode(), int(QJsonRpc::TimeoutError));
+#endif
+}
+
+void TestQJsonRpcServer::tcpServerIoThreads()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != TcpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for TCP connections");
+#else
+        QSKIP("Only supported for TCP connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcTcpServer ioServer;
+    ioServer.setIoThreadCount(2);
+    QCOMPARE(ioServer.ioThreadCount(), 2);
+    quint16 port = quint16(tcpServerPort + 1);
+    QVERIFY(ioServer.listen(QHostAddress::LocalHost, port));
+    QVERIFY(ioServer.addService(new TestService));
+
+    QList<QTcpSocket *> sockets;
+    QList<QJsonRpcSocket *> clients;
+    for (int i = 0; i < 3; ++i) {
+        QTcpSocket *tcpSocket = new QTcpSocket;
+        tcpSocket->connectToHost(QHostAddress::LocalHost, port);
+        QVERIFY(tcpSocket->waitForConnected());
+        sockets.append(tcpSocket);
+        clients.append(new QJsonRpcSocket(tcpSocket));
+    }
+
+    for (int i = 0; i < clients.size(); ++i) {
+        QJsonRpcMessage request =
+            QJsonRpcMessage::createRequest("service.singleParam", QString::number(i));
+        QJsonRpcMessage response = clients.at(i)->sendMessageBlocking(request);
+        QCOMPARE(response.type(), QJsonRpcMessage::Response);
+        QCOMPARE(response.result().toString(), QString::number(i));
+    }
+
+    QCOMPARE(ioServer.connectedClientCount(), 3);
+    QCOMPARE(ioServer.ioThreadCount(), 2);
+    ioServer.setIoThreadCount(4);
+    QCOMPARE(ioServer.ioThreadCount(), 2);
+
+    qDeleteAll(clients);
+    qDeleteAll(sockets);
+}
+
+void TestQJsonRpcServer::connectionMemoryLimits()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != TcpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only tested for TCP connections");
+#else
+        QSKIP("Only tested for TCP connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcTcpServer limitedServer;
+    limitedServer.setMaximumFrameSize(1024);
+    limitedServer.setMaximumConnectionMemory(64 * 1024);
+    QCOMPARE(limitedServer.maximumFrameSize(), 1024);
+    QCOMPARE(limitedServer.maximumConnectionMemory(), qint64(64 * 1024));
+    quint16 port = quint16(tcpServerPort + 2);
+    QVERIFY(limitedServer.listen(QHostAddress::LocalHost, port));
+    QVERIFY(limitedServer.addService(new TestService));
+
+    // a well behaved client is served
+    QTcpSocket goodSocket;
+    goodSocket.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(goodSocket.waitForConnected());
+    QJsonRpcSocket goodClient(&goodSocket);
+    QJsonRpcMessage response = goodClient.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.singleParam", QString::fromLatin1("hello")));
+    QCOMPARE(response.result().toString(), QLatin1String("hello"));
+
+    // one opening a document it never closes is dropped, the other stays
+    QTcpSocket badSocket;
+    badSocket.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(badSocket.waitForConnected());
+    badSocket.write("{\"jsonrpc\": \"2.0\", \"method\": \"" + QByteArray(4096, 'x'));
+    QElapsedTimer timer;
+    timer.start();
+    while (badSocket.state() != QAbstractSocket::UnconnectedState && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    QCOMPARE(badSocket.state(), QAbstractSocket::UnconnectedState);
+
+    QJsonRpcMemoryStats stats = limitedServer.memoryStats();
+    QCOMPARE(stats.droppedConnections, 1);
+    QVERIFY(stats.peakBytes > 1024);
+    QVERIFY(stats.bytes < 1024);
+
+    response = goodClient.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.singleParam", QString::fromLatin1("again")));
+    QCOMPARE(response.result().toString(), QLatin1String("again"));
+    QCOMPARE(limitedServer.connectedClientCount(), 1);
+}
+
+void TestQJsonRpcServer::broadcastPastMemoryLimit()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != TcpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only tested for TCP connections");
+#else
+        QSKIP("Only tested for TCP connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcTcpServer limitedServer;
+    limitedServer.setMaximumConnectionMemory(64 * 1024);
+    quint16 port = quint16(tcpServerPort + 6);
+    QVERIFY(limitedServer.listen(QHostAddress::LocalHost, port));
+
+    QTcpSocket clientSocket;
+    clientSocket.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(clientSocket.waitForConnected());
+    QElapsedTimer timer;
+    timer.start();
+    while (limitedServer.connectedClientCount() != 1 && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    QCOMPARE(limitedServer.connectedClientCount(), 1);
+
+    // the client is dropped while the broadcast still holds the client list
+    QJsonArray params;
+    params.append(QString(128 * 1024, QLatin1Char('x')));
+    limitedServer.notifyConnectedClients(QJsonRpcMessage::createNotification("test.large", params));
+
+    timer.restart();
+    while (clientSocket.state() != QAbstractSocket::UnconnectedState && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    QCOMPARE(clientSocket.state(), QAbstractSocket::UnconnectedState);
+    QCOMPARE(limitedServer.memoryStats().droppedConnections, 1);
+    QCOMPARE(limitedServer.connectedClientCount(), 0);
+
+    // and the next broadcast finds nobody left to write to
+    limitedServer.notifyConnectedClients(QJsonRpcMessage::createNotification("test.small", QJsonArray()));
+    QCOMPARE(limitedServer.connectedClientCount(), 0);
+}
+
+void TestQJsonRpcServer::idleConnections()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != TcpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only tested for TCP connections");
+#else
+        QSKIP("Only tested for TCP connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcTcpServer idleServer;
+    idleServer.setIdleTimeout(500);
+    QCOMPARE(idleServer.idleTimeout(), 500);
+    quint16 port = quint16(tcpServerPort + 3);
+    QVERIFY(idleServer.listen(QHostAddress::LocalHost, port));
+    QVERIFY(idleServer.addService(new TestService));
+
+    QTcpSocket quietSocket;
+    quietSocket.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(quietSocket.waitForConnected());
+    QTcpSocket busySocket;
+    busySocket.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(busySocket.waitForConnected());
+    QJsonRpcSocket busyClient(&busySocket);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (idleServer.connectedClientCount() < 2 && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    QCOMPARE(idleServer.connectedClientCount(), 2);
+
+    // one sending requests stays, the quiet one is closed
+    timer.restart();
+    while (quietSocket.state() != QAbstractSocket::UnconnectedState && timer.elapsed() < 5000) {
+        QJsonRpcMessage response = busyClient.sendMessageBlocking(
+            QJsonRpcMessage::createRequest("service.singleParam", QString::fromLatin1("ping")));
+        QCOMPARE(response.result().toString(), QLatin1String("ping"));
+        QTest::qWait(50);
+    }
+    QCOMPARE(quietSocket.state(), QAbstractSocket::UnconnectedState);
+    QVERIFY(timer.elapsed() >= 200);
+    QCOMPARE(busySocket.state(), QAbstractSocket::ConnectedState);
+    QCOMPARE(idleServer.connectedClientCount(), 1);
+
+    // and goes once it stops
+    timer.restart();
+    while (busySocket.state() != QAbstractSocket::UnconnectedState && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    QCOMPARE(busySocket.state(), QAbstractSocket::UnconnectedState);
+    QCOMPARE(idleServer.connectedClientCount(), 0);
+}
+
+void TestQJsonRpcServer::gatewayBackends()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != TcpServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only tested for TCP connections");
+#else
+        QSKIP("Only tested for TCP connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcTcpServer backendServer;
+    quint16 backendPort = quint16(tcpServerPort + 4);
+    QVERIFY(backendServer.listen(QHostAddress::LocalHost, backendPort));
+    TestService *service = new TestService;
+    QVERIFY(backendServer.addService(service));
+
+    QTcpSocket backendSocket;
+    backendSocket.connectToHost(QHostAddress::LocalHost, backendPort);
+    QVERIFY(backendSocket.waitForConnected());
+    QScopedPointer<QJsonRpcSocket> backend(new QJsonRpcSocket(&backendSocket));
+
+    QJsonRpcTcpServer gateway;
+    quint16 gatewayPort = quint16(tcpServerPort + 5);
+    QVERIFY(gateway.listen(QHostAddress::LocalHost, gatewayPort));
+    gateway.addBackend("service", backend.data());
+    QCOMPARE(gateway.backend("service"), static_cast<QJsonRpcAbstractSocket*>(backend.data()));
+
+    QTcpSocket clientSocket;
+    clientSocket.connectToHost(QHostAddress::LocalHost, gatewayPort);
+    QVERIFY(clientSocket.waitForConnected());
+    QJsonRpcSocket client(&clientSocket);
+
+    // relayed with another id, which is put back in the response
+    QJsonRpcMessage request = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":\"first\",\"method\":\"service.singleParam\",\"params\":[\"hello\"]}");
+    QJsonRpcMessage response = client.sendMessageBlocking(request);
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QLatin1String("hello"));
+    QCOMPARE(response.toObject().value("id").toString(), QLatin1String("first"));
+
+    response = client.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.multipleParam",
+            QJsonArray() << QLatin1String("a") << QLatin1String("b") << QLatin1String("c")));
+    QCOMPARE(response.result().toString(), QLatin1String("abc"));
+
+    // errors of the backend come back the same way
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("service.unknown"));
+    QCOMPARE(response.type(), QJsonRpcMessage::Error);
+    QCOMPARE(response.errorCode(), int(QJsonRpc::MethodNotFound));
+
+    // services without a backend aren't found on the gateway itself
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("other.method"));
+    QCOMPARE(response.errorCode(), int(QJsonRpc::MethodNotFound));
+
+    // and requests are answered once the backend is gone
+    backend.reset();
+    QCOMPARE(gateway.backend("service"), static_cast<QJsonRpcAbstractSocket*>(0));
+    response = client.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.singleParam", QString::fromLatin1("again")));
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InternalError));
+
+    gateway.removeBackend("service");
+    QVERIFY(!gateway.backend("service"));
+}
+
+static QByteArray readHandshake(QTcpSocket *socket)
+{
+    QByteArray data;
+    QElapsedTimer timer;
+    timer.start();
+    while (!data.contains("\r\n\r\n") && timer.elapsed() < 5000) {
+        socket->waitForReadyRead(100);
+        data += socket->readAll();
+    }
+    return data;
+}
+
+void TestQJsonRpcServer::webSocketHandshake()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != WebSocketServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for WebSocket connections");
+#else
+        QSKIP("Only supported for WebSocket connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcWebSocket *webSocket = qobject_cast<QJsonRpcWebSocket*>(clientSocket.data());
+    QVERIFY(webSocket);
+    QVERIFY(webSocket->isOpen());
+    QVERIFY(webSocket->isCompressionNegotiated());
+    QCOMPARE(webSocket->resourceName(), QByteArray("/rpc"));
+
+    // the example of RFC 6455, with an offer that can be accepted
+    QTcpSocket tcpSocket;
+    tcpSocket.connectToHost(QHostAddress::LocalHost, webSocketServerPort);
+    QVERIFY(tcpSocket.waitForConnected());
+    tcpSocket.write("GET /chat HTTP/1.1\r\n"
+                    "Host: server.example.com\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: keep-alive, Upgrade\r\n"
+                    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                    "Sec-WebSocket-Version: 13\r\n"
+                    "Sec-WebSocket-Extensions: x-unknown, permessage-deflate; client_max_window_bits\r\n"
+                    "\r\n");
+    QByteArray response = readHandshake(&tcpSocket);
+    QVERIFY(response.startsWith("HTTP/1.1 101 "));
+    QVERIFY(response.contains("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+    QVERIFY(response.contains("Sec-WebSocket-Extensions: permessage-deflate"));
+    connect(serverObject(), SIGNAL(clientDisconnected()), &QTestEventLoop::instance(), SLOT(exitLoop()));
+    tcpSocket.disconnectFromHost();
+    QTestEventLoop::instance().enterLoop(5);
+    QVERIFY(!QTestEventLoop::instance().timeout());
+
+    // neither a key nor a version
+    QTcpSocket invalidSocket;
+    invalidSocket.connectToHost(QHostAddress::LocalHost, webSocketServerPort);
+    QVERIFY(invalidSocket.waitForConnected());
+    invalidSocket.write("GET /chat HTTP/1.1\r\n"
+                        "Host: server.example.com\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "\r\n");
+    response = readHandshake(&invalidSocket);
+    QVERIFY(response.startsWith("HTTP/1.1 400 "));
+    QCOMPARE(server->connectedClientCount(), 1);
+}
+
+void TestQJsonRpcServer::webSocketCompression()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != WebSocketServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for WebSocket connections");
+#else
+        QSKIP("Only supported for WebSocket connections", SkipAll);
+#endif
+    }
+
+    // "Hello" as sent with a flush, from RFC 7692
+    QByteArray inflated;
+    QVERIFY(QJsonRpcCompression::inflateMessage(QByteArray::fromHex("f248cdc9c90700"), &inflated));
+    QCOMPARE(inflated, QByteArray("Hello"));
+
+    QByteArray text;
+    for (int i = 0; i < 1000; ++i)
+        text += "compressible " + QByteArray::number(i % 10) + ' ';
+    QByteArray compressed = QJsonRpcCompression::deflateMessage(text);
+    QVERIFY(compressed.size() < text.size() / 4);
+    QVERIFY(QJsonRpcCompression::inflateMessage(compressed, &inflated));
+    QCOMPARE(inflated, text);
+    QVERIFY(QJsonRpcCompression::inflateMessage(QJsonRpcCompression::deflateMessage(QByteArray()),
+                                                &inflated));
+    QVERIFY(inflated.isEmpty());
+
+    bool sizeExceeded = false;
+    QVERIFY(!QJsonRpcCompression::inflateMessage(compressed, &inflated, 1024, &sizeExceeded));
+    QVERIFY(sizeExceeded);
+
+    // every message compressed in both directions
+    webSocketServer->setCompressionThreshold(0);
+    QVERIFY(server->addService(new TestService));
+    QScopedPointer<QJsonRpcAbstractSocket> client(createClient());
+    QVERIFY(client);
+    static_cast<QJsonRpcSocket*>(client.data())->setCompressionThreshold(0);
+
+    const QString parameter = QString::fromLatin1(text);
+    QJsonRpcMessage response = client->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.singleParam", parameter));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), parameter);
+
+    QSignalSpy spy(client.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+    QJsonRpcMessage notification =
+        QJsonRpcMessage::createNotification("compressed", QJsonValue(parameter));
+    QMetaObject::invokeMethod(serverObject(), "notifyConnectedClients",
+                              Q_ARG(QJsonRpcMessage, notification));
+    QElapsedTimer timer;
+    timer.start();
+    while (spy.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.takeFirst().first().value<QJsonRpcMessage>(), notification);
+}
+
+void TestQJsonRpcServer::sharedMemoryDoorbells()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != SharedMemoryServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for shared memory connections");
+#else
+        QSKIP("Only supported for shared memory connections", SkipAll);
+#endif
+    }
+
+    QJsonRpcSharedMemoryDevice *device =
+        localSockets.first()->findChild<QJsonRpcSharedMemoryDevice*>();
+    QVERIFY(device);
+    QElapsedTimer timer;
+    timer.start();
+    while (!device->isSharedMemoryActive() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    if (!device->isSharedMemoryActive()) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Shared memory is not available");
+#else
+        QSKIP("Shared memory is not available", SkipAll);
+#endif
+    }
+    QCOMPARE(device->ringSize(), 64 * 1024);
+
+    TestService *service = new TestService;
+    QVERIFY(server->addService(service));
+
+    // written in one pass, the server is woken up once
+    QJsonArray params;
+    params.append(10);
+    params.append(3.14159);
+    QJsonRpcMessage notification = QJsonRpcMessage::createNotification("service.numberParameters", params);
+    const int doorbells = device->doorbellCount();
+    for (int i = 0; i < 100; ++i)
+        clientSocket->notify(notification);
+
+    timer.restart();
+    while (service->callCount() < 100 && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(service->callCount(), 100);
+    QCOMPARE(device->doorbellCount() - doorbells, 1);
+
+    // more than the ring holds still goes through
+    const QString parameter(100 * 1024, QLatin1Char('x'));
+    QJsonRpcMessage response = clientSocket->sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.singleParam", parameter));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), parameter);
+}
+
+static QByteArray readLocal(QLocalSocket *socket, int size)
+{
+    QByteArray data;
+    QElapsedTimer timer;
+    timer.start();
+    while (data.size() < size && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        data += socket->readAll();
+    }
+    return data;
+}
+
+static QByteArray readDevice(QIODevice *device, int size)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (device->bytesAvailable() < size && timer.elapsed() < 5000)
+        qApp->processEvents();
+    return device->readAll();
+}
+
+void TestQJsonRpcServer::sharedMemoryFallback()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != SharedMemoryServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for shared memory connections");
+#else
+        QSKIP("Only supported for shared memory connections", SkipAll);
+#endif
+    }
+
+    QLocalServer::removeServer("qjsonrpc-test-shm-fallback");
+    QLocalServer listener;
+    QVERIFY(listener.listen("qjsonrpc-test-shm-fallback"));
+
+    // a client that can't attach tells the server, which sends what it had
+    // put into the ring through the socket
+    QLocalSocket plainClient;
+    plainClient.connectToServer("qjsonrpc-test-shm-fallback");
+    QVERIFY(plainClient.waitForConnected());
+    QVERIFY(listener.waitForNewConnection(5000));
+    QJsonRpcSharedMemoryDevice serverDevice(listener.nextPendingConnection(),
+                                            QJsonRpcSharedMemoryDevice::ServerRole, 4096);
+    if (!serverDevice.isSharedMemoryActive()) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Shared memory is not available");
+#else
+        QSKIP("Shared memory is not available", SkipAll);
+#endif
+    }
+    serverDevice.write("to client");
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (!received.contains('\n') && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        received += plainClient.readAll();
+    }
+    QVERIFY(received.startsWith("QJSONRPC-SHM "));
+    received = received.mid(received.indexOf('\n') + 1);
+
+    plainClient.write("QJSONRPC-PLAIN\nto server");
+    QCOMPARE(readDevice(&serverDevice, 9), QByteArray("to server"));
+    QVERIFY(!serverDevice.isSharedMemoryActive());
+    received += readLocal(&plainClient, 9 - received.size());
+    QCOMPARE(received, QByteArray("to client"));
+
+    // the client does so once attaching failed, followed by what it wrote
+    QLocalSocket attachingSocket;
+    attachingSocket.connectToServer("qjsonrpc-test-shm-fallback");
+    QVERIFY(attachingSocket.waitForConnected());
+    QVERIFY(listener.waitForNewConnection(5000));
+    QLocalSocket *plainServer = listener.nextPendingConnection();
+    QJsonRpcSharedMemoryDevice clientDevice(&attachingSocket, QJsonRpcSharedMemoryDevice::ClientRole);
+    clientDevice.write("to server");
+    plainServer->write("QJSONRPC-SHM qjsonrpc-test-missing-segment 4096\n");
+    QCOMPARE(readLocal(plainServer, 24), QByteArray("QJSONRPC-PLAIN\nto server"));
+    QVERIFY(!clientDevice.isSharedMemoryActive());
+    plainServer->write("to client");
+    QCOMPARE(readDevice(&clientDevice, 9), QByteArray("to client"));
+
+    // data that came along with the server's fallback isn't lost
+    QLocalSocket fallingBackSocket;
+    fallingBackSocket.connectToServer("qjsonrpc-test-shm-fallback");
+    QVERIFY(fallingBackSocket.waitForConnected());
+    QVERIFY(listener.waitForNewConnection(5000));
+    plainServer = listener.nextPendingConnection();
+    QJsonRpcSharedMemoryDevice fallingBackDevice(&fallingBackSocket, QJsonRpcSharedMemoryDevice::ClientRole);
+    plainServer->write("QJSONRPC-PLAIN\nto client");
+    QCOMPARE(readDevice(&fallingBackDevice, 9), QByteArray("to client"));
+    QVERIFY(!fallingBackDevice.isSharedMemoryActive());
+    fallingBackDevice.write("to server");
+    QCOMPARE(readLocal(plainServer, 9), QByteArray("to server"));
+}
+
+void TestQJsonRpcServer::sharedMemoryCorruptedRing()
+{
+    QFETCH_GLOBAL(ServerType, serverType);
+    if (serverType != SharedMemoryServer) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Only supported for shared memory connections");
+#else
+        QSKIP("Only supported for shared memory connections", SkipAll);
+#endif
+    }
+
+    QLocalServer::removeServer("qjsonrpc-test-shm-corrupted");
+    QLocalServer listener;
+    QVERIFY(listener.listen("qjsonrpc-test-shm-corrupted"));
+
+    QLocalSocket peer;
+    peer.connectToServer("qjsonrpc-test-shm-corrupted");
+    QVERIFY(peer.waitForConnected());
+    QVERIFY(listener.waitForNewConnection(5000));
+    QJsonRpcSharedMemoryDevice serverDevice(listener.nextPendingConnection(),
+                                            QJsonRpcSharedMemoryDevice::ServerRole, 4096);
+    if (!serverDevice.isSharedMemoryActive()) {
+#if QT_VERSION >= 0x050000
+        QSKIP("Shared memory is not available");
+#else
+        QSKIP("Shared memory is not available", SkipAll);
+#endif
+    }
+
+    QByteArray line;
+    QElapsedTimer timer;
+    timer.start();
+    while (!line.contains('\n') && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        line += peer.readAll();
+    }
+    const QList<QByteArray> fields = line.trimmed().split(' ');
+    QCOMPARE(fields.size(), 3);
+    QSharedMemory memory(QString::fromLatin1(fields.at(1)));
+    QVERIFY(memory.attach());
+
+    // a peer moving the tail of the ring to the client past its head makes
+    // it look like holding far more than the ring's size
+    qint32 *toClient = static_cast<qint32*>(memory.data());
+    toClient[1] = 0x7fff0000;
+    QCOMPARE(serverDevice.write("to client"), qint64(-1));
+    QVERIFY(!serverDevice.isSharedMemoryActive());
+
+    timer.restart();
+    while (peer.state() != QLocalSocket::UnconnectedState && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        peer.readAll();
+    }
+    QCOMPARE(peer.state(), QLocalSocket::UnconnectedState);
 }
 
 void TestQJsonRpcServer::addRemoveService()
@@ -898,9 +2455,9 @@ void TestQJsonRpcServer::addRemoveService()
     QVERIFY(response.errorCode() == QJsonRpc::MethodNotFound);
 
     QFETCH_GLOBAL(ServerType, serverType);
-    if (serverType == TcpServer)
-        QVERIFY(tcpServer->errorString().isEmpty());
-    else if (serverType == LocalServer)
+    if (serverType == TcpServer || serverType == WebSocketServer)
+        QVERIFY(static_cast<QTcpServer*>(serverObject())->errorString().isEmpty());
+    else if (serverType == LocalServer || serverType == SharedMemoryServer)
         QVERIFY(localServer->errorString().isEmpty());
 }
 
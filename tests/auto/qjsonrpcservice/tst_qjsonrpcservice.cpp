@@ -26,6 +26,7 @@
 #include "qjsonrpcabstractserver.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpcservice.h"
+#include "qjsonrpcinprocesssocket.h"
 
 class TestQJsonRpcService: public QObject
 {
@@ -36,6 +37,14 @@ private slots:
     void ambiguousDispatch();
     void dispatchSignals_data();
     void dispatchSignals();
+    void typedArguments();
+    void attachmentParameters();
+    void typedMethodRegistration();
+    void lateTypedRegistration();
+    void namedParameterOverloads();
+    void repeatedOverloadResolution();
+    void cachedResults();
+    void delayedResponseWithoutSocket();
 
 };
 
@@ -48,17 +57,25 @@ public:
         : QJsonRpcService(parent),
           m_stringCount(0),
           m_intCount(0),
-          m_variantCount(0)
+          m_variantCount(0),
+          m_lastBytes(0),
+          m_delayed(true),
+          m_responded(true)
     {}
 
     QJsonRpcMessage testDispatch(const QJsonRpcMessage &message) {
         return QJsonRpcService::dispatch(message);
     }
 
+    int multiply(int a, int b) const { return a * b; }
+
     int stringCount() const { return m_stringCount; }
     int intCount() const { return m_intCount; }
     int variantCount() const { return m_variantCount; }
     void resetCounters() { m_stringCount = m_intCount = m_variantCount = 0; }
+    const char *lastBytes() const { return m_lastBytes; }
+    bool delayed() const { return m_delayed; }
+    bool responded() const { return m_responded; }
 
 Q_SIGNALS:
     void testSignal();
@@ -82,10 +99,78 @@ public Q_SLOTS:
         m_variantCount++;
     }
 
+    QString typedMethod(int i, uint u, qlonglong ll, double d, float f, bool b,
+                        const QString &s) {
+        return QString("%1 %2 %3 %4 %5 %6 %7").arg(i).arg(u).arg(ll).arg(d).arg(f)
+                                              .arg(b ? "true" : "false").arg(s);
+    }
+
+    QString namedOverload(const QString &text, int count) {
+        return text.repeated(count);
+    }
+
+    QString namedOverload(bool flag) {
+        return flag ? QLatin1String("yes") : QLatin1String("no");
+    }
+
+    int byteSum(const QByteArray &data) {
+        m_lastBytes = data.constData();
+        int sum = 0;
+        for (int i = 0; i < data.size(); ++i)
+            sum += uchar(data.at(i));
+        return sum;
+    }
+
+    int typedOutMethod(int in, double &doubled, QString &text) {
+        doubled = in * 2;
+        text = QString::number(in);
+        return in + 1;
+    }
+
+    QString delayedMethod() {
+        m_delayed = beginDelayedResponse();
+        QJsonRpcServiceRequest request = currentRequest();
+        m_responded = request.respond(QVariant(QLatin1String("later")));
+        return QLatin1String("now");
+    }
+
 private:
     int m_stringCount;
     int m_intCount;
     int m_variantCount;
+    const char *m_lastBytes;
+    bool m_delayed;
+    bool m_responded;
+
+};
+
+class TestCachingService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "caching")
+    Q_CLASSINFO("cacheable", "square")
+public:
+    TestCachingService(QObject *parent = 0)
+        : QJsonRpcService(parent),
+          calls(0)
+    {}
+
+    QJsonRpcMessage testDispatch(const QJsonRpcMessage &message) {
+        return QJsonRpcService::dispatch(message);
+    }
+
+    int calls;
+
+public Q_SLOTS:
+    int square(int value) {
+        calls++;
+        return value * value;
+    }
+
+    int increment(int value) {
+        calls++;
+        return value + 1;
+    }
 
 };
 
@@ -187,6 +272,210 @@ void TestQJsonRpcService::ambiguousDispatch()
     QCOMPARE(service.variantCount(), 1);
 }
 
+void TestQJsonRpcService::typedArguments()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    QJsonArray params;
+    params << 1.6 << 2.0 << 3.0 << 4.5 << 5.5 << true << QLatin1String("six");
+    QJsonRpcMessage response =
+        service.testDispatch(QJsonRpcMessage::createRequest("service.typedMethod", params));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QLatin1String("2 2 3 4.5 5.5 true six"));
+
+    QJsonArray outParams;
+    outParams << 21;
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.typedOutMethod", outParams));
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QJsonArray result = response.result().toArray();
+    QCOMPARE(result.size(), 3);
+    QCOMPARE(result.at(0).toDouble(), 22.0);
+    QCOMPARE(result.at(1).toDouble(), 42.0);
+    QCOMPARE(result.at(2).toString(), QLatin1String("21"));
+}
+
+void TestQJsonRpcService::attachmentParameters()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    // the slot gets the attachment itself, not a copy
+    QByteArray data;
+    data.append(char(0)).append(char(1)).append(char(2)).append(char(255));
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.byteSum",
+        QJsonArray() << QJsonRpcMessage::attachmentReference(0));
+    request.setAttachments(QList<QByteArray>() << data);
+    QCOMPARE(request.attachment(request.params().toArray().at(0)), data);
+    QJsonRpcMessage response = service.testDispatch(request);
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toInt(), 258);
+    QVERIFY(service.lastBytes() == data.constData());
+
+    // references to missing attachments stand for nothing
+    request = QJsonRpcMessage::createRequest("service.byteSum",
+        QJsonArray() << QJsonRpcMessage::attachmentReference(1));
+    request.setAttachments(QList<QByteArray>() << data);
+    QVERIFY(request.attachment(request.params().toArray().at(0)).isNull());
+}
+
+#if defined(QJSONRPC_HAS_STD_FUNCTION)
+static QString concatenate(const QString &a, const QString &b)
+{
+    return a + b;
+}
+#endif
+
+void TestQJsonRpcService::typedMethodRegistration()
+{
+#if !defined(QJSONRPC_HAS_STD_FUNCTION)
+#if QT_VERSION >= 0x050000
+    QSKIP("typed methods require c++11 support");
+#else
+    QSKIP("typed methods require c++11 support", SkipAll);
+#endif
+#else
+    TestServiceProvider provider;
+    TestService service;
+    service.registerMethod("concatenate", &concatenate);
+    service.registerMethod("multiply", &service, &TestService::multiply);
+    service.registerMethod("negate", [](double value) { return -value; });
+    // hides the testMethod slot
+    service.registerMethod("testMethod", [](const QString &value) { return value.toUpper(); });
+    provider.addService(&service);
+
+    QJsonArray strings;
+    strings << QLatin1String("foo") << QLatin1String("bar");
+    QJsonRpcMessage response =
+        service.testDispatch(QJsonRpcMessage::createRequest("service.concatenate", strings));
+    QCOMPARE(response.result().toString(), QLatin1String("foobar"));
+
+    QJsonArray numbers;
+    numbers << 6 << 7;
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.multiply", numbers));
+    QCOMPARE(response.result().toDouble(), 42.0);
+
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.negate", QJsonValue(1.5)));
+    QCOMPARE(response.result().toDouble(), -1.5);
+
+    response = service.testDispatch(
+        QJsonRpcMessage::createRequest("service.testMethod", QLatin1String("hidden")));
+    QCOMPARE(response.result().toString(), QLatin1String("HIDDEN"));
+
+    // parameters are strictly typed and positional
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.multiply", strings));
+    QCOMPARE(response.type(), QJsonRpcMessage::Error);
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.negate", numbers));
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+
+    // other instances of the class keep the slots
+    TestServiceProvider otherProvider;
+    TestService otherService;
+    otherProvider.addService(&otherService);
+    response = otherService.testDispatch(
+        QJsonRpcMessage::createRequest("service.testMethod", QLatin1String("visible")));
+    QCOMPARE(response.result().toString(), QLatin1String("visible"));
+    response = otherService.testDispatch(QJsonRpcMessage::createRequest("service.negate", QJsonValue(1.5)));
+    QCOMPARE(response.errorCode(), int(QJsonRpc::MethodNotFound));
+#endif
+}
+
+void TestQJsonRpcService::lateTypedRegistration()
+{
+#if !defined(QJSONRPC_HAS_STD_FUNCTION)
+#if QT_VERSION >= 0x050000
+    QSKIP("typed methods require c++11 support");
+#else
+    QSKIP("typed methods require c++11 support", SkipAll);
+#endif
+#else
+    QJsonRpcInProcessServiceSocket services;
+    QJsonRpcInProcessSocket client;
+    client.setPeer(&services);
+    TestService service;
+    QVERIFY(services.addService(&service));
+
+    // registered once the service is routed to, requests are routed to them
+    service.registerMethod("testMethod", [](const QString &value) { return value.toUpper(); });
+    service.registerMethod("negate", [](double value) { return -value; });
+
+    QJsonRpcMessage response = client.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.testMethod", QLatin1String("late")));
+    QCOMPARE(response.result().toString(), QLatin1String("LATE"));
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("service.negate", QJsonValue(1.5)));
+    QCOMPARE(response.result().toDouble(), -1.5);
+
+    // and no longer once it is gone
+    QVERIFY(services.removeService(&service));
+    response = client.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("service.testMethod", QLatin1String("late")));
+    QCOMPARE(response.errorCode(), int(QJsonRpc::MethodNotFound));
+#endif
+}
+
+void TestQJsonRpcService::namedParameterOverloads()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    QJsonObject repeat;
+    repeat.insert("count", 3);
+    repeat.insert("text", QLatin1String("ab"));
+    repeat.insert("unused", true);
+    QJsonRpcMessage response =
+        service.testDispatch(QJsonRpcMessage::createRequest("service.namedOverload", repeat));
+    QCOMPARE(response.result().toString(), QLatin1String("ababab"));
+
+    QJsonObject flag;
+    flag.insert("flag", true);
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.namedOverload", flag));
+    QCOMPARE(response.result().toString(), QLatin1String("yes"));
+
+    QJsonObject mismatch;
+    mismatch.insert("text", 42);
+    response = service.testDispatch(QJsonRpcMessage::createRequest("service.namedOverload", mismatch));
+    QCOMPARE(response.type(), QJsonRpcMessage::Error);
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+}
+
+void TestQJsonRpcService::repeatedOverloadResolution()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    // resolved overloads are cached by parameter types, make sure each
+    // shape keeps resolving to its own overload
+    QJsonRpcMessage stringDispatch =
+        QJsonRpcMessage::createRequest("service.ambiguousMethod", QLatin1String("testParam"));
+    QJsonRpcMessage intDispatch =
+        QJsonRpcMessage::createRequest("service.ambiguousMethod", 10);
+    QJsonRpcMessage objectDispatch =
+        QJsonRpcMessage::createRequest("service.ambiguousMethod", QJsonValue(QJsonObject()));
+    for (int i = 0; i < 3; ++i) {
+        service.testDispatch(stringDispatch);
+        service.testDispatch(intDispatch);
+        service.testDispatch(objectDispatch);
+    }
+
+    QCOMPARE(service.stringCount(), 3);
+    QCOMPARE(service.intCount(), 3);
+    QCOMPARE(service.variantCount(), 3);
+
+    QJsonArray tooMany;
+    tooMany << 1 << 2;
+    for (int i = 0; i < 2; ++i) {
+        QJsonRpcMessage response =
+            service.testDispatch(QJsonRpcMessage::createRequest("service.ambiguousMethod", tooMany));
+        QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+    }
+}
+
 void TestQJsonRpcService::dispatchSignals_data()
 {
     QTest::addColumn<QJsonRpcMessage>("request");
@@ -225,5 +514,91 @@ void TestQJsonRpcService::dispatchSignals()
     QCOMPARE(response.type(), messageType);
 }
 
+void TestQJsonRpcService::cachedResults()
+{
+    TestServiceProvider provider;
+    TestCachingService service;
+    provider.addService(&service);
+
+    QJsonArray three;
+    three << 3;
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("caching.square", three);
+    QJsonRpcMessage response = service.testDispatch(request);
+    QCOMPARE(response.result().toInt(), 9);
+    QCOMPARE(service.calls, 1);
+
+    // answered from the cache, for the id of the new request
+    QJsonRpcMessage repeated = QJsonRpcMessage::createRequest("caching.square", three);
+    response = service.testDispatch(repeated);
+    QCOMPARE(response.result().toInt(), 9);
+    QCOMPARE(response.id(), repeated.id());
+    QCOMPARE(service.calls, 1);
+
+    QJsonArray four;
+    four << 4;
+    response = service.testDispatch(QJsonRpcMessage::createRequest("caching.square", four));
+    QCOMPARE(response.result().toInt(), 16);
+    QCOMPARE(service.calls, 2);
+
+    service.invalidateResultCache("square");
+    service.testDispatch(QJsonRpcMessage::createRequest("caching.square", three));
+    QCOMPARE(service.calls, 3);
+
+    // not marked cacheable
+    service.testDispatch(QJsonRpcMessage::createRequest("caching.increment", three));
+    service.testDispatch(QJsonRpcMessage::createRequest("caching.increment", three));
+    QCOMPARE(service.calls, 5);
+
+    TestServiceProvider otherProvider;
+    TestCachingService other;
+    other.setMethodCacheable("increment");
+    otherProvider.addService(&other);
+    other.testDispatch(QJsonRpcMessage::createRequest("caching.increment", three));
+    other.testDispatch(QJsonRpcMessage::createRequest("caching.increment", three));
+    QCOMPARE(other.calls, 1);
+
+    // expired results are computed again
+    other.setResultCacheTimeout(0);
+    QTest::qWait(5);
+    other.testDispatch(QJsonRpcMessage::createRequest("caching.increment", three));
+    QCOMPARE(other.calls, 2);
+
+    // enabled once the service is routed to, routed requests are cached
+    QJsonRpcInProcessServiceSocket services;
+    QJsonRpcInProcessSocket client;
+    client.setPeer(&services);
+    TestCachingService routed;
+    QVERIFY(services.addService(&routed));
+    routed.setMethodCacheable("increment");
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("caching.increment", three));
+    QCOMPARE(response.result().toInt(), 4);
+    response = client.sendMessageBlocking(QJsonRpcMessage::createRequest("caching.increment", three));
+    QCOMPARE(response.result().toInt(), 4);
+    QCOMPARE(routed.calls, 1);
+
+    // errors are never kept
+    QJsonArray strings;
+    strings << QLatin1String("three");
+    response = service.testDispatch(QJsonRpcMessage::createRequest("caching.square", strings));
+    QCOMPARE(response.type(), QJsonRpcMessage::Error);
+}
+
+void TestQJsonRpcService::delayedResponseWithoutSocket()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    // dispatch() called directly has nothing to answer later on, so the slot
+    // is told and its return value is the response
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.delayedMethod");
+    QJsonRpcMessage response = service.testDispatch(request);
+    QVERIFY(!service.delayed());
+    QVERIFY(!service.responded());
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toString(), QLatin1String("now"));
+}
+
 QTEST_MAIN(TestQJsonRpcService)
 #include "tst_qjsonrpcservice.moc"
@@ -33,6 +33,9 @@
 #include "qjsonrpcservicereply.h"
 #include "qjsonrpcsocket_p.h"
 #include "qjsonrpcsocket.h"
+#include "qjsonrpcinprocesssocket.h"
+#include "qjsonrpcclustersocket.h"
+#include "qjsonrpccodec.h"
 
 class QBufferBackedQJsonRpcSocketPrivate : public QJsonRpcSocketPrivate
 {
@@ -63,6 +66,31 @@ public:
     }
 };
 
+// answers from a thread of its own, like a service on a thread pool
+class ResponsePoster : public QThread
+{
+public:
+    ResponsePoster(QJsonRpcSocket *socket, int index, int count)
+        : socket(socket), index(index), count(count) {}
+
+protected:
+    void run() {
+        for (int i = 0; i < count; ++i) {
+            QJsonRpcMessage request =
+                QJsonRpcMessage::fromObject(QJsonRpcMessage::createRequest("test.post").toObject());
+            QJsonObject result;
+            result.insert(QLatin1String("thread"), index);
+            result.insert(QLatin1String("sequence"), i);
+            QJsonRpcAbstractSocketPrivate::post(socket, request.createResponse(result));
+        }
+    }
+
+private:
+    QJsonRpcSocket *socket;
+    const int index;
+    const int count;
+};
+
 class TestQJsonRpcSocket: public QObject
 {
     Q_OBJECT
@@ -79,6 +107,23 @@ private Q_SLOTS:
     void notification();
     void response();
     void delayedMessageReceive();
+    void incrementalFraming();
+    void contentLengthFraming();
+    void writeCoalescing();
+    void postedFromOtherThreads();
+    void writeSerialization();
+    void requestIdsAsStrings();
+    void codecs_data();
+    void codecs();
+    void compression();
+    void attachments();
+    void sendBatch();
+    void responseCallback();
+    void asyncRequestTimeout();
+    void flowControl();
+    void memoryLimits();
+    void inProcessSocket();
+    void clusterSocket();
 
 private:
     // benchmark parsing speed
@@ -265,5 +310,796 @@ void TestQJsonRpcSocket::delayedMessageReceive()
         qApp->processEvents();
 }
 
+void TestQJsonRpcSocket::incrementalFraming()
+{
+    // the escaped quote and brace inside the string must not end the frame,
+    // even when the escape sequence is split across two chunks
+    QByteArray frame("{\"jsonrpc\": \"2.0\", \"method\": \"test.\\\"}\", \"id\": 1}");
+    QByteArray data = "  " + frame + "{\"id\": 2}";
+
+    QJsonRpcSocketPrivate socketPrivate(0);
+    QCOMPARE(socketPrivate.findJsonDocumentEnd(data), frame.size() + 1);
+
+    QJsonRpcSocketPrivate::FrameScanner scanner;
+    int end = -1;
+    for (int i = 1; i <= data.size() && end == -1; ++i)
+        end = scanner.scan(data.constData(), i);
+    QCOMPARE(end, frame.size() + 1);
+
+    // the scanner is reset after a frame has been found
+    QCOMPARE(scanner.offset, 0);
+    QCOMPARE(scanner.depth, 0);
+}
+
+void TestQJsonRpcSocket::contentLengthFraming()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+    serviceSocket.setFramingMode(QJsonRpc::ContentLengthFraming);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("test.framing");
+    QScopedPointer<QJsonRpcServiceReply> reply(serviceSocket.sendMessage(request));
+    QByteArray written = buffer.data();
+    int headerEnd = written.indexOf("\r\n\r\n");
+    QVERIFY(headerEnd != -1);
+    QByteArray body = written.mid(headerEnd + 4);
+    QCOMPARE(written.left(headerEnd), "Content-Length: " + QByteArray::number(body.size()));
+    QCOMPARE(QJsonRpcMessage::fromJson(body).id(), request.id());
+
+    // deliver the response in two parts, splitting the body
+    QByteArray response = request.createResponse(QLatin1String("}")).toJson();
+    qint64 readPosition = buffer.pos();
+    buffer.write("Content-Length: " + QByteArray::number(response.size()) + "\r\n\r\n");
+    buffer.write(response.left(10));
+    buffer.seek(readPosition);
+    qApp->processEvents();
+    QCOMPARE(spyMessageReceived.count(), 0);
+
+    readPosition = buffer.pos();
+    buffer.write(response.mid(10));
+    buffer.seek(readPosition);
+    while (!spyMessageReceived.size())
+        qApp->processEvents();
+
+    QCOMPARE(reply->response().id(), request.id());
+    QCOMPARE(reply->response().result().toString(), QLatin1String("}"));
+}
+
+void TestQJsonRpcSocket::writeCoalescing()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+    serviceSocket.setWriteCoalescingDelay(0);
+
+    serviceSocket.notify(QJsonRpcMessage::createNotification("test.first"));
+    serviceSocket.notify(QJsonRpcMessage::createNotification("test.second"));
+    QVERIFY(buffer.data().isEmpty());
+
+    // both messages are written together on the next event loop iteration
+    while (buffer.data().isEmpty())
+        qApp->processEvents();
+    QJsonRpcSocketPrivate socketPrivate(0);
+    int firstEnd = socketPrivate.findJsonDocumentEnd(buffer.data());
+    QVERIFY(firstEnd != -1);
+    QCOMPARE(QJsonRpcMessage::fromJson(buffer.data().left(firstEnd + 1)).method(),
+             QLatin1String("test.first"));
+    QCOMPARE(QJsonRpcMessage::fromJson(buffer.data().mid(firstEnd + 1)).method(),
+             QLatin1String("test.second"));
+
+    // reaching the threshold writes immediately
+    buffer.buffer().clear();
+    buffer.seek(0);
+    serviceSocket.setWriteCoalescingThreshold(1);
+    serviceSocket.notify(QJsonRpcMessage::createNotification("test.third"));
+    QCOMPARE(QJsonRpcMessage::fromJson(buffer.data()).method(), QLatin1String("test.third"));
+}
+
+void TestQJsonRpcSocket::postedFromOtherThreads()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+
+    const int threadCount = 4;
+    const int count = 250;
+    QList<ResponsePoster *> posters;
+    for (int i = 0; i < threadCount; ++i) {
+        posters.append(new ResponsePoster(&serviceSocket, i, count));
+        posters.last()->start();
+    }
+    foreach (ResponsePoster *poster, posters)
+        QVERIFY(poster->wait(10000));
+    qDeleteAll(posters);
+
+    // nothing is written until the socket's thread drains the queue, then
+    // everything at once
+    QVERIFY(buffer.data().isEmpty());
+    while (buffer.data().isEmpty())
+        qApp->processEvents();
+
+    // every response arrives whole, in the order each thread posted them
+    QVector<int> next(threadCount);
+    QJsonRpcSocketPrivate socketPrivate(0);
+    QByteArray data = buffer.data();
+    int responses = 0;
+    while (!data.isEmpty()) {
+        const int end = socketPrivate.findJsonDocumentEnd(data);
+        QVERIFY(end != -1);
+        QJsonRpcMessage response = QJsonRpcMessage::fromJson(data.left(end + 1));
+        data.remove(0, end + 1);
+        QCOMPARE(response.type(), QJsonRpcMessage::Response);
+        const int index = response.result().toObject().value(QLatin1String("thread")).toInt();
+        QCOMPARE(response.result().toObject().value(QLatin1String("sequence")).toInt(), next[index]++);
+        responses++;
+    }
+    QCOMPARE(responses, threadCount * count);
+}
+
+void TestQJsonRpcSocket::writeSerialization()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+
+    QJsonArray params;
+    params.append(QLatin1String("quote\" backslash\\ tab\t newline\n \x01"));
+    params.append(QString::fromUtf8("\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"));
+    params.append(42);
+    params.append(-0.5);
+    params.append(1e300);
+    params.append(true);
+    params.append(QJsonValue());
+    QJsonObject named;
+    named.insert(QLatin1String("key"), QLatin1String("value"));
+    params.append(named);
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("test.serialize", params);
+    serviceSocket.notify(request);
+
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(buffer.data(), &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QCOMPARE(document.object(), request.toObject());
+
+    // messages read from JSON keep their original id
+    buffer.buffer().clear();
+    buffer.seek(0);
+    QJsonRpcMessage stringId = QJsonRpcMessage::fromJson(
+        "{\"jsonrpc\":\"2.0\",\"id\":\"abc\",\"method\":\"test.id\"}");
+    serviceSocket.notify(stringId.createResponse(QLatin1String("done")));
+    document = QJsonDocument::fromJson(buffer.data());
+    QCOMPARE(document.object().value(QLatin1String("id")).toString(), QLatin1String("abc"));
+    QCOMPARE(document.object().value(QLatin1String("result")).toString(), QLatin1String("done"));
+
+    buffer.buffer().clear();
+    buffer.seek(0);
+    serviceSocket.notify(request.createErrorResponse(QJsonRpc::InvalidParams, "bad"));
+    QJsonRpcMessage response = QJsonRpcMessage::fromJson(buffer.data());
+    QCOMPARE(response.type(), QJsonRpcMessage::Error);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+    QCOMPARE(response.errorMessage(), QLatin1String("bad"));
+}
+
+void TestQJsonRpcSocket::requestIdsAsStrings()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+    serviceSocket.setRequestIdsAsStrings(true);
+
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("test.stringId");
+    QScopedPointer<QJsonRpcServiceReply> reply(serviceSocket.sendMessage(request));
+    QJsonObject written = QJsonDocument::fromJson(buffer.data()).object();
+    QCOMPARE(written.value(QLatin1String("id")).toString(), QString::number(request.id()));
+
+    // the peer echoes the string, which still matches the request
+    QJsonRpcMessage echoed = QJsonRpcMessage::fromObject(written);
+    qint64 readPosition = buffer.pos();
+    buffer.write(echoed.createResponse(QLatin1String("done")).toJson());
+    buffer.seek(readPosition);
+    while (reply->response().type() != QJsonRpcMessage::Response)
+        qApp->processEvents();
+    QCOMPARE(reply->response().id(), request.id());
+    QCOMPARE(reply->response().result().toString(), QLatin1String("done"));
+}
+
+void TestQJsonRpcSocket::codecs_data()
+{
+    QTest::addColumn<QByteArray>("contentType");
+    QTest::newRow("binary-json") << QJsonRpcCodec::binaryJson()->contentType();
+    if (QJsonRpcCodec::cbor())
+        QTest::newRow("cbor") << QJsonRpcCodec::cbor()->contentType();
+}
+
+void TestQJsonRpcSocket::codecs()
+{
+    QFETCH(QByteArray, contentType);
+    QJsonRpcCodec *codec = QJsonRpcCodec::codecForContentType(contentType);
+    QVERIFY(codec);
+    QCOMPARE(QJsonRpcCodec::codecForContentType(contentType.toUpper() + "; charset=binary"), codec);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket clientSocket(&buffer, this);
+    clientSocket.setCodec(codec);
+
+    // frames carry their content type, even with JSON framing
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("test.codec", QLatin1String("param"));
+    QScopedPointer<QJsonRpcServiceReply> reply(clientSocket.sendMessage(request));
+    QByteArray written = buffer.data();
+    int headerEnd = written.indexOf("\r\n\r\n");
+    QVERIFY(headerEnd != -1);
+    QVERIFY(written.left(headerEnd).contains("Content-Type: " + contentType));
+    QByteArray body = written.mid(headerEnd + 4);
+    QVERIFY(written.left(headerEnd).contains("Content-Length: " + QByteArray::number(body.size())));
+    QCOMPARE(QJsonRpcMessage::fromObject(codec->decode(body).toObject()), request);
+
+    // a socket without a codec reads the frame and answers in its encoding
+    QBuffer serverBuffer;
+    serverBuffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serverSocket(&serverBuffer, this);
+    QSignalSpy spyMessageReceived(&serverSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    serverBuffer.write(written);
+    serverBuffer.seek(0);
+    while (!spyMessageReceived.size())
+        qApp->processEvents();
+    QJsonRpcMessage received = spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>();
+    QCOMPARE(received.method(), QLatin1String("test.codec"));
+
+    serverBuffer.buffer().clear();
+    serverBuffer.seek(0);
+    serverSocket.notify(received.createResponse(QLatin1String("result")));
+    QByteArray response = serverBuffer.data();
+    QVERIFY(response.left(response.indexOf("\r\n\r\n")).contains("Content-Type: " + contentType));
+
+    // which the client decodes whatever framing it expects
+    qint64 readPosition = buffer.pos();
+    buffer.write(response);
+    buffer.seek(readPosition);
+    while (reply->response().type() != QJsonRpcMessage::Response)
+        qApp->processEvents();
+    QCOMPARE(reply->response().result().toString(), QLatin1String("result"));
+}
+
+void TestQJsonRpcSocket::compression()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket clientSocket(&buffer, this);
+    clientSocket.setCompressionThreshold(1024);
+
+    // small messages are written as they are
+    QJsonRpcMessage small = QJsonRpcMessage::createNotification("test.small");
+    clientSocket.notify(small);
+    QCOMPARE(QJsonRpcMessage::fromJson(buffer.data()), small);
+
+    buffer.buffer().clear();
+    buffer.seek(0);
+    QJsonArray numbers;
+    for (int i = 0; i < 10000; ++i)
+        numbers.append(i % 10);
+    QJsonRpcMessage large = QJsonRpcMessage::createNotification("test.large", numbers);
+    clientSocket.notify(large);
+    QByteArray written = buffer.data();
+    int headerEnd = written.indexOf("\r\n\r\n");
+    QVERIFY(headerEnd != -1);
+    QVERIFY(written.left(headerEnd).contains("Content-Encoding: deflate"));
+    QVERIFY(written.size() < large.toJson().size() / 4);
+
+    // the peer inflates it without being configured for compression
+    QBuffer serverBuffer;
+    serverBuffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serverSocket(&serverBuffer, this);
+    QSignalSpy spyMessageReceived(&serverSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    serverBuffer.write(written);
+    serverBuffer.seek(0);
+    while (!spyMessageReceived.size())
+        qApp->processEvents();
+    QJsonRpcMessage received = spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>();
+    QCOMPARE(received.method(), QLatin1String("test.large"));
+    QCOMPARE(received.params().toArray(), numbers);
+}
+
+void TestQJsonRpcSocket::attachments()
+{
+    QByteArray data;
+    for (int i = 0; i < 1024; ++i)
+        data.append(char(i % 256));
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket clientSocket(&buffer, this);
+    clientSocket.setAttachmentsEnabled(true);
+
+    // written after the body, which only holds the reference
+    QJsonRpcMessage notification = QJsonRpcMessage::createNotification("test.blob",
+        QJsonArray() << QLatin1String("name") << QJsonRpcMessage::attachmentReference(0));
+    notification.setAttachments(QList<QByteArray>() << data);
+    clientSocket.notify(notification);
+    QByteArray written = buffer.data();
+    int headerEnd = written.indexOf("\r\n\r\n");
+    QVERIFY(headerEnd != -1);
+    QVERIFY(written.left(headerEnd).contains("Attachments: 1024\r\n"));
+    QVERIFY(written.endsWith(data));
+    QVERIFY(written.size() < data.size() + 256);
+
+    // the peer reads them without being configured for it, next to a
+    // message without any
+    QJsonRpcMessage plain = QJsonRpcMessage::createNotification("test.plain");
+    clientSocket.notify(plain);
+    written = buffer.data();
+
+    QBuffer serverBuffer;
+    serverBuffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serverSocket(&serverBuffer, this);
+    QSignalSpy spyMessageReceived(&serverSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    serverBuffer.write(written);
+    serverBuffer.seek(0);
+    while (spyMessageReceived.size() < 2)
+        qApp->processEvents();
+    QJsonRpcMessage received = spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>();
+    QCOMPARE(received.method(), QLatin1String("test.blob"));
+    QCOMPARE(received.attachments().size(), 1);
+    QCOMPARE(received.attachment(received.params().toArray().at(1)), data);
+    received = spyMessageReceived.at(1).at(0).value<QJsonRpcMessage>();
+    QCOMPARE(received, plain);
+    QVERIFY(received.attachments().isEmpty());
+
+    // without attachments they are inlined as base64
+    serverBuffer.buffer().clear();
+    serverBuffer.seek(0);
+    serverSocket.notify(notification);
+    written = serverBuffer.data();
+    QVERIFY(!written.contains("Attachments:"));
+    received = QJsonRpcMessage::fromJson(written);
+    QCOMPARE(received.method(), QLatin1String("test.blob"));
+    QVERIFY(received.attachments().isEmpty());
+    QCOMPARE(received.params().toArray().at(1).toString(), QString::fromLatin1(data.toBase64()));
+    QCOMPARE(received.attachment(received.params().toArray().at(1)), data);
+}
+
+void TestQJsonRpcSocket::sendBatch()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+
+    QJsonRpcMessage first = QJsonRpcMessage::createRequest("test.first");
+    QJsonRpcMessage second = QJsonRpcMessage::createRequest("test.second");
+    QList<QJsonRpcMessage> messages;
+    messages << first << QJsonRpcMessage::createNotification("test.notify") << second;
+    QList<QJsonRpcServiceReply *> replies = serviceSocket.sendBatch(messages);
+    QCOMPARE(replies.size(), 2);
+    QCOMPARE(replies.at(0)->request().id(), first.id());
+    QCOMPARE(replies.at(1)->request().id(), second.id());
+
+    // the batch is written as a single array
+    QJsonDocument document = QJsonDocument::fromJson(buffer.data());
+    QVERIFY(document.isArray());
+    QCOMPARE(document.array().size(), 3);
+
+    // responses may arrive in any order
+    QJsonArray responses;
+    responses.append(second.createResponse(QLatin1String("second")).toObject());
+    responses.append(first.createResponse(QLatin1String("first")).toObject());
+    qint64 readPosition = buffer.pos();
+    buffer.write(QJsonDocument(responses).toJson());
+    buffer.seek(readPosition);
+    while (replies.at(0)->response().type() != QJsonRpcMessage::Response ||
+           replies.at(1)->response().type() != QJsonRpcMessage::Response)
+        qApp->processEvents();
+
+    QCOMPARE(replies.at(0)->response().result().toString(), QLatin1String("first"));
+    QCOMPARE(replies.at(1)->response().result().toString(), QLatin1String("second"));
+    qDeleteAll(replies);
+}
+
+void TestQJsonRpcSocket::responseCallback()
+{
+#if !defined(QJSONRPC_HAS_STD_FUNCTION)
+#if QT_VERSION >= 0x050000
+    QSKIP("response callbacks require c++11 support");
+#else
+    QSKIP("response callbacks require c++11 support", SkipAll);
+#endif
+#else
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+
+    int callCount = 0;
+    QJsonRpcMessage response;
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("test.callback");
+    serviceSocket.sendMessage(request, [&](const QJsonRpcMessage &message) {
+        callCount++;
+        response = message;
+    });
+
+    qint64 readPosition = buffer.pos();
+    buffer.write(request.createResponse(QLatin1String("done")).toJson());
+    buffer.seek(readPosition);
+    while (callCount == 0)
+        qApp->processEvents();
+
+    QCOMPARE(callCount, 1);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toString(), QLatin1String("done"));
+
+    // a duplicate response is ignored once the callback has run
+    readPosition = buffer.pos();
+    buffer.write(request.createResponse(QLatin1String("again")).toJson());
+    buffer.seek(readPosition);
+    qApp->processEvents();
+    QCOMPARE(callCount, 1);
+#endif
+}
+
+void TestQJsonRpcSocket::asyncRequestTimeout()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+    serviceSocket.setDefaultRequestTimeout(100);
+
+    QJsonRpcMessage answered = QJsonRpcMessage::createRequest("test.answered");
+    QJsonRpcMessage unanswered = QJsonRpcMessage::createRequest("test.unanswered");
+    QScopedPointer<QJsonRpcServiceReply> answeredReply(serviceSocket.sendMessage(answered));
+    QScopedPointer<QJsonRpcServiceReply> unansweredReply(serviceSocket.sendMessage(unanswered));
+    QSignalSpy spy(unansweredReply.data(), SIGNAL(finished()));
+
+    qint64 readPosition = buffer.pos();
+    buffer.write(answered.createResponse(QLatin1String("done")).toJson());
+    buffer.seek(readPosition);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (spy.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+
+    QCOMPARE(spy.count(), 1);
+    QVERIFY(timer.elapsed() >= 100);
+    QCOMPARE(unansweredReply->response().type(), QJsonRpcMessage::Error);
+    QCOMPARE(unansweredReply->response().errorCode(), int(QJsonRpc::TimeoutError));
+    QCOMPARE(unansweredReply->response().id(), unanswered.id());
+    QCOMPARE(answeredReply->response().result().toString(), QLatin1String("done"));
+}
+
+void TestQJsonRpcSocket::flowControl()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+    serviceSocket.setMaximumRequestsInFlight(1);
+
+    // the second request waits for the first one's response
+    QJsonRpcMessage first = QJsonRpcMessage::createRequest("test.first");
+    QJsonRpcMessage second = QJsonRpcMessage::createRequest("test.second");
+    QScopedPointer<QJsonRpcServiceReply> firstReply(serviceSocket.sendMessage(first));
+    QScopedPointer<QJsonRpcServiceReply> secondReply(serviceSocket.sendMessage(second));
+    QVERIFY(buffer.data().contains("test.first"));
+    QVERIFY(!buffer.data().contains("test.second"));
+
+    qint64 readPosition = buffer.pos();
+    buffer.write(first.createResponse(QLatin1String("done")).toJson());
+    buffer.seek(readPosition);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!buffer.data().contains("test.second") && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QVERIFY(buffer.data().contains("test.second"));
+    QCOMPARE(firstReply->response().result().toString(), QLatin1String("done"));
+
+    // past the high water mark reading pauses and requests are held back
+    // until the buffer drains to the low water mark
+    buffer.buffer().clear();
+    buffer.seek(0);
+    serviceSocket.setMaximumRequestsInFlight(-1);
+    serviceSocket.setWriteCoalescingDelay(60000);
+    serviceSocket.setWriteBufferWaterMarks(64, 0);
+    QSignalSpy fullSpy(&serviceSocket, SIGNAL(writeBufferFull()));
+    QSignalSpy drainedSpy(&serviceSocket, SIGNAL(writeBufferDrained()));
+    QSignalSpy pausedSpy(&serviceSocket, SIGNAL(readingPaused()));
+    QSignalSpy resumedSpy(&serviceSocket, SIGNAL(readingResumed()));
+
+    QJsonArray params;
+    params.append(QString(128, QLatin1Char('x')));
+    serviceSocket.notify(QJsonRpcMessage::createNotification("test.large", params));
+    QCOMPARE(fullSpy.count(), 1);
+    QCOMPARE(pausedSpy.count(), 1);
+    QVERIFY(serviceSocket.isReadingPaused());
+    QVERIFY(serviceSocket.bytesToWrite() >= 128);
+
+    QJsonRpcMessage held = QJsonRpcMessage::createRequest("test.held");
+    QScopedPointer<QJsonRpcServiceReply> heldReply(serviceSocket.sendMessage(held));
+    serviceSocket.flush();
+    QVERIFY(!buffer.data().contains("test.held"));
+
+    timer.restart();
+    while (drainedSpy.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(drainedSpy.count(), 1);
+    QCOMPARE(resumedSpy.count(), 1);
+    QVERIFY(!serviceSocket.isReadingPaused());
+    serviceSocket.flush();
+    QVERIFY(buffer.data().contains("test.held"));
+}
+
+void TestQJsonRpcSocket::memoryLimits()
+{
+    // frames within the limit are read as usual
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+    socket.setMaximumFrameSize(64);
+    QCOMPARE(socket.maximumFrameSize(), 64);
+    QSignalSpy receivedSpy(&socket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QSignalSpy exceededSpy(&socket, SIGNAL(memoryLimitExceeded()));
+    buffer.write("{\"jsonrpc\": \"2.0\", \"method\": \"test.small\"}");
+    buffer.seek(0);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (receivedSpy.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(receivedSpy.count(), 1);
+    QCOMPARE(exceededSpy.count(), 0);
+    QCOMPARE(socket.memoryUsage(), qint64(0));
+
+    // a document that never ends is refused once it outgrows the limit
+    qint64 readPosition = buffer.pos();
+    buffer.write("{\"jsonrpc\": \"2.0\", \"method\": \"" + QByteArray(128, 'x'));
+    buffer.seek(readPosition);
+    timer.restart();
+    while (buffer.isOpen() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(exceededSpy.count(), 1);
+    QCOMPARE(receivedSpy.count(), 1);
+    QVERIFY(!buffer.isOpen());
+    QCOMPARE(socket.memoryUsage(), qint64(0));
+
+    // a frame whose header announces too large a body isn't waited for
+    QBuffer framed;
+    framed.open(QIODevice::ReadWrite);
+    QJsonRpcSocket framedSocket(&framed, this);
+    framedSocket.setFramingMode(QJsonRpc::ContentLengthFraming);
+    framedSocket.setMaximumFrameSize(64);
+    QSignalSpy framedSpy(&framedSocket, SIGNAL(memoryLimitExceeded()));
+    framed.write("Content-Length: 1000\r\n\r\n{");
+    framed.seek(0);
+    timer.restart();
+    while (framed.isOpen() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(framedSpy.count(), 1);
+    QVERIFY(!framed.isOpen());
+
+    // even without a maximum, sizes adding up past what a buffer can hold
+    // are refused rather than overflowing
+    QBuffer announced;
+    announced.open(QIODevice::ReadWrite);
+    QJsonRpcSocket announcedSocket(&announced, this);
+    announcedSocket.setFramingMode(QJsonRpc::ContentLengthFraming);
+    QSignalSpy announcedSpy(&announcedSocket, SIGNAL(memoryLimitExceeded()));
+    QSignalSpy announcedReceivedSpy(&announcedSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    announced.write("Content-Length: 2000000000\r\nAttachments: 1000000000\r\n\r\n{}");
+    announced.seek(0);
+    timer.restart();
+    while (announced.isOpen() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(announcedSpy.count(), 1);
+    QCOMPARE(announcedReceivedSpy.count(), 0);
+    QVERIFY(!announced.isOpen());
+
+    // and so is a connection holding more than its maximum to write
+    QBuffer output;
+    output.open(QIODevice::ReadWrite);
+    QJsonRpcSocket outputSocket(&output, this);
+    outputSocket.setWriteCoalescingDelay(60000);
+    outputSocket.setMaximumMemoryUsage(256);
+    QCOMPARE(outputSocket.maximumMemoryUsage(), qint64(256));
+    QSignalSpy outputSpy(&outputSocket, SIGNAL(memoryLimitExceeded()));
+    QJsonArray params;
+    params.append(QString(64, QLatin1Char('x')));
+    outputSocket.notify(QJsonRpcMessage::createNotification("test.small", params));
+    QCOMPARE(outputSpy.count(), 0);
+    QVERIFY(outputSocket.memoryUsage() > 64);
+
+    params.replace(0, QString(256, QLatin1Char('x')));
+    outputSocket.notify(QJsonRpcMessage::createNotification("test.large", params));
+    QCOMPARE(outputSpy.count(), 1);
+    QCOMPARE(outputSocket.memoryUsage(), qint64(0));
+
+    // the device is closed once the write that exceeded the limit returned
+    QVERIFY(output.isOpen());
+    timer.restart();
+    while (output.isOpen() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QVERIFY(!output.isOpen());
+}
+
+class InProcessService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "inprocess")
+public:
+    InProcessService() : notifications(0) {}
+
+    int notifications;
+
+public Q_SLOTS:
+    QString echo(const QString &text) const { return text; }
+    bool onServiceThread() const { return QThread::currentThread() == thread(); }
+    void notified() { notifications++; }
+};
+
+void TestQJsonRpcSocket::inProcessSocket()
+{
+    QJsonRpcInProcessSocket client;
+    QVERIFY(!client.isValid());
+    QVERIFY(!client.sendMessage(QJsonRpcMessage::createRequest("inprocess.echo")));
+
+    // the service end lives on a thread of its own
+    QThread serviceThread;
+    QJsonRpcInProcessServiceSocket *serviceSocket = new QJsonRpcInProcessServiceSocket;
+    InProcessService *service = new InProcessService;
+    QVERIFY(serviceSocket->addService(service));
+    client.setPeer(serviceSocket);
+    QVERIFY(client.isValid());
+    QCOMPARE(serviceSocket->peer(), &client);
+    serviceSocket->moveToThread(&serviceThread);
+    service->moveToThread(&serviceThread);
+    serviceThread.start();
+
+    QJsonRpcMessage response = client.invokeRemoteMethodBlocking("inprocess.echo", "direct");
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QLatin1String("direct"));
+    response = client.invokeRemoteMethodBlocking("inprocess.onServiceThread");
+    QVERIFY(response.result().toBool());
+
+    QScopedPointer<QJsonRpcServiceReply> reply(client.invokeRemoteMethod("inprocess.echo", "async"));
+    QSignalSpy spyFinished(reply.data(), SIGNAL(finished()));
+    QElapsedTimer timer;
+    timer.start();
+    while (spyFinished.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(reply->response().result().toString(), QLatin1String("async"));
+
+    QList<QJsonRpcMessage> batch;
+    batch << QJsonRpcMessage::createNotification("inprocess.notified")
+          << QJsonRpcMessage::createNotification("inprocess.notified");
+    QVERIFY(client.sendBatch(batch).isEmpty());
+    client.notify(QJsonRpcMessage::createNotification("inprocess.notified"));
+    timer.restart();
+    while (service->notifications < 3 && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(service->notifications, 3);
+
+    // an end that doesn't answer lets requests time out
+    QJsonRpcInProcessSocket silent;
+    client.setPeer(&silent);
+    QVERIFY(!serviceSocket->peer());
+    client.setDefaultRequestTimeout(100);
+    QScopedPointer<QJsonRpcServiceReply> unanswered(client.invokeRemoteMethod("inprocess.echo", "lost"));
+    QSignalSpy spyUnanswered(unanswered.data(), SIGNAL(finished()));
+    timer.restart();
+    while (spyUnanswered.isEmpty() && timer.elapsed() < 5000)
+        qApp->processEvents();
+    QCOMPARE(unanswered->response().errorCode(), int(QJsonRpc::TimeoutError));
+
+    serviceThread.quit();
+    QVERIFY(serviceThread.wait());
+    delete serviceSocket;
+}
+
+class ShardService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "shard")
+public:
+    explicit ShardService(const QString &name) : name(name) {}
+
+    const QString name;
+
+public Q_SLOTS:
+    QString owner(const QString &key) const { Q_UNUSED(key) return name; }
+    QString ownerOf(const QString &other, const QString &key) const { Q_UNUSED(other) Q_UNUSED(key) return name; }
+};
+
+void TestQJsonRpcSocket::clusterSocket()
+{
+    QJsonRpcClusterSocket cluster;
+    QVERIFY(!cluster.isValid());
+    QVERIFY(cluster.nodeForKey("key").isEmpty());
+    QVERIFY(!cluster.sendMessage(QJsonRpcMessage::createRequest("shard.owner", QString::fromLatin1("key"))));
+
+    QList<QJsonRpcInProcessServiceSocket *> services;
+    QList<QJsonRpcInProcessSocket *> clients;
+    for (int i = 0; i < 3; ++i) {
+        const QString name = QString::fromLatin1("node-%1").arg(i);
+        QJsonRpcInProcessServiceSocket *service = new QJsonRpcInProcessServiceSocket;
+        QVERIFY(service->addService(new ShardService(name)));
+        QJsonRpcInProcessSocket *client = new QJsonRpcInProcessSocket;
+        client->setPeer(service);
+        services.append(service);
+        clients.append(client);
+        cluster.addNode(name, client);
+    }
+    QVERIFY(cluster.isValid());
+    QCOMPARE(cluster.nodeNames().size(), 3);
+
+    // every node gets a share of the keys, each key always the same node
+    QHash<QString, QString> owners;
+    QHash<QString, int> shares;
+    for (int i = 0; i < 300; ++i) {
+        const QString key = QString::fromLatin1("account-%1").arg(i);
+        owners.insert(key, cluster.nodeForKey(key));
+        shares[owners.value(key)]++;
+    }
+    QCOMPARE(shares.size(), 3);
+    foreach (int share, shares)
+        QVERIFY(share > 30);
+
+    QJsonRpcMessage response = cluster.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("shard.owner", QString::fromLatin1("account-7")));
+    QCOMPARE(response.result().toString(), owners.value("account-7"));
+
+    // another param, or a key given explicitly
+    cluster.setShardKeyParameter("shard.ownerOf", "/1");
+    QCOMPARE(cluster.shardKeyParameter("shard.ownerOf"), QLatin1String("/1"));
+    QCOMPARE(cluster.shardKeyParameter(), QLatin1String("/0"));
+    response = cluster.sendMessageBlocking(QJsonRpcMessage::createRequest("shard.ownerOf",
+        QJsonArray() << QLatin1String("ignored") << QLatin1String("account-8")));
+    QCOMPARE(response.result().toString(), owners.value("account-8"));
+    response = cluster.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("shard.owner", QString::fromLatin1("ignored")),
+        QString::fromLatin1("account-9"));
+    QCOMPARE(response.result().toString(), owners.value("account-9"));
+
+    // batches are split by node, the replies keep the order of the requests
+    QList<QJsonRpcMessage> batch;
+    for (int i = 0; i < 12; ++i) {
+        batch << QJsonRpcMessage::createRequest("shard.owner",
+                     QString::fromLatin1("account-%1").arg(i));
+    }
+    QList<QJsonRpcServiceReply *> replies = cluster.sendBatch(batch);
+    QCOMPARE(replies.size(), batch.size());
+    for (int i = 0; i < replies.size(); ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        while (!replies.at(i)->response().isValid() && timer.elapsed() < 5000)
+            qApp->processEvents();
+        QCOMPARE(replies.at(i)->response().result().toString(),
+                 owners.value(QString::fromLatin1("account-%1").arg(i)));
+    }
+    qDeleteAll(replies);
+
+    // only the keys of a node leaving move, and those of one destroyed
+    cluster.removeNode("node-2");
+    QVERIFY(!cluster.node("node-2"));
+    int moved = 0;
+    QHash<QString, QString>::const_iterator it;
+    for (it = owners.constBegin(); it != owners.constEnd(); ++it) {
+        const QString owner = cluster.nodeForKey(it.key());
+        QVERIFY(owner != QLatin1String("node-2"));
+        if (it.value() != QLatin1String("node-2"))
+            QCOMPARE(owner, it.value());
+        else
+            moved++;
+    }
+    QCOMPARE(moved, shares.value("node-2"));
+
+    delete clients.takeAt(1);
+    QCOMPARE(cluster.nodeNames(), QStringList() << QLatin1String("node-0"));
+    QCOMPARE(cluster.nodeForKey("account-1"), QLatin1String("node-0"));
+
+    qDeleteAll(clients);
+    qDeleteAll(services);
+    QVERIFY(!cluster.isValid());
+}
+
 QTEST_MAIN(TestQJsonRpcSocket)
 #include "tst_qjsonrpcsocket.moc"
@@ -0,0 +1,6 @@
+DEPTH = ../../..
+include($${DEPTH}/qjsonrpc.pri)
+include($${DEPTH}/tests/tests.pri)
+
+TARGET = tst_qjsonrpcudpserver
+SOURCES = tst_qjsonrpcudpserver.cpp
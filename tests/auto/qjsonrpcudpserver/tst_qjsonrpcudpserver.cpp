@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <QUdpSocket>
+#include <QScopedPointer>
+
+#include <QtCore/QEventLoop>
+#include <QtCore/QVariant>
+#include <QtCore/QElapsedTimer>
+#include <QtTest/QtTest>
+
+#include "qjsonrpcservice.h"
+#include "qjsonrpcudpserver.h"
+#include "qjsonrpcudpsocket.h"
+#include "qjsonrpcmessage.h"
+#include "qjsonrpcservicereply.h"
+
+class TestQJsonRpcUdpServer: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void notifications();
+    void requests();
+    void oversizedMessages();
+    void notifyConnectedClients();
+    void peerTimeout();
+    void maximumPeerCount();
+    void responsesDisabled();
+
+private:
+    QJsonRpcUdpSocket *createClient();
+
+    QScopedPointer<QJsonRpcUdpServer> server;
+    QList<QUdpSocket*> udpSockets;
+
+};
+
+class TestService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "service")
+public:
+    TestService(QObject *parent = 0)
+        : QJsonRpcService(parent),
+          m_called(0)
+    {}
+
+    int callCount() const {
+        return m_called;
+    }
+
+public Q_SLOTS:
+    void sample(int value) {
+        Q_UNUSED(value)
+        m_called++;
+    }
+
+    QString singleParam(const QString &string) const { return string; }
+
+private:
+    int m_called;
+
+};
+
+void TestQJsonRpcUdpServer::init()
+{
+    server.reset(new QJsonRpcUdpServer);
+    QVERIFY(server->listen(QHostAddress::LocalHost));
+    QVERIFY(server->isListening());
+    QVERIFY(server->serverPort() != 0);
+}
+
+void TestQJsonRpcUdpServer::cleanup()
+{
+    server->close();
+    QVERIFY(!server->isListening());
+    QCOMPARE(server->connectedClientCount(), 0);
+    qDeleteAll(udpSockets);
+    udpSockets.clear();
+}
+
+QJsonRpcUdpSocket *TestQJsonRpcUdpServer::createClient()
+{
+    QUdpSocket *udpSocket = new QUdpSocket;
+    udpSockets.append(udpSocket);
+    return new QJsonRpcUdpSocket(udpSocket, QHostAddress::LocalHost, server->serverPort(), udpSocket);
+}
+
+void TestQJsonRpcUdpServer::notifications()
+{
+    TestService *service = new TestService;
+    QVERIFY(server->addService(service));
+    QSignalSpy spyConnected(server.data(), SIGNAL(clientConnected()));
+
+    // one datagram each, then several in a single one
+    QJsonRpcUdpSocket *client = createClient();
+    for (int i = 0; i < 20; ++i)
+        client->notify(QJsonRpcMessage::createNotification("service.sample", QJsonValue(i)));
+
+    QList<QJsonRpcMessage> batch;
+    for (int i = 0; i < 20; ++i)
+        batch.append(QJsonRpcMessage::createNotification("service.sample", QJsonValue(i)));
+    QVERIFY(client->sendBatch(batch).isEmpty());
+
+    // datagrams may get lost, though hardly ever on the loopback interface
+    QElapsedTimer timer;
+    timer.start();
+    while (service->callCount() < 40 && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(service->callCount(), 40);
+
+    // peers only become clients once responses are enabled
+    QCOMPARE(spyConnected.count(), 0);
+    QCOMPARE(server->connectedClientCount(), 0);
+}
+
+void TestQJsonRpcUdpServer::requests()
+{
+    server->setResponsesEnabled(true);
+    QVERIFY(server->addService(new TestService));
+    QJsonRpcUdpSocket *client = createClient();
+    QVERIFY(client->isValid());
+
+    QJsonRpcMessage response = client->invokeRemoteMethodBlocking("service.singleParam", "udp");
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.result().toString(), QLatin1String("udp"));
+
+    QScopedPointer<QJsonRpcServiceReply> reply(client->invokeRemoteMethod("service.singleParam", "async"));
+    QVERIFY(reply);
+    QSignalSpy spyFinished(reply.data(), SIGNAL(finished()));
+    QElapsedTimer timer;
+    timer.start();
+    while (spyFinished.isEmpty() && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(reply->response().result().toString(), QLatin1String("async"));
+
+    // datagrams from anyone but the server are ignored
+    QUdpSocket stranger;
+    QVERIFY(stranger.bind(QHostAddress::LocalHost, 0));
+    QSignalSpy spyMessageReceived(client, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QJsonRpcMessage notification = QJsonRpcMessage::createNotification("stranger");
+    stranger.writeDatagram(notification.toJson(), QHostAddress::LocalHost,
+                           udpSockets.first()->localPort());
+    QTest::qWait(200);
+    QCOMPARE(spyMessageReceived.count(), 0);
+}
+
+void TestQJsonRpcUdpServer::oversizedMessages()
+{
+    TestService *service = new TestService;
+    QVERIFY(server->addService(service));
+    server->setMaximumDatagramSize(512);
+    QCOMPARE(server->maximumDatagramSize(), 512);
+
+    QJsonRpcUdpSocket *client = createClient();
+    QCOMPARE(client->maximumDatagramSize(), 65507);
+    const QString large(1024, QLatin1Char('x'));
+
+    // dropped by the server
+    client->notify(QJsonRpcMessage::createNotification("service.singleParam", QJsonValue(large)));
+    client->notify(QJsonRpcMessage::createNotification("service.sample", QJsonValue(1)));
+    QElapsedTimer timer;
+    timer.start();
+    while (service->callCount() < 1 && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(service->callCount(), 1);
+    QCOMPARE(server->rejectedDatagramCount(), 1);
+
+    // dropped by the client, the request times out
+    client->setMaximumDatagramSize(512);
+    client->setDefaultRequestTimeout(200);
+    QScopedPointer<QJsonRpcServiceReply> reply(client->invokeRemoteMethod("service.singleParam", large));
+    QSignalSpy spyFinished(reply.data(), SIGNAL(finished()));
+    timer.restart();
+    while (spyFinished.isEmpty() && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(reply->response().errorCode(), int(QJsonRpc::TimeoutError));
+    QCOMPARE(client->rejectedDatagramCount(), 1);
+}
+
+void TestQJsonRpcUdpServer::notifyConnectedClients()
+{
+    server->setResponsesEnabled(true);
+    QVERIFY(server->addService(new TestService));
+    QJsonRpcUdpSocket *first = createClient();
+    QJsonRpcUdpSocket *second = createClient();
+
+    // clients are known once they sent something
+    QCOMPARE(first->invokeRemoteMethodBlocking("service.singleParam", "first").type(),
+             QJsonRpcMessage::Response);
+    QCOMPARE(second->invokeRemoteMethodBlocking("service.singleParam", "second").type(),
+             QJsonRpcMessage::Response);
+    QCOMPARE(server->connectedClientCount(), 2);
+
+    QSignalSpy spyFirst(first, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QSignalSpy spySecond(second, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QJsonRpcMessage notification = QJsonRpcMessage::createNotification("broadcast", QJsonValue(42));
+    server->notifyConnectedClients(notification);
+
+    QElapsedTimer timer;
+    timer.start();
+    while ((spyFirst.isEmpty() || spySecond.isEmpty()) && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(spyFirst.count(), 1);
+    QCOMPARE(spySecond.count(), 1);
+    QCOMPARE(spyFirst.takeFirst().first().value<QJsonRpcMessage>(), notification);
+}
+
+void TestQJsonRpcUdpServer::peerTimeout()
+{
+    QCOMPARE(server->peerTimeout(), 60000);
+    server->setPeerTimeout(200);
+    server->setResponsesEnabled(true);
+    QVERIFY(server->addService(new TestService));
+
+    QJsonRpcUdpSocket *client = createClient();
+    QCOMPARE(client->invokeRemoteMethodBlocking("service.singleParam", "hello").type(),
+             QJsonRpcMessage::Response);
+    QCOMPARE(server->connectedClientCount(), 1);
+
+    QSignalSpy spyDisconnected(server.data(), SIGNAL(clientDisconnected()));
+    QElapsedTimer timer;
+    timer.start();
+    while (spyDisconnected.isEmpty() && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(spyDisconnected.count(), 1);
+    QCOMPARE(server->connectedClientCount(), 0);
+}
+
+void TestQJsonRpcUdpServer::maximumPeerCount()
+{
+    QCOMPARE(server->maximumPeerCount(), 1024);
+    server->setMaximumPeerCount(0);
+    QCOMPARE(server->maximumPeerCount(), 1024);
+    server->setMaximumPeerCount(1);
+    QCOMPARE(server->maximumPeerCount(), 1);
+    server->setResponsesEnabled(true);
+    TestService *service = new TestService;
+    QVERIFY(server->addService(service));
+
+    QJsonRpcUdpSocket *first = createClient();
+    QCOMPARE(first->invokeRemoteMethodBlocking("service.singleParam", "first").type(),
+             QJsonRpcMessage::Response);
+    QCOMPARE(server->connectedClientCount(), 1);
+
+    // neither processed nor answered
+    QJsonRpcUdpSocket *second = createClient();
+    QSignalSpy spySecond(second, SIGNAL(messageReceived(QJsonRpcMessage)));
+    second->notify(QJsonRpcMessage::createNotification("service.sample", QJsonValue(1)));
+    QScopedPointer<QJsonRpcServiceReply> reply(second->invokeRemoteMethod("service.singleParam", "second"));
+    QElapsedTimer timer;
+    timer.start();
+    while (server->rejectedDatagramCount() < 2 && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(server->rejectedDatagramCount(), 2);
+    QTest::qWait(200);
+    QCOMPARE(spySecond.count(), 0);
+    QCOMPARE(service->callCount(), 0);
+    QCOMPARE(server->connectedClientCount(), 1);
+
+    // the known client is still served
+    QCOMPARE(first->invokeRemoteMethodBlocking("service.singleParam", "again").result().toString(),
+             QLatin1String("again"));
+}
+
+void TestQJsonRpcUdpServer::responsesDisabled()
+{
+    QVERIFY(!server->responsesEnabled());
+    TestService *service = new TestService;
+    QVERIFY(server->addService(service));
+    QSignalSpy spyConnected(server.data(), SIGNAL(clientConnected()));
+
+    // neither requests, subscriptions nor invalid messages are answered
+    QJsonRpcUdpSocket *client = createClient();
+    QSignalSpy spyMessageReceived(client, SIGNAL(messageReceived(QJsonRpcMessage)));
+    client->setDefaultRequestTimeout(200);
+    QScopedPointer<QJsonRpcServiceReply> reply(client->invokeRemoteMethod("service.singleParam", "udp"));
+    QSignalSpy spyFinished(reply.data(), SIGNAL(finished()));
+    QJsonArray topics;
+    topics.append(QLatin1String("topic"));
+    client->notify(QJsonRpcMessage::createNotification("rpc.subscribe", topics));
+    udpSockets.first()->writeDatagram("{}", QHostAddress::LocalHost, server->serverPort());
+
+    // while notifications are processed
+    client->notify(QJsonRpcMessage::createNotification("service.sample", QJsonValue(1)));
+    QElapsedTimer timer;
+    timer.start();
+    while ((spyFinished.isEmpty() || service->callCount() < 1) && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    QCOMPARE(reply->response().errorCode(), int(QJsonRpc::TimeoutError));
+    QCOMPARE(service->callCount(), 1);
+    QCOMPARE(server->subscriberCount(QLatin1String("topic")), 0);
+
+    // and the peer is no client to broadcast to
+    QCOMPARE(server->connectedClientCount(), 0);
+    QCOMPARE(spyConnected.count(), 0);
+    server->notifyConnectedClients(QJsonRpcMessage::createNotification("broadcast"));
+    QTest::qWait(200);
+    QCOMPARE(spyMessageReceived.count(), 0);
+}
+
+QTEST_MAIN(TestQJsonRpcUdpServer)
+#include "tst_qjsonrpcudpserver.moc"
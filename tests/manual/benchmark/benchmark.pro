@@ -6,3 +6,5 @@ CONFIG -= testcase
 TARGET = benchmark
 SOURCES = \
     tst_benchmark.cpp
+RESOURCES = \
+    benchmark.qrc
@@ -29,6 +29,8 @@
 #endif
 
 #include "qjsonrpcabstractserver.h"
+#include "qjsonrpccodec.h"
+#include "qjsonrpcsocket_p.h"
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcservice.h"
 #include "qjsonrpcmessage.h"
@@ -39,9 +41,56 @@ class TestBenchmark: public QObject
 private Q_SLOTS:
     void simple();
     void namedParameters();
+    void framing_data();
+    void framing();
+    void parsing_data();
+    void parsing();
+    void serializing_data();
+    void serializing();
+    void fromVariantList();
+    void decoding_data();
+    void decoding();
+    void encoding_data();
+    void encoding();
+    void allocations_data();
+    void allocations();
 
 };
 
+#if defined(__GLIBC__)
+// Every allocation of the process goes through these while they're defined
+// in the executable, glibc's own versions remain reachable under their
+// internal names. Only the benchmarks thread allocates while counting.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static bool countingAllocations = false;
+static int allocationCount = 0;
+
+extern "C" void *malloc(size_t size)
+{
+    if (countingAllocations)
+        allocationCount++;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    if (countingAllocations)
+        allocationCount++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (countingAllocations)
+        allocationCount++;
+    return __libc_realloc(ptr, size);
+}
+#define QJSONRPC_COUNTS_ALLOCATIONS
+#endif
+
 class TestService : public QJsonRpcService
 {
     Q_OBJECT
@@ -107,6 +156,312 @@ void TestBenchmark::namedParameters()
     }
 }
 
+// byte at a time reference for the frame scanner, used as the baseline
+static int scalarJsonDocumentEnd(const QByteArray &jsonData)
+{
+    const char *data = jsonData.constData();
+    const int size = jsonData.size();
+    int i = 0;
+    while (i < size && data[i] != '{' && data[i] != '[')
+        i++;
+    if (i == size)
+        return -1;
+
+    const char blockStart = data[i];
+    const char blockEnd = (blockStart == '{') ? '}' : ']';
+    int depth = 1;
+    bool inString = false;
+    bool escaped = false;
+    for (i++; i < size; ++i) {
+        const char c = data[i];
+        if (inString) {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                inString = false;
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == blockStart) {
+            depth++;
+        } else if (c == blockEnd && --depth == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void TestBenchmark::framing_data()
+{
+    QTest::addColumn<bool>("vectorized");
+    QTest::addColumn<QByteArray>("payload");
+
+    QJsonArray strings;
+    QJsonArray numbers;
+    for (int i = 0; i < 10000; ++i) {
+        strings.append(QString("some sample data to make the response larger %1").arg(i));
+        numbers.append(i * 3.14159);
+    }
+
+    QByteArray stringPayload =
+        QJsonRpcMessage::createRequest("service.strings", strings).toJson();
+    QByteArray numberPayload =
+        QJsonRpcMessage::createRequest("service.numbers", numbers).toJson();
+    QTest::newRow("strings-scalar") << false << stringPayload;
+    QTest::newRow("strings-vectorized") << true << stringPayload;
+    QTest::newRow("numbers-scalar") << false << numberPayload;
+    QTest::newRow("numbers-vectorized") << true << numberPayload;
+}
+
+void TestBenchmark::framing()
+{
+    QFETCH(bool, vectorized);
+    QFETCH(QByteArray, payload);
+
+    QJsonRpcSocketPrivate socketPrivate(0);
+    QCOMPARE(socketPrivate.findJsonDocumentEnd(payload), scalarJsonDocumentEnd(payload));
+
+    int end = -1;
+    if (vectorized) {
+        QBENCHMARK {
+            end = socketPrivate.findJsonDocumentEnd(payload);
+        }
+    } else {
+        QBENCHMARK {
+            end = scalarJsonDocumentEnd(payload);
+        }
+    }
+
+    QVERIFY(end > 0);
+}
+
+void TestBenchmark::parsing_data()
+{
+    QTest::addColumn<QByteArray>("json");
+
+    QFile file(":/test.json");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QTest::newRow("test.json") << file.readAll();
+
+    QJsonArray strings;
+    for (int i = 0; i < 10000; ++i)
+        strings.append(QString("some sample data to make the response larger %1").arg(i));
+    QJsonObject object;
+    object.insert("strings", strings);
+    QTest::newRow("strings-compact") << QJsonDocument(strings).toJson(QJsonDocument::Compact);
+    QTest::newRow("strings-indented") << QJsonDocument(object).toJson(QJsonDocument::Indented);
+
+    QJsonArray integers;
+    QJsonArray doubles;
+    for (int i = 0; i < 10000; ++i) {
+        integers.append(i * 7919);
+        doubles.append(i * 3.14159);
+    }
+    QTest::newRow("integers") << QJsonDocument(integers).toJson(QJsonDocument::Compact);
+    QTest::newRow("doubles") << QJsonDocument(doubles).toJson(QJsonDocument::Compact);
+}
+
+// measures the bundled parser on Qt 4, the one of QtCore on Qt 5
+void TestBenchmark::parsing()
+{
+    QFETCH(QByteArray, json);
+    QBENCHMARK {
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(json, &error);
+        QCOMPARE(error.error, QJsonParseError::NoError);
+    }
+}
+
+void TestBenchmark::serializing_data()
+{
+    parsing_data();
+}
+
+// the writer counterpart of parsing, on the same documents
+void TestBenchmark::serializing()
+{
+    QFETCH(QByteArray, json);
+    const QJsonDocument document = QJsonDocument::fromJson(json);
+    QVERIFY(!document.isNull());
+    QBENCHMARK {
+        QByteArray output = document.toJson(QJsonDocument::Compact);
+        QVERIFY(!output.isEmpty());
+    }
+}
+
+// how results returned as variants are converted, the bundled library builds
+// them in one pass
+void TestBenchmark::fromVariantList()
+{
+    QVariantList list;
+    for (int i = 0; i < 100000; ++i)
+        list.append(i % 2 ? QVariant(i) : QVariant(QString::number(i)));
+
+    QBENCHMARK {
+        QJsonArray array = QJsonArray::fromVariantList(list);
+        QCOMPARE(array.size(), list.size());
+    }
+}
+
+// The codecs compared below, the text one being the bundled parser on Qt 4
+// and the one of QtCore on Qt 5. Others are benchmarked by adding them here.
+static QList<QPair<QByteArray, QJsonRpcCodec *> > benchmarkCodecs()
+{
+    QList<QPair<QByteArray, QJsonRpcCodec *> > codecs;
+    codecs.append(qMakePair(QByteArray("json"), QJsonRpcCodec::json()));
+    codecs.append(qMakePair(QByteArray("binaryjson"), QJsonRpcCodec::binaryJson()));
+    if (QJsonRpcCodec::cbor())
+        codecs.append(qMakePair(QByteArray("cbor"), QJsonRpcCodec::cbor()));
+    return codecs;
+}
+
+static QJsonValue corpusValue(const QByteArray &json)
+{
+    const QJsonDocument document = QJsonDocument::fromJson(json);
+    if (document.isArray())
+        return document.array();
+    return document.object();
+}
+
+// the documents of the json autotest, along with generated ones dominated by
+// numbers or by strings
+static QList<QPair<QByteArray, QJsonValue> > benchmarkCorpora()
+{
+    QList<QPair<QByteArray, QJsonValue> > corpora;
+    const char *files[] = { "test.json", "test2.json", "test3.json" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        QFile file(QString(":/") + files[i]);
+        if (file.open(QIODevice::ReadOnly))
+            corpora.append(qMakePair(QByteArray(files[i]), corpusValue(file.readAll())));
+    }
+
+    QJsonArray numbers;
+    QJsonArray strings;
+    for (int i = 0; i < 10000; ++i) {
+        numbers.append(i % 2 ? QJsonValue(i * 7919) : QJsonValue(i * 3.14159));
+        strings.append(QString("some sample data to make the response larger %1").arg(i));
+    }
+    corpora.append(qMakePair(QByteArray("numbers"), QJsonValue(numbers)));
+    corpora.append(qMakePair(QByteArray("strings"), QJsonValue(strings)));
+    return corpora;
+}
+
+void TestBenchmark::decoding_data()
+{
+    QTest::addColumn<int>("codec");
+    QTest::addColumn<QJsonValue>("value");
+
+    const QList<QPair<QByteArray, QJsonRpcCodec *> > codecs = benchmarkCodecs();
+    const QList<QPair<QByteArray, QJsonValue> > corpora = benchmarkCorpora();
+    for (int i = 0; i < codecs.size(); ++i) {
+        for (int j = 0; j < corpora.size(); ++j) {
+            const QByteArray name = codecs.at(i).first + '-' + corpora.at(j).first;
+            QTest::newRow(name.constData()) << i << corpora.at(j).second;
+        }
+    }
+}
+
+// Runs the codec until at least a quarter of a second went by and reports
+// the rate in bytes of the encoded form, so that codecs and corpora of any
+// size compare directly.
+static void benchmarkThroughput(const QJsonRpcCodec *codec, const QJsonValue &value, bool decode)
+{
+    const QByteArray encoded = codec->encode(value);
+    QVERIFY(!encoded.isEmpty());
+    QCOMPARE(codec->decode(encoded), value);
+
+    QElapsedTimer timer;
+    qint64 iterations = 0;
+    timer.start();
+    do {
+        for (int i = 0; i < 16; ++i) {
+            if (decode) {
+                QJsonValue decoded = codec->decode(encoded);
+                Q_UNUSED(decoded)
+            } else {
+                QByteArray output = codec->encode(value);
+                Q_UNUSED(output)
+            }
+        }
+        iterations += 16;
+    } while (timer.elapsed() < 250);
+
+    const qint64 nsecs = qMax(timer.nsecsElapsed(), qint64(1));
+    QTest::setBenchmarkResult(qreal(encoded.size()) * iterations * 1e9 / nsecs,
+                              QTest::BytesPerSecond);
+}
+
+void TestBenchmark::decoding()
+{
+    QFETCH(int, codec);
+    QFETCH(QJsonValue, value);
+    benchmarkThroughput(benchmarkCodecs().at(codec).second, value, true);
+}
+
+void TestBenchmark::encoding_data()
+{
+    decoding_data();
+}
+
+void TestBenchmark::encoding()
+{
+    QFETCH(int, codec);
+    QFETCH(QJsonValue, value);
+    benchmarkThroughput(benchmarkCodecs().at(codec).second, value, false);
+}
+
+void TestBenchmark::allocations_data()
+{
+    QTest::addColumn<int>("codec");
+    QTest::addColumn<QJsonValue>("value");
+    QTest::addColumn<bool>("decode");
+
+    const QList<QPair<QByteArray, QJsonRpcCodec *> > codecs = benchmarkCodecs();
+    const QList<QPair<QByteArray, QJsonValue> > corpora = benchmarkCorpora();
+    for (int i = 0; i < codecs.size(); ++i) {
+        for (int j = 0; j < corpora.size(); ++j) {
+            const QByteArray name = codecs.at(i).first + '-' + corpora.at(j).first;
+            QTest::newRow((name + "-decode").constData()) << i << corpora.at(j).second << true;
+            QTest::newRow((name + "-encode").constData()) << i << corpora.at(j).second << false;
+        }
+    }
+}
+
+// heap allocations made by decoding or encoding one document
+void TestBenchmark::allocations()
+{
+#if defined(QJSONRPC_COUNTS_ALLOCATIONS)
+    QFETCH(int, codec);
+    QFETCH(QJsonValue, value);
+    QFETCH(bool, decode);
+
+    const QJsonRpcCodec *jsonCodec = benchmarkCodecs().at(codec).second;
+    const QByteArray encoded = jsonCodec->encode(value);
+
+    // once first, so that per-thread buffers and caches are in place
+    for (int pass = 0; pass < 2; ++pass) {
+        allocationCount = 0;
+        countingAllocations = pass == 1;
+        if (decode) {
+            QJsonValue decoded = jsonCodec->decode(encoded);
+            Q_UNUSED(decoded)
+        } else {
+            QByteArray output = jsonCodec->encode(value);
+            Q_UNUSED(output)
+        }
+        countingAllocations = false;
+    }
+
+    QTest::setBenchmarkResult(allocationCount, QTest::Events);
+#elif QT_VERSION >= 0x050000
+    QSKIP("allocations are only counted with glibc");
+#else
+    QSKIP("allocations are only counted with glibc", SkipAll);
+#endif
+}
+
 QTEST_MAIN(TestBenchmark)
 #include "tst_benchmark.moc"
 
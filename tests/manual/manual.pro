@@ -6,7 +6,8 @@ SUBDIRS += localserver \
            qjsonrpc \
            httpclient \
            httpserver \
-           benchmark
+           benchmark \
+           transportbenchmark
 
 greaterThan(QT_MAJOR_VERSION, 4) {
     qtHaveModule(script): SUBDIRS += console
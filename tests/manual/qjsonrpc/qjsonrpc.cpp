@@ -21,9 +21,351 @@
 #include <QScopedPointer>
 #include <QUrl>
 #include <QHostAddress>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QTimer>
+#include <QHash>
+#include <QUuid>
+
+#include <math.h>
+#include <stdio.h>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonDocument>
+#else
+#include "json/qjsondocument.h"
+#endif
 
 #include "qjsonrpcsocket.h"
+#include "qjsonrpchttpclient.h"
 #include "qjsonrpcservice.h"
+#include "qjsonrpcservicereply.h"
+
+// an http(s) URL, a host with an optional port (5555 by default), or the
+// name of a local server
+static QJsonRpcAbstractSocket *connectToService(const QString &service, QObject *parent = 0)
+{
+    if (service.startsWith("http://") || service.startsWith("https://"))
+        return new QJsonRpcHttpClient(service, parent);
+
+    QUrl serviceUrl = QUrl::fromUserInput(service);
+    QHostAddress serviceAddress(serviceUrl.host());
+    if (serviceAddress.isNull()) {
+        QLocalSocket *localSocket = new QLocalSocket;
+        localSocket->connectToServer(service);
+        if (!localSocket->waitForConnected(5000)) {
+            qDebug("could not connect to service: %s", service.toLocal8Bit().data());
+            delete localSocket;
+            return 0;
+        }
+
+        QJsonRpcSocket *socket = new QJsonRpcSocket(localSocket, parent);
+        localSocket->setParent(socket);
+        return socket;
+    }
+
+    QTcpSocket *tcpSocket = new QTcpSocket;
+    int servicePort = serviceUrl.port() > 0 ? serviceUrl.port() : 5555;
+    tcpSocket->connectToHost(serviceAddress, servicePort);
+    if (!tcpSocket->waitForConnected(5000)) {
+        qDebug("could not connect to host at %s:%d", serviceUrl.host().toLocal8Bit().data(),
+               servicePort);
+        delete tcpSocket;
+        return 0;
+    }
+
+    tcpSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    QJsonRpcSocket *socket = new QJsonRpcSocket(tcpSocket, parent);
+    tcpSocket->setParent(socket);
+    return socket;
+}
+
+static QString randomString(int length)
+{
+    static const char characters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    QString string;
+    string.reserve(length);
+    for (int i = 0; i < length; ++i)
+        string.append(QLatin1Char(characters[qrand() % (sizeof(characters) - 1)]));
+    return string;
+}
+
+// Strings of a params template standing for random values are replaced for
+// every request: {{int}} or {{int:min:max}}, {{double}}, {{bool}},
+// {{string}} or {{string:length}} and {{uuid}}
+static QJsonValue expandTemplate(const QJsonValue &value)
+{
+    if (value.isArray()) {
+        QJsonArray array;
+        foreach (const QJsonValue &element, value.toArray())
+            array.append(expandTemplate(element));
+        return array;
+    }
+
+    if (value.isObject()) {
+        const QJsonObject templateObject = value.toObject();
+        QJsonObject object;
+        for (QJsonObject::const_iterator it = templateObject.constBegin();
+             it != templateObject.constEnd(); ++it)
+            object.insert(it.key(), expandTemplate(it.value()));
+        return object;
+    }
+
+    const QString string = value.toString();
+    if (!value.isString() || !string.startsWith("{{") || !string.endsWith("}}"))
+        return value;
+
+    const QStringList placeholder = string.mid(2, string.size() - 4).split(QLatin1Char(':'));
+    const QString kind = placeholder.first();
+    if (kind == QLatin1String("int")) {
+        const int minimum = placeholder.size() > 1 ? placeholder.at(1).toInt() : 0;
+        const int maximum = placeholder.size() > 2 ? placeholder.at(2).toInt() : RAND_MAX;
+        const qint64 range = qMax(qint64(maximum) - minimum + 1, qint64(1));
+        return double(minimum + qint64(qrand()) % range);
+    } else if (kind == QLatin1String("double")) {
+        return double(qrand()) / RAND_MAX;
+    } else if (kind == QLatin1String("bool")) {
+        return bool(qrand() % 2);
+    } else if (kind == QLatin1String("string")) {
+        return randomString(placeholder.size() > 1 ? placeholder.at(1).toInt() : 16);
+    } else if (kind == QLatin1String("uuid")) {
+        return QUuid::createUuid().toString();
+    }
+
+    return value;
+}
+
+struct LoadOptions
+{
+    LoadOptions()
+        : qps(0), concurrency(1), duration(10), notification(false) {}
+
+    QString method;
+    QJsonValue params;
+    double qps;             // open loop at that rate, closed loop if 0
+    int concurrency;        // requests in flight per connection, closed loop
+    int duration;           // seconds
+    bool notification;
+};
+
+// Sends requests over every connection for the duration, either at a fixed
+// rate whatever the responses, or keeping a number of them in flight on
+// each connection, and prints the throughput and latencies of every second
+// and of the whole run.
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    LoadGenerator(const QList<QJsonRpcAbstractSocket *> &connections, const LoadOptions &options,
+                  QObject *parent = 0)
+        : QObject(parent),
+          m_connections(connections),
+          m_options(options),
+          m_nextConnection(0),
+          m_sent(0),
+          m_completed(0),
+          m_errors(0),
+          m_intervalCompleted(0),
+          m_intervalErrors(0),
+          m_lastReport(0),
+          m_duration(0),
+          m_stopping(false)
+    {
+        connect(&m_sendTimer, SIGNAL(timeout()), this, SLOT(sendDue()));
+        connect(&m_reportTimer, SIGNAL(timeout()), this, SLOT(report()));
+    }
+
+    int errors() const { return m_errors; }
+
+public Q_SLOTS:
+    void start()
+    {
+        m_clock.start();
+        m_reportTimer.start(1000);
+        QTimer::singleShot(m_options.duration * 1000, this, SLOT(stop()));
+        if (m_options.qps > 0) {
+            m_sendTimer.start(1);
+            return;
+        }
+
+        for (int i = 0; i < m_connections.size(); ++i) {
+            for (int j = 0; j < m_options.concurrency; ++j)
+                send(m_connections.at(i), m_clock.nsecsElapsed());
+        }
+    }
+
+    void stop()
+    {
+        if (m_stopping)
+            return;
+
+        // requests in flight are given a moment to complete
+        m_stopping = true;
+        m_sendTimer.stop();
+        m_duration = m_clock.nsecsElapsed();
+        if (m_pending.isEmpty())
+            finish();
+        else
+            QTimer::singleShot(2000, this, SLOT(finish()));
+    }
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    // open loop, latencies count from when a request was due rather than
+    // sent, so that a stalled client or server adds to them rather than
+    // holding the following requests back
+    void sendDue()
+    {
+        const qint64 now = m_clock.nsecsElapsed();
+        const qint64 due = qint64(now / 1e9 * m_options.qps);
+        while (m_sent < due) {
+            const qint64 scheduled = qint64(m_sent * 1e9 / m_options.qps);
+            send(m_connections.at(m_nextConnection), scheduled);
+            m_nextConnection = (m_nextConnection + 1) % m_connections.size();
+        }
+    }
+
+    void processResponse()
+    {
+        QJsonRpcServiceReply *reply = static_cast<QJsonRpcServiceReply *>(sender());
+        QHash<QJsonRpcServiceReply *, QPair<QJsonRpcAbstractSocket *, qint64> >::iterator it =
+            m_pending.find(reply);
+        if (it == m_pending.end())
+            return;
+
+        QJsonRpcAbstractSocket *connection = it.value().first;
+        const qint64 started = it.value().second;
+        m_pending.erase(it);
+        reply->deleteLater();
+        if (reply->response().type() == QJsonRpcMessage::Response)
+            complete(started, false);
+        else
+            complete(started, true);
+
+        if (m_stopping) {
+            if (m_pending.isEmpty())
+                finish();
+        } else if (m_options.qps <= 0) {
+            send(connection, m_clock.nsecsElapsed());
+        }
+    }
+
+    void report()
+    {
+        const qint64 now = m_clock.nsecsElapsed();
+        print(QString::number(qRound(now / 1e9)) + "s", now - m_lastReport,
+              m_intervalCompleted, m_intervalErrors, m_intervalLatencies);
+        m_lastReport = now;
+        m_intervalCompleted = 0;
+        m_intervalErrors = 0;
+        m_intervalLatencies.clear();
+    }
+
+    void finish()
+    {
+        if (!m_reportTimer.isActive())
+            return;
+
+        m_reportTimer.stop();
+        printf("\n");
+        print("total", m_duration, m_completed, m_errors, m_latencies);
+        if (!m_pending.isEmpty())
+            printf("%d requests unanswered\n", m_pending.size());
+        fflush(stdout);
+        Q_EMIT finished();
+    }
+
+private:
+    void send(QJsonRpcAbstractSocket *connection, qint64 scheduled)
+    {
+        m_sent++;
+        const QJsonValue params = expandTemplate(m_options.params);
+        if (m_options.notification) {
+            connection->notify(params.isObject() ?
+                QJsonRpcMessage::createNotification(m_options.method, params.toObject()) :
+                QJsonRpcMessage::createNotification(m_options.method, params.toArray()));
+            complete(scheduled, false);
+            return;
+        }
+
+        QJsonRpcMessage request = params.isObject() ?
+            QJsonRpcMessage::createRequest(m_options.method, params.toObject()) :
+            QJsonRpcMessage::createRequest(m_options.method, params.toArray());
+        QJsonRpcServiceReply *reply = connection->sendMessage(request);
+        if (!reply) {
+            complete(scheduled, true);
+            return;
+        }
+
+        m_pending.insert(reply, qMakePair(connection, scheduled));
+        connect(reply, SIGNAL(finished()), this, SLOT(processResponse()));
+    }
+
+    void complete(qint64 started, bool error)
+    {
+        const qint64 latency = (m_clock.nsecsElapsed() - started) / 1000;
+        m_completed++;
+        m_intervalCompleted++;
+        if (error) {
+            m_errors++;
+            m_intervalErrors++;
+        }
+        m_latencies.append(latency);
+        m_intervalLatencies.append(latency);
+    }
+
+    static qint64 percentile(const QVector<qint64> &sorted, double rank)
+    {
+        if (sorted.isEmpty())
+            return 0;
+        const int index = qBound(0, int(ceil(rank * sorted.size())) - 1, sorted.size() - 1);
+        return sorted.at(index);
+    }
+
+    void print(const QString &label, qint64 nsecs, int completed, int errors,
+               const QVector<qint64> &latencies) const
+    {
+        QVector<qint64> sorted = latencies;
+        qSort(sorted);
+        const double rate = nsecs > 0 ? completed * 1e9 / nsecs : 0;
+        printf("%-6s %9d done %6d errors %10.1f req/s   p50 %7lldus  p99 %7lldus  p999 %7lldus\n",
+               label.toLocal8Bit().constData(), completed, errors, rate,
+               (long long) percentile(sorted, 0.5), (long long) percentile(sorted, 0.99),
+               (long long) percentile(sorted, 0.999));
+        fflush(stdout);
+    }
+
+    QList<QJsonRpcAbstractSocket *> m_connections;
+    LoadOptions m_options;
+    int m_nextConnection;
+    QElapsedTimer m_clock;
+    QTimer m_sendTimer;
+    QTimer m_reportTimer;
+    QHash<QJsonRpcServiceReply *, QPair<QJsonRpcAbstractSocket *, qint64> > m_pending;
+    qint64 m_sent;
+    int m_completed;
+    int m_errors;
+    int m_intervalCompleted;
+    int m_intervalErrors;
+    QVector<qint64> m_latencies;            // in usecs
+    QVector<qint64> m_intervalLatencies;
+    qint64 m_lastReport;
+    qint64 m_duration;
+    bool m_stopping;
+};
+
+static QString takeOption(QStringList &args, const QString &name, const QString &defaultValue)
+{
+    const int index = args.indexOf(name);
+    if (index < 0 || index + 1 >= args.size())
+        return defaultValue;
+
+    args.removeAt(index);
+    return args.takeAt(index);
+}
 
 int main(int argc, char **argv)
 {
@@ -33,48 +375,71 @@ int main(int argc, char **argv)
     bool notification = args.contains("-n");
     if (notification)
         args.removeAll("-n");
+    bool load = args.contains("-load");
+    if (load)
+        args.removeAll("-load");
+
+    LoadOptions options;
+    options.notification = notification;
+    options.qps = takeOption(args, "-qps", "0").toDouble();
+    options.concurrency = qMax(1, takeOption(args, "-concurrency", "1").toInt());
+    options.duration = qMax(1, takeOption(args, "-duration", "10").toInt());
+    const int connectionCount = qMax(1, takeOption(args, "-connections", "1").toInt());
+    const QString paramsTemplate = takeOption(args, "-params", QString());
 
     if (args.size() < 2) {
         qDebug("usage: %s [-n] <service> <method> <arguments>", appName.toLocal8Bit().data());
+        qDebug("       %s -load [-n] [-qps rate | -concurrency requests] [-connections count]",
+               appName.toLocal8Bit().data());
+        qDebug("           [-duration seconds] [-params json] <service> <method> <arguments>");
+        qDebug("service is an http(s) URL, a host[:port] or the name of a local server");
+        qDebug("params strings {{int[:min:max]}}, {{double}}, {{bool}}, {{string[:length]}}");
+        qDebug("and {{uuid}} are replaced by random values for every request");
         return -1;
     }
 
-    // try to process socket
-    QIODevice *device = 0;
-    QScopedPointer<QIODevice> devicePtr(device);
     QString service = args.takeFirst();
-    QUrl serviceUrl = QUrl::fromUserInput(service);
-    QHostAddress serviceAddress(serviceUrl.host());
-    if (serviceAddress.isNull()) {
-        QLocalSocket *localSocket = new QLocalSocket;
-        device = localSocket;
-        localSocket->connectToServer(service);
-        if (!localSocket->waitForConnected(5000)) {
-            qDebug("could not connect to service: %s", service.toLocal8Bit().data());
-            return -1;
+    QString method = args.takeFirst();
+    QJsonArray arguments;
+    foreach (QString arg, args)
+        arguments.append(arg);
+
+    if (load) {
+        options.method = method;
+        options.params = arguments;
+        if (!paramsTemplate.isEmpty()) {
+            QJsonDocument document = QJsonDocument::fromJson(paramsTemplate.toUtf8());
+            if (document.isNull()) {
+                qDebug("params must be a JSON array or object");
+                return -1;
+            }
+            options.params = document.isObject() ? QJsonValue(document.object())
+                                                 : QJsonValue(document.array());
         }
-    } else {
-        QTcpSocket *tcpSocket = new QTcpSocket;
-        device = tcpSocket;
-        int servicePort = serviceUrl.port() ? serviceUrl.port() : 5555;
-        tcpSocket->connectToHost(serviceAddress, servicePort);
-        if (!tcpSocket->waitForConnected(5000)) {
-            qDebug("could not connect to host at %s:%d", serviceUrl.host().toLocal8Bit().data(),
-                   servicePort);
-            return -1;
+
+        QList<QJsonRpcAbstractSocket *> connections;
+        for (int i = 0; i < connectionCount; ++i) {
+            QJsonRpcAbstractSocket *connection = connectToService(service, &app);
+            if (!connection)
+                return -1;
+            connections.append(connection);
         }
+
+        LoadGenerator generator(connections, options);
+        QObject::connect(&generator, SIGNAL(finished()), &app, SLOT(quit()));
+        QTimer::singleShot(0, &generator, SLOT(start()));
+        app.exec();
+        return generator.errors() ? 1 : 0;
     }
 
-    QJsonRpcSocket socket(device);
-    QString method = args.takeFirst();
-    QVariantList arguments;
-    foreach (QString arg, args)
-        arguments.append(arg);
+    QScopedPointer<QJsonRpcAbstractSocket> socket(connectToService(service));
+    if (!socket)
+        return -1;
 
     QJsonRpcMessage request = notification ?
-        QJsonRpcMessage::createNotification(method, QJsonArray::fromVariantList(arguments)) :
-        QJsonRpcMessage::createRequest(method, QJsonArray::fromVariantList(arguments));
-    QJsonRpcMessage response = socket.sendMessageBlocking(request, 5000);
+        QJsonRpcMessage::createNotification(method, arguments) :
+        QJsonRpcMessage::createRequest(method, arguments);
+    QJsonRpcMessage response = socket->sendMessageBlocking(request, 5000);
     if (response.type() == QJsonRpcMessage::Error) {
         qDebug("error(%d): %s", response.errorCode(), response.errorMessage().toLocal8Bit().data());
         return -1;
@@ -82,3 +447,5 @@ int main(int argc, char **argv)
 
     qDebug() << response.result();
 }
+
+#include "qjsonrpc.moc"
@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QStringList>
+#include <QMutexLocker>
+#include <QVector>
+#include <QThread>
+#include <QTimer>
+#include <QFile>
+#include <QHash>
+#include <QDebug>
+
+#include <math.h>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonDocument>
+#else
+#include "json/qjsondocument.h"
+#endif
+
+#include "qjsonrpctcpserver.h"
+#include "qjsonrpclocalserver.h"
+#include "qjsonrpchttpserver.h"
+#include "qjsonrpchttpclient.h"
+#include "qjsonrpcsocket.h"
+#include "qjsonrpcservice.h"
+#include "qjsonrpcservicereply.h"
+
+// Runs one of the three servers on its own thread and drives it from
+// -concurrency clients on the main one, each keeping -pipeline messages in
+// flight. Requests are timed from being sent to their response arriving,
+// notifications from being sent to the service receiving them, against the
+// same clock. The result is printed as one JSON object, so that runs can be
+// collected and compared by scripts.
+
+// shared by both threads, read only once started
+static QElapsedTimer benchmarkClock;
+
+class LatencyRecorder : public QObject
+{
+    Q_OBJECT
+public:
+    LatencyRecorder(int expected, QObject *parent = 0)
+        : QObject(parent),
+          m_expected(expected),
+          m_errors(0),
+          m_lastSample(0)
+    {
+        m_samples.reserve(expected);
+    }
+
+    // called from either thread
+    void record(qint64 nsecs, bool error = false)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_samples.append(nsecs);
+        if (error)
+            m_errors++;
+        if (m_samples.size() == m_expected) {
+            m_lastSample = benchmarkClock.nsecsElapsed();
+            QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+        }
+    }
+
+    int count() const { QMutexLocker locker(&m_mutex); return m_samples.size(); }
+    int errors() const { QMutexLocker locker(&m_mutex); return m_errors; }
+    qint64 lastSample() const { QMutexLocker locker(&m_mutex); return m_lastSample; }
+
+    // nearest rank, in microseconds
+    QJsonObject percentiles() const
+    {
+        QMutexLocker locker(&m_mutex);
+        QVector<qint64> sorted = m_samples;
+        qSort(sorted);
+
+        QJsonObject result;
+        if (sorted.isEmpty())
+            return result;
+
+        static const struct { const char *name; double rank; } ranks[] = {
+            { "p50", 0.50 }, { "p99", 0.99 }, { "p999", 0.999 }
+        };
+        for (size_t i = 0; i < sizeof(ranks) / sizeof(ranks[0]); ++i) {
+            int index = int(ceil(ranks[i].rank * sorted.size())) - 1;
+            index = qBound(0, index, sorted.size() - 1);
+            result.insert(QLatin1String(ranks[i].name), sorted.at(index) / 1000.0);
+        }
+        result.insert(QLatin1String("min"), sorted.first() / 1000.0);
+        result.insert(QLatin1String("max"), sorted.last() / 1000.0);
+        return result;
+    }
+
+Q_SIGNALS:
+    void finished();
+
+private:
+    mutable QMutex m_mutex;
+    QVector<qint64> m_samples;
+    int m_expected;
+    int m_errors;
+    qint64 m_lastSample;
+};
+
+class BenchmarkService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "benchmark")
+public:
+    BenchmarkService(LatencyRecorder *recorder, QObject *parent = 0)
+        : QJsonRpcService(parent),
+          m_recorder(recorder)
+    {}
+
+public Q_SLOTS:
+    QString echo(const QString &payload) const { return payload; }
+
+    // sent as a notification, stamped by the client
+    void deliver(double sentAt, const QString &payload)
+    {
+        Q_UNUSED(payload)
+        m_recorder->record(benchmarkClock.nsecsElapsed() - qint64(sentAt));
+    }
+
+private:
+    LatencyRecorder *m_recorder;
+};
+
+// owns the server, created and destroyed on the server thread
+class ServerHost : public QObject
+{
+    Q_OBJECT
+public:
+    ServerHost(const QString &transport, LatencyRecorder *recorder)
+        : m_transport(transport),
+          m_recorder(recorder),
+          m_server(0)
+    {}
+
+    QString address() const { return m_address; }
+
+public Q_SLOTS:
+    bool start()
+    {
+        BenchmarkService *service = new BenchmarkService(m_recorder, this);
+        if (m_transport == QLatin1String("local")) {
+            QJsonRpcLocalServer *server = new QJsonRpcLocalServer(this);
+            m_address = QString("qjsonrpc-benchmark-%1").arg(QCoreApplication::applicationPid());
+            QLocalServer::removeServer(m_address);
+            server->addService(service);
+            m_server = server;
+            return server->listen(m_address);
+        }
+
+        QTcpServer *tcpServer = 0;
+        if (m_transport == QLatin1String("http")) {
+            QJsonRpcHttpServer *server = new QJsonRpcHttpServer(this);
+            server->addService(service);
+            tcpServer = server;
+        } else {
+            QJsonRpcTcpServer *server = new QJsonRpcTcpServer(this);
+            server->addService(service);
+            tcpServer = server;
+        }
+
+        m_server = tcpServer;
+        if (!tcpServer->listen(QHostAddress::LocalHost, 0))
+            return false;
+        m_address = QString::number(tcpServer->serverPort());
+        return true;
+    }
+
+    void stop()
+    {
+        delete m_server;
+        m_server = 0;
+    }
+
+private:
+    QString m_transport;
+    QString m_address;
+    LatencyRecorder *m_recorder;
+    QObject *m_server;
+};
+
+class BenchmarkClient : public QObject
+{
+    Q_OBJECT
+public:
+    BenchmarkClient(LatencyRecorder *recorder, QObject *parent = 0)
+        : QObject(parent),
+          m_recorder(recorder),
+          m_socket(0),
+          m_remaining(0),
+          m_pipeline(1),
+          m_notifications(false)
+    {}
+
+    bool connectTo(const QString &transport, const QString &address)
+    {
+        if (transport == QLatin1String("http")) {
+            m_socket = new QJsonRpcHttpClient(QString("http://127.0.0.1:%1").arg(address), this);
+            return true;
+        }
+
+        if (transport == QLatin1String("local")) {
+            QLocalSocket *device = new QLocalSocket(this);
+            device->connectToServer(address);
+            if (!device->waitForConnected()) {
+                qDebug() << "could not connect to server: " << device->errorString();
+                return false;
+            }
+            m_socket = new QJsonRpcSocket(device, this);
+            return true;
+        }
+
+        QTcpSocket *device = new QTcpSocket(this);
+        device->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        device->connectToHost(QHostAddress::LocalHost, address.toUShort());
+        if (!device->waitForConnected()) {
+            qDebug() << "could not connect to server: " << device->errorString();
+            return false;
+        }
+        m_socket = new QJsonRpcSocket(device, this);
+        return true;
+    }
+
+    void start(int count, int pipeline, bool notifications, const QString &payload)
+    {
+        m_remaining = count;
+        m_pipeline = pipeline;
+        m_notifications = notifications;
+        m_payload = payload;
+        if (m_notifications) {
+            sendNotifications();
+        } else {
+            for (int i = 0; i < m_pipeline && m_remaining > 0; ++i)
+                sendRequest();
+        }
+    }
+
+private Q_SLOTS:
+    // without responses to wait for, the window is how many are written
+    // before returning to the event loop
+    void sendNotifications()
+    {
+        for (int i = 0; i < m_pipeline && m_remaining > 0; ++i, --m_remaining) {
+            QJsonArray params;
+            params.append(double(benchmarkClock.nsecsElapsed()));
+            params.append(m_payload);
+            m_socket->notify(QJsonRpcMessage::createNotification("benchmark.deliver", params));
+        }
+
+        if (m_remaining > 0)
+            QTimer::singleShot(0, this, SLOT(sendNotifications()));
+    }
+
+    void processResponse()
+    {
+        QJsonRpcServiceReply *reply = static_cast<QJsonRpcServiceReply *>(sender());
+        const qint64 sentAt = m_sent.take(reply);
+        const bool error = reply->response().type() != QJsonRpcMessage::Response;
+        m_recorder->record(benchmarkClock.nsecsElapsed() - sentAt, error);
+        reply->deleteLater();
+
+        if (m_remaining > 0)
+            sendRequest();
+    }
+
+private:
+    void sendRequest()
+    {
+        m_remaining--;
+        const qint64 sentAt = benchmarkClock.nsecsElapsed();
+        QJsonRpcServiceReply *reply =
+            m_socket->sendMessage(QJsonRpcMessage::createRequest("benchmark.echo", m_payload));
+        if (!reply) {
+            m_recorder->record(0, true);
+            return;
+        }
+
+        m_sent.insert(reply, sentAt);
+        connect(reply, SIGNAL(finished()), this, SLOT(processResponse()));
+    }
+
+    LatencyRecorder *m_recorder;
+    QJsonRpcAbstractSocket *m_socket;
+    QHash<QJsonRpcServiceReply *, qint64> m_sent;
+    QString m_payload;
+    int m_remaining;
+    int m_pipeline;
+    bool m_notifications;
+};
+
+static QString option(const QStringList &arguments, const QString &name,
+                      const QString &defaultValue)
+{
+    const int index = arguments.indexOf(name);
+    if (index < 0 || index + 1 >= arguments.size())
+        return defaultValue;
+    return arguments.at(index + 1);
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    const QStringList arguments = app.arguments();
+    if (arguments.contains("-h") || arguments.contains("-help")) {
+        qDebug() << "usage: " << argv[0] << "[-transport tcp|local|http] [-payload bytes]"
+                 << "[-concurrency clients] [-pipeline depth] [-count messages]"
+                 << "[-notifications] [-timeout seconds] [-output file]";
+        return 0;
+    }
+
+    const QString transport = option(arguments, "-transport", "tcp");
+    const int payloadSize = qMax(0, option(arguments, "-payload", "64").toInt());
+    const int concurrency = qMax(1, option(arguments, "-concurrency", "1").toInt());
+    const int pipeline = qMax(1, option(arguments, "-pipeline", "1").toInt());
+    const int count = qMax(1, option(arguments, "-count", "10000").toInt());
+    const int timeout = qMax(1, option(arguments, "-timeout", "120").toInt());
+    const bool notifications = arguments.contains("-notifications");
+    const QString output = option(arguments, "-output", QString());
+    if (transport != "tcp" && transport != "local" && transport != "http") {
+        qDebug() << "unknown transport: " << transport;
+        return -1;
+    }
+
+    // rounded up so that every client sends the same share
+    const int share = (count + concurrency - 1) / concurrency;
+    const int total = share * concurrency;
+    benchmarkClock.start();
+    LatencyRecorder recorder(total);
+
+    QThread serverThread;
+    ServerHost host(transport, &recorder);
+    host.moveToThread(&serverThread);
+    serverThread.start();
+
+    bool listening = false;
+    QMetaObject::invokeMethod(&host, "start", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, listening));
+    if (!listening) {
+        qDebug() << "could not start the" << transport << "server";
+        serverThread.quit();
+        serverThread.wait();
+        return -1;
+    }
+
+    QList<BenchmarkClient *> clients;
+    for (int i = 0; i < concurrency; ++i) {
+        BenchmarkClient *client = new BenchmarkClient(&recorder, &app);
+        if (!client->connectTo(transport, host.address()))
+            return -1;
+        clients.append(client);
+    }
+
+    QEventLoop loop;
+    QObject::connect(&recorder, SIGNAL(finished()), &loop, SLOT(quit()));
+    QTimer::singleShot(timeout * 1000, &loop, SLOT(quit()));
+
+    const QString payload(payloadSize, QLatin1Char('x'));
+    const qint64 started = benchmarkClock.nsecsElapsed();
+    foreach (BenchmarkClient *client, clients)
+        client->start(share, pipeline, notifications, payload);
+    loop.exec();
+
+    const bool complete = recorder.count() == total;
+    const qint64 elapsed = (complete ? recorder.lastSample() : benchmarkClock.nsecsElapsed()) - started;
+
+    qDeleteAll(clients);
+    QMetaObject::invokeMethod(&host, "stop", Qt::BlockingQueuedConnection);
+    serverThread.quit();
+    serverThread.wait();
+
+    QJsonObject result;
+    result.insert("transport", transport);
+    result.insert("flow", notifications ? QLatin1String("notification") : QLatin1String("request"));
+    result.insert("payload", payloadSize);
+    result.insert("concurrency", concurrency);
+    result.insert("pipeline", pipeline);
+    result.insert("messages", recorder.count());
+    result.insert("expected", total);
+    result.insert("errors", recorder.errors());
+    result.insert("complete", complete);
+    result.insert("elapsed", elapsed / 1000000.0);
+    result.insert("throughput", elapsed > 0 ? recorder.count() * 1e9 / elapsed : 0.0);
+    result.insert("latency", recorder.percentiles());
+    result.insert("qt", QLatin1String(qVersion()));
+
+    const QByteArray json = QJsonDocument(result).toJson();
+    if (output.isEmpty()) {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    } else {
+        QFile out(output);
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            qDebug() << "could not open" << output << ": " << out.errorString();
+            return -1;
+        }
+        out.write(json);
+    }
+
+    return complete ? 0 : 1;
+}
+
+#include "main.moc"
@@ -0,0 +1,9 @@
+DEPTH = ../../..
+include($${DEPTH}/qjsonrpc.pri)
+include($${DEPTH}/tests/tests.pri)
+CONFIG -= testcase
+
+TEMPLATE = app
+TARGET = transportbenchmark
+SOURCES = \
+    main.cpp
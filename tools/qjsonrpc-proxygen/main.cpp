@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFileInfo>
+#include <QFile>
+#include <QTextStream>
+#include <QRegExp>
+
+#include <cstdio>
+
+// Reads the declarations of QJsonRpcService subclasses the way moc does,
+// without a preprocessor: comments and directives are dropped, and the
+// public slots of each class are turned into the methods of a
+// QJsonRpcProxy subclass named after it.
+
+struct Parameter
+{
+    QString type;           // as declared
+    QString valueType;      // without const and reference, for the converter
+    QString name;
+    QString defaultValue;
+};
+
+struct Method
+{
+    QString returnType;
+    QString name;
+    QList<Parameter> parameters;
+};
+
+struct Service
+{
+    QString className;
+    QString serviceName;
+    QList<Method> methods;
+    QStringList skipped;
+};
+
+static QString stripComments(const QString &source)
+{
+    QString result;
+    result.reserve(source.size());
+    int i = 0;
+    while (i < source.size()) {
+        const QChar c = source.at(i);
+        const QChar next = i + 1 < source.size() ? source.at(i + 1) : QChar();
+        if (c == QLatin1Char('/') && next == QLatin1Char('/')) {
+            while (i < source.size() && source.at(i) != QLatin1Char('\n'))
+                ++i;
+        } else if (c == QLatin1Char('/') && next == QLatin1Char('*')) {
+            i += 2;
+            while (i + 1 < source.size() &&
+                   !(source.at(i) == QLatin1Char('*') && source.at(i + 1) == QLatin1Char('/')))
+                ++i;
+            i += 2;
+            result += QLatin1Char(' ');
+        } else if (c == QLatin1Char('"') || c == QLatin1Char('\'')) {
+            // literals are kept as they are, they may hold a serviceName
+            result += c;
+            ++i;
+            while (i < source.size() && source.at(i) != c) {
+                if (source.at(i) == QLatin1Char('\\') && i + 1 < source.size())
+                    result += source.at(i++);
+                result += source.at(i++);
+            }
+            if (i < source.size())
+                result += source.at(i++);
+        } else {
+            result += c;
+            ++i;
+        }
+    }
+
+    // directives, with their continuation lines
+    QStringList lines = result.split(QLatin1Char('\n'));
+    bool continued = false;
+    for (int j = 0; j < lines.size(); ++j) {
+        const bool directive = continued || lines.at(j).trimmed().startsWith(QLatin1Char('#'));
+        continued = directive && lines.at(j).endsWith(QLatin1Char('\\'));
+        if (directive)
+            lines[j].clear();
+    }
+
+    return lines.join(QLatin1String("\n"));
+}
+
+static int matchingBracket(const QString &text, int open)
+{
+    const QChar opening = text.at(open);
+    const QChar closing = opening == QLatin1Char('{') ? QLatin1Char('}') :
+                          opening == QLatin1Char('(') ? QLatin1Char(')') : QLatin1Char('>');
+    int depth = 0;
+    for (int i = open; i < text.size(); ++i) {
+        if (text.at(i) == opening) {
+            depth++;
+        } else if (text.at(i) == closing) {
+            if (--depth == 0)
+                return i;
+        }
+    }
+
+    return -1;
+}
+
+// splits at separators outside of brackets and template arguments
+static QStringList splitTopLevel(const QString &text, QChar separator)
+{
+    QStringList parts;
+    int depth = 0;
+    int start = 0;
+    for (int i = 0; i < text.size(); ++i) {
+        const QChar c = text.at(i);
+        if (c == QLatin1Char('(') || c == QLatin1Char('<') || c == QLatin1Char('{') || c == QLatin1Char('['))
+            depth++;
+        else if (c == QLatin1Char(')') || c == QLatin1Char('>') || c == QLatin1Char('}') || c == QLatin1Char(']'))
+            depth--;
+        else if (c == separator && depth == 0) {
+            parts.append(text.mid(start, i - start));
+            start = i + 1;
+        }
+    }
+
+    parts.append(text.mid(start));
+    return parts;
+}
+
+static QString valueType(QString type)
+{
+    type = type.simplified();
+    if (type.startsWith(QLatin1String("const ")))
+        type = type.mid(6);
+    if (type.endsWith(QLatin1Char('&')))
+        type.chop(1);
+    type = type.trimmed();
+    if (type.endsWith(QLatin1String(" const")))
+        type.chop(6);
+    return type.trimmed();
+}
+
+static bool parseParameter(const QString &text, int index, Parameter *parameter, QString *error)
+{
+    QStringList parts = splitTopLevel(text, QLatin1Char('='));
+    QString declaration = parts.takeFirst().simplified();
+    if (!parts.isEmpty())
+        parameter->defaultValue = parts.join(QLatin1String("=")).trimmed();
+
+    // the name is the last identifier, unless that is all there is to the type
+    static const QStringList typeWords = QStringList() << "const" << "unsigned" << "signed"
+                                                       << "long" << "short" << "int" << "char"
+                                                       << "bool" << "double" << "float";
+    QRegExp named(QLatin1String("^(.*[\\s&*])(\\w+)$"));
+    if (named.exactMatch(declaration) && !typeWords.contains(named.cap(2)) &&
+        !valueType(named.cap(1)).isEmpty()) {
+        parameter->type = named.cap(1).trimmed();
+        parameter->name = named.cap(2);
+    } else {
+        parameter->type = declaration;
+        parameter->name = QString::fromLatin1("arg%1").arg(index + 1);
+    }
+
+    if (parameter->type.contains(QLatin1Char('&')) &&
+        !parameter->type.startsWith(QLatin1String("const "))) {
+        *error = QLatin1String("has output parameters");
+        return false;
+    }
+
+    if (parameter->type.contains(QLatin1Char('*'))) {
+        *error = QLatin1String("takes pointers");
+        return false;
+    }
+
+    parameter->valueType = valueType(parameter->type);
+    return true;
+}
+
+static bool parseMethod(const QString &className, const QString &declaration, Method *method,
+                        QString *error)
+{
+    const int open = declaration.indexOf(QLatin1Char('('));
+    if (open < 0)
+        return false;
+    const int close = matchingBracket(declaration, open);
+    if (close < 0)
+        return false;
+
+    QStringList prefix = declaration.left(open).simplified().split(QLatin1Char(' '));
+    if (prefix.isEmpty())
+        return false;
+    method->name = prefix.takeLast();
+    if (method->name == className || method->name.startsWith(QLatin1Char('~')) ||
+        method->name.startsWith(QLatin1String("operator")))
+        return false;
+
+    static const QStringList specifiers = QStringList() << "virtual" << "static" << "inline"
+                                                        << "explicit" << "Q_INVOKABLE" << "Q_SCRIPTABLE";
+    for (int i = prefix.size() - 1; i >= 0; --i) {
+        if (specifiers.contains(prefix.at(i)))
+            prefix.removeAt(i);
+    }
+
+    method->returnType = valueType(prefix.join(QLatin1String(" ")));
+    if (method->returnType.isEmpty())
+        return false;
+    if (method->returnType.startsWith(QLatin1String("QFuture<")))
+        method->returnType = QLatin1String("QVariant");     // delayed results of any type
+    if (method->returnType.contains(QLatin1Char('*'))) {
+        *error = QLatin1String("returns a pointer");
+        return false;
+    }
+
+    const QString arguments = declaration.mid(open + 1, close - open - 1).trimmed();
+    if (arguments.isEmpty() || arguments == QLatin1String("void"))
+        return true;
+
+    const QStringList parts = splitTopLevel(arguments, QLatin1Char(','));
+    for (int i = 0; i < parts.size(); ++i) {
+        Parameter parameter;
+        if (!parseParameter(parts.at(i), i, &parameter, error))
+            return false;
+        method->parameters.append(parameter);
+    }
+
+    return true;
+}
+
+static void parseClassBody(const QString &body, Service *service)
+{
+    QRegExp access(QLatin1String("^(public|protected|private|Q_SIGNALS|signals)"
+                                 "(\\s+(Q_SLOTS|slots))?$"));
+    bool inSlots = false;
+    QString statement;
+    for (int i = 0; i < body.size(); ++i) {
+        const QChar c = body.at(i);
+        if (c == QLatin1Char(':') && (i + 1 >= body.size() || body.at(i + 1) != QLatin1Char(':')) &&
+            (i == 0 || body.at(i - 1) != QLatin1Char(':')) && access.exactMatch(statement.simplified())) {
+            inSlots = access.cap(1) == QLatin1String("public") && !access.cap(3).isEmpty();
+            statement.clear();
+            continue;
+        }
+
+        if (c != QLatin1Char(';') && c != QLatin1Char('{')) {
+            statement += c;
+            continue;
+        }
+
+        if (c == QLatin1Char('{')) {
+            // an inline body, or that of a nested type
+            const int close = matchingBracket(body, i);
+            if (close < 0)
+                break;
+            i = close;
+        }
+
+        const QString declaration = statement.simplified();
+        statement.clear();
+        if (!inSlots || declaration.isEmpty())
+            continue;
+        if (declaration.startsWith(QLatin1String("friend ")) ||
+            declaration.startsWith(QLatin1String("typedef ")) ||
+            declaration.startsWith(QLatin1String("using ")) ||
+            declaration.startsWith(QLatin1String("enum ")) ||
+            declaration.startsWith(QLatin1String("class ")) ||
+            declaration.startsWith(QLatin1String("struct ")) ||
+            declaration.startsWith(QLatin1String("template")))
+            continue;
+
+        Method method;
+        QString error;
+        if (parseMethod(service->className, declaration, &method, &error))
+            service->methods.append(method);
+        else if (!error.isEmpty())
+            service->skipped.append(method.name + QLatin1String(" ") + error);
+    }
+}
+
+static QList<Service> parseServices(const QString &source)
+{
+    QList<Service> services;
+    QRegExp classHead(QLatin1String("\\bclass\\s+(?:\\w+\\s+)?(\\w+)\\s*:([^{;]*)\\{"));
+    int position = 0;
+    while ((position = classHead.indexIn(source, position)) != -1) {
+        const int open = position + classHead.matchedLength() - 1;
+        const int close = matchingBracket(source, open);
+        if (close < 0)
+            break;
+        position = close;
+        if (!classHead.cap(2).contains(QRegExp(QLatin1String("\\bQJsonRpcService\\b"))))
+            continue;
+
+        Service service;
+        service.className = classHead.cap(1);
+        QString body = source.mid(open + 1, close - open - 1);
+
+        QRegExp serviceName(QLatin1String("Q_CLASSINFO\\s*\\(\\s*\"serviceName\"\\s*,\\s*\"([^\"]*)\"\\s*\\)"));
+        service.serviceName = serviceName.indexIn(body) != -1 ? serviceName.cap(1) :
+                                                                service.className.toLower();
+
+        // macros that end without a semicolon
+        body.remove(QRegExp(QLatin1String("\\bQ_(OBJECT|GADGET)\\b")));
+        body.remove(QRegExp(QLatin1String("\\bQ_[A-Z_]+\\s*\\([^\\n]*\\)\\s*(?=\\n)")));
+        parseClassBody(body, &service);
+        services.append(service);
+    }
+
+    return services;
+}
+
+static QString generate(const QList<Service> &services, const QString &input, const QStringList &includes)
+{
+    QString guard = QFileInfo(input).fileName().toUpper();
+    guard.replace(QRegExp(QLatin1String("[^A-Z0-9]")), QLatin1String("_"));
+    guard += QLatin1String("_PROXY_H");
+
+    QString output;
+    QTextStream out(&output);
+    out << "// Generated by qjsonrpc-proxygen from " << QFileInfo(input).fileName() << ", do not edit.\n"
+        << "#ifndef " << guard << "\n"
+        << "#define " << guard << "\n\n"
+        << "#include \"qjsonrpcproxy.h\"\n";
+    foreach (const QString &include, includes)
+        out << "#include \"" << include << "\"\n";
+
+    foreach (const Service &service, services) {
+        const QString proxy = service.className + QLatin1String("Proxy");
+        out << "\nclass " << proxy << " : public QJsonRpcProxy\n"
+            << "{\n"
+            << "public:\n"
+            << "    explicit " << proxy << "(QJsonRpcAbstractSocket *socket = 0)\n"
+            << "        : QJsonRpcProxy(socket), m_timeout(DEFAULT_MSECS_REQUEST_TIMEOUT) {}\n\n"
+            << "    // of the blocking calls\n"
+            << "    int timeout() const { return m_timeout; }\n"
+            << "    void setTimeout(int msecs) { m_timeout = msecs; }\n";
+
+        foreach (const QString &skipped, service.skipped)
+            out << "\n    // skipped " << skipped << "\n";
+
+        foreach (const Method &method, service.methods) {
+            QStringList declared;
+            QStringList appended;
+            foreach (const Parameter &parameter, method.parameters) {
+                QString declaration = parameter.type + QLatin1Char(' ') + parameter.name;
+                if (!parameter.defaultValue.isEmpty())
+                    declaration += QLatin1String(" = ") + parameter.defaultValue;
+                declared.append(declaration);
+                appended.append(QString::fromLatin1("        params.append(QJsonRpcParamConverter<%1 >::toJson(%2));\n")
+                                .arg(parameter.valueType, parameter.name));
+            }
+
+            const QString signature = declared.join(QLatin1String(", "));
+            const QString prologue =
+                QString::fromLatin1("        static const QString method = QLatin1String(\"%1.%2\");\n"
+                                    "        QJsonArray params;\n").arg(service.serviceName, method.name) +
+                appended.join(QString());
+
+            out << "\n    QJsonRpcResult<" << method.returnType << " > " << method.name
+                << "(" << signature << ") const\n"
+                << "    {\n" << prologue
+                << "        return QJsonRpcResult<" << method.returnType
+                << " >(sendRequestBlocking(method, params, m_timeout));\n"
+                << "    }\n\n"
+                << "    QJsonRpcServiceReply *" << method.name << "Async(" << signature << ") const\n"
+                << "    {\n" << prologue
+                << "        return sendRequest(method, params);\n"
+                << "    }\n";
+        }
+
+        out << "\nprivate:\n"
+            << "    int m_timeout;\n"
+            << "};\n";
+    }
+
+    out << "\n#endif\n";
+    out.flush();
+    return output;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QString appName = args.takeFirst();
+
+    QString outputFile;
+    QStringList includes;
+    QString inputFile;
+    while (!args.isEmpty()) {
+        const QString arg = args.takeFirst();
+        if (arg == QLatin1String("-o") && !args.isEmpty())
+            outputFile = args.takeFirst();
+        else if (arg == QLatin1String("-i") && !args.isEmpty())
+            includes.append(args.takeFirst());
+        else
+            inputFile = arg;
+    }
+
+    if (inputFile.isEmpty()) {
+        fprintf(stderr, "usage: %s [-o <output>] [-i <include>]... <service header>\n",
+                appName.toLocal8Bit().data());
+        return -1;
+    }
+
+    QFile input(inputFile);
+    if (!input.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        fprintf(stderr, "%s: cannot read %s\n", appName.toLocal8Bit().data(),
+                inputFile.toLocal8Bit().data());
+        return -1;
+    }
+
+    const QList<Service> services = parseServices(stripComments(QString::fromUtf8(input.readAll())));
+    if (services.isEmpty()) {
+        fprintf(stderr, "%s: no QJsonRpcService subclass in %s\n", appName.toLocal8Bit().data(),
+                inputFile.toLocal8Bit().data());
+        return -1;
+    }
+
+    foreach (const Service &service, services) {
+        foreach (const QString &skipped, service.skipped)
+            fprintf(stderr, "%s: %s::%s, skipped\n", appName.toLocal8Bit().data(),
+                    service.className.toLocal8Bit().data(), skipped.toLocal8Bit().data());
+    }
+
+    const QByteArray generated = generate(services, inputFile, includes).toUtf8();
+    if (outputFile.isEmpty()) {
+        fwrite(generated.constData(), 1, generated.size(), stdout);
+        return 0;
+    }
+
+    QFile output(outputFile);
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate) || output.write(generated) != generated.size()) {
+        fprintf(stderr, "%s: cannot write %s\n", appName.toLocal8Bit().data(),
+                outputFile.toLocal8Bit().data());
+        return -1;
+    }
+
+    return 0;
+}
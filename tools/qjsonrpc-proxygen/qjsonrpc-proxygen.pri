@@ -0,0 +1,17 @@
+# Writes a typed client stub, <header>_proxy.h, for each QJsonRpcService
+# header listed in JSONRPC_PROXIES:
+#
+#     JSONRPC_PROXIES += calculatorservice.h
+#     include(path/to/qjsonrpc-proxygen.pri)
+#
+# QJSONRPC_PROXYGEN overrides the generator to run, the installed one by
+# default.
+isEmpty(QJSONRPC_PROXYGEN): QJSONRPC_PROXYGEN = qjsonrpc-proxygen
+
+qjsonrpc_proxygen.input = JSONRPC_PROXIES
+qjsonrpc_proxygen.output = ${QMAKE_FILE_BASE}_proxy.h
+qjsonrpc_proxygen.commands = $${QJSONRPC_PROXYGEN} -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_NAME}
+qjsonrpc_proxygen.variable_out = GENERATED_FILES
+qjsonrpc_proxygen.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += qjsonrpc_proxygen
+INCLUDEPATH += $${OUT_PWD}
@@ -0,0 +1,12 @@
+DEPTH = ../..
+include($${DEPTH}/qjsonrpc.pri)
+
+TEMPLATE = app
+TARGET = qjsonrpc-proxygen
+QT = core
+CONFIG += console
+CONFIG -= app_bundle
+SOURCES = main.cpp
+
+target.path = $${PREFIX}/bin
+INSTALLS += target